@@ -0,0 +1,11 @@
+file(REMOVE_RECURSE
+  "CMakeFiles/fatelf-ar.dir/utils/fatelf-ar.c.o"
+  "CMakeFiles/fatelf-ar.dir/utils/fatelf-ar.c.o.d"
+  "fatelf-ar"
+  "fatelf-ar.pdb"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang C)
+  include(CMakeFiles/fatelf-ar.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
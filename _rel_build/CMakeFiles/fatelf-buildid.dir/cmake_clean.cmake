@@ -0,0 +1,11 @@
+file(REMOVE_RECURSE
+  "CMakeFiles/fatelf-buildid.dir/utils/fatelf-buildid.c.o"
+  "CMakeFiles/fatelf-buildid.dir/utils/fatelf-buildid.c.o.d"
+  "fatelf-buildid"
+  "fatelf-buildid.pdb"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang C)
+  include(CMakeFiles/fatelf-buildid.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
@@ -0,0 +1,11 @@
+file(REMOVE_RECURSE
+  "CMakeFiles/fatelf-cc.dir/utils/fatelf-cc.c.o"
+  "CMakeFiles/fatelf-cc.dir/utils/fatelf-cc.c.o.d"
+  "fatelf-cc"
+  "fatelf-cc.pdb"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang C)
+  include(CMakeFiles/fatelf-cc.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
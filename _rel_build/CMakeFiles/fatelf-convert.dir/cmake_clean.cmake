@@ -0,0 +1,11 @@
+file(REMOVE_RECURSE
+  "CMakeFiles/fatelf-convert.dir/utils/fatelf-convert.c.o"
+  "CMakeFiles/fatelf-convert.dir/utils/fatelf-convert.c.o.d"
+  "fatelf-convert"
+  "fatelf-convert.pdb"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang C)
+  include(CMakeFiles/fatelf-convert.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
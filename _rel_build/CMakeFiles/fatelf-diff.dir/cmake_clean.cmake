@@ -0,0 +1,11 @@
+file(REMOVE_RECURSE
+  "CMakeFiles/fatelf-diff.dir/utils/fatelf-diff.c.o"
+  "CMakeFiles/fatelf-diff.dir/utils/fatelf-diff.c.o.d"
+  "fatelf-diff"
+  "fatelf-diff.pdb"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang C)
+  include(CMakeFiles/fatelf-diff.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
@@ -0,0 +1,11 @@
+file(REMOVE_RECURSE
+  "CMakeFiles/fatelf-edit.dir/utils/fatelf-edit.c.o"
+  "CMakeFiles/fatelf-edit.dir/utils/fatelf-edit.c.o.d"
+  "fatelf-edit"
+  "fatelf-edit.pdb"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang C)
+  include(CMakeFiles/fatelf-edit.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
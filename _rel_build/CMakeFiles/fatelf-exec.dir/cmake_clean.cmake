@@ -0,0 +1,11 @@
+file(REMOVE_RECURSE
+  "CMakeFiles/fatelf-exec.dir/utils/fatelf-exec.c.o"
+  "CMakeFiles/fatelf-exec.dir/utils/fatelf-exec.c.o.d"
+  "fatelf-exec"
+  "fatelf-exec.pdb"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang C)
+  include(CMakeFiles/fatelf-exec.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
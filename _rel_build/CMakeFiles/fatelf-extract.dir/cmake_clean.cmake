@@ -0,0 +1,11 @@
+file(REMOVE_RECURSE
+  "CMakeFiles/fatelf-extract.dir/utils/fatelf-extract.c.o"
+  "CMakeFiles/fatelf-extract.dir/utils/fatelf-extract.c.o.d"
+  "fatelf-extract"
+  "fatelf-extract.pdb"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang C)
+  include(CMakeFiles/fatelf-extract.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
@@ -0,0 +1,11 @@
+file(REMOVE_RECURSE
+  "CMakeFiles/fatelf-fetch.dir/utils/fatelf-fetch.c.o"
+  "CMakeFiles/fatelf-fetch.dir/utils/fatelf-fetch.c.o.d"
+  "fatelf-fetch"
+  "fatelf-fetch.pdb"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang C)
+  include(CMakeFiles/fatelf-fetch.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
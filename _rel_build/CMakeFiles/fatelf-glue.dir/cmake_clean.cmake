@@ -0,0 +1,11 @@
+file(REMOVE_RECURSE
+  "CMakeFiles/fatelf-glue.dir/utils/fatelf-glue.c.o"
+  "CMakeFiles/fatelf-glue.dir/utils/fatelf-glue.c.o.d"
+  "fatelf-glue"
+  "fatelf-glue.pdb"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang C)
+  include(CMakeFiles/fatelf-glue.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
@@ -0,0 +1,11 @@
+file(REMOVE_RECURSE
+  "CMakeFiles/fatelf-info.dir/utils/fatelf-info.c.o"
+  "CMakeFiles/fatelf-info.dir/utils/fatelf-info.c.o.d"
+  "fatelf-info"
+  "fatelf-info.pdb"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang C)
+  include(CMakeFiles/fatelf-info.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
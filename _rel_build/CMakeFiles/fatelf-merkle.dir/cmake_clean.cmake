@@ -0,0 +1,11 @@
+file(REMOVE_RECURSE
+  "CMakeFiles/fatelf-merkle.dir/utils/fatelf-merkle.c.o"
+  "CMakeFiles/fatelf-merkle.dir/utils/fatelf-merkle.c.o.d"
+  "fatelf-merkle"
+  "fatelf-merkle.pdb"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang C)
+  include(CMakeFiles/fatelf-merkle.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
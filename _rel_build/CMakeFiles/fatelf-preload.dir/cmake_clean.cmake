@@ -0,0 +1,11 @@
+file(REMOVE_RECURSE
+  "CMakeFiles/fatelf-preload.dir/utils/fatelf-preload.c.o"
+  "CMakeFiles/fatelf-preload.dir/utils/fatelf-preload.c.o.d"
+  "libfatelf-preload.pdb"
+  "libfatelf-preload.so"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang C)
+  include(CMakeFiles/fatelf-preload.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
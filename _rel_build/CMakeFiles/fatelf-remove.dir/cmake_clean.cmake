@@ -0,0 +1,11 @@
+file(REMOVE_RECURSE
+  "CMakeFiles/fatelf-remove.dir/utils/fatelf-remove.c.o"
+  "CMakeFiles/fatelf-remove.dir/utils/fatelf-remove.c.o.d"
+  "fatelf-remove"
+  "fatelf-remove.pdb"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang C)
+  include(CMakeFiles/fatelf-remove.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
@@ -0,0 +1,11 @@
+file(REMOVE_RECURSE
+  "CMakeFiles/fatelf-replace.dir/utils/fatelf-replace.c.o"
+  "CMakeFiles/fatelf-replace.dir/utils/fatelf-replace.c.o.d"
+  "fatelf-replace"
+  "fatelf-replace.pdb"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang C)
+  include(CMakeFiles/fatelf-replace.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
@@ -0,0 +1,11 @@
+file(REMOVE_RECURSE
+  "CMakeFiles/fatelf-resource.dir/utils/fatelf-resource.c.o"
+  "CMakeFiles/fatelf-resource.dir/utils/fatelf-resource.c.o.d"
+  "fatelf-resource"
+  "fatelf-resource.pdb"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang C)
+  include(CMakeFiles/fatelf-resource.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
@@ -0,0 +1,11 @@
+file(REMOVE_RECURSE
+  "CMakeFiles/fatelf-serve.dir/utils/fatelf-serve.c.o"
+  "CMakeFiles/fatelf-serve.dir/utils/fatelf-serve.c.o.d"
+  "fatelf-serve"
+  "fatelf-serve.pdb"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang C)
+  include(CMakeFiles/fatelf-serve.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
@@ -0,0 +1,11 @@
+file(REMOVE_RECURSE
+  "CMakeFiles/fatelf-split.dir/utils/fatelf-split.c.o"
+  "CMakeFiles/fatelf-split.dir/utils/fatelf-split.c.o.d"
+  "fatelf-split"
+  "fatelf-split.pdb"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang C)
+  include(CMakeFiles/fatelf-split.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
@@ -0,0 +1,11 @@
+file(REMOVE_RECURSE
+  "CMakeFiles/fatelf-symbols.dir/utils/fatelf-symbols.c.o"
+  "CMakeFiles/fatelf-symbols.dir/utils/fatelf-symbols.c.o.d"
+  "fatelf-symbols"
+  "fatelf-symbols.pdb"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang C)
+  include(CMakeFiles/fatelf-symbols.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
@@ -0,0 +1,11 @@
+file(REMOVE_RECURSE
+  "CMakeFiles/fatelf-tar.dir/utils/fatelf-tar.c.o"
+  "CMakeFiles/fatelf-tar.dir/utils/fatelf-tar.c.o.d"
+  "fatelf-tar"
+  "fatelf-tar.pdb"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang C)
+  include(CMakeFiles/fatelf-tar.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
@@ -0,0 +1,11 @@
+file(REMOVE_RECURSE
+  "CMakeFiles/fatelf-thin-tree.dir/utils/fatelf-thin-tree.c.o"
+  "CMakeFiles/fatelf-thin-tree.dir/utils/fatelf-thin-tree.c.o.d"
+  "fatelf-thin-tree"
+  "fatelf-thin-tree.pdb"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang C)
+  include(CMakeFiles/fatelf-thin-tree.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
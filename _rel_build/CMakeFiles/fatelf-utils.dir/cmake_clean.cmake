@@ -0,0 +1,11 @@
+file(REMOVE_RECURSE
+  "CMakeFiles/fatelf-utils.dir/utils/fatelf-utils.c.o"
+  "CMakeFiles/fatelf-utils.dir/utils/fatelf-utils.c.o.d"
+  "libfatelf-utils.a"
+  "libfatelf-utils.pdb"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang C)
+  include(CMakeFiles/fatelf-utils.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
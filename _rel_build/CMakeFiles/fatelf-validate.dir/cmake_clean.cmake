@@ -0,0 +1,11 @@
+file(REMOVE_RECURSE
+  "CMakeFiles/fatelf-validate.dir/utils/fatelf-validate.c.o"
+  "CMakeFiles/fatelf-validate.dir/utils/fatelf-validate.c.o.d"
+  "fatelf-validate"
+  "fatelf-validate.pdb"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang C)
+  include(CMakeFiles/fatelf-validate.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
@@ -0,0 +1,11 @@
+file(REMOVE_RECURSE
+  "CMakeFiles/fatelf-verify.dir/utils/fatelf-verify.c.o"
+  "CMakeFiles/fatelf-verify.dir/utils/fatelf-verify.c.o.d"
+  "fatelf-verify"
+  "fatelf-verify.pdb"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang C)
+  include(CMakeFiles/fatelf-verify.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
@@ -0,0 +1,11 @@
+file(REMOVE_RECURSE
+  "CMakeFiles/fatelf-watchd.dir/utils/fatelf-watchd.c.o"
+  "CMakeFiles/fatelf-watchd.dir/utils/fatelf-watchd.c.o.d"
+  "fatelf-watchd"
+  "fatelf-watchd.pdb"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang C)
+  include(CMakeFiles/fatelf-watchd.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
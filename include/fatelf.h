@@ -13,10 +13,24 @@
 
 /* This is little endian on disk, and looks like "FA700E1F" in a hex editor. */
 #define FATELF_MAGIC (0x1F0E70FA)
-#define FATELF_FORMAT_VERSION (1)
+#define FATELF_FORMAT_VERSION (2)
 
-/* This does not count padding for page alignment at the end. */
+/* Version 1 is what the system patches understand, so tools should write it
+   unless they need something only version 2 offers (more than 255 records).
+   Version 2 also requires records to be sorted; see the specification. */
+#define FATELF_FORMAT_VERSION_1 (1)
+#define FATELF_FORMAT_VERSION_2 (2)
+#define FATELF_MAX_RECORDS_V1 (0xFF)
+#define FATELF_MAX_RECORDS_V2 (0xFFFFFFFF)
+
+/* These do not count padding for page alignment at the end. */
 #define FATELF_DISK_FORMAT_SIZE(bins) (8 + (24 * (bins)))
+#define FATELF_DISK_FORMAT_SIZE_V2(bins) (16 + (24 * ((uint64_t) (bins))))
+
+/* FATELF_record::isa_level values depend on the machine; zero is always
+   the baseline ISA. For x86_64, 2 through 4 are x86-64-v2 through v4. For
+   aarch64, 1 through 5 are armv8.1-a through armv8.5-a. */
+#define FATELF_ISA_BASELINE (0)
 
 /* Valid FATELF_record::word_size values... */
 #define FATELF_32BITS (1)
@@ -34,22 +48,57 @@ typedef struct FATELF_record
     uint8_t osabi_version;  /* maps to e_ident[EI_ABIVERSION]. */
     uint8_t word_size;      /* maps to e_ident[EI_CLASS]. */
     uint8_t byte_order;     /* maps to e_ident[EI_DATA]. */
-    uint8_t reserved0;
+    uint8_t isa_level;      /* version 2 and later, zero in version 1. */
     uint8_t reserved1;
     uint64_t offset;
     uint64_t size;
 } FATELF_record;
 
-/* Values on disk are always littleendian, and align like Elf64. */
+/* Values on disk are always littleendian, and align like Elf64. This is
+   the header as it sits in memory, for any version: on disk, version 1 has
+   an 8-bit num_records and an 8-bit reserved0, and no reserved1. */
 typedef struct FATELF_header
 {
     uint32_t magic;  /* always FATELF_MAGIC */
     uint16_t version; /* latest is always FATELF_FORMAT_VERSION */
-    uint8_t num_records;
-    uint8_t reserved0;
+    uint16_t reserved0;
+    uint32_t num_records;
+    uint32_t flags;  /* version 2 and later: FATELF_FLAG_* bits. */
     FATELF_record records[0];  /* this is actually num_records items. */
 } FATELF_header;
 
+/* Version 2 header flags. FATELF_FLAG_MERKLE means a table of per-record
+   Merkle trees follows the records; see the specification. The magic
+   looks like "FMRK" in a hex editor. FATELF_FLAG_ALIASES means some
+   records share their data (the same offset and size) with others, which
+   may differ from it only in OSABI and OSABI version. */
+#define FATELF_FLAG_MERKLE (1 << 0)
+#define FATELF_FLAG_ALIASES (1 << 1)
+#define FATELF_KNOWN_FLAGS (FATELF_FLAG_MERKLE | FATELF_FLAG_ALIASES)
+#define FATELF_MERKLE_MAGIC (0x4B524D46)
+#define FATELF_MERKLE_VERSION (1)
+#define FATELF_MERKLE_HEADER_SIZE (16)
+#define FATELF_MERKLE_ENTRY_SIZE (56)
+#define FATELF_MERKLE_TABLE_SIZE(bins) (FATELF_MERKLE_HEADER_SIZE + (FATELF_MERKLE_ENTRY_SIZE * ((uint64_t) (bins))))
+#define FATELF_MERKLE_HASH_SHA256 (1)
+#define FATELF_MERKLE_MIN_BLOCK_LOG2 (10)
+#define FATELF_MERKLE_MAX_BLOCK_LOG2 (16)
+
+/* An optional table of named resources can end the data after the last
+   record; see the specification. It's found by a trailer in the last
+   FATELF_RESOURCE_TRAILER_SIZE bytes of the file. All offsets in it are
+   from the start of the resource region, so it can move between files.
+   The magic looks like "FRES" in a hex editor. */
+#define FATELF_RESOURCE_MAGIC (0x53455246)
+#define FATELF_RESOURCE_VERSION (1)
+#define FATELF_RESOURCE_TRAILER_SIZE (32)
+#define FATELF_RESOURCE_ENTRY_SIZE (64)
+#define FATELF_RESOURCE_MAX_ALIGN (4096)
+
+/* Valid resource entry hash types... */
+#define FATELF_RESOURCE_HASH_NONE (0)
+#define FATELF_RESOURCE_HASH_SHA256 (1)
+
 #endif
 
 /* end of fatelf.h ... */
@@ -0,0 +1,699 @@
+/**
+ * FatELF; support multiple ELF binaries in one file.
+ *
+ * Please see the file LICENSE.txt in the source's root directory.
+ *
+ *  This file written by Ryan C. Gordon.
+ */
+
+// This remembers what merge.sh already did, so a re-run only touches files
+//  that changed since. The state database is a text file with one line per
+//  merged path:
+//
+//    path <tab> source-state <tab> dest-state <tab> dest-record-hashes
+//
+//  ...where a state is "dev:inode:size:mtime:sha256" (or "-" if the file
+//  didn't exist), and the record hashes are the SHA-256 of each FatELF
+//  record in the dest file, comma-separated (a thin dest is one record).
+//  Files whose stat() data didn't change are never read again, so a no-op
+//  run is just two stat() calls per path.
+
+#define _GNU_SOURCE 1  // for nftw().
+#define FATELF_UTILS 1
+#include "fatelf-utils.h"
+
+#include <errno.h>
+#include <unistd.h>
+#include <ftw.h>
+
+#define STATEDB_SIGNATURE "fatelf-mergestate 1"
+
+typedef struct file_state
+{
+    int exists;
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t size;
+    int64_t mtime_sec;
+    long mtime_nsec;
+    uint8_t sha256[FATELF_SHA256_SIZE];
+} file_state;
+
+typedef struct merge_entry
+{
+    char *path;
+    file_state src;
+    file_state dst;
+    int num_records;
+    uint8_t *record_sha256;  // num_records * FATELF_SHA256_SIZE bytes.
+    int seen;  // still in the list of binaries?
+} merge_entry;
+
+typedef struct merge_db
+{
+    merge_entry *entries;  // sorted by path.
+    int count;
+} merge_db;
+
+// One path from the current list, with its old (if any) and new state.
+typedef struct merge_job
+{
+    const char *srcroot;
+    const char *dstroot;
+    const merge_entry *old;
+    merge_entry now;
+    int changed;
+} merge_job;
+
+
+static int compare_entries(const void *a, const void *b)
+{
+    return strcmp(((const merge_entry *) a)->path,
+                  ((const merge_entry *) b)->path);
+} // compare_entries
+
+
+static int compare_jobs(const void *a, const void *b)
+{
+    return strcmp(((const merge_job *) a)->now.path,
+                  ((const merge_job *) b)->now.path);
+} // compare_jobs
+
+
+static merge_entry *find_entry(const merge_db *db, const char *path)
+{
+    merge_entry key;
+    key.path = (char *) path;
+    return (merge_entry *) bsearch(&key, db->entries, db->count,
+                                   sizeof (merge_entry), compare_entries);
+} // find_entry
+
+
+static void hexify(const uint8_t *bytes, char *hex)
+{
+    static const char digits[] = "0123456789abcdef";
+    int i;
+    for (i = 0; i < FATELF_SHA256_SIZE; i++)
+    {
+        *(hex++) = digits[bytes[i] >> 4];
+        *(hex++) = digits[bytes[i] & 0xF];
+    } // for
+    *hex = '\0';
+} // hexify
+
+
+static int unhexify(const char *hex, uint8_t *bytes)
+{
+    int i;
+    for (i = 0; i < FATELF_SHA256_SIZE * 2; i++)
+    {
+        const char ch = hex[i];
+        int val;
+        if ((ch >= '0') && (ch <= '9'))
+            val = ch - '0';
+        else if ((ch >= 'a') && (ch <= 'f'))
+            val = (ch - 'a') + 10;
+        else
+            return 0;
+        if (i & 1)
+            bytes[i / 2] |= (uint8_t) val;
+        else
+            bytes[i / 2] = (uint8_t) (val << 4);
+    } // for
+    return 1;
+} // unhexify
+
+
+static int parse_state(char *str, file_state *state)
+{
+    long long sec = 0;
+    unsigned long long dev = 0, ino = 0, size = 0;
+    char hex[FATELF_SHA256_SIZE * 2 + 1];
+
+    memset(state, '\0', sizeof (*state));
+    if (strcmp(str, "-") == 0)
+        return 1;
+    else if (sscanf(str, "%llu:%llu:%llu:%lld.%ld:%64s", &dev, &ino, &size,
+                    &sec, &state->mtime_nsec, hex) != 6)
+        return 0;
+    else if (!unhexify(hex, state->sha256))
+        return 0;
+
+    state->exists = 1;
+    state->dev = dev;
+    state->ino = ino;
+    state->size = size;
+    state->mtime_sec = sec;
+    return 1;
+} // parse_state
+
+
+static void print_state(FILE *io, const file_state *state)
+{
+    char hex[FATELF_SHA256_SIZE * 2 + 1];
+    if (!state->exists)
+    {
+        fputs("-", io);
+        return;
+    } // if
+
+    hexify(state->sha256, hex);
+    fprintf(io, "%llu:%llu:%llu:%lld.%09ld:%s",
+            (unsigned long long) state->dev, (unsigned long long) state->ino,
+            (unsigned long long) state->size, (long long) state->mtime_sec,
+            state->mtime_nsec, hex);
+} // print_state
+
+
+static void load_db(const char *fname, merge_db *db)
+{
+    int fd = -1;
+    uint64_t len = 0;
+    char *buf = NULL;
+    char *line = NULL;
+    char *next = NULL;
+    int lineno = 0;
+    int allocated = 0;
+
+    memset(db, '\0', sizeof (*db));
+
+    if ((fd = open(fname, O_RDONLY)) == -1)
+    {
+        if (errno == ENOENT)
+            return;  // first run, start empty.
+        xfail("Failed to open '%s': %s", fname, strerror(errno));
+    } // if
+
+    len = xget_file_size(fname, fd);
+    buf = (char *) xmalloc((size_t) len + 1);
+    xread(fname, fd, buf, (size_t) len, 1);
+    xclose(fname, fd);
+
+    for (line = buf; (line != NULL) && (*line != '\0'); line = next)
+    {
+        merge_entry *entry = NULL;
+        char *fields[4];
+        int i;
+
+        if ((next = strchr(line, '\n')) != NULL)
+            *(next++) = '\0';
+
+        if (lineno++ == 0)
+        {
+            if (strcmp(line, STATEDB_SIGNATURE) != 0)
+                xfail("'%s' isn't a merge state database.", fname);
+            continue;
+        } // if
+
+        for (i = 0; i < 4; i++)
+        {
+            fields[i] = line;
+            if ((line = strchr(line, '\t')) != NULL)
+                *(line++) = '\0';
+            else if (i < 3)
+                xfail("'%s' line %d is corrupt.", fname, lineno);
+        } // for
+
+        if (db->count == allocated)
+        {
+            allocated = allocated ? (allocated * 2) : 1024;
+            db->entries = (merge_entry *) realloc(db->entries, sizeof (merge_entry) * allocated);
+            if (db->entries == NULL)
+                xfail("Out of memory!");
+        } // if
+
+        entry = &db->entries[db->count++];
+        memset(entry, '\0', sizeof (*entry));
+        entry->path = xstrdup(fields[0]);
+        if (!parse_state(fields[1], &entry->src) || !parse_state(fields[2], &entry->dst))
+            xfail("'%s' line %d is corrupt.", fname, lineno);
+
+        if (strcmp(fields[3], "-") != 0)
+        {
+            char *hex = fields[3];
+            entry->num_records = (int) ((strlen(hex) + 1) / ((FATELF_SHA256_SIZE * 2) + 1));
+            entry->record_sha256 = (uint8_t *) xmalloc(entry->num_records * FATELF_SHA256_SIZE);
+            for (i = 0; i < entry->num_records; i++, hex += (FATELF_SHA256_SIZE * 2) + 1)
+            {
+                if (!unhexify(hex, entry->record_sha256 + (i * FATELF_SHA256_SIZE)))
+                    xfail("'%s' line %d is corrupt.", fname, lineno);
+            } // for
+        } // if
+    } // for
+
+    free(buf);
+    qsort(db->entries, db->count, sizeof (merge_entry), compare_entries);
+} // load_db
+
+
+static void save_db(const char *fname, const merge_job *jobs, const int count)
+{
+    const size_t len = strlen(fname) + 8;
+    char *tmpfname = (char *) xmalloc(len);
+    FILE *io = NULL;
+    int i, j;
+
+    // write to a temp file and rename it over the old one, so a crash
+    //  leaves the old state (which just means redoing some work).
+    snprintf(tmpfname, len, "%s.tmp", fname);
+    if ((io = fopen(tmpfname, "w")) == NULL)
+        xfail("Failed to open '%s': %s", tmpfname, strerror(errno));
+
+    fprintf(io, "%s\n", STATEDB_SIGNATURE);
+    for (i = 0; i < count; i++)
+    {
+        const merge_entry *entry = &jobs[i].now;
+        fprintf(io, "%s\t", entry->path);
+        print_state(io, &entry->src);
+        fputc('\t', io);
+        print_state(io, &entry->dst);
+        fputc('\t', io);
+        if (entry->num_records == 0)
+            fputc('-', io);
+        for (j = 0; j < entry->num_records; j++)
+        {
+            char hex[FATELF_SHA256_SIZE * 2 + 1];
+            hexify(entry->record_sha256 + (j * FATELF_SHA256_SIZE), hex);
+            fprintf(io, "%s%s", j ? "," : "", hex);
+        } // for
+        fputc('\n', io);
+    } // for
+
+    if ((fflush(io) != 0) || (ferror(io)))
+        xfail("Failed to write '%s': %s", tmpfname, strerror(errno));
+    xfsync(tmpfname, fileno(io));
+    fclose(io);
+
+    if (rename(tmpfname, fname) == -1)
+        xfail("Failed to rename '%s': %s", tmpfname, strerror(errno));
+    free(tmpfname);
+} // save_db
+
+
+static int same_stat(const file_state *a, const file_state *b)
+{
+    if (a->exists != b->exists)
+        return 0;
+    else if (!a->exists)
+        return 1;
+    return ( (a->dev == b->dev) && (a->ino == b->ino) &&
+             (a->size == b->size) && (a->mtime_sec == b->mtime_sec) &&
+             (a->mtime_nsec == b->mtime_nsec) );
+} // same_stat
+
+
+static char *make_path(const char *root, const char *path)
+{
+    const size_t len = strlen(root) + strlen(path) + 2;
+    char *retval = (char *) xmalloc(len);
+    snprintf(retval, len, "%s/%s", root, path);
+    return retval;
+} // make_path
+
+
+static void stat_file(const char *fname, file_state *state)
+{
+    struct stat statbuf;
+    memset(state, '\0', sizeof (*state));
+    if (stat(fname, &statbuf) == -1)
+    {
+        if ((errno != ENOENT) && (errno != ENOTDIR))
+            xfail("Failed to stat '%s': %s", fname, strerror(errno));
+        return;
+    } // if
+
+    state->exists = 1;
+    state->dev = (uint64_t) statbuf.st_dev;
+    state->ino = (uint64_t) statbuf.st_ino;
+    state->size = (uint64_t) statbuf.st_size;
+    state->mtime_sec = (int64_t) statbuf.st_mtim.tv_sec;
+    state->mtime_nsec = statbuf.st_mtim.tv_nsec;
+} // stat_file
+
+
+// Hash the whole dest file, and each record in it if it's FatELF.
+static void hash_dest(const char *fname, merge_entry *entry)
+{
+    const int fd = xopen(fname, O_RDONLY, 0);
+    uint8_t magic[4];
+
+    xsha256_range(fname, fd, 0, entry->dst.size, entry->dst.sha256);
+
+    if ( (entry->dst.size >= sizeof (magic)) &&
+         (xread(fname, fd, magic, sizeof (magic), 1) == sizeof (magic)) &&
+         (magic[0] == (FATELF_MAGIC & 0xFF)) &&
+         (magic[1] == ((FATELF_MAGIC >> 8) & 0xFF)) &&
+         (magic[2] == ((FATELF_MAGIC >> 16) & 0xFF)) &&
+         (magic[3] == ((FATELF_MAGIC >> 24) & 0xFF)) )
+    {
+        FATELF_header *header = xread_fatelf_header(fname, fd);
+        int i;
+        entry->num_records = (int) header->num_records;
+        entry->record_sha256 = (uint8_t *) xmalloc(entry->num_records * FATELF_SHA256_SIZE);
+        for (i = 0; i < entry->num_records; i++)
+        {
+            const FATELF_record *rec = &header->records[i];
+            uint8_t *sha = entry->record_sha256 + (i * FATELF_SHA256_SIZE);
+            xsha256_range(fname, fd, rec->offset, rec->size, sha);
+        } // for
+        free(header);
+    } // if
+    else  // a thin file is just one record.
+    {
+        entry->num_records = 1;
+        entry->record_sha256 = (uint8_t *) xmalloc(FATELF_SHA256_SIZE);
+        memcpy(entry->record_sha256, entry->dst.sha256, FATELF_SHA256_SIZE);
+    } // else
+
+    xclose(fname, fd);
+} // hash_dest
+
+
+// fatelf_parallel_for() callback: find the current state of one path,
+//  reusing old hashes for files that haven't changed.
+static void refresh_job(void *data, const int idx)
+{
+    merge_job *job = ((merge_job *) data) + idx;
+    const merge_entry *old = job->old;
+    merge_entry *now = &job->now;
+    char *src = make_path(job->srcroot, now->path);
+    char *dst = make_path(job->dstroot, now->path);
+    int i;
+
+    stat_file(src, &now->src);
+    stat_file(dst, &now->dst);
+
+    if ((old != NULL) && same_stat(&old->src, &now->src) && same_stat(&old->dst, &now->dst))
+    {
+        memcpy(now->src.sha256, old->src.sha256, FATELF_SHA256_SIZE);
+        memcpy(now->dst.sha256, old->dst.sha256, FATELF_SHA256_SIZE);
+        now->num_records = old->num_records;
+        now->record_sha256 = old->record_sha256;  // shared, never freed.
+        job->changed = 0;
+        free(src);
+        free(dst);
+        return;
+    } // if
+
+    if (now->src.exists)
+    {
+        if ((old != NULL) && same_stat(&old->src, &now->src))
+            memcpy(now->src.sha256, old->src.sha256, FATELF_SHA256_SIZE);
+        else
+        {
+            const int fd = xopen(src, O_RDONLY, 0);
+            xsha256_range(src, fd, 0, now->src.size, now->src.sha256);
+            xclose(src, fd);
+        } // else
+    } // if
+
+    if (now->dst.exists)
+        hash_dest(dst, now);
+
+    // Changed on disk, but did anything change that matters?
+    job->changed = 1;
+    if ((old != NULL) && (old->src.exists == now->src.exists) &&
+        (old->dst.exists == now->dst.exists) &&
+        (memcmp(old->src.sha256, now->src.sha256, FATELF_SHA256_SIZE) == 0) &&
+        (memcmp(old->dst.sha256, now->dst.sha256, FATELF_SHA256_SIZE) == 0))
+    {
+        job->changed = 0;  // just touched, or copied back in place.
+    } // if
+
+    // If the dest already holds this exact source, it's merged already
+    //  (say, by a run from before there was a state database).
+    for (i = 0; (job->changed) && (i < now->num_records); i++)
+    {
+        const uint8_t *sha = now->record_sha256 + (i * FATELF_SHA256_SIZE);
+        if (memcmp(sha, now->src.sha256, FATELF_SHA256_SIZE) == 0)
+            job->changed = 0;
+    } // for
+
+    free(src);
+    free(dst);
+} // refresh_job
+
+
+static merge_job *read_jobs(const merge_db *db, const char *srcroot,
+                            const char *dstroot, int *_count)
+{
+    merge_job *jobs = NULL;
+    int allocated = 0;
+    int count = 0;
+    char *line = NULL;
+    size_t linelen = 0;
+    ssize_t len;
+
+    while ((len = getline(&line, &linelen, stdin)) != -1)
+    {
+        merge_job *job = NULL;
+        merge_entry *old = NULL;
+
+        while ((len > 0) && ((line[len-1] == '\n') || (line[len-1] == '\r')))
+            line[--len] = '\0';
+        if (len == 0)
+            continue;
+        else if (strchr(line, '\t') != NULL)
+            xfail("Can't handle a tab in path '%s'", line);
+
+        if ((old = find_entry(db, line)) != NULL)
+        {
+            if (old->seen)
+                continue;  // duplicate in the list.
+            old->seen = 1;
+        } // if
+
+        if (count == allocated)
+        {
+            allocated = allocated ? (allocated * 2) : 1024;
+            jobs = (merge_job *) realloc(jobs, sizeof (merge_job) * allocated);
+            if (jobs == NULL)
+                xfail("Out of memory!");
+        } // if
+
+        job = &jobs[count++];
+        memset(job, '\0', sizeof (*job));
+        job->srcroot = srcroot;
+        job->dstroot = dstroot;
+        job->old = old;
+        job->now.path = xstrdup(line);
+    } // while
+
+    free(line);
+    *_count = count;
+    return jobs;
+} // read_jobs
+
+
+static int record_hash_matches(const merge_entry *entry, const uint8_t *sha)
+{
+    int i;
+    for (i = 0; i < entry->num_records; i++)
+    {
+        if (memcmp(entry->record_sha256 + (i * FATELF_SHA256_SIZE), sha, FATELF_SHA256_SIZE) == 0)
+            return 1;
+    } // for
+    return 0;
+} // record_hash_matches
+
+
+// A path that vanished from the list, whose merged output can serve a new
+//  path with the same inputs. Returns the matching job index, or -1.
+static int find_rename(const merge_entry *gone, merge_job *jobs,
+                       const int count, const char *dstroot)
+{
+    file_state dststate;
+    char *dst = NULL;
+    int i;
+
+    if (!gone->src.exists || !gone->dst.exists)
+        return -1;
+
+    // the old output has to still be there, untouched, for us to move it.
+    dst = make_path(dstroot, gone->path);
+    stat_file(dst, &dststate);
+    free(dst);
+    if (!same_stat(&gone->dst, &dststate))
+        return -1;
+
+    for (i = 0; i < count; i++)
+    {
+        const merge_job *job = &jobs[i];
+        if ((job->old != NULL) || (!job->changed))
+            continue;  // only brand new paths can be renames.
+        else if (!job->now.src.exists || !job->now.dst.exists)
+            continue;
+        else if (memcmp(job->now.src.sha256, gone->src.sha256, FATELF_SHA256_SIZE) != 0)
+            continue;
+        else if (!record_hash_matches(gone, job->now.dst.sha256))
+            continue;  // the dest side changed; it needs a real merge.
+        return i;
+    } // for
+
+    return -1;
+} // find_rename
+
+
+static int mergestate_plan(const char *dbfname, const char *srcroot,
+                           const char *dstroot)
+{
+    merge_db db;
+    merge_job *jobs = NULL;
+    int count = 0;
+    int unchanged = 0;
+    int i;
+
+    load_db(dbfname, &db);
+    jobs = read_jobs(&db, srcroot, dstroot, &count);
+    fatelf_parallel_for(count, 0, refresh_job, jobs);
+
+    // Anything in the database that isn't in the list anymore was deleted
+    //  or renamed on the source side.
+    for (i = 0; i < db.count; i++)
+    {
+        const merge_entry *gone = &db.entries[i];
+        int renamed = -1;
+        if (gone->seen)
+            continue;
+        else if ((renamed = find_rename(gone, jobs, count, dstroot)) >= 0)
+        {
+            printf("rename\t%s\t%s\n", gone->path, jobs[renamed].now.path);
+            jobs[renamed].changed = 0;
+        } // else if
+        else
+        {
+            printf("removed\t%s\n", gone->path);
+        } // else
+    } // for
+
+    for (i = 0; i < count; i++)
+    {
+        if (jobs[i].changed)
+            printf("merge\t%s\n", jobs[i].now.path);
+        else
+            unchanged++;
+    } // for
+
+    fprintf(stderr, "%d of %d paths unchanged since the last merge.\n",
+            unchanged, count);
+
+    return 0;
+} // mergestate_plan
+
+
+static int mergestate_commit(const char *dbfname, const char *srcroot,
+                             const char *dstroot)
+{
+    merge_db db;
+    merge_job *jobs = NULL;
+    int count = 0;
+
+    load_db(dbfname, &db);
+    jobs = read_jobs(&db, srcroot, dstroot, &count);
+    fatelf_parallel_for(count, 0, refresh_job, jobs);
+    qsort(jobs, count, sizeof (merge_job), compare_jobs);
+    save_db(dbfname, jobs, count);
+    return 0;
+} // mergestate_commit
+
+
+// nftw() has no way to pass state to the callback, so...
+static const char *scan_root = NULL;
+static char **scan_paths = NULL;
+static int scan_count = 0;
+static int scan_allocated = 0;
+
+static int scan_callback(const char *fname, const struct stat *statbuf,
+                         int typeflag, struct FTW *ftwbuf)
+{
+    static const uint8_t magic[4] = { 0x7F, 0x45, 0x4C, 0x46 };
+    const size_t rootlen = strlen(scan_root);
+    uint8_t buf[4];
+    int fd = -1;
+    int isself = 0;
+
+    if ((typeflag != FTW_F) || (!S_ISREG(statbuf->st_mode)))
+        return 0;
+    else if (statbuf->st_size < sizeof (magic))
+        return 0;
+    else if ((fd = open(fname, O_RDONLY)) == -1)
+    {
+        fprintf(stderr, "Can't open %s: %s\n", fname, strerror(errno));
+        return 0;
+    } // else if
+
+    isself = ( (read(fd, buf, sizeof (buf)) == sizeof (buf)) &&
+               (memcmp(buf, magic, sizeof (magic)) == 0) );
+    close(fd);
+
+    if (isself)
+    {
+        if (scan_count == scan_allocated)
+        {
+            scan_allocated = scan_allocated ? (scan_allocated * 2) : 1024;
+            scan_paths = (char **) realloc(scan_paths, sizeof (char *) * scan_allocated);
+            if (scan_paths == NULL)
+                xfail("Out of memory!");
+        } // if
+
+        fname += rootlen;
+        while (*fname == '/')
+            fname++;
+        scan_paths[scan_count++] = xstrdup(fname);
+    } // if
+
+    return 0;
+} // scan_callback
+
+
+static int compare_strings(const void *a, const void *b)
+{
+    return strcmp(*((const char **) a), *((const char **) b));
+} // compare_strings
+
+
+static int mergestate_scan(const char *root, const char **dirs,
+                           const int dircount)
+{
+    int i;
+
+    scan_root = root;
+    for (i = 0; i < ((dircount > 0) ? dircount : 1); i++)
+    {
+        char *dir = (dircount > 0) ? make_path(root, dirs[i]) : xstrdup(root);
+        // no FTW_PHYS, so this follows symlinks, like find -follow.
+        if ((nftw(dir, scan_callback, 64, 0) == -1) && (errno != ENOENT))
+            xfail("Failed to scan '%s': %s", dir, strerror(errno));
+        free(dir);
+    } // for
+
+    qsort(scan_paths, scan_count, sizeof (char *), compare_strings);
+    for (i = 0; i < scan_count; i++)
+    {
+        if ((i == 0) || (strcmp(scan_paths[i-1], scan_paths[i]) != 0))
+            printf("%s\n", scan_paths[i]);
+    } // for
+
+    return 0;
+} // mergestate_scan
+
+
+int main(int argc, const char **argv)
+{
+    xfatelf_init(&argc, argv);
+    if ((argc >= 3) && (strcmp(argv[1], "scan") == 0))
+        return mergestate_scan(argv[2], &argv[3], argc - 3);
+    else if ((argc == 5) && (strcmp(argv[1], "plan") == 0))
+        return mergestate_plan(argv[2], argv[3], argv[4]);
+    else if ((argc == 5) && (strcmp(argv[1], "commit") == 0))
+        return mergestate_commit(argv[2], argv[3], argv[4]);
+
+    xfail("USAGE: %s scan <root> [dir1 ... dirN] > list\n"
+          "       %s plan <statedb> <srcroot> <dstroot> < list\n"
+          "       %s commit <statedb> <srcroot> <dstroot> < list",
+          argv[0], argv[0], argv[0]);
+    return 1;
+} // main
+
+// end of fatelf-mergestate.c ...
+
@@ -39,17 +39,40 @@ rm -rf /x86_64/home/fatelf
 cp -av /x86_64/etc/skel /x86_64/home/fatelf
 chown -R 1000 /x86_64/home/fatelf
 
-gcc -o fatelf-validate -O3 -s -I../../include -I../../utils ../../utils/fatelf-validate.c ../../utils/fatelf-utils.c
-gcc -o fatelf-replace -O3 -s -I../../include -I../../utils ../../utils/fatelf-replace.c ../../utils/fatelf-utils.c
-gcc -o fatelf-glue -O3 -s -I../../include -I../../utils ../../utils/fatelf-glue.c ../../utils/fatelf-utils.c
-gcc -o iself -s -O3 ../iself.c
+gcc -o fatelf-validate -O3 -s -pthread -I../../include -I../../utils ../../utils/fatelf-validate.c ../../utils/fatelf-utils.c
+gcc -o fatelf-replace -O3 -s -pthread -I../../include -I../../utils ../../utils/fatelf-replace.c ../../utils/fatelf-utils.c
+gcc -o fatelf-glue -O3 -s -pthread -I../../include -I../../utils ../../utils/fatelf-glue.c ../../utils/fatelf-utils.c
+gcc -o fatelf-extract -O3 -s -pthread -I../../include -I../../utils ../../utils/fatelf-extract.c ../../utils/fatelf-utils.c
+gcc -o fatelf-mergestate -O3 -s -pthread -I../../include -I../../utils ../fatelf-mergestate.c ../../utils/fatelf-utils.c
 gcc -o is32bitelf -s -O3 ../is32bitelf.c
 
-if [ ! -f ./binaries-32 ]; then
-    time for feh in bin boot etc lib opt sbin usr/bin usr/games usr/sbin usr/X11R6 usr/lib usr/local var/lib ; do find /x86/$feh -follow -type f -exec ./iself {} \; ; done |perl -w -pi -e 's/\A\/x86\///;' |sort |uniq > ./binaries-32
-fi
+# This remembers what we merged last time (it lives outside cmake-build,
+#  which gets wiped every run), so we only redo files that changed since.
+#  Delete it to force a full merge.
+STATEDB=${STATEDB:-../merge-state.db}
+
+time ./fatelf-mergestate scan /x86 bin boot etc lib opt sbin usr/bin usr/games usr/sbin usr/X11R6 usr/lib usr/local var/lib > ./binaries-32
+./fatelf-mergestate plan "$STATEDB" /x86 /x86_64 < ./binaries-32 > ./merge-plan
 
-for feh in `cat binaries-32` ; do
+# Files that moved on the 32-bit side (and whose 64-bit side matches
+#  what we merged before) just move, and files that vanished from the
+#  32-bit side lose their 32-bit half.
+grep -P '^rename\t' merge-plan | while IFS=$'\t' read -r action oldfeh feh ; do
+    mkdir -p --mode=0755 `dirname "/x86_64/$feh"`
+    mv -f "/x86_64/$oldfeh" "/x86_64/$feh"
+done
+
+grep -P '^removed\t' merge-plan | while IFS=$'\t' read -r action feh ; do
+    ISFATELF=0
+    [ -f "/x86_64/$feh" ] && ./fatelf-validate "/x86_64/$feh" && ISFATELF=1
+    if [ "x$ISFATELF" = "x1" ]; then
+        ./fatelf-extract tmp-fatelf "/x86_64/$feh" 64bits
+        chmod --reference="/x86_64/$feh" tmp-fatelf
+        mv tmp-fatelf "/x86_64/$feh"
+    fi
+done
+
+grep -P '^merge\t' merge-plan | while IFS=$'\t' read -r action feh ; do
     mkdir -p --mode=0755 `dirname "/x86_64/$feh"`
     if [ ! -f "/x86_64/$feh" ]; then
         cp -a "/x86/$feh" "/x86_64/$feh"
@@ -74,6 +97,9 @@ for feh in `cat binaries-32` ; do
     fi
 done
 
+# Remember all of this for next time.
+./fatelf-mergestate commit "$STATEDB" /x86 /x86_64 < ./binaries-32
+
 # We don't need /lib32 and /lib64, but symlink them to /lib just in case.
 rm -rf /x86_64/lib32
 rm -rf /x86_64/lib64
@@ -0,0 +1,68 @@
+#!/bin/bash
+
+# Compare the copy engines (see --copy-engine in README.md) by gluing a big
+#  ELF file into a FatELF file. To see what the pipelined engines buy you,
+#  put the input and output on different devices (say, an NVMe drive and a
+#  USB disk), where reads and writes can overlap; on one device, "auto" will
+#  likely just let the kernel do the copy.
+#
+# Usage: bench-copy.sh [size_in_mb] [input_dir] [output_dir] [runs]
+#  Run as root to start each pass with a cold page cache.
+
+SIZEMB=${1:-1024}
+INDIR=${2:-.}
+OUTDIR=${3:-$INDIR}
+RUNS=${4:-3}
+
+set -e
+
+. "`dirname "$0"`/common.sh"
+fatelf_setup bench-copy "$INDIR" fatelf-glue
+
+BIG="$DIR/big.elf"
+SMALL="$DIR/small.elf"
+OUT="$OUTDIR/bench-copy-out"
+
+# Same setup as bench-directio.sh: a real ELF header with lots of data
+#  after it, and a tiny second record for a different target.
+cp /bin/true "$BIG"
+dd if=/dev/urandom of="$BIG" bs=1M count="$SIZEMB" oflag=append conv=notrunc status=none
+make_stub "$SMALL" arm
+sync
+
+run() {
+    local name="$1"
+    shift
+    local best=0
+    local i
+    for i in `seq $RUNS` ; do
+        rm -f "$OUT"
+        dropcaches
+        local start=`date +%s%N`
+        ./fatelf-glue "$@" "$OUT" "$BIG" "$SMALL"
+        sync  # count the time to get it on the disk, too.
+        local end=`date +%s%N`
+        local ms=$(( (end - start) / 1000000 ))
+        if [ "$best" -eq 0 ] || [ "$ms" -lt "$best" ]; then
+            best=$ms
+        fi
+    done
+    local mbps=0
+    [ "$best" -gt 0 ] && mbps=$(( (SIZEMB * 1000) / best ))
+    printf "%-36s %8d ms %8d MiB/s  (best of %d)\n" "$name" "$best" "$mbps" "$RUNS"
+}
+
+run "plain (one buffer)" --copy-engine=plain
+run "kernel (copy_file_range)" --copy-engine=kernel
+run "threads, depth 2" --copy-engine=threads --copy-depth=2
+run "threads, depth 4" --copy-engine=threads --copy-depth=4
+run "threads, depth 16" --copy-engine=threads --copy-depth=16
+run "uring, depth 2" --copy-engine=uring --copy-depth=2
+run "uring, depth 4" --copy-engine=uring --copy-depth=4
+run "uring, depth 16" --copy-engine=uring --copy-depth=16
+run "auto" --copy-engine=auto
+
+rm -rf "$DIR" "$OUT"
+
+# end of bench-copy.sh ...
+
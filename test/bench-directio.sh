@@ -0,0 +1,55 @@
+#!/bin/bash
+
+# Compare the normal copy path against --direct-io, for a big FatELF file.
+#  Reports wall clock time and how much of the input and output files ended
+#  up resident in the page cache (via fincore(1), from util-linux).
+#
+# Usage: bench-directio.sh [size_in_mb] [scratch_dir]
+#  Run as root to start each pass with a cold page cache.
+
+SIZEMB=${1:-2048}
+SCRATCH=${2:-.}
+
+set -e
+
+. "`dirname "$0"`/common.sh"
+fatelf_setup bench-directio "$SCRATCH" fatelf-glue
+
+BIG="$DIR/big.elf"
+SMALL="$DIR/small.elf"
+OUT="$DIR/out"
+
+# The payload is a real ELF header followed by a lot of data, like a game
+#  binary with its assets appended. The second record just has to be a
+#  different target than the host.
+cp /bin/true "$BIG"
+dd if=/dev/urandom of="$BIG" bs=1M count="$SIZEMB" oflag=append conv=notrunc status=none
+make_stub "$SMALL" arm
+sync
+
+resident() {
+    fincore --bytes --noheadings --output RES "$1" | tr -d ' '
+}
+
+run() {
+    local name="$1"
+    shift
+    rm -f "$OUT"
+    dropcaches
+    local start=`date +%s%N`
+    ./fatelf-glue "$@" "$OUT" "$BIG" "$SMALL"
+    local end=`date +%s%N`
+    local ms=$(( (end - start) / 1000000 ))
+    local mbps=0
+    [ "$ms" -gt 0 ] && mbps=$(( (SIZEMB * 1000) / ms ))
+    printf "%-24s %8d ms %8d MiB/s   resident: input %12s bytes, output %12s bytes\n" \
+        "$name" "$ms" "$mbps" "`resident "$BIG"`" "`resident "$OUT"`"
+}
+
+run "buffered" 
+run "--direct-io" --direct-io
+run "--direct-io --io-rate=200M" --direct-io --io-rate=200M
+
+rm -rf "$DIR"
+
+# end of bench-directio.sh ...
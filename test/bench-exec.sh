@@ -0,0 +1,60 @@
+#!/bin/bash
+
+# Measure program start time through fatelf-exec against the other ways of
+#  running a FatELF program on a stock kernel: extracting it to a file and
+#  running that, and fatelf-exec --extract (a memfd). "thin" is the plain
+#  ELF program run directly, for reference. The program is padded to SIZE
+#  kilobytes, since copying is what mapping in place avoids.
+#
+# Usage: bench-exec.sh [size_kb] [runs] [scratch_dir]
+
+SIZEKB=${1:-4096}
+RUNS=${2:-200}
+SCRATCH=${3:-.}
+
+set -e
+
+. "`dirname "$0"`/common.sh"
+fatelf_setup bench-exec "$SCRATCH" fatelf-exec fatelf-glue
+
+# The second record just has to be a different target than the host.
+make_stub "$DIR/other.elf" arm
+
+cat > "$DIR/main.c" <<EOF
+static const char padding[$SIZEKB * 1024] = { 1 };
+int main(int argc, char **argv) { return padding[argc * 4096]; }
+EOF
+gcc -O2 -o "$DIR/thin" "$DIR/main.c"
+"$TOOLS/fatelf-glue" "$DIR/fat" "$DIR/other.elf" "$DIR/thin"
+chmod +x "$DIR/fat"
+
+run() {
+    local name="$1"
+    shift
+    "$@" || { echo "$name: failed to start" 1>&2; exit 1; }
+    local start=`date +%s%N`
+    for i in `seq 1 $RUNS`; do
+        "$@"
+    done
+    local end=`date +%s%N`
+    printf "%-28s %8d us per start\n" "$name" $(( (end - start) / (RUNS * 1000) ))
+}
+
+extract_and_run() {
+    "$TOOLS/fatelf-extract" "$DIR/extracted" "$DIR/fat" host
+    chmod +x "$DIR/extracted"
+    "$DIR/extracted"
+    local rc=$?
+    rm -f "$DIR/extracted"
+    return $rc
+}
+
+echo "`ls -l "$DIR/thin" | awk '{ print $5 }'` byte program, $RUNS runs each:"
+run "thin" "$DIR/thin"
+run "fatelf-exec, in place" "$TOOLS/fatelf-exec" "$DIR/fat"
+run "fatelf-exec --extract" "$TOOLS/fatelf-exec" --extract "$DIR/fat"
+run "fatelf-extract, then run" extract_and_run
+
+rm -rf "$DIR"
+
+# end of bench-exec.sh ...
@@ -0,0 +1,61 @@
+#!/bin/bash
+
+# Measure process start time with N shared library dependencies, thin
+#  versus fat. The fat runs go through libfatelf-preload.so as an LD_AUDIT
+#  library, once extracting to memfds every time and once with a warm
+#  FATELF_CACHE_DIR. "thin + audit" shows what the audit hook costs alone.
+#
+# Usage: bench-preload.sh [num_libraries] [runs] [scratch_dir]
+
+NUMLIBS=${1:-50}
+RUNS=${2:-200}
+SCRATCH=${3:-.}
+
+set -e
+
+. "`dirname "$0"`/common.sh"
+fatelf_setup bench-preload "$SCRATCH" fatelf-glue libfatelf-preload.so
+
+mkdir -p "$DIR/thin" "$DIR/fat" "$DIR/cache"
+PRELOAD="`pwd`/libfatelf-preload.so"
+
+# The second record just has to be a different target than the host.
+make_stub "$DIR/other.elf" arm
+
+LIBS=""
+echo "#include <stdio.h>" > "$DIR/main.c"
+echo "int main(void) { int x = 0;" > "$DIR/main-body.c"
+for i in `seq 1 $NUMLIBS`; do
+    echo "int bench_fn$i(void) { return $i; }" > "$DIR/lib$i.c"
+    gcc -shared -fPIC -o "$DIR/thin/libbench$i.so" "$DIR/lib$i.c"
+    ./fatelf-glue "$DIR/fat/libbench$i.so" "$DIR/thin/libbench$i.so" "$DIR/other.elf"
+    echo "int bench_fn$i(void);" >> "$DIR/main.c"
+    echo "x += bench_fn$i();" >> "$DIR/main-body.c"
+    LIBS="$LIBS -lbench$i"
+done
+echo "return (x == 0); }" >> "$DIR/main-body.c"
+cat "$DIR/main-body.c" >> "$DIR/main.c"
+gcc -o "$DIR/main" "$DIR/main.c" -L"$DIR/thin" $LIBS
+
+run() {
+    local name="$1"
+    shift
+    env "$@" "$DIR/main" || { echo "$name: failed to start" 1>&2; exit 1; }
+    local start=`date +%s%N`
+    for i in `seq 1 $RUNS`; do
+        env "$@" "$DIR/main"
+    done
+    local end=`date +%s%N`
+    printf "%-24s %8d us per start\n" "$name" $(( (end - start) / (RUNS * 1000) ))
+}
+
+echo "$NUMLIBS libraries, $RUNS runs each (includes fork/exec of env):"
+run "thin" LD_LIBRARY_PATH="$DIR/thin"
+run "thin + audit" LD_LIBRARY_PATH="$DIR/thin" LD_AUDIT="$PRELOAD"
+run "fat, memfd" LD_LIBRARY_PATH="$DIR/fat" LD_AUDIT="$PRELOAD"
+run "fat, cached" LD_LIBRARY_PATH="$DIR/fat" LD_AUDIT="$PRELOAD" FATELF_CACHE_DIR="$DIR/cache"
+
+rm -rf "$DIR"
+
+# end of bench-preload.sh ...
+
@@ -0,0 +1,501 @@
+#!/bin/bash
+
+# Measure what FatELF costs when a program starts, against thin binaries.
+#  Programs are hello.c (with hello-lib.c as a shared library), hello-dlopen.c
+#  and some synthetic ones, built thin and fat. Each variant is started RUNS
+#  times by a little launcher, and we report percentiles of:
+#
+#  - exec-to-main: from just before fork() to a constructor in an
+#    LD_PRELOADed library, which runs after every other library is loaded
+#    and initialized, right before main().
+#  - dlopen: how long hello-dlopen's dlopen() call of hello.so takes.
+#
+#  Fat programs are started every way this system has: directly, if the
+#  kernel runs FatELF files itself (it's skipped otherwise), fatelf-exec in
+#  place, fatelf-exec --extract, and fatelf-extract to a file, then exec.
+#  Fat libraries are loaded through libfatelf-preload.so, with and without
+#  a warm FATELF_CACHE_DIR. The sections vary one thing at a time:
+#
+#  - exec paths: hello, thin against each way to start it fat.
+#  - records: synthetic programs with 2 to 1024 records, host record last.
+#  - host position: 255 records, with the host's first, in the middle and
+#    last, in the record table and in the file.
+#  - alignment: records at 4K, 64K and 2M boundaries.
+#  - libraries: 0, 1 (hello), 10 and 50 shared library dependencies.
+#  - dlopen: hello-dlopen loading a thin and a fat hello.so.
+#
+#  Every section runs with a warm page cache, then a cold one. "Cold" drops
+#  the whole page cache before each run if /proc/sys/vm/drop_caches is
+#  writable (as root), and otherwise evicts just the files under test and
+#  the FatELF tools with posix_fadvise(), which leaves libc and friends warm.
+#  Times are in microseconds.
+#
+# Usage: bench-startup.sh [runs] [scratch_dir] [sections] [caches]
+#  Run from a directory with the built FatELF tools. Needs gcc and python3.
+#  (sections) is any of "paths records position alignment libraries dlopen"
+#  and (caches) any of "warm cold"; both default to all of them.
+
+RUNS=${1:-200}
+SCRATCH=${2:-.}
+SECTIONS=${3:-paths records position alignment libraries dlopen}
+CACHES=${4:-warm cold}
+
+set -e
+
+. "`dirname "$0"`/common.sh"
+fatelf_setup bench-startup "$SCRATCH" fatelf-exec fatelf-glue libfatelf-preload.so
+
+mkdir -p "$DIR/thin" "$DIR/fat" "$DIR/cache" "$DIR/x"
+PRELOAD="$TOOLS/libfatelf-preload.so"
+cd "$DIR"
+
+# The launcher: runs a program RUNS times and reports percentiles.
+cat > startlat.c <<'EOT'
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#define MAX_OPTS 256
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t) ts.tv_sec * 1000000000ull) + (uint64_t) ts.tv_nsec;
+}
+
+static void fail(const char *label, const char *why)
+{
+    fprintf(stderr, "%s: %s\n", label, why);
+    exit(1);
+}
+
+// Only clean, unmapped pages can go, so write back first.
+static void evict(const char *path)
+{
+    const int fd = open(path, O_RDONLY);
+    if (fd != -1)
+    {
+        fdatasync(fd);
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+}
+
+static void drop_caches(void)
+{
+    const int fd = open("/proc/sys/vm/drop_caches", O_WRONLY);
+    sync();
+    if ((fd == -1) || (write(fd, "3", 1) != 1))
+        fail("startlat", "can't write /proc/sys/vm/drop_caches");
+    close(fd);
+}
+
+// Fork and exec (argv); (stampfd) becomes fd 3 if it isn't -1.
+static pid_t spawn(char **argv, char **envs, const int numenvs,
+                   const char *stamp, const char *dir, const int stampfd)
+{
+    const pid_t pid = fork();
+    if (pid == 0)
+    {
+        const int devnull = open("/dev/null", O_WRONLY);
+        int i;
+        dup2(devnull, 1);
+        if (stampfd != -1)
+        {
+            dup2(stampfd, 3);
+            setenv("LD_PRELOAD", stamp, 1);
+            for (i = 0; i < numenvs; i++)
+                putenv(envs[i]);
+        }
+        if ((dir != NULL) && (chdir(dir) == -1))
+            _exit(126);
+        execv(argv[0], argv);
+        _exit(127);
+    }
+    return pid;
+}
+
+static int finish(const pid_t pid)
+{
+    int status = 0;
+    if ((pid == -1) || (waitpid(pid, &status, 0) == -1))
+        return -1;
+    return (WIFEXITED(status) && (WEXITSTATUS(status) == 0)) ? 0 : -1;
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+    const uint64_t x = *(const uint64_t *) a;
+    const uint64_t y = *(const uint64_t *) b;
+    return (x < y) ? -1 : ((x > y) ? 1 : 0);
+}
+
+int main(int argc, char **argv)
+{
+    const char *usage = "USAGE: startlat [-n RUNS] [-m main|dlopen] [-s STAMP.so]"
+                        " [-e VAR=VALUE]... [-c FILE]... [-D] [-d DIR]"
+                        " [-x EXTRACTOR] [-l LABEL] PROGRAM [ARGS...]";
+    char *envs[MAX_OPTS], *evicts[MAX_OPTS];
+    int numenvs = 0, numevicts = 0, dropall = 0, wantdlopen = 0;
+    int runs = 100, opt, i, j;
+    const char *stamp = NULL, *dir = NULL, *extractor = NULL, *label = NULL;
+    char extracted[4096];
+    uint64_t *samples;
+
+    while ((opt = getopt(argc, argv, "+n:m:s:e:c:Dd:x:l:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'n': runs = atoi(optarg); break;
+            case 'm': wantdlopen = (strcmp(optarg, "dlopen") == 0); break;
+            case 's': stamp = optarg; break;
+            case 'e': if (numenvs < MAX_OPTS) envs[numenvs++] = optarg; break;
+            case 'c': if (numevicts < MAX_OPTS) evicts[numevicts++] = optarg; break;
+            case 'D': dropall = 1; break;
+            case 'd': dir = optarg; break;
+            case 'x': extractor = optarg; break;
+            case 'l': label = optarg; break;
+            default: fail("startlat", usage);
+        }
+    }
+
+    if ((stamp == NULL) || (runs < 1) || ((argc - optind) < 1))
+        fail("startlat", usage);
+
+    argv += optind;
+    if (label == NULL)
+        label = argv[0];
+    samples = (uint64_t *) calloc(runs, sizeof (uint64_t));
+    snprintf(extracted, sizeof (extracted), "%s.extracted", argv[0]);
+
+    // One extra run first, to check it works, and to warm things up.
+    for (i = -1; i < runs; i++)
+    {
+        char *realprog = argv[0];
+        uint64_t start, mainstamp = 0, dlopentime = 0, rec[2];
+        int pipefd[2];
+        pid_t pid;
+
+        if (dropall)
+            drop_caches();
+        for (j = 0; j < numevicts; j++)
+            evict(evicts[j]);
+
+        if (pipe(pipefd) == -1)
+            fail(label, "pipe failed");
+
+        start = now_ns();
+        if (extractor != NULL)  // extract it to a file, then run that.
+        {
+            char *xargv[] = { (char *) extractor, extracted, argv[0], (char *) "host", NULL };
+            if (finish(spawn(xargv, NULL, 0, NULL, NULL, -1)) == -1)
+                fail(label, "extracting failed");
+            chmod(extracted, 0755);
+            argv[0] = extracted;
+        }
+
+        pid = spawn(argv, envs, numenvs, stamp, dir, pipefd[1]);
+        close(pipefd[1]);
+
+        // fatelf-exec loads the stamp library too, so the last stamp counts.
+        while (read(pipefd[0], rec, sizeof (rec)) == sizeof (rec))
+        {
+            if (rec[0] == 1)
+                mainstamp = rec[1];
+            else if (rec[0] == 2)
+                dlopentime = rec[1];
+        }
+        close(pipefd[0]);
+
+        if (finish(pid) == -1)
+            fail(label, "the program failed");
+        else if (extractor != NULL)
+        {
+            unlink(extracted);
+            argv[0] = realprog;
+        }
+
+        if (wantdlopen && (dlopentime == 0))
+            fail(label, "the program never called dlopen()");
+        else if (!wantdlopen && (mainstamp == 0))
+            fail(label, "the program never reached main()");
+        else if (i >= 0)
+            samples[i] = wantdlopen ? dlopentime : (mainstamp - start);
+    }
+
+    qsort(samples, runs, sizeof (uint64_t), compare_u64);
+    printf("  %-40s %9.1f %9.1f %9.1f %9.1f %9.1f\n", label,
+           samples[0] / 1000.0, samples[(runs - 1) / 2] / 1000.0,
+           samples[((runs - 1) * 90) / 100] / 1000.0,
+           samples[((runs - 1) * 99) / 100] / 1000.0,
+           samples[runs - 1] / 1000.0);
+    free(samples);
+    return 0;
+}
+EOT
+
+# The stamp library: tells the launcher when main() is about to run, and
+#  how long dlopen() took, on fd 3.
+cat > stamp.c <<'EOT'
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t) ts.tv_sec * 1000000000ull) + (uint64_t) ts.tv_nsec;
+}
+
+static void report(const uint64_t tag, const uint64_t value)
+{
+    const uint64_t rec[2] = { tag, value };
+    if (write(3, rec, sizeof (rec)) != sizeof (rec))
+        return;  // not under the launcher.
+}
+
+__attribute__((constructor)) static void stamp_main(void)
+{
+    report(1, now_ns());
+}
+
+void *dlopen(const char *fname, int flags)
+{
+    static void *(*real_dlopen)(const char *, int) = NULL;
+    uint64_t start;
+    void *retval;
+    if (real_dlopen == NULL)
+        real_dlopen = (void *(*)(const char *, int)) dlsym(RTLD_NEXT, "dlopen");
+    start = now_ns();
+    retval = real_dlopen(fname, flags);
+    report(2, now_ns() - start);
+    return retval;
+}
+EOT
+
+# Lays out a FatELF file by hand, so the record count, where the host
+#  record goes and the alignment can all be picked: mkfat.py OUT HOST COUNT
+#  first|middle|last ALIGN. The other records are 64-byte stubs: arm ones
+#  sort before an x86_64 host and vax ones after it, so the host lands
+#  where it's asked to in the file and in the (sorted) record table.
+cat > mkfat.py <<'EOT'
+import struct, sys
+out, host, count, position, align = sys.argv[1], sys.argv[2], int(sys.argv[3]), sys.argv[4], int(sys.argv[5])
+hostdata = open(host, 'rb').read()
+others = count - 1
+before = {'first': 0, 'middle': others // 2, 'last': others}[position]
+
+def stub(machine, wordsize, k):
+    osabi, osabiver = divmod(k, 256)
+    ident = b'\x7fELF' + bytes([wordsize, 1, 1, osabi, osabiver]) + bytes(7)
+    data = ident + struct.pack('<HH', 2, machine)
+    rec = (machine, osabi, osabiver, wordsize, 1, 0)
+    return rec, data + bytes(64 - len(data))
+
+records = [stub(40, 1, k) for k in range(before)]
+records.append(((struct.unpack_from('<H', hostdata, 18)[0], hostdata[7], hostdata[8], hostdata[4], hostdata[5], 0), hostdata))
+records += [stub(75, 1, k) for k in range(others - before)]
+
+version = 1 if count <= 255 else 2
+hdrsize = (8 if version == 1 else 16) + (24 * count)
+up = lambda x: (x + align - 1) // align * align
+offset = up(hdrsize)
+body = bytearray()
+table = b''
+for rec, data in records:
+    table += struct.pack('<HBBBBBBQQ', rec[0], rec[1], rec[2], rec[3], rec[4], rec[5], 0, offset, len(data))
+    body += bytes(offset - hdrsize - len(body)) + data
+    offset = up(offset + len(data))
+if version == 1:
+    header = struct.pack('<IHBB', 0x1F0E70FA, 1, count, 0)
+else:
+    header = struct.pack('<IHHII', 0x1F0E70FA, 2, 0, count, 0)
+with open(out, 'wb') as f:
+    f.write(header + table + body)
+EOT
+
+gcc -O2 -Wall -o startlat startlat.c
+gcc -O2 -Wall -shared -fPIC -o stamp.so stamp.c -ldl
+make_stub other.elf arm
+
+# hello, hello.so and hello-dlopen, thin and fat.
+gcc -O2 -shared -fPIC -Wl,-soname,hello.so -o thin/hello.so "$TESTDIR/hello-lib.c"
+gcc -O2 -o thin/hello "$TESTDIR/hello.c" thin/hello.so
+gcc -O2 -o hello-dlopen "$TESTDIR/hello-dlopen.c" -ldl
+echo "int main(void) { return 0; }" > empty.c
+gcc -O2 -o thin/empty empty.c
+for f in hello hello.so empty ; do
+    "$TOOLS/fatelf-glue" fat/$f other.elf thin/$f
+    chmod +x fat/$f
+done
+
+# Programs with N library dependencies, like bench-preload.sh.
+for n in 10 50 ; do
+    echo "int main(void) { int x = 0;" > body$n.c
+    : > main$n.c
+    LIBS=""
+    for i in `seq 1 $n` ; do
+        if [ ! -f thin/libbench$i.so ] ; then
+            echo "int bench_fn$i(void) { return $i; }" > lib$i.c
+            gcc -O2 -shared -fPIC -o thin/libbench$i.so lib$i.c
+            "$TOOLS/fatelf-glue" fat/libbench$i.so thin/libbench$i.so other.elf
+        fi
+        echo "int bench_fn$i(void);" >> main$n.c
+        echo "x += bench_fn$i();" >> body$n.c
+        LIBS="$LIBS -lbench$i"
+    done
+    echo "return (x == 0); }" >> body$n.c
+    cat body$n.c >> main$n.c
+    gcc -O2 -o thin/libs$n main$n.c -Lthin $LIBS
+    "$TOOLS/fatelf-glue" fat/libs$n other.elf thin/libs$n
+    chmod +x fat/libs$n
+done
+
+# Synthetic layouts of the empty program.
+for n in 2 16 64 255 1024 ; do
+    python3 mkfat.py x/records$n thin/empty $n last 4096
+done
+for p in first middle last ; do
+    python3 mkfat.py x/position-$p thin/empty 255 $p 4096
+done
+for a in 4096 65536 2097152 ; do
+    python3 mkfat.py x/align$a thin/empty 2 last $a
+done
+chmod +x x/*
+for f in fat/* x/* ; do
+    "$TOOLS/fatelf-validate" $f || { echo "$f isn't a valid FatELF file" 1>&2 ; exit 1 ; }
+done
+
+# Does the kernel run FatELF files itself?
+KERNEL=0
+if fat/empty > /dev/null 2>&1 ; then
+    KERNEL=1
+fi
+
+COLD="fadvise"
+if [ -w /proc/sys/vm/drop_caches ] ; then
+    COLD="drop_caches"
+fi
+
+# bench LABEL [startlat options] PROGRAM [ARGS]; the cache mode is in $CACHE.
+bench() {
+    local label="$1"
+    shift
+    local cold=""
+    if [ "$CACHE" = "cold" ] ; then
+        if [ "$COLD" = "drop_caches" ] ; then
+            cold="-D"
+        else
+            for f in $EVICT "$TOOLS/fatelf-exec" "$TOOLS/fatelf-extract" "$PRELOAD" ; do
+                cold="$cold -c $f"
+            done
+        fi
+    fi
+    ./startlat -n $RUNS -s "$DIR/stamp.so" $cold -l "$label" "$@"
+}
+
+# every way to start fat program (1) that we have, with startlat options (2).
+fat_paths() {
+    local prog="$1"
+    shift
+    if [ $KERNEL -eq 1 ] ; then
+        bench "kernel" "$@" "$prog"
+    fi
+    bench "fatelf-exec" "$@" "$TOOLS/fatelf-exec" "$prog"
+    bench "fatelf-exec --extract" "$@" "$TOOLS/fatelf-exec" --extract "$prog"
+    bench "fatelf-extract, then exec" -x "$TOOLS/fatelf-extract" "$@" "$prog"
+}
+
+echo "FatELF startup benchmark: $RUNS runs per line, times in microseconds."
+echo "`uname -sr`, `nproc` CPUs. Kernel FatELF support: `[ $KERNEL -eq 1 ] && echo yes || echo no`." \
+     "Cold cache: $COLD."
+
+for CACHE in $CACHES ; do
+    echo
+    printf "%s cache:%35s %9s %9s %9s %9s %9s\n" "$CACHE" "" min p50 p90 p99 max
+    for section in $SECTIONS ; do
+        case "$section" in
+        paths)
+            echo " exec-to-main, hello with hello.so:"
+            EVICT="$DIR/thin/hello $DIR/fat/hello $DIR/thin/hello.so"
+            bench "thin" -e LD_LIBRARY_PATH="$DIR/thin" thin/hello
+            fat_paths fat/hello -e LD_LIBRARY_PATH="$DIR/thin"
+            ;;
+        records)
+            echo " exec-to-main, fatelf-exec, host record last of N:"
+            for n in 2 16 64 255 1024 ; do
+                EVICT="$DIR/x/records$n"
+                bench "$n records" "$TOOLS/fatelf-exec" x/records$n
+                if [ $KERNEL -eq 1 ] ; then
+                    bench "$n records, kernel" x/records$n
+                fi
+            done
+            ;;
+        position)
+            echo " exec-to-main, fatelf-exec, host record among 255:"
+            for p in first middle last ; do
+                EVICT="$DIR/x/position-$p"
+                bench "host $p" "$TOOLS/fatelf-exec" x/position-$p
+            done
+            ;;
+        alignment)
+            echo " exec-to-main, fatelf-exec, records aligned to N bytes:"
+            EVICT="$DIR/thin/empty"
+            bench "thin" thin/empty
+            for a in 4096 65536 2097152 ; do
+                EVICT="$DIR/x/align$a"
+                bench "$a" "$TOOLS/fatelf-exec" x/align$a
+                if [ $KERNEL -eq 1 ] ; then
+                    bench "$a, kernel" x/align$a
+                fi
+            done
+            ;;
+        libraries)
+            echo " exec-to-main, N shared libraries; fat ones through libfatelf-preload.so:"
+            for n in 0 1 10 50 ; do
+                case $n in
+                0) prog=empty ;;
+                1) prog=hello ;;
+                *) prog=libs$n ;;
+                esac
+                EVICT="$DIR/thin/$prog $DIR/fat/$prog `ls "$DIR"/thin/*.so "$DIR"/fat/*.so`"
+                rm -rf cache/*
+                bench "$n, thin" -e LD_LIBRARY_PATH="$DIR/thin" thin/$prog
+                bench "$n, fat, memfd" -e LD_LIBRARY_PATH="$DIR/fat" -e LD_AUDIT="$PRELOAD" \
+                      "$TOOLS/fatelf-exec" fat/$prog
+                bench "$n, fat, FATELF_CACHE_DIR" -e LD_LIBRARY_PATH="$DIR/fat" -e LD_AUDIT="$PRELOAD" \
+                      -e FATELF_CACHE_DIR="$DIR/cache" "$TOOLS/fatelf-exec" fat/$prog
+            done
+            ;;
+        dlopen)
+            echo " dlopen() of hello.so from hello-dlopen:"
+            EVICT="$DIR/thin/hello.so $DIR/fat/hello.so"
+            rm -rf cache/*
+            bench "thin" -m dlopen -d "$DIR/thin" "$DIR/hello-dlopen"
+            bench "fat, memfd" -m dlopen -d "$DIR/fat" -e LD_AUDIT="$PRELOAD" "$DIR/hello-dlopen"
+            bench "fat, FATELF_CACHE_DIR" -m dlopen -d "$DIR/fat" -e LD_AUDIT="$PRELOAD" \
+                  -e FATELF_CACHE_DIR="$DIR/cache" "$DIR/hello-dlopen"
+            ;;
+        *)
+            echo "Unknown section '$section'" 1>&2
+            exit 1
+            ;;
+        esac
+    done
+done
+
+cd "$TOOLS"
+rm -rf "$DIR"
+
+# end of bench-startup.sh ...
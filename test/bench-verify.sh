@@ -0,0 +1,61 @@
+#!/bin/bash
+
+# Measure verified program start: fatelf-exec on a file with Merkle trees
+#  (which checks only the pages it maps) against hashing the whole file
+#  before running it, the only option without trees. The program carries
+#  SIZE megabytes it never maps, like debug info, which is where a big
+#  record's bytes usually are. "unverified" is fatelf-exec without trees,
+#  for reference.
+#
+# Usage: bench-verify.sh [size_mb] [runs] [scratch_dir]
+
+SIZEMB=${1:-64}
+RUNS=${2:-20}
+SCRATCH=${3:-.}
+
+set -e
+
+. "`dirname "$0"`/common.sh"
+fatelf_setup bench-verify "$SCRATCH" fatelf-exec fatelf-merkle
+
+# The second record just has to be a different target than the host.
+make_stub "$DIR/other.elf" arm
+
+echo 'int main(void) { return 0; }' > "$DIR/main.c"
+gcc -O2 -o "$DIR/small" "$DIR/main.c"
+head -c $((SIZEMB * 1024 * 1024)) /dev/urandom > "$DIR/blob"
+objcopy --add-section .bigdata="$DIR/blob" --set-section-flags .bigdata=noload,readonly "$DIR/small" "$DIR/thin"
+rm -f "$DIR/blob"
+"$TOOLS/fatelf-glue" "$DIR/fat" "$DIR/other.elf" "$DIR/thin"
+"$TOOLS/fatelf-merkle" add "$DIR/fatm" "$DIR/fat"
+chmod +x "$DIR/fat" "$DIR/fatm"
+
+run() {
+    local name="$1"
+    shift
+    "$@" || { echo "$name: failed to start" 1>&2; exit 1; }
+    local start=`date +%s%N`
+    for i in `seq 1 $RUNS`; do
+        "$@"
+    done
+    local end=`date +%s%N`
+    printf "%-34s %8d us per start\n" "$name" $(( (end - start) / (RUNS * 1000) ))
+}
+
+sha256_then_exec() {
+    sha256sum "$DIR/fat" > /dev/null && "$TOOLS/fatelf-exec" "$DIR/fat"
+}
+
+full_merkle_then_exec() {
+    "$TOOLS/fatelf-merkle" verify "$DIR/fatm" host > /dev/null && "$TOOLS/fatelf-exec" "$DIR/fatm"
+}
+
+echo "`ls -l "$DIR/fatm" | awk '{ print $5 }'` byte file, warm cache, $RUNS runs each:"
+run "unverified" "$TOOLS/fatelf-exec" "$DIR/fat"
+run "Merkle, mapped pages only" "$TOOLS/fatelf-exec" "$DIR/fatm"
+run "sha256sum whole file, then run" sha256_then_exec
+run "Merkle, whole record, then run" full_merkle_then_exec
+
+rm -rf "$DIR"
+
+# end of bench-verify.sh ...
@@ -0,0 +1,58 @@
+#!/bin/bash
+
+# Setup and fixtures shared by the test-*.sh and bench-*.sh scripts.
+#  Source it first thing:
+#
+#    . "`dirname "$0"`/common.sh"
+#    fatelf_setup test-foo "$SCRATCH" fatelf-foo
+#
+#  Scripts run from the directory with the built FatELF tools.
+
+TESTDIR=`dirname "${BASH_SOURCE[0]}"`
+TESTDIR=`realpath "$TESTDIR"`
+
+# fatelf_setup NAME SCRATCH [FILE...]: make sure FILEs were built here, then
+#  make an empty SCRATCH/NAME to work in. Sets TOOLS to this directory and
+#  DIR to the new one; the caller stays where it is.
+fatelf_setup() {
+    local name="$1"
+    local scratch="$2"
+    local f
+    shift 2
+    for f in "$@" ; do
+        if [ ! -e "./$f" ] ; then
+            echo "Run this from a directory with the built FatELF tools." 1>&2
+            exit 1
+        fi
+    done
+    TOOLS=`pwd`
+    DIR=`realpath "$scratch"`/$name
+    rm -rf "$DIR"
+    mkdir -p "$DIR"
+}
+
+fail() { echo "FAIL: $*" 1>&2 ; exit 1 ; }
+must_fail() { if "$@" 2> err ; then fail "'$*' worked" ; fi ; }
+size() { stat -c %s "$1" ; }
+offsets() { "$TOOLS/fatelf-info" "$1" | sed -n 's/^  Offset \([0-9]*\)$/\1/p' | tr '\n' ' ' ; }
+
+# make_stub FILE TARGET: write just an ELF header for a target we can't
+#  build here, which is all most tools look at. TARGET is "arm" (32-bit
+#  little-endian ARM) or "ppc64" (64-bit big-endian PowerPC).
+make_stub() {
+    case "$2" in
+    arm) printf '\177ELF\001\001\001\000\000\000\000\000\000\000\000\000\002\000\050\000' > "$1" ;;
+    ppc64) printf '\177ELF\002\000\001\000\000\000\000\000\000\000\000\000\000\002\000\025' > "$1" ;;
+    *) fail "No stub for '$2'" ;;
+    esac
+}
+
+# Only root can drop the page cache; everyone else gets a warm one.
+dropcaches() {
+    sync
+    if [ "x`id -u`" = "x0" ]; then
+        echo 3 > /proc/sys/vm/drop_caches
+    fi
+}
+
+# end of common.sh ...
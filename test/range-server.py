@@ -0,0 +1,93 @@
+#!/usr/bin/env python3
+
+# A stand-in for an artifact store, for test-fetch.sh: serves a directory
+#  over HTTP on localhost, with single-range GET support (python's own
+#  http.server doesn't do ranges). Requests under /redirect/ get a 302 to
+#  the same path without that prefix. Every response is logged to stderr
+#  as "status range-start bytes-sent path", so tests can see how much was
+#  actually downloaded.
+#
+# Usage: range-server.py <port> <directory>
+
+import http.server
+import os
+import re
+import sys
+
+
+class RangeHandler(http.server.SimpleHTTPRequestHandler):
+    protocol_version = 'HTTP/1.1'
+
+    def log_message(self, fmt, *args):
+        pass  # we log our own way, below.
+
+    def note(self, status, start, count):
+        sys.stderr.write('%d %d %d %s\n' % (status, start, count, self.path))
+        sys.stderr.flush()
+
+    def do_GET(self):
+        if self.path.startswith('/redirect/'):
+            self.send_response(302)
+            self.send_header('Location', self.path[len('/redirect'):])
+            self.send_header('Content-Length', '0')
+            self.end_headers()
+            self.note(302, 0, 0)
+            return
+
+        path = self.translate_path(self.path)
+        if not os.path.isfile(path):
+            self.send_error(404)
+            self.note(404, 0, 0)
+            return
+
+        size = os.path.getsize(path)
+        start, end, status = 0, size - 1, 200
+        wanted = self.headers.get('Range')
+        if wanted is not None:
+            m = re.fullmatch(r'bytes=(\d+)-(\d*)', wanted.strip())
+            if m is None:
+                self.send_error(400)
+                return
+            start = int(m.group(1))
+            end = int(m.group(2)) if m.group(2) else size - 1
+            end = min(end, size - 1)
+            if start > end:
+                self.send_response(416)
+                self.send_header('Content-Range', 'bytes */%d' % size)
+                self.send_header('Content-Length', '0')
+                self.end_headers()
+                self.note(416, start, 0)
+                return
+            status = 206
+
+        count = end - start + 1
+        self.send_response(status)
+        self.send_header('Content-Type', 'application/octet-stream')
+        self.send_header('Content-Length', str(count))
+        if status == 206:
+            self.send_header('Content-Range', 'bytes %d-%d/%d' % (start, end, size))
+        self.end_headers()
+
+        with open(path, 'rb') as f:
+            f.seek(start)
+            remaining = count
+            while remaining > 0:
+                data = f.read(min(remaining, 1024 * 1024))
+                if not data:
+                    break
+                self.wfile.write(data)
+                remaining -= len(data)
+        self.note(status, start, count)
+
+
+def main():
+    port = int(sys.argv[1])
+    os.chdir(sys.argv[2])
+    server = http.server.ThreadingHTTPServer(('127.0.0.1', port), RangeHandler)
+    server.serve_forever()
+
+
+if __name__ == '__main__':
+    main()
+
+# end of range-server.py ...
@@ -0,0 +1,144 @@
+#!/bin/bash
+
+# Check aliased records: fatelf-glue stores identical binaries once,
+#  fatelf-validate accepts records that share data (and only those), and
+#  the tools that rewrite files keep the sharing, or refuse to break it.
+#
+# Usage: test-alias.sh [scratch_dir]
+#  Run from a directory with the built FatELF tools. Needs gcc and python3.
+
+SCRATCH=${1:-.}
+
+set -e
+
+. "`dirname "$0"`/common.sh"
+fatelf_setup test-alias "$SCRATCH" fatelf-glue
+
+cd "$DIR"
+cat > prog.c <<EOT
+#include <stdio.h>
+int main(void) { printf("hello\n"); return 0; }
+EOT
+gcc -o prog prog.c
+make_stub arm arm
+make_stub arm2 arm
+printf '\001' >> arm2
+make_stub ppc ppc64
+
+# Records are sorted on disk: arm, x86_64 sysv, x86_64 linux.
+"$TOOLS/fatelf-glue" plain arm prog
+"$TOOLS/fatelf-glue" fat arm prog --osabi=linux prog
+chmod +x fat
+"$TOOLS/fatelf-validate" fat || fail "fatelf-validate"
+"$TOOLS/fatelf-info" fat > info
+grep -q '^fat: FatELF format version 2$' info || fail "aliases need version 2"
+grep -q '^1 records share data with another.$' info || fail "fatelf-info: `cat info`"
+grep -q '^  Shares its data with index #1$' info || fail "fatelf-info: `cat info`"
+set -- `offsets fat`
+[ "$2" = "$3" ] || fail "records don't share data: $*"
+[ `size fat` -eq `size plain` ] || fail "fat is `size fat` bytes, not `size plain`"
+for r in record1 record2 ; do
+    "$TOOLS/fatelf-extract" x fat $r
+    cmp x prog || fail "$r isn't prog"
+done
+if [ -x "$TOOLS/fatelf-exec" ] ; then
+    [ "`"$TOOLS/fatelf-exec" ./fat`" = "hello" ] || fail "fatelf-exec"
+fi
+echo "ok: glue"
+
+# --osabi only makes sense for an alias, and only for ELF inputs.
+must_fail "$TOOLS/fatelf-glue" bad arm --osabi=linux prog
+grep -q 'needs the same binary glued in without it' err || fail "`cat err`"
+[ ! -e bad ] || fail "failed glue left output"
+must_fail "$TOOLS/fatelf-glue" bad --osabi=linux plain prog
+must_fail "$TOOLS/fatelf-glue" bad prog --osabi=nosuchos prog
+# FatELF inputs keep their sharing.
+"$TOOLS/fatelf-glue" fat2 fat ppc
+"$TOOLS/fatelf-info" fat2 | grep -q '^1 records share data with another.$' || fail "reglue lost the alias"
+echo "ok: glue options"
+
+# The flag has to match the records.
+python3 - fat noflag <<EOT
+import sys
+d = bytearray(open(sys.argv[1], 'rb').read())
+d[12] &= ~2
+open(sys.argv[2], 'wb').write(d)
+EOT
+must_fail "$TOOLS/fatelf-validate" noflag
+grep -q "doesn't allow aliases" err || fail "`cat err`"
+"$TOOLS/fatelf-convert" plain2 plain 2
+python3 - plain2 flag <<EOT
+import sys
+d = bytearray(open(sys.argv[1], 'rb').read())
+d[12] |= 2
+open(sys.argv[2], 'wb').write(d)
+EOT
+must_fail "$TOOLS/fatelf-validate" flag
+grep -q "no records share data" err || fail "`cat err`"
+# Aliases are exact; anything else that overlaps is bogus.
+python3 - fat overlap <<EOT
+import struct, sys
+d = bytearray(open(sys.argv[1], 'rb').read())
+size = struct.unpack_from('<Q', d, 16 + 24 * 2 + 16)[0]
+struct.pack_into('<Q', d, 16 + 24 * 2 + 16, size - 1)
+open(sys.argv[2], 'wb').write(d)
+EOT
+must_fail "$TOOLS/fatelf-validate" overlap
+grep -q 'overlap' err || fail "`cat err`"
+echo "ok: validate"
+
+# Removing an alias keeps the data for the other; removing the record the
+#  ELF header describes would leave the alias with the wrong OSABI.
+"$TOOLS/fatelf-remove" noalias fat record2
+"$TOOLS/fatelf-validate" noalias || fail "remove the alias"
+"$TOOLS/fatelf-extract" x noalias record1
+cmp x prog || fail "remove lost the data"
+must_fail "$TOOLS/fatelf-remove" bad fat record1
+grep -q "can't keep it alone" err || fail "`cat err`"
+[ ! -e bad ] || fail "failed remove left output"
+"$TOOLS/fatelf-remove" noarm fat record0
+"$TOOLS/fatelf-validate" noarm || fail "remove arm"
+"$TOOLS/fatelf-info" noarm | grep -q '^1 records share data with another.$' || fail "remove lost the alias"
+echo "ok: remove"
+
+# Same for replace.
+"$TOOLS/fatelf-replace" newarm fat arm2
+"$TOOLS/fatelf-validate" newarm || fail "replace arm"
+"$TOOLS/fatelf-info" newarm | grep -q '^1 records share data with another.$' || fail "replace lost the alias"
+[ `size newarm` -eq `size fat` ] || fail "replace copied the shared data"
+must_fail "$TOOLS/fatelf-replace" bad fat prog
+grep -q "can't keep it alone" err || fail "`cat err`"
+echo "ok: replace"
+
+# The other tools that rewrite files keep the sharing.
+"$TOOLS/fatelf-convert" conv fat 2
+"$TOOLS/fatelf-validate" conv || fail "convert"
+[ `size conv` -eq `size fat` ] || fail "convert copied the shared data"
+must_fail "$TOOLS/fatelf-convert" bad fat 1
+grep -q 'needs FatELF version 2' err || fail "`cat err`"
+"$TOOLS/fatelf-edit" edited fat --remove=record0
+"$TOOLS/fatelf-validate" edited || fail "edit"
+"$TOOLS/fatelf-info" edited | grep -q '^1 records share data with another.$' || fail "edit lost the alias"
+"$TOOLS/fatelf-edit" edited fat --remove=record2
+"$TOOLS/fatelf-validate" edited || fail "edit, remove the alias"
+"$TOOLS/fatelf-edit" edited fat --add=ppc --replace=arm2 --remove=record2
+"$TOOLS/fatelf-validate" edited || fail "edit, remove the alias after other edits"
+# ...and like fatelf-remove and fatelf-replace, won't leave an alias alone.
+for op in --remove=record1 --replace=prog "--add=ppc --remove=record1" ; do
+    must_fail "$TOOLS/fatelf-edit" bad fat $op
+    grep -q "can't keep it alone" err || fail "edit $op: `cat err`"
+done
+[ ! -e bad ] || fail "failed edit left output"
+if [ -x "$TOOLS/fatelf-merkle" ] ; then
+    "$TOOLS/fatelf-merkle" add tree fat
+    "$TOOLS/fatelf-validate" tree || fail "merkle add"
+    "$TOOLS/fatelf-merkle" verify tree > /dev/null || fail "merkle verify"
+    "$TOOLS/fatelf-info" tree | grep -q '^1 records share data with another.$' || fail "merkle add lost the alias"
+fi
+echo "ok: rewriting"
+
+cd "$TOOLS"
+rm -rf "$DIR"
+echo "All alias tests passed."
+
+# end of test-alias.sh ...
@@ -0,0 +1,84 @@
+#!/bin/bash
+
+# Check fatelf-ar: an archive of FatELF objects lists every target's symbol
+#  index, and extracting a target gives a thin archive that links. It also
+#  builds an index with more targets than a version 1 header can hold.
+#
+# Usage: test-ar.sh [scratch_dir]
+#  Run from a directory with the built FatELF tools, on x86_64. Needs gcc
+#  (with -m32), ar, nm and python3.
+
+SCRATCH=${1:-.}
+
+set -e
+
+. "`dirname "$0"`/common.sh"
+fatelf_setup test-ar "$SCRATCH" fatelf-ar
+
+cd "$DIR"
+echo "int foo(void) { return 42; }" > foo.c
+echo "int bar(void) { return 7; }" > bar.c
+cat > main.c <<EOT
+int foo(void);
+int bar(void);
+int main(void) { return ((foo() + bar()) == 49) ? 0 : 1; }
+EOT
+for bits in 64 32 ; do
+    for f in foo bar ; do
+        gcc -m$bits -c -o $f$bits.o $f.c
+    done
+done
+"$TOOLS/fatelf-glue" foo.o foo64.o foo32.o
+"$TOOLS/fatelf-glue" bar.o bar64.o bar32.o
+
+# create, then list.
+"$TOOLS/fatelf-ar" create lib.a foo.o bar.o
+[ "`ar t lib.a | head -n 1`" = "__.FATELF.INDEX" ] || fail "no index member: `ar t lib.a`"
+"$TOOLS/fatelf-ar" list lib.a > list
+grep -q '^lib.a: FatELF archive, 2 targets.$' list || fail "`cat list`"
+for target in x86_64:64bits i386:32bits ; do
+    sed -n "/^Archive index for '$target/,/^$/p" list > syms
+    grep -q '^foo in foo.o$' syms || fail "no foo for $target: `cat list`"
+    grep -q '^bar in bar.o$' syms || fail "no bar for $target: `cat list`"
+done
+echo "ok: create and list"
+
+# extract gives each target's members, thin, with a symbol index that
+#  links (32-bit libc may not be here, so only the host's is linked).
+for bits in 64 32 ; do
+    [ $bits = 64 ] && target=x86_64 || target=i386
+    "$TOOLS/fatelf-ar" extract thin$bits.a lib.a $target
+    [ "`ar t thin$bits.a | tr '\n' ' '`" = "foo.o bar.o " ] || fail "members: `ar t thin$bits.a`"
+    mkdir -p x$bits
+    ( cd x$bits && ar x ../thin$bits.a )
+    for f in foo bar ; do
+        cmp x$bits/$f.o $f$bits.o || fail "$f.o for $target isn't the thin object"
+    done
+    nm -s thin$bits.a | grep -q '^foo in foo.o$' || fail "no symbol index for $target"
+done
+gcc -o prog main.c thin64.a
+./prog || fail "linking against the x86_64 archive"
+echo "ok: extract"
+
+# More than 255 targets: copies of one object that differ by OSABI.
+python3 - foo64.o 300 <<EOT
+import sys
+data = bytearray(open(sys.argv[1], 'rb').read())
+for k in range(int(sys.argv[2])):
+    data[7], data[8] = divmod(k, 256)
+    open('many%d.o' % k, 'wb').write(data)
+EOT
+"$TOOLS/fatelf-glue" many.o `for k in \`seq 0 299\` ; do echo many$k.o ; done`
+"$TOOLS/fatelf-ar" create many.a many.o bar.o
+"$TOOLS/fatelf-ar" list many.a > list
+grep -q '^many.a: FatELF archive, 301 targets.$' list || fail "`head -n 1 list`"
+last=`sed -n "s/^Archive index for '\(.*\)' (1 symbols):$/\1/p" list | tail -n 1`
+"$TOOLS/fatelf-ar" extract thin.a many.a "$last"
+[ "`ar t thin.a`" = "many.o" ] || fail "members for $last: `ar t thin.a`"
+echo "ok: many targets"
+
+cd "$TOOLS"
+rm -rf "$DIR"
+echo "All ar tests passed."
+
+# end of test-ar.sh ...
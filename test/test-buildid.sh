@@ -0,0 +1,85 @@
+#!/bin/bash
+
+# Check fatelf-buildid: build-ids are read from every record of a FatELF
+#  file and from plain ELF files, agree with readelf, can be looked up in
+#  the index, and re-indexing only reads the files that changed.
+#
+# Usage: test-buildid.sh [scratch_dir]
+#  Run from a directory with the built FatELF tools. Needs gcc and readelf.
+
+SCRATCH=${1:-.}
+
+set -e
+
+. "`dirname "$0"`/common.sh"
+fatelf_setup test-buildid "$SCRATCH" fatelf-buildid
+
+mkdir -p "$DIR/tree/sub"
+BUILDID="$TOOLS/fatelf-buildid"
+
+readelf_id() { readelf -n "$1" | sed -n 's/.*Build ID: \([0-9a-f]*\).*/\1/p' ; }
+
+cd "$DIR"
+echo 'int main(void) { return 0; }' > a.c
+echo 'int main(void) { return 1; }' > b.c
+gcc -Wl,--build-id=sha1 -o a a.c
+gcc -Wl,--build-id=md5 -o b b.c
+gcc -Wl,--build-id=none -o none a.c
+gcc -Wl,--build-id -c -o a.o a.c
+make_stub arm arm
+IDA=`readelf_id a`
+IDB=`readelf_id b`
+[ -n "$IDA" ] && [ -n "$IDB" ] || fail "gcc didn't add build-ids"
+
+# Each record, read in place.
+"$TOOLS/fatelf-glue" tree/fat arm a
+"$BUILDID" show tree/fat > out
+grep -q "^tree/fat	1	x86_64:.*	$IDA$" out || fail "record 1: `cat out`"
+[ `wc -l < out` -eq 1 ] || fail "the arm stub has a build-id: `cat out`"
+"$BUILDID" show b | grep -q "^b	-	.*	$IDB$" || fail "plain ELF"
+"$BUILDID" show none | grep -q "(no build-id)" || fail "no build-id"
+echo "ok: show"
+
+cp b tree/sub/b
+cp none tree/sub/none
+echo "not an ELF" > tree/sub/text
+"$BUILDID" index idx tree > out
+grep -q '^4 files: 4 read, 0 unchanged; 2 build-ids indexed.$' out || fail "index: `cat out`"
+"$BUILDID" lookup idx "$IDA" > out
+OFFSET=`"$TOOLS/fatelf-info" tree/fat | sed -n 's/.*Offset \([0-9]*\).*/\1/p' | tail -1`
+grep -q "^$IDA	$DIR/tree/fat	1	x86_64:.*	$OFFSET	[0-9]*$" out || fail "lookup: `cat out`"
+"$BUILDID" lookup idx `echo $IDB | tr a-f A-F` | grep -q "	$DIR/tree/sub/b	-	" || fail "lookup plain ELF"
+set +e
+"$BUILDID" lookup idx 0123456789abcdef 2> err
+RC=$?
+set -e
+[ $RC -eq 2 ] || fail "a missing build-id exited with $RC"
+grep -q 'not found' err || fail "wrong error: `cat err`"
+echo "ok: lookup"
+
+# Only changed files are read again; gone files drop out.
+"$BUILDID" index idx tree | grep -q '^4 files: 0 read, 4 unchanged; 2 build-ids indexed.$' || fail "nothing changed"
+cp a tree/sub/b
+touch -d '2001-01-01' tree/sub/b
+rm tree/sub/none
+"$BUILDID" --jobs=2 index idx tree > out
+grep -q '^3 files: 1 read, 2 unchanged; 2 build-ids indexed.$' out || fail "incremental: `cat out`"
+"$BUILDID" lookup idx "$IDB" 2> /dev/null && fail "stale build-id found"
+[ `"$BUILDID" lookup idx "$IDA" | wc -l` -eq 2 ] || fail "a shared build-id lost a file"
+"$BUILDID" index --rebuild idx tree | grep -q '^3 files: 3 read, 0 unchanged' || fail "--rebuild"
+echo "ok: incremental"
+
+# Relocatable objects only have sections.
+[ "`"$BUILDID" show a.o | cut -f4`" = "`readelf_id a.o`" ] || fail "section notes"
+echo "ok: objects"
+
+echo "junk" > bad
+"$BUILDID" lookup bad "$IDA" 2> err && fail "a bogus index was read"
+grep -q 'is not a build-id index' err || fail "wrong error: `cat err`"
+echo "ok: bogus index"
+
+cd "$TOOLS"
+rm -rf "$DIR"
+echo "All buildid tests passed."
+
+# end of test-buildid.sh ...
@@ -0,0 +1,118 @@
+#!/bin/bash
+
+# Check fatelf-cc with the host gcc's multilib: -m64 and -m32 objects come
+#  out as one FatELF file, FatELF objects link into a FatELF program,
+#  depfiles are merged so make rebuilds the right things, and failures
+#  report once and leave no output.
+#
+# Usage: test-cc.sh [scratch_dir]
+#  Run from a directory with the built FatELF tools. Needs gcc with -m32
+#  support for compiling, and make.
+
+SCRATCH=${1:-.}
+
+set -e
+
+. "`dirname "$0"`/common.sh"
+fatelf_setup test-cc "$SCRATCH" fatelf-cc
+
+mkdir -p "$DIR/include32" "$DIR/include64"
+CC="$TOOLS/fatelf-cc"
+
+cd "$DIR"
+echo "int foo(void);" > foo.h
+cat > foo.c <<EOF
+#include "foo.h"
+#include "wordsize.h"
+int foo(void) { return WORDSIZE; }
+EOF
+cat > main.c <<EOF
+#include <stdio.h>
+#include "foo.h"
+int main(void) { printf("%d\n", foo()); return 0; }
+EOF
+echo "#define WORDSIZE 32" > include32/wordsize.h
+echo "#define WORDSIZE 64" > include64/wordsize.h
+
+# Each target can have its own flags; their headers all end up in the depfile.
+T64="--target=-m64 -Iinclude64"
+T32="--target=-m32 -Iinclude32"
+"$CC" "$T64" "$T32" gcc -c foo.c -o foo.o -MMD -MP
+"$TOOLS/fatelf-info" foo.o > out
+grep -q "'x86_64:64bits" out || fail "no x86_64 record"
+grep -q "'i386:32bits" out || fail "no i386 record"
+"$TOOLS/fatelf-extract" foo32.o foo.o i386
+"$TOOLS/fatelf-extract" foo64.o foo.o x86_64
+gcc -m32 -Iinclude32 -c foo.c -o thin32.o
+gcc -m64 -Iinclude64 -c foo.c -o thin64.o
+cmp foo32.o thin32.o || fail "i386 record differs from a plain build"
+cmp foo64.o thin64.o || fail "x86_64 record differs from a plain build"
+echo "ok: multilib objects"
+
+grep -q '^foo.o: foo.c' foo.d || fail "depfile names the wrong target: `head -1 foo.d`"
+for h in foo.h include32/wordsize.h include64/wordsize.h ; do
+    grep -q " $h" foo.d || fail "depfile lacks $h"
+    grep -q "^$h:$" foo.d || fail "depfile lacks -MP rule for $h"
+done
+[ `grep -c ' foo.h' foo.d` -eq 1 ] || fail "depfile repeats foo.h"
+grep -q '/proc/self/fd' foo.d && fail "depfile mentions a memfd"
+mkdir deps
+"$CC" "$T64" "$T32" gcc -c foo.c -o foo.o -MD -MF deps/foo.dep
+grep -q '^foo.o: foo.c' deps/foo.dep || fail "-MF ignored"
+grep -q 'stdc-predef.h' deps/foo.dep || fail "-MD lost system headers"
+echo "ok: depfiles"
+
+# Links: FatELF objects are thinned per target. Two x86_64 targets that
+#  differ by ISA level, since the 32-bit libc may not be installed.
+L1="--target=-m64 -Iinclude64"
+L2="--target=-m64 -Iinclude64 -march=x86-64-v2 isa=x86-64-v2"
+"$CC" "$L1" "$L2" gcc -c foo.c -o foo2.o
+"$CC" "$L1" "$L2" gcc -c main.c -o main.o
+"$CC" --jobs=1 "$L1" "$L2" gcc main.o foo2.o -o prog
+"$TOOLS/fatelf-info" prog | grep -q "x86_64:64bits:le:sysv:osabiver0:x86-64-v2'" || fail "no x86-64-v2 record"
+"$TOOLS/fatelf-extract" prog-base prog x86_64:64bits:le:sysv:osabiver0
+chmod +x prog-base
+[ "`./prog-base`" = "64" ] || fail "linked program is wrong"
+if [ -x "$TOOLS/fatelf-exec" ] ; then
+    [ "`"$TOOLS/fatelf-exec" ./prog`" = "64" ] || fail "fat program doesn't run"
+fi
+echo "ok: links"
+
+# make rebuilds the right things.
+cat > Makefile <<EOF
+CC := $CC "$T64" "$T32" gcc
+all: foo.o
+foo.o: foo.c
+	\$(CC) -c foo.c -o foo.o -MMD -MP
+-include foo.d
+EOF
+rm -f foo.o foo.d
+make -s > /dev/null
+make -q || fail "make wants to rebuild right after building"
+sleep 1
+touch include32/wordsize.h
+make -q && fail "make missed a header only one target uses"
+make -s > /dev/null
+make -q || fail "make still wants to rebuild"
+echo "ok: make"
+
+# Failures: the compiler's status, one copy of the error, no output.
+echo "int broken = ;" > bad.c
+set +e
+"$CC" "$T64" "$T32" gcc -c bad.c -o bad.o 2> err
+RC=$?
+set -e
+[ $RC -ne 0 ] || fail "a failed compile succeeded"
+[ ! -e bad.o ] || fail "a failed compile left output"
+[ `grep -c 'error:' err` -eq 1 ] || fail "errors weren't merged: `cat err`"
+echo "ok: failures"
+
+# Preprocessing has nothing to glue; the first target does it.
+"$CC" "$T64" "$T32" gcc -E -dM foo.c | grep -q 'WORDSIZE 64' || fail "-E"
+echo "ok: single target modes"
+
+cd "$TOOLS"
+rm -rf "$DIR"
+echo "All cc tests passed."
+
+# end of test-cc.sh ...
@@ -0,0 +1,140 @@
+#!/bin/bash
+
+# Check FatELF version 2 headers and fatelf-convert: conversion works both
+#  ways and keeps every record and the junk, version 2 records are sorted on
+#  disk, and readers refuse a version 2 file whose records aren't, that has
+#  flags they don't know, or whose record count doesn't fit in the file.
+#
+# Usage: test-convert.sh [scratch_dir]
+#  Run from a directory with the built FatELF tools. Needs python3.
+
+SCRATCH=${1:-.}
+
+set -e
+
+. "`dirname "$0"`/common.sh"
+fatelf_setup test-convert "$SCRATCH" fatelf-convert
+
+version() { "$TOOLS/fatelf-info" "$1" | sed -n 's/^.*: FatELF format version \([0-9]*\)$/\1/p' ; }
+machines() { "$TOOLS/fatelf-info" "$1" | sed -n 's/^  Machine \([0-9]*\) .*/\1/p' | tr '\n' ' ' ; }
+targets() { "$TOOLS/fatelf-info" "$1" | sed -n "s/^  Target name: '\([^']*\)'.*/\1/p" ; }
+
+cd "$DIR"
+cp "$TOOLS/fatelf-info" host
+make_stub arm arm
+make_stub ppc ppc64
+
+# Version 1 keeps the order it was given.
+"$TOOLS/fatelf-glue" v1 host arm ppc
+echo "this is junk" >> v1
+[ "`version v1`" = "1" ] || fail "glue wrote version `version v1`"
+[ "`machines v1`" = "62 40 21 " ] || fail "version 1 records were reordered: `machines v1`"
+
+# ...and version 2 sorts them.
+"$TOOLS/fatelf-convert" v2 v1 2
+"$TOOLS/fatelf-validate" v2 || fail "fatelf-validate v2"
+[ "`version v2`" = "2" ] || fail "convert wrote version `version v2`"
+[ "`machines v2`" = "21 40 62 " ] || fail "version 2 records aren't sorted: `machines v2`"
+"$TOOLS/fatelf-convert" back v2 1
+"$TOOLS/fatelf-validate" back || fail "fatelf-validate back"
+[ "`version back`" = "1" ] || fail "convert wrote version `version back`"
+for f in v2 back ; do
+    for t in `targets v1` ; do
+        "$TOOLS/fatelf-extract" expected v1 "$t"
+        "$TOOLS/fatelf-extract" got $f "$t"
+        cmp got expected || fail "$t in $f"
+    done
+    "$TOOLS/fatelf-info" $f | grep -q '^13 bytes of junk appended' || fail "$f lost the junk"
+done
+echo "ok: convert"
+
+must_fail "$TOOLS/fatelf-convert" bad v1 3
+grep -q 'Unsupported FatELF version 3' err || fail "`cat err`"
+must_fail "$TOOLS/fatelf-convert" bad v1 two
+grep -q "isn't a FatELF version number" err || fail "`cat err`"
+
+# More than 255 records needs version 2.
+python3 - arm 300 <<EOT
+import sys
+data = bytearray(open(sys.argv[1], 'rb').read())
+for k in range(int(sys.argv[2])):
+    data[7], data[8] = divmod(k, 256)
+    open('arm%d' % k, 'wb').write(data)
+EOT
+"$TOOLS/fatelf-glue" many `for k in \`seq 0 299\` ; do echo arm$k ; done`
+[ "`version many`" = "2" ] || fail "300 records in version `version many`"
+"$TOOLS/fatelf-validate" many || fail "fatelf-validate many"
+must_fail "$TOOLS/fatelf-convert" bad many 1
+grep -q 'needs at least FatELF version 2' err || fail "`cat err`"
+[ ! -e bad ] || fail "failed convert left output"
+"$TOOLS/fatelf-extract" got many "arm:32bits:le:hpux:osabiver43"
+cmp got arm299 || fail "binary search found the wrong record"
+echo "ok: version 2 needed"
+
+# Readers check the order, since they binary search.
+python3 - v2 unsorted <<EOT
+import sys
+d = bytearray(open(sys.argv[1], 'rb').read())
+d[16:40], d[40:64] = d[40:64], d[16:40]
+open(sys.argv[2], 'wb').write(d)
+EOT
+for tool in fatelf-info fatelf-validate ; do
+    must_fail "$TOOLS/$tool" unsorted
+    grep -q 'unsorted or duplicate' err || fail "$tool: `cat err`"
+done
+must_fail "$TOOLS/fatelf-extract" got unsorted host
+grep -q 'unsorted or duplicate' err || fail "fatelf-extract: `cat err`"
+# The same swap is fine in version 1.
+python3 - v1 swapped <<EOT
+import sys
+d = bytearray(open(sys.argv[1], 'rb').read())
+d[8:32], d[32:56] = d[32:56], d[8:32]
+open(sys.argv[2], 'wb').write(d)
+EOT
+"$TOOLS/fatelf-validate" swapped || fail "version 1 records in any order"
+echo "ok: unsorted"
+
+# ...and refuse flags they don't know, which might change how to read it.
+python3 - v2 flagged <<EOT
+import sys
+d = bytearray(open(sys.argv[1], 'rb').read())
+d[12] |= 0x80
+open(sys.argv[2], 'wb').write(d)
+EOT
+for tool in fatelf-info fatelf-validate ; do
+    must_fail "$TOOLS/$tool" flagged
+    grep -q 'unknown FatELF header flags' err || fail "$tool: `cat err`"
+done
+must_fail "$TOOLS/fatelf-extract" got flagged host
+grep -q 'unknown FatELF header flags' err || fail "fatelf-extract: `cat err`"
+echo "ok: unknown flags"
+
+# A record count the file can't hold is refused before anything is sized
+#  from it, including counts that would wrap around on 32-bit hosts.
+for count in 0xFFFFFFFF 0xAAAAAAAB 0x0AAAAAAB 4 ; do
+    python3 - v2 bogus $count <<EOT
+import struct, sys
+d = bytearray(open(sys.argv[1], 'rb').read(16 + 24 * 3))
+struct.pack_into('<I', d, 8, int(sys.argv[3], 16))
+open(sys.argv[2], 'wb').write(d)
+EOT
+    for tool in fatelf-info fatelf-validate ; do
+        must_fail "$TOOLS/$tool" bogus
+        grep -q 'truncated FatELF header\|too many records' err || fail "$tool, $count records: `cat err`"
+    done
+    must_fail "$TOOLS/fatelf-extract" got bogus host
+    must_fail "$TOOLS/fatelf-convert" bad bogus 2
+done
+head -c 56 v1 > bogus
+for tool in fatelf-info fatelf-validate ; do
+    must_fail "$TOOLS/$tool" bogus
+    grep -q 'truncated FatELF header' err || fail "$tool, version 1: `cat err`"
+done
+[ ! -e bad ] || fail "failed convert left output"
+echo "ok: bogus record counts"
+
+cd "$TOOLS"
+rm -rf "$DIR"
+echo "All convert tests passed."
+
+# end of test-convert.sh ...
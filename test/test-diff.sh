@@ -0,0 +1,98 @@
+#!/bin/bash
+
+# Check fatelf-diff: records are paired by target, record order and padding
+#  don't count, the canonical digest agrees, and trees compare in one run.
+#
+# Usage: test-diff.sh [scratch_dir]
+#  Run from a directory with the built FatELF tools.
+
+SCRATCH=${1:-.}
+
+set -e
+
+. "`dirname "$0"`/common.sh"
+fatelf_setup test-diff "$SCRATCH" fatelf-diff
+
+cp ./fatelf-info "$DIR/host"
+cp ./fatelf-validate "$DIR/host2"
+make_stub "$DIR/arm" arm
+make_stub "$DIR/arm2" arm
+printf 'changed' >> "$DIR/arm2"
+make_stub "$DIR/ppc64" ppc64
+
+./fatelf-glue "$DIR/a.fat" "$DIR/host" "$DIR/arm"
+./fatelf-glue "$DIR/reordered.fat" "$DIR/arm" "$DIR/host"
+./fatelf-convert "$DIR/v2.fat" "$DIR/a.fat" 2
+./fatelf-glue "$DIR/b.fat" "$DIR/host2" "$DIR/arm" "$DIR/ppc64"
+./fatelf-glue "$DIR/c.fat" "$DIR/host" "$DIR/arm2"
+
+# Equivalent files: exit 0, everything "same".
+for f in reordered v2 ; do
+    ./fatelf-diff "$DIR/a.fat" "$DIR/$f.fat" > "$DIR/out" || fail "$f.fat differs"
+    [ `grep -c '^same' "$DIR/out"` -eq 2 ] || fail "$f.fat: wrong report"
+done
+echo "ok: order, padding and version don't count"
+
+set +e
+./fatelf-diff "$DIR/a.fat" "$DIR/b.fat" > "$DIR/out"
+RC=$?
+set -e
+[ $RC -eq 2 ] || fail "differences exit with $RC, not 2"
+grep -q '^changed *x86_64' "$DIR/out" || fail "changed record not reported"
+grep -q '^same *arm' "$DIR/out" || fail "same record not reported"
+grep -q '^added *ppc64' "$DIR/out" || fail "added record not reported"
+./fatelf-diff "$DIR/b.fat" "$DIR/a.fat" | grep -q '^removed *ppc64' || fail "removed record not reported"
+./fatelf-diff "$DIR/a.fat" "$DIR/c.fat" | grep -q '^changed *arm' || fail "small change not reported"
+echo "ok: added, removed and changed records"
+
+# Junk, and padding in front of it.
+cp "$DIR/a.fat" "$DIR/junky.fat"
+echo "junk" >> "$DIR/junky.fat"
+./fatelf-diff "$DIR/a.fat" "$DIR/junky.fat" | grep -q '^added *junk' || fail "added junk not reported"
+cp "$DIR/a.fat" "$DIR/padded.fat"
+head -c 1000 /dev/zero >> "$DIR/padded.fat"
+echo "junk" >> "$DIR/padded.fat"
+./fatelf-diff "$DIR/junky.fat" "$DIR/padded.fat" > /dev/null || fail "padding before junk counted"
+echo "ok: junk"
+
+# The canonical digest.
+./fatelf-diff --digest "$DIR/a.fat" "$DIR/reordered.fat" "$DIR/v2.fat" "$DIR/b.fat" > "$DIR/digests"
+[ `awk '{ print $1 }' "$DIR/digests" | sort -u | wc -l` -eq 2 ] || fail "digests don't group right"
+FATELF_SHA256=portable ./fatelf-diff --digest --jobs=1 "$DIR/a.fat" "$DIR/reordered.fat" "$DIR/v2.fat" "$DIR/b.fat" > "$DIR/digests2"
+cmp "$DIR/digests" "$DIR/digests2" || fail "digest depends on the SHA-256 code or threads"
+./fatelf-diff --digest "$DIR/host" | cmp - <(sha256sum "$DIR/host") || fail "plain file digest isn't its SHA-256"
+echo "ok: digests"
+
+# Trees.
+mkdir -p "$DIR/t1/bin" "$DIR/t2/bin"
+cp "$DIR/a.fat" "$DIR/t1/bin/tool"
+cp "$DIR/reordered.fat" "$DIR/t2/bin/tool"
+cp "$DIR/a.fat" "$DIR/t1/bin/other"
+cp "$DIR/b.fat" "$DIR/t2/bin/other"
+echo "hello" > "$DIR/t1/readme"
+echo "hello" > "$DIR/t2/readme"
+echo "old" > "$DIR/t1/gone"
+echo "new" > "$DIR/t2/new"
+ln -s tool "$DIR/t1/bin/link"
+ln -s other "$DIR/t2/bin/link"
+set +e
+./fatelf-diff --tree "$DIR/t1" "$DIR/t2" > "$DIR/out"
+RC=$?
+set -e
+[ $RC -eq 2 ] || fail "tree differences exit with $RC, not 2"
+grep -q '^bin/other: changed *x86_64' "$DIR/out" || fail "tree: changed record"
+grep -q '^bin/other: added *ppc64' "$DIR/out" || fail "tree: added record"
+grep -q '^bin/link: changed *symlink' "$DIR/out" || fail "tree: symlink"
+grep -q '^gone: removed' "$DIR/out" || fail "tree: removed file"
+grep -q '^new: added' "$DIR/out" || fail "tree: added file"
+grep -q 'bin/tool' "$DIR/out" && fail "tree: equivalent file reported"
+grep -q '^2 same, 2 changed, 1 added, 1 removed.$' "$DIR/out" || fail "tree: wrong summary"
+rm "$DIR/t1/gone" "$DIR/t2/new" "$DIR/t1/bin/link" "$DIR/t2/bin/link"
+cp "$DIR/b.fat" "$DIR/t1/bin/other"
+./fatelf-diff --tree "$DIR/t1" "$DIR/t2" > /dev/null || fail "equivalent trees differ"
+echo "ok: trees"
+
+rm -rf "$DIR"
+echo "All diff tests passed."
+
+# end of test-diff.sh ...
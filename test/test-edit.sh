@@ -0,0 +1,112 @@
+#!/bin/bash
+
+# Check fatelf-edit: mixed --add/--remove/--replace/--ops sequences apply in
+#  order, editing a file in place works, the output keeps the input's mode
+#  across the temp file's rename, and a failed edit leaves nothing behind.
+#
+# Usage: test-edit.sh [scratch_dir]
+#  Run from a directory with the built FatELF tools.
+
+SCRATCH=${1:-.}
+
+set -e
+
+. "`dirname "$0"`/common.sh"
+fatelf_setup test-edit "$SCRATCH" fatelf-edit
+
+machines() { "$TOOLS/fatelf-info" "$1" | sed -n 's/^  Machine \([0-9]*\) .*/\1/p' | tr '\n' ' ' ; }
+mode() { stat -c %a "$1" ; }
+
+# has FATFILE TARGET ELF: the record for TARGET is ELF, byte for byte.
+has() {
+    "$TOOLS/fatelf-extract" got "$1" "$2"
+    cmp got "$3" || fail "$2 in $1 isn't $3"
+}
+
+# Temp files are named after the output.
+no_temps() {
+    [ -z "`ls | grep '\.edit-'`" ] || fail "temp files left: `ls | grep '\.edit-'`"
+}
+
+cd "$DIR"
+cp "$TOOLS/fatelf-info" host
+cp "$TOOLS/fatelf-extract" host2
+make_stub arm arm
+make_stub ppc ppc64
+# same targets, different bytes.
+cp arm arm2 ; echo "new arm" >> arm2
+cp ppc ppc2 ; echo "new ppc" >> ppc2
+"$TOOLS/fatelf-glue" fat host arm
+
+# Every kind of operation at once.
+"$TOOLS/fatelf-edit" out fat --add=ppc --remove=arm --replace=host2
+"$TOOLS/fatelf-validate" out || fail "fatelf-validate out"
+[ "`machines out`" = "62 21 " ] || fail "records: `machines out`"
+has out host host2
+has out ppc64 ppc
+# They apply in order: adding a target only works once it's gone.
+"$TOOLS/fatelf-edit" out fat --remove=arm --add=arm2
+has out arm arm2
+must_fail "$TOOLS/fatelf-edit" out2 fat --add=arm2 --remove=arm
+grep -q "'arm2' is for the same target as arm:" err || fail "`cat err`"
+# ...and a replace sees an earlier add.
+"$TOOLS/fatelf-edit" out fat --add=ppc --replace=ppc2 --replace=arm2
+has out ppc64 ppc2
+has out arm arm2
+must_fail "$TOOLS/fatelf-edit" out2 fat --replace=ppc
+grep -q "No record matches 'ppc'" err || fail "`cat err`"
+must_fail "$TOOLS/fatelf-edit" out2 fat --remove=arm --remove=host
+grep -q "That would leave no records in 'fat'" err || fail "`cat err`"
+[ ! -e out2 ] || fail "failed edit left output"
+echo "ok: operations"
+
+# --ops files, both spellings, mixed with the command line in order.
+cat > ops <<EOT
+# a comment, then a blank line
+
+add ppc
+  --replace=arm2
+remove host
+EOT
+"$TOOLS/fatelf-edit" out fat --replace=host2 --ops=ops --add=host
+[ "`machines out`" = "40 21 62 " ] || fail "records: `machines out`"
+has out arm arm2
+has out ppc64 ppc
+has out x86_64 host
+echo "frobnicate arm" > badops
+must_fail "$TOOLS/fatelf-edit" out2 fat --ops=badops
+grep -q "badops:1: unknown operation 'frobnicate'" err || fail "`cat err`"
+echo "add" > badops
+must_fail "$TOOLS/fatelf-edit" out2 fat --ops=badops
+grep -q "badops:1: expected an operation and an argument" err || fail "`cat err`"
+echo "ok: ops files"
+
+# In place: the file is replaced whole, and keeps its mode.
+cp fat inplace
+chmod 751 inplace
+"$TOOLS/fatelf-edit" inplace inplace --replace=arm2 --add=ppc
+"$TOOLS/fatelf-validate" inplace || fail "fatelf-validate inplace"
+[ "`mode inplace`" = "751" ] || fail "in place edit changed the mode to `mode inplace`"
+has inplace arm arm2
+has inplace ppc64 ppc
+has inplace x86_64 host
+no_temps
+# A new output gets the input's mode, not the temp file's 0600.
+chmod 640 fat
+rm -f out
+"$TOOLS/fatelf-edit" out fat --add=ppc
+[ "`mode out`" = "640" ] || fail "new output has mode `mode out`"
+chmod 755 fat
+# A failed in place edit leaves the file alone.
+cp inplace before
+must_fail "$TOOLS/fatelf-edit" inplace inplace --remove=ppc --replace=ppc2
+cmp inplace before || fail "failed edit changed the input"
+[ "`mode inplace`" = "751" ] || fail "failed edit changed the mode"
+no_temps
+echo "ok: in place"
+
+cd "$TOOLS"
+rm -rf "$DIR"
+echo "All edit tests passed."
+
+# end of test-edit.sh ...
@@ -0,0 +1,151 @@
+#!/bin/bash
+
+# Check fatelf-exec: dynamic, non-PIE, static and static-PIE programs run
+#  straight out of a FatELF file, with their arguments, environment, exit
+#  status, zeroed bss, threads and dlopen() intact, and without a copy.
+#  If binfmt_misc is writable (we're root), it's tried that way too.
+#
+# Usage: test-exec.sh [scratch_dir]
+#  Run from a directory with the built FatELF tools. Needs gcc, and a
+#  static libc for the static programs (they're skipped without one).
+
+SCRATCH=${1:-.}
+
+set -e
+
+. "`dirname "$0"`/common.sh"
+fatelf_setup test-exec "$SCRATCH" fatelf-exec
+
+EXEC="`pwd`/fatelf-exec"
+
+cat > "$DIR/prog.c" <<EOF
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <dlfcn.h>
+
+static char bss[200000];  // more than a page, past the end of the file.
+static __thread int tls = 5;
+int data = 42;
+
+static void *thread_fn(void *arg) { tls++; return arg; }
+
+int main(int argc, char **argv)
+{
+    pthread_t thread;
+    char line[512];
+    FILE *maps;
+    int i;
+
+    for (i = 0; i < (int) sizeof (bss); i++)
+        if (bss[i]) { printf("dirty bss\n"); return 3; }
+    if (pthread_create(&thread, NULL, thread_fn, NULL) || pthread_join(thread, NULL))
+        return 4;
+    if (tls != 5)
+        return 5;
+    free(memset(malloc(1 << 20), 1, 1 << 20));
+
+    printf("data=%d argc=%d", data, argc);
+    for (i = 0; i < argc; i++)
+        printf(" [%s]", argv[i]);
+    printf(" env=%s\n", getenv("FATELF_TEST") ? getenv("FATELF_TEST") : "(null)");
+
+    if ((argc > 1) && (strcmp(argv[1], "dlopen") == 0))
+    {
+        void *lib = dlopen("libm.so.6", RTLD_NOW);
+        printf("dlopen %s\n", (lib && dlsym(lib, "cos")) ? "ok" : "failed");
+    }
+
+    // Show where the code came from.
+    if ((maps = fopen("/proc/self/maps", "r")) != NULL)
+    {
+        while (fgets(line, sizeof (line), maps))
+            if (strstr(line, "r-xp") && strstr(line, argv[0] + 2))
+                printf("mapped: %s", strchr(line, '/'));
+        fclose(maps);
+    }
+    return 7;
+}
+EOF
+
+make_stub "$DIR/arm" arm
+KINDS="dynamic nopie"
+gcc -o "$DIR/dynamic" "$DIR/prog.c" -pthread -ldl
+gcc -no-pie -o "$DIR/nopie" "$DIR/prog.c" -pthread -ldl
+if gcc -static -o "$DIR/static" "$DIR/prog.c" -pthread 2> /dev/null ; then
+    gcc -static-pie -o "$DIR/static-pie" "$DIR/prog.c" -pthread 2> /dev/null
+    KINDS="$KINDS static static-pie"
+else
+    echo "skipped: no static libc"
+fi
+
+cd "$DIR"
+for kind in $KINDS ; do
+    "$OLDPWD/fatelf-glue" "$kind.fat" arm "$kind"
+    chmod +x "$kind.fat"
+    set +e
+    FATELF_TEST="x y" "$EXEC" "./$kind.fat" one "two three" > out
+    RC=$?
+    ./$kind one "two three" > /dev/null
+    EXPECTED=$?
+    set -e
+    [ $RC -eq $EXPECTED ] || fail "$kind: exit status $RC, not $EXPECTED"
+    grep -q "^data=42 argc=3 \[./$kind.fat\] \[one\] \[two three\] env=x y$" out || fail "$kind: wrong output: `cat out`"
+    grep -q "^mapped: $DIR/$kind.fat$" out || fail "$kind: not mapped from the fat file"
+    echo "ok: $kind"
+done
+
+# dlopen() after starting through us.
+"$EXEC" ./dynamic.fat dlopen | grep -q '^dlopen ok$' || fail "dlopen failed"
+echo "ok: dlopen"
+
+# argv[0] can be set, and options after the program are the program's.
+"$EXEC" --argv0=./renamed.fat ./dynamic.fat --verbose | grep -q '^data=42 argc=2 \[./renamed.fat\] \[--verbose\]' || fail "--argv0"
+echo "ok: arguments"
+
+# The memfd path, and plain ELF files.
+"$EXEC" --extract ./dynamic.fat > out || true
+grep -q '^data=42 argc=1' out || fail "--extract: `cat out`"
+grep -q "^mapped: $DIR/dynamic.fat" out && fail "--extract still mapped the fat file"
+"$EXEC" ./dynamic > out || true
+grep -q "^mapped: $DIR/dynamic$" out || fail "plain ELF not run in place"
+echo "ok: memfd and plain ELF"
+
+# Things that shouldn't run.
+make_stub arm2 arm
+make_stub ppc64 ppc64
+"$OLDPWD/fatelf-glue" foreign.fat arm2 ppc64
+chmod +x foreign.fat
+"$EXEC" ./foreign.fat 2> err && fail "foreign.fat ran"
+grep -q 'no record that runs on this machine' err || fail "wrong error: `cat err`"
+chmod -x dynamic.fat
+"$EXEC" ./dynamic.fat 2> err && fail "ran without execute permission"
+grep -q 'Permission denied' err || fail "wrong error: `cat err`"
+chmod +x dynamic.fat
+echo "ok: refusals"
+
+# As a binfmt_misc interpreter, if we're allowed to register one.
+BINFMT=/proc/sys/fs/binfmt_misc
+if [ -w "$BINFMT/register" ] ; then
+    NAME="fatelf-test-$$"
+    echo ":$NAME:M::\xfa\x70\x0e\x1f::$EXEC:OP" > "$BINFMT/register"
+    trap "echo -1 > '$BINFMT/$NAME' 2> /dev/null || true" EXIT
+    set +e
+    FATELF_TEST=binfmt ./dynamic.fat one > out
+    RC=$?
+    set -e
+    echo -1 > "$BINFMT/$NAME"
+    trap - EXIT
+    [ $RC -eq 7 ] || fail "binfmt_misc: exit status $RC"
+    grep -q '^data=42 argc=2 \[./dynamic.fat\] \[one\] env=binfmt$' out || fail "binfmt_misc: wrong output: `cat out`"
+    echo "ok: binfmt_misc"
+else
+    echo "skipped: binfmt_misc isn't writable"
+fi
+
+cd "$OLDPWD"
+rm -rf "$DIR"
+echo "All exec tests passed."
+
+# end of test-exec.sh ...
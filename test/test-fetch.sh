@@ -0,0 +1,95 @@
+#!/bin/bash
+
+# Check fatelf-fetch against a local HTTP server (range-server.py): it
+#  should get the same bytes fatelf-extract would, while downloading only
+#  the FatELF header and the record it wants.
+#
+# Usage: test-fetch.sh [scratch_dir] [port]
+#  Run from a directory with the built FatELF tools. Needs python3.
+
+SCRATCH=${1:-.}
+PORT=${2:-18080}
+
+set -e
+
+. "`dirname "$0"`/common.sh"
+fatelf_setup test-fetch "$SCRATCH" fatelf-fetch
+
+mkdir -p "$DIR/www"
+
+# A host binary, a big host binary (so the fetch is split into parts), and
+#  a tiny record for another target, with some junk at the end.
+cp ./fatelf-info "$DIR/host"
+cp ./fatelf-info "$DIR/bighost"
+dd if=/dev/urandom of="$DIR/bighost" bs=1M count=40 oflag=append conv=notrunc status=none
+make_stub "$DIR/other" arm
+./fatelf-glue "$DIR/www/small.fat" "$DIR/host" "$DIR/other"
+./fatelf-glue "$DIR/www/big.fat" "$DIR/bighost" "$DIR/other"
+cp "$DIR/www/small.fat" "$DIR/www/junk.fat"
+echo "this is junk" >> "$DIR/www/junk.fat"
+echo "hello" > "$DIR/hello"
+./fatelf-resource add "$DIR/www/res.fat" "$DIR/www/junk.fat" hello "$DIR/hello"
+
+python3 "$TESTDIR/range-server.py" "$PORT" "$DIR/www" 2> "$DIR/server.log" &
+SERVER=$!
+trap 'kill $SERVER 2>/dev/null' EXIT
+for i in `seq 50` ; do
+    (echo > /dev/tcp/127.0.0.1/$PORT) 2>/dev/null && break
+    sleep 0.1
+done
+
+URL="http://127.0.0.1:$PORT"
+
+check() {  # check <name> <fatfile> <target> [fetch options...]
+    local name="$1" fat="$2" target="$3"
+    shift 3
+    ./fatelf-extract "$DIR/expected" "$DIR/www/$fat" "$target"
+    ./fatelf-fetch "$@" "$DIR/got" "$URL/$fat" "$target" || fail "$name: fetch failed"
+    cmp "$DIR/expected" "$DIR/got" || fail "$name: wrong bytes"
+    echo "ok: $name"
+}
+
+: > "$DIR/server.log"
+check "host record" small.fat host
+SENT=`awk '{ n += $3 } END { print n }' "$DIR/server.log"`
+FULL=`stat -c %s "$DIR/www/small.fat"`
+RECORD=`stat -c %s "$DIR/host"`
+[ "$SENT" -lt "$FULL" ] || fail "downloaded $SENT bytes of a $FULL byte file"
+[ "$SENT" -le $(( RECORD + 64 )) ] || fail "downloaded $SENT bytes for a $RECORD byte record"
+echo "ok: downloaded $SENT of $FULL bytes"
+
+check "named target" small.fat record1
+check "junk" junk.fat host --junk
+./fatelf-fetch "$DIR/got" "$URL/junk.fat" host
+cmp -s "$DIR/got" "$DIR/host" || fail "junk came along without --junk"
+echo "ok: no junk without --junk"
+check "junk with resources" res.fat host --junk
+
+: > "$DIR/server.log"
+check "parallel parts" big.fat host --connections=4
+PARTS=`grep -c '^206' "$DIR/server.log"`
+[ "$PARTS" -gt 3 ] || fail "big record came in only $PARTS requests"
+echo "ok: big record came in $PARTS requests"
+
+check "big record, default connections" big.fat host
+./fatelf-fetch "$DIR/got" "$URL/redirect/small.fat" host
+cmp "$DIR/got" "$DIR/host" || fail "redirect: wrong bytes"
+echo "ok: followed redirect"
+
+rm -f "$DIR/got"
+if ./fatelf-fetch "$DIR/got" "$URL/small.fat" ppc 2>/dev/null; then
+    fail "fetched a target that isn't there"
+fi
+[ ! -e "$DIR/got" ] || fail "left output behind after failing"
+echo "ok: missing target fails"
+
+if ./fatelf-fetch "$DIR/got" "$URL/nope.fat" host 2>/dev/null; then
+    fail "fetched a file that isn't there"
+fi
+echo "ok: missing file fails"
+
+rm -rf "$DIR"
+echo "All fetch tests passed."
+
+# end of test-fetch.sh ...
+
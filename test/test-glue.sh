@@ -0,0 +1,101 @@
+#!/bin/bash
+
+# Check fatelf-glue with FatELF inputs: their records are copied into the
+#  output, a target in two inputs is refused even when both are FatELF
+#  files, --junk=keep|first|drop decides what happens to their junk, and
+#  the output may not be one of the inputs.
+#
+# Usage: test-glue.sh [scratch_dir]
+#  Run from a directory with the built FatELF tools.
+
+SCRATCH=${1:-.}
+
+set -e
+
+. "`dirname "$0"`/common.sh"
+fatelf_setup test-glue "$SCRATCH" fatelf-glue
+
+records() { "$TOOLS/fatelf-info" "$1" | sed -n 's/^\([0-9]*\) records\.$/\1/p' ; }
+junk() { "$TOOLS/fatelf-info" "$1" | sed -n 's/^\([0-9]*\) bytes of junk appended.*/\1/p' ; }
+
+cd "$DIR"
+cp "$TOOLS/fatelf-info" host
+make_stub arm arm
+make_stub ppc ppc64
+
+# FatELF inputs: every record comes along, byte for byte.
+"$TOOLS/fatelf-glue" hostarm host arm
+"$TOOLS/fatelf-glue" armppc arm ppc
+"$TOOLS/fatelf-remove" ppcfat armppc arm
+"$TOOLS/fatelf-glue" all hostarm ppcfat
+"$TOOLS/fatelf-validate" all || fail "fatelf-validate all"
+[ "`records all`" = "3" ] || fail "`records all` records"
+for t in host:host arm:arm ppc:ppc64 ; do
+    "$TOOLS/fatelf-extract" got all ${t#*:}
+    cmp got ${t%:*} || fail "${t%:*} didn't survive"
+done
+# ...mixed with ELF inputs, in any order.
+"$TOOLS/fatelf-glue" mixed ppc hostarm
+[ "`records mixed`" = "3" ] || fail "`records mixed` records in mixed"
+echo "ok: FatELF inputs"
+
+# A target that's in two inputs is an error, wherever it came from.
+must_fail "$TOOLS/fatelf-glue" dup hostarm arm
+grep -q "'hostarm (arm:.*)' and 'arm' are for the same target" err || fail "`cat err`"
+must_fail "$TOOLS/fatelf-glue" dup hostarm armppc
+grep -q "'hostarm (arm:.*)' and 'armppc (arm:.*)' are for the same target" err || fail "`cat err`"
+must_fail "$TOOLS/fatelf-glue" dup all all
+grep -q "are for the same target" err || fail "`cat err`"
+[ ! -e dup ] || fail "failed glue left output"
+echo "ok: duplicates"
+
+# The output can't be an input, by any name: it'd be gone before it's read.
+cp armppc before
+must_fail "$TOOLS/fatelf-glue" armppc armppc host
+grep -q "'armppc' is both an input and the output" err || fail "`cat err`"
+ln -s armppc link
+must_fail "$TOOLS/fatelf-glue" link host armppc
+grep -q "'armppc' is both an input and the output 'link'" err || fail "`cat err`"
+cmp armppc before || fail "failed glue changed its input"
+echo "ok: output is an input"
+
+# Junk.
+cp hostarm hostarmjunk
+echo "first junk" >> hostarmjunk
+cp ppcfat ppcjunk
+echo "second junk, longer" >> ppcjunk
+
+# keep is the default, and fine with one input's junk...
+for policy in "" --junk=keep ; do
+    "$TOOLS/fatelf-glue" out $policy hostarmjunk ppcfat
+    [ "`junk out`" = "11" ] || fail "$policy: `junk out` bytes of junk"
+    [ "`tail -c 11 out`" = "first junk" ] || fail "$policy: wrong junk"
+done
+"$TOOLS/fatelf-glue" out ppc hostarmjunk
+[ "`tail -c 11 out`" = "first junk" ] || fail "junk after an ELF input"
+# ...but not with two.
+must_fail "$TOOLS/fatelf-glue" out2 hostarmjunk ppcjunk
+grep -q "'hostarmjunk' and 'ppcjunk' both have junk at the end" err || fail "`cat err`"
+must_fail "$TOOLS/fatelf-glue" out2 --junk=keep hostarmjunk ppcjunk
+[ ! -e out2 ] || fail "failed glue left output"
+
+"$TOOLS/fatelf-glue" out --junk=first ppcjunk hostarmjunk
+"$TOOLS/fatelf-validate" out || fail "fatelf-validate --junk=first"
+[ "`junk out`" = "20" ] || fail "--junk=first: `junk out` bytes of junk"
+[ "`tail -c 20 out`" = "second junk, longer" ] || fail "--junk=first kept the wrong junk"
+
+"$TOOLS/fatelf-glue" out --junk=drop hostarmjunk ppcjunk
+"$TOOLS/fatelf-validate" out || fail "fatelf-validate --junk=drop"
+[ -z "`junk out`" ] || fail "--junk=drop kept `junk out` bytes"
+"$TOOLS/fatelf-glue" expected hostarm ppcfat
+cmp out expected || fail "--junk=drop isn't the same as no junk"
+
+must_fail "$TOOLS/fatelf-glue" out --junk=some hostarmjunk ppcjunk
+grep -q "Unknown junk policy 'some'" err || fail "`cat err`"
+echo "ok: junk"
+
+cd "$TOOLS"
+rm -rf "$DIR"
+echo "All glue tests passed."
+
+# end of test-glue.sh ...
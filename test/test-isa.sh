@@ -0,0 +1,71 @@
+#!/bin/bash
+
+# Check ISA level selection: "host" picks the highest ISA level the CPU
+#  (or FATELF_HOST_ISA_LEVEL) allows, a target name without an ISA level
+#  means the baseline record, and records the CPU can't run are skipped.
+#
+# Usage: test-isa.sh [scratch_dir]
+#  Run from a directory with the built FatELF tools, on x86_64. Needs gcc.
+
+SCRATCH=${1:-.}
+
+set -e
+
+. "`dirname "$0"`/common.sh"
+fatelf_setup test-isa "$SCRATCH" fatelf-glue
+
+# extracted HOSTLEVEL FATFILE TARGET: which build fatelf-extract picks.
+extracted() {
+    FATELF_HOST_ISA_LEVEL="$1" "$TOOLS/fatelf-extract" got "$2" "$3"
+    chmod +x got
+    ./got
+}
+
+cd "$DIR"
+# Each build just says which one it is; nothing really needs AVX2.
+for level in v1 v2 v3 ; do
+    echo "#include <stdio.h>" > $level.c
+    echo "int main(void) { puts(\"$level\"); return 0; }" >> $level.c
+    gcc -o $level $level.c
+done
+make_stub arm arm
+"$TOOLS/fatelf-glue" fat v1 --isa=x86-64-v2 v2 --isa=x86-64-v3 v3 arm
+"$TOOLS/fatelf-validate" fat || fail "fatelf-validate"
+"$TOOLS/fatelf-info" fat | grep -q '^  ISA level 3 (x86-64-v3' || fail "fatelf-info: `"$TOOLS/fatelf-info" fat`"
+
+# "host" takes the best record the CPU can run, never one it can't.
+[ "`extracted baseline fat host`" = "v1" ] || fail "baseline CPU got `extracted baseline fat host`"
+[ "`extracted x86-64-v2 fat host`" = "v2" ] || fail "x86-64-v2 CPU got `extracted x86-64-v2 fat host`"
+[ "`extracted x86-64-v3 fat host`" = "v3" ] || fail "x86-64-v3 CPU got `extracted x86-64-v3 fat host`"
+[ "`extracted x86-64-v4 fat host`" = "v3" ] || fail "x86-64-v4 CPU got `extracted x86-64-v4 fat host`"
+[ "`extracted 2 fat host`" = "v2" ] || fail "FATELF_HOST_ISA_LEVEL=2 got `extracted 2 fat host`"
+echo "ok: host"
+
+# Without an ISA level, a target name means the baseline build.
+for level in baseline x86-64-v4 ; do
+    [ "`extracted $level fat x86_64`" = "v1" ] || fail "x86_64 got `extracted $level fat x86_64`"
+done
+[ "`extracted baseline fat x86_64:x86-64-v3`" = "v3" ] || fail "x86_64:x86-64-v3"
+[ "`extracted baseline fat x86-64-v2`" = "v2" ] || fail "x86-64-v2"
+echo "ok: target names"
+
+# A CPU that's too old for every record gets nothing.
+"$TOOLS/fatelf-glue" new --isa=x86-64-v3 v3 arm
+if FATELF_HOST_ISA_LEVEL=x86-64-v2 "$TOOLS/fatelf-extract" got new host 2> err ; then
+    fail "extracted a record this CPU can't run"
+fi
+grep -q "can run on this machine" err || fail "`cat err`"
+[ "`extracted x86-64-v3 new host`" = "v3" ] || fail "x86-64-v3 CPU got `extracted x86-64-v3 new host`"
+echo "ok: too new"
+
+if [ -x "$TOOLS/fatelf-exec" ] ; then
+    [ "`FATELF_HOST_ISA_LEVEL=baseline "$TOOLS/fatelf-exec" ./fat`" = "v1" ] || fail "fatelf-exec, baseline"
+    [ "`FATELF_HOST_ISA_LEVEL=x86-64-v2 "$TOOLS/fatelf-exec" ./fat`" = "v2" ] || fail "fatelf-exec, x86-64-v2"
+    echo "ok: fatelf-exec"
+fi
+
+cd "$TOOLS"
+rm -rf "$DIR"
+echo "All ISA level tests passed."
+
+# end of test-isa.sh ...
@@ -0,0 +1,165 @@
+#!/bin/bash
+
+# Check fatelf-merkle and the tools that verify against its trees: roots
+#  agree with an independent implementation, ranges verify, fatelf-exec
+#  checks only what it maps and runs what it checked, and damage is caught
+#  by whatever reads it (fatelf-exec, fatelf-extract, libfatelf-preload.so
+#  and verify) while damage nobody reads goes unnoticed until a full verify.
+#
+# Usage: test-merkle.sh [scratch_dir]
+#  Run from a directory with the built FatELF tools. Needs gcc, objcopy,
+#  readelf and python3.
+
+SCRATCH=${1:-.}
+
+set -e
+
+. "`dirname "$0"`/common.sh"
+fatelf_setup test-merkle "$SCRATCH" fatelf-merkle
+
+MERKLE="$TOOLS/fatelf-merkle"
+
+record_offset() { "$TOOLS/fatelf-info" "$1" | sed -n 's/^  Offset \([0-9]*\)$/\1/p' | sed -n "$(( $2 + 1 ))p" ; }
+section_offset() { echo $(( 16#`readelf -SW "$1" | sed 's/^ *\[ *[0-9]*\] *//' | awk -v s="$2" '$1 == s { print $4 }'` )) ; }
+poke() { printf '\377' | dd of="$1" bs=1 seek="$2" conv=notrunc status=none ; }
+
+cd "$DIR"
+cat > prog.c <<EOT
+#include <stdio.h>
+int main(void) { printf("hello\n"); return 0; }
+EOT
+gcc -o prog prog.c
+head -c $((8 * 1024 * 1024 + 123)) /dev/urandom > blob
+objcopy --add-section .bigdata=blob --set-section-flags .bigdata=noload,readonly prog big
+make_stub arm arm
+"$TOOLS/fatelf-glue" fat arm big
+"$MERKLE" add fatm fat
+chmod +x fatm
+"$TOOLS/fatelf-validate" fatm || fail "fatelf-validate"
+"$TOOLS/fatelf-info" fatm | grep -q '^Records have Merkle trees, in 4096 byte blocks.$' || fail "fatelf-info"
+echo "ok: add"
+
+# The same construction, written out in python.
+cat > merkle.py <<EOT
+import hashlib, sys
+data = open(sys.argv[1], 'rb').read()[int(sys.argv[2]):int(sys.argv[2]) + int(sys.argv[3])]
+B = int(sys.argv[4])
+pad = lambda b: b + bytes(B - len(b))
+level = [hashlib.sha256(pad(data[i:i+B])).digest() for i in range(0, len(data), B)]
+while len(level) > 1:
+    raw = b''.join(level)
+    level = [hashlib.sha256(pad(raw[i:i+B])).digest() for i in range(0, len(raw), B)]
+print(level[0].hex() if level else '0' * 64)
+EOT
+for bs in 4096 1024 65536 ; do
+    "$MERKLE" --block-size=$bs add fatm-$bs fat
+    "$TOOLS/fatelf-info" fatm-$bs | sed -n 's/^  Merkle root \([0-9a-f]*\),.*/\1/p' > roots
+    for i in 0 1 ; do
+        SIZE=`"$TOOLS/fatelf-info" fatm-$bs | sed -n 's/^  Size \([0-9]*\)$/\1/p' | sed -n "$(( i + 1 ))p"`
+        EXPECT=`python3 merkle.py fatm-$bs \`record_offset fatm-$bs $i\` $SIZE $bs`
+        [ "`sed -n "$(( i + 1 ))p" roots`" = "$EXPECT" ] || fail "record $i root differs with $bs byte blocks"
+    done
+    "$MERKLE" verify fatm-$bs > /dev/null || fail "verify with $bs byte blocks"
+done
+echo "ok: roots"
+
+"$MERKLE" verify fatm x86_64 0 1 | grep -q 'bytes 0 to 1 ok' || fail "range"
+"$MERKLE" verify fatm x86_64 4000 9000 > /dev/null || fail "range across blocks"
+"$MERKLE" verify fatm x86_64 0 99999999999 2> /dev/null && fail "range past the end"
+"$TOOLS/fatelf-extract" thin fatm x86_64
+cmp thin big || fail "extract"
+echo "ok: verify and extract"
+
+# fatelf-exec only reads the mapped parts.
+"$TOOLS/fatelf-exec" --verbose ./fatm 2> err > out
+grep -q '^hello$' out || fail "fatm didn't run"
+VERIFIED=`sed -n 's/.*verified \([0-9]*\) of \([0-9]*\) bytes.*/\1/p' err`
+TOTAL=`sed -n 's/.*verified \([0-9]*\) of \([0-9]*\) bytes.*/\2/p' err`
+[ -n "$VERIFIED" ] || fail "fatelf-exec didn't verify: `cat err`"
+[ $VERIFIED -lt $((TOTAL / 16)) ] || fail "fatelf-exec verified $VERIFIED of $TOTAL bytes"
+"$TOOLS/fatelf-exec" --extract ./fatm | grep -q '^hello$' || fail "--extract"
+echo "ok: exec verifies $VERIFIED of $TOTAL bytes"
+
+# What runs is what was checked: a verified program's segments are copies,
+#  not mappings of a file that could change after it was hashed.
+cat > maps.c <<EOT
+#include <stdio.h>
+int main(void)
+{
+    char buf[512];
+    FILE *io = fopen("/proc/self/maps", "r");
+    while (io && fgets(buf, sizeof (buf), io))
+        fputs(buf, stdout);
+    return 0;
+}
+EOT
+gcc -o maps maps.c
+"$TOOLS/fatelf-glue" mapsfat arm maps
+"$MERKLE" add mapsfatm mapsfat
+chmod +x mapsfat mapsfatm
+"$TOOLS/fatelf-exec" ./mapsfat > out
+grep -q '/mapsfat$' out || fail "unverified program wasn't mapped in place: `cat out`"
+"$TOOLS/fatelf-exec" ./mapsfatm > out
+grep -q '/mapsfatm$' out && fail "verified program was mapped from the file: `cat out`"
+grep -q '\[stack\]' out || fail "verified program didn't run: `cat out`"
+echo "ok: exec runs what it verified"
+
+# Damage nobody maps...
+REC=`record_offset fatm 1`
+cp fatm bad-data
+poke bad-data $(( REC + `section_offset big .bigdata` + 5000000 ))
+"$TOOLS/fatelf-exec" ./bad-data | grep -q '^hello$' || fail "unmapped damage stopped exec"
+"$MERKLE" verify bad-data > out 2>&1 && fail "verify missed damage"
+grep -q "record #1 .*doesn't match its Merkle tree" out || fail "wrong error: `cat out`"
+"$MERKLE" verify bad-data arm > /dev/null || fail "damage in record 1 failed record 0"
+"$TOOLS/fatelf-extract" thin2 bad-data x86_64 2> err && fail "extract copied damage"
+[ ! -e thin2 ] || fail "extract left output"
+grep -q "doesn't match its Merkle tree" err || fail "wrong error: `cat err`"
+echo "ok: unmapped damage"
+
+# ...and damage in code.
+cp fatm bad-text
+poke bad-text $(( REC + `section_offset big .text` + 10 ))
+chmod +x bad-text
+"$TOOLS/fatelf-exec" ./bad-text 2> err && fail "exec ran damaged code"
+grep -q "doesn't match its Merkle tree" err || fail "wrong error: `cat err`"
+"$TOOLS/fatelf-exec" --extract ./bad-text 2> err && fail "exec --extract ran damaged code"
+echo "ok: mapped damage"
+
+# A damaged tree, and the tree table.
+cp fatm bad-tree
+TREE=`"$TOOLS/fatelf-info" fatm | sed -n 's/.*tree at offset \([0-9]*\)$/\1/p' | tail -1`
+poke bad-tree $(( TREE + 100 ))
+"$MERKLE" verify bad-tree x86_64 0 1 2> /dev/null && fail "damaged tree verified"
+cp fatm bad-table
+poke bad-table $(( 16 + 48 + 2 ))
+"$TOOLS/fatelf-validate" bad-table 2> /dev/null && fail "validate passed a bad table"
+"$TOOLS/fatelf-exec" ./bad-table 2> /dev/null && fail "exec ran with a bad table"
+echo "ok: damaged trees"
+
+# Tools that move records drop the trees rather than keep stale ones.
+"$TOOLS/fatelf-remove" removed fatm arm
+"$TOOLS/fatelf-info" removed | grep -q Merkle && fail "remove kept trees"
+"$TOOLS/fatelf-validate" removed || fail "remove left a bad file"
+echo "ok: rewriting"
+
+# Shared libraries through libfatelf-preload.so.
+if [ -f "$TOOLS/libfatelf-preload.so" ] ; then
+    mkdir -p libs fatlibs
+    echo 'int lib_fn(void) { return 42; }' > lib.c
+    echo 'int lib_fn(void); int main(void) { return lib_fn() == 42 ? 0 : 1; }' > main.c
+    gcc -shared -fPIC -o libs/liblib.so lib.c
+    gcc -o main main.c -Llibs -llib
+    "$TOOLS/fatelf-glue" plain.so libs/liblib.so arm
+    "$MERKLE" add fatlibs/liblib.so plain.so
+    LD_LIBRARY_PATH=fatlibs LD_AUDIT="$TOOLS/libfatelf-preload.so" ./main || fail "preload"
+    poke fatlibs/liblib.so $(( `record_offset fatlibs/liblib.so 1` + `section_offset libs/liblib.so .text` + 4 ))
+    LD_LIBRARY_PATH=fatlibs LD_AUDIT="$TOOLS/libfatelf-preload.so" ./main 2> /dev/null && fail "preload loaded damage"
+    echo "ok: preload"
+fi
+
+cd "$TOOLS"
+rm -rf "$DIR"
+echo "All merkle tests passed."
+
+# end of test-merkle.sh ...
@@ -0,0 +1,130 @@
+#!/bin/bash
+
+# Check libfatelf-preload.so: as an LD_AUDIT module it loads a fat .so that
+#  a program links against or dlopen()s, by path or by bare name. As an
+#  LD_PRELOAD module it only steps in for dlopen() of a path. Copies go to
+#  FATELF_CACHE_DIR when that's set, and are only reused while nobody else
+#  could have changed them. A fat .so it can't use is left for the loader
+#  to refuse, without taking the process down.
+#
+# Usage: test-preload.sh [scratch_dir]
+#  Run from a directory with the built FatELF tools, on glibc. Needs gcc and
+#  python3.
+
+SCRATCH=${1:-.}
+
+set -e
+
+. "`dirname "$0"`/common.sh"
+fatelf_setup test-preload "$SCRATCH" fatelf-glue libfatelf-preload.so
+
+PRELOAD="$TOOLS/libfatelf-preload.so"
+HELLO="hello from a shared library!"
+
+# says NAME COMMAND...: COMMAND runs, and the fat hello.so says hello.
+says() {
+    local name="$1"
+    shift
+    "$@" > out 2>&1 || fail "$name: `cat out`"
+    grep -q "$HELLO" out || fail "$name: `cat out`"
+    echo "ok: $name"
+}
+
+# fails NAME COMMAND...: COMMAND can't load the fat hello.so, but it's the
+#  loader that says so, not us.
+fails() {
+    local name="$1"
+    shift
+    if "$@" > out 2>&1 ; then
+        fail "$name worked: `cat out`"
+    fi
+    grep -q "$HELLO" out && fail "$name: `cat out`"
+    echo "ok: $name"
+}
+
+cd "$DIR"
+mkdir thin fat
+gcc -shared -fPIC -Wl,-soname,hello.so -o thin/hello.so "$TESTDIR/hello-lib.c"
+gcc -o linked "$TESTDIR/hello.c" thin/hello.so
+gcc -o dlopen-path "$TESTDIR/hello-dlopen.c" -ldl
+sed 's|"\./hello.so"|"hello.so"|' "$TESTDIR/hello-dlopen.c" > bare.c
+gcc -o dlopen-bare bare.c -ldl
+make_stub arm arm
+"$TOOLS/fatelf-glue" fat/hello.so arm thin/hello.so
+
+# Without help, the loader can't use it at all.
+fails "no preload" env LD_LIBRARY_PATH=fat ./linked
+
+# LD_AUDIT sees everything.
+says "audit, linked" env LD_LIBRARY_PATH=fat LD_AUDIT="$PRELOAD" ./linked
+says "audit, dlopen of a path" sh -c "cd fat && LD_AUDIT='$PRELOAD' ../dlopen-path"
+says "audit, dlopen of a bare name" env LD_LIBRARY_PATH=fat LD_AUDIT="$PRELOAD" ./dlopen-bare
+
+# LD_PRELOAD only gets dlopen() calls with a '/' in the path.
+says "preload, dlopen of a path" sh -c "cd fat && LD_PRELOAD='$PRELOAD' ../dlopen-path"
+fails "preload, linked" env LD_LIBRARY_PATH=fat LD_PRELOAD="$PRELOAD" ./linked
+fails "preload, dlopen of a bare name" env LD_LIBRARY_PATH=fat LD_PRELOAD="$PRELOAD" ./dlopen-bare
+
+# With a cache, the copy is kept, and the next process uses it as-is.
+says "cache, first run" env LD_LIBRARY_PATH=fat LD_AUDIT="$PRELOAD" FATELF_CACHE_DIR="$DIR/cache" ./linked
+[ "`ls cache | wc -l`" = "1" ] || fail "cache has `ls -a cache`"
+cmp cache/* thin/hello.so || fail "cached copy isn't the thin library"
+touch -d @1000000000 cache/*
+says "cache, second run" env LD_LIBRARY_PATH=fat LD_AUDIT="$PRELOAD" FATELF_CACHE_DIR="$DIR/cache" ./linked
+[ "`stat -c %Y cache/*`" = "1000000000" ] || fail "cached copy was written again"
+[ "`stat -c %a cache`" = "700" ] || fail "cache directory is mode `stat -c %a cache`"
+[ "`stat -c %a cache/*`" = "600" ] || fail "cached copy is mode `stat -c %a cache/*`"
+
+# A copy that's the wrong size, or that others could have written, is made
+#  again; a directory others can write to isn't used at all.
+CACHED=`ls cache/*`
+head -c 100 thin/hello.so > "$CACHED"
+says "cache, wrong size" env LD_LIBRARY_PATH=fat LD_AUDIT="$PRELOAD" FATELF_CACHE_DIR="$DIR/cache" ./linked
+cmp "$CACHED" thin/hello.so || fail "short cached copy wasn't replaced"
+chmod 666 "$CACHED"
+touch -d @1000000000 "$CACHED"
+says "cache, writable copy" env LD_LIBRARY_PATH=fat LD_AUDIT="$PRELOAD" FATELF_CACHE_DIR="$DIR/cache" ./linked
+[ "`stat -c %Y%a "$CACHED"`" != "1000000000666" ] || fail "writable cached copy was used"
+head -c `size thin/hello.so` /dev/zero > "$CACHED"
+chmod 777 cache
+says "cache, writable directory" env LD_LIBRARY_PATH=fat LD_AUDIT="$PRELOAD" FATELF_CACHE_DIR="$DIR/cache" ./linked
+cmp -s "$CACHED" thin/hello.so && fail "writable cache directory was used"
+chmod 700 cache
+# With Merkle trees, a cached copy has to match them every time.
+if [ -x "$TOOLS/fatelf-merkle" ] ; then
+    mkdir fatm
+    "$TOOLS/fatelf-merkle" add fatm/hello.so fat/hello.so
+    rm -rf cache
+    says "cache, Merkle trees" env LD_LIBRARY_PATH=fatm LD_AUDIT="$PRELOAD" FATELF_CACHE_DIR="$DIR/cache" ./linked
+    CACHED=`ls cache/*`
+    printf '\377' | dd of="$CACHED" bs=1 seek=1000 conv=notrunc status=none
+    says "cache, damaged copy" env LD_LIBRARY_PATH=fatm LD_AUDIT="$PRELOAD" FATELF_CACHE_DIR="$DIR/cache" ./linked
+    cmp "$CACHED" thin/hello.so || fail "damaged cached copy wasn't replaced"
+fi
+
+# Nothing it can use: no record for this machine, a truncated record, and
+#  flags it doesn't know. The loader gets the fat file and refuses it.
+mkdir bad
+"$TOOLS/fatelf-remove" bad/hello.so fat/hello.so host
+fails "audit, no record for this machine" env LD_LIBRARY_PATH=bad LD_AUDIT="$PRELOAD" ./linked
+grep -q "hello.so" out || fail "loader didn't complain: `cat out`"
+head -c 10000 fat/hello.so > bad/hello.so
+fails "audit, truncated" env LD_LIBRARY_PATH=bad LD_AUDIT="$PRELOAD" ./linked
+fails "preload, truncated" sh -c "cd bad && LD_PRELOAD='$PRELOAD' ../dlopen-path"
+grep -q "^dlopen: " out || fail "dlopen() didn't just fail: `cat out`"
+"$TOOLS/fatelf-convert" bad/v2.so fat/hello.so 2
+python3 - bad/v2.so bad/hello.so <<EOT
+import sys
+d = bytearray(open(sys.argv[1], 'rb').read())
+d[12] |= 0x80
+open(sys.argv[2], 'wb').write(d)
+EOT
+fails "audit, unknown flags" env LD_LIBRARY_PATH=bad LD_AUDIT="$PRELOAD" ./linked
+fails "preload, unknown flags" sh -c "cd bad && LD_PRELOAD='$PRELOAD' ../dlopen-path"
+grep -q "^dlopen: " out || fail "dlopen() didn't just fail: `cat out`"
+
+cd "$TOOLS"
+rm -rf "$DIR"
+echo "All preload tests passed."
+
+# end of test-preload.sh ...
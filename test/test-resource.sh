@@ -0,0 +1,105 @@
+#!/bin/bash
+
+# Check fatelf-resource: resources go in and come back out byte for byte,
+#  keep their alignment through the other tools, and junk that was there
+#  first survives.
+#
+# Usage: test-resource.sh [scratch_dir]
+#  Run from a directory with the built FatELF tools.
+
+SCRATCH=${1:-.}
+
+set -e
+
+. "`dirname "$0"`/common.sh"
+fatelf_setup test-resource "$SCRATCH" fatelf-resource
+
+cp ./fatelf-info "$DIR/host"
+make_stub "$DIR/arm" arm
+./fatelf-glue "$DIR/plain.fat" "$DIR/host" "$DIR/arm"
+cp "$DIR/plain.fat" "$DIR/junky.fat"
+echo "this is junk" >> "$DIR/junky.fat"
+
+head -c 100000 /dev/urandom > "$DIR/data"
+echo "hello" > "$DIR/hello"
+: > "$DIR/empty"
+
+./fatelf-resource add --hash "$DIR/a.fat" "$DIR/junky.fat" data "$DIR/data" hello "$DIR/hello"
+./fatelf-resource add --align=4096 "$DIR/b.fat" "$DIR/a.fat" page "$DIR/hello" empty "$DIR/empty"
+./fatelf-validate "$DIR/b.fat" || fail "validate rejected resources"
+./fatelf-resource list "$DIR/b.fat"
+./fatelf-info "$DIR/b.fat" | grep -q "4 named resources" || fail "info didn't count resources"
+
+for name in data hello ; do
+    ./fatelf-resource get "$DIR/got" "$DIR/b.fat" $name
+    cmp "$DIR/got" "$DIR/$name" || fail "$name came back wrong"
+done
+./fatelf-resource get "$DIR/got" "$DIR/b.fat" page
+cmp "$DIR/got" "$DIR/hello" || fail "page came back wrong"
+./fatelf-resource get "$DIR/got" "$DIR/b.fat" empty
+[ ! -s "$DIR/got" ] || fail "empty resource isn't empty"
+echo "ok: resources come back"
+
+# The records and the junk before the table are untouched.
+./fatelf-extract "$DIR/x" "$DIR/b.fat" host
+cmp -n `stat -c %s "$DIR/host"` "$DIR/x" "$DIR/host" || fail "record changed"
+tail -c +$(( `stat -c %s "$DIR/plain.fat"` + 1 )) "$DIR/b.fat" | head -c 13 | grep -q "this is junk" || fail "junk lost"
+echo "ok: records and junk kept"
+
+# Alignment holds through tools that move the junk.
+check_aligned() {  # check_aligned <file>
+    ./fatelf-resource list "$1" | grep "'page'" | awk '{ print $6 }' | tr -d , > "$DIR/offset"
+    [ $(( `cat "$DIR/offset"` % 4096 )) -eq 0 ] || fail "page resource not aligned in $1"
+    ./fatelf-resource get "$DIR/got" "$1" data
+    cmp "$DIR/got" "$DIR/data" || fail "data came back wrong from $1"
+}
+check_aligned "$DIR/b.fat"
+./fatelf-remove "$DIR/removed.fat" "$DIR/b.fat" arm
+check_aligned "$DIR/removed.fat"
+./fatelf-replace "$DIR/replaced.fat" "$DIR/b.fat" "$DIR/arm"
+check_aligned "$DIR/replaced.fat"
+./fatelf-convert "$DIR/converted.fat" "$DIR/b.fat" 2
+check_aligned "$DIR/converted.fat"
+echo "ok: alignment kept by remove, replace and convert"
+
+# Replacing and removing.
+./fatelf-resource add "$DIR/c.fat" "$DIR/b.fat" data "$DIR/hello"
+./fatelf-resource get "$DIR/got" "$DIR/c.fat" data
+cmp "$DIR/got" "$DIR/hello" || fail "data wasn't replaced"
+./fatelf-resource remove "$DIR/d.fat" "$DIR/c.fat" data page
+./fatelf-resource list "$DIR/d.fat" | grep -q "2 resources" || fail "remove left the wrong count"
+if ./fatelf-resource get "$DIR/got" "$DIR/d.fat" data 2>/dev/null; then
+    fail "got a removed resource"
+fi
+./fatelf-resource remove "$DIR/e.fat" "$DIR/d.fat" hello empty
+./fatelf-resource list "$DIR/e.fat" | grep -q "no resources" || fail "table left behind"
+cmp -n `stat -c %s "$DIR/junky.fat"` "$DIR/e.fat" "$DIR/junky.fat" || fail "junk changed"
+echo "ok: replace and remove"
+
+# A pipe has no size up front; the large-file copy options mustn't lose it.
+for opt in --direct-io --io-rate=100M --progress ; do
+    ./fatelf-resource $opt add "$DIR/p.fat" "$DIR/plain.fat" data <(cat "$DIR/data") 2>/dev/null
+    ./fatelf-resource get "$DIR/got" "$DIR/p.fat" data
+    cmp "$DIR/got" "$DIR/data" || fail "$opt lost a resource from a pipe"
+done
+echo "ok: pipes"
+
+# A corrupt hash is caught, and a corrupt table is rejected.
+SIZE=`stat -c %s "$DIR/a.fat"`
+OFFSET=`./fatelf-resource list "$DIR/a.fat" | grep "'data'" | awk '{ print $6 }' | tr -d ,`
+cp "$DIR/a.fat" "$DIR/bad.fat"
+printf 'X' | dd of="$DIR/bad.fat" bs=1 seek=$OFFSET conv=notrunc status=none
+if ./fatelf-resource get "$DIR/got" "$DIR/bad.fat" data 2>/dev/null; then
+    fail "corrupt resource passed its hash check"
+fi
+cp "$DIR/a.fat" "$DIR/bad.fat"
+printf '\377\377\377\377' | dd of="$DIR/bad.fat" bs=1 seek=$(( SIZE - 24 )) conv=notrunc status=none
+if ./fatelf-validate "$DIR/bad.fat" 2>/dev/null; then
+    fail "validate passed a corrupt table"
+fi
+echo "ok: corruption caught"
+
+rm -rf "$DIR"
+echo "All resource tests passed."
+
+# end of test-resource.sh ...
@@ -0,0 +1,133 @@
+#!/bin/bash
+
+# Check fatelf-serve: what it sends for each kind of request should match
+#  what the command line tools would have written, and it should keep up
+#  with a crowd of clients at once.
+#
+# Usage: test-serve.sh [scratch_dir] [clients]
+#  Run from a directory with the built FatELF tools. Needs curl.
+
+SCRATCH=${1:-.}
+CLIENTS=${2:-64}
+
+set -e
+
+. "`dirname "$0"`/common.sh"
+fatelf_setup test-serve "$SCRATCH" fatelf-serve
+
+mkdir -p "$DIR/www/sub"
+
+# A host binary, a tiny record for another target (32-bit ARM), and a
+#  tiny one for a third (64-bit big-endian PowerPC), with junk at the end.
+cp ./fatelf-info "$DIR/host"
+make_stub "$DIR/arm" arm
+make_stub "$DIR/ppc" ppc64
+./fatelf-glue "$DIR/www/three.fat" "$DIR/host" "$DIR/arm" "$DIR/ppc"
+echo "this is junk" >> "$DIR/www/three.fat"
+cp "$DIR/www/three.fat" "$DIR/www/sub/name with space.fat"
+echo "hello" > "$DIR/hello"
+./fatelf-resource add "$DIR/www/res.fat" "$DIR/www/three.fat" hello "$DIR/hello"
+echo "not a FatELF file" > "$DIR/www/plain.txt"
+
+./fatelf-serve --port=0 "$DIR/www" > "$DIR/server.out" &
+SERVER=$!
+trap 'kill $SERVER 2>/dev/null || true' EXIT
+for i in `seq 50` ; do
+    grep -q Listening "$DIR/server.out" 2>/dev/null && break
+    sleep 0.1
+done
+URL=`sed -n 's/^Listening on \(.*\)\/$/\1/p' "$DIR/server.out"`
+[ -n "$URL" ] || { echo "FAIL: server didn't start" 1>&2 ; exit 1 ; }
+
+status() {  # status <url> [curl options...]
+    local url="$1"
+    shift
+    curl -s -o /dev/null -w '%{http_code}' "$@" "$url"
+}
+
+check() {  # check <name> <expected file> <url> [curl options...]
+    local name="$1" expected="$2" url="$3"
+    shift 3
+    curl -sf -o "$DIR/got" "$@" "$url" || fail "$name: request failed"
+    cmp "$expected" "$DIR/got" || fail "$name: wrong bytes"
+    echo "ok: $name"
+}
+
+FAT="$DIR/www/three.fat"
+./fatelf-extract "$DIR/want-host" "$FAT" host
+./fatelf-extract "$DIR/want-arm" "$FAT" arm
+./fatelf-remove "$DIR/want-two" "$FAT" ppc64
+
+check "whole file" "$FAT" "$URL/three.fat"
+check "target in query" "$DIR/want-host" "$URL/three.fat?target=host"
+check "target in header" "$DIR/want-arm" "$URL/three.fat" -H "X-FatELF-Target: arm"
+check "escaped path" "$DIR/want-arm" "$URL/sub/name%20with%20space.fat?target=arm"
+check "several targets" "$DIR/want-two" "$URL/three.fat?target=record0,arm"
+./fatelf-validate "$DIR/got" > /dev/null || fail "several targets: not valid FatELF"
+check "same record twice" "$DIR/want-arm" "$URL/three.fat?target=arm&target=arm:32bits"
+check "non-FatELF file" "$DIR/www/plain.txt" "$URL/plain.txt?target=arm"
+
+# Junk with a resource table keeps its offset within a page.
+./fatelf-extract "$DIR/want-res-host" "$DIR/www/res.fat" host
+./fatelf-remove "$DIR/want-res-two" "$DIR/www/res.fat" ppc64
+check "resources" "$DIR/want-res-host" "$URL/res.fat?target=host"
+check "resources, several targets" "$DIR/want-res-two" "$URL/res.fat?target=record0,arm"
+./fatelf-resource get "$DIR/got-hello" "$DIR/got" hello
+cmp "$DIR/got-hello" "$DIR/hello" || fail "resources, several targets: resource came out wrong"
+
+# Ranges are over the thinned response, not the original file.
+dd if="$DIR/want-host" of="$DIR/want-range" bs=1 skip=100 count=5000 status=none
+check "range" "$DIR/want-range" "$URL/three.fat?target=host" -r 100-5099
+tail -c 123 "$DIR/want-two" > "$DIR/want-range"
+check "suffix range" "$DIR/want-range" "$URL/three.fat?target=record0,arm" -r -123
+[ "`status "$URL/three.fat?target=arm" -r 99999999-`" = "416" ] || fail "bad range wasn't a 416"
+echo "ok: unsatisfiable range"
+
+LEN=`curl -sI "$URL/three.fat?target=host" | tr -d '\r' | sed -n 's/^Content-Length: //p'`
+[ "$LEN" = "`stat -c %s "$DIR/want-host"`" ] || fail "HEAD reported $LEN bytes"
+echo "ok: HEAD"
+
+[ "`status "$URL/nope.fat"`" = "404" ] || fail "missing file wasn't a 404"
+[ "`status "$URL/../three.fat" --path-as-is`" = "404" ] || fail "escaped the directory"
+[ "`status "$URL/sub/%2e%2e/%2e%2e/three.fat"`" = "404" ] || fail "escaped the directory, escaped"
+[ "`status "$URL/sub"`" = "404" ] || fail "directory wasn't a 404"
+[ "`status "$URL/three.fat?target=mips"`" = "404" ] || fail "missing record wasn't a 404"
+[ "`status "$URL/three.fat?target=bogus"`" = "400" ] || fail "bad target wasn't a 400"
+[ "`status "$URL/three.fat" -X POST`" = "405" ] || fail "POST wasn't a 405"
+echo "ok: errors"
+
+# fatelf-fetch can pull through the server, too.
+./fatelf-fetch "$DIR/got" "$URL/three.fat" arm
+cmp "$DIR/got" "$DIR/arm" || fail "fetch: wrong bytes"
+echo "ok: fatelf-fetch"
+
+# Lots of clients at once, with a few that connect and never say anything.
+for i in `seq 4` ; do
+    (exec 3<>/dev/tcp/127.0.0.1/${URL##*:} ; sleep 5) &
+done
+PIDS=""
+for i in `seq $CLIENTS` ; do
+    curl -sf -o "$DIR/got.$i" "$URL/three.fat?target=host" &
+    PIDS="$PIDS $!"
+done
+for pid in $PIDS ; do
+    wait $pid || fail "concurrent request failed"
+done
+for i in `seq $CLIENTS` ; do
+    cmp -s "$DIR/want-host" "$DIR/got.$i" || fail "concurrent request $i: wrong bytes"
+done
+echo "ok: $CLIENTS clients at once"
+
+# Changing a file drops what we remembered about its header.
+./fatelf-remove "$DIR/www/three.fat" "$DIR/want-two" arm
+./fatelf-extract "$DIR/want-host" "$DIR/www/three.fat" host
+check "file changed" "$DIR/want-host" "$URL/three.fat?target=host"
+[ "`status "$URL/three.fat?target=arm"`" = "404" ] || fail "served a stale header"
+echo "ok: no stale header"
+
+kill $SERVER
+wait $SERVER 2>/dev/null || true
+rm -rf "$DIR"
+echo "All serve tests passed."
+
+# end of test-serve.sh ...
@@ -0,0 +1,57 @@
+#!/bin/bash
+
+# Check --stats: the text report and the --stats=json line both show up on
+#  stderr, the JSON parses, and neither touches the tool's own output.
+#
+# Usage: test-stats.sh [scratch_dir]
+#  Run from a directory with the built FatELF tools. Needs python3.
+
+SCRATCH=${1:-.}
+
+set -e
+
+. "`dirname "$0"`/common.sh"
+fatelf_setup test-stats "$SCRATCH" fatelf-glue
+
+cd "$DIR"
+make_stub arm arm
+make_stub ppc ppc64
+
+# Text.
+"$TOOLS/fatelf-glue" --stats fat arm ppc 2> stats
+grep -q '^fatelf-glue stats: [0-9.]* ms wall clock$' stats || fail "`cat stats`"
+grep -q '^  syscall  *calls  *bytes$' stats || fail "no syscall table: `cat stats`"
+grep -q '^  phase  *calls  *bytes  *ms  *MB/s$' stats || fail "no phase table: `cat stats`"
+grep -q '^  copy  *2  *40 ' stats || fail "didn't count copying both inputs: `cat stats`"
+"$TOOLS/fatelf-info" fat > expected
+"$TOOLS/fatelf-info" fat --stats > got 2> stats
+cmp got expected || fail "--stats changed stdout"
+grep -q '^fatelf-info stats:' stats || fail "`cat stats`"
+echo "ok: text"
+
+# JSON, anywhere on the command line, one line that parses.
+"$TOOLS/fatelf-glue" fat2 arm --stats=json ppc 2> stats
+cmp fat fat2 || fail "--stats=json changed the output file"
+[ "`wc -l < stats`" = "1" ] || fail "JSON isn't one line: `cat stats`"
+python3 - stats <<EOT || fail "bad JSON: `cat stats`"
+import json, sys
+s = json.load(open(sys.argv[1]))
+assert s['tool'] == 'fatelf-glue'
+assert s['wall_ns'] > 0
+assert s['syscalls']['open']['calls'] > 0
+assert s['phases']['copy'] == {'calls': 2, 'bytes': 40, 'ns': s['phases']['copy']['ns']}
+for v in list(s['syscalls'].values()) + list(s['phases'].values()):
+    assert all(isinstance(n, int) and n >= 0 for n in v.values())
+EOT
+echo "ok: json"
+
+# Reported even when the tool fails.
+must_fail "$TOOLS/fatelf-extract" --stats=json got fat i386
+grep -q '^{"tool":"fatelf-extract",' err || fail "`cat err`"
+echo "ok: failures"
+
+cd "$TOOLS"
+rm -rf "$DIR"
+echo "All stats tests passed."
+
+# end of test-stats.sh ...
@@ -0,0 +1,139 @@
+#!/bin/bash
+
+# Check fatelf-symbols: symbols and versions read from records in place
+#  match what binutils sees, both byte orders and word sizes parse, and
+#  the parity check finds exports that only some records have.
+#
+# Usage: test-symbols.sh [scratch_dir]
+#  Run from a directory with the built FatELF tools. Needs gcc (with -m32),
+#  nm and python3.
+
+SCRATCH=${1:-.}
+
+set -e
+
+. "`dirname "$0"`/common.sh"
+fatelf_setup test-symbols "$SCRATCH" fatelf-symbols
+
+cat > "$DIR/a.c" <<EOF
+int puts(const char *str);
+int counter = 3;
+int foo(void) { return counter; }
+static int helper(void) { return 2; }
+__attribute__((visibility("hidden"))) int hidden(void) { return helper(); }
+int only_a(void) { puts("a"); return hidden(); }
+EOF
+cat > "$DIR/b.c" <<EOF
+int counter = 3;
+int foo(void) { return counter; }
+int only_b(void) { return 0; }
+EOF
+cat > "$DIR/v.map" <<EOF
+V1 { global: foo; counter; local: *; };
+V2 { global: only_a; } V1;
+EOF
+
+gcc -shared -fPIC -o "$DIR/liba.so" "$DIR/a.c"
+gcc -shared -fPIC -o "$DIR/libb.so" "$DIR/b.c"
+gcc -shared -fPIC -Wl,--version-script="$DIR/v.map" -o "$DIR/libv.so" "$DIR/a.c"
+gcc -c -fPIC -o "$DIR/a64.o" "$DIR/a.c"
+gcc -m32 -c -fPIC -o "$DIR/a32.o" "$DIR/a.c"
+
+# There's no big-endian toolchain here, so byteswap a little-endian ELF64
+#  object into a ppc64 one: header, section headers and symbol table.
+python3 - "$DIR/a64.o" "$DIR/ppc64.o" <<EOF
+import struct, sys
+data = bytearray(open(sys.argv[1], 'rb').read())
+def swap(fmt, off):
+    vals = struct.unpack_from('<' + fmt, data, off)
+    struct.pack_into('>' + fmt, data, off, *vals)
+    return vals
+data[5] = 0  # FATELF_BIGENDIAN, as the other fixtures spell it.
+struct.pack_into('<H', data, 18, 21)  # EM_PPC64
+hdr = swap('HHIQQQIHHHHHH', 16)
+shoff, shentsize, shnum = hdr[5], hdr[10], hdr[11]
+for i in range(shnum):
+    sec = swap('IIQQQQIIQQ', shoff + i * shentsize)
+    if sec[1] == 2:  # SHT_SYMTAB
+        for off in range(sec[4], sec[4] + sec[5], 24):
+            swap('IBBHQQ', off)
+open(sys.argv[2], 'wb').write(data)
+EOF
+
+# Defined and undefined names agree with nm.
+names() { ./fatelf-symbols list "$1" | awk -v w="$2" 'NR > 1 && $NF ~ /^[^ ]/ && $0 ~ w { print $NF }' | sort ; }
+names "$DIR/liba.so" ' DEF ' > "$DIR/ours"
+nm -D --defined-only "$DIR/liba.so" | awk '{ print $3 }' | sort > "$DIR/theirs"
+diff "$DIR/ours" "$DIR/theirs" || fail "defined symbols differ from nm"
+names "$DIR/liba.so" ' UND ' > "$DIR/ours"
+nm -D --undefined-only "$DIR/liba.so" | awk '{ print $2 }' | sort > "$DIR/theirs"
+diff "$DIR/ours" "$DIR/theirs" || fail "undefined symbols differ from nm"
+./fatelf-symbols list "$DIR/liba.so" | grep -q 'hidden' && fail "hidden symbol listed"
+./fatelf-symbols list "$DIR/liba.so" | grep -q 'helper' && fail "local symbol listed"
+echo "ok: matches nm"
+
+# Versions.
+./fatelf-symbols list "$DIR/libv.so" > "$DIR/out"
+grep -q ' foo@@V1$' "$DIR/out" || fail "foo@@V1 missing"
+grep -q ' only_a@@V2$' "$DIR/out" || fail "only_a@@V2 missing"
+grep -q ' counter@@V1$' "$DIR/out" || fail "counter@@V1 missing"
+grep -q 'UND puts@GLIBC_' "$DIR/out" || fail "needed version missing"
+echo "ok: versions"
+
+# Word sizes and byte orders: each record lists the same exports.
+./fatelf-glue "$DIR/objs.fat" "$DIR/a64.o" "$DIR/a32.o" "$DIR/ppc64.o"
+./fatelf-symbols list "$DIR/objs.fat" > "$DIR/out"
+grep -q '^.*: ppc64:64bits:be' "$DIR/out" || fail "no ppc64 record"
+[ `grep -c ' FUNC   GLOBAL DEF only_a$' "$DIR/out"` -eq 3 ] || fail "a record lost only_a"
+[ `grep -c ' OBJECT GLOBAL DEF counter$' "$DIR/out"` -eq 3 ] || fail "a record lost counter"
+grep -q '^  00000000 OBJECT' "$DIR/out" || fail "32-bit values aren't 32-bit"
+./fatelf-symbols list "$DIR/ppc64.o" | tail -n +2 > "$DIR/be"
+./fatelf-symbols list "$DIR/a64.o" | tail -n +2 > "$DIR/le"
+cmp "$DIR/be" "$DIR/le" || fail "byteswapped object reads differently"
+./fatelf-symbols check "$DIR/objs.fat" > /dev/null || fail "identical exports reported as different"
+echo "ok: word sizes and byte orders"
+
+# Parity.
+./fatelf-glue "$DIR/ab.fat" "$DIR/liba.so" "$DIR/a32.o"
+./fatelf-edit "$DIR/abb.fat" "$DIR/ab.fat" --isa=x86-64-v2 --add="$DIR/libb.so"
+set +e
+./fatelf-symbols --jobs=3 check "$DIR/ab.fat" "$DIR/abb.fat" > "$DIR/out"
+RC=$?
+set -e
+[ $RC -eq 2 ] || fail "differences exit with $RC, not 2"
+grep -q 'abb.fat: missing from x86_64:64bits:le:sysv:osabiver0:x86-64-v2: only_a$' "$DIR/out" || fail "missing only_a not reported"
+grep -q 'abb.fat: missing from i386:[^ ]* x86_64:64bits:le:sysv:osabiver0: only_b$' "$DIR/out" || fail "missing only_b not reported"
+grep -q 'ab.fat:' "$DIR/out" && fail "matching file reported"
+grep -q '^2 files checked, 1 with differences between records.$' "$DIR/out" || fail "wrong summary"
+echo "ok: parity"
+
+# Directories: non-FatELF files are skipped, and results don't depend on
+#  how many threads there are.
+mkdir -p "$DIR/tree/lib/sub"
+for i in `seq 300` ; do cp "$DIR/objs.fat" "$DIR/tree/lib/libobjs$i.so" ; done
+cp "$DIR/abb.fat" "$DIR/tree/lib/sub/libabb.so"
+cp "$DIR/a.c" "$DIR/liba.so" "$DIR/tree/lib"
+set +e
+./fatelf-symbols --jobs=1 check "$DIR/tree" > "$DIR/out1"
+./fatelf-symbols --jobs=4 check "$DIR/tree" > "$DIR/out4"
+set -e
+cmp "$DIR/out1" "$DIR/out4" || fail "output depends on threads"
+grep -q '^301 files checked, 1 with differences between records.$' "$DIR/out1" || fail "tree: wrong summary"
+echo "ok: directories"
+
+# Damaged records are reported, not fatal.
+cp "$DIR/objs.fat" "$DIR/bad.fat"
+OFF=`./fatelf-info "$DIR/bad.fat" | awk '/Offset/ { print $2 ; exit }'`
+printf '\377\377\377\377\377\377\377\177' | dd of="$DIR/bad.fat" bs=1 seek=$(( OFF + 40 )) conv=notrunc 2> /dev/null
+set +e
+./fatelf-symbols check "$DIR/bad.fat" > "$DIR/out"
+RC=$?
+set -e
+[ $RC -eq 2 ] || fail "damaged record exits with $RC"
+grep -q 'bogus section headers' "$DIR/out" || fail "damaged record not reported"
+echo "ok: damaged records"
+
+rm -rf "$DIR"
+echo "All symbols tests passed."
+
+# end of test-symbols.sh ...
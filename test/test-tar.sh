@@ -0,0 +1,165 @@
+#!/bin/bash
+
+# Check fatelf-tar against the command line tools: thinning or removing
+#  records in a tar stream should give the same files fatelf-extract and
+#  fatelf-remove would, merging should give the same files fatelf-glue
+#  would, and everything else should come through untouched, for each tar
+#  format GNU tar can write.
+#
+# Usage: test-tar.sh [scratch_dir]
+#  Run from a directory with the built FatELF tools. Needs GNU tar.
+
+SCRATCH=${1:-.}
+
+set -e
+
+. "`dirname "$0"`/common.sh"
+fatelf_setup test-tar "$SCRATCH" fatelf-tar
+
+# An x86_64 binary, and tiny ones for 32-bit ARM and 64-bit PowerPC, padded
+#  out so they look like real ELF files.
+cp ./fatelf-info "$DIR/host"
+make_stub "$DIR/arm" arm
+make_stub "$DIR/ppc" ppc64
+truncate -s 200 "$DIR/arm" "$DIR/ppc"
+
+# A tree with FatELF files (one with junk, one with resources, one with a
+#  long path), plain files, a symlink, a hard link, and an empty directory.
+SRC="$DIR/src"
+LONG="a-directory-with-a-name-long-enough/that-the-whole-path-is-more/than-a-ustar-name-field-can-hold"
+mkdir -p "$SRC/bin" "$SRC/empty" "$SRC/$LONG"
+./fatelf-glue "$SRC/bin/tool" "$DIR/host" "$DIR/arm" "$DIR/ppc"
+./fatelf-glue "$SRC/bin/junky" "$DIR/host" "$DIR/arm"
+echo "this is junk" >> "$SRC/bin/junky"
+echo "hello" > "$DIR/hello"
+./fatelf-resource add --align=64 "$SRC/bin/res" "$SRC/bin/junky" hello "$DIR/hello"
+cp "$SRC/bin/tool" "$SRC/$LONG/a-fatelf-binary-with-a-long-name-too"
+echo "#!/bin/sh" > "$SRC/bin/script"
+head -c 100000 /dev/urandom > "$SRC/data"
+ln -s tool "$SRC/bin/link"
+ln "$SRC/data" "$SRC/hardlink"
+
+# what each tool would make of one tree, file by file.
+expect_tree() {  # expect_tree <dir> <tool> <target>
+    local dir="$1" tool="$2" target="$3" f
+    rm -rf "$dir"
+    cp -a "$SRC" "$dir"
+    for f in bin/tool bin/junky bin/res "$LONG/a-fatelf-binary-with-a-long-name-too" ; do
+        "$TOOLS/fatelf-$tool" "$dir/$f.new" "$SRC/$f" "$target"
+        touch -r "$SRC/$f" "$dir/$f.new"
+        mv "$dir/$f.new" "$dir/$f"
+    done
+}
+
+compare_trees() {  # compare_trees <name> <expected dir> <tarball>
+    local name="$1" expected="$2" tarball="$3"
+    rm -rf "$DIR/got"
+    mkdir "$DIR/got"
+    tar -xf "$tarball" -C "$DIR/got" || fail "$name: tar couldn't read the output"
+    diff -r --no-dereference "$expected" "$DIR/got" || fail "$name: trees differ"
+    [ "`stat -c %i "$DIR/got/data"`" = "`stat -c %i "$DIR/got/hardlink"`" ] || fail "$name: lost the hard link"
+}
+
+expect_tree "$DIR/want-thin" extract arm
+expect_tree "$DIR/want-remove" remove arm
+
+for format in gnu pax ustar ; do
+    if [ "$format" = "ustar" ]; then
+        DIRS="--exclude=$LONG"  # ustar can't hold that path at all.
+        rm -rf "$DIR/want-thin/$LONG" "$DIR/want-remove/$LONG"
+    else
+        DIRS=""
+    fi
+    tar --format=$format $DIRS -cf "$DIR/in.tar" -C "$SRC" .
+
+    ./fatelf-tar thin arm < "$DIR/in.tar" > "$DIR/out.tar"
+    compare_trees "thin, $format" "$DIR/want-thin" "$DIR/out.tar"
+    echo "ok: thin, $format"
+
+    cat "$DIR/in.tar" | ./fatelf-tar remove arm | cat > "$DIR/out.tar"
+    compare_trees "remove, $format" "$DIR/want-remove" "$DIR/out.tar"
+    echo "ok: remove through pipes, $format"
+done
+
+# Junk with a resource table keeps its offset within a page, like
+#  fatelf-extract keeps it, whether we can seek the input or not.
+expect_tree "$DIR/want-host" extract x86_64
+tar -cf "$DIR/in.tar" -C "$SRC" .
+./fatelf-tar thin x86_64 < "$DIR/in.tar" > "$DIR/out.tar"
+compare_trees "thin x86_64" "$DIR/want-host" "$DIR/out.tar"
+cat "$DIR/in.tar" | ./fatelf-tar thin x86_64 | cat > "$DIR/out.tar"
+compare_trees "thin x86_64 through pipes" "$DIR/want-host" "$DIR/out.tar"
+echo "ok: resources"
+
+# Targets that aren't there leave files alone; bad ones are errors.
+tar -cf "$DIR/in.tar" -C "$SRC" .
+./fatelf-tar thin mips < "$DIR/in.tar" > "$DIR/out.tar" 2> /dev/null
+cmp "$DIR/in.tar" "$DIR/out.tar" || fail "missing target changed the archive"
+echo "ok: missing target passes through"
+if ./fatelf-tar thin bogus < "$DIR/in.tar" > "$DIR/out.tar" 2> /dev/null; then
+    fail "bad target didn't fail"
+fi
+echo "ok: bad target fails"
+
+# Memory use shouldn't grow with the size of a member.
+mkdir -p "$DIR/big"
+cp ./fatelf-info "$DIR/bighost"
+dd if=/dev/urandom of="$DIR/bighost" bs=1M count=200 oflag=append conv=notrunc status=none
+./fatelf-glue "$DIR/big/fat" "$DIR/bighost" "$DIR/arm"
+tar -cf - -C "$DIR/big" fat | ( ulimit -v 32768 ; ./fatelf-tar thin x86_64 ) | tar -xOf - fat > "$DIR/got-big"
+cmp "$DIR/got-big" "$DIR/bighost" || fail "big member came out wrong"
+rm -rf "$DIR/big" "$DIR/bighost" "$DIR/got-big"
+echo "ok: 200 megabyte member in 32 megabytes of address space"
+
+# Merge: a tree per architecture, with some files in common.
+for arch in host arm ; do
+    mkdir -p "$DIR/$arch-tree/bin" "$DIR/$arch-tree/share"
+    cp "$DIR/$arch" "$DIR/$arch-tree/bin/tool"
+    echo "same everywhere" > "$DIR/$arch-tree/share/common"
+    echo "built for $arch" > "$DIR/$arch-tree/share/config"
+    echo "only in $arch" > "$DIR/$arch-tree/share/only-$arch"
+    touch -d @1000000000 "$DIR/$arch-tree/bin/tool"
+done
+./fatelf-glue "$DIR/ppc-fat" "$DIR/ppc" "$DIR/host"
+./fatelf-remove "$DIR/ppc-only" "$DIR/ppc-fat" x86_64
+./fatelf-resource add "$DIR/ppc-res" "$DIR/ppc-only" hello "$DIR/hello"
+mkdir -p "$DIR/ppc-tree/bin"
+cp "$DIR/ppc-res" "$DIR/ppc-tree/bin/tool"
+tar -cf "$DIR/host.tar" -C "$DIR/host-tree" .
+tar --format=pax -cf "$DIR/arm.tar" -C "$DIR/arm-tree" .
+tar -cf "$DIR/ppc.tar" -C "$DIR/ppc-tree" .
+
+./fatelf-tar merge "$DIR/host.tar" "$DIR/arm.tar" "$DIR/ppc.tar" > "$DIR/out.tar" 2> "$DIR/merge.log"
+rm -rf "$DIR/got"
+mkdir "$DIR/got"
+tar -xf "$DIR/out.tar" -C "$DIR/got" || fail "merge: tar couldn't read the output"
+./fatelf-glue "$DIR/want-tool" "$DIR/host" "$DIR/arm" "$DIR/ppc-res"
+cmp "$DIR/want-tool" "$DIR/got/bin/tool" || fail "merge: glued binary differs from fatelf-glue's"
+[ "`stat -c %Y "$DIR/got/bin/tool"`" = "1000000000" ] || fail "merge: lost the first archive's metadata"
+cmp "$DIR/host-tree/share/common" "$DIR/got/share/common" || fail "merge: common file"
+cmp "$DIR/host-tree/share/config" "$DIR/got/share/config" || fail "merge: differing file"
+grep -q "share/config" "$DIR/merge.log" || fail "merge: didn't warn about differing file"
+[ "`grep -c . "$DIR/merge.log"`" = "1" ] || fail "merge: warned about something else"
+[ -f "$DIR/got/share/only-host" ] && [ -f "$DIR/got/share/only-arm" ] || fail "merge: lost a file"
+[ "`stat -c %s "$DIR/out.tar"`" -eq $(( `stat -c %s "$DIR/out.tar"` / 10240 * 10240 )) ] || fail "merge: not padded"
+echo "ok: merge"
+
+if ./fatelf-tar merge "$DIR/host.tar" "$DIR/host.tar" > "$DIR/out.tar" 2> /dev/null; then
+    cmp -s "$DIR/out.tar" /dev/null && fail "merging an archive with itself wrote nothing"
+fi
+echo "ok: merging identical archives"
+
+cp "$DIR/host" "$DIR/host-tree/bin/tool2"
+cp "$DIR/host" "$DIR/arm-tree/bin/tool2"
+printf 'x' >> "$DIR/arm-tree/bin/tool2"
+tar -cf "$DIR/host.tar" -C "$DIR/host-tree" .
+tar -cf "$DIR/arm.tar" -C "$DIR/arm-tree" .
+if ./fatelf-tar merge "$DIR/host.tar" "$DIR/arm.tar" > "$DIR/out.tar" 2> /dev/null; then
+    fail "merged two different binaries for the same target"
+fi
+echo "ok: same target twice fails"
+
+rm -rf "$DIR"
+echo "All tar tests passed."
+
+# end of test-tar.sh ...
@@ -0,0 +1,82 @@
+#!/bin/bash
+
+# Check fatelf-thin-tree: FatELF files become what fatelf-extract would
+#  write (junk included), everything else is copied as-is, and symlinks,
+#  hardlinks, permissions and timestamps survive.
+#
+# Usage: test-thin-tree.sh [scratch_dir]
+#  Run from a directory with the built FatELF tools.
+
+SCRATCH=${1:-.}
+
+set -e
+
+. "`dirname "$0"`/common.sh"
+fatelf_setup test-thin-tree "$SCRATCH" fatelf-thin-tree
+
+mkdir -p "$DIR/src/bin" "$DIR/src/lib/private" "$DIR/src/empty"
+cp ./fatelf-info "$DIR/host"
+make_stub "$DIR/arm" arm
+make_stub "$DIR/ppc" ppc64
+
+SRC="$DIR/src"
+./fatelf-glue "$SRC/bin/tool" "$DIR/host" "$DIR/arm"
+./fatelf-glue "$SRC/bin/junky" "$DIR/host" "$DIR/arm"
+echo "this is junk" >> "$SRC/bin/junky"
+echo "hello" > "$DIR/hello"
+./fatelf-resource add "$SRC/bin/res" "$SRC/bin/junky" hello "$DIR/hello"
+./fatelf-glue "$SRC/lib/foreign" "$DIR/arm" "$DIR/ppc"
+echo "hello" > "$SRC/readme"
+cp "$DIR/host" "$SRC/bin/plain-elf"
+ln -s tool "$SRC/bin/link"
+ln -s ../nowhere "$SRC/bin/dangling"
+ln "$SRC/bin/tool" "$SRC/lib/tool-hardlink"
+ln "$SRC/readme" "$SRC/lib/readme-hardlink"
+chmod 0750 "$SRC/bin/tool"
+chmod 0600 "$SRC/readme"
+chmod 0700 "$SRC/lib/private"
+touch -d "2001-02-03 04:05:06" "$SRC/bin/tool" "$SRC/bin/junky" "$SRC/readme" "$SRC/lib/private"
+
+./fatelf-thin-tree "$SRC" "$DIR/dst" host 2> "$DIR/err"
+DST="$DIR/dst"
+
+# FatELF files are thinned, the same way fatelf-extract does it.
+for f in bin/tool bin/junky bin/res ; do
+    ./fatelf-extract "$DIR/expected" "$SRC/$f" host
+    cmp "$DST/$f" "$DIR/expected" || fail "$f isn't what fatelf-extract writes"
+done
+tail -c 13 "$DST/bin/junky" | grep -q "this is junk" || fail "junk was dropped"
+echo "ok: thinned"
+
+# Everything else is copied unchanged.
+cmp "$DST/readme" "$SRC/readme" || fail "plain file changed"
+cmp "$DST/bin/plain-elf" "$SRC/bin/plain-elf" || fail "plain ELF changed"
+cmp "$DST/lib/foreign" "$SRC/lib/foreign" || fail "FatELF file without a host record changed"
+grep -q "foreign" "$DIR/err" || fail "no warning about lib/foreign: `cat "$DIR/err"`"
+[ -d "$DST/empty" ] || fail "empty directory is missing"
+echo "ok: copied"
+
+# Symlinks stay symlinks, even dangling ones.
+[ -L "$DST/bin/link" ] && [ "`readlink "$DST/bin/link"`" = "tool" ] || fail "symlink"
+[ -L "$DST/bin/dangling" ] && [ "`readlink "$DST/bin/dangling"`" = "../nowhere" ] || fail "dangling symlink"
+# Hardlinks are still hardlinks, thinned or not.
+[ "`stat -c %i "$DST/bin/tool"`" = "`stat -c %i "$DST/lib/tool-hardlink"`" ] || fail "thinned hardlink was split"
+[ "`stat -c %i "$DST/readme"`" = "`stat -c %i "$DST/lib/readme-hardlink"`" ] || fail "plain hardlink was split"
+echo "ok: links"
+
+for f in bin/tool bin/junky readme lib/private ; do
+    [ "`stat -c %a "$DST/$f"`" = "`stat -c %a "$SRC/$f"`" ] || fail "$f has mode `stat -c %a "$DST/$f"`"
+    [ "`stat -c %Y "$DST/$f"`" = "`stat -c %Y "$SRC/$f"`" ] || fail "$f has the wrong mtime"
+done
+echo "ok: modes and timestamps"
+
+# A target nothing has gets every FatELF file copied whole.
+./fatelf-thin-tree "$SRC" "$DIR/dst2" arm 2> /dev/null
+./fatelf-extract "$DIR/expected" "$SRC/lib/foreign" arm
+cmp "$DIR/dst2/lib/foreign" "$DIR/expected" || fail "arm record"
+
+cd "$TOOLS"
+rm -rf "$DIR"
+echo "All thin-tree tests passed."
+
+# end of test-thin-tree.sh ...
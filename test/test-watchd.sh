@@ -0,0 +1,126 @@
+#!/bin/bash
+
+# Check fatelf-watchd: it brings a thin tree up to date when it starts,
+#  follows changes to the source tree (new, changed, renamed and deleted
+#  files and directories), and reports its state over its socket.
+#
+# Usage: test-watchd.sh [scratch_dir]
+#  Run from a directory with the built FatELF tools.
+
+SCRATCH=${1:-.}
+
+set -e
+
+. "`dirname "$0"`/common.sh"
+fatelf_setup test-watchd "$SCRATCH" fatelf-watchd
+
+mkdir -p "$DIR/src/bin" "$DIR/work"
+
+cp ./fatelf-info "$DIR/work/host"
+cp ./fatelf-validate "$DIR/work/host2"
+make_stub "$DIR/work/arm" arm
+./fatelf-glue "$DIR/work/a.fat" "$DIR/work/host" "$DIR/work/arm"
+./fatelf-glue "$DIR/work/b.fat" "$DIR/work/host2" "$DIR/work/arm"
+
+cp "$DIR/work/a.fat" "$DIR/src/bin/tool"
+echo "hello" > "$DIR/src/readme"
+ln -s tool "$DIR/src/bin/link"
+
+# Something stale in the thin tree, which should go.
+mkdir -p "$DIR/dst"
+echo "stale" > "$DIR/dst/stale"
+
+SOCK="$DIR/watchd.sock"
+./fatelf-watchd --delay=50 --jobs=2 --socket="$SOCK" "$DIR/src" "$DIR/dst" arm 2> "$DIR/log" &
+DAEMON=$!
+trap 'kill $DAEMON 2>/dev/null || true' EXIT
+
+# Wait until (cmd) succeeds, or give up after five seconds.
+wait_for() {
+    local i
+    for i in `seq 100` ; do
+        eval "$1" && return 0
+        sleep 0.05
+    done
+    fail "timed out waiting for: $1"
+}
+
+status() { ./fatelf-watchd --status="$SOCK" 2>/dev/null | awk -v k="$1" '$1 == k { print $2 }' ; }
+idle() { [ "`status queue_depth`" = "0" ] ; }
+
+wait_for "[ -S '$SOCK' ]"
+wait_for "cmp -s '$DIR/dst/bin/tool' '$DIR/work/arm'"
+wait_for idle
+cmp "$DIR/dst/readme" "$DIR/src/readme" || fail "plain file not copied"
+[ "`readlink "$DIR/dst/bin/link"`" = "tool" ] || fail "symlink not copied"
+[ ! -e "$DIR/dst/stale" ] || fail "stale file not removed"
+echo "ok: initial sync"
+
+# Changing a file: write it in pieces, as a build would.
+cat "$DIR/work/b.fat" > "$DIR/src/bin/tool.tmp"
+mv "$DIR/src/bin/tool.tmp" "$DIR/src/bin/tool"
+printf 'more' >> "$DIR/src/readme"
+wait_for "cmp -s '$DIR/dst/readme' '$DIR/src/readme'"
+wait_for "[ ! -e '$DIR/dst/bin/tool.tmp' ]"
+./fatelf-extract "$DIR/work/expected" "$DIR/work/b.fat" arm
+wait_for "cmp -s '$DIR/dst/bin/tool' '$DIR/work/expected'"
+echo "ok: changes"
+
+# Permissions follow.
+chmod 0700 "$DIR/src/readme"
+wait_for "[ `stat -c %a "$DIR/src/readme"` = \`stat -c %a '$DIR/dst/readme'\` ]"
+echo "ok: permissions"
+
+# New directories, including ones that arrive with files already in them.
+mkdir -p "$DIR/src/lib/deep"
+cp "$DIR/work/a.fat" "$DIR/src/lib/deep/libthing"
+mkdir -p "$DIR/work/moved/sub"
+echo "moved in" > "$DIR/work/moved/sub/file"
+mv "$DIR/work/moved" "$DIR/src/moved"
+wait_for "cmp -s '$DIR/dst/lib/deep/libthing' '$DIR/work/arm'"
+wait_for "cmp -s '$DIR/dst/moved/sub/file' '$DIR/src/moved/sub/file'"
+echo "moved again" > "$DIR/src/moved/sub/file2"
+wait_for "[ -f '$DIR/dst/moved/sub/file2' ]"
+echo "ok: new directories"
+
+# Renames and deletes.
+mv "$DIR/src/moved" "$DIR/src/renamed"
+wait_for "[ ! -e '$DIR/dst/moved' ]"
+wait_for "[ -f '$DIR/dst/renamed/sub/file2' ]"
+echo "renamed" > "$DIR/src/renamed/sub/file3"
+wait_for "[ -f '$DIR/dst/renamed/sub/file3' ]"
+rm "$DIR/src/readme"
+rm -rf "$DIR/src/lib"
+wait_for "[ ! -e '$DIR/dst/readme' ]"
+wait_for "[ ! -e '$DIR/dst/lib' ]"
+echo "ok: renames and deletes"
+
+# A burst of writes to one file is one job, not many.
+wait_for idle
+BEFORE=`status files_written`
+for i in `seq 50` ; do echo $i >> "$DIR/src/renamed/burst" ; done
+wait_for "cmp -s '$DIR/dst/renamed/burst' '$DIR/src/renamed/burst'"
+wait_for idle
+AFTER=`status files_written`
+[ $(( AFTER - BEFORE )) -le 3 ] || fail "50 writes took $(( AFTER - BEFORE )) jobs"
+echo "ok: bursts coalesce ($(( AFTER - BEFORE )) jobs for 50 writes)"
+
+./fatelf-watchd --status="$SOCK" > "$DIR/status"
+for key in queue_depth lag_ms bytes_processed events errors watches ; do
+    grep -q "^$key [0-9]" "$DIR/status" || fail "status has no $key"
+done
+[ "`status errors`" = "0" ] || fail "errors reported: `cat "$DIR/log"`"
+echo "ok: status"
+
+# The rest of the tree is exactly what fatelf-thin-tree makes.
+kill $DAEMON
+wait $DAEMON || true
+[ ! -e "$SOCK" ] || fail "socket left behind"
+./fatelf-thin-tree "$DIR/src" "$DIR/thin" arm
+diff -r "$DIR/dst" "$DIR/thin" > /dev/null || fail "thin tree differs from fatelf-thin-tree's"
+echo "ok: matches fatelf-thin-tree"
+
+rm -rf "$DIR"
+echo "All watchd tests passed."
+
+# end of test-watchd.sh ...
@@ -0,0 +1,89 @@
+#!/bin/bash
+
+# Check the record-at-a-time writer in fatelf-utils (xfatelf_begin_writer()
+#  and friends) with a little program that writes records from a buffer,
+#  from a file and from a pipe, and then some junk.
+#
+# Usage: test-writer.sh [scratch_dir]
+#  Run from a directory with the built FatELF tools and libfatelf-utils.a.
+#  Needs gcc.
+
+SCRATCH=${1:-.}
+
+set -e
+
+. "`dirname "$0"`/common.sh"
+fatelf_setup test-writer "$SCRATCH" libfatelf-utils.a
+
+SRC=`realpath "$TESTDIR/.."`
+
+cd "$DIR"
+cat > writer.c <<EOT
+#define FATELF_UTILS 1
+#include "fatelf-utils.h"
+
+// writer OUT ELF-IN-MEMORY ELF-FILE [DUPLICATE]; a third ELF comes on stdin.
+int main(int argc, const char **argv)
+{
+    int outfd, memfd, filefd;
+    uint64_t memsize;
+    uint8_t *buf;
+    fatelf_writer *writer;
+
+    xfatelf_init(&argc, argv);
+    outfd = xopen(argv[1], O_RDWR | O_CREAT | O_TRUNC, 0755);
+    unlink_on_xfail = argv[1];
+    memfd = xopen(argv[2], O_RDONLY, 0);
+    filefd = xopen(argv[3], O_RDONLY, 0);
+    memsize = xget_file_size(argv[2], memfd);
+    buf = (uint8_t *) xmalloc(memsize);
+    xpread(argv[2], memfd, buf, memsize, 0);
+
+    writer = xfatelf_begin_writer(argv[1], outfd, 0);
+    xfatelf_write_record(writer, argv[2], buf, memsize, -1);
+    xfatelf_write_record_fd(writer, argv[3], filefd, 0, xget_file_size(argv[3], filefd), -1);
+    xfatelf_write_record_fd(writer, "stdin", 0, 0, FATELF_WRITER_TO_EOF, 2);
+    if (argc > 4)
+        xfatelf_write_record(writer, argv[4], buf, memsize, -1);
+    xfatelf_write_junk(writer, "junk!", 5);
+    xfatelf_finish_writer(writer);
+    xclose(argv[1], outfd);
+    return 0;
+} // main
+EOT
+gcc -Wall -Werror -I"$SRC/include" -I"$SRC/utils" -o writer writer.c "$TOOLS/libfatelf-utils.a" -lpthread
+cat > prog.c <<EOT
+#include <stdio.h>
+int main(void) { printf("hello\n"); return 0; }
+EOT
+gcc -o prog prog.c
+make_stub arm arm
+
+./writer fat prog arm < prog
+"$TOOLS/fatelf-validate" fat || fail "fatelf-validate"
+"$TOOLS/fatelf-info" fat > info
+grep -q '^fat: FatELF format version 2$' info || fail "an ISA level needs version 2"
+grep -q '^3 records.$' info || fail "`cat info`"
+grep -q '^5 bytes of junk appended' info || fail "no junk: `cat info`"
+"$TOOLS/fatelf-info" fat | sed -n 's/^  Offset \([0-9]*\)$/\1/p' | while read off ; do
+    [ $(( off % 4096 )) -eq 0 ] || fail "record at $off isn't page-aligned"
+done
+# Records are sorted on disk, and fatelf-extract keeps the junk.
+"$TOOLS/fatelf-extract" x fat record1
+cmp -n `stat -c %s prog` x prog || fail "record from memory"
+"$TOOLS/fatelf-extract" x fat record2
+cmp -n `stat -c %s prog` x prog || fail "record from a pipe"
+"$TOOLS/fatelf-extract" x fat record0
+cmp -n `stat -c %s arm` x arm || fail "record from a file"
+echo "ok: writer"
+
+if ./writer bad prog arm prog < prog 2> err ; then fail "duplicate target worked" ; fi
+grep -q 'are for the same target' err || fail "`cat err`"
+[ ! -e bad ] || fail "failed writer left output"
+echo "ok: duplicates"
+
+cd "$TOOLS"
+rm -rf "$DIR"
+echo "All writer tests passed."
+
+# end of test-writer.sh ...
@@ -0,0 +1,876 @@
+/**
+ * FatELF; support multiple ELF binaries in one file.
+ *
+ * Please see the file LICENSE.txt in the source's root directory.
+ *
+ *  This file written by Ryan C. Gordon.
+ */
+
+// Static libraries of FatELF objects.
+//
+// These are normal Unix "ar" archives, whose members are FatELF (or plain
+//  ELF) object files. Instead of the usual "/" symbol index, which can only
+//  describe one architecture, there's a member named "__.FATELF.INDEX", in
+//  the spirit of BSD's "__.SYMDEF". It's the first member, except for the
+//  "//" long filename table, which GNU ar insists on finding first when
+//  there's no "/" member. It holds a FatELF header whose records point to
+//  one standard GNU-format symbol index per target, relative to the start of
+//  the member's data. A linker can pick its target's record and resolve
+//  symbols without opening every member, just as it would with a thin
+//  archive. The member offsets in each index refer to the member headers of
+//  the fat archive itself; the linker then uses the member's own FatELF
+//  header to find its target's record (the bfd "base_offset" path in
+//  patches/binutils.diff).
+
+#define FATELF_UTILS 1
+#include "fatelf-utils.h"
+
+#define AR_MAGIC "!<arch>\n"
+#define AR_MAGIC_LEN 8
+#define AR_HEADER_LEN 60
+#define AR_FATELF_INDEX_NAME "__.FATELF.INDEX/"  // trailing slash as GNU ar does.
+
+// symbols defined by one record of one member, as a block of
+//  null-terminated strings.
+typedef struct ar_symbols
+{
+    char *names;
+    size_t nameslen;
+    uint32_t count;
+} ar_symbols;
+
+typedef struct ar_member
+{
+    const char *path;
+    const char *name;  // what goes in the archive.
+    uint64_t size;
+    uint64_t offset;  // of the member header, in the output archive.
+    int num_records;
+    FATELF_record *records;
+    ar_symbols *symbols;  // one per record.
+} ar_member;
+
+
+static uint64_t ar_pad(const uint64_t size)
+{
+    return size + (size & 1);  // members are aligned to 2 bytes.
+} // ar_pad
+
+
+static void xwrite_ar_header(const char *out, const int outfd,
+                             const char *name, const uint64_t size)
+{
+    char buf[AR_HEADER_LEN + 1];
+    snprintf(buf, sizeof (buf), "%-16s%-12s%-6s%-6s%-8s%-10llu`\n",
+             name, "0", "0", "0", "644", (unsigned long long) size);
+    xwrite(out, outfd, buf, AR_HEADER_LEN);
+} // xwrite_ar_header
+
+
+static void xwrite_ar_pad(const char *out, const int outfd, const uint64_t size)
+{
+    if (size & 1)
+        xwrite(out, outfd, "\n", 1);
+} // xwrite_ar_pad
+
+
+static inline uint8_t *putbe32(uint8_t *ptr, const uint32_t val)
+{
+    *(ptr++) = (uint8_t) ((val >> 24) & 0xFF);
+    *(ptr++) = (uint8_t) ((val >> 16) & 0xFF);
+    *(ptr++) = (uint8_t) ((val >> 8) & 0xFF);
+    *(ptr++) = (uint8_t) ((val >> 0) & 0xFF);
+    return ptr;
+} // putbe32
+
+
+static inline uint32_t getbe32(const uint8_t *ptr)
+{
+    return ( (((uint32_t) ptr[0]) << 24) | (((uint32_t) ptr[1]) << 16) |
+             (((uint32_t) ptr[2]) << 8) | (((uint32_t) ptr[3]) << 0) );
+} // getbe32
+
+
+static void add_symbol(ar_symbols *syms, const char *name)
+{
+    const size_t len = strlen(name) + 1;
+    char *ptr = (char *) realloc(syms->names, syms->nameslen + len);
+    if (ptr == NULL)
+        xfail("Out of memory!");
+    memcpy(ptr + syms->nameslen, name, len);
+    syms->names = ptr;
+    syms->nameslen += len;
+    syms->count++;
+} // add_symbol
+
+
+// Collect the symbols an archive index should list for the ELF object at
+//  (offset): defined globals, the same set GNU ar would pick.
+static void read_object_symbols(const char *fname, const int fd,
+                                const uint64_t offset, ar_symbols *syms)
+{
+    fatelf_elf_header hdr;
+    fatelf_elf_section *sections = NULL;
+    int numsections = 0;
+    int i;
+
+    xread_elf_full_header(fname, fd, offset, &hdr);
+    sections = xread_elf_sections(fname, fd, offset, &hdr, &numsections);
+
+    for (i = 0; i < numsections; i++)
+    {
+        const fatelf_elf_section *sec = &sections[i];
+        const size_t symsize = FATELF_ELF_SYM_SIZE(hdr.word_size);
+        uint8_t *symdata = NULL;
+        char *strtab = NULL;
+        uint64_t strtablen = 0;
+        uint64_t total = 0;
+        uint64_t j;
+
+        if (sec->type != FATELF_SHT_SYMTAB)
+            continue;
+        else if (sec->link >= ((uint32_t) numsections))
+            xfail("'%s' has a bogus symbol table", fname);
+
+        symdata = (uint8_t *) xread_elf_section_data(fname, fd, offset, sec);
+        strtab = (char *) xread_elf_section_data(fname, fd, offset,
+                                                 &sections[sec->link]);
+        strtablen = sections[sec->link].size;
+        total = sec->size / symsize;
+
+        for (j = 1; j < total; j++)  // symbol 0 is always the null symbol.
+        {
+            fatelf_elf_symbol sym;
+            int bind, type;
+            fatelf_elf_decode_symbol(&hdr, symdata + (j * symsize), &sym);
+            bind = FATELF_ELF_ST_BIND(sym.info);
+            type = FATELF_ELF_ST_TYPE(sym.info);
+            if ((bind != FATELF_STB_GLOBAL) && (bind != FATELF_STB_WEAK) &&
+                (bind != FATELF_STB_GNU_UNIQUE))
+                continue;
+            else if ((type == FATELF_STT_SECTION) || (type == FATELF_STT_FILE))
+                continue;
+            else if (sym.shndx == FATELF_SHN_UNDEF)
+                continue;
+            else if ((sym.name == 0) || (sym.name >= strtablen))
+                continue;
+            add_symbol(syms, strtab + sym.name);
+        } // for
+
+        free(strtab);
+        free(symdata);
+    } // for
+
+    free(sections);
+} // read_object_symbols
+
+
+// fatelf_parallel_for() callback: figure out what's in one member.
+static void scan_member(void *data, const int idx)
+{
+    ar_member *member = ((ar_member *) data) + idx;
+    const char *fname = member->path;
+    const int fd = xopen(fname, O_RDONLY, 0755);
+    uint8_t magic[4] = { 0, 0, 0, 0 };
+    int i;
+
+    member->size = xget_file_size(fname, fd);
+    if (member->size >= sizeof (magic))
+        xpread(fname, fd, magic, sizeof (magic), 0);
+
+    if ( (magic[0] == (FATELF_MAGIC & 0xFF)) &&
+         (magic[1] == ((FATELF_MAGIC >> 8) & 0xFF)) &&
+         (magic[2] == ((FATELF_MAGIC >> 16) & 0xFF)) &&
+         (magic[3] == ((FATELF_MAGIC >> 24) & 0xFF)) )
+    {
+        FATELF_header *header = xread_fatelf_header(fname, fd);
+        const size_t len = sizeof (FATELF_record) * header->num_records;
+        member->num_records = (int) header->num_records;
+        member->records = (FATELF_record *) xmalloc(len);
+        memcpy(member->records, header->records, len);
+        free(header);
+    } // if
+    else  // a plain ELF object is fine too; it's just a single record.
+    {
+        member->num_records = 1;
+        member->records = (FATELF_record *) xmalloc(sizeof (FATELF_record));
+        xread_elf_header(fname, fd, 0, member->records);
+        member->records->size = member->size;
+    } // else
+
+    member->symbols = (ar_symbols *) xmalloc(sizeof (ar_symbols) * member->num_records);
+    for (i = 0; i < member->num_records; i++)
+        read_object_symbols(fname, fd, member->records[i].offset, &member->symbols[i]);
+
+    xclose(fname, fd);
+} // scan_member
+
+
+static const char *get_basename(const char *path)
+{
+    const char *ptr = strrchr(path, '/');
+    return ptr ? ptr + 1 : path;
+} // get_basename
+
+
+// Build the "//" long filename table, and fill in what each member's
+//  ar header name field should be. Returns NULL if nobody needs it.
+static char *build_long_names(const ar_member *members, const int count,
+                              char **arnames, uint64_t *len)
+{
+    char *retval = NULL;
+    size_t total = 0;
+    int i;
+
+    for (i = 0; i < count; i++)
+    {
+        const char *name = members[i].name;
+        const size_t namelen = strlen(name);
+        arnames[i] = (char *) xmalloc(32);
+        if (namelen < 16)  // fits, with the trailing '/'.
+            snprintf(arnames[i], 32, "%s/", name);
+        else
+        {
+            char *ptr = (char *) realloc(retval, total + namelen + 2);
+            if (ptr == NULL)
+                xfail("Out of memory!");
+            retval = ptr;
+            snprintf(arnames[i], 32, "/%llu", (unsigned long long) total);
+            memcpy(retval + total, name, namelen);
+            retval[total + namelen] = '/';
+            retval[total + namelen + 1] = '\n';
+            total += namelen + 2;
+        } // else
+    } // for
+
+    *len = total;
+    return retval;
+} // build_long_names
+
+
+// Serialize one target's symbol index, in the standard GNU "/" format.
+static uint8_t *build_armap(const ar_member *members, const int count,
+                            const FATELF_record *target, uint64_t *len)
+{
+    uint32_t numsyms = 0;
+    size_t nameslen = 0;
+    uint8_t *retval = NULL;
+    uint8_t *ptr = NULL;
+    uint8_t *names = NULL;
+    int i, j;
+
+    for (i = 0; i < count; i++)
+    {
+        for (j = 0; j < members[i].num_records; j++)
+        {
+            if (fatelf_record_matches(&members[i].records[j], target))
+            {
+                numsyms += members[i].symbols[j].count;
+                nameslen += members[i].symbols[j].nameslen;
+            } // if
+        } // for
+    } // for
+
+    *len = 4 + (((uint64_t) numsyms) * 4) + nameslen;
+    ptr = retval = (uint8_t *) xmalloc((size_t) *len);
+    names = retval + 4 + (numsyms * 4);
+    ptr = putbe32(ptr, numsyms);
+
+    for (i = 0; i < count; i++)
+    {
+        for (j = 0; j < members[i].num_records; j++)
+        {
+            const ar_symbols *syms = &members[i].symbols[j];
+            uint32_t k;
+            if (!fatelf_record_matches(&members[i].records[j], target))
+                continue;
+            for (k = 0; k < syms->count; k++)
+                ptr = putbe32(ptr, (uint32_t) members[i].offset);
+            memcpy(names, syms->names, syms->nameslen);
+            names += syms->nameslen;
+        } // for
+    } // for
+
+    assert(ptr == retval + 4 + (numsyms * 4));
+    assert(names == retval + *len);
+    return retval;
+} // build_armap
+
+
+static int fatelf_ar_create(const char *out, const char **paths,
+                            const int count, const int jobs)
+{
+    ar_member *members = (ar_member *) xmalloc(sizeof (ar_member) * count);
+    char **arnames = (char **) xmalloc(sizeof (char *) * count);
+    FATELF_header *index = NULL;
+    uint8_t **armaps = NULL;
+    uint8_t *indexhdr = NULL;
+    size_t indexhdrlen = 0;
+    char *longnames = NULL;
+    uint64_t longnameslen = 0;
+    uint64_t indexlen = 0;
+    uint64_t offset = 0;
+    uint32_t maxtargets = 0;
+    int numtargets = 0;
+    int outfd = -1;
+    int i, j, k;
+
+    if (count == 0)
+        xfail("Nothing to do.");
+
+    for (i = 0; i < count; i++)
+    {
+        members[i].path = paths[i];
+        members[i].name = get_basename(paths[i]);
+    } // for
+
+    // Reading symbol tables is the expensive part, so do it in parallel.
+    fatelf_parallel_for(count, jobs, scan_member, members);
+
+    // Every distinct target across all members gets its own index. There
+    //  can't be more of them than records in all the members.
+    for (i = 0; i < count; i++)
+        maxtargets += (uint32_t) members[i].num_records;
+    index = (FATELF_header *) xmalloc(fatelf_header_size(maxtargets));
+    for (i = 0; i < count; i++)
+    {
+        for (j = 0; j < members[i].num_records; j++)
+        {
+            const FATELF_record *rec = &members[i].records[j];
+            for (k = 0; k < numtargets; k++)
+            {
+                if (fatelf_record_matches(rec, &index->records[k]))
+                    break;
+            } // for
+
+            if (k == numtargets)
+            {
+                index->records[numtargets] = *rec;
+                index->records[numtargets].offset = 0;
+                index->records[numtargets].size = 0;
+                numtargets++;
+            } // if
+        } // for
+    } // for
+
+    index->magic = FATELF_MAGIC;
+    index->num_records = (uint32_t) numtargets;
+    index->version = fatelf_minimum_format_version(index);
+    index->reserved0 = 0;
+    index->flags = 0;
+
+    longnames = build_long_names(members, count, arnames, &longnameslen);
+
+    // The index size only depends on the symbol counts, not the member
+    //  offsets, so build it once with dummy offsets to lay everything out.
+    armaps = (uint8_t **) xmalloc(sizeof (uint8_t *) * numtargets);
+    indexlen = fatelf_disk_header_size(index->version, numtargets);
+    for (i = 0; i < numtargets; i++)
+    {
+        uint64_t len = 0;
+        FATELF_record *target = &index->records[i];
+        free(build_armap(members, count, target, &len));
+        indexlen = (indexlen + 3) & ~((uint64_t) 3);
+        target->offset = indexlen;
+        target->size = len;
+        indexlen += len;
+    } // for
+
+    offset = AR_MAGIC_LEN + AR_HEADER_LEN + ar_pad(indexlen);
+    if (longnames != NULL)
+        offset += AR_HEADER_LEN + ar_pad(longnameslen);
+    for (i = 0; i < count; i++)
+    {
+        members[i].offset = offset;
+        offset += AR_HEADER_LEN + ar_pad(members[i].size);
+    } // for
+
+    if (offset > 0xFFFFFFFF)
+        xfail("Archive is too big for a 32-bit symbol index.");
+
+    outfd = xopen(out, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    unlink_on_xfail = out;
+
+    xwrite(out, outfd, AR_MAGIC, AR_MAGIC_LEN);
+
+    if (longnames != NULL)
+    {
+        xwrite_ar_header(out, outfd, "//", longnameslen);
+        xwrite(out, outfd, longnames, (size_t) longnameslen);
+        xwrite_ar_pad(out, outfd, longnameslen);
+    } // if
+
+    xwrite_ar_header(out, outfd, AR_FATELF_INDEX_NAME, indexlen);
+    indexhdr = fatelf_encode_header(index, &indexhdrlen);
+    xwrite(out, outfd, indexhdr, indexhdrlen);
+    offset = indexhdrlen;
+    for (i = 0; i < numtargets; i++)
+    {
+        const FATELF_record *target = &index->records[i];
+        uint64_t len = 0;
+        armaps[i] = build_armap(members, count, target, &len);
+        assert(len == target->size);
+        xwrite_zeros(out, outfd, (size_t) (target->offset - offset));
+        xwrite(out, outfd, armaps[i], (size_t) len);
+        offset = target->offset + len;
+        free(armaps[i]);
+    } // for
+    xwrite_ar_pad(out, outfd, indexlen);
+
+    for (i = 0; i < count; i++)
+    {
+        const char *fname = members[i].path;
+        const int fd = xopen(fname, O_RDONLY, 0755);
+        xwrite_ar_header(out, outfd, arnames[i], members[i].size);
+        if (xcopyfile(fname, fd, out, outfd) != members[i].size)
+            xfail("'%s' changed size while we were reading it", fname);
+        xwrite_ar_pad(out, outfd, members[i].size);
+        xclose(fname, fd);
+    } // for
+
+    xclose(out, outfd);
+    unlink_on_xfail = NULL;
+
+    for (i = 0; i < count; i++)
+    {
+        for (j = 0; j < members[i].num_records; j++)
+            free(members[i].symbols[j].names);
+        free(members[i].symbols);
+        free(members[i].records);
+        free(arnames[i]);
+    } // for
+
+    free(indexhdr);
+    free(armaps);
+    free(longnames);
+    free(arnames);
+    free(index);
+    free(members);
+
+    return 0;  // success.
+} // fatelf_ar_create
+
+
+// Read the member header at (offset). Returns zero at end of archive.
+static int xread_ar_header(const char *fname, const int fd,
+                           const uint64_t fsize, const uint64_t offset,
+                           char *name, uint64_t *size)
+{
+    char buf[AR_HEADER_LEN + 1];
+    char *endptr = NULL;
+    int i;
+
+    if (offset >= fsize)
+        return 0;
+    else if ((fsize - offset) < AR_HEADER_LEN)
+        xfail("'%s' is a truncated archive", fname);
+
+    xpread(fname, fd, buf, AR_HEADER_LEN, offset);
+    buf[AR_HEADER_LEN] = '\0';
+    if ((buf[58] != '`') || (buf[59] != '\n'))
+        xfail("'%s' has a corrupt archive member header", fname);
+
+    memcpy(name, buf, 16);
+    for (i = 15; (i >= 0) && (name[i] == ' '); i--) { /* spin */ }
+    name[i + 1] = '\0';
+
+    buf[58] = '\0';
+    *size = (uint64_t) strtoull(buf + 48, &endptr, 10);
+    if ((endptr == buf + 48) || ((offset + AR_HEADER_LEN + *size) > fsize))
+        xfail("'%s' has a corrupt archive member size", fname);
+
+    return 1;
+} // xread_ar_header
+
+
+// Read the FatELF header of a member at (offset), or NULL if it's not FatELF.
+static FATELF_header *xread_member_fatelf_header(const char *fname,
+                                                 const int fd,
+                                                 const uint64_t offset,
+                                                 const uint64_t size)
+{
+    FATELF_header *retval = NULL;
+    const char *err = NULL;
+    uint8_t buf[FATELF_DISK_FORMAT_SIZE_V2(0)];  // enough for any version.
+    const size_t avail = (size < sizeof (buf)) ? (size_t) size : sizeof (buf);
+    uint8_t *fullbuf = NULL;
+    size_t buflen = 0;
+
+    if (size < 8)
+        return NULL;
+
+    xpread(fname, fd, buf, avail, offset);
+    if ((buflen = fatelf_decode_header_size(buf, avail, &err)) == 0)
+        return NULL;
+    else if (buflen > size)
+        xfail("'%s' has a member with a truncated FatELF header", fname);
+
+    fullbuf = (uint8_t *) xmalloc(buflen);
+    xpread(fname, fd, fullbuf, buflen, offset);
+    if ((retval = fatelf_decode_header(fullbuf, buflen, &err)) == NULL)
+        xfail("'%s' has a member that %s.", fname, err);
+    free(fullbuf);
+    return retval;
+} // xread_member_fatelf_header
+
+
+typedef struct fat_archive
+{
+    uint64_t fsize;
+    FATELF_header *index;
+    uint8_t *indexdata;
+    uint64_t indexlen;
+    char *longnames;  // the "//" member, NULL if there wasn't one.
+    uint64_t longnameslen;
+    uint64_t firstmember;  // offset of the first normal member's header.
+} fat_archive;
+
+
+// Open a fat archive and load its symbol index member.
+static int xopen_fat_archive(const char *fname, fat_archive *ar)
+{
+    const int fd = xopen(fname, O_RDONLY, 0755);
+    uint64_t offset = AR_MAGIC_LEN;
+    char magic[AR_MAGIC_LEN];
+    char name[17];
+    const char *err = NULL;
+
+    memset(ar, '\0', sizeof (*ar));
+    ar->fsize = xget_file_size(fname, fd);
+    if (ar->fsize < AR_MAGIC_LEN)
+        xfail("'%s' is not an archive", fname);
+    xpread(fname, fd, magic, AR_MAGIC_LEN, 0);
+    if (memcmp(magic, AR_MAGIC, AR_MAGIC_LEN) != 0)
+        xfail("'%s' is not an archive", fname);
+    else if (!xread_ar_header(fname, fd, ar->fsize, offset, name, &ar->indexlen))
+        xfail("'%s' is an empty archive", fname);
+
+    if (strcmp(name, "//") == 0)
+    {
+        ar->longnameslen = ar->indexlen;
+        ar->longnames = (char *) xmalloc((size_t) ar->longnameslen + 1);
+        xpread(fname, fd, ar->longnames, (size_t) ar->longnameslen,
+               offset + AR_HEADER_LEN);
+        offset += AR_HEADER_LEN + ar_pad(ar->longnameslen);
+        if (!xread_ar_header(fname, fd, ar->fsize, offset, name, &ar->indexlen))
+            xfail("'%s' has no FatELF symbol index", fname);
+    } // if
+
+    if (strcmp(name, AR_FATELF_INDEX_NAME) != 0)
+        xfail("'%s' has no FatELF symbol index", fname);
+
+    ar->indexdata = (uint8_t *) xmalloc((size_t) ar->indexlen + 1);
+    xpread(fname, fd, ar->indexdata, (size_t) ar->indexlen,
+           offset + AR_HEADER_LEN);
+    ar->index = fatelf_decode_header(ar->indexdata, (size_t) ar->indexlen, &err);
+    if (ar->index == NULL)
+        xfail("'%s' has a symbol index that %s.", fname, err);
+    ar->firstmember = offset + AR_HEADER_LEN + ar_pad(ar->indexlen);
+    return fd;
+} // xopen_fat_archive
+
+
+static void free_fat_archive(fat_archive *ar)
+{
+    free(ar->longnames);
+    free(ar->indexdata);
+    free(ar->index);
+} // free_fat_archive
+
+
+// Make sure a target's symbol index is within the index member and sane.
+static uint32_t check_armap(const char *fname, const uint8_t *indexdata,
+                            const uint64_t indexlen, const FATELF_record *rec)
+{
+    uint32_t count = 0;
+    if ( (rec->offset > indexlen) || (rec->size > (indexlen - rec->offset)) ||
+         (rec->size < 4) )
+        xfail("'%s' has a corrupt FatELF symbol index", fname);
+    count = getbe32(indexdata + rec->offset);
+    if ((((uint64_t) count) * 4) > (rec->size - 4))
+        xfail("'%s' has a corrupt FatELF symbol index", fname);
+    return count;
+} // check_armap
+
+
+typedef struct thin_member
+{
+    uint64_t oldoffset;  // member header in the fat archive.
+    uint64_t newoffset;  // member header in the thin archive.
+    uint64_t dataoffset;  // where to copy from in the fat archive.
+    uint64_t size;
+    char name[17];
+} thin_member;
+
+
+static int fatelf_ar_extract(const char *out, const char *fname,
+                             const char *target)
+{
+    fat_archive ar;
+    const int fd = xopen_fat_archive(fname, &ar);
+    const uint8_t *indexdata = ar.indexdata;
+    const int recidx = xfind_fatelf_record(ar.index, target);
+    const FATELF_record *want = NULL;
+    uint64_t offset = ar.firstmember;
+    uint64_t size = 0;
+    thin_member *members = NULL;
+    int nummembers = 0;
+    uint8_t *armap = NULL;
+    uint8_t *ptr = NULL;
+    const char *names = NULL;
+    uint32_t numsyms = 0;
+    uint32_t keptsyms = 0;
+    size_t keptnameslen = 0;
+    char name[17];
+    int outfd = -1;
+    uint32_t i;
+    int j;
+
+    if ((recidx < 0) || (recidx >= (int) ar.index->num_records))
+        xfail("No target '%s' in archive '%s'", target, fname);
+    want = &ar.index->records[recidx];
+    numsyms = check_armap(fname, indexdata, ar.indexlen, want);
+
+    // Find every member that has something for this target.
+    while (xread_ar_header(fname, fd, ar.fsize, offset, name, &size))
+    {
+        const uint64_t dataoffset = offset + AR_HEADER_LEN;
+        FATELF_header *header = NULL;
+        FATELF_record rec;
+        int found = 0;
+
+        if ((header = xread_member_fatelf_header(fname, fd, dataoffset, size)) != NULL)
+        {
+            for (j = 0; j < (int) header->num_records; j++)
+            {
+                if (fatelf_record_matches(&header->records[j], want))
+                {
+                    rec = header->records[j];
+                    found = 1;
+                    break;
+                } // if
+            } // for
+            free(header);
+            if ((found) && ((rec.offset > size) || (rec.size > (size - rec.offset))))
+                xfail("'%s' has a member with a corrupt FatELF header", fname);
+        } // else if
+        else if (size >= 20)
+        {
+            xread_elf_header(fname, fd, dataoffset, &rec);
+            rec.size = size;
+            found = fatelf_record_matches(&rec, want);
+        } // else if
+
+        if (found)
+        {
+            thin_member *tm;
+            members = (thin_member *) realloc(members, sizeof (thin_member) * (nummembers + 1));
+            if (members == NULL)
+                xfail("Out of memory!");
+            tm = &members[nummembers++];
+            tm->oldoffset = offset;
+            tm->dataoffset = dataoffset + rec.offset;
+            tm->size = rec.size;
+            strcpy(tm->name, name);
+        } // if
+
+        offset = dataoffset + ar_pad(size);
+    } // while
+
+    // The symbol index is the same for the thin archive, except the member
+    //  offsets move. Symbols from members we didn't keep get dropped.
+    names = (const char *) indexdata + want->offset + 4 + (numsyms * 4);
+    armap = (uint8_t *) xmalloc((size_t) want->size);
+    ptr = armap + 4 + (numsyms * 4);
+    for (i = 0; i < numsyms; i++)
+    {
+        const uint32_t memberoffset = getbe32(indexdata + want->offset + 4 + (i * 4));
+        const size_t namelen = strlen(names) + 1;
+        if ((names + namelen) > ((const char *) indexdata + want->offset + want->size))
+            xfail("'%s' has a corrupt FatELF symbol index", fname);
+        for (j = 0; j < nummembers; j++)
+        {
+            if (members[j].oldoffset == memberoffset)
+                break;
+        } // for
+
+        if (j < nummembers)
+        {
+            memcpy(ptr, names, namelen);
+            ptr += namelen;
+            keptnameslen += namelen;
+            putbe32(armap + 4 + (keptsyms * 4), (uint32_t) j);  // fixed up below.
+            keptsyms++;
+        } // if
+        names += namelen;
+    } // for
+
+    // squeeze out the offset slots we didn't use.
+    memmove(armap + 4 + (keptsyms * 4), armap + 4 + (numsyms * 4), keptnameslen);
+    putbe32(armap, keptsyms);
+
+    offset = AR_MAGIC_LEN;
+    if (keptsyms > 0)
+        offset += AR_HEADER_LEN + ar_pad(4 + (keptsyms * 4) + keptnameslen);
+    if (ar.longnames != NULL)
+        offset += AR_HEADER_LEN + ar_pad(ar.longnameslen);
+    for (j = 0; j < nummembers; j++)
+    {
+        members[j].newoffset = offset;
+        offset += AR_HEADER_LEN + ar_pad(members[j].size);
+    } // for
+
+    if (offset > 0xFFFFFFFF)
+        xfail("Archive is too big for a 32-bit symbol index.");
+
+    for (i = 0; i < keptsyms; i++)
+    {
+        uint8_t *slot = armap + 4 + (i * 4);
+        putbe32(slot, (uint32_t) members[getbe32(slot)].newoffset);
+    } // for
+
+    outfd = xopen(out, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    unlink_on_xfail = out;
+
+    xwrite(out, outfd, AR_MAGIC, AR_MAGIC_LEN);
+    if (keptsyms > 0)
+    {
+        const uint64_t len = 4 + (keptsyms * 4) + keptnameslen;
+        xwrite_ar_header(out, outfd, "/", len);
+        xwrite(out, outfd, armap, (size_t) len);
+        xwrite_ar_pad(out, outfd, len);
+    } // if
+
+    if (ar.longnames != NULL)  // extra names for dropped members are harmless.
+    {
+        xwrite_ar_header(out, outfd, "//", ar.longnameslen);
+        xwrite(out, outfd, ar.longnames, (size_t) ar.longnameslen);
+        xwrite_ar_pad(out, outfd, ar.longnameslen);
+    } // if
+
+    for (j = 0; j < nummembers; j++)
+    {
+        xwrite_ar_header(out, outfd, members[j].name, members[j].size);
+        xcopyfile_range(fname, fd, out, outfd, members[j].dataoffset, members[j].size);
+        xwrite_ar_pad(out, outfd, members[j].size);
+    } // for
+
+    xclose(out, outfd);
+    unlink_on_xfail = NULL;
+
+    xclose(fname, fd);
+    free(members);
+    free(armap);
+    free_fat_archive(&ar);
+
+    return 0;  // success.
+} // fatelf_ar_extract
+
+
+// Figure out a member's real name, from its header and the "//" table.
+static void get_member_name(const char *arname, const char *longnames,
+                            const uint64_t longnameslen, char *buf,
+                            const size_t buflen)
+{
+    if ((arname[0] == '/') && (arname[1] >= '0') && (arname[1] <= '9'))
+    {
+        const unsigned long long pos = strtoull(arname + 1, NULL, 10);
+        size_t len = 0;
+        if ((longnames == NULL) || (pos >= longnameslen))
+            snprintf(buf, buflen, "%s", arname);
+        else
+        {
+            const char *name = longnames + pos;
+            while (((pos + len) < longnameslen) && (name[len] != '/') && (name[len] != '\n'))
+                len++;
+            snprintf(buf, buflen, "%.*s", (int) len, name);
+        } // else
+    } // if
+    else
+    {
+        const char *end = strrchr(arname, '/');
+        const size_t len = end ? (size_t) (end - arname) : strlen(arname);
+        snprintf(buf, buflen, "%.*s", (int) len, arname);
+    } // else
+} // get_member_name
+
+
+static int fatelf_ar_list(const char *fname)
+{
+    fat_archive ar;
+    const int fd = xopen_fat_archive(fname, &ar);
+    const uint8_t *indexdata = ar.indexdata;
+    int i;
+
+    printf("%s: FatELF archive, %d targets.\n", fname, (int) ar.index->num_records);
+
+    for (i = 0; i < (int) ar.index->num_records; i++)
+    {
+        const FATELF_record *rec = &ar.index->records[i];
+        const uint32_t numsyms = check_armap(fname, indexdata, ar.indexlen, rec);
+        const char *names = (const char *) indexdata + rec->offset + 4 + (numsyms * 4);
+        const char *end = (const char *) indexdata + rec->offset + rec->size;
+        uint32_t j;
+
+        printf("\nArchive index for '%s' (%u symbols):\n",
+               fatelf_get_target_name(rec, FATELF_WANT_EVERYTHING),
+               (unsigned int) numsyms);
+
+        for (j = 0; (j < numsyms) && (names < end); j++)
+        {
+            const uint32_t memberoffset = getbe32(indexdata + rec->offset + 4 + (j * 4));
+            char arname[17];
+            char membername[256];
+            uint64_t membersize = 0;
+            if (!xread_ar_header(fname, fd, ar.fsize, memberoffset, arname, &membersize))
+                xfail("'%s' has a corrupt FatELF symbol index", fname);
+            get_member_name(arname, ar.longnames, ar.longnameslen,
+                            membername, sizeof (membername));
+            printf("%.*s in %s\n", (int) (end - names), names, membername);
+            names += strnlen(names, end - names) + 1;
+        } // for
+    } // for
+
+    xclose(fname, fd);
+    free_fat_archive(&ar);
+    return 0;  // success.
+} // fatelf_ar_list
+
+
+static void usage(const char *argv0)
+{
+    xfail("USAGE: %s [--jobs=N] create <out> <member1> [... memberN]\n"
+          "       %s extract <out> <in> <target>\n"
+          "       %s list <in>", argv0, argv0, argv0);
+} // usage
+
+
+int main(int argc, const char **argv)
+{
+    const char *argv0 = argv[0];
+    int jobs = 0;
+
+    xfatelf_init(&argc, argv);
+
+    // this could stand to use getopt(), later.
+    if ((argc >= 2) && (strncmp(argv[1], "--jobs=", 7) == 0))
+    {
+        jobs = atoi(argv[1] + 7);
+        argv++;
+        argc--;
+    } // if
+
+    if (argc < 2)
+        usage(argv0);
+    else if ((strcmp(argv[1], "create") == 0) && (argc >= 4))
+        return fatelf_ar_create(argv[2], &argv[3], argc - 3, jobs);
+    else if ((strcmp(argv[1], "extract") == 0) && (argc == 5))
+        return fatelf_ar_extract(argv[2], argv[3], argv[4]);
+    else if ((strcmp(argv[1], "list") == 0) && (argc == 3))
+        return fatelf_ar_list(argv[2]);
+
+    usage(argv0);
+    return 1;
+} // main
+
+// end of fatelf-ar.c ...
@@ -0,0 +1,546 @@
+/**
+ * FatELF; support multiple ELF binaries in one file.
+ *
+ * Please see the file LICENSE.txt in the source's root directory.
+ *
+ *  This file written by Ryan C. Gordon.
+ */
+
+// This builds an index of GNU build-ids, so a debugger or crash reporter
+//  holding a build-id from a core dump can find the FatELF file and record
+//  it came from without opening every binary on the system. Each record's
+//  NT_GNU_BUILD_ID note is read right at its offset in the FatELF file, the
+//  files are read in parallel, and the index is written sorted, so looking
+//  something up is a binary search of an mmap()ed file. Files that haven't
+//  changed since the last run (same size and mtime) aren't read again.
+
+#define _GNU_SOURCE 1  // for nftw().
+#define FATELF_UTILS 1
+#include "fatelf-utils.h"
+
+#include <ftw.h>
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+
+#define BUILDID_EXIT_NOT_FOUND 2  // exit(1) is taken by xfail().
+
+typedef struct index_file
+{
+    const char *path;
+    int64_t mtime_sec;
+    uint32_t mtime_nsec;
+    uint64_t size;
+    int64_t old;  // file index in the old index, or -1 if it must be read.
+    int is_elf;   // zero if it's neither FatELF nor ELF.
+    fatelf_build_id_entry *entries;
+    uint32_t count;
+} index_file;
+
+typedef struct buildid_options
+{
+    int rebuild;
+    int threads;
+} buildid_options;
+
+static buildid_options options;
+
+
+static void hex_build_id(const uint8_t *id, const size_t len, char *buf)
+{
+    size_t i;
+    for (i = 0; i < len; i++)
+        snprintf(buf + (i * 2), 3, "%02x", (unsigned int) id[i]);
+    buf[len * 2] = '\0';
+} // hex_build_id
+
+
+static int parse_build_id(const char *str, uint8_t *id, size_t *len)
+{
+    const size_t slen = strlen(str);
+    size_t i;
+
+    if ((slen == 0) || (slen % 2) || (slen > (FATELF_BUILD_ID_MAX * 2)))
+        return 0;
+
+    for (i = 0; i < slen; i += 2)
+    {
+        const char byte[3] = { str[i], str[i+1], '\0' };
+        if (!isxdigit((unsigned char) str[i]) || !isxdigit((unsigned char) str[i+1]))
+            return 0;
+        id[i / 2] = (uint8_t) strtoul(byte, NULL, 16);
+    } // for
+
+    *len = slen / 2;
+    return 1;
+} // parse_build_id
+
+
+static void add_entry(index_file *file, const uint8_t *id, const size_t len,
+                      const uint32_t record, const FATELF_record *rec)
+{
+    fatelf_build_id_entry *entry;
+    file->entries = (fatelf_build_id_entry *) realloc(file->entries, sizeof (fatelf_build_id_entry) * (file->count + 1));
+    if (file->entries == NULL)
+        xfail("Out of memory!");
+    entry = &file->entries[file->count++];
+    memset(entry, '\0', sizeof (*entry));
+    memcpy(entry->id, id, len);
+    entry->id_len = (uint8_t) len;
+    entry->record = record;
+    memcpy(&entry->rec, rec, sizeof (*rec));
+} // add_entry
+
+
+// Read the build-ids of one file. Files that aren't FatELF or ELF, or are
+//  broken, are quietly left out: we're usually walking a whole tree.
+static void read_file(index_file *file)
+{
+    const int fd = open(file->path, O_RDONLY | O_CLOEXEC);
+    uint8_t id[FATELF_BUILD_ID_MAX];
+    const char *err = NULL;
+    FATELF_header *header;
+    size_t len = 0;
+    int i;
+
+    if (fd == -1)
+        return;
+
+    header = fatelf_pread_header(fd, 0, file->size, &err);
+    if (header != NULL)
+    {
+        file->is_elf = 1;
+        for (i = 0; i < (int) header->num_records; i++)
+        {
+            const FATELF_record *rec = &header->records[i];
+            if ((fatelf_read_build_id(fd, rec->offset, rec->size, id, &len) == NULL) && (len > 0))
+                add_entry(file, id, len, (uint32_t) i, rec);
+        } // for
+        free(header);
+    } // if
+
+    else if (strcmp(err, "is not a FatELF binary") == 0)
+    {
+        uint8_t buf[64];
+        fatelf_elf_header hdr;
+        const ssize_t br = pread(fd, buf, sizeof (buf), 0);
+        if ((br > 0) && (fatelf_elf_decode_header(buf, (size_t) br, &hdr) == NULL))
+        {
+            file->is_elf = 1;
+            if ((fatelf_read_build_id(fd, 0, file->size, id, &len) == NULL) && (len > 0))
+            {
+                FATELF_record rec;
+                memset(&rec, '\0', sizeof (rec));
+                rec.machine = hdr.machine;
+                rec.osabi = hdr.osabi;
+                rec.osabi_version = hdr.osabi_version;
+                rec.word_size = hdr.word_size;
+                rec.byte_order = hdr.byte_order;
+                rec.size = file->size;
+                add_entry(file, id, len, FATELF_BUILD_ID_NO_RECORD, &rec);
+            } // if
+        } // if
+    } // else if
+
+    close(fd);
+} // read_file
+
+
+static void read_worker(void *data, const int idx)
+{
+    index_file *file = ((index_file *) data) + idx;
+    if (file->old < 0)
+        read_file(file);
+} // read_worker
+
+
+static index_file *walk_files = NULL;  // nftw() doesn't pass a context pointer.
+static int walk_count = 0;
+static int walk_allocated = 0;
+
+
+static int walk_callback(const char *fname, const struct stat *statbuf,
+                         int typeflag, struct FTW *ftwbuf)
+{
+    index_file *file;
+
+    (void) ftwbuf;
+    if ((typeflag == FTW_DNR) || (typeflag == FTW_NS))
+        return 0;  // not ours to index, if we can't read it.
+    else if (!S_ISREG(statbuf->st_mode))
+        return 0;
+
+    if (walk_count == walk_allocated)
+    {
+        walk_allocated = walk_allocated ? (walk_allocated * 2) : 1024;
+        walk_files = (index_file *) realloc(walk_files, sizeof (index_file) * walk_allocated);
+        if (walk_files == NULL)
+            xfail("Out of memory!");
+    } // if
+
+    file = &walk_files[walk_count++];
+    memset(file, '\0', sizeof (*file));
+    file->path = xstrdup(fname);
+    file->mtime_sec = (int64_t) statbuf->st_mtim.tv_sec;
+    file->mtime_nsec = (uint32_t) statbuf->st_mtim.tv_nsec;
+    file->size = (uint64_t) statbuf->st_size;
+    file->old = -1;
+    return 0;
+} // walk_callback
+
+
+static int compare_files(const void *a, const void *b)
+{
+    return strcmp(((const index_file *) a)->path, ((const index_file *) b)->path);
+} // compare_files
+
+
+static int compare_entries(const void *a, const void *b)
+{
+    const fatelf_build_id_entry *ea = (const fatelf_build_id_entry *) a;
+    const fatelf_build_id_entry *eb = (const fatelf_build_id_entry *) b;
+    const int rc = fatelf_compare_build_id_entries(ea, eb);
+    if (rc != 0)
+        return rc;
+    else if (ea->file != eb->file)
+        return (ea->file < eb->file) ? -1 : 1;
+    return (ea->record < eb->record) ? -1 : (ea->record > eb->record);
+} // compare_entries
+
+
+// The old index keeps its files sorted by path, so search it directly.
+static int64_t find_old_file(const fatelf_build_id_index *index,
+                             const char *path, fatelf_build_id_file *file)
+{
+    uint32_t lo = 0, hi = index->num_files;
+    while (lo < hi)
+    {
+        const uint32_t mid = lo + ((hi - lo) / 2);
+        int rc;
+        if (!fatelf_get_build_id_file(index, mid, file))
+            return -1;  // corrupt; read everything again.
+        rc = strcmp(file->path, path);
+        if (rc == 0)
+            return (int64_t) mid;
+        else if (rc < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    } // while
+    return -1;
+} // find_old_file
+
+
+// Move the old index's entries over to the files that didn't change.
+static void reuse_old_entries(const fatelf_build_id_index *index,
+                              index_file *files, const int numfiles)
+{
+    int32_t *map = (int32_t *) xmalloc(sizeof (int32_t) * (index->num_files + 1));
+    uint32_t i;
+
+    for (i = 0; i < index->num_files; i++)
+        map[i] = -1;
+    for (i = 0; i < (uint32_t) numfiles; i++)
+    {
+        if (files[i].old >= 0)
+            map[files[i].old] = (int32_t) i;
+    } // for
+
+    for (i = 0; i < index->num_entries; i++)
+    {
+        fatelf_build_id_entry entry;
+        fatelf_get_build_id_entry(index, i, &entry);
+        if ((entry.file < index->num_files) && (map[entry.file] >= 0))
+            add_entry(&files[map[entry.file]], entry.id, entry.id_len, entry.record, &entry.rec);
+    } // for
+
+    free(map);
+} // reuse_old_entries
+
+
+static void write_index(const char *out, index_file *files, const int numfiles)
+{
+    const size_t tmplen = strlen(out) + 16;
+    char *tmppath = (char *) xmalloc(tmplen);
+    fatelf_build_id_entry *entries = NULL;
+    uint64_t strings_size = 0;
+    const uint32_t num_files = (uint32_t) numfiles;
+    uint32_t num_entries = 0;
+    uint8_t buf[FATELF_BUILD_ID_HEADER_SIZE];
+    uint64_t path_offset = 0;
+    int outfd;
+    int i;
+    uint32_t j;
+
+    // Every file goes in, even ones without build-ids, so the next run
+    //  knows it doesn't have to read them. They're numbered in path order.
+    for (i = 0; i < numfiles; i++)
+    {
+        for (j = 0; j < files[i].count; j++)
+            files[i].entries[j].file = (uint32_t) i;
+        num_entries += files[i].count;
+        strings_size += strlen(files[i].path) + 1;
+    } // for
+
+    entries = (fatelf_build_id_entry *) xmalloc(sizeof (fatelf_build_id_entry) * (num_entries + 1));
+    num_entries = 0;
+    for (i = 0; i < numfiles; i++)
+    {
+        memcpy(&entries[num_entries], files[i].entries, sizeof (fatelf_build_id_entry) * files[i].count);
+        num_entries += files[i].count;
+    } // for
+    qsort(entries, num_entries, sizeof (fatelf_build_id_entry), compare_entries);
+
+    snprintf(tmppath, tmplen, "%s.XXXXXX", out);
+    if ((outfd = mkstemp(tmppath)) == -1)
+        xfail("Failed to create '%s': %s", tmppath, strerror(errno));
+    unlink_on_xfail = tmppath;
+
+    fatelf_encode_build_id_index_header(num_entries, num_files, strings_size, buf);
+    xwrite(tmppath, outfd, buf, sizeof (buf));
+
+    for (j = 0; j < num_entries; j++)
+    {
+        fatelf_encode_build_id_entry(&entries[j], buf);
+        xwrite(tmppath, outfd, buf, FATELF_BUILD_ID_ENTRY_SIZE);
+    } // for
+
+    for (i = 0; i < numfiles; i++)
+    {
+        fatelf_build_id_file file;
+        file.path = files[i].path;
+        file.mtime_sec = files[i].mtime_sec;
+        file.mtime_nsec = files[i].mtime_nsec;
+        file.size = files[i].size;
+        fatelf_encode_build_id_file(&file, path_offset, buf);
+        xwrite(tmppath, outfd, buf, FATELF_BUILD_ID_FILE_SIZE);
+        path_offset += strlen(files[i].path) + 1;
+    } // for
+
+    for (i = 0; i < numfiles; i++)
+        xwrite(tmppath, outfd, files[i].path, strlen(files[i].path) + 1);
+
+    if (fchmod(outfd, 0644) == -1)
+        xfail("Failed to chmod '%s': %s", tmppath, strerror(errno));
+    xfsync(tmppath, outfd);
+    xclose(tmppath, outfd);
+    if (rename(tmppath, out) == -1)
+        xfail("Failed to rename '%s' to '%s': %s", tmppath, out, strerror(errno));
+    unlink_on_xfail = NULL;
+
+    free(entries);
+    free(tmppath);
+} // write_index
+
+
+static int fatelf_buildid_index(const char *out, const char **paths,
+                                const int numpaths)
+{
+    fatelf_build_id_index *old = NULL;
+    int reused = 0, numread = 0, numfiles = 0;
+    uint32_t numentries = 0;
+    const char *err = NULL;
+    int i;
+
+    for (i = 0; i < numpaths; i++)
+    {
+        char *real = realpath(paths[i], NULL);
+        struct stat statbuf;
+        if ((real == NULL) || (stat(real, &statbuf) == -1))
+            xfail("Can't read '%s': %s", paths[i], strerror(errno));
+        else if (!S_ISDIR(statbuf.st_mode))
+            walk_callback(real, &statbuf, FTW_F, NULL);
+        else if (nftw(real, walk_callback, 64, FTW_PHYS) == -1)
+            xfail("Failed to scan '%s': %s", paths[i], strerror(errno));
+        free(real);
+    } // for
+
+    // Paths are sorted so the index can search them; drop repeats, from
+    //  overlapping arguments.
+    qsort(walk_files, walk_count, sizeof (index_file), compare_files);
+    for (i = 0; i < walk_count; i++)
+    {
+        if ((numfiles > 0) && (strcmp(walk_files[numfiles-1].path, walk_files[i].path) == 0))
+            free((void *) walk_files[i].path);
+        else
+            walk_files[numfiles++] = walk_files[i];
+    } // for
+
+    if (!options.rebuild)
+    {
+        old = fatelf_open_build_id_index(out, &err);
+        if ((old == NULL) && (errno != ENOENT))
+            fprintf(stderr, "%s: '%s' %s; rebuilding it.\n", "fatelf-buildid", out, err);
+    } // if
+
+    if (old != NULL)
+    {
+        for (i = 0; i < numfiles; i++)
+        {
+            fatelf_build_id_file prev;
+            index_file *file = &walk_files[i];
+            const int64_t idx = find_old_file(old, file->path, &prev);
+            if ( (idx >= 0) && (prev.size == file->size) &&
+                 (prev.mtime_sec == file->mtime_sec) &&
+                 (prev.mtime_nsec == file->mtime_nsec) )
+            {
+                file->old = idx;
+                reused++;
+            } // if
+        } // for
+        reuse_old_entries(old, walk_files, numfiles);
+        fatelf_close_build_id_index(old);
+    } // if
+
+    numread = numfiles - reused;
+    fatelf_parallel_for(numfiles, options.threads, read_worker, walk_files);
+
+    write_index(out, walk_files, numfiles);
+
+    for (i = 0; i < numfiles; i++)
+    {
+        numentries += walk_files[i].count;
+        free(walk_files[i].entries);
+        free((void *) walk_files[i].path);
+    } // for
+    free(walk_files);
+
+    printf("%d files: %d read, %d unchanged; %u build-ids indexed.\n",
+           numfiles, numread, reused, (unsigned int) numentries);
+    return 0;
+} // fatelf_buildid_index
+
+
+static int fatelf_buildid_lookup(const char *fname, const char **ids,
+                                 const int numids)
+{
+    const char *err = NULL;
+    fatelf_build_id_index *index = fatelf_open_build_id_index(fname, &err);
+    int missing = 0;
+    int i;
+
+    if (index == NULL)
+        xfail("'%s' %s", fname, err);
+
+    for (i = 0; i < numids; i++)
+    {
+        uint8_t id[FATELF_BUILD_ID_MAX];
+        size_t len = 0;
+        uint32_t first = 0, count, j;
+
+        if (!parse_build_id(ids[i], id, &len))
+            xfail("'%s' isn't a build-id", ids[i]);
+
+        count = fatelf_lookup_build_id(index, id, len, &first);
+        if (count == 0)
+        {
+            fprintf(stderr, "%s: not found\n", ids[i]);
+            missing++;
+        } // if
+
+        for (j = first; j < first + count; j++)
+        {
+            fatelf_build_id_entry entry;
+            fatelf_build_id_file file;
+            char hex[(FATELF_BUILD_ID_MAX * 2) + 1];
+
+            fatelf_get_build_id_entry(index, j, &entry);
+            if (!fatelf_get_build_id_file(index, entry.file, &file))
+                xfail("'%s' is a corrupt build-id index", fname);
+
+            hex_build_id(entry.id, entry.id_len, hex);
+            if (entry.record == FATELF_BUILD_ID_NO_RECORD)
+                printf("%s\t%s\t-", hex, file.path);
+            else
+                printf("%s\t%s\t%u", hex, file.path, (unsigned int) entry.record);
+            printf("\t%s\t%llu\t%llu\n",
+                   fatelf_get_target_name(&entry.rec, FATELF_WANT_EVERYTHING),
+                   (unsigned long long) entry.rec.offset,
+                   (unsigned long long) entry.rec.size);
+        } // for
+    } // for
+
+    fatelf_close_build_id_index(index);
+    return missing ? BUILDID_EXIT_NOT_FOUND : 0;
+} // fatelf_buildid_lookup
+
+
+static int fatelf_buildid_show(const char **paths, const int numpaths)
+{
+    int i;
+    uint32_t j;
+
+    for (i = 0; i < numpaths; i++)
+    {
+        index_file file;
+        struct stat statbuf;
+
+        memset(&file, '\0', sizeof (file));
+        if (stat(paths[i], &statbuf) == -1)
+            xfail("Can't read '%s': %s", paths[i], strerror(errno));
+        file.path = paths[i];
+        file.size = (uint64_t) statbuf.st_size;
+        read_file(&file);
+        if (!file.is_elf)
+            xfail("'%s' is not a FatELF or ELF binary", paths[i]);
+        else if (file.count == 0)
+            printf("%s\t(no build-id)\n", paths[i]);
+
+        for (j = 0; j < file.count; j++)
+        {
+            const fatelf_build_id_entry *entry = &file.entries[j];
+            char hex[(FATELF_BUILD_ID_MAX * 2) + 1];
+            hex_build_id(entry->id, entry->id_len, hex);
+            if (entry->record == FATELF_BUILD_ID_NO_RECORD)
+                printf("%s\t-", paths[i]);
+            else
+                printf("%s\t%u", paths[i], (unsigned int) entry->record);
+            printf("\t%s\t%s\n", fatelf_get_target_name(&entry->rec, FATELF_WANT_EVERYTHING), hex);
+        } // for
+        free(file.entries);
+    } // for
+
+    return 0;
+} // fatelf_buildid_show
+
+
+int main(int argc, const char **argv)
+{
+    const char *usage = "USAGE: %s [--jobs=N] index [--rebuild] <index> <in|dir> [... <in|dir>]\n"
+                        "       %s lookup <index> <build-id> [... <build-id>]\n"
+                        "       %s show <in> [... <in>]";
+    int i = 1;
+
+    xfatelf_init(&argc, argv);
+
+    while ((i < argc) && (strncmp(argv[i], "--", 2) == 0))
+    {
+        if (strncmp(argv[i], "--jobs=", 7) == 0)
+            options.threads = atoi(argv[i] + 7);
+        else
+            xfail("Unknown option '%s'", argv[i]);
+        i++;
+    } // while
+
+    if ((i < argc) && (strcmp(argv[i], "index") == 0))
+    {
+        i++;
+        if ((i < argc) && (strcmp(argv[i], "--rebuild") == 0))
+        {
+            options.rebuild = 1;
+            i++;
+        } // if
+        if (argc > i + 1)
+            return fatelf_buildid_index(argv[i], argv + i + 1, argc - (i + 1));
+    } // if
+    else if ((i < argc) && (strcmp(argv[i], "lookup") == 0) && (argc > i + 2))
+        return fatelf_buildid_lookup(argv[i + 1], argv + i + 2, argc - (i + 2));
+    else if ((i < argc) && (strcmp(argv[i], "show") == 0) && (argc > i + 1))
+        return fatelf_buildid_show(argv + i + 1, argc - (i + 1));
+
+    // this could stand to use getopt(), later.
+    xfail(usage, argv[0], argv[0], argv[0]);
+    return 1;
+} // main
+
+// end of fatelf-buildid.c ...
@@ -0,0 +1,785 @@
+/**
+ * FatELF; support multiple ELF binaries in one file.
+ *
+ * Please see the file LICENSE.txt in the source's root directory.
+ *
+ *  This file written by Ryan C. Gordon.
+ */
+
+// This is a compiler driver wrapper that builds a FatELF file in one step.
+//  It runs the same compile or link once per target, all at once, with
+//  each target's output (and depfile) going to a memfd the compiler reaches
+//  through /proc/self/fd. When they all succeed, the memfds are glued into
+//  the real output and the depfiles are merged into one. Nothing thin ever
+//  touches the disk, and nothing waits on the slowest target but the glue.
+//
+// FatELF inputs (objects or shared libraries built by an earlier fatelf-cc)
+//  get thinned for each target the same way, so links work too. To know
+//  which record a target wants, we compile an empty file for it first.
+
+#define _GNU_SOURCE 1
+#define FATELF_UTILS 1
+#include "fatelf-utils.h"
+
+#include <errno.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+extern char **environ;
+
+// One way of running the compiler.
+typedef struct cc_target
+{
+    const char *spec;     // as given, for messages.
+    char *compiler;       // the compiler's name, with any cross prefix.
+    char **flags;         // extra arguments for this target.
+    int numflags;
+    int isa;              // ISA level for the record, or -1 to read notes.
+    FATELF_record probe;  // what an object for this target looks like.
+    int outfd;            // memfd for -o.
+    int depfd;            // memfd for -MF, or -1.
+    int errfd;            // memfd for the compiler's stderr.
+    int *thinfds;         // a memfd for each argument, or -1.
+    char **thinpaths;     // /proc/self/fd paths for those.
+    char *outpath;
+    char *deppath;
+    pid_t pid;
+    int status;
+} cc_target;
+
+// What we need to know from the compiler's command line.
+typedef struct cc_command
+{
+    const char *compiler;
+    const char **args;
+    int numargs;
+    const char *output;   // -o, or NULL.
+    const char *depfile;  // -MF, or derived from -o with -MD/-MMD; or NULL.
+    int output_arg;       // index of -o's value in args, or -1.
+    int depfile_arg;      // index of -MF's value in args, or -1.
+    int has_deps;         // -MD or -MMD.
+    int has_dep_target;   // -MT or -MQ.
+    int single;           // -E, -S, -M or -MM: nothing to glue.
+    int compile_only;     // -c.
+    int *is_fat;          // non-zero for arguments that are FatELF files.
+    int any_fat;
+} cc_command;
+
+typedef struct cc_options
+{
+    int jobs;
+    int verbose;
+} cc_options;
+
+static cc_options options;
+
+
+static int make_memfd(const char *name)
+{
+    // Not MFD_CLOEXEC: the compiler and its children need these.
+    const int fd = memfd_create(name, 0);
+    if (fd == -1)
+        xfail("memfd_create failed: %s", strerror(errno));
+    return fd;
+} // make_memfd
+
+
+static char *fd_path(const int fd)
+{
+    char buf[64];
+    snprintf(buf, sizeof (buf), "/proc/self/fd/%d", fd);
+    return xstrdup(buf);
+} // fd_path
+
+
+// A target is "[PREFIX] [FLAGS...] [isa=LEVEL]": "-m32", "-m64 -mavx2",
+//  "aarch64-linux-gnu-", "aarch64-linux-gnu- -mcpu=cortex-a72"...
+static void parse_target(cc_target *target, const char *spec,
+                         const char *compiler)
+{
+    char *copy = xstrdup(spec);
+    char *saveptr = NULL;
+    char *tok;
+    int first = 1;
+
+    memset(target, '\0', sizeof (*target));
+    target->spec = spec;
+    target->isa = -1;
+    target->depfd = -1;
+    target->flags = (char **) xmalloc(sizeof (char *) * (strlen(spec) + 1));
+
+    for (tok = strtok_r(copy, " \t", &saveptr); tok != NULL; tok = strtok_r(NULL, " \t", &saveptr), first = 0)
+    {
+        if (strncmp(tok, "isa=", 4) == 0)
+        {
+            if ((target->isa = fatelf_parse_isa_level(tok + 4)) == -1)
+                xfail("Unknown ISA level '%s' in target '%s'", tok + 4, spec);
+        } // if
+        else if ((first) && (*tok != '-'))
+        {
+            // A cross prefix goes on the compiler's name, not its path.
+            const char *base = strrchr(compiler, '/');
+            const size_t dirlen = base ? (size_t) (base + 1 - compiler) : 0;
+            base = base ? base + 1 : compiler;
+            target->compiler = (char *) xmalloc(strlen(compiler) + strlen(tok) + 1);
+            memcpy(target->compiler, compiler, dirlen);
+            strcpy(target->compiler + dirlen, tok);
+            strcat(target->compiler, base);
+        } // else if
+        else
+        {
+            target->flags[target->numflags++] = xstrdup(tok);
+        } // else
+    } // for
+
+    if (target->compiler == NULL)
+        target->compiler = xstrdup(compiler);
+    free(copy);
+} // parse_target
+
+
+static int is_fatelf_path(const char *fname)
+{
+    const int fd = open(fname, O_RDONLY | O_CLOEXEC);
+    uint8_t buf[4];
+    struct stat statbuf;
+    int retval = 0;
+
+    if (fd == -1)
+        return 0;
+    else if ((fstat(fd, &statbuf) == 0) && (S_ISREG(statbuf.st_mode)) &&
+             (pread(fd, buf, sizeof (buf), 0) == sizeof (buf)))
+    {
+        retval = ( (buf[0] == (FATELF_MAGIC & 0xFF)) &&
+                   (buf[1] == ((FATELF_MAGIC >> 8) & 0xFF)) &&
+                   (buf[2] == ((FATELF_MAGIC >> 16) & 0xFF)) &&
+                   (buf[3] == ((FATELF_MAGIC >> 24) & 0xFF)) );
+    } // else if
+    close(fd);
+    return retval;
+} // is_fatelf_path
+
+
+// gcc names the depfile after -o, with the suffix swapped for ".d".
+static char *default_depfile(const char *output)
+{
+    const char *slash = strrchr(output, '/');
+    const char *dot = strrchr(slash ? slash : output, '.');
+    const size_t len = dot ? (size_t) (dot - output) : strlen(output);
+    char *retval = (char *) xmalloc(len + 3);
+    memcpy(retval, output, len);
+    strcpy(retval + len, ".d");
+    return retval;
+} // default_depfile
+
+
+static void parse_command(cc_command *cmd, const char **args, const int numargs)
+{
+    int i;
+
+    memset(cmd, '\0', sizeof (*cmd));
+    cmd->compiler = args[0];
+    cmd->args = args + 1;
+    cmd->numargs = numargs - 1;
+    cmd->output_arg = -1;
+    cmd->depfile_arg = -1;
+    cmd->is_fat = (int *) xmalloc(sizeof (int) * (numargs + 1));
+
+    for (i = 0; i < cmd->numargs; i++)
+    {
+        const char *arg = cmd->args[i];
+        const int has_next = (i + 1 < cmd->numargs);
+
+        if ((strcmp(arg, "-o") == 0) && (has_next))
+            cmd->output = cmd->args[cmd->output_arg = ++i];
+        else if ((strcmp(arg, "-MF") == 0) && (has_next))
+            cmd->depfile = cmd->args[cmd->depfile_arg = ++i];
+        else if (((strcmp(arg, "-MT") == 0) || (strcmp(arg, "-MQ") == 0)) && (has_next))
+        {
+            cmd->has_dep_target = 1;
+            i++;
+        } // else if
+        else if ((strncmp(arg, "-o", 2) == 0) || (strncmp(arg, "-MF", 3) == 0))
+            xfail("Please put a space after '%.3s' in '%s'", arg, arg);
+        else if ((strncmp(arg, "-MT", 3) == 0) || (strncmp(arg, "-MQ", 3) == 0))
+            cmd->has_dep_target = 1;
+        else if ((strcmp(arg, "-MD") == 0) || (strcmp(arg, "-MMD") == 0))
+            cmd->has_deps = 1;
+        else if ((strcmp(arg, "-E") == 0) || (strcmp(arg, "-S") == 0) ||
+                 (strcmp(arg, "-M") == 0) || (strcmp(arg, "-MM") == 0))
+            cmd->single = 1;
+        else if (strcmp(arg, "-c") == 0)
+            cmd->compile_only = 1;
+        else if ((*arg != '-') && (is_fatelf_path(arg)))
+            cmd->is_fat[i] = cmd->any_fat = 1;
+    } // for
+
+    // Without an output file, there's nothing to glue.
+    if (cmd->output == NULL)
+        cmd->single = 1;
+
+    if ((cmd->has_deps) && (cmd->depfile == NULL) && (cmd->output != NULL))
+        cmd->depfile = default_depfile(cmd->output);
+} // parse_command
+
+
+// Start the compiler for one target, with (args) after the target's flags.
+//  Its stderr goes to the target's errfd.
+static void spawn_compiler(cc_target *target, const char **args,
+                           const int numargs)
+{
+    const char **argv = (const char **) xmalloc(sizeof (char *) * (target->numflags + numargs + 2));
+    posix_spawn_file_actions_t actions;
+    int argc = 0;
+    int rc, i;
+
+    argv[argc++] = target->compiler;
+    for (i = 0; i < target->numflags; i++)
+        argv[argc++] = target->flags[i];
+    for (i = 0; i < numargs; i++)
+        argv[argc++] = args[i];
+    argv[argc] = NULL;
+
+    if (options.verbose)
+    {
+        for (i = 0; i < argc; i++)
+            fprintf(stderr, "%s%s", (i > 0) ? " " : "", argv[i]);
+        fprintf(stderr, "\n");
+    } // if
+
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, target->errfd, 2);
+    rc = posix_spawnp(&target->pid, argv[0], &actions, NULL, (char **) argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    if (rc != 0)
+        xfail("Failed to run '%s': %s", argv[0], strerror(rc));
+    free(argv);
+} // spawn_compiler
+
+
+// Run spawn_compiler() for every target, at most options.jobs at once,
+//  then show what they had to say. Identical messages from several targets
+//  are only shown once. Returns the first failing target, or -1.
+static int run_all(cc_target *targets, const int numtargets,
+                   const char ***argvs, const int *argcs)
+{
+    const int jobs = ((options.jobs > 0) && (options.jobs < numtargets)) ? options.jobs : numtargets;
+    char **messages = (char **) xmalloc(sizeof (char *) * numtargets);
+    int started = 0, running = 0, finished = 0;
+    int failed = -1;
+    int i, j;
+
+    while (finished < numtargets)
+    {
+        int status = 0;
+        pid_t pid;
+
+        while ((running < jobs) && (started < numtargets))
+        {
+            targets[started].errfd = make_memfd("fatelf-cc-stderr");
+            spawn_compiler(&targets[started], argvs[started], argcs[started]);
+            started++;
+            running++;
+        } // while
+
+        if ((pid = waitpid(-1, &status, 0)) == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            xfail("waitpid failed: %s", strerror(errno));
+        } // if
+
+        for (i = 0; i < started; i++)
+        {
+            if (targets[i].pid == pid)
+            {
+                targets[i].status = status;
+                targets[i].pid = 0;
+                running--;
+                finished++;
+            } // if
+        } // for
+    } // while
+
+    for (i = 0; i < numtargets; i++)
+    {
+        cc_target *target = &targets[i];
+        const uint64_t len = xget_file_size("stderr", target->errfd);
+        messages[i] = (char *) xmalloc(len + 1);
+        if (len > 0)
+            xpread("stderr", target->errfd, messages[i], (size_t) len, 0);
+        close(target->errfd);
+
+        for (j = 0; j < i; j++)
+        {
+            if (strcmp(messages[i], messages[j]) == 0)
+                break;
+        } // for
+        if ((j == i) && (len > 0))
+            xwrite("stderr", 2, messages[i], (size_t) len);
+
+        if (failed == -1)
+        {
+            if (WIFSIGNALED(target->status))
+            {
+                fprintf(stderr, "fatelf-cc: compiler for target '%s' died from signal %d\n",
+                        target->spec, WTERMSIG(target->status));
+                failed = i;
+            } // if
+            else if (WEXITSTATUS(target->status) != 0)
+                failed = i;
+        } // if
+    } // for
+
+    for (i = 0; i < numtargets; i++)
+        free(messages[i]);
+    free(messages);
+    return failed;
+} // run_all
+
+
+// Compile an empty file for each target, to see what its records look like.
+static void probe_targets(cc_target *targets, const int numtargets)
+{
+    static const char *args[] = { "-x", "c", "-c", "/dev/null", "-o", NULL };
+    const char ***argvs = (const char ***) xmalloc(sizeof (char **) * numtargets);
+    int *argcs = (int *) xmalloc(sizeof (int) * numtargets);
+    int i;
+
+    for (i = 0; i < numtargets; i++)
+    {
+        argvs[i] = (const char **) xmalloc(sizeof (args));
+        memcpy(argvs[i], args, sizeof (args));
+        targets[i].outfd = make_memfd("fatelf-cc-probe");
+        argvs[i][5] = fd_path(targets[i].outfd);
+        argcs[i] = 6;
+    } // for
+
+    if ((i = run_all(targets, numtargets, argvs, argcs)) != -1)
+        xfail("Can't compile anything for target '%s'", targets[i].spec);
+
+    for (i = 0; i < numtargets; i++)
+    {
+        xread_elf_header(targets[i].spec, targets[i].outfd, 0, &targets[i].probe);
+        close(targets[i].outfd);
+        free((void *) argvs[i][5]);
+        free(argvs[i]);
+    } // for
+
+    free(argcs);
+    free(argvs);
+} // probe_targets
+
+
+// Copy the record in FatELF file (fname) that suits (target) to a memfd.
+static int thin_input(const char *fname, const cc_target *target)
+{
+    const int fd = xopen(fname, O_RDONLY | O_CLOEXEC, 0);
+    FATELF_header *header = xread_fatelf_header(fname, fd);
+    const FATELF_record *probe = &target->probe;
+    const FATELF_record *found = NULL;
+    int memfd;
+    uint32_t i;
+
+    // Any record for the machine will do, but one built for the same ISA
+    //  level is better.
+    for (i = 0; i < header->num_records; i++)
+    {
+        const FATELF_record *rec = &header->records[i];
+        if ( (rec->machine != probe->machine) || (rec->word_size != probe->word_size) ||
+             (rec->byte_order != probe->byte_order) )
+            continue;
+        else if ((found == NULL) || ((target->isa >= 0) && (rec->isa_level == target->isa)))
+            found = rec;
+    } // for
+
+    if (found == NULL)
+    {
+        xfail("'%s' has no record for target '%s' (%s)", fname, target->spec,
+              fatelf_get_target_name(probe, FATELF_WANT_MACHINE | FATELF_WANT_WORDSIZE | FATELF_WANT_BYTEORDER));
+    } // if
+
+    memfd = make_memfd("fatelf-cc-input");
+    xcopyfile_range(fname, fd, "memfd", memfd, found->offset, found->size);
+    free(header);
+    xclose(fname, fd);
+    return memfd;
+} // thin_input
+
+
+// A make rule from a depfile. Words keep their escapes.
+typedef struct dep_rule
+{
+    char *targets;
+    char **prereqs;
+    int count;
+    int allocated;
+} dep_rule;
+
+typedef struct dep_rules
+{
+    dep_rule *rules;
+    int count;
+    int allocated;
+} dep_rules;
+
+
+static dep_rule *find_dep_rule(dep_rules *deps, const char *targets)
+{
+    dep_rule *rule;
+    int i;
+
+    for (i = 0; i < deps->count; i++)
+    {
+        if (strcmp(deps->rules[i].targets, targets) == 0)
+            return &deps->rules[i];
+    } // for
+
+    if (deps->count == deps->allocated)
+    {
+        deps->allocated = deps->allocated ? (deps->allocated * 2) : 16;
+        deps->rules = (dep_rule *) realloc(deps->rules, sizeof (dep_rule) * deps->allocated);
+        if (deps->rules == NULL)
+            xfail("Out of memory!");
+    } // if
+
+    rule = &deps->rules[deps->count++];
+    memset(rule, '\0', sizeof (*rule));
+    rule->targets = xstrdup(targets);
+    return rule;
+} // find_dep_rule
+
+
+static void add_prereq(dep_rule *rule, const char *prereq)
+{
+    int i;
+    for (i = 0; i < rule->count; i++)
+    {
+        if (strcmp(rule->prereqs[i], prereq) == 0)
+            return;  // all the targets saw the same headers, usually.
+    } // for
+
+    if (rule->count == rule->allocated)
+    {
+        rule->allocated = rule->allocated ? (rule->allocated * 2) : 64;
+        rule->prereqs = (char **) realloc(rule->prereqs, sizeof (char *) * rule->allocated);
+        if (rule->prereqs == NULL)
+            xfail("Out of memory!");
+    } // if
+    rule->prereqs[rule->count++] = xstrdup(prereq);
+} // add_prereq
+
+
+// Add a depfile's rules to (deps). Backslash-newlines join lines, and a
+//  backslash keeps the next character in the word, as make reads them.
+static void merge_depfile(dep_rules *deps, const char *text, const size_t len)
+{
+    char *word = (char *) xmalloc(len + 1);
+    char *targets = (char *) xmalloc(len + 2);
+    dep_rule *rule = NULL;
+    size_t wordlen = 0;
+    size_t i = 0;
+
+    *targets = '\0';
+    while (i <= len)
+    {
+        const char ch = (i < len) ? text[i] : '\n';
+        int end_word = 0, end_line = 0;
+
+        if ((ch == '\\') && (i + 1 < len) && (text[i+1] == '\n'))
+        {
+            end_word = 1;  // a continued line.
+            i += 2;
+        } // if
+        else if ((ch == '\\') && (i + 1 < len))
+        {
+            word[wordlen++] = text[i++];
+            word[wordlen++] = text[i++];
+        } // else if
+        else if ((ch == ' ') || (ch == '\t') || (ch == '\r'))
+        {
+            end_word = 1;
+            i++;
+        } // else if
+        else if (ch == '\n')
+        {
+            end_word = end_line = 1;
+            i++;
+        } // else if
+        else
+        {
+            word[wordlen++] = text[i++];
+        } // else
+
+        if ((end_word) && (wordlen > 0))
+        {
+            word[wordlen] = '\0';
+            if (rule != NULL)
+                add_prereq(rule, word);
+            else
+            {
+                // Targets run up to a word ending in an unescaped colon.
+                const int colon = ((word[wordlen-1] == ':') && ((wordlen < 2) || (word[wordlen-2] != '\\')));
+                if (colon)
+                    word[--wordlen] = '\0';
+                if (wordlen > 0)
+                {
+                    if (*targets)
+                        strcat(targets, " ");
+                    strcat(targets, word);
+                } // if
+                if (colon)
+                    rule = find_dep_rule(deps, targets);
+            } // else
+            wordlen = 0;
+        } // if
+
+        if (end_line)
+        {
+            rule = NULL;
+            *targets = '\0';
+        } // if
+    } // while
+
+    free(targets);
+    free(word);
+} // merge_depfile
+
+
+static void write_depfile(const char *fname, const dep_rules *deps)
+{
+    FILE *io = fopen(fname, "w");
+    int i, j;
+
+    if (io == NULL)
+        xfail("Can't write '%s': %s", fname, strerror(errno));
+
+    for (i = 0; i < deps->count; i++)
+    {
+        const dep_rule *rule = &deps->rules[i];
+        fprintf(io, "%s%s:", (i > 0) ? "\n" : "", rule->targets);
+        for (j = 0; j < rule->count; j++)
+            fprintf(io, " %s%s", rule->prereqs[j], (j < rule->count - 1) ? " \\\n" : "");
+        fprintf(io, "\n");
+    } // for
+
+    if (fclose(io) == EOF)
+        xfail("Can't write '%s': %s", fname, strerror(errno));
+} // write_depfile
+
+
+static void free_depfile(dep_rules *deps)
+{
+    int i, j;
+    for (i = 0; i < deps->count; i++)
+    {
+        for (j = 0; j < deps->rules[i].count; j++)
+            free(deps->rules[i].prereqs[j]);
+        free(deps->rules[i].prereqs);
+        free(deps->rules[i].targets);
+    } // for
+    free(deps->rules);
+} // free_depfile
+
+
+// Put every target's output in one FatELF file, the way fatelf-glue does,
+//  straight from the memfds the compilers wrote.
+static void glue_outputs(const char *out, cc_target *targets,
+                         const int numtargets, const int compile_only)
+{
+    const int outfd = xopen(out, O_RDWR | O_CREAT | O_TRUNC, compile_only ? 0644 : 0755);
+    fatelf_writer *writer = NULL;
+    int i;
+
+    unlink_on_xfail = out;
+
+    writer = xfatelf_begin_writer(out, outfd, (uint32_t) numtargets);
+    for (i = 0; i < numtargets; i++)
+    {
+        const uint64_t size = xget_file_size(targets[i].spec, targets[i].outfd);
+        xfatelf_write_record_fd(writer, targets[i].spec, targets[i].outfd, 0, size, targets[i].isa);
+    } // for
+    xfatelf_finish_writer(writer);
+
+    xclose(out, outfd);
+    unlink_on_xfail = NULL;
+} // glue_outputs
+
+
+static int fatelf_cc(cc_target *targets, const int numtargets,
+                     const cc_command *cmd)
+{
+    const char ***argvs = (const char ***) xmalloc(sizeof (char **) * numtargets);
+    int *argcs = (int *) xmalloc(sizeof (int) * numtargets);
+    int failed, i, j;
+
+    if (cmd->single)  // nothing to glue; the first target speaks for all.
+    {
+        targets[0].errfd = 2;
+        spawn_compiler(&targets[0], cmd->args, cmd->numargs);
+        while (waitpid(targets[0].pid, &targets[0].status, 0) == -1)
+        {
+            if (errno != EINTR)
+                xfail("waitpid failed: %s", strerror(errno));
+        } // while
+        return WIFEXITED(targets[0].status) ? WEXITSTATUS(targets[0].status) : 1;
+    } // if
+
+    if (cmd->any_fat)
+        probe_targets(targets, numtargets);
+
+    for (i = 0; i < numtargets; i++)
+    {
+        cc_target *target = &targets[i];
+        const char **argv = (const char **) xmalloc(sizeof (char *) * (cmd->numargs + 5));
+        int argc = 0;
+
+        target->outfd = make_memfd("fatelf-cc-output");
+        target->outpath = fd_path(target->outfd);
+        if (cmd->depfile != NULL)
+        {
+            target->depfd = make_memfd("fatelf-cc-depfile");
+            target->deppath = fd_path(target->depfd);
+        } // if
+        target->thinfds = (int *) xmalloc(sizeof (int) * (cmd->numargs + 1));
+        target->thinpaths = (char **) xmalloc(sizeof (char *) * (cmd->numargs + 1));
+
+        for (j = 0; j < cmd->numargs; j++)
+        {
+            target->thinfds[j] = -1;
+            if (j == cmd->output_arg)
+                argv[argc++] = target->outpath;
+            else if (j == cmd->depfile_arg)
+                argv[argc++] = target->deppath;
+            else if (cmd->is_fat[j])
+            {
+                target->thinfds[j] = thin_input(cmd->args[j], target);
+                argv[argc++] = target->thinpaths[j] = fd_path(target->thinfds[j]);
+            } // else if
+            else
+                argv[argc++] = cmd->args[j];
+        } // for
+
+        // The depfile has to name the real output, not the memfd.
+        if ((cmd->depfile != NULL) && (cmd->depfile_arg == -1))
+        {
+            argv[argc++] = "-MF";
+            argv[argc++] = target->deppath;
+        } // if
+        if ((cmd->depfile != NULL) && (!cmd->has_dep_target))
+        {
+            argv[argc++] = "-MQ";
+            argv[argc++] = cmd->output;
+        } // if
+
+        argvs[i] = argv;
+        argcs[i] = argc;
+    } // for
+
+    if ((failed = run_all(targets, numtargets, argvs, argcs)) == -1)
+    {
+        glue_outputs(cmd->output, targets, numtargets, cmd->compile_only);
+
+        if (cmd->depfile != NULL)
+        {
+            dep_rules deps;
+            memset(&deps, '\0', sizeof (deps));
+            for (i = 0; i < numtargets; i++)
+            {
+                const uint64_t len = xget_file_size(cmd->depfile, targets[i].depfd);
+                char *text = (char *) xmalloc(len + 1);
+                xpread(cmd->depfile, targets[i].depfd, text, (size_t) len, 0);
+                merge_depfile(&deps, text, (size_t) len);
+                free(text);
+            } // for
+            write_depfile(cmd->depfile, &deps);
+            free_depfile(&deps);
+        } // if
+    } // if
+
+    for (i = 0; i < numtargets; i++)
+    {
+        for (j = 0; j < cmd->numargs; j++)
+        {
+            if (targets[i].thinfds[j] != -1)
+            {
+                close(targets[i].thinfds[j]);
+                free(targets[i].thinpaths[j]);
+            } // if
+        } // for
+        free(targets[i].thinpaths);
+        free(targets[i].thinfds);
+        free(targets[i].outpath);
+        free(targets[i].deppath);
+        free(argvs[i]);
+        close(targets[i].outfd);
+        if (targets[i].depfd != -1)
+            close(targets[i].depfd);
+    } // for
+    free(argcs);
+    free(argvs);
+
+    if (failed == -1)
+        return 0;
+    else if (WIFEXITED(targets[failed].status))
+        return WEXITSTATUS(targets[failed].status);
+    return 1;
+} // fatelf_cc
+
+
+int main(int argc, const char **argv)
+{
+    const char *usage = "USAGE: %s [--jobs=N] [--verbose] --target=SPEC [... --target=SPEC] <compiler> [compiler args...]";
+    cc_target *targets = (cc_target *) xmalloc(sizeof (cc_target) * argc);
+    const char **specs = (const char **) xmalloc(sizeof (char *) * argc);
+    int numtargets = 0;
+    cc_command cmd;
+    int retval, i;
+
+    // We don't call xfatelf_init(): its options could be the compiler's.
+    for (i = 1; (i < argc) && (strncmp(argv[i], "--", 2) == 0); i++)
+    {
+        if (strcmp(argv[i], "--version") == 0)
+        {
+            printf("%s\n", fatelf_build_version);
+            return 0;
+        } // if
+        else if (strncmp(argv[i], "--target=", 9) == 0)
+            specs[numtargets++] = argv[i] + 9;
+        else if (strncmp(argv[i], "--jobs=", 7) == 0)
+            options.jobs = atoi(argv[i] + 7);
+        else if (strcmp(argv[i], "--verbose") == 0)
+            options.verbose = 1;
+        else
+            xfail("Unknown option '%s'", argv[i]);
+    } // for
+
+    // this could stand to use getopt(), later.
+    if ((i >= argc) || (numtargets == 0))
+        xfail(usage, argv[0]);
+
+    parse_command(&cmd, argv + i, argc - i);
+    for (i = 0; i < numtargets; i++)
+        parse_target(&targets[i], specs[i], cmd.compiler);
+
+    retval = fatelf_cc(targets, numtargets, &cmd);
+
+    for (i = 0; i < numtargets; i++)
+    {
+        int j;
+        for (j = 0; j < targets[i].numflags; j++)
+            free(targets[i].flags[j]);
+        free(targets[i].flags);
+        free(targets[i].compiler);
+    } // for
+    if ((cmd.depfile != NULL) && (cmd.depfile_arg == -1))
+        free((void *) cmd.depfile);
+    free(cmd.is_fat);
+    free(specs);
+    free(targets);
+    return retval;
+} // main
+
+// end of fatelf-cc.c ...
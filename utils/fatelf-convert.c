@@ -0,0 +1,93 @@
+/**
+ * FatELF; support multiple ELF binaries in one file.
+ *
+ * Please see the file LICENSE.txt in the source's root directory.
+ *
+ *  This file written by Ryan C. Gordon.
+ */
+
+#define FATELF_UTILS 1
+#include "fatelf-utils.h"
+
+static int fatelf_convert(const char *out, const char *fname,
+                          const char *verstr)
+{
+    const int fd = xopen(fname, O_RDONLY, 0755);
+    FATELF_header *header = xread_fatelf_header(fname, fd);
+    uint64_t junkoffset = 0, junksize = 0;
+    const int hasjunk = xfind_junk(fname, fd, header, &junkoffset, &junksize);
+    char *endptr = NULL;
+    const long version = strtol(verstr, &endptr, 10);
+    uint64_t offset = 0;
+    int *owners = (int *) xmalloc(sizeof (int) * (header->num_records + 1));
+    const uint32_t aliases = fatelf_find_aliases(header, -1, owners);
+    int outfd = -1;
+    int i;
+
+    if ((*verstr == '\0') || (*endptr != '\0'))
+        xfail("'%s' isn't a FatELF version number.", verstr);
+    else if ((version != FATELF_FORMAT_VERSION_1) && (version != FATELF_FORMAT_VERSION_2))
+        xfail("Unsupported FatELF version %ld.", version);
+    else if (version < fatelf_minimum_format_version(header))
+    {
+        xfail("'%s' needs at least FatELF version %d.",
+              fname, (int) fatelf_minimum_format_version(header));
+    } // else if
+    else if ((version < FATELF_FORMAT_VERSION_2) && (aliases > 0))
+        xfail("'%s' has records that share data, which needs FatELF version 2.", fname);
+
+    header->version = (uint16_t) version;
+
+    outfd = xopen(out, O_WRONLY | O_CREAT | O_TRUNC, 0755);
+    unlink_on_xfail = out;
+
+    // The header size changes between versions, so everything moves.
+    offset = fatelf_disk_header_size(header->version, header->num_records);
+    xwrite_zeros(out, outfd, (size_t) offset);
+
+    for (i = 0; i < ((int) header->num_records); i++)
+    {
+        const uint64_t binary_offset = align_to_page(offset);
+        FATELF_record *rec = &header->records[i];
+
+        if (owners[i] != i)  // shares data we already wrote?
+        {
+            rec->offset = header->records[owners[i]].offset;
+            continue;
+        } // if
+
+        // append this binary to the final file, padded to page alignment.
+        xwrite_zeros(out, outfd, (size_t) (binary_offset - offset));
+        xcopyfile_range(fname, fd, out, outfd, rec->offset, rec->size);
+
+        rec->offset = binary_offset;
+        offset = binary_offset + rec->size;
+    } // for
+
+    if (hasjunk)
+        xcopy_junk(fname, fd, out, outfd, junkoffset, junksize);
+
+    // Write the actual FatELF header now...
+    xwrite_fatelf_header(out, outfd, header);
+
+    xclose(out, outfd);
+    xclose(fname, fd);
+    free(owners);
+    free(header);
+
+    unlink_on_xfail = NULL;
+
+    return 0;  // success.
+} // fatelf_convert
+
+
+int main(int argc, const char **argv)
+{
+    xfatelf_init(&argc, argv);
+    if (argc != 4)  // this could stand to use getopt(), later.
+        xfail("USAGE: %s <out> <in> <version>", argv[0]);
+    return fatelf_convert(argv[1], argv[2], argv[3]);
+} // main
+
+// end of fatelf-convert.c ...
+
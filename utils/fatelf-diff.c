@@ -0,0 +1,585 @@
+/**
+ * FatELF; support multiple ELF binaries in one file.
+ *
+ * Please see the file LICENSE.txt in the source's root directory.
+ *
+ *  This file written by Ryan C. Gordon.
+ */
+
+// This compares FatELF files record by record: records are paired up by
+//  target, not by position, and only their bytes are compared, so record
+//  order, padding and alignment don't count as differences. Every record
+//  (and the junk) of every file is hashed up front, spread across threads,
+//  with the CPU's SHA instructions where it has them.
+
+#define _GNU_SOURCE 1  // for nftw().
+#define FATELF_UTILS 1
+#include "fatelf-utils.h"
+
+#include <ftw.h>
+#include <errno.h>
+#include <unistd.h>
+#include <limits.h>
+
+#define DIFF_EXIT_DIFFERENT 2  // exit(1) is taken by xfail().
+
+typedef struct hash_job
+{
+    const char *fname;
+    uint64_t offset;
+    uint64_t size;      // for junk, shrinks if there's leading padding.
+    int is_junk;
+    uint8_t digest[FATELF_SHA256_SIZE];
+} hash_job;
+
+typedef struct diff_file
+{
+    const char *fname;
+    FATELF_header *header;  // NULL if it isn't FatELF.
+    int firstjob;           // one job per record, in header order, or one
+                            //  for the whole file if it isn't FatELF.
+    int junkjob;            // -1 if there's no junk.
+} diff_file;
+
+static hash_job *jobs = NULL;
+static int numjobs = 0;
+static int jobs_allocated = 0;
+
+
+static int add_job(const char *fname, const uint64_t offset,
+                   const uint64_t size, const int is_junk)
+{
+    hash_job *job;
+    if (numjobs == jobs_allocated)
+    {
+        jobs_allocated = jobs_allocated ? (jobs_allocated * 2) : 256;
+        jobs = (hash_job *) realloc(jobs, sizeof (hash_job) * jobs_allocated);
+        if (jobs == NULL)
+            xfail("Out of memory!");
+    } // if
+
+    job = &jobs[numjobs];
+    job->fname = fname;
+    job->offset = offset;
+    job->size = size;
+    job->is_junk = is_junk;
+    return numjobs++;
+} // add_job
+
+
+// Tools pad junk with zeros to keep resource tables aligned (and people pad
+//  it for other reasons), so leading zeros in the junk aren't content.
+static void skip_leading_zeros(const char *fname, const int fd,
+                               uint64_t *offset, uint64_t *size)
+{
+    uint8_t buf[64 * 1024];
+    while (*size > 0)
+    {
+        const size_t len = (size_t) ((*size < sizeof (buf)) ? *size : sizeof (buf));
+        size_t i;
+        xpread(fname, fd, buf, len, *offset);
+        for (i = 0; (i < len) && (buf[i] == 0); i++) { /* spin */ }
+        *offset += i;
+        *size -= i;
+        if (i < len)
+            break;
+    } // while
+} // skip_leading_zeros
+
+
+static void hash_worker(void *data, const int idx)
+{
+    hash_job *job = &((hash_job *) data)[idx];
+    const int fd = xopen(job->fname, O_RDONLY, 0755);
+    if (job->is_junk)
+        skip_leading_zeros(job->fname, fd, &job->offset, &job->size);
+    xsha256_range(job->fname, fd, job->offset, job->size, job->digest);
+    xclose(job->fname, fd);
+} // hash_worker
+
+
+static void queue_file(diff_file *file, const char *fname)
+{
+    const int fd = xopen(fname, O_RDONLY, 0755);
+    const uint64_t size = xget_file_size(fname, fd);
+    const char *err = NULL;
+    uint64_t junkoffset, junksize;
+    uint32_t i;
+
+    file->fname = fname;
+    file->header = fatelf_pread_header(fd, 0, size, &err);
+    file->firstjob = numjobs;
+    file->junkjob = -1;
+
+    if (file->header == NULL)
+    {
+        if (strcmp(err, "is not a FatELF binary") != 0)
+            xfail("'%s' %s", fname, err);
+        add_job(fname, 0, size, 0);
+    } // if
+    else
+    {
+        for (i = 0; i < file->header->num_records; i++)
+        {
+            const FATELF_record *rec = &file->header->records[i];
+            add_job(fname, rec->offset, rec->size, 0);
+        } // for
+        if (xfind_junk(fname, fd, file->header, &junkoffset, &junksize))
+            file->junkjob = add_job(fname, junkoffset, junksize, 1);
+    } // else
+
+    xclose(fname, fd);
+} // queue_file
+
+
+static const hash_job *get_junk(const diff_file *file)
+{
+    if ((file->junkjob == -1) || (jobs[file->junkjob].size == 0))
+        return NULL;  // no junk, or it was all padding.
+    return &jobs[file->junkjob];
+} // get_junk
+
+
+static uint8_t *put_le(uint8_t *ptr, uint64_t val, const int bytes)
+{
+    int i;
+    for (i = 0; i < bytes; i++, val >>= 8)
+        *(ptr++) = (uint8_t) (val & 0xFF);
+    return ptr;
+} // put_le
+
+
+// SHA-256 over the sorted list of (target, size, hash) for every record,
+//  then the junk's size and hash, so only content counts. Files that aren't
+//  FatELF get a plain SHA-256 of the file.
+static void canonical_digest(const diff_file *file, uint8_t *digest)
+{
+    static const char signature[] = "FatELF canonical digest 1";
+    const uint32_t count = file->header ? file->header->num_records : 0;
+    const hash_job *junk = get_junk(file);
+    FATELF_record *sorted = NULL;
+    uint8_t buf[16 + 8 + FATELF_SHA256_SIZE];
+    uint8_t *ptr;
+    fatelf_sha256 ctx;
+    uint32_t i;
+
+    if (file->header == NULL)
+    {
+        memcpy(digest, jobs[file->firstjob].digest, FATELF_SHA256_SIZE);
+        return;
+    } // if
+
+    // Sorting only looks at the target, so stash each job index in offset.
+    sorted = (FATELF_record *) xmalloc(sizeof (FATELF_record) * (count + 1));
+    memcpy(sorted, file->header->records, sizeof (FATELF_record) * count);
+    for (i = 0; i < count; i++)
+        sorted[i].offset = (uint64_t) (file->firstjob + i);
+    fatelf_sort_records(sorted, count);
+
+    fatelf_sha256_init(&ctx);
+    fatelf_sha256_update(&ctx, signature, sizeof (signature));
+    ptr = put_le(buf, count, 4);
+    fatelf_sha256_update(&ctx, buf, (size_t) (ptr - buf));
+
+    for (i = 0; i < count; i++)
+    {
+        const FATELF_record *rec = &sorted[i];
+        const hash_job *job = &jobs[rec->offset];
+        ptr = put_le(buf, rec->machine, 2);
+        *(ptr++) = rec->osabi;
+        *(ptr++) = rec->osabi_version;
+        *(ptr++) = rec->word_size;
+        *(ptr++) = rec->byte_order;
+        *(ptr++) = rec->isa_level;
+        *(ptr++) = 0;
+        ptr = put_le(ptr, job->size, 8);
+        memcpy(ptr, job->digest, FATELF_SHA256_SIZE);
+        ptr += FATELF_SHA256_SIZE;
+        fatelf_sha256_update(&ctx, buf, (size_t) (ptr - buf));
+    } // for
+
+    ptr = put_le(buf, junk ? junk->size : 0, 8);
+    if (junk != NULL)
+    {
+        memcpy(ptr, junk->digest, FATELF_SHA256_SIZE);
+        ptr += FATELF_SHA256_SIZE;
+    } // if
+    fatelf_sha256_update(&ctx, buf, (size_t) (ptr - buf));
+    fatelf_sha256_final(&ctx, digest);
+
+    free(sorted);
+} // canonical_digest
+
+
+static int same_job(const hash_job *a, const hash_job *b)
+{
+    return ( (a->size == b->size) &&
+             (memcmp(a->digest, b->digest, FATELF_SHA256_SIZE) == 0) );
+} // same_job
+
+
+static void print_line(const char *label, const char *status,
+                       const char *what)
+{
+    if (label != NULL)
+        printf("%s: ", label);
+    printf("%-8s %s\n", status, what);
+} // print_line
+
+
+// Returns the number of differences, printing them if (print) is set, and
+//  what didn't change too if (all) is set.
+static int compare_files(const diff_file *a, const diff_file *b,
+                         const char *label, const int print, const int all)
+{
+    const hash_job *ajunk = get_junk(a);
+    const hash_job *bjunk = get_junk(b);
+    int *paired = NULL;
+    int diffs = 0;
+    uint32_t i, j;
+
+    if ((a->header == NULL) || (b->header == NULL))
+    {
+        const char *what = "file";
+        int same = 0;
+        if ((a->header == NULL) && (b->header == NULL))
+            same = same_job(&jobs[a->firstjob], &jobs[b->firstjob]);
+        else
+            what = (a->header == NULL) ? "file (now FatELF)" : "file (no longer FatELF)";
+        if ((print) && ((all) || (!same)))
+            print_line(label, same ? "same" : "changed", what);
+        return same ? 0 : 1;
+    } // if
+
+    paired = (int *) xmalloc(sizeof (int) * (b->header->num_records + 1));
+    memset(paired, '\0', sizeof (int) * (b->header->num_records + 1));
+
+    for (i = 0; i < a->header->num_records; i++)
+    {
+        const FATELF_record *rec = &a->header->records[i];
+        const char *status = "removed";
+        for (j = 0; j < b->header->num_records; j++)
+        {
+            if (fatelf_record_matches(rec, &b->header->records[j]))
+                break;
+        } // for
+
+        if (j < b->header->num_records)
+        {
+            paired[j] = 1;
+            status = "same";
+            if (!same_job(&jobs[a->firstjob + i], &jobs[b->firstjob + j]))
+                status = "changed";
+        } // if
+
+        if (strcmp(status, "same") != 0)
+            diffs++;
+        if ((print) && ((all) || (strcmp(status, "same") != 0)))
+            print_line(label, status, fatelf_get_target_name(rec, FATELF_WANT_EVERYTHING));
+    } // for
+
+    for (j = 0; j < b->header->num_records; j++)
+    {
+        if (!paired[j])
+        {
+            diffs++;
+            if (print)
+                print_line(label, "added", fatelf_get_target_name(&b->header->records[j], FATELF_WANT_EVERYTHING));
+        } // if
+    } // for
+
+    free(paired);
+
+    if ((ajunk != NULL) || (bjunk != NULL))
+    {
+        const char *status = "same";
+        if (ajunk == NULL)
+            status = "added";
+        else if (bjunk == NULL)
+            status = "removed";
+        else if (!same_job(ajunk, bjunk))
+            status = "changed";
+
+        if (strcmp(status, "same") != 0)
+            diffs++;
+        if ((print) && ((all) || (strcmp(status, "same") != 0)))
+            print_line(label, status, "junk");
+    } // if
+
+    return diffs;
+} // compare_files
+
+
+static int fatelf_diff_files(const char *fname1, const char *fname2,
+                             const int threads)
+{
+    diff_file files[2];
+    int diffs;
+
+    queue_file(&files[0], fname1);
+    queue_file(&files[1], fname2);
+    fatelf_parallel_for(numjobs, threads, hash_worker, jobs);
+
+    diffs = compare_files(&files[0], &files[1], NULL, 1, 1);
+
+    free(files[0].header);
+    free(files[1].header);
+    free(jobs);
+    return diffs ? DIFF_EXIT_DIFFERENT : 0;
+} // fatelf_diff_files
+
+
+static int fatelf_digest(const char **fnames, const int count,
+                         const int threads)
+{
+    diff_file *files = (diff_file *) xmalloc(sizeof (diff_file) * count);
+    uint8_t digest[FATELF_SHA256_SIZE];
+    int i, j;
+
+    for (i = 0; i < count; i++)
+        queue_file(&files[i], fnames[i]);
+    fatelf_parallel_for(numjobs, threads, hash_worker, jobs);
+
+    for (i = 0; i < count; i++)  // same layout as sha256sum.
+    {
+        canonical_digest(&files[i], digest);
+        for (j = 0; j < FATELF_SHA256_SIZE; j++)
+            printf("%02x", (unsigned int) digest[j]);
+        printf("  %s\n", files[i].fname);
+        free(files[i].header);
+    } // for
+
+    free(files);
+    free(jobs);
+    return 0;  // success.
+} // fatelf_digest
+
+
+typedef struct tree_entry
+{
+    char *path;         // relative to the root.
+    char *fullpath;
+    mode_t mode;
+    diff_file file;     // if it's a regular file in both trees.
+} tree_entry;
+
+typedef struct tree
+{
+    const char *root;
+    tree_entry *entries;
+    int count;
+    int allocated;
+} tree;
+
+static tree *walk = NULL;  // nftw() doesn't pass a context pointer.
+
+
+static int walk_callback(const char *fname, const struct stat *statbuf,
+                         int typeflag, struct FTW *ftwbuf)
+{
+    const char *rel = fname + strlen(walk->root);
+    tree_entry *entry;
+
+    (void) ftwbuf;
+
+    if ((typeflag == FTW_DNR) || (typeflag == FTW_NS))
+        xfail("Can't read '%s'", fname);
+    else if (S_ISDIR(statbuf->st_mode))
+        return 0;  // only what's in them counts.
+
+    if (walk->count == walk->allocated)
+    {
+        walk->allocated = walk->allocated ? (walk->allocated * 2) : 1024;
+        walk->entries = (tree_entry *) realloc(walk->entries, sizeof (tree_entry) * walk->allocated);
+        if (walk->entries == NULL)
+            xfail("Out of memory!");
+    } // if
+
+    while (*rel == '/')
+        rel++;
+
+    entry = &walk->entries[walk->count++];
+    entry->path = xstrdup(rel);
+    entry->fullpath = xstrdup(fname);
+    entry->mode = statbuf->st_mode;
+    return 0;
+} // walk_callback
+
+
+static int compare_entries(const void *a, const void *b)
+{
+    return strcmp(((const tree_entry *) a)->path, ((const tree_entry *) b)->path);
+} // compare_entries
+
+
+static void scan_tree(tree *t, const char *root)
+{
+    struct stat statbuf;
+    memset(t, '\0', sizeof (*t));
+    t->root = root;
+    if (stat(root, &statbuf) == -1)
+        xfail("Can't read '%s': %s", root, strerror(errno));
+    else if (!S_ISDIR(statbuf.st_mode))
+        xfail("'%s' isn't a directory", root);
+
+    walk = t;
+    // FTW_PHYS: symlinks are compared as symlinks, not followed.
+    if (nftw(root, walk_callback, 64, FTW_PHYS) == -1)
+        xfail("Failed to scan '%s': %s", root, strerror(errno));
+    walk = NULL;
+
+    qsort(t->entries, t->count, sizeof (tree_entry), compare_entries);
+} // scan_tree
+
+
+static int same_symlink(const tree_entry *a, const tree_entry *b)
+{
+    char abuf[PATH_MAX + 1];
+    char bbuf[PATH_MAX + 1];
+    const ssize_t alen = readlink(a->fullpath, abuf, sizeof (abuf) - 1);
+    const ssize_t blen = readlink(b->fullpath, bbuf, sizeof (bbuf) - 1);
+    if (alen == -1)
+        xfail("Failed to read link '%s': %s", a->fullpath, strerror(errno));
+    else if (blen == -1)
+        xfail("Failed to read link '%s': %s", b->fullpath, strerror(errno));
+    return ((alen == blen) && (memcmp(abuf, bbuf, (size_t) alen) == 0));
+} // same_symlink
+
+
+static int fatelf_diff_trees(const char *root1, const char *root2,
+                             const int threads)
+{
+    int same = 0, changed = 0, added = 0, removed = 0;
+    tree trees[2];
+    int i, j;
+
+    scan_tree(&trees[0], root1);
+    scan_tree(&trees[1], root2);
+
+    // Queue up hashing for every regular file that's in both trees.
+    for (i = 0, j = 0; (i < trees[0].count) && (j < trees[1].count); )
+    {
+        tree_entry *a = &trees[0].entries[i];
+        tree_entry *b = &trees[1].entries[j];
+        const int cmp = strcmp(a->path, b->path);
+        if (cmp < 0)
+            i++;
+        else if (cmp > 0)
+            j++;
+        else
+        {
+            if ((S_ISREG(a->mode)) && (S_ISREG(b->mode)))
+            {
+                queue_file(&a->file, a->fullpath);
+                queue_file(&b->file, b->fullpath);
+            } // if
+            i++;
+            j++;
+        } // else
+    } // for
+
+    fatelf_parallel_for(numjobs, threads, hash_worker, jobs);
+
+    for (i = 0, j = 0; (i < trees[0].count) || (j < trees[1].count); )
+    {
+        tree_entry *a = (i < trees[0].count) ? &trees[0].entries[i] : NULL;
+        tree_entry *b = (j < trees[1].count) ? &trees[1].entries[j] : NULL;
+        const int cmp = (a == NULL) ? 1 : (b == NULL) ? -1 : strcmp(a->path, b->path);
+
+        if (cmp < 0)
+        {
+            print_line(a->path, "removed", "file");
+            removed++;
+            i++;
+        } // if
+        else if (cmp > 0)
+        {
+            print_line(b->path, "added", "file");
+            added++;
+            j++;
+        } // else if
+        else
+        {
+            int diffs = 0;
+            if ((a->mode & S_IFMT) != (b->mode & S_IFMT))
+            {
+                print_line(a->path, "changed", "file type");
+                diffs = 1;
+            } // if
+            else if (S_ISLNK(a->mode))
+            {
+                if ((diffs = !same_symlink(a, b)) != 0)
+                    print_line(a->path, "changed", "symlink");
+            } // else if
+            else if (S_ISREG(a->mode))
+            {
+                diffs = compare_files(&a->file, &b->file, a->path, 1, 0);
+                free(a->file.header);
+                free(b->file.header);
+            } // else if
+
+            if (diffs)
+                changed++;
+            else
+                same++;
+            i++;
+            j++;
+        } // else
+    } // for
+
+    printf("%d same, %d changed, %d added, %d removed.\n",
+           same, changed, added, removed);
+
+    for (i = 0; i < 2; i++)
+    {
+        for (j = 0; j < trees[i].count; j++)
+        {
+            free(trees[i].entries[j].path);
+            free(trees[i].entries[j].fullpath);
+        } // for
+        free(trees[i].entries);
+    } // for
+    free(jobs);
+
+    return (changed || added || removed) ? DIFF_EXIT_DIFFERENT : 0;
+} // fatelf_diff_trees
+
+
+int main(int argc, const char **argv)
+{
+    const char *usage = "USAGE: %s [--jobs=N] <in1> <in2>\n"
+                        "       %s [--jobs=N] --tree <dir1> <dir2>\n"
+                        "       %s [--jobs=N] --digest <in> [... <in>]";
+    int threads = 0;
+    int trees = 0;
+    int digest = 0;
+    int i = 1;
+
+    xfatelf_init(&argc, argv);
+
+    while ((i < argc) && (strncmp(argv[i], "--", 2) == 0))
+    {
+        if (strncmp(argv[i], "--jobs=", 7) == 0)
+            threads = atoi(argv[i] + 7);
+        else if (strcmp(argv[i], "--tree") == 0)
+            trees = 1;
+        else if (strcmp(argv[i], "--digest") == 0)
+            digest = 1;
+        else
+            xfail("Unknown option '%s'", argv[i]);
+        i++;
+    } // while
+
+    if ((digest) && (!trees) && (argc > i))
+        return fatelf_digest(argv + i, argc - i, threads);
+    else if ((trees) && (!digest) && (argc == i + 2))
+        return fatelf_diff_trees(argv[i], argv[i + 1], threads);
+    else if ((!trees) && (!digest) && (argc == i + 2))
+        return fatelf_diff_files(argv[i], argv[i + 1], threads);
+
+    // this could stand to use getopt(), later.
+    xfail(usage, argv[0], argv[0], argv[0]);
+    return 1;
+} // main
+
+// end of fatelf-diff.c ...
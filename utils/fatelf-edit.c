@@ -0,0 +1,415 @@
+/**
+ * FatELF; support multiple ELF binaries in one file.
+ *
+ * Please see the file LICENSE.txt in the source's root directory.
+ *
+ *  This file written by Ryan C. Gordon.
+ */
+
+// This does any number of adds, removes and replaces to a FatELF file, but
+//  only writes the file once. The operations are applied, in order, to the
+//  list of records first, and then the final file is built from that list:
+//  records we kept come straight from the input (shared with it, if the
+//  filesystem can do that), and new ones come from their ELF files. The
+//  output is written to a temp file and renamed over (out) at the end, so
+//  (out) can be the same as (in), and nobody ever sees half a file.
+
+#define FATELF_UTILS 1
+#include "fatelf-utils.h"
+
+#include <errno.h>
+#include <unistd.h>
+
+typedef enum edit_op_type
+{
+    EDIT_ADD,
+    EDIT_REMOVE,
+    EDIT_REPLACE
+} edit_op_type;
+
+typedef struct edit_op
+{
+    edit_op_type type;
+    const char *arg;  // ELF file for add/replace, target for remove.
+    int isa;          // ISA level for add/replace, -1 to read the notes.
+} edit_op;
+
+// Where a record's bytes come from.
+typedef struct edit_source
+{
+    const char *fname;  // NULL for the input FatELF file.
+    uint64_t offset;
+} edit_source;
+
+
+static void add_op(edit_op **ops, int *opcount, const edit_op_type type,
+                   const char *arg, const int isa)
+{
+    edit_op *ptr = (edit_op *) realloc(*ops, sizeof (edit_op) * (*opcount + 1));
+    if (ptr == NULL)
+        xfail("Out of memory!");
+    ptr[*opcount].type = type;
+    ptr[*opcount].arg = arg;
+    ptr[*opcount].isa = isa;
+    *ops = ptr;
+    (*opcount)++;
+} // add_op
+
+
+// parse one "--add=ELF", "--remove=TARGET" or "--replace=ELF", plus
+//  "--isa=LEVEL", which applies to the next add or replace. Returns zero if
+//  (str) isn't any of those.
+static int parse_op(const char *str, edit_op **ops, int *opcount, int *isa)
+{
+    if (strncmp(str, "--isa=", 6) == 0)
+    {
+        if ((*isa = fatelf_parse_isa_level(str + 6)) == -1)
+            xfail("Unknown ISA level '%s'", str + 6);
+        return 1;
+    } // if
+    else if (strncmp(str, "--add=", 6) == 0)
+        add_op(ops, opcount, EDIT_ADD, str + 6, *isa);
+    else if (strncmp(str, "--replace=", 10) == 0)
+        add_op(ops, opcount, EDIT_REPLACE, str + 10, *isa);
+    else if (strncmp(str, "--remove=", 9) == 0)
+    {
+        if (*isa != -1)
+            xfail("--isa needs to come before an add or replace.");
+        add_op(ops, opcount, EDIT_REMOVE, str + 9, -1);
+    } // else if
+    else
+        return 0;
+
+    *isa = -1;
+    return 1;
+} // parse_op
+
+
+// An ops file has one operation per line, spelled just like the command
+//  line ("--add=foo.elf", etc), or as "add foo.elf", "remove i386", etc.
+//  Blank lines and lines starting with '#' are ignored. The strings we
+//  hand out live until exit.
+static void read_ops_file(const char *fname, edit_op **ops, int *opcount,
+                          int *isa)
+{
+    FILE *io = fopen(fname, "r");
+    char *line = NULL;
+    size_t linelen = 0;
+    int lineno = 0;
+
+    if (io == NULL)
+        xfail("Failed to open '%s': %s", fname, strerror(errno));
+
+    while (getline(&line, &linelen, io) != -1)
+    {
+        char *str = line;
+        char *end = line + strlen(line);
+        char *opstr;
+
+        lineno++;
+        while ((end > str) && ((end[-1] == '\n') || (end[-1] == '\r') || (end[-1] == ' ') || (end[-1] == '\t')))
+            *(--end) = '\0';
+        while ((*str == ' ') || (*str == '\t'))
+            str++;
+
+        if ((*str == '\0') || (*str == '#'))
+            continue;
+
+        opstr = (char *) xmalloc(strlen(str) + 3);
+        if (strncmp(str, "--", 2) == 0)
+            strcpy(opstr, str);
+        else
+        {
+            char *space = str + strcspn(str, " \t");
+            char *arg = space + strspn(space, " \t");
+            if (*space == '\0')
+                xfail("%s:%d: expected an operation and an argument", fname, lineno);
+            *space = '\0';
+            sprintf(opstr, "--%s=%s", str, arg);
+        } // else
+
+        if (!parse_op(opstr, ops, opcount, isa))
+            xfail("%s:%d: unknown operation '%s'", fname, lineno, str);
+    } // while
+
+    free(line);
+    fclose(io);
+} // read_ops_file
+
+
+static void xread_new_record(const char *fname, const int isa,
+                             FATELF_record *rec)
+{
+    const int fd = xopen(fname, O_RDONLY, 0755);
+    xread_elf_header(fname, fd, 0, rec);
+    rec->isa_level = (isa >= 0) ? (uint8_t) isa : xread_elf_isa_level(fname, fd, 0);
+    rec->offset = 0;
+    rec->size = xget_file_size(fname, fd);
+    xclose(fname, fd);
+} // xread_new_record
+
+
+// Record (idx) is about to be removed or replaced. If it came from the
+//  input and shared its data, what's left of the sharing has to hold up
+//  without it, just like fatelf-remove and fatelf-replace check.
+static void check_lone_aliases(const char *fname, const int fd,
+                               const FATELF_header *header,
+                               const edit_source *sources, const int idx)
+{
+    int *owners;
+
+    if (sources[idx].fname != NULL)
+        return;  // we added it, so it doesn't share anything.
+
+    owners = (int *) xmalloc(sizeof (int) * (header->num_records + 1));
+    fatelf_find_aliases(header, idx, owners);
+    xcheck_lone_aliases(fname, fd, header, idx, owners);
+    free(owners);
+} // check_lone_aliases
+
+
+// Apply (ops) to the record list, without touching any file data.
+static void apply_ops(const char *fname, const int fd, FATELF_header *header,
+                      edit_source *sources, const edit_op *ops,
+                      const int opcount)
+{
+    int i;
+    for (i = 0; i < opcount; i++)
+    {
+        const edit_op *op = &ops[i];
+        FATELF_record rec;
+        int idx;
+
+        if (op->type == EDIT_REMOVE)
+        {
+            const uint32_t count = header->num_records - 1;
+            if ((idx = xfind_fatelf_record(header, op->arg)) < 0)
+                xfail("No record matches '%s' in FatELF file '%s'", op->arg, fname);
+            check_lone_aliases(fname, fd, header, sources, idx);
+            memmove(&header->records[idx], &header->records[idx+1], sizeof (FATELF_record) * (count - idx));
+            memmove(&sources[idx], &sources[idx+1], sizeof (edit_source) * (count - idx));
+            header->num_records = count;
+            continue;
+        } // if
+
+        xread_new_record(op->arg, op->isa, &rec);
+        idx = fatelf_find_matching_record(header, &rec);
+        if (op->type == EDIT_REPLACE)
+        {
+            if (idx < 0)
+                xfail("No record matches '%s' in FatELF file '%s'", op->arg, fname);
+            check_lone_aliases(fname, fd, header, sources, idx);
+        } // if
+        else  // EDIT_ADD
+        {
+            if (idx >= 0)
+            {
+                xfail("'%s' is for the same target as %s.", op->arg,
+                      sources[idx].fname ? sources[idx].fname :
+                      fatelf_get_target_name(&header->records[idx], FATELF_WANT_EVERYTHING));
+            } // if
+            idx = (int) header->num_records++;
+        } // else
+
+        header->records[idx] = rec;
+        sources[idx].fname = op->arg;
+        sources[idx].offset = 0;
+    } // for
+
+    if (header->num_records == 0)
+        xfail("That would leave no records in '%s'.", fname);
+} // apply_ops
+
+
+// Put the record at (binary_offset), sharing blocks with the input where
+//  we can, and copying whatever we can't.
+static void write_record(const char *fname, const int fd,
+                         const char *out, const int outfd,
+                         const uint64_t srcoffset, const uint64_t binary_offset,
+                         const uint64_t size)
+{
+    const uint64_t cloned = fatelf_clone_range(fd, srcoffset, outfd, binary_offset, size);
+    if (cloned > 0)
+        xlseek(out, outfd, (off_t) (binary_offset + cloned), SEEK_SET);
+    xcopyfile_range(fname, fd, out, outfd, srcoffset + cloned, size - cloned);
+} // write_record
+
+
+static char *make_temp_path(const char *out)
+{
+    char *retval = (char *) xmalloc(strlen(out) + 16);
+    sprintf(retval, "%s.edit-XXXXXX", out);
+    return retval;
+} // make_temp_path
+
+
+// fsync the directory holding (fname), so a rename into it is durable.
+static void sync_parent_dir(const char *fname)
+{
+    char *dir = xstrdup(fname);
+    char *slash = strrchr(dir, '/');
+    int fd;
+
+    if (slash == NULL)
+        strcpy(dir, ".");
+    else if (slash == dir)
+        slash[1] = '\0';
+    else
+        *slash = '\0';
+
+    if ((fd = open(dir, O_RDONLY | O_DIRECTORY)) != -1)
+    {
+        xfsync(dir, fd);
+        xclose(dir, fd);
+    } // if
+    free(dir);
+} // sync_parent_dir
+
+
+static int fatelf_edit(const char *out, const char *fname,
+                       const edit_op *ops, const int opcount)
+{
+    const int fd = xopen(fname, O_RDONLY, 0755);
+    FATELF_header *orig = xread_fatelf_header(fname, fd);
+    const uint32_t maxrecs = orig->num_records + (uint32_t) opcount;
+    FATELF_header *header = (FATELF_header *) xmalloc(fatelf_header_size(maxrecs));
+    edit_source *sources = (edit_source *) xmalloc(sizeof (edit_source) * maxrecs);
+    char *tmppath = make_temp_path(out);
+    uint64_t junkoffset = 0, junksize = 0;
+    const int hasjunk = xfind_junk(fname, fd, orig, &junkoffset, &junksize);
+    uint16_t version;
+    int *owners = NULL;
+    struct stat statbuf;
+    uint64_t offset;
+    uint32_t i;
+    int outfd;
+
+    memcpy(header, orig, fatelf_header_size(orig->num_records));
+    for (i = 0; i < orig->num_records; i++)
+    {
+        sources[i].fname = NULL;
+        sources[i].offset = orig->records[i].offset;
+    } // for
+
+    // The list isn't sorted while we edit it, so searches have to use the
+    //  version 1 rules (look at everything). We pick the real version below.
+    header->version = FATELF_FORMAT_VERSION_1;
+    apply_ops(fname, fd, header, sources, ops, opcount);
+
+    // never downgrade the file, but upgrade it if the new records need that.
+    version = fatelf_minimum_format_version(header);
+    header->version = (version > orig->version) ? version : orig->version;
+
+    // Records we kept that shared data still do. New ones all sit at
+    //  offset zero for now, so they don't share anything.
+    owners = (int *) xmalloc(sizeof (int) * (header->num_records + 1));
+    fatelf_find_aliases(header, -1, owners);
+    for (i = 0; i < header->num_records; i++)
+    {
+        if (sources[i].fname != NULL)
+            owners[i] = (int) i;
+    } // for
+
+    if (fstat(fd, &statbuf) == -1)
+        xfail("Failed to fstat '%s': %s", fname, strerror(errno));
+
+    if ((outfd = mkstemp(tmppath)) == -1)
+        xfail("Failed to create '%s': %s", tmppath, strerror(errno));
+    unlink_on_xfail = tmppath;
+
+    // pad out some bytes for the header we'll write at the end...
+    offset = fatelf_disk_header_size(header->version, header->num_records);
+    xwrite_zeros(tmppath, outfd, (size_t) offset);
+
+    for (i = 0; i < header->num_records; i++)
+    {
+        const uint64_t binary_offset = align_to_page(offset);
+        FATELF_record *rec = &header->records[i];
+        const edit_source *src = &sources[i];
+
+        if (owners[i] != (int) i)  // shares data we already wrote?
+        {
+            rec->offset = header->records[owners[i]].offset;
+            continue;
+        } // if
+
+        // append this binary to the final file, padded to page alignment.
+        xwrite_zeros(tmppath, outfd, (size_t) (binary_offset - offset));
+
+        if (src->fname == NULL)
+            write_record(fname, fd, tmppath, outfd, src->offset, binary_offset, rec->size);
+        else
+        {
+            const int elffd = xopen(src->fname, O_RDONLY, 0755);
+            if (xget_file_size(src->fname, elffd) != rec->size)
+                xfail("'%s' changed while we were working.", src->fname);
+            write_record(src->fname, elffd, tmppath, outfd, 0, binary_offset, rec->size);
+            xclose(src->fname, elffd);
+        } // else
+
+        rec->offset = binary_offset;
+        offset = binary_offset + rec->size;
+    } // for
+
+    if (hasjunk)
+        xcopy_junk(fname, fd, tmppath, outfd, junkoffset, junksize);
+
+    // Write the actual FatELF header now...
+    xwrite_fatelf_header(tmppath, outfd, header);
+
+    // ...and swap it into place.
+    if (fchmod(outfd, statbuf.st_mode & 07777) == -1)
+        xfail("Failed to chmod '%s': %s", tmppath, strerror(errno));
+    xfsync(tmppath, outfd);
+    xclose(tmppath, outfd);
+    if (rename(tmppath, out) == -1)
+        xfail("Failed to rename '%s' to '%s': %s", tmppath, out, strerror(errno));
+    unlink_on_xfail = NULL;
+    sync_parent_dir(out);
+
+    xclose(fname, fd);
+    free(tmppath);
+    free(owners);
+    free(sources);
+    free(header);
+    free(orig);
+
+    return 0;  // success.
+} // fatelf_edit
+
+
+int main(int argc, const char **argv)
+{
+    edit_op *ops = NULL;
+    int opcount = 0;
+    int isa = -1;
+    int retval = 0;
+    int i;
+
+    xfatelf_init(&argc, argv);
+    if (argc < 4)  // this could stand to use getopt(), later.
+    {
+        xfail("USAGE: %s <out> <in> [--isa=LEVEL] <--add=ELF | --remove=TARGET | --replace=ELF | --ops=FILE> [...]",
+              argv[0]);
+    } // if
+
+    for (i = 3; i < argc; i++)
+    {
+        if (strncmp(argv[i], "--ops=", 6) == 0)
+            read_ops_file(argv[i] + 6, &ops, &opcount, &isa);
+        else if (!parse_op(argv[i], &ops, &opcount, &isa))
+            xfail("Unknown operation '%s'", argv[i]);
+    } // for
+
+    if (isa != -1)
+        xfail("--isa needs to come before an add or replace.");
+    else if (opcount == 0)
+        xfail("Nothing to do.");
+
+    retval = fatelf_edit(argv[1], argv[2], ops, opcount);
+    free(ops);
+    return retval;
+} // main
+
+// end of fatelf-edit.c ...
+
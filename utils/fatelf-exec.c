@@ -0,0 +1,596 @@
+/**
+ * FatELF; support multiple ELF binaries in one file.
+ *
+ * Please see the file LICENSE.txt in the source's root directory.
+ *
+ *  This file written by Ryan C. Gordon.
+ */
+
+// This runs a FatELF program on a kernel that doesn't know about FatELF,
+//  without extracting anything. It does in userspace what the kernel patch
+//  in patches/linux-kernel.diff does: pick the record for this machine, map
+//  its PT_LOAD segments straight out of the fat file at the record's offset,
+//  load its interpreter (which may be FatELF too), build a fresh stack with
+//  argv, envp and an auxv that describes the program instead of us, and
+//  jump to the interpreter's entry point (or the program's, if it's static).
+//
+// It can be a binfmt_misc interpreter: register it with the "O" and "P"
+//  flags, and it finds the program through AT_EXECFD and gets the original
+//  argv[0]. If a record can't be mapped in place (it isn't page aligned, or
+//  a fixed address is taken by this process) or we don't know how to start
+//  a program on this CPU, the record is copied to a memfd and run with
+//  fexecve() instead, which always works.
+//
+// If the FatELF file has Merkle trees, only what we actually read is
+//  verified: the ELF and program headers, PT_INTERP, and the pages of each
+//  PT_LOAD segment we map. Debug info and other sections that are never
+//  mapped aren't read at all, so they aren't hashed either. A verified
+//  record's segments are read into anonymous memory and checked there,
+//  not mapped from the file: a file mapping would see the file change
+//  after we hashed it, so what ran might not be what we checked.
+
+#define _GNU_SOURCE 1
+#define FATELF_UTILS 1
+#include "fatelf-utils.h"
+
+#include <link.h>
+#include <errno.h>
+#include <alloca.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE 0x100000
+#endif
+
+#if defined(__x86_64__) || defined(__i386__) || defined(__aarch64__)
+#define FATELF_EXEC_IN_PLACE 1
+#else
+#define FATELF_EXEC_IN_PLACE 0  // start_program() needs a port.
+#endif
+
+#if defined(__LP64__)
+#define FATELF_EXEC_ELFCLASS ELFCLASS64
+#else
+#define FATELF_EXEC_ELFCLASS ELFCLASS32
+#endif
+
+#define MAX_PROGRAM_HEADERS 1024
+
+// A program or interpreter, mapped into memory.
+typedef struct loaded_image
+{
+    uintptr_t bias;    // what to add to a p_vaddr to get its address.
+    uintptr_t entry;
+    uintptr_t phdr;    // where the program headers are, in memory.
+    int phnum;
+    char *interp;      // PT_INTERP, if any.
+} loaded_image;
+
+typedef struct exec_options
+{
+    int extract;       // always use a memfd.
+    int verbose;
+} exec_options;
+
+static exec_options options;
+static uint64_t verified_bytes = 0;  // for --verbose.
+
+
+// Find the ELF binary we should run in (fd): the record for this machine,
+//  or the whole file if it isn't FatELF. (*verifier) is set if the record
+//  has a Merkle tree, NULL otherwise.
+static void find_image(const char *fname, const int fd,
+                       uint64_t *offset, uint64_t *size,
+                       fatelf_merkle_verifier **verifier)
+{
+    const uint64_t filesize = xget_file_size(fname, fd);
+    const char *err = NULL;
+    FATELF_header *header = fatelf_pread_header(fd, 0, filesize, &err);
+    int idx;
+
+    *verifier = NULL;
+    if (header == NULL)
+    {
+        if (strcmp(err, "is not a FatELF binary") != 0)
+            xfail("'%s' %s", fname, err);
+        *offset = 0;
+        *size = filesize;
+        return;
+    } // if
+
+    if ((idx = fatelf_find_host_record(header)) < 0)
+        xfail("'%s' has no record that runs on this machine", fname);
+
+    *offset = header->records[idx].offset;
+    *size = header->records[idx].size;
+    *verifier = fatelf_open_merkle_verifier(fd, header, filesize, idx, &err);
+    if ((*verifier == NULL) && (err != NULL))
+        xfail("'%s' %s", fname, err);
+    free(header);
+
+    if ((*offset > filesize) || (*size > (filesize - *offset)))
+        xfail("'%s' is truncated", fname);
+} // find_image
+
+
+// Read (len) bytes at (pos) into the record at (offset) in (fd). If the
+//  record has a Merkle tree, the whole blocks around them are checked in
+//  our own buffer, so nobody can change them between the check and the use.
+static void xpread_record(const char *fname, const int fd,
+                          const uint64_t offset,
+                          fatelf_merkle_verifier *verifier, void *_dst,
+                          const uint64_t pos, const uint64_t len)
+{
+    uint8_t *dst = (uint8_t *) _dst;
+    uint64_t start, end, buflen;
+    uint8_t *buf = NULL;
+
+    if (verifier == NULL)
+    {
+        xpread(fname, fd, dst, (size_t) len, offset + pos);
+        return;
+    } // if
+
+    start = pos - (pos % verifier->block_size);
+    end = ((pos + len + (verifier->block_size - 1)) / verifier->block_size) * verifier->block_size;
+    if (end > verifier->rec_size)
+        end = verifier->rec_size;
+    buflen = ((uint64_t) verifier->block_size) * 64;
+    buf = (uint8_t *) xmalloc((size_t) buflen);
+
+    while (start < end)
+    {
+        const uint64_t count = ((end - start) < buflen) ? (end - start) : buflen;
+        const uint64_t from = (start > pos) ? start : pos;
+        const uint64_t to = ((start + count) < (pos + len)) ? (start + count) : (pos + len);
+        const char *err = NULL;
+
+        xpread(fname, fd, buf, (size_t) count, offset + start);
+        if ((err = fatelf_merkle_verify_data(verifier, start, buf, count)) != NULL)
+            xfail("'%s' %s, near offset %llu of its record", fname, err, (unsigned long long) start);
+        verified_bytes += count;
+        if (from < to)
+            memcpy(dst + (from - pos), buf + (from - start), (size_t) (to - from));
+        start += count;
+    } // while
+
+    free(buf);
+} // xpread_record
+
+
+static ElfW(Phdr) *read_program_headers(const char *fname, const int fd,
+                                        const uint64_t offset,
+                                        const uint64_t size,
+                                        fatelf_merkle_verifier *verifier,
+                                        ElfW(Ehdr) *ehdr)
+{
+    ElfW(Phdr) *phdrs = NULL;
+    size_t len;
+
+    if (size < sizeof (*ehdr))
+        xfail("'%s' is too small to be an ELF binary", fname);
+    xpread_record(fname, fd, offset, verifier, ehdr, 0, sizeof (*ehdr));
+
+    if (memcmp(ehdr->e_ident, ELFMAG, SELFMAG) != 0)
+        xfail("'%s' is not an ELF binary", fname);
+    else if (ehdr->e_ident[EI_CLASS] != FATELF_EXEC_ELFCLASS)
+        xfail("'%s' has the wrong word size for this machine", fname);
+    else if ((ehdr->e_type != ET_EXEC) && (ehdr->e_type != ET_DYN))
+        xfail("'%s' is not an executable", fname);
+    else if (ehdr->e_phentsize != sizeof (ElfW(Phdr)))
+        xfail("'%s' has bogus program headers", fname);
+    else if ((ehdr->e_phnum == 0) || (ehdr->e_phnum > MAX_PROGRAM_HEADERS))
+        xfail("'%s' has bogus program headers", fname);
+
+    len = sizeof (ElfW(Phdr)) * ehdr->e_phnum;
+    if ((ehdr->e_phoff > size) || (len > (size - ehdr->e_phoff)))
+        xfail("'%s' has bogus program headers", fname);
+
+    phdrs = (ElfW(Phdr) *) xmalloc(len);
+    xpread_record(fname, fd, offset, verifier, phdrs, ehdr->e_phoff, len);
+    return phdrs;
+} // read_program_headers
+
+
+static int elf_prot(const ElfW(Word) flags)
+{
+    return ((flags & PF_R) ? PROT_READ : 0) |
+           ((flags & PF_W) ? PROT_WRITE : 0) |
+           ((flags & PF_X) ? PROT_EXEC : 0);
+} // elf_prot
+
+
+// Map the ELF binary at (offset) in (fd), like the kernel would. Returns
+//  zero, having mapped nothing, if it can't be mapped in place; calls
+//  xfail() if it's damaged.
+static int map_image(const char *fname, const int fd, const uint64_t offset,
+                     const uint64_t size, fatelf_merkle_verifier *verifier,
+                     loaded_image *img)
+{
+    const uintptr_t pagesize = (uintptr_t) sysconf(_SC_PAGESIZE);
+    const uintptr_t pagemask = pagesize - 1;
+    ElfW(Ehdr) ehdr;
+    ElfW(Phdr) *phdrs = read_program_headers(fname, fd, offset, size, verifier, &ehdr);
+    uintptr_t minva = UINTPTR_MAX;
+    uintptr_t maxva = 0;
+    uint8_t *reserved = NULL;
+    int i;
+
+    memset(img, '\0', sizeof (*img));
+
+    // A segment's file offset and address have to agree modulo the page
+    //  size, so the record's offset has to be page aligned for any of this
+    //  to work. fatelf-glue aligns them, but other tools might not.
+    if (offset & pagemask)
+    {
+        free(phdrs);
+        return 0;
+    } // if
+
+    for (i = 0; i < ehdr.e_phnum; i++)
+    {
+        const ElfW(Phdr) *ph = &phdrs[i];
+        if (ph->p_type == PT_INTERP)
+        {
+            if ((ph->p_filesz == 0) || (ph->p_filesz > 4096) ||
+                (ph->p_offset > size) || (ph->p_filesz > (size - ph->p_offset)))
+                xfail("'%s' has a bogus PT_INTERP", fname);
+            img->interp = (char *) xmalloc(ph->p_filesz + 1);
+            xpread_record(fname, fd, offset, verifier, img->interp, ph->p_offset, ph->p_filesz);
+        } // if
+        else if (ph->p_type == PT_LOAD)
+        {
+            if ( (ph->p_filesz > ph->p_memsz) || ((ph->p_offset & pagemask) != (ph->p_vaddr & pagemask)) ||
+                 (ph->p_offset > size) || (ph->p_filesz > (size - ph->p_offset)) ||
+                 (ph->p_memsz > (UINTPTR_MAX - ph->p_vaddr)) )
+                xfail("'%s' has a bogus PT_LOAD", fname);
+            if ((ph->p_vaddr & ~pagemask) < minva)
+                minva = ph->p_vaddr & ~pagemask;
+            if (((ph->p_vaddr + ph->p_memsz + pagemask) & ~pagemask) > maxva)
+                maxva = (ph->p_vaddr + ph->p_memsz + pagemask) & ~pagemask;
+        } // else if
+    } // for
+
+    if (maxva == 0)
+        xfail("'%s' has nothing to load", fname);
+
+    // Reserve the whole span first, so the segments land together. A fixed
+    //  address might be taken by this process, in which case we give up.
+    if (ehdr.e_type == ET_DYN)
+        reserved = (uint8_t *) mmap(NULL, maxva - minva, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    else
+        reserved = (uint8_t *) mmap((void *) minva, maxva - minva, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+
+    if (reserved == MAP_FAILED)
+    {
+        if ((ehdr.e_type == ET_DYN) || (errno != EEXIST))
+            xfail("Failed to map '%s': %s", fname, strerror(errno));
+        free(img->interp);
+        free(phdrs);
+        return 0;
+    } // if
+    else if ((ehdr.e_type == ET_EXEC) && (((uintptr_t) reserved) != minva))
+    {
+        munmap(reserved, maxva - minva);  // an old kernel, taking it as a hint.
+        free(img->interp);
+        free(phdrs);
+        return 0;
+    } // else if
+
+    img->bias = ((uintptr_t) reserved) - minva;
+    img->entry = img->bias + ehdr.e_entry;
+    img->phnum = ehdr.e_phnum;
+
+    for (i = 0; i < ehdr.e_phnum; i++)
+    {
+        const ElfW(Phdr) *ph = &phdrs[i];
+        const int prot = elf_prot(ph->p_flags);
+        const uintptr_t start = img->bias + (ph->p_vaddr & ~pagemask);
+        const uintptr_t filetail = img->bias + ph->p_vaddr + ph->p_filesz;
+        const uintptr_t fileend = (filetail + pagemask) & ~pagemask;
+        const uintptr_t memend = (img->bias + ph->p_vaddr + ph->p_memsz + pagemask) & ~pagemask;
+        const int has_bss = (ph->p_memsz > ph->p_filesz);
+
+        if (ph->p_type == PT_PHDR)
+            img->phdr = img->bias + ph->p_vaddr;
+
+        if (ph->p_type != PT_LOAD)
+            continue;
+
+        // A verified segment is copied, and checked on the way in.
+        if ((ph->p_filesz > 0) && (verifier != NULL))
+        {
+            void *ptr = mmap((void *) start, fileend - start, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+            if (ptr == MAP_FAILED)
+                xfail("Failed to map '%s': %s", fname, strerror(errno));
+            xpread_record(fname, fd, offset, verifier, ptr, ph->p_offset & ~pagemask,
+                          (ph->p_offset & pagemask) + ph->p_filesz);
+            if (mprotect(ptr, fileend - start, prot) == -1)
+                xfail("Failed to map '%s': %s", fname, strerror(errno));
+        } // if
+
+        // Here's the whole trick: the file offset includes the record's.
+        else if (ph->p_filesz > 0)
+        {
+            void *ptr = mmap((void *) start, fileend - start, prot | (has_bss ? PROT_WRITE : 0),
+                             MAP_PRIVATE | MAP_FIXED, fd, (off_t) (offset + (ph->p_offset & ~pagemask)));
+            if (ptr == MAP_FAILED)
+                xfail("Failed to map '%s': %s", fname, strerror(errno));
+
+            // The rest of the last page is whatever follows in the fat file.
+            if (has_bss)
+            {
+                memset((void *) filetail, '\0', fileend - filetail);
+                if ((!(prot & PROT_WRITE)) && (mprotect((void *) start, fileend - start, prot) == -1))
+                    xfail("Failed to map '%s': %s", fname, strerror(errno));
+            } // if
+        } // if
+
+        if (memend > fileend)
+        {
+            const uintptr_t bss = (ph->p_filesz > 0) ? fileend : start;
+            void *ptr = mmap((void *) bss, memend - bss, prot, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+            if (ptr == MAP_FAILED)
+                xfail("Failed to map '%s': %s", fname, strerror(errno));
+        } // if
+
+        // No PT_PHDR? Then they're wherever the segment holding them went.
+        if ( (img->phdr == 0) && (ehdr.e_phoff >= ph->p_offset) &&
+             ((ehdr.e_phoff - ph->p_offset) < ph->p_filesz) )
+            img->phdr = img->bias + ph->p_vaddr + (ehdr.e_phoff - ph->p_offset);
+    } // for
+
+    free(phdrs);
+    return 1;
+} // map_image
+
+
+// Copy the record to a memfd and let the kernel run that. Only returns on
+//  failure.
+static void exec_extracted(const char *fname, const int fd,
+                           const uint64_t offset, const uint64_t size,
+                           fatelf_merkle_verifier *verifier,
+                           char **argv, char **envp)
+{
+    const int memfd = memfd_create("fatelf-exec", MFD_CLOEXEC);
+    if (memfd == -1)
+        xfail("memfd_create failed: %s", strerror(errno));
+    else if (verifier != NULL)
+        xcopyfile_verified(fname, fd, "memfd", memfd, verifier);  // the kernel reads all of it.
+    else
+        xcopyfile_range(fname, fd, "memfd", memfd, offset, size);
+    close(fd);
+    fexecve(memfd, argv, envp);
+    xfail("Failed to run '%s': %s", fname, strerror(errno));
+} // exec_extracted
+
+
+#if FATELF_EXEC_IN_PLACE
+// Put (words) at the top of a fresh stack frame and jump to (entry) with
+//  the stack pointer on argc, as the kernel does. Everything above the new
+//  stack pointer is our own dead frames, which is fine; the strings argv
+//  and envp point to are further up still, where the kernel put them.
+static void start_program(const uintptr_t entry, const uintptr_t *words,
+                          const size_t count) __attribute__((noreturn));
+static void start_program(const uintptr_t entry, const uintptr_t *words,
+                          const size_t count)
+{
+    uintptr_t *sp = (uintptr_t *) alloca((count * sizeof (uintptr_t)) + 16);
+    sp = (uintptr_t *) ((((uintptr_t) sp) + 15) & ~((uintptr_t) 15));
+    memcpy(sp, words, count * sizeof (uintptr_t));
+
+    // The ABIs want a function to register with atexit() in a register;
+    //  zero means there isn't one.
+    #if defined(__x86_64__)
+    __asm__ __volatile__ ("mov %0, %%rsp\n\txor %%edx, %%edx\n\tjmp *%1\n" : : "r" (sp), "a" (entry) : "memory");
+    #elif defined(__i386__)
+    __asm__ __volatile__ ("mov %0, %%esp\n\txor %%edx, %%edx\n\tjmp *%1\n" : : "r" (sp), "a" (entry) : "memory");
+    #elif defined(__aarch64__)
+    {
+        register uintptr_t target __asm__("x16") = entry;
+        __asm__ __volatile__ ("mov sp, %0\n\tmov x0, #0\n\tbr %1\n" : : "r" (sp), "r" (target) : "memory");
+    }
+    #endif
+
+    __builtin_unreachable();
+} // start_program
+
+
+static size_t add_aux(uintptr_t *words, size_t pos, const uintptr_t type,
+                      const uintptr_t value)
+{
+    words[pos++] = type;
+    words[pos++] = value;
+    return pos;
+} // add_aux
+
+
+// Build argc/argv/envp/auxv for the program and jump into it.
+static void exec_in_place(const char *fname, const loaded_image *prog,
+                          const loaded_image *interp, char **argv,
+                          char **envp, const ElfW(auxv_t) *auxv)
+{
+    size_t argc = 0, envc = 0, auxc = 0;
+    uintptr_t *words = NULL;
+    size_t pos = 0;
+    size_t i;
+
+    while (argv[argc] != NULL)
+        argc++;
+    while (envp[envc] != NULL)
+        envc++;
+    while (auxv[auxc].a_type != AT_NULL)
+        auxc++;
+
+    words = (uintptr_t *) xmalloc(sizeof (uintptr_t) * (argc + envc + (auxc * 2) + 16));
+    words[pos++] = (uintptr_t) argc;
+    for (i = 0; i <= argc; i++)
+        words[pos++] = (uintptr_t) argv[i];
+    for (i = 0; i <= envc; i++)
+        words[pos++] = (uintptr_t) envp[i];
+
+    // Everything about the process (hwcaps, uid, AT_RANDOM, the vDSO...)
+    //  stays as the kernel told us; everything about the binary changes.
+    pos = add_aux(words, pos, AT_PHDR, prog->phdr);
+    pos = add_aux(words, pos, AT_PHENT, sizeof (ElfW(Phdr)));
+    pos = add_aux(words, pos, AT_PHNUM, (uintptr_t) prog->phnum);
+    pos = add_aux(words, pos, AT_ENTRY, prog->entry);
+    pos = add_aux(words, pos, AT_BASE, interp ? interp->bias : 0);
+    pos = add_aux(words, pos, AT_EXECFN, (uintptr_t) fname);
+    for (i = 0; i < auxc; i++)
+    {
+        switch (auxv[i].a_type)
+        {
+            case AT_PHDR: case AT_PHENT: case AT_PHNUM: case AT_ENTRY:
+            case AT_BASE: case AT_EXECFN: case AT_EXECFD:
+                break;
+            default:
+                pos = add_aux(words, pos, auxv[i].a_type, auxv[i].a_un.a_val);
+                break;
+        } // switch
+    } // for
+    pos = add_aux(words, pos, AT_NULL, 0);
+
+    start_program(interp ? interp->entry : prog->entry, words, pos);
+} // exec_in_place
+#endif
+
+
+// Run (fname), which is open as (fd). Never returns.
+static void fatelf_exec(const char *fname, const int fd, char **argv,
+                        char **envp, const ElfW(auxv_t) *auxv)
+{
+    uint64_t offset, size;
+    loaded_image prog, interp;
+    fatelf_merkle_verifier *verifier = NULL;
+    int interpfd = -1;
+    const char *ptr;
+
+    find_image(fname, fd, &offset, &size, &verifier);
+
+    if ((options.extract) || (!FATELF_EXEC_IN_PLACE) || (!map_image(fname, fd, offset, size, verifier, &prog)))
+    {
+        if (options.verbose)
+            fprintf(stderr, "fatelf-exec: running '%s' from a memfd\n", fname);
+        exec_extracted(fname, fd, offset, size, verifier, argv, envp);
+    } // if
+
+    if ((options.verbose) && (verifier != NULL))
+    {
+        fprintf(stderr, "fatelf-exec: verified %llu of %llu bytes of '%s' against its Merkle tree\n",
+                (unsigned long long) verified_bytes, (unsigned long long) size, fname);
+    } // if
+
+    // The segments stay mapped after the fd is gone.
+    fatelf_close_merkle_verifier(verifier);
+    close(fd);
+
+    if (prog.interp != NULL)
+    {
+        uint64_t interpoffset, interpsize;
+        interpfd = xopen(prog.interp, O_RDONLY | O_CLOEXEC, 0);
+        find_image(prog.interp, interpfd, &interpoffset, &interpsize, &verifier);
+        if (!map_image(prog.interp, interpfd, interpoffset, interpsize, verifier, &interp))
+            xfail("Can't map interpreter '%s' for '%s'", prog.interp, fname);
+        else if (interp.interp != NULL)
+            xfail("Interpreter '%s' wants an interpreter itself", prog.interp);
+        fatelf_close_merkle_verifier(verifier);
+        close(interpfd);
+    } // if
+
+    if (options.verbose)
+    {
+        fprintf(stderr, "fatelf-exec: '%s' mapped in place at offset %llu, interpreter %s\n",
+                fname, (unsigned long long) offset, prog.interp ? prog.interp : "(none)");
+    } // if
+
+    // So ps and top show the program, not us.
+    ptr = strrchr(argv[0], '/');
+    prctl(PR_SET_NAME, (unsigned long) (ptr ? ptr + 1 : argv[0]), 0, 0, 0);
+
+    #if FATELF_EXEC_IN_PLACE
+    exec_in_place(fname, &prog, (prog.interp != NULL) ? &interp : NULL, argv, envp, auxv);
+    #endif
+    xfail("Failed to run '%s'", fname);
+} // fatelf_exec
+
+
+int main(int argc, char **argv, char **envp)
+{
+    const char *usage = "USAGE: %s [--extract] [--verbose] [--argv0=NAME] <program> [args...]";
+    const ElfW(auxv_t) *auxv = NULL;
+    const char *fname = NULL;
+    const char *argv0 = NULL;
+    char **progargv = NULL;
+    long execfd = -1;
+    char **env;
+    int fd = -1;
+    int i = 1;
+
+    // The auxv sits right after envp, where the kernel put it.
+    for (env = envp; *env != NULL; env++) { /* spin */ }
+    auxv = (const ElfW(auxv_t) *) (env + 1);
+    for (i = 0; auxv[i].a_type != AT_NULL; i++)
+    {
+        if (auxv[i].a_type == AT_EXECFD)
+            execfd = (long) auxv[i].a_un.a_val;
+    } // for
+
+    // Started by binfmt_misc with the "O" and "P" flags, our argv is
+    //  (us, full path of the program, the program's argv[0], its args...)
+    //  and the program is already open.
+    if (execfd >= 0)
+    {
+        if (argc < 3)
+            xfail("binfmt_misc should register fatelf-exec with the 'OP' flags");
+        fname = argv[1];
+        fatelf_exec(fname, (int) execfd, argv + 2, envp, auxv);
+    } // if
+
+    // We don't call xfatelf_init(): its options could be the program's.
+    i = 1;
+    while ((i < argc) && (strncmp(argv[i], "--", 2) == 0))
+    {
+        if (strcmp(argv[i], "--") == 0)
+        {
+            i++;
+            break;
+        } // if
+        else if (strcmp(argv[i], "--version") == 0)
+        {
+            printf("%s\n", fatelf_build_version);
+            return 0;
+        } // else if
+        else if (strcmp(argv[i], "--extract") == 0)
+            options.extract = 1;
+        else if (strcmp(argv[i], "--verbose") == 0)
+            options.verbose = 1;
+        else if (strncmp(argv[i], "--argv0=", 8) == 0)
+            argv0 = argv[i] + 8;
+        else
+            xfail("Unknown option '%s'", argv[i]);
+        i++;
+    } // while
+
+    // this could stand to use getopt(), later.
+    if (i >= argc)
+        xfail(usage, argv[0]);
+
+    fname = argv[i];
+    progargv = argv + i;
+    if (argv0 != NULL)
+        progargv[0] = (char *) argv0;
+
+    // binfmt_misc checked this for us, but here we're the kernel.
+    if (access(fname, X_OK) == -1)
+        xfail("Can't run '%s': %s", fname, strerror(errno));
+
+    fd = xopen(fname, O_RDONLY | O_CLOEXEC, 0);
+    fatelf_exec(fname, fd, progargv, envp, auxv);
+    return 1;
+} // main
+
+// end of fatelf-exec.c ...
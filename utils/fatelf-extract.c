@@ -17,10 +17,27 @@ static int fatelf_extract(const char *out, const char *fname,
     const int recidx = xfind_fatelf_record(header, target);
     const int outfd = xopen(out, O_WRONLY | O_CREAT | O_TRUNC, 0755);
     const FATELF_record *rec = &header->records[recidx];
+    fatelf_merkle_verifier *verifier = NULL;
+    const char *err = NULL;
 
     unlink_on_xfail = out;
 
-    xcopyfile_range(fname, fd, out, outfd, rec->offset, rec->size);
+    if (recidx < 0)
+        xfail("No record matches '%s' in FatELF file '%s'", target, fname);
+
+    // With Merkle trees, each block is checked as it's copied, instead of
+    //  hashing the record in a separate pass.
+    verifier = fatelf_open_merkle_verifier(fd, header, xget_file_size(fname, fd), recidx, &err);
+    if (verifier != NULL)
+    {
+        xcopyfile_verified(fname, fd, out, outfd, verifier);
+        fatelf_close_merkle_verifier(verifier);
+    } // if
+    else if (err != NULL)
+        xfail("'%s' %s", fname, err);
+    else
+        xcopyfile_range(fname, fd, out, outfd, rec->offset, rec->size);
+
     xappend_junk(fname, fd, out, outfd, header);
     xclose(out, outfd);
     xclose(fname, fd);
@@ -34,7 +51,7 @@ static int fatelf_extract(const char *out, const char *fname,
 
 int main(int argc, const char **argv)
 {
-    xfatelf_init(argc, argv);
+    xfatelf_init(&argc, argv);
     if (argc != 4)  // this could stand to use getopt(), later.
         xfail("USAGE: %s <out> <in> <target>", argv[0]);
     return fatelf_extract(argv[1], argv[2], argv[3]);
@@ -0,0 +1,567 @@
+/**
+ * FatELF; support multiple ELF binaries in one file.
+ *
+ * Please see the file LICENSE.txt in the source's root directory.
+ *
+ *  This file written by Ryan C. Gordon.
+ */
+
+// This downloads one record of a FatELF file from an HTTP server, without
+//  downloading the rest: a ranged GET for the FatELF header, then ranged
+//  GETs for just the record we want (split across several connections if
+//  it's big). The result is what fatelf-extract would have written if we
+//  had the whole file. Only plain http:// is supported; put a TLS proxy in
+//  front of it if you need https.
+
+#define FATELF_UTILS 1
+#include "fatelf-utils.h"
+
+#include <errno.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#define FETCH_PART_SIZE (8 * 1024 * 1024)  // ranged GETs for records are this big, at most.
+#define FETCH_TIMEOUT_SECS 30
+#define FETCH_MAX_REDIRECTS 5
+
+typedef struct http_url
+{
+    char *host;
+    char *port;
+    char *path;  // includes the query string.
+} http_url;
+
+// a little read buffer for a socket, so we can read headers a line at a time.
+typedef struct http_conn
+{
+    const char *name;
+    int fd;
+    uint8_t buf[16 * 1024];
+    size_t pos;
+    size_t len;
+} http_conn;
+
+typedef struct http_response
+{
+    int status;
+    int64_t content_length;  // -1 if not given.
+    int64_t range_total;     // from Content-Range, -1 if not given.
+    uint64_t range_start;
+    char *location;
+} http_response;
+
+typedef struct fetch_job
+{
+    const http_url *url;
+    const char *out;
+    int outfd;
+    uint64_t offset;       // where the record starts on the server.
+    uint64_t outoffset;    // where it starts in our output.
+    uint64_t size;
+    int parts;
+} fetch_job;
+
+
+static void free_url(http_url *url)
+{
+    free(url->host);
+    free(url->port);
+    free(url->path);
+    memset(url, '\0', sizeof (*url));
+} // free_url
+
+
+static void parse_url(const char *str, http_url *url)
+{
+    const char *host = str + 7;
+    const char *slash;
+    const char *colon;
+    size_t hostlen;
+
+    if (strncmp(str, "http://", 7) != 0)
+        xfail("'%s' isn't an http:// URL", str);
+
+    slash = strchr(host, '/');
+    hostlen = slash ? (size_t) (slash - host) : strlen(host);
+    colon = memchr(host, ':', hostlen);
+    if (host[0] == '[')  // IPv6 literal, like [::1]:8000
+    {
+        const char *bracket = memchr(host, ']', hostlen);
+        if (bracket == NULL)
+            xfail("Bad URL '%s'", str);
+        colon = ((bracket + 1) < (host + hostlen)) && (bracket[1] == ':') ? bracket + 1 : NULL;
+        url->host = (char *) xmalloc((bracket - host));
+        memcpy(url->host, host + 1, (bracket - host) - 1);
+    } // if
+    else
+    {
+        const size_t len = colon ? (size_t) (colon - host) : hostlen;
+        url->host = (char *) xmalloc(len + 1);
+        memcpy(url->host, host, len);
+    } // else
+
+    if (colon == NULL)
+        url->port = xstrdup("80");
+    else
+    {
+        const size_t len = hostlen - ((colon + 1) - host);
+        url->port = (char *) xmalloc(len + 1);
+        memcpy(url->port, colon + 1, len);
+    } // else
+
+    url->path = xstrdup(slash ? slash : "/");
+
+    if ((url->host[0] == '\0') || (url->port[0] == '\0'))
+        xfail("Bad URL '%s'", str);
+} // parse_url
+
+
+static void http_connect(const http_url *url, http_conn *conn)
+{
+    struct addrinfo hints;
+    struct addrinfo *addrs = NULL;
+    struct addrinfo *addr;
+    struct timeval tv;
+    int rc;
+
+    memset(&hints, '\0', sizeof (hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if ((rc = getaddrinfo(url->host, url->port, &hints, &addrs)) != 0)
+        xfail("Can't find '%s': %s", url->host, gai_strerror(rc));
+
+    conn->fd = -1;
+    for (addr = addrs; addr != NULL; addr = addr->ai_next)
+    {
+        const int fd = socket(addr->ai_family, addr->ai_socktype | SOCK_CLOEXEC, addr->ai_protocol);
+        if (fd == -1)
+            continue;
+        else if (connect(fd, addr->ai_addr, addr->ai_addrlen) == 0)
+        {
+            conn->fd = fd;
+            break;
+        } // else if
+        close(fd);
+    } // for
+
+    freeaddrinfo(addrs);
+
+    if (conn->fd == -1)
+        xfail("Can't connect to '%s' port %s: %s", url->host, url->port, strerror(errno));
+
+    // don't hang forever on a server that went away.
+    tv.tv_sec = FETCH_TIMEOUT_SECS;
+    tv.tv_usec = 0;
+    setsockopt(conn->fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof (tv));
+    setsockopt(conn->fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof (tv));
+
+    conn->name = url->host;
+    conn->pos = conn->len = 0;
+} // http_connect
+
+
+// Read up to (len) bytes; zero at end of stream.
+static size_t http_read(http_conn *conn, void *buf, const size_t len)
+{
+    if (conn->pos == conn->len)
+    {
+        ssize_t rc;
+        while (((rc = read(conn->fd, conn->buf, sizeof (conn->buf))) == -1) && (errno == EINTR)) { /* spin */ }
+        if (rc == -1)
+            xfail("Failed to read from '%s': %s", conn->name, strerror(errno));
+        conn->pos = 0;
+        conn->len = (size_t) rc;
+        if (rc == 0)
+            return 0;
+    } // if
+
+    {
+        const size_t avail = conn->len - conn->pos;
+        const size_t cpy = (len < avail) ? len : avail;
+        memcpy(buf, conn->buf + conn->pos, cpy);
+        conn->pos += cpy;
+        return cpy;
+    }
+} // http_read
+
+
+// Read a header line, without the CRLF, into (line). Zero at end of stream.
+static int http_read_line(http_conn *conn, char *line, const size_t len)
+{
+    size_t i = 0;
+    char ch;
+
+    while (http_read(conn, &ch, 1) == 1)
+    {
+        if (ch == '\n')
+        {
+            if ((i > 0) && (line[i-1] == '\r'))
+                i--;
+            line[i] = '\0';
+            return 1;
+        } // if
+        else if (i >= (len - 1))
+            xfail("Header line from '%s' is too long", conn->name);
+        line[i++] = ch;
+    } // while
+
+    return 0;
+} // http_read_line
+
+
+static void http_request(const http_url *url, http_conn *conn,
+                         const uint64_t start, const uint64_t len,
+                         http_response *response)
+{
+    char line[4096];
+    char *request = NULL;
+    size_t reqlen = 0;
+    size_t sent = 0;
+    int gotstatus = 0;
+
+    http_connect(url, conn);
+
+    reqlen = strlen(url->path) + strlen(url->host) + 256;
+    request = (char *) xmalloc(reqlen);
+    snprintf(request, reqlen,
+             "GET %s HTTP/1.1\r\n"
+             "Host: %s%s%s\r\n"
+             "Range: bytes=%llu-%llu\r\n"
+             "User-Agent: fatelf-fetch\r\n"
+             "Connection: close\r\n"
+             "\r\n",
+             url->path, url->host, strcmp(url->port, "80") ? ":" : "",
+             strcmp(url->port, "80") ? url->port : "",
+             (unsigned long long) start,
+             (unsigned long long) (start + len - 1));
+
+    reqlen = strlen(request);
+    while (sent < reqlen)
+    {
+        const ssize_t rc = send(conn->fd, request + sent, reqlen - sent, MSG_NOSIGNAL);
+        if ((rc == -1) && (errno == EINTR))
+            continue;
+        else if (rc == -1)
+            xfail("Failed to send to '%s': %s", url->host, strerror(errno));
+        sent += (size_t) rc;
+    } // while
+    free(request);
+
+    memset(response, '\0', sizeof (*response));
+    response->content_length = -1;
+    response->range_total = -1;
+
+    while (1)
+    {
+        if (!http_read_line(conn, line, sizeof (line)))
+            xfail("'%s' closed the connection early", url->host);
+        else if (line[0] == '\0')
+            break;  // end of headers.
+        else if (!gotstatus)
+        {
+            if ((strncmp(line, "HTTP/1.", 7) != 0) || (sscanf(line + 8, " %d", &response->status) != 1))
+                xfail("'%s' didn't send an HTTP response", url->host);
+            gotstatus = 1;
+        } // else if
+        else if (strncasecmp(line, "Content-Length:", 15) == 0)
+            response->content_length = strtoll(line + 15, NULL, 10);
+        else if (strncasecmp(line, "Content-Range:", 14) == 0)
+        {
+            unsigned long long first = 0, last = 0, total = 0;
+            if (sscanf(line + 14, " bytes %llu-%llu/%llu", &first, &last, &total) == 3)
+            {
+                response->range_start = (uint64_t) first;
+                response->range_total = (int64_t) total;
+            } // if
+        } // else if
+        else if (strncasecmp(line, "Location:", 9) == 0)
+        {
+            const char *ptr = line + 9;
+            while (*ptr == ' ')
+                ptr++;
+            free(response->location);
+            response->location = xstrdup(ptr);
+        } // else if
+        else if (strncasecmp(line, "Transfer-Encoding:", 18) == 0)
+        {
+            if (strstr(line + 18, "chunked") != NULL)
+                xfail("'%s' sent a chunked response to a range request", url->host);
+        } // else if
+    } // while
+} // http_request
+
+
+// Fetch (len) bytes at (start) of (url), into (buf) if it's not NULL, or
+//  else into (outfd) at (outoffset). If (total) isn't NULL, it gets the
+//  size of the whole file. Follows redirects, and updates (url) to where
+//  they led, so later requests go straight there.
+static void http_fetch_range(http_url *url, const uint64_t start,
+                             const uint64_t len, uint8_t *buf,
+                             const char *out, const int outfd,
+                             const uint64_t outoffset, uint64_t *total)
+{
+    http_response response;
+    http_conn *conn = (http_conn *) xmalloc(sizeof (http_conn));
+    uint64_t got = 0;
+    int redirects = 0;
+
+    while (1)
+    {
+        http_request(url, conn, start, len, &response);
+        if ( (response.status == 301) || (response.status == 302) ||
+             (response.status == 303) || (response.status == 307) ||
+             (response.status == 308) )
+        {
+            if (response.location == NULL)
+                xfail("'%s' redirected us nowhere", url->host);
+            else if (++redirects > FETCH_MAX_REDIRECTS)
+                xfail("Too many redirects from '%s'", url->host);
+            else if (response.location[0] == '/')  // same server.
+            {
+                free(url->path);
+                url->path = response.location;
+            } // else if
+            else
+            {
+                free_url(url);
+                parse_url(response.location, url);
+                free(response.location);
+            } // else
+            close(conn->fd);
+            continue;
+        } // if
+
+        free(response.location);
+        break;
+    } // while
+
+    if (response.status == 200)
+        xfail("'%s' doesn't support range requests", url->host);
+    else if (response.status == 416)
+        xfail("'%s' says the file is shorter than its FatELF header claims", url->host);
+    else if (response.status != 206)
+        xfail("'%s' returned HTTP status %d", url->host, response.status);
+    else if (response.range_start != start)
+        xfail("'%s' sent the wrong range", url->host);
+    else if ((response.content_length >= 0) && (((uint64_t) response.content_length) != len))
+        xfail("'%s' sent %lld bytes, not the %llu we asked for", url->host, (long long) response.content_length, (unsigned long long) len);
+
+    if (total != NULL)
+    {
+        if (response.range_total < 0)
+            xfail("'%s' didn't say how big the file is", url->host);
+        *total = (uint64_t) response.range_total;
+    } // if
+
+    while (got < len)
+    {
+        uint8_t tmp[16 * 1024];
+        const size_t want = (size_t) (((len - got) < sizeof (tmp)) ? (len - got) : sizeof (tmp));
+        uint8_t *dst = (buf != NULL) ? (buf + got) : tmp;
+        const size_t rc = http_read(conn, dst, want);
+        size_t written = 0;
+
+        if (rc == 0)
+            break;
+
+        while ((buf == NULL) && (written < rc))
+        {
+            const ssize_t wrc = pwrite(outfd, tmp + written, rc - written, (off_t) (outoffset + got + written));
+            if ((wrc == -1) && (errno == EINTR))
+                continue;
+            else if (wrc <= 0)
+                xfail("Failed to write '%s': %s", out, strerror(errno));
+            written += (size_t) wrc;
+        } // while
+
+        got += rc;
+    } // while
+
+    close(conn->fd);
+    free(conn);
+
+    if (got < len)
+        xfail("'%s' closed the connection early", url->host);
+} // http_fetch_range
+
+
+static void fetch_part(void *data, const int idx)
+{
+    const fetch_job *job = (const fetch_job *) data;
+    const uint64_t partoffset = ((uint64_t) idx) * FETCH_PART_SIZE;
+    const uint64_t remaining = job->size - partoffset;
+    const uint64_t len = (remaining < FETCH_PART_SIZE) ? remaining : FETCH_PART_SIZE;
+    http_url url;
+
+    // each worker gets its own copy, since redirects change it.
+    url.host = xstrdup(job->url->host);
+    url.port = xstrdup(job->url->port);
+    url.path = xstrdup(job->url->path);
+    http_fetch_range(&url, job->offset + partoffset, len, NULL, job->out,
+                     job->outfd, job->outoffset + partoffset, NULL);
+    free_url(&url);
+} // fetch_part
+
+
+// Fetch (size) bytes at (offset) on the server to (outoffset) in the output,
+//  with up to (connections) requests at once.
+static void fetch_ranges(const http_url *url, const char *out, const int outfd,
+                         const uint64_t offset, const uint64_t outoffset,
+                         const uint64_t size, const int connections)
+{
+    fetch_job job;
+
+    if (size == 0)
+        return;
+
+    job.url = url;
+    job.out = out;
+    job.outfd = outfd;
+    job.offset = offset;
+    job.outoffset = outoffset;
+    job.size = size;
+    job.parts = (int) ((size + FETCH_PART_SIZE - 1) / FETCH_PART_SIZE);
+    fatelf_parallel_for(job.parts, connections, fetch_part, &job);
+} // fetch_ranges
+
+
+static FATELF_header *fetch_header(http_url *url, uint64_t *total)
+{
+    const char *err = NULL;
+    uint8_t *buf = NULL;
+    uint8_t first[FATELF_DISK_FORMAT_SIZE_V2(0)];
+    FATELF_header *header = NULL;
+    size_t len = sizeof (first);
+
+    // Start with the smallest header we might see; that tells us how big
+    //  the whole thing really is.
+    http_fetch_range(url, 0, len, first, NULL, -1, 0, total);
+    if (*total < len)
+        xfail("'%s' is too small to be a FatELF file", url->path);
+    else if ((len = fatelf_decode_header_size(first, len, &err)) == 0)
+        xfail("'%s' %s", url->path, err);
+    else if (len > *total)
+        xfail("'%s' is truncated", url->path);
+
+    buf = (uint8_t *) xmalloc(len);
+    if (len <= sizeof (first))
+        memcpy(buf, first, len);
+    else
+    {
+        memcpy(buf, first, sizeof (first));
+        http_fetch_range(url, sizeof (first), len - sizeof (first),
+                         buf + sizeof (first), NULL, -1, 0, NULL);
+    } // else
+
+    if ((header = fatelf_decode_header(buf, len, &err)) == NULL)
+        xfail("'%s' %s", url->path, err);
+    free(buf);
+    return header;
+} // fetch_header
+
+
+static int fatelf_fetch(const char *out, const char *urlstr,
+                        const char *target, const int want_junk,
+                        const int connections)
+{
+    http_url url;
+    FATELF_header *header = NULL;
+    const FATELF_record *rec = NULL;
+    FATELF_record elfrec;
+    uint64_t total = 0;
+    uint64_t junkoffset = 0;
+    uint64_t junksize = 0;
+    uint64_t junkpad = 0;
+    int recidx;
+    int outfd;
+
+    parse_url(urlstr, &url);
+    header = fetch_header(&url, &total);
+
+    if ((recidx = xfind_fatelf_record(header, target)) < 0)
+        xfail("No record matches '%s' in '%s'", target, urlstr);
+
+    rec = &header->records[recidx];
+    if ((rec->offset > total) || (rec->size > (total - rec->offset)))
+        xfail("'%s' is truncated", urlstr);
+
+    if (want_junk)
+    {
+        const int furthest = find_furthest_record(header);
+        const uint64_t edge = header->records[furthest].offset + header->records[furthest].size;
+        if (total > edge)
+        {
+            junkoffset = edge;
+            junksize = total - edge;
+        } // if
+
+        // padded like xcopy_junk(), if it ends in a resource table.
+        if (junksize >= FATELF_RESOURCE_TRAILER_SIZE)
+        {
+            uint8_t trailer[FATELF_RESOURCE_TRAILER_SIZE];
+            http_fetch_range(&url, total - sizeof (trailer), sizeof (trailer),
+                             trailer, NULL, -1, 0, NULL);
+            if (fatelf_is_resource_trailer(trailer))
+                junkpad = fatelf_junk_padding(junkoffset, rec->size);
+        } // if
+    } // if
+
+    outfd = xopen(out, O_RDWR | O_CREAT | O_TRUNC, 0755);
+    unlink_on_xfail = out;
+
+    fetch_ranges(&url, out, outfd, rec->offset, 0, rec->size, connections);
+    // any padding before the junk is just a hole, which reads as zeros.
+    fetch_ranges(&url, out, outfd, junkoffset, rec->size + junkpad, junksize, connections);
+
+    // Make sure we got what the FatELF header promised.
+    xread_elf_header(out, outfd, 0, &elfrec);
+    elfrec.isa_level = rec->isa_level;
+    if (!fatelf_record_fits_elf(header, recidx, &elfrec))
+        xfail("ELF header in '%s' differs from its FatELF record", urlstr);
+    else if (xread_elf_isa_level(out, outfd, 0) > rec->isa_level)
+        xfail("ISA level in '%s' is lower than the ELF notes need", urlstr);
+
+    xclose(out, outfd);
+    unlink_on_xfail = NULL;
+
+    free(header);
+    free_url(&url);
+    return 0;  // success.
+} // fatelf_fetch
+
+
+int main(int argc, const char **argv)
+{
+    const char *args[3] = { NULL, NULL, "host" };
+    int argcount = 0;
+    int want_junk = 0;
+    int connections = 4;
+    int i;
+
+    xfatelf_init(&argc, argv);
+
+    for (i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--junk") == 0)
+            want_junk = 1;
+        else if (strncmp(argv[i], "--connections=", 14) == 0)
+        {
+            if ((connections = atoi(argv[i] + 14)) < 1)
+                xfail("Bad --connections value '%s'", argv[i] + 14);
+        } // else if
+        else if (argcount < 3)
+            args[argcount++] = argv[i];
+        else
+            argcount = 4;  // too many.
+    } // for
+
+    if ((argcount < 2) || (argcount > 3))  // this could stand to use getopt(), later.
+        xfail("USAGE: %s [--junk] [--connections=N] <out> <url> [target]", argv[0]);
+
+    return fatelf_fetch(args[0], args[1], args[2], want_junk, connections);
+} // main
+
+// end of fatelf-fetch.c ...
+
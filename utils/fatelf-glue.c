@@ -9,58 +9,370 @@
 #define FATELF_UTILS 1
 #include "fatelf-utils.h"
 
-static int fatelf_glue(const char *out, const char **bins, const int bincount)
+#include <errno.h>
+
+static int compare_record_ptrs(const void *a, const void *b)
 {
-    int i = 0;
-    const size_t struct_size = fatelf_header_size(bincount);
-    FATELF_header *header = (FATELF_header *) xmalloc(struct_size);
-    const int outfd = xopen(out, O_WRONLY | O_CREAT | O_TRUNC, 0755);
-    uint64_t offset = FATELF_DISK_FORMAT_SIZE(bincount);
+    return fatelf_record_compare(*((const FATELF_record **) a),
+                                 *((const FATELF_record **) b));
+} // compare_record_ptrs
 
-    unlink_on_xfail = out;
+
+// What to do with junk at the end of FatELF inputs.
+typedef enum junk_policy
+{
+    JUNK_KEEP,   // keep it, but fail if more than one input has some.
+    JUNK_FIRST,  // keep the first input's junk, drop the rest.
+    JUNK_DROP    // drop it all.
+} junk_policy;
+
+// One ELF binary going into the output: either a whole ELF file, or a
+//  record inside a FatELF file, which we copy straight from where it sits.
+typedef struct glue_source
+{
+    int input;        // index into bins.
+    char *name;       // for error messages.
+    uint64_t offset;  // where the binary starts in its file.
+    int renamed;      // nonzero if --osabi changed the record's OSABI.
+} glue_source;
+
+
+// make sure we don't have a duplicate target. Sorting makes this cheap even
+//  when there are thousands of records.
+static void check_duplicates(const FATELF_header *header,
+                             const glue_source *sources)
+{
+    const uint32_t total = header->num_records;
+    FATELF_record **sorted = (FATELF_record **) xmalloc(sizeof (FATELF_record *) * total);
+    uint32_t i;
+
+    for (i = 0; i < total; i++)
+        sorted[i] = (FATELF_record *) &header->records[i];
+
+    qsort(sorted, total, sizeof (FATELF_record *), compare_record_ptrs);
+
+    for (i = 1; i < total; i++)
+    {
+        if (fatelf_record_matches(sorted[i-1], sorted[i]))
+        {
+            const int a = (int) (sorted[i-1] - header->records);
+            const int b = (int) (sorted[i] - header->records);
+            xfail("'%s' and '%s' are for the same target.",
+                  sources[(a < b) ? a : b].name, sources[(a < b) ? b : a].name);
+        } // if
+    } // for
+
+    free(sorted);
+} // check_duplicates
+
+
+static int compare_record_sizes(const void *_a, const void *_b)
+{
+    const FATELF_record *a = *((const FATELF_record **) _a);
+    const FATELF_record *b = *((const FATELF_record **) _b);
+    if (a->size != b->size)
+        return (a->size < b->size) ? -1 : 1;
+    else if (a != b)  // keep records in order, so the first one owns the data.
+        return (a < b) ? -1 : 1;
+    return 0;
+} // compare_record_sizes
+
+
+// Find binaries with the same bytes, so their records can share one copy.
+//  Only binaries of the same size can match, so only those get hashed.
+//  Sets (owners) like fatelf_find_aliases() does, and returns how many
+//  records are aliases of another.
+static uint32_t find_identical_sources(const char **bins,
+                                       const FATELF_header *header,
+                                       const glue_source *sources,
+                                       int *owners)
+{
+    const uint32_t total = header->num_records;
+    const FATELF_record **sorted = (const FATELF_record **) xmalloc(sizeof (FATELF_record *) * total);
+    uint8_t *hashes = (uint8_t *) xmalloc(FATELF_SHA256_SIZE * total);
+    uint32_t aliases = 0;
+    uint32_t start, end, i, j;
+
+    for (i = 0; i < total; i++)
+    {
+        owners[i] = (int) i;
+        sorted[i] = &header->records[i];
+    } // for
+
+    qsort(sorted, total, sizeof (FATELF_record *), compare_record_sizes);
+
+    for (start = 0; start < total; start = end)
+    {
+        for (end = start + 1; end < total; end++)
+        {
+            if (sorted[end]->size != sorted[start]->size)
+                break;
+        } // for
+
+        if ((sorted[start]->size == 0) || ((end - start) < 2))
+            continue;  // nothing to share.
+
+        for (i = start; i < end; i++)
+        {
+            const glue_source *src = &sources[sorted[i] - header->records];
+            const char *fname = bins[src->input];
+            const int fd = xopen(fname, O_RDONLY, 0755);
+            xsha256_range(fname, fd, src->offset, sorted[i]->size, hashes + (FATELF_SHA256_SIZE * i));
+            xclose(fname, fd);
+
+            for (j = start; j < i; j++)
+            {
+                if (memcmp(hashes + (FATELF_SHA256_SIZE * i), hashes + (FATELF_SHA256_SIZE * j), FATELF_SHA256_SIZE) == 0)
+                {
+                    owners[sorted[i] - header->records] = owners[sorted[j] - header->records];
+                    aliases++;
+                    break;
+                } // if
+            } // for
+        } // for
+    } // for
+
+    free(hashes);
+    free(sorted);
+    return aliases;
+} // find_identical_sources
+
+
+static int is_fatelf_file(const char *fname, const int fd)
+{
+    uint8_t buf[4];
+    if (xget_file_size(fname, fd) < sizeof (buf))
+        return 0;
+    xpread(fname, fd, buf, sizeof (buf), 0);
+    return ( (buf[0] == (FATELF_MAGIC & 0xFF)) &&
+             (buf[1] == ((FATELF_MAGIC >> 8) & 0xFF)) &&
+             (buf[2] == ((FATELF_MAGIC >> 16) & 0xFF)) &&
+             (buf[3] == ((FATELF_MAGIC >> 24) & 0xFF)) );
+} // is_fatelf_file
+
+
+// The output is truncated before the inputs are copied into it, so it can't
+//  be one of them. fatelf-edit rewrites a file in place, via a temp file.
+static void check_not_output(const char *fname, const int fd,
+                             const char *out, const struct stat *outstat)
+{
+    struct stat statbuf;
+    if (outstat == NULL)
+        return;  // the output doesn't exist yet.
+    else if (fstat(fd, &statbuf) == -1)
+        xfail("Failed to stat '%s': %s", fname, strerror(errno));
+    else if ((statbuf.st_dev == outstat->st_dev) && (statbuf.st_ino == outstat->st_ino))
+        xfail("'%s' is both an input and the output '%s'; use fatelf-edit to add to a file in place.", fname, out);
+} // check_not_output
+
+
+// (isas) has an ISA level for each binary, or -1 to read it from its notes.
+//  (osabis) has an OSABI for each binary, or -1 to use its ELF header's.
+static int fatelf_glue(const char *out, const char **bins, const int *isas,
+                       const int *osabis, const int bincount,
+                       const junk_policy junk)
+{
+    int i = 0;
+    uint32_t total = 0;
+    uint32_t allocated = (uint32_t) bincount;
+    FATELF_header *header = (FATELF_header *) xmalloc(fatelf_header_size(allocated));
+    glue_source *sources = (glue_source *) xmalloc(sizeof (glue_source) * allocated);
+    int *owners = NULL;
+    uint32_t aliases = 0;
+    uint32_t j = 0;
+    struct stat outstat;
+    const struct stat *existing = (stat(out, &outstat) == 0) ? &outstat : NULL;
+    int outfd = -1;
+    int junkinput = -1;
+    uint64_t junkoffset = 0;
+    uint64_t junksize = 0;
+    uint64_t offset = 0;
 
     if (bincount == 0)
         xfail("Nothing to do.");
-    else if (bincount > 0xFF)
-        xfail("Too many binaries (max is 255).");
 
-    // pad out some bytes for the header we'll write at the end...
-    xwrite_zeros(out, outfd, (size_t) offset);
+    // Read all the headers first, since they decide which FatELF version
+    //  (and so how big a header) we need. FatELF inputs contribute all
+    //  their records.
+    for (i = 0; i < bincount; i++)
+    {
+        const char *fname = bins[i];
+        const int fd = xopen(fname, O_RDONLY, 0755);
+
+        check_not_output(fname, fd, out, existing);
+
+        if (is_fatelf_file(fname, fd))
+        {
+            FATELF_header *fat = xread_fatelf_header(fname, fd);
+            const uint64_t fsize = xget_file_size(fname, fd);
+            uint64_t thisjunkoffset, thisjunksize;
+
+            if (isas[i] >= 0)
+                xfail("'%s' is a FatELF file; --isa only applies to ELF inputs.", fname);
+            else if (osabis[i] >= 0)
+                xfail("'%s' is a FatELF file; --osabi only applies to ELF inputs.", fname);
+
+            // keep room for one record per input that's still to come.
+            if ((total + fat->num_records + (bincount - i - 1)) > allocated)
+            {
+                allocated = total + fat->num_records + (bincount - i - 1);
+                header = (FATELF_header *) realloc(header, fatelf_header_size(allocated));
+                sources = (glue_source *) realloc(sources, sizeof (glue_source) * allocated);
+                if ((header == NULL) || (sources == NULL))
+                    xfail("Out of memory!");
+            } // if
+
+            for (j = 0; j < fat->num_records; j++)
+            {
+                const FATELF_record *rec = &fat->records[j];
+                const char *target = fatelf_get_target_name(rec, FATELF_WANT_EVERYTHING);
+                glue_source *src = &sources[total];
+                char *name;
+
+                if ((rec->offset > fsize) || (rec->size > (fsize - rec->offset)))
+                    xfail("'%s' is truncated.", fname);
+
+                name = (char *) xmalloc(strlen(fname) + strlen(target) + 4);
+                sprintf(name, "%s (%s)", fname, target);
+                src->input = i;
+                src->name = name;
+                src->offset = rec->offset;
+                src->renamed = 0;
+                header->records[total++] = *rec;
+            } // for
+
+            if (xfind_junk(fname, fd, fat, &thisjunkoffset, &thisjunksize))
+            {
+                if (junkinput == -1)
+                {
+                    junkinput = i;
+                    junkoffset = thisjunkoffset;
+                    junksize = thisjunksize;
+                } // if
+                else if (junk == JUNK_KEEP)
+                {
+                    xfail("'%s' and '%s' both have junk at the end;"
+                          " use --junk=first or --junk=drop.",
+                          bins[junkinput], fname);
+                } // else if
+            } // if
+
+            free(fat);
+        } // if
+        else
+        {
+            FATELF_record *record = &header->records[total];
+            glue_source *src = &sources[total++];
+
+            xread_elf_header(fname, fd, 0, record);
+            if (isas[i] >= 0)
+                record->isa_level = (uint8_t) isas[i];
+            else
+                record->isa_level = xread_elf_isa_level(fname, fd, 0);
+            record->offset = 0;
+            record->size = xget_file_size(fname, fd);
+            src->input = i;
+            src->name = xstrdup(fname);
+            src->offset = 0;
+            src->renamed = ((osabis[i] >= 0) && (osabis[i] != record->osabi));
+            if (osabis[i] >= 0)
+                record->osabi = (uint8_t) osabis[i];
+        } // else
+
+        xclose(fname, fd);
+    } // for
 
     header->magic = FATELF_MAGIC;
-    header->version = FATELF_FORMAT_VERSION;
-    header->num_records = bincount;
+    header->num_records = total;
+    header->reserved0 = 0;
+    header->flags = 0;
+
+    check_duplicates(header, sources);
+    header->version = fatelf_minimum_format_version(header);
+
+    // Identical binaries share one copy, which needs version 2.
+    owners = (int *) xmalloc(sizeof (int) * total);
+    aliases = find_identical_sources(bins, header, sources, owners);
+    if (aliases > 0)
+        header->version = FATELF_FORMAT_VERSION_2;
+
+    // A record only gets another OSABI by sharing the data of one that has
+    //  the ELF header's own OSABI.
+    for (j = 0; j < total; j++)
+    {
+        if (sources[j].renamed && (owners[j] == (int) j))
+        {
+            uint32_t k;
+            for (k = j + 1; k < total; k++)
+            {
+                if (owners[k] == (int) j)
+                    break;
+            } // for
+            if (k == total)
+                xfail("--osabi on '%s' needs the same binary glued in without it, too.", sources[j].name);
+        } // if
+    } // for
 
+    if (junk == JUNK_DROP)
+        junkinput = -1;
+
+    // Every input checks out, so it's safe to clobber the output now.
+    outfd = xopen(out, O_WRONLY | O_CREAT | O_TRUNC, 0755);
+    unlink_on_xfail = out;
+
+    // pad out some bytes for the header we'll write at the end...
+    offset = fatelf_disk_header_size(header->version, total);
+    xwrite_zeros(out, outfd, (size_t) offset);
+
+    // Copy each input's binaries straight from where they sit; the
+    //  records are in input order, so each input is opened once.
     for (i = 0; i < bincount; i++)
     {
-        int j = 0;
-        const uint64_t binary_offset = align_to_page(offset);
         const char *fname = bins[i];
         const int fd = xopen(fname, O_RDONLY, 0755);
-        FATELF_record *record = &header->records[i];
-
-        xread_elf_header(fname, fd, 0, record);
-        record->offset = binary_offset;
 
-        // make sure we don't have a duplicate target.
-        for (j = 0; j < i; j++)
+        for (j = 0; j < total; j++)
         {
-            if (fatelf_record_matches(record, &header->records[j]))
-                xfail("'%s' and '%s' are for the same target.", bins[j], fname);
-        } // for
+            FATELF_record *record = &header->records[j];
+            const uint64_t binary_offset = align_to_page(offset);
+
+            if (sources[j].input != i)
+                continue;
+            else if (owners[j] != (int) j)
+            {
+                // an alias; its owner came earlier, so it's already written.
+                record->offset = header->records[owners[j]].offset;
+                continue;
+            } // else if
 
-        // append this binary to the final file, padded to page alignment.
-        xwrite_zeros(out, outfd, (size_t) (binary_offset - offset));
-        record->size = xcopyfile(fname, fd, out, outfd);
-        offset = binary_offset + record->size;
+            // append this binary to the final file, padded to page alignment.
+            xwrite_zeros(out, outfd, (size_t) (binary_offset - offset));
+            xcopyfile_range(fname, fd, out, outfd, sources[j].offset, record->size);
+            record->offset = binary_offset;
+            offset = binary_offset + record->size;
+        } // for
 
-        // done with this binary!
+        // done with this file!
         xclose(fname, fd);
     } // for
 
+    // Junk is whatever follows the last record, so it goes at the very end.
+    if (junkinput != -1)
+    {
+        const char *fname = bins[junkinput];
+        const int fd = xopen(fname, O_RDONLY, 0755);
+        xcopy_junk(fname, fd, out, outfd, junkoffset, junksize);
+        xclose(fname, fd);
+    } // if
+
     // Write the actual FatELF header now...
     xwrite_fatelf_header(out, outfd, header);
     xclose(out, outfd);
+
+    for (i = 0; i < (int) total; i++)
+        free(sources[i].name);
+    free(sources);
+    free(owners);
     free(header);
 
     unlink_on_xfail = NULL;
@@ -71,10 +383,68 @@ static int fatelf_glue(const char *out, const char **bins, const int bincount)
 
 int main(int argc, const char **argv)
 {
-    xfatelf_init(argc, argv);
+    const char **bins = NULL;
+    int *isas = NULL;
+    int *osabis = NULL;
+    int bincount = 0;
+    int isa = -1;
+    int osabi = -1;
+    junk_policy junk = JUNK_KEEP;
+    int retval = 0;
+    int i;
+
+    xfatelf_init(&argc, argv);
     if (argc < 4)  // this could stand to use getopt(), later.
-        xfail("USAGE: %s <out> <bin1> <bin2> [... binN]", argv[0]);
-    return fatelf_glue(argv[1], &argv[2], argc - 2);
+        xfail("USAGE: %s <out> [--junk=keep|first|drop] [--isa=LEVEL] [--osabi=NAME] <bin1> <bin2> [... binN]", argv[0]);
+
+    bins = (const char **) xmalloc(sizeof (char *) * argc);
+    isas = (int *) xmalloc(sizeof (int) * argc);
+    osabis = (int *) xmalloc(sizeof (int) * argc);
+
+    // --isa=LEVEL and --osabi=NAME apply to the binary that follows them.
+    for (i = 2; i < argc; i++)
+    {
+        if (strncmp(argv[i], "--isa=", 6) == 0)
+        {
+            if ((isa = fatelf_parse_isa_level(argv[i] + 6)) == -1)
+                xfail("Unknown ISA level '%s'", argv[i] + 6);
+        } // if
+        else if (strncmp(argv[i], "--osabi=", 8) == 0)
+        {
+            const fatelf_osabi_info *info = get_osabi_by_name(argv[i] + 8);
+            if (info == NULL)
+                xfail("Unknown OSABI '%s'", argv[i] + 8);
+            osabi = (int) info->id;
+        } // else if
+        else if (strcmp(argv[i], "--junk=keep") == 0)
+            junk = JUNK_KEEP;
+        else if (strcmp(argv[i], "--junk=first") == 0)
+            junk = JUNK_FIRST;
+        else if (strcmp(argv[i], "--junk=drop") == 0)
+            junk = JUNK_DROP;
+        else if (strncmp(argv[i], "--junk=", 7) == 0)
+            xfail("Unknown junk policy '%s'", argv[i] + 7);
+        else
+        {
+            bins[bincount] = argv[i];
+            isas[bincount] = isa;
+            osabis[bincount] = osabi;
+            bincount++;
+            isa = -1;
+            osabi = -1;
+        } // else
+    } // for
+
+    if (isa != -1)
+        xfail("--isa needs to come before a binary.");
+    else if (osabi != -1)
+        xfail("--osabi needs to come before a binary.");
+
+    retval = fatelf_glue(argv[1], bins, isas, osabis, bincount, junk);
+    free(osabis);
+    free(isas);
+    free(bins);
+    return retval;
 } // main
 
 // end of fatelf-glue.c ...
@@ -13,16 +13,43 @@ static int fatelf_info(const char *fname)
 {
     const int fd = xopen(fname, O_RDONLY, 0755);
     FATELF_header *header = xread_fatelf_header(fname, fd);
+    fatelf_merkle_table *merkle = NULL;
+    int *owners = (int *) xmalloc(sizeof (int) * (header->num_records + 1));
+    const uint32_t aliases = fatelf_find_aliases(header, -1, owners);
     unsigned int i = 0;
     uint64_t junkoffset, junksize;
 
     printf("%s: FatELF format version %d\n", fname, (int) header->version);
     printf("%d records.\n", (int) header->num_records);
 
+    if (aliases > 0)
+        printf("%u records share data with another.\n", (unsigned int) aliases);
+
+    if (header->flags & FATELF_FLAG_MERKLE)
+    {
+        const char *err = NULL;
+        merkle = fatelf_read_merkle_table(fd, header, xget_file_size(fname, fd), &err);
+        if (merkle != NULL)
+            printf("Records have Merkle trees, in %u byte blocks.\n", 1u << merkle->block_log2);
+        else
+            printf("Records have Merkle trees, but '%s' %s.\n", fname, err);
+    } // if
+
     if (xfind_junk(fname, fd, header, &junkoffset, &junksize))
     {
+        const char *err = NULL;
+        fatelf_resource_table *table = fatelf_read_resource_table(fd, junkoffset + junksize, &err);
         printf("%llu bytes of junk appended, starting at offset %llu.\n",
                (unsigned long long) junksize, (unsigned long long) junkoffset);
+        if (table != NULL)
+        {
+            printf("%u named resources in the last %llu bytes of junk.\n",
+                   (unsigned int) table->num_resources,
+                   (unsigned long long) table->region_size);
+        } // if
+        else if (err != NULL)
+            printf("Junk ends in a resource table, but '%s' %s.\n", fname, err);
+        free(table);
     } // if
 
     for (i = 0; i < header->num_records; i++)
@@ -30,6 +57,7 @@ static int fatelf_info(const char *fname)
         const FATELF_record *rec = &header->records[i];
         const fatelf_machine_info *machine = get_machine_by_id(rec->machine);
         const fatelf_osabi_info *osabi = get_osabi_by_id(rec->osabi);
+        const fatelf_isa_info *isa = get_isa_by_level(rec->machine, rec->isa_level);
 
         printf("Binary at index #%d:\n", i);
         printf("  OSABI %u (%s%s%s) version %u,\n",
@@ -41,13 +69,31 @@ static int fatelf_info(const char *fname)
         printf("  Machine %u (%s%s%s)\n",
                 (unsigned int) rec->machine, machine ? machine->name : "???",
                 machine ? ": " : "", machine ? machine->desc : "");
+        if (rec->isa_level != FATELF_ISA_BASELINE)
+        {
+            printf("  ISA level %u (%s%s%s)\n",
+                    (unsigned int) rec->isa_level, isa ? isa->name : "???",
+                    isa ? ": " : "", isa ? isa->desc : "");
+        } // if
         printf("  Offset %llu\n", (unsigned long long) rec->offset);
         printf("  Size %llu\n", (unsigned long long) rec->size);
+        if (owners[i] != (int) i)
+            printf("  Shares its data with index #%d\n", owners[i]);
         printf("  Target name: '%s' or 'record%u'\n",
                fatelf_get_target_name(rec, FATELF_WANT_EVERYTHING), i);
+        if (merkle != NULL)
+        {
+            unsigned int j;
+            printf("  Merkle root ");
+            for (j = 0; j < FATELF_SHA256_SIZE; j++)
+                printf("%02x", (unsigned int) merkle->trees[i].root[j]);
+            printf(", tree at offset %llu\n", (unsigned long long) merkle->trees[i].offset);
+        } // if
     } // for
 
     xclose(fname, fd);
+    free(merkle);
+    free(owners);
     free(header);
 
     return 0;  // success.
@@ -56,7 +102,7 @@ static int fatelf_info(const char *fname)
 
 int main(int argc, const char **argv)
 {
-    xfatelf_init(argc, argv);
+    xfatelf_init(&argc, argv);
     if (argc != 2)  // this could stand to use getopt(), later.
         xfail("USAGE: %s <fname>", argv[0]);
     return fatelf_info(argv[1]);
@@ -0,0 +1,304 @@
+/**
+ * FatELF; support multiple ELF binaries in one file.
+ *
+ * Please see the file LICENSE.txt in the source's root directory.
+ *
+ *  This file written by Ryan C. Gordon.
+ */
+
+// This adds per-record Merkle trees to a FatELF file, and checks records
+//  (or parts of them) against them. With trees, a loader can verify just
+//  the pages it maps instead of hashing a whole record before it runs it.
+//  Trees for all the records are built in parallel.
+
+#define FATELF_UTILS 1
+#include "fatelf-utils.h"
+
+typedef struct merkle_job
+{
+    const char *fname;
+    int fd;
+    const FATELF_header *header;
+    int recidx;
+    int owner;  // add only: the record whose data this one shares.
+    uint8_t *tree;
+    uint64_t treesize;
+    uint8_t root[FATELF_SHA256_SIZE];
+    const char *err;  // verify only.
+} merkle_job;
+
+typedef struct merkle_options
+{
+    int threads;
+    uint8_t block_log2;
+} merkle_options;
+
+static merkle_options options = { 0, 12 };
+
+
+static void build_worker(void *data, const int idx)
+{
+    merkle_job *job = ((merkle_job *) data) + idx;
+    const FATELF_record *rec = &job->header->records[job->recidx];
+    if (job->owner != job->recidx)
+        return;  // an alias gets its owner's tree.
+    job->tree = xbuild_merkle_tree(job->fname, job->fd, rec->offset, rec->size,
+                                   options.block_log2, job->root, &job->treesize);
+} // build_worker
+
+
+static int fatelf_merkle_add(const char *out, const char *fname)
+{
+    const int fd = xopen(fname, O_RDONLY, 0755);
+    FATELF_header *header = xread_fatelf_header(fname, fd);
+    const uint32_t count = header->num_records;
+    uint64_t junkoffset = 0, junksize = 0;
+    const int hasjunk = xfind_junk(fname, fd, header, &junkoffset, &junksize);
+    merkle_job *jobs = (merkle_job *) xmalloc(sizeof (merkle_job) * (count + 1));
+    int *owners = (int *) xmalloc(sizeof (int) * (count + 1));
+    fatelf_merkle_table *table = NULL;
+    uint8_t *buf = NULL;
+    size_t buflen = 0;
+    uint64_t offset = 0;
+    int outfd = -1;
+    uint32_t i;
+
+    // Trees only fit in version 2 headers, which are sorted on disk; sort
+    //  ours now so the trees line up with the records.
+    header->version = FATELF_FORMAT_VERSION_2;
+    fatelf_sort_records(header->records, count);
+    fatelf_find_aliases(header, -1, owners);
+
+    for (i = 0; i < count; i++)
+    {
+        memset(&jobs[i], '\0', sizeof (merkle_job));
+        jobs[i].fname = fname;
+        jobs[i].fd = fd;
+        jobs[i].header = header;
+        jobs[i].recidx = (int) i;
+        jobs[i].owner = owners[i];
+    } // for
+    fatelf_parallel_for((int) count, options.threads, build_worker, jobs);
+
+    // Aliases share their data, but each record still has its own tree.
+    for (i = 0; i < count; i++)
+    {
+        const merkle_job *owner = &jobs[owners[i]];
+        if (owners[i] != (int) i)
+        {
+            memcpy(jobs[i].root, owner->root, FATELF_SHA256_SIZE);
+            jobs[i].treesize = owner->treesize;
+            jobs[i].tree = owner->tree;
+        } // if
+    } // for
+
+    table = (fatelf_merkle_table *) xmalloc(sizeof (fatelf_merkle_table) + (sizeof (fatelf_merkle_tree) * (count + 1)));
+    table->hash_type = FATELF_MERKLE_HASH_SHA256;
+    table->block_log2 = options.block_log2;
+    table->num_trees = count;
+    table->trees = (fatelf_merkle_tree *) (table + 1);
+
+    outfd = xopen(out, O_WRONLY | O_CREAT | O_TRUNC, 0755);
+    unlink_on_xfail = out;
+
+    // Header, tree table, trees, then the records; everything moves.
+    offset = fatelf_disk_header_size(header->version, count) + FATELF_MERKLE_TABLE_SIZE(count);
+    xwrite_zeros(out, outfd, (size_t) offset);
+
+    for (i = 0; i < count; i++)
+    {
+        fatelf_merkle_tree *tree = &table->trees[i];
+        memcpy(tree->root, jobs[i].root, FATELF_SHA256_SIZE);
+        tree->size = jobs[i].treesize;
+        tree->offset = 0;
+        if (tree->size > 0)
+        {
+            tree->offset = align_to_page(offset);
+            xwrite_zeros(out, outfd, (size_t) (tree->offset - offset));
+            xwrite(out, outfd, jobs[i].tree, (size_t) tree->size);
+            offset = tree->offset + tree->size;
+        } // if
+    } // for
+
+    for (i = 0; i < count; i++)
+    {
+        if (owners[i] == (int) i)
+            free(jobs[i].tree);
+    } // for
+
+    for (i = 0; i < count; i++)
+    {
+        const uint64_t binary_offset = align_to_page(offset);
+        FATELF_record *rec = &header->records[i];
+
+        if (owners[i] != (int) i)  // shares data we already wrote?
+        {
+            rec->offset = header->records[owners[i]].offset;
+            continue;
+        } // if
+
+        // append this binary to the final file, padded to page alignment.
+        xwrite_zeros(out, outfd, (size_t) (binary_offset - offset));
+        xcopyfile_range(fname, fd, out, outfd, rec->offset, rec->size);
+
+        rec->offset = binary_offset;
+        offset = binary_offset + rec->size;
+    } // for
+
+    if (hasjunk)
+        xcopy_junk(fname, fd, out, outfd, junkoffset, junksize);
+
+    // Write the actual FatELF header and tree table now.
+    buf = fatelf_encode_merkle_header(header, table, &buflen);
+    xlseek(out, outfd, 0, SEEK_SET);
+    xwrite(out, outfd, buf, buflen);
+
+    xclose(out, outfd);
+    xclose(fname, fd);
+    unlink_on_xfail = NULL;
+
+    free(buf);
+    free(table);
+    free(owners);
+    free(jobs);
+    free(header);
+    return 0;  // success.
+} // fatelf_merkle_add
+
+
+static void verify_worker(void *data, const int idx)
+{
+    merkle_job *job = ((merkle_job *) data) + idx;
+    const char *err = NULL;
+    fatelf_merkle_verifier *verifier = fatelf_open_merkle_verifier(job->fd, job->header,
+                                           xget_file_size(job->fname, job->fd), job->recidx, &err);
+    if (verifier == NULL)
+        job->err = err ? err : "has no Merkle trees";
+    else
+    {
+        job->err = fatelf_merkle_verify_range(verifier, 0, job->header->records[job->recidx].size);
+        fatelf_close_merkle_verifier(verifier);
+    } // else
+} // verify_worker
+
+
+static uint64_t parse_u64(const char *str)
+{
+    char *endptr = NULL;
+    const unsigned long long val = strtoull(str, &endptr, 0);
+    if ((*str == '\0') || (*endptr != '\0'))
+        xfail("'%s' isn't a number", str);
+    return (uint64_t) val;
+} // parse_u64
+
+
+static int fatelf_merkle_verify(const char *fname, const char *target,
+                                const char *offsetstr, const char *sizestr)
+{
+    const int fd = xopen(fname, O_RDONLY, 0755);
+    FATELF_header *header = xread_fatelf_header(fname, fd);
+    const uint32_t count = header->num_records;
+    merkle_job *jobs = (merkle_job *) xmalloc(sizeof (merkle_job) * (count + 1));
+    const int only = target ? xfind_fatelf_record(header, target) : -1;
+    int failed = 0;
+    uint32_t i;
+
+    if (!(header->flags & FATELF_FLAG_MERKLE))
+        xfail("'%s' has no Merkle trees", fname);
+    else if ((target != NULL) && (only < 0))
+        xfail("No record matches '%s' in FatELF file '%s'", target, fname);
+
+    // Just a range of one record.
+    if (offsetstr != NULL)
+    {
+        const uint64_t offset = parse_u64(offsetstr);
+        const uint64_t size = parse_u64(sizestr);
+        const char *err = NULL;
+        fatelf_merkle_verifier *verifier = fatelf_open_merkle_verifier(fd, header, xget_file_size(fname, fd), only, &err);
+        if (verifier == NULL)
+            xfail("'%s' %s", fname, err);
+        else if ((err = fatelf_merkle_verify_range(verifier, offset, size)) != NULL)
+            xfail("'%s' record #%d %s", fname, only, err);
+        printf("record #%d ('%s'): bytes %llu to %llu ok\n", only,
+               fatelf_get_target_name(&header->records[only], FATELF_WANT_EVERYTHING),
+               (unsigned long long) offset, (unsigned long long) (offset + size));
+        fatelf_close_merkle_verifier(verifier);
+        xclose(fname, fd);
+        free(jobs);
+        free(header);
+        return 0;
+    } // if
+
+    for (i = 0; i < count; i++)
+    {
+        memset(&jobs[i], '\0', sizeof (merkle_job));
+        jobs[i].fname = fname;
+        jobs[i].fd = fd;
+        jobs[i].header = header;
+        jobs[i].recidx = (only >= 0) ? only : (int) i;
+    } // for
+    fatelf_parallel_for((only >= 0) ? 1 : (int) count, options.threads, verify_worker, jobs);
+
+    for (i = 0; i < ((only >= 0) ? 1 : count); i++)
+    {
+        const int idx = jobs[i].recidx;
+        printf("record #%d ('%s'): %s\n", idx,
+               fatelf_get_target_name(&header->records[idx], FATELF_WANT_EVERYTHING),
+               jobs[i].err ? jobs[i].err : "ok");
+        if (jobs[i].err != NULL)
+            failed = 1;
+    } // for
+
+    xclose(fname, fd);
+    free(jobs);
+    free(header);
+
+    if (failed)
+        xfail("'%s' failed verification", fname);
+    return 0;
+} // fatelf_merkle_verify
+
+
+int main(int argc, const char **argv)
+{
+    const char *usage = "USAGE: %s [--jobs=N] [--block-size=N] add <out> <in>\n"
+                        "       %s [--jobs=N] verify <in> [<target> [<offset> <size>]]";
+    int i = 1;
+
+    xfatelf_init(&argc, argv);
+
+    while ((i < argc) && (strncmp(argv[i], "--", 2) == 0))
+    {
+        if (strncmp(argv[i], "--jobs=", 7) == 0)
+            options.threads = atoi(argv[i] + 7);
+        else if (strncmp(argv[i], "--block-size=", 13) == 0)
+        {
+            const uint64_t size = parse_u64(argv[i] + 13);
+            for (options.block_log2 = FATELF_MERKLE_MIN_BLOCK_LOG2; options.block_log2 <= FATELF_MERKLE_MAX_BLOCK_LOG2; options.block_log2++)
+            {
+                if (size == (((uint64_t) 1) << options.block_log2))
+                    break;
+            } // for
+            if (options.block_log2 > FATELF_MERKLE_MAX_BLOCK_LOG2)
+                xfail("Block size must be a power of two from 1024 to 65536");
+        } // else if
+        else
+            xfail("Unknown option '%s'", argv[i]);
+        i++;
+    } // while
+
+    if ((i < argc) && (strcmp(argv[i], "add") == 0) && (argc == i + 3))
+        return fatelf_merkle_add(argv[i + 1], argv[i + 2]);
+    else if ((i < argc) && (strcmp(argv[i], "verify") == 0) && (argc == i + 2))
+        return fatelf_merkle_verify(argv[i + 1], NULL, NULL, NULL);
+    else if ((i < argc) && (strcmp(argv[i], "verify") == 0) && (argc == i + 3))
+        return fatelf_merkle_verify(argv[i + 1], argv[i + 2], NULL, NULL);
+    else if ((i < argc) && (strcmp(argv[i], "verify") == 0) && (argc == i + 5))
+        return fatelf_merkle_verify(argv[i + 1], argv[i + 2], argv[i + 3], argv[i + 4]);
+
+    // this could stand to use getopt(), later.
+    xfail(usage, argv[0], argv[0]);
+    return 1;
+} // main
+
+// end of fatelf-merkle.c ...
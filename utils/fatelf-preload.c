@@ -0,0 +1,464 @@
+/**
+ * FatELF; support multiple ELF binaries in one file.
+ *
+ * Please see the file LICENSE.txt in the source's root directory.
+ *
+ *  This file written by Ryan C. Gordon.
+ */
+
+// This lets a stock glibc load FatELF shared libraries. It works two ways,
+//  and the same .so does both:
+//
+//  - LD_AUDIT=libfatelf-preload.so: the dynamic loader asks la_objsearch()
+//    about every path it tries, for DT_NEEDED entries and dlopen() alike, so
+//    this catches everything. This is the supported way to use it.
+//  - LD_PRELOAD=libfatelf-preload.so: we interpose dlopen(), but only step
+//    in when the path has a '/' in it. A bare name is searched for by the
+//    loader itself, and DT_NEEDED never goes through libc at all.
+//
+// When a path is a FatELF file, the record that best fits this machine is
+//  copied out, and the loader gets that instead. By default, the copy goes
+//  to a memfd for the life of the process. If FATELF_CACHE_DIR is set, the
+//  copies go there instead, named by the fat file's device, inode, mtime and
+//  size (and the host's machine and ISA level), and every process after the
+//  first uses the existing copy instead of making another. The directory and
+//  the copy have to be ours and nobody else's to write, and the copy has to
+//  be the record's size, or we don't trust it: anyone who could plant a
+//  library there could run code in every process that uses the cache.
+//  If the fat file has Merkle trees, every block is verified as it's
+//  copied, a cached copy is verified again before each use, and a record
+//  that fails is never handed to the loader.
+//
+// This is loaded into arbitrary processes, so nothing here may exit() or
+//  print; on any trouble, we hand the loader the original path and let it
+//  fail however it would have anyhow. That goes for the fatelf-utils code
+//  we call, too: only the functions that return an error instead of calling
+//  xfail() (fatelf_decode_header(), fatelf_open_merkle_verifier(), etc).
+
+#define _GNU_SOURCE 1
+#define FATELF_UTILS 1
+#include "fatelf-utils.h"
+
+#include <dlfcn.h>
+#include <link.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+
+#define FATELF_EXPORT __attribute__((visibility("default")))
+
+typedef struct thin_library
+{
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    off_t size;
+    char *path;  // never freed, la_objsearch() hands it to the loader.
+} thin_library;
+
+static pthread_mutex_t thin_lock = PTHREAD_MUTEX_INITIALIZER;
+static thin_library *thin_libraries = NULL;
+static int thin_count = 0;
+
+
+static int read_fully(const int fd, void *buf, const size_t len,
+                      const uint64_t offset)
+{
+    uint8_t *ptr = (uint8_t *) buf;
+    size_t remaining = len;
+    uint64_t pos = offset;
+    while (remaining > 0)
+    {
+        const ssize_t rc = pread(fd, ptr, remaining, (off_t) pos);
+        if ((rc < 0) && (errno == EINTR))
+            continue;
+        else if (rc <= 0)
+            return 0;
+        ptr += rc;
+        pos += rc;
+        remaining -= rc;
+    } // while
+    return 1;
+} // read_fully
+
+
+// NULL if this isn't a FatELF file we can use.
+static FATELF_header *read_header(const int fd, const uint64_t fsize)
+{
+    FATELF_header *header = NULL;
+    const char *err = NULL;
+    uint8_t buf[16];
+    uint8_t *fullbuf = NULL;
+    size_t buflen = 0;
+
+    if (fsize < sizeof (buf))
+        return NULL;
+    else if (!read_fully(fd, buf, sizeof (buf), 0))
+        return NULL;
+    else if ((buflen = fatelf_decode_header_size(buf, sizeof (buf), &err)) == 0)
+        return NULL;
+    else if (buflen > fsize)
+        return NULL;
+    else if ((fullbuf = (uint8_t *) malloc(buflen)) == NULL)
+        return NULL;
+
+    if (read_fully(fd, fullbuf, buflen, 0))
+        header = fatelf_decode_header(fullbuf, buflen, &err);
+    free(fullbuf);
+    return header;
+} // read_header
+
+
+// Copy through a buffer, so each block can be checked before it's written.
+static int copy_verified(const int infd, const int outfd,
+                         fatelf_merkle_verifier *verifier)
+{
+    const uint64_t buflen = ((uint64_t) verifier->block_size) * 64;
+    uint64_t pos = 0;
+    while (pos < verifier->rec_size)
+    {
+        const uint64_t count = (verifier->rec_size - pos) < buflen ? (verifier->rec_size - pos) : buflen;
+        const uint8_t *ptr = verifier->buf;
+        size_t remaining = (size_t) count;
+
+        if (!read_fully(infd, verifier->buf, (size_t) count, verifier->rec_offset + pos))
+            return 0;
+        else if (fatelf_merkle_verify_data(verifier, pos, verifier->buf, count) != NULL)
+            return 0;
+
+        while (remaining > 0)
+        {
+            const ssize_t rc = write(outfd, ptr, remaining);
+            if ((rc < 0) && (errno == EINTR))
+                continue;
+            else if (rc <= 0)
+                return 0;
+            ptr += rc;
+            remaining -= rc;
+        } // while
+        pos += count;
+    } // while
+    return 1;
+} // copy_verified
+
+
+static int copy_record(const int infd, const int outfd,
+                       const FATELF_record *rec,
+                       fatelf_merkle_verifier *verifier)
+{
+    off_t offset = (off_t) rec->offset;
+    uint64_t remaining = rec->size;
+
+    if (verifier != NULL)
+        return copy_verified(infd, outfd, verifier);
+
+    while (remaining > 0)
+    {
+        const size_t len = (remaining > 0x40000000) ? 0x40000000 : (size_t) remaining;
+        const ssize_t rc = sendfile(outfd, infd, &offset, len);
+        if ((rc < 0) && (errno == EINTR))
+            continue;
+        else if (rc <= 0)
+            return 0;
+        remaining -= rc;
+    } // while
+    return 1;
+} // copy_record
+
+
+static char *extract_to_memfd(const int fd, const FATELF_record *rec,
+                              fatelf_merkle_verifier *verifier)
+{
+    const int memfd = memfd_create("fatelf", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    char path[64];
+
+    if (memfd == -1)
+        return NULL;
+    else if (!copy_record(fd, memfd, rec, verifier))
+    {
+        close(memfd);
+        return NULL;
+    } // else if
+
+    // Nothing should change this under the loader. We keep the fd open
+    //  forever, so the path stays good for later dlopen()s of the same file.
+    fcntl(memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL);
+    snprintf(path, sizeof (path), "/proc/self/fd/%d", memfd);
+    return strdup(path);
+} // extract_to_memfd
+
+
+// The record we pick only depends on the fat file and this machine, so the
+//  cache name covers both.
+static char *make_cache_path(const char *dir, const struct stat *statbuf)
+{
+    static int hostlevel = -1;
+    const size_t len = strlen(dir) + 128;
+    char *path = (char *) malloc(len);
+    FATELF_record host;
+
+    if (path == NULL)
+        return NULL;
+    else if (!fatelf_get_host_record(&host))
+        host.machine = 0;
+
+    if (hostlevel == -1)  // CPUID isn't free, just do it once.
+        hostlevel = (int) fatelf_get_host_isa_level(host.machine);
+
+    snprintf(path, len, "%s/%llx-%llx-%lld.%09ld-%llx-%u-%d.so", dir,
+             (unsigned long long) statbuf->st_dev,
+             (unsigned long long) statbuf->st_ino,
+             (long long) statbuf->st_mtim.tv_sec,
+             (long) statbuf->st_mtim.tv_nsec,
+             (unsigned long long) statbuf->st_size,
+             (unsigned int) host.machine, hostlevel);
+    return path;
+} // make_cache_path
+
+
+// Only we may write to it; anything else and the cache isn't used at all.
+static int cache_dir_ok(const char *dir)
+{
+    struct stat statbuf;
+    int fd = -1;
+    int retval = 0;
+
+    mkdir(dir, 0700);
+    if ((fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1)
+        return 0;
+    else if (fstat(fd, &statbuf) == 0)
+    {
+        retval = (S_ISDIR(statbuf.st_mode) && (statbuf.st_uid == geteuid()) &&
+                  ((statbuf.st_mode & (S_IWGRP | S_IWOTH)) == 0));
+    } // else if
+    close(fd);
+    return retval;
+} // cache_dir_ok
+
+
+// An earlier process's copy of (rec), if it's ours, nobody else can write
+//  it, and it's the right size. With a Merkle tree, it has to match that,
+//  too, since the tree is the only thing that says what the record holds.
+static int cached_copy_ok(const char *path, const FATELF_record *rec,
+                          fatelf_merkle_verifier *verifier)
+{
+    const int fd = open(path, O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+    struct stat statbuf;
+    uint64_t pos = 0;
+    int retval = 0;
+
+    if (fd == -1)
+        return 0;
+    else if (fstat(fd, &statbuf) == 0)
+    {
+        retval = (S_ISREG(statbuf.st_mode) && (statbuf.st_uid == geteuid()) &&
+                  ((statbuf.st_mode & (S_IWGRP | S_IWOTH)) == 0) &&
+                  (((uint64_t) statbuf.st_size) == rec->size));
+    } // else if
+
+    if ((retval) && (verifier != NULL))
+    {
+        const uint64_t buflen = ((uint64_t) verifier->block_size) * 64;
+        while ((retval) && (pos < rec->size))
+        {
+            const uint64_t count = (rec->size - pos) < buflen ? (rec->size - pos) : buflen;
+            if (!read_fully(fd, verifier->buf, (size_t) count, pos))
+                retval = 0;
+            else if (fatelf_merkle_verify_data(verifier, pos, verifier->buf, count) != NULL)
+                retval = 0;
+            pos += count;
+        } // while
+    } // if
+
+    close(fd);
+    return retval;
+} // cached_copy_ok
+
+
+static int extract_to_cache(const char *dir, const char *path, const int fd,
+                            const FATELF_record *rec,
+                            fatelf_merkle_verifier *verifier)
+{
+    const size_t len = strlen(dir) + 16;
+    char *tmppath = (char *) malloc(len);
+    int tmpfd = -1;
+
+    if (tmppath == NULL)
+        return 0;
+
+    // Write to a temp file and rename it into place, so other processes
+    //  never see half a library.
+    snprintf(tmppath, len, "%s/.tmp-XXXXXX", dir);
+    if ((tmpfd = mkostemp(tmppath, O_CLOEXEC)) == -1)
+    {
+        free(tmppath);
+        return 0;
+    } // if
+
+    if ((!copy_record(fd, tmpfd, rec, verifier)) || (fchmod(tmpfd, 0600) == -1))
+    {
+        close(tmpfd);
+        unlink(tmppath);
+        free(tmppath);
+        return 0;
+    } // if
+    else if ((close(tmpfd) == -1) || (rename(tmppath, path) == -1))
+    {
+        unlink(tmppath);
+        free(tmppath);
+        return 0;
+    } // else if
+
+    free(tmppath);
+    return 1;
+} // extract_to_cache
+
+
+// Pick a record and copy it somewhere the loader can open. NULL on failure.
+static char *extract_thin_library(const int fd, const struct stat *statbuf,
+                                  const char *dir, char *cachepath)
+{
+    FATELF_header *header = read_header(fd, (uint64_t) statbuf->st_size);
+    const int idx = (header == NULL) ? -1 : fatelf_find_host_record(header);
+    const FATELF_record *rec = (idx < 0) ? NULL : &header->records[idx];
+    fatelf_merkle_verifier *verifier = NULL;
+    const char *err = NULL;
+    char *retval = NULL;
+
+    if (rec != NULL)
+        verifier = fatelf_open_merkle_verifier(fd, header, (uint64_t) statbuf->st_size, idx, &err);
+
+    // a truncated or corrupt file gets no help; let the loader choke on it.
+    if ((rec != NULL) && (err == NULL) && ((rec->offset + rec->size) <= ((uint64_t) statbuf->st_size)))
+    {
+        if ((cachepath != NULL) && (cached_copy_ok(cachepath, rec, verifier)))
+            retval = strdup(cachepath);  // someone already did the work.
+        else if ((cachepath != NULL) && (extract_to_cache(dir, cachepath, fd, rec, verifier)))
+            retval = strdup(cachepath);
+        else
+            retval = extract_to_memfd(fd, rec, verifier);
+    } // if
+
+    fatelf_close_merkle_verifier(verifier);
+    free(header);
+    return retval;
+} // extract_thin_library
+
+
+// Returns the path the loader should use instead of (path), or NULL to use
+//  (path) as-is. The returned string lives forever.
+static const char *resolve_fatelf(const char *path)
+{
+    static const uint8_t magic[4] = {
+        (FATELF_MAGIC & 0xFF), ((FATELF_MAGIC >> 8) & 0xFF),
+        ((FATELF_MAGIC >> 16) & 0xFF), ((FATELF_MAGIC >> 24) & 0xFF)
+    };
+    const char *dir = getenv("FATELF_CACHE_DIR");
+    const char *retval = NULL;
+    char *cachepath = NULL;
+    char *thin = NULL;
+    thin_library *ptr = NULL;
+    struct stat statbuf;
+    uint8_t buf[4];
+    int fd = -1;
+    int i;
+
+    if ((fd = open(path, O_RDONLY | O_CLOEXEC)) == -1)
+        return NULL;  // the loader will try the next path, like always.
+    else if ((fstat(fd, &statbuf) == -1) || (!S_ISREG(statbuf.st_mode)))
+    {
+        close(fd);
+        return NULL;
+    } // else if
+    else if ((!read_fully(fd, buf, sizeof (buf), 0)) || (memcmp(buf, magic, 4) != 0))
+    {
+        close(fd);
+        return NULL;  // not FatELF; this is the common case.
+    } // else if
+
+    pthread_mutex_lock(&thin_lock);
+
+    for (i = 0; i < thin_count; i++)
+    {
+        const thin_library *lib = &thin_libraries[i];
+        if ( (lib->dev == statbuf.st_dev) && (lib->ino == statbuf.st_ino) &&
+             (lib->size == statbuf.st_size) &&
+             (lib->mtime.tv_sec == statbuf.st_mtim.tv_sec) &&
+             (lib->mtime.tv_nsec == statbuf.st_mtim.tv_nsec) )
+        {
+            retval = lib->path;
+            break;
+        } // if
+    } // for
+
+    if (retval == NULL)
+    {
+        if ((dir != NULL) && (*dir != '\0') && (cache_dir_ok(dir)))
+            cachepath = make_cache_path(dir, &statbuf);
+        thin = extract_thin_library(fd, &statbuf, dir, cachepath);
+
+        ptr = (thin == NULL) ? NULL : (thin_library *) realloc(thin_libraries, sizeof (thin_library) * (thin_count + 1));
+        if (ptr == NULL)
+            free(thin);
+        else
+        {
+            thin_libraries = ptr;
+            ptr = &thin_libraries[thin_count++];
+            ptr->dev = statbuf.st_dev;
+            ptr->ino = statbuf.st_ino;
+            ptr->mtime = statbuf.st_mtim;
+            ptr->size = statbuf.st_size;
+            ptr->path = thin;
+            retval = thin;
+        } // else
+    } // if
+
+    pthread_mutex_unlock(&thin_lock);
+
+    free(cachepath);
+    close(fd);
+    return retval;
+} // resolve_fatelf
+
+
+// LD_AUDIT interface...
+
+FATELF_EXPORT unsigned int la_version(unsigned int version)
+{
+    return (version < LAV_CURRENT) ? version : LAV_CURRENT;
+} // la_version
+
+
+FATELF_EXPORT char *la_objsearch(const char *name, uintptr_t *cookie,
+                                 unsigned int flag)
+{
+    const char *thin = NULL;
+    if (strchr(name, '/') != NULL)  // bare names come back as paths later.
+        thin = resolve_fatelf(name);
+    return (char *) ((thin != NULL) ? thin : name);
+} // la_objsearch
+
+
+// LD_PRELOAD interface...
+
+FATELF_EXPORT void *dlopen(const char *fname, int flags)
+{
+    typedef void *(*dlopen_fn)(const char *fname, int flags);
+    static dlopen_fn real_dlopen = NULL;
+    const char *thin = NULL;
+
+    if (real_dlopen == NULL)
+        real_dlopen = (dlopen_fn) dlsym(RTLD_NEXT, "dlopen");
+    if (real_dlopen == NULL)
+        return NULL;
+
+    if ((fname != NULL) && (strchr(fname, '/') != NULL))
+        thin = resolve_fatelf(fname);
+
+    return real_dlopen((thin != NULL) ? thin : fname, flags);
+} // dlopen
+
+// end of fatelf-preload.c ...
+
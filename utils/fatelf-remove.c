@@ -16,24 +16,36 @@ static int fatelf_remove(const char *out, const char *fname,
     FATELF_header *header = xread_fatelf_header(fname, fd);
     const int idx = xfind_fatelf_record(header, target);
     const int outfd = xopen(out, O_WRONLY | O_CREAT | O_TRUNC, 0755);
-    uint64_t offset = FATELF_DISK_FORMAT_SIZE(((int)header->num_records));
+    uint64_t offset = fatelf_disk_header_size(header->version, header->num_records);
+    uint64_t junkoffset = 0, junksize = 0;
+    const int hasjunk = xfind_junk(fname, fd, header, &junkoffset, &junksize);
+    int *owners = (int *) xmalloc(sizeof (int) * (header->num_records + 1));
     int i;
 
     unlink_on_xfail = out;
 
+    if (idx < 0)
+        xfail("No record matches '%s' in FatELF file '%s'", target, fname);
+
+    // Records that share data with the one we're removing keep it.
+    fatelf_find_aliases(header, idx, owners);
+    xcheck_lone_aliases(fname, fd, header, idx, owners);
+
     // pad out some bytes for the header we'll write at the end...
     xwrite_zeros(out, outfd, (size_t) offset);
 
     for (i = 0; i < ((int) header->num_records); i++)
     {
-        if (i != idx)  // not the thing we're removing?
+        if ((i != idx) && (owners[i] != i))  // shares data we already wrote?
+            header->records[i].offset = header->records[owners[i]].offset;
+        else if (i != idx)  // not the thing we're removing?
         {
             const uint64_t binary_offset = align_to_page(offset);
             FATELF_record *rec = &header->records[i];
 
             // append this binary to the final file, padded to page alignment.
             xwrite_zeros(out, outfd, (size_t) (binary_offset - offset));
-            xcopyfile_range(fname, fd, out, outfd, binary_offset, rec->size);
+            xcopyfile_range(fname, fd, out, outfd, rec->offset, rec->size);
 
             rec->offset = binary_offset;
             offset = binary_offset + rec->size;
@@ -50,13 +62,15 @@ static int fatelf_remove(const char *out, const char *fname,
         memmove(dst, src, sizeof (FATELF_record) * count);
     } // if
 
-    xappend_junk(fname, fd, out, outfd, header);
+    if (hasjunk)
+        xcopy_junk(fname, fd, out, outfd, junkoffset, junksize);
 
     // Write the actual FatELF header now...
     xwrite_fatelf_header(out, outfd, header);
 
     xclose(out, outfd);
     xclose(fname, fd);
+    free(owners);
     free(header);
 
     unlink_on_xfail = NULL;
@@ -67,7 +81,7 @@ static int fatelf_remove(const char *out, const char *fname,
 
 int main(int argc, const char **argv)
 {
-    xfatelf_init(argc, argv);
+    xfatelf_init(&argc, argv);
     if (argc != 4)  // this could stand to use getopt(), later.
         xfail("USAGE: %s <out> <in> <target>", argv[0]);
     return fatelf_remove(argv[1], argv[2], argv[3]);
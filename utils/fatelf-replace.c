@@ -17,11 +17,9 @@ static int xfind_fatelf_record_by_elf(const char *fname, const int fd,
     int i;
 
     xread_elf_header(fname, fd, 0, &record);
-    for (i = 0; i < ((int)header->num_records); i++)
-    {
-        if (fatelf_record_matches(&header->records[i], &record))
-            return i;
-    } // for
+    record.isa_level = xread_elf_isa_level(fname, fd, 0);
+    if ((i = fatelf_find_matching_record(header, &record)) >= 0)
+        return i;
 
     xfail("No record matches '%s' in FatELF file '%s'", fname, fatfname);
     return -1;
@@ -36,11 +34,18 @@ static int fatelf_replace(const char *out, const char *fname,
     FATELF_header *header = xread_fatelf_header(fname, fd);
     const int idx = xfind_fatelf_record_by_elf(newobj, newfd, fname, header);
     const int outfd = xopen(out, O_WRONLY | O_CREAT | O_TRUNC, 0755);
-    uint64_t offset = FATELF_DISK_FORMAT_SIZE(((int)header->num_records));
+    uint64_t offset = fatelf_disk_header_size(header->version, header->num_records);
+    uint64_t junkoffset = 0, junksize = 0;
+    const int hasjunk = xfind_junk(fname, fd, header, &junkoffset, &junksize);
+    int *owners = (int *) xmalloc(sizeof (int) * (header->num_records + 1));
     int i;
 
     unlink_on_xfail = out;
 
+    // Records that share data with the one we're replacing keep the old data.
+    fatelf_find_aliases(header, idx, owners);
+    xcheck_lone_aliases(fname, fd, header, idx, owners);
+
     // pad out some bytes for the header we'll write at the end...
     xwrite_zeros(out, outfd, (size_t) offset);
 
@@ -49,19 +54,26 @@ static int fatelf_replace(const char *out, const char *fname,
         const uint64_t binary_offset = align_to_page(offset);
         FATELF_record *rec = &header->records[i];
 
+        if ((i != idx) && (owners[i] != i))  // shares data we already wrote?
+        {
+            rec->offset = header->records[owners[i]].offset;
+            continue;
+        } // if
+
         // append this binary to the final file, padded to page alignment.
         xwrite_zeros(out, outfd, (size_t) (binary_offset - offset));
 
         if (i == idx)  // the thing we're replacing...
             rec->size = xcopyfile(newobj, newfd, out, outfd);
         else
-            xcopyfile_range(fname, fd, out, outfd, binary_offset, rec->size);
+            xcopyfile_range(fname, fd, out, outfd, rec->offset, rec->size);
 
         rec->offset = binary_offset;
         offset = binary_offset + rec->size;
     } // for
 
-    xappend_junk(fname, fd, out, outfd, header);
+    if (hasjunk)
+        xcopy_junk(fname, fd, out, outfd, junkoffset, junksize);
 
     // Write the actual FatELF header now...
     xwrite_fatelf_header(out, outfd, header);
@@ -69,6 +81,7 @@ static int fatelf_replace(const char *out, const char *fname,
     xclose(out, outfd);
     xclose(newobj, newfd);
     xclose(fname, fd);
+    free(owners);
     free(header);
 
     unlink_on_xfail = NULL;
@@ -79,7 +92,7 @@ static int fatelf_replace(const char *out, const char *fname,
 
 int main(int argc, const char **argv)
 {
-    xfatelf_init(argc, argv);
+    xfatelf_init(&argc, argv);
     if (argc != 4)  // this could stand to use getopt(), later.
         xfail("USAGE: %s <out> <in> <newelf>", argv[0]);
     return fatelf_replace(argv[1], argv[2], argv[3]);
@@ -0,0 +1,355 @@
+/**
+ * FatELF; support multiple ELF binaries in one file.
+ *
+ * Please see the file LICENSE.txt in the source's root directory.
+ *
+ *  This file written by Ryan C. Gordon.
+ */
+
+#define FATELF_UTILS 1
+#include "fatelf-utils.h"
+
+#define DEFAULT_RESOURCE_ALIGN 16
+
+// A resource headed for the output: either one already in the input's
+//  table, or a new one from a file on disk.
+typedef struct resource_source
+{
+    fatelf_resource res;  // res.offset is in the output region, once written.
+    const char *fname;    // NULL if it comes from the input file.
+    uint64_t srcoffset;   // absolute offset in the input file, if fname==NULL.
+} resource_source;
+
+
+static void xwrite_all(const char *fname, const int fd,
+                       const uint8_t *buf, uint64_t len)
+{
+    while (len > 0)
+    {
+        const size_t chunk = (size_t) ((len > 0x40000000) ? 0x40000000 : len);
+        const ssize_t rc = xwrite(fname, fd, buf, chunk);
+        buf += rc;
+        len -= (uint64_t) rc;
+    } // while
+} // xwrite_all
+
+
+// Open a FatELF file and its resource table, which may be NULL.
+static FATELF_header *xopen_resources(const char *fname, int *fd,
+                                      fatelf_resource_table **table)
+{
+    const char *err = NULL;
+    FATELF_header *header = NULL;
+    *fd = xopen(fname, O_RDONLY, 0755);
+    header = xread_fatelf_header(fname, *fd);
+    *table = fatelf_read_resource_table(*fd, xget_file_size(fname, *fd), &err);
+    if (err != NULL)
+        xfail("'%s' %s", fname, err);
+    return header;
+} // xopen_resources
+
+
+static int fatelf_resource_list(const char *fname)
+{
+    fatelf_resource_table *table = NULL;
+    int fd = -1;
+    FATELF_header *header = xopen_resources(fname, &fd, &table);
+    uint32_t i, j;
+
+    if (table == NULL)
+        printf("%s: no resources.\n", fname);
+    else
+    {
+        printf("%s: %u resources, in %llu bytes starting at offset %llu.\n",
+               fname, (unsigned int) table->num_resources,
+               (unsigned long long) table->region_size,
+               (unsigned long long) table->region_offset);
+        for (i = 0; i < table->num_resources; i++)
+        {
+            const fatelf_resource *res = &table->resources[i];
+            printf("  '%s': %llu bytes at offset %llu, aligned to %u",
+                   res->name, (unsigned long long) res->size,
+                   (unsigned long long) (table->region_offset + res->offset),
+                   (unsigned int) res->alignment);
+            if (res->hash_type == FATELF_RESOURCE_HASH_SHA256)
+            {
+                printf(", sha256 ");
+                for (j = 0; j < sizeof (res->hash); j++)
+                    printf("%02x", (unsigned int) res->hash[j]);
+            } // if
+            printf("\n");
+        } // for
+    } // else
+
+    free(table);
+    free(header);
+    xclose(fname, fd);
+    return 0;  // success.
+} // fatelf_resource_list
+
+
+// Write a copy of fname with a new resource table holding (sources).
+static void xwrite_resources(const char *out, const char *fname,
+                             const int fd, const FATELF_header *header,
+                             const fatelf_resource_table *table,
+                             resource_source *sources, const uint32_t count)
+{
+    const int outfd = xopen(out, O_WRONLY | O_CREAT | O_TRUNC, 0755);
+    uint64_t junkoffset = 0, junksize = 0;
+    uint64_t region = 0, offset = 0;
+    fatelf_resource_table newtable;
+    uint8_t *buf = NULL;
+    size_t buflen = 0;
+    uint32_t i;
+
+    unlink_on_xfail = out;
+
+    // Everything up to the junk stays as it is, so the header is still right.
+    if (!xfind_junk(fname, fd, header, &junkoffset, &junksize))
+        junkoffset = xget_file_size(fname, fd);
+    else if (table != NULL)
+    {
+        if (table->region_offset < junkoffset)
+            xfail("'%s' has a resource table that overlaps its records", fname);
+        junksize = table->region_offset - junkoffset;  // keep what's before it.
+    } // else if
+    xcopyfile_range(fname, fd, out, outfd, 0, junkoffset + junksize);
+    offset = junkoffset + junksize;
+
+    if (count == 0)  // nothing left? Then there's no table at all.
+    {
+        xclose(out, outfd);
+        unlink_on_xfail = NULL;
+        return;
+    } // if
+
+    // Start the region on a page, so resources line up in memory too.
+    region = align_to_page(offset);
+    xwrite_zeros(out, outfd, (size_t) (region - offset));
+    offset = region;
+
+    for (i = 0; i < count; i++)
+    {
+        fatelf_resource *res = &sources[i].res;
+        const uint64_t aligned = (offset + (res->alignment - 1)) & ~((uint64_t) (res->alignment - 1));
+        xwrite_zeros(out, outfd, (size_t) (aligned - offset));
+        res->offset = aligned - region;
+
+        if (sources[i].fname == NULL)
+            xcopyfile_range(fname, fd, out, outfd, sources[i].srcoffset, res->size);
+        else
+        {
+            const char *src = sources[i].fname;
+            const int srcfd = xopen(src, O_RDONLY, 0755);
+            res->size = xcopyfile(src, srcfd, out, outfd);
+            if (res->hash_type == FATELF_RESOURCE_HASH_SHA256)
+                xsha256_range(src, srcfd, 0, res->size, res->hash);
+            xclose(src, srcfd);
+        } // else
+
+        offset = aligned + res->size;
+    } // for
+
+    newtable.region_offset = region;
+    newtable.table_offset = offset - region;
+    newtable.num_resources = count;
+    newtable.resources = (fatelf_resource *) xmalloc(sizeof (fatelf_resource) * count);
+    for (i = 0; i < count; i++)
+        newtable.resources[i] = sources[i].res;
+
+    buf = fatelf_encode_resource_table(&newtable, &buflen);
+    newtable.region_size = newtable.table_offset + buflen;
+    xwrite_all(out, outfd, buf, buflen);
+
+    free(buf);
+    free(newtable.resources);
+    xclose(out, outfd);
+    unlink_on_xfail = NULL;
+} // xwrite_resources
+
+
+// Collect the input's resources, minus any named in (names).
+static resource_source *keep_resources(const fatelf_resource_table *table,
+                                       const char **names, const int numnames,
+                                       const int extra, uint32_t *count)
+{
+    const uint32_t total = (table ? table->num_resources : 0) + (uint32_t) extra;
+    resource_source *sources = (resource_source *) xmalloc(sizeof (resource_source) * (total ? total : 1));
+    uint32_t i;
+    int j;
+
+    *count = 0;
+    for (i = 0; (table != NULL) && (i < table->num_resources); i++)
+    {
+        const fatelf_resource *res = &table->resources[i];
+        for (j = 0; j < numnames; j++)
+        {
+            if (strcmp(names[j], res->name) == 0)
+                break;
+        } // for
+
+        if (j == numnames)
+        {
+            resource_source *src = &sources[(*count)++];
+            src->res = *res;
+            src->fname = NULL;
+            src->srcoffset = table->region_offset + res->offset;
+        } // if
+    } // for
+
+    return sources;
+} // keep_resources
+
+
+static int fatelf_resource_add(const char *out, const char *fname,
+                               const uint32_t alignment, const int hash,
+                               const char **args, const int argc)
+{
+    const int numnew = argc / 2;
+    const char **names = (const char **) xmalloc(sizeof (char *) * (numnew + 1));
+    fatelf_resource_table *table = NULL;
+    resource_source *sources = NULL;
+    uint32_t count = 0;
+    int fd = -1;
+    FATELF_header *header = xopen_resources(fname, &fd, &table);
+    int i, j;
+
+    for (i = 0; i < numnew; i++)
+    {
+        names[i] = args[i * 2];
+        if ((*names[i] == '\0') || (strlen(names[i]) > 0xFFFF))
+            xfail("Resource names must be 1 to 65535 bytes long");
+        for (j = 0; j < i; j++)
+        {
+            if (strcmp(names[i], names[j]) == 0)
+                xfail("Resource '%s' is listed twice", names[i]);
+        } // for
+    } // for
+
+    // Resources with the same name as the new ones are replaced.
+    sources = keep_resources(table, names, numnew, numnew, &count);
+    for (i = 0; i < numnew; i++)
+    {
+        resource_source *src = &sources[count++];
+        memset(src, '\0', sizeof (*src));
+        src->res.name = names[i];
+        src->res.alignment = alignment;
+        src->res.hash_type = hash ? FATELF_RESOURCE_HASH_SHA256 : FATELF_RESOURCE_HASH_NONE;
+        src->fname = args[(i * 2) + 1];
+    } // for
+
+    xwrite_resources(out, fname, fd, header, table, sources, count);
+
+    free(sources);
+    free(names);
+    free(table);
+    free(header);
+    xclose(fname, fd);
+    return 0;  // success.
+} // fatelf_resource_add
+
+
+static int fatelf_resource_remove(const char *out, const char *fname,
+                                  const char **names, const int numnames)
+{
+    fatelf_resource_table *table = NULL;
+    resource_source *sources = NULL;
+    uint32_t count = 0;
+    int fd = -1;
+    FATELF_header *header = xopen_resources(fname, &fd, &table);
+    int i;
+
+    for (i = 0; i < numnames; i++)
+    {
+        if ((table == NULL) || (fatelf_find_resource(table, names[i]) == NULL))
+            xfail("'%s' has no resource named '%s'", fname, names[i]);
+    } // for
+
+    sources = keep_resources(table, names, numnames, 0, &count);
+    xwrite_resources(out, fname, fd, header, table, sources, count);
+
+    free(sources);
+    free(table);
+    free(header);
+    xclose(fname, fd);
+    return 0;  // success.
+} // fatelf_resource_remove
+
+
+static int fatelf_resource_get(const char *out, const char *fname,
+                               const char *name)
+{
+    const int fd = xopen(fname, O_RDONLY, 0755);
+    FATELF_header *header = xread_fatelf_header(fname, fd);
+    const char *err = NULL;
+    uint64_t size = 0;
+    const void *ptr = fatelf_map_resource(fd, name, 1, &size, &err);
+    int outfd = -1;
+
+    if (ptr == NULL)
+        xfail("'%s' %s", fname, err);
+
+    outfd = xopen(out, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    unlink_on_xfail = out;
+    xwrite_all(out, outfd, (const uint8_t *) ptr, size);
+    xclose(out, outfd);
+    unlink_on_xfail = NULL;
+
+    fatelf_unmap_resource(ptr, size);
+    free(header);
+    xclose(fname, fd);
+    return 0;  // success.
+} // fatelf_resource_get
+
+
+int main(int argc, const char **argv)
+{
+    const char *usage = "USAGE: %s list <in>\n"
+                        "       %s add [--align=N] [--hash] <out> <in> <name> <file> [... <name> <file>]\n"
+                        "       %s remove <out> <in> <name> [... <name>]\n"
+                        "       %s get <out> <in> <name>";
+    uint32_t alignment = DEFAULT_RESOURCE_ALIGN;
+    int hash = 0;
+    int i = 2;
+
+    xfatelf_init(&argc, argv);
+
+    if ((argc >= 2) && (strcmp(argv[1], "add") == 0))
+    {
+        while ((i < argc) && (strncmp(argv[i], "--", 2) == 0))
+        {
+            if (strncmp(argv[i], "--align=", 8) == 0)
+            {
+                char *end = NULL;
+                const unsigned long val = strtoul(argv[i] + 8, &end, 0);
+                if ( (*end != '\0') || (val == 0) || (val > FATELF_RESOURCE_MAX_ALIGN) ||
+                     ((val & (val - 1)) != 0) )
+                {
+                    xfail("Alignment must be a power of two, up to %d",
+                          FATELF_RESOURCE_MAX_ALIGN);
+                } // if
+                alignment = (uint32_t) val;
+            } // if
+            else if (strcmp(argv[i], "--hash") == 0)
+                hash = 1;
+            else
+                xfail("Unknown option '%s'", argv[i]);
+            i++;
+        } // while
+
+        if ((argc >= i + 4) && (((argc - i) % 2) == 0))
+            return fatelf_resource_add(argv[i], argv[i+1], alignment, hash, argv + i + 2, argc - (i + 2));
+    } // if
+    else if ((argc == 3) && (strcmp(argv[1], "list") == 0))
+        return fatelf_resource_list(argv[2]);
+    else if ((argc >= 5) && (strcmp(argv[1], "remove") == 0))
+        return fatelf_resource_remove(argv[2], argv[3], argv + 4, argc - 4);
+    else if ((argc == 5) && (strcmp(argv[1], "get") == 0))
+        return fatelf_resource_get(argv[2], argv[3], argv[4]);
+
+    // this could stand to use getopt(), later.
+    xfail(usage, argv[0], argv[0], argv[0], argv[0]);
+    return 1;
+} // main
+
+// end of fatelf-resource.c ...
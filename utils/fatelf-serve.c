@@ -0,0 +1,1036 @@
+/**
+ * FatELF; support multiple ELF binaries in one file.
+ *
+ * Please see the file LICENSE.txt in the source's root directory.
+ *
+ *  This file written by Ryan C. Gordon.
+ */
+
+// This serves a directory of FatELF files over HTTP on localhost, and hands
+//  each client only the part it asked for: "?target=x86_64" (or an
+//  "X-FatELF-Target: x86_64" header) gets that one record, like
+//  fatelf-extract would write it, and "?target=x86_64,aarch64" gets a new
+//  FatELF file with just those records, like fatelf-glue would write it.
+//  No target gets the whole file. Nothing is staged: the response is a list
+//  of pieces of the original file (plus a new FatELF header and padding),
+//  sent with sendfile(), and single ranges of it work, so fatelf-fetch can
+//  pull from this, too. One thread handles every client with epoll.
+
+#define _GNU_SOURCE 1  // for accept4() and MSG_MORE.
+#define FATELF_UTILS 1
+#include "fatelf-utils.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+#define SERVE_MAX_REQUEST (16 * 1024)  // headers bigger than this get a 431.
+#define SERVE_MAX_TARGETS 32
+#define SERVE_MAX_SEGMENTS ((SERVE_MAX_TARGETS * 2) + 3)  // header, records, junk.
+#define SERVE_IDLE_SECS 30
+#define SERVE_CACHE_BUCKETS 256
+#define SERVE_CACHE_MAX 4096  // headers to remember before starting over.
+
+typedef enum
+{
+    SEGMENT_MEMORY,
+    SEGMENT_ZEROS,
+    SEGMENT_FILE
+} segment_type;
+
+// one piece of a response body.
+typedef struct segment
+{
+    segment_type type;
+    const uint8_t *mem;  // for SEGMENT_MEMORY.
+    uint64_t offset;     // for SEGMENT_FILE.
+    uint64_t len;
+} segment;
+
+// what we know about a file, so we only parse its header once.
+typedef struct cached_header
+{
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+    struct timespec ctime;
+    FATELF_header *header;  // NULL if this isn't a FatELF file.
+    uint64_t junkoffset;
+    uint64_t junksize;
+    int junkresources;  // nonzero if the junk ends in a resource table.
+    struct cached_header *next;
+} cached_header;
+
+typedef struct connection
+{
+    int sock;
+    int filefd;
+    char request[SERVE_MAX_REQUEST + 1];
+    size_t requestlen;
+    char logline[256];  // the request line, for --verbose.
+    char head[2048];  // status line, headers, and the body of error replies.
+    size_t headlen;
+    size_t headsent;
+    uint8_t *fatheader;  // new FatELF header, when we glue a subset.
+    segment segments[SERVE_MAX_SEGMENTS];
+    int numsegments;
+    int cursegment;
+    uint64_t segmentpos;
+    int writing;
+    time_t last_active;
+    struct connection *prev;
+    struct connection *next;
+} connection;
+
+typedef struct server
+{
+    int listenfd;
+    int rootfd;
+    int epollfd;
+    int accepting;
+    int verbose;
+    connection *connections;
+} server;
+
+static const uint8_t zeros[4096];
+static cached_header *cache[SERVE_CACHE_BUCKETS];
+static int cache_count = 0;
+
+
+static void flush_cache(void)
+{
+    int i;
+    for (i = 0; i < SERVE_CACHE_BUCKETS; i++)
+    {
+        cached_header *item = cache[i];
+        while (item != NULL)
+        {
+            cached_header *next = item->next;
+            free(item->header);
+            free(item);
+            item = next;
+        } // while
+        cache[i] = NULL;
+    } // for
+    cache_count = 0;
+} // flush_cache
+
+
+// Find (or parse and remember) what we know about an open file. Returns
+//  NULL and sets (*err) if it claims to be FatELF but we can't use it.
+static const cached_header *get_cached_header(const int fd,
+                                              const struct stat *st,
+                                              const char **err)
+{
+    const size_t bucket = (size_t) ((st->st_dev * 31) + st->st_ino) % SERVE_CACHE_BUCKETS;
+    cached_header *item = cache[bucket];
+    cached_header *prev = NULL;
+    const char *readerr = NULL;
+    FATELF_header *header = NULL;
+
+    for (; item != NULL; prev = item, item = item->next)
+    {
+        if ((item->dev != st->st_dev) || (item->ino != st->st_ino))
+            continue;
+        else if ( (item->size == st->st_size) &&
+                  (item->mtime.tv_sec == st->st_mtim.tv_sec) &&
+                  (item->mtime.tv_nsec == st->st_mtim.tv_nsec) &&
+                  (item->ctime.tv_sec == st->st_ctim.tv_sec) &&
+                  (item->ctime.tv_nsec == st->st_ctim.tv_nsec) )
+            return item;
+
+        // the file changed since we looked at it; forget what we knew.
+        if (prev == NULL)
+            cache[bucket] = item->next;
+        else
+            prev->next = item->next;
+        free(item->header);
+        free(item);
+        cache_count--;
+        break;
+    } // for
+
+    header = fatelf_pread_header(fd, 0, (uint64_t) st->st_size, &readerr);
+    if ((header == NULL) && (strcmp(readerr, "is not a FatELF binary") != 0))
+    {
+        *err = readerr;
+        return NULL;
+    } // if
+
+    if (cache_count >= SERVE_CACHE_MAX)
+        flush_cache();
+
+    item = (cached_header *) xmalloc(sizeof (cached_header));
+    memset(item, '\0', sizeof (*item));
+    item->dev = st->st_dev;
+    item->ino = st->st_ino;
+    item->size = st->st_size;
+    item->mtime = st->st_mtim;
+    item->ctime = st->st_ctim;
+    item->header = header;
+
+    // Junk is whatever follows the last record, as fatelf-extract sees it.
+    if ((header != NULL) && (header->num_records > 0))
+    {
+        const FATELF_record *rec = &header->records[find_furthest_record(header)];
+        const uint64_t edge = rec->offset + rec->size;
+        if ((uint64_t) st->st_size > edge)
+        {
+            item->junkoffset = edge;
+            item->junksize = ((uint64_t) st->st_size) - edge;
+            item->junkresources = fatelf_junk_has_resources(fd, edge, item->junksize);
+        } // if
+    } // if
+
+    item->next = cache[bucket];
+    cache[bucket] = item;
+    cache_count++;
+    return item;
+} // get_cached_header
+
+
+static void add_segment(connection *conn, const segment_type type,
+                        const uint8_t *mem, const uint64_t offset,
+                        const uint64_t len)
+{
+    segment *seg;
+    if (len == 0)
+        return;
+    assert(conn->numsegments < SERVE_MAX_SEGMENTS);
+    seg = &conn->segments[conn->numsegments++];
+    seg->type = type;
+    seg->mem = mem;
+    seg->offset = offset;
+    seg->len = len;
+} // add_segment
+
+
+static uint64_t body_size(const connection *conn)
+{
+    uint64_t retval = 0;
+    int i;
+    for (i = 0; i < conn->numsegments; i++)
+        retval += conn->segments[i].len;
+    return retval;
+} // body_size
+
+
+// Cut the body down to (len) bytes starting at (start).
+static void clip_segments(connection *conn, uint64_t start, uint64_t len)
+{
+    int out = 0;
+    int i;
+
+    for (i = 0; (i < conn->numsegments) && (len > 0); i++)
+    {
+        segment seg = conn->segments[i];
+        if (start >= seg.len)
+        {
+            start -= seg.len;
+            continue;
+        } // if
+
+        seg.offset += start;
+        if (seg.mem != NULL)
+            seg.mem += start;
+        seg.len -= start;
+        start = 0;
+        if (seg.len > len)
+            seg.len = len;
+        len -= seg.len;
+        conn->segments[out++] = seg;
+    } // for
+
+    conn->numsegments = out;
+} // clip_segments
+
+
+static void set_error(connection *conn, const int status,
+                      const char *reason, const char *extra,
+                      const char *fmt, ...) FATELF_ISPRINTF(5,6);
+
+static void set_error(connection *conn, const int status,
+                      const char *reason, const char *extra,
+                      const char *fmt, ...)
+{
+    char body[512];
+    va_list ap;
+    int len;
+
+    va_start(ap, fmt);
+    len = vsnprintf(body, sizeof (body) - 1, fmt, ap);
+    va_end(ap);
+    if ((len < 0) || (len >= (int) sizeof (body) - 1))
+        len = (int) strlen(body);
+    body[len++] = '\n';
+    body[len] = '\0';
+
+    conn->numsegments = 0;
+    conn->headlen = (size_t) snprintf(conn->head, sizeof (conn->head),
+                        "HTTP/1.1 %d %s\r\n"
+                        "Content-Type: text/plain\r\n"
+                        "Content-Length: %d\r\n"
+                        "%s"
+                        "Connection: close\r\n"
+                        "\r\n"
+                        "%s", status, reason, len, extra ? extra : "", body);
+} // set_error
+
+
+static int unhex(const char ch)
+{
+    if ((ch >= '0') && (ch <= '9'))
+        return ch - '0';
+    else if ((ch >= 'a') && (ch <= 'f'))
+        return (ch - 'a') + 10;
+    else if ((ch >= 'A') && (ch <= 'F'))
+        return (ch - 'A') + 10;
+    return -1;
+} // unhex
+
+
+// %-decode in place. Returns -1 on bad escapes or an embedded NUL.
+static int url_decode(char *str)
+{
+    char *out = str;
+    while (*str)
+    {
+        if (*str == '%')
+        {
+            const int hi = unhex(str[1]);
+            const int lo = (hi == -1) ? -1 : unhex(str[2]);
+            if ((lo == -1) || ((hi == 0) && (lo == 0)))
+                return -1;
+            *(out++) = (char) ((hi << 4) | lo);
+            str += 3;
+        } // if
+        else
+        {
+            *(out++) = *(str++);
+        } // else
+    } // while
+    *out = '\0';
+    return 0;
+} // url_decode
+
+
+// Split a comma-separated target list into (targets). Returns -1 if too many.
+static int add_targets(char *list, char **targets, int *count)
+{
+    char *str = list;
+    char *ptr = list;
+
+    while (1)
+    {
+        const char ch = *ptr;
+        if ((ch == ',') || (ch == '\0'))
+        {
+            *ptr = '\0';
+            if (ptr != str)
+            {
+                if (*count >= SERVE_MAX_TARGETS)
+                    return -1;
+                targets[(*count)++] = str;
+            } // if
+            if (ch == '\0')
+                break;
+            str = ptr + 1;
+        } // if
+        ptr++;
+    } // while
+
+    return 0;
+} // add_targets
+
+
+static char *header_value(char *line, const char *name)
+{
+    const size_t len = strlen(name);
+    if ((strncasecmp(line, name, len) != 0) || (line[len] != ':'))
+        return NULL;
+    line += len + 1;
+    while ((*line == ' ') || (*line == '\t'))
+        line++;
+    return line;
+} // header_value
+
+
+// Parse "bytes=a-b", "bytes=a-" or "bytes=-n". Returns 0 if there's no
+//  usable range (so we ignore it, like the RFC says), -1 if it can't be
+//  satisfied, 1 if (*start) and (*len) are set.
+static int parse_range(const char *str, const uint64_t total,
+                       uint64_t *start, uint64_t *len)
+{
+    char *endptr = NULL;
+    unsigned long long first = 0;
+    unsigned long long last = 0;
+
+    if (strncmp(str, "bytes=", 6) != 0)
+        return 0;
+    str += 6;
+
+    if (*str == '-')  // suffix: the last n bytes.
+    {
+        last = strtoull(str + 1, &endptr, 10);
+        if ((endptr == str + 1) || (*endptr != '\0'))
+            return 0;
+        else if ((last == 0) || (total == 0))
+            return -1;
+        else if (last > total)
+            last = total;
+        *start = total - last;
+        *len = last;
+        return 1;
+    } // if
+
+    if ((*str < '0') || (*str > '9'))
+        return 0;
+    first = strtoull(str, &endptr, 10);
+    if (*endptr != '-')
+        return 0;
+    str = endptr + 1;
+    if (*str == '\0')
+        last = (total > 0) ? total - 1 : 0;
+    else
+    {
+        last = strtoull(str, &endptr, 10);
+        if ((endptr == str) || (*endptr != '\0') || (last < first))
+            return 0;
+        if (last >= total)
+            last = total - 1;
+    } // else
+
+    if (first >= total)
+        return -1;
+
+    *start = first;
+    *len = (last - first) + 1;
+    return 1;
+} // parse_range
+
+
+// The junk goes at (outpos) in the body, padded like xcopy_junk() would.
+static void add_junk_segments(connection *conn, const cached_header *cached,
+                              const uint64_t outpos)
+{
+    if (cached->junkresources)
+        add_segment(conn, SEGMENT_ZEROS, NULL, 0, fatelf_junk_padding(cached->junkoffset, outpos));
+    add_segment(conn, SEGMENT_FILE, NULL, cached->junkoffset, cached->junksize);
+} // add_junk_segments
+
+
+// Lay out a new FatELF file with just (recs) from (cached), like
+//  fatelf-glue: header, page-aligned records, then the junk.
+static void glue_segments(connection *conn, const cached_header *cached,
+                          const int *recs, const int count)
+{
+    FATELF_header *header = (FATELF_header *) xmalloc(fatelf_header_size((uint32_t) count));
+    uint64_t offset = 0;
+    size_t len = 0;
+    int i;
+
+    header->magic = FATELF_MAGIC;
+    header->version = FATELF_FORMAT_VERSION_1;
+    header->reserved0 = 0;
+    header->flags = 0;
+    header->num_records = (uint32_t) count;
+    for (i = 0; i < count; i++)
+        memcpy(&header->records[i], &cached->header->records[recs[i]], sizeof (FATELF_record));
+    header->version = fatelf_minimum_format_version(header);
+
+    offset = fatelf_disk_header_size(header->version, (uint32_t) count);
+    for (i = 0; i < count; i++)
+    {
+        FATELF_record *rec = &header->records[i];
+        rec->offset = align_to_page(offset);
+        offset = rec->offset + rec->size;
+    } // for
+
+    conn->fatheader = fatelf_encode_header(header, &len);
+    add_segment(conn, SEGMENT_MEMORY, conn->fatheader, 0, len);
+
+    offset = len;
+    for (i = 0; i < count; i++)
+    {
+        const FATELF_record *orig = &cached->header->records[recs[i]];
+        add_segment(conn, SEGMENT_ZEROS, NULL, 0, header->records[i].offset - offset);
+        add_segment(conn, SEGMENT_FILE, NULL, orig->offset, orig->size);
+        offset = header->records[i].offset + orig->size;
+    } // for
+
+    add_junk_segments(conn, cached, offset);
+    free(header);
+} // glue_segments
+
+
+// Work out the whole response to a request: status, headers, and the
+//  segments of the body.
+static void build_response(const server *srv, connection *conn)
+{
+    char *targets[SERVE_MAX_TARGETS];
+    int recs[SERVE_MAX_TARGETS];
+    int numtargets = 0;
+    int numrecs = 0;
+    char *line = conn->request;
+    char *method = NULL;
+    char *path = NULL;
+    char *query = NULL;
+    char *targethdr = NULL;
+    char *range = NULL;
+    char *ptr = NULL;
+    const cached_header *cached = NULL;
+    const char *err = NULL;
+    char contentrange[128];
+    struct stat st;
+    uint64_t total = 0;
+    uint64_t start = 0;
+    uint64_t len = 0;
+    int head_only = 0;
+    int status = 200;
+    int i;
+
+    // Request line: METHOD SP path SP version.
+    if ((ptr = strstr(line, "\r\n")) == NULL)
+    {
+        set_error(conn, 400, "Bad Request", NULL, "Bad request");
+        return;
+    } // if
+    *ptr = '\0';
+    snprintf(conn->logline, sizeof (conn->logline), "%.*s",
+             (int) (sizeof (conn->logline) - 1), line);
+    method = line;
+    line = ptr + 2;
+    if ( ((path = strchr(method, ' ')) == NULL) ||
+         ((ptr = strchr(path + 1, ' ')) == NULL) ||
+         (strncmp(ptr + 1, "HTTP/1.", 7) != 0) )
+    {
+        set_error(conn, 400, "Bad Request", NULL, "Bad request");
+        return;
+    } // if
+    *(path++) = '\0';
+    *ptr = '\0';
+
+    if (strcmp(method, "HEAD") == 0)
+        head_only = 1;
+    else if (strcmp(method, "GET") != 0)
+    {
+        set_error(conn, 405, "Method Not Allowed", "Allow: GET, HEAD\r\n",
+                  "Only GET and HEAD are supported");
+        return;
+    } // else if
+
+    // Headers we care about.
+    while ((ptr = strstr(line, "\r\n")) != NULL)
+    {
+        char *value;
+        *ptr = '\0';
+        if ((value = header_value(line, "Range")) != NULL)
+            range = value;
+        else if ((value = header_value(line, "X-FatELF-Target")) != NULL)
+            targethdr = value;
+        line = ptr + 2;
+    } // while
+
+    if ((query = strchr(path, '?')) != NULL)
+        *(query++) = '\0';
+
+    if ((*path != '/') || (url_decode(path) == -1))
+    {
+        set_error(conn, 400, "Bad Request", NULL, "Bad path");
+        return;
+    } // if
+
+    // Don't let anyone out of the directory we serve.
+    for (ptr = path; *ptr; ptr++)
+    {
+        if ( (ptr[0] == '/') && (ptr[1] == '.') && (ptr[2] == '.') &&
+             ((ptr[3] == '/') || (ptr[3] == '\0')) )
+        {
+            set_error(conn, 404, "Not Found", NULL, "No such file");
+            return;
+        } // if
+    } // for
+
+    while (query != NULL)
+    {
+        char *param = query;
+        if ((query = strchr(query, '&')) != NULL)
+            *(query++) = '\0';
+        if (strncmp(param, "target=", 7) != 0)
+            continue;
+        else if (url_decode(param + 7) == -1)
+        {
+            set_error(conn, 400, "Bad Request", NULL, "Bad query string");
+            return;
+        } // else if
+        else if (add_targets(param + 7, targets, &numtargets) == -1)
+        {
+            set_error(conn, 400, "Bad Request", NULL, "Too many targets");
+            return;
+        } // else if
+    } // while
+
+    if ((numtargets == 0) && (targethdr != NULL))
+    {
+        if (add_targets(targethdr, targets, &numtargets) == -1)
+        {
+            set_error(conn, 400, "Bad Request", NULL, "Too many targets");
+            return;
+        } // if
+    } // if
+
+    while (*path == '/')
+        path++;
+
+    if (*path == '\0')
+        conn->filefd = -1;
+    else
+        conn->filefd = openat(srv->rootfd, path, O_RDONLY | O_CLOEXEC | O_NONBLOCK);
+
+    if ((conn->filefd == -1) || (fstat(conn->filefd, &st) == -1) || (!S_ISREG(st.st_mode)))
+    {
+        set_error(conn, 404, "Not Found", NULL, "No such file");
+        return;
+    } // if
+
+    if ((cached = get_cached_header(conn->filefd, &st, &err)) == NULL)
+    {
+        set_error(conn, 500, "Internal Server Error", NULL, "'%s' %s", path, err);
+        return;
+    } // if
+
+    // Resolve the targets; asking for the same record twice gets it once.
+    if (cached->header != NULL)
+    {
+        for (i = 0; i < numtargets; i++)
+        {
+            char errbuf[256];
+            const int idx = fatelf_find_record(cached->header, targets[i], errbuf, sizeof (errbuf));
+            int j;
+            if (idx == -2)
+            {
+                set_error(conn, 400, "Bad Request", NULL, "%s", errbuf);
+                return;
+            } // if
+            else if (idx == -1)
+            {
+                set_error(conn, 404, "Not Found", NULL,
+                          "No record matches '%s' in '%s'", targets[i], path);
+                return;
+            } // else if
+
+            for (j = 0; j < numrecs; j++)
+            {
+                if (recs[j] == idx)
+                    break;
+            } // for
+            if (j == numrecs)
+                recs[numrecs++] = idx;
+        } // for
+    } // if
+
+    if (numrecs == 0)  // no target, or not FatELF: the whole file.
+        add_segment(conn, SEGMENT_FILE, NULL, 0, (uint64_t) st.st_size);
+    else if (numrecs == 1)  // one record and the junk, like fatelf-extract.
+    {
+        const FATELF_record *rec = &cached->header->records[recs[0]];
+        add_segment(conn, SEGMENT_FILE, NULL, rec->offset, rec->size);
+        add_junk_segments(conn, cached, rec->size);
+    } // else if
+    else
+    {
+        glue_segments(conn, cached, recs, numrecs);
+    } // else
+
+    total = body_size(conn);
+    contentrange[0] = '\0';
+    len = total;
+    if (range != NULL)
+    {
+        const int rc = parse_range(range, total, &start, &len);
+        if (rc == -1)
+        {
+            snprintf(contentrange, sizeof (contentrange),
+                     "Content-Range: bytes */%llu\r\n", (unsigned long long) total);
+            set_error(conn, 416, "Range Not Satisfiable", contentrange,
+                      "Range not satisfiable");
+            return;
+        } // if
+        else if (rc == 1)
+        {
+            status = 206;
+            clip_segments(conn, start, len);
+            snprintf(contentrange, sizeof (contentrange),
+                     "Content-Range: bytes %llu-%llu/%llu\r\n",
+                     (unsigned long long) start,
+                     (unsigned long long) (start + len - 1),
+                     (unsigned long long) total);
+        } // else if
+        else
+        {
+            len = total;
+        } // else
+    } // if
+
+    if (head_only)
+        conn->numsegments = 0;
+
+    conn->headlen = (size_t) snprintf(conn->head, sizeof (conn->head),
+                        "HTTP/1.1 %d %s\r\n"
+                        "Content-Type: application/octet-stream\r\n"
+                        "Content-Length: %llu\r\n"
+                        "%s"
+                        "Accept-Ranges: bytes\r\n"
+                        "Vary: X-FatELF-Target\r\n"
+                        "Connection: close\r\n"
+                        "\r\n",
+                        status, (status == 206) ? "Partial Content" : "OK",
+                        (unsigned long long) len, contentrange);
+} // build_response
+
+
+// Send as much as the socket will take. Returns 1 when the response is all
+//  sent, 0 if the socket is full, -1 if we should give up on this client.
+static int send_response(connection *conn)
+{
+    while (conn->headsent < conn->headlen)
+    {
+        const int more = (conn->numsegments > 0) ? MSG_MORE : 0;
+        const ssize_t rc = send(conn->sock, conn->head + conn->headsent,
+                                conn->headlen - conn->headsent,
+                                MSG_NOSIGNAL | more);
+        if (rc == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            return ((errno == EAGAIN) || (errno == EWOULDBLOCK)) ? 0 : -1;
+        } // if
+        conn->headsent += (size_t) rc;
+    } // while
+
+    while (conn->cursegment < conn->numsegments)
+    {
+        const segment *seg = &conn->segments[conn->cursegment];
+        const uint64_t left = seg->len - conn->segmentpos;
+        const int more = (conn->cursegment < conn->numsegments - 1) ? MSG_MORE : 0;
+        ssize_t rc;
+
+        if (seg->type == SEGMENT_FILE)
+        {
+            off_t offset = (off_t) (seg->offset + conn->segmentpos);
+            const size_t count = (left > 0x7FFFF000) ? 0x7FFFF000 : (size_t) left;
+            const uint64_t start = fatelf_stats_begin();
+            rc = sendfile(conn->sock, conn->filefd, &offset, count);
+            if (rc > 0)
+                fatelf_stats_end(FATELF_STATS_PHASE_COPY, start, (uint64_t) rc);
+            else if (rc == 0)
+                return -1;  // the file got shorter under us.
+        } // if
+        else
+        {
+            const uint8_t *mem = (seg->type == SEGMENT_ZEROS) ? zeros : seg->mem + conn->segmentpos;
+            const size_t max = (seg->type == SEGMENT_ZEROS) ? sizeof (zeros) : (size_t) left;
+            const size_t count = (left > max) ? max : (size_t) left;
+            rc = send(conn->sock, mem, count, MSG_NOSIGNAL | more);
+        } // else
+
+        if (rc == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            return ((errno == EAGAIN) || (errno == EWOULDBLOCK)) ? 0 : -1;
+        } // if
+
+        conn->segmentpos += (uint64_t) rc;
+        if (conn->segmentpos == seg->len)
+        {
+            conn->cursegment++;
+            conn->segmentpos = 0;
+        } // if
+    } // while
+
+    return 1;
+} // send_response
+
+
+static void set_accepting(server *srv, const int accepting)
+{
+    struct epoll_event ev;
+    if (srv->accepting == accepting)
+        return;
+    memset(&ev, '\0', sizeof (ev));
+    ev.events = accepting ? EPOLLIN : 0;
+    ev.data.ptr = NULL;
+    epoll_ctl(srv->epollfd, EPOLL_CTL_MOD, srv->listenfd, &ev);
+    srv->accepting = accepting;
+} // set_accepting
+
+
+static void close_connection(server *srv, connection *conn)
+{
+    if (srv->verbose)
+    {
+        int status = 0;
+        sscanf(conn->head, "HTTP/1.1 %d", &status);
+        printf("%d %s\n", status, conn->logline[0] ? conn->logline : "(no request)");
+        fflush(stdout);
+    } // if
+
+    if (conn->prev != NULL)
+        conn->prev->next = conn->next;
+    else
+        srv->connections = conn->next;
+    if (conn->next != NULL)
+        conn->next->prev = conn->prev;
+
+    close(conn->sock);  // this removes it from epoll, too.
+    if (conn->filefd != -1)
+        close(conn->filefd);
+    free(conn->fatheader);
+    free(conn);
+
+    set_accepting(srv, 1);  // if we ran out of fds, we have one back now.
+} // close_connection
+
+
+static void accept_connections(server *srv)
+{
+    while (1)
+    {
+        struct epoll_event ev;
+        connection *conn;
+        const int sock = accept4(srv->listenfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (sock == -1)
+        {
+            if ((errno == EMFILE) || (errno == ENFILE))
+                set_accepting(srv, 0);  // wait for someone to leave.
+            else if ((errno == EINTR) || (errno == ECONNABORTED))
+                continue;
+            return;
+        } // if
+
+        conn = (connection *) xmalloc(sizeof (connection));
+        memset(conn, '\0', sizeof (*conn));
+        conn->sock = sock;
+        conn->filefd = -1;
+        conn->last_active = time(NULL);
+        conn->next = srv->connections;
+        if (conn->next != NULL)
+            conn->next->prev = conn;
+        srv->connections = conn;
+
+        memset(&ev, '\0', sizeof (ev));
+        ev.events = EPOLLIN | EPOLLRDHUP;
+        ev.data.ptr = conn;
+        if (epoll_ctl(srv->epollfd, EPOLL_CTL_ADD, sock, &ev) == -1)
+            close_connection(srv, conn);
+    } // while
+} // accept_connections
+
+
+static void handle_connection(server *srv, connection *conn, const uint32_t events)
+{
+    int rc;
+
+    conn->last_active = time(NULL);
+
+    if (events & EPOLLERR)
+    {
+        close_connection(srv, conn);
+        return;
+    } // if
+
+    if (!conn->writing)
+    {
+        struct epoll_event ev;
+        char *end = NULL;
+
+        while (1)
+        {
+            const size_t avail = SERVE_MAX_REQUEST - conn->requestlen;
+            const ssize_t br = recv(conn->sock, conn->request + conn->requestlen, avail, 0);
+            if ((br == -1) && (errno == EINTR))
+                continue;
+            else if ((br == -1) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)))
+                break;
+            else if (br <= 0)
+            {
+                close_connection(srv, conn);  // gone, or broken.
+                return;
+            } // else if
+
+            conn->requestlen += (size_t) br;
+            conn->request[conn->requestlen] = '\0';
+            if ((end = strstr(conn->request, "\r\n\r\n")) != NULL)
+                break;
+            else if (conn->requestlen == SERVE_MAX_REQUEST)
+                break;
+        } // while
+
+        if (end != NULL)
+        {
+            end[2] = '\0';  // keep the last header's CRLF.
+            build_response(srv, conn);
+        } // if
+        else if (conn->requestlen == SERVE_MAX_REQUEST)
+        {
+            set_error(conn, 431, "Request Header Fields Too Large", NULL,
+                      "Request headers are too big");
+        } // else if
+        else
+        {
+            if (events & (EPOLLHUP | EPOLLRDHUP))
+                close_connection(srv, conn);
+            return;  // wait for the rest of the request.
+        } // else
+
+        conn->writing = 1;
+        memset(&ev, '\0', sizeof (ev));
+        ev.events = EPOLLOUT;
+        ev.data.ptr = conn;
+        epoll_ctl(srv->epollfd, EPOLL_CTL_MOD, conn->sock, &ev);
+    } // if
+
+    if ((rc = send_response(conn)) != 0)
+    {
+        if (rc == 1)
+            shutdown(conn->sock, SHUT_WR);
+        close_connection(srv, conn);
+    } // if
+} // handle_connection
+
+
+static void drop_idle_connections(server *srv, const time_t now)
+{
+    connection *conn = srv->connections;
+    while (conn != NULL)
+    {
+        connection *next = conn->next;
+        if ((now - conn->last_active) >= SERVE_IDLE_SECS)
+            close_connection(srv, conn);
+        conn = next;
+    } // while
+} // drop_idle_connections
+
+
+static int fatelf_serve(const char *dir, const int port, const int verbose)
+{
+    struct epoll_event events[64];
+    struct sockaddr_in addr;
+    socklen_t addrlen = sizeof (addr);
+    struct epoll_event ev;
+    time_t last_sweep = time(NULL);
+    server srv;
+    int one = 1;
+
+    memset(&srv, '\0', sizeof (srv));
+    srv.verbose = verbose;
+
+    if ((srv.rootfd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1)
+        xfail("Couldn't open directory '%s': %s", dir, strerror(errno));
+
+    // Only ever on localhost: this isn't meant to face the internet.
+    memset(&addr, '\0', sizeof (addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t) port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    srv.listenfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (srv.listenfd == -1)
+        xfail("Couldn't create socket: %s", strerror(errno));
+    setsockopt(srv.listenfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof (one));
+    if (bind(srv.listenfd, (struct sockaddr *) &addr, sizeof (addr)) == -1)
+        xfail("Couldn't bind to port %d: %s", port, strerror(errno));
+    else if (listen(srv.listenfd, SOMAXCONN) == -1)
+        xfail("Couldn't listen on port %d: %s", port, strerror(errno));
+    else if (getsockname(srv.listenfd, (struct sockaddr *) &addr, &addrlen) == -1)
+        xfail("Couldn't get socket address: %s", strerror(errno));
+
+    if ((srv.epollfd = epoll_create1(EPOLL_CLOEXEC)) == -1)
+        xfail("Couldn't create epoll instance: %s", strerror(errno));
+
+    memset(&ev, '\0', sizeof (ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;  // NULL means the listening socket.
+    if (epoll_ctl(srv.epollfd, EPOLL_CTL_ADD, srv.listenfd, &ev) == -1)
+        xfail("Couldn't watch socket: %s", strerror(errno));
+    srv.accepting = 1;
+
+    signal(SIGPIPE, SIG_IGN);  // sendfile() can still raise it.
+
+    printf("Listening on http://127.0.0.1:%d/\n", (int) ntohs(addr.sin_port));
+    fflush(stdout);
+
+    while (1)
+    {
+        const int rc = epoll_wait(srv.epollfd, events, 64, 1000);
+        time_t now;
+        int i;
+
+        if ((rc == -1) && (errno != EINTR))
+            xfail("epoll_wait failed: %s", strerror(errno));
+
+        for (i = 0; i < rc; i++)
+        {
+            if (events[i].data.ptr == NULL)
+                accept_connections(&srv);
+            else
+                handle_connection(&srv, (connection *) events[i].data.ptr, events[i].events);
+        } // for
+
+        now = time(NULL);
+        if (now != last_sweep)
+        {
+            drop_idle_connections(&srv, now);
+            last_sweep = now;
+        } // if
+    } // while
+
+    return 0;  // not reached.
+} // fatelf_serve
+
+
+int main(int argc, const char **argv)
+{
+    const char *dir = NULL;
+    int argcount = 0;
+    int port = 8080;
+    int verbose = 0;
+    int i;
+
+    xfatelf_init(&argc, argv);
+
+    for (i = 1; i < argc; i++)
+    {
+        if (strncmp(argv[i], "--port=", 7) == 0)
+        {
+            char *endptr = NULL;
+            const long val = strtol(argv[i] + 7, &endptr, 10);
+            if ((endptr == argv[i] + 7) || (*endptr != '\0') || (val < 0) || (val > 65535))
+                xfail("Bad --port value '%s'", argv[i] + 7);
+            port = (int) val;
+        } // if
+        else if (strcmp(argv[i], "--verbose") == 0)
+            verbose = 1;
+        else
+        {
+            dir = argv[i];
+            argcount++;
+        } // else
+    } // for
+
+    if (argcount != 1)  // this could stand to use getopt(), later.
+        xfail("USAGE: %s [--port=N] [--verbose] <directory>", argv[0]);
+
+    return fatelf_serve(dir, port, verbose);
+} // main
+
+// end of fatelf-serve.c ...
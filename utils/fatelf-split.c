@@ -20,25 +20,11 @@ static char *make_filename(const char *base, const int wants,
 } // make_filename
 
 
-static inline int unsorted(const FATELF_record *a, const FATELF_record *b)
+static int compare_record_ptrs(const void *a, const void *b)
 {
-    #define TEST_UNSORTED(field) \
-        if (a->field > b->field) \
-            return 1; \
-        else if (a->field < b->field) \
-            return 0;
-
-    // This is the in order of precedence of fields.
-    TEST_UNSORTED(machine);
-    TEST_UNSORTED(word_size);
-    TEST_UNSORTED(byte_order);
-    TEST_UNSORTED(osabi);
-    TEST_UNSORTED(osabi_version);
-
-    #undef TEST_UNSORTED
-
-    return 0;
-} // unsorted
+    return fatelf_record_compare(*((const FATELF_record **) a),
+                                 *((const FATELF_record **) b));
+} // compare_record_ptrs
 
 
 static int fatelf_split(const char *fname)
@@ -48,7 +34,6 @@ static int fatelf_split(const char *fname)
     const size_t len = sizeof (FATELF_record *) * header->num_records;
     FATELF_record **sorted = (FATELF_record **) xmalloc(len);
     const int maxrecs = header->num_records;
-    int is_sorted = 1;
     int i = 0;
 
     // Try to keep the filenames as short as possible. To start, sort
@@ -56,20 +41,7 @@ static int fatelf_split(const char *fname)
     for (i = 0; i < ((int) header->num_records); i++)
         sorted[i] = &header->records[i];
 
-    do  // bubble sort ftw.
-    {
-        is_sorted = 1;
-        for (i = 0; i < ((int)header->num_records)-1; i++)
-        {
-            if (unsorted(sorted[i], sorted[i+1]))
-            {
-                FATELF_record *tmp = sorted[i];
-                sorted[i] = sorted[i+1];
-                sorted[i+1] = tmp;
-                is_sorted = 0;
-            } // if
-        } // for
-    } while (!is_sorted);
+    qsort(sorted, maxrecs, sizeof (FATELF_record *), compare_record_ptrs);
 
     // now dump each ELF file, naming it with just the minimum set of
     //  attributes that make it unique. We do this by checking the item
@@ -103,12 +75,13 @@ static int fatelf_split(const char *fname)
                 if (!prev && !next) unique = 1; \
             }
 
-        // This must be in the same order as the TEST_UNSORTED things above.
+        // This must be in the same order as fatelf_record_compare() sorts.
         TEST_WANT(machine, MACHINE);
         TEST_WANT(word_size, WORDSIZE);
         TEST_WANT(byte_order, BYTEORDER);
         TEST_WANT(osabi, OSABI);
         TEST_WANT(osabi_version, OSABIVER);
+        TEST_WANT(isa_level, ISALEVEL);
 
         #undef TEST_WANT
 
@@ -132,7 +105,7 @@ static int fatelf_split(const char *fname)
 
 int main(int argc, const char **argv)
 {
-    xfatelf_init(argc, argv);
+    xfatelf_init(&argc, argv);
     if (argc != 2)  // this could stand to use getopt(), later.
         xfail("USAGE: %s <in>", argv[0]);
     return fatelf_split(argv[1]);
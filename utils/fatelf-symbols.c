@@ -0,0 +1,715 @@
+/**
+ * FatELF; support multiple ELF binaries in one file.
+ *
+ * Please see the file LICENSE.txt in the source's root directory.
+ *
+ *  This file written by Ryan C. Gordon.
+ */
+
+// This reads the symbol tables of every record in FatELF files straight
+//  out of a memory mapping, without extracting anything, and can check that
+//  every record exports the same symbols. Records from all the files in a
+//  batch are parsed in parallel, and names are never copied: symbols point
+//  into the mapping until the batch is reported.
+
+#define _GNU_SOURCE 1  // for nftw().
+#define FATELF_UTILS 1
+#include "fatelf-utils.h"
+
+#include <ftw.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#define SYMBOLS_EXIT_DIFFERENT 2  // exit(1) is taken by xfail().
+#define FILES_PER_BATCH 256  // bounds how much is mapped and parsed at once.
+
+typedef struct symbol
+{
+    const char *name;     // points into the mapped file.
+    const char *version;  // NULL if unversioned.
+    uint64_t value;
+    uint8_t type;
+    uint8_t bind;
+    uint8_t is_default;   // name@@version, rather than name@version.
+    uint8_t defined;
+} symbol;
+
+typedef struct symbol_file
+{
+    const char *fname;
+    const uint8_t *map;
+    uint64_t size;
+    FATELF_header *header;  // NULL if it's a plain ELF file.
+    const char *err;        // if we couldn't read it at all.
+    int firstjob;
+    int numjobs;
+} symbol_file;
+
+typedef struct record_job
+{
+    symbol_file *file;
+    const FATELF_record *rec;  // NULL if it's a plain ELF file.
+    const char *err;
+    symbol *symbols;  // sorted by name, then version.
+    uint32_t count;
+    uint8_t word_size;
+} record_job;
+
+typedef struct symbols_options
+{
+    int symtab;  // use .symtab even if there's a .dynsym.
+    int threads;
+} symbols_options;
+
+static symbols_options options;
+
+
+// A null-terminated string at (offset) in a string table, or NULL.
+static const char *get_string(const uint8_t *strtab, const uint64_t strsize,
+                              const uint64_t offset)
+{
+    if ((offset >= strsize) || (memchr(strtab + offset, '\0', strsize - offset) == NULL))
+        return NULL;
+    return (const char *) (strtab + offset);
+} // get_string
+
+
+static int in_bounds(const uint64_t offset, const uint64_t len,
+                     const uint64_t size)
+{
+    return ((offset <= size) && (len <= (size - offset)));
+} // in_bounds
+
+
+typedef struct version_names
+{
+    const char **names;  // by version index.
+    uint32_t count;
+} version_names;
+
+
+static void set_version_name(version_names *versions, const uint32_t idx,
+                             const char *name)
+{
+    if (idx >= versions->count)
+    {
+        const uint32_t count = idx + 16;
+        versions->names = (const char **) realloc(versions->names, sizeof (char *) * count);
+        if (versions->names == NULL)
+            xfail("Out of memory!");
+        memset(versions->names + versions->count, '\0', sizeof (char *) * (count - versions->count));
+        versions->count = count;
+    } // if
+    versions->names[idx] = name;
+} // set_version_name
+
+
+// Walk .gnu.version_d (what this binary defines) or .gnu.version_r (what it
+//  needs from others) to map version indices to names.
+static const char *read_versions(const fatelf_elf_header *hdr,
+                                 const uint8_t *base, const uint64_t size,
+                                 const fatelf_elf_section *sections,
+                                 const int numsections,
+                                 const fatelf_elf_section *sec,
+                                 version_names *versions)
+{
+    const int is_verdef = (sec->type == FATELF_SHT_GNU_VERDEF);
+    const fatelf_elf_section *strsec = NULL;
+    const uint8_t *strtab = NULL;
+    uint64_t pos = 0;
+    uint32_t i;
+
+    if ((sec->link >= (uint32_t) numsections) || (!in_bounds(sec->offset, sec->size, size)))
+        return "has a bogus version section";
+
+    strsec = &sections[sec->link];
+    if (!in_bounds(strsec->offset, strsec->size, size))
+        return "has a bogus version string table";
+    strtab = base + strsec->offset;
+
+    // sh_info is the number of entries in both kinds of section.
+    for (i = 0; i < sec->info; i++)
+    {
+        const uint8_t *entry = base + sec->offset + pos;
+        uint32_t auxpos, next, count, j;
+
+        if (!in_bounds(pos, 16, sec->size))
+            return "has a bogus version section";
+
+        if (is_verdef)  // Elf_Verdef, then Elf_Verdaux; the first is the name.
+        {
+            const uint16_t ndx = fatelf_elf_get16(hdr, entry + 4);
+            if (!in_bounds(pos, 20, sec->size))
+                return "has a bogus version section";
+            auxpos = fatelf_elf_get32(hdr, entry + 12);
+            next = fatelf_elf_get32(hdr, entry + 16);
+            if (!in_bounds(pos + auxpos, 8, sec->size))
+                return "has a bogus version section";
+            set_version_name(versions, ndx & 0x7FFF,
+                get_string(strtab, strsec->size, fatelf_elf_get32(hdr, base + sec->offset + pos + auxpos)));
+        } // if
+        else  // Elf_Verneed, then an Elf_Vernaux for each version.
+        {
+            uint64_t aux;
+            count = fatelf_elf_get16(hdr, entry + 2);
+            auxpos = fatelf_elf_get32(hdr, entry + 8);
+            next = fatelf_elf_get32(hdr, entry + 12);
+            aux = pos + auxpos;
+            for (j = 0; j < count; j++)
+            {
+                const uint8_t *vernaux = base + sec->offset + aux;
+                if (!in_bounds(aux, 16, sec->size))
+                    return "has a bogus version section";
+                set_version_name(versions, fatelf_elf_get16(hdr, vernaux + 6) & 0x7FFF,
+                    get_string(strtab, strsec->size, fatelf_elf_get32(hdr, vernaux + 8)));
+                if (fatelf_elf_get32(hdr, vernaux + 12) == 0)
+                    break;
+                aux += fatelf_elf_get32(hdr, vernaux + 12);
+            } // for
+        } // else
+
+        if (next == 0)
+            break;
+        pos += next;
+    } // for
+
+    return NULL;
+} // read_versions
+
+
+static int compare_symbols(const void *_a, const void *_b)
+{
+    const symbol *a = (const symbol *) _a;
+    const symbol *b = (const symbol *) _b;
+    const int rc = strcmp(a->name, b->name);
+    if (rc != 0)
+        return rc;
+    else if ((a->version == NULL) || (b->version == NULL))
+        return (a->version != NULL) - (b->version != NULL);
+    return strcmp(a->version, b->version);
+} // compare_symbols
+
+
+// Pull the global symbols out of one ELF binary in memory. Doesn't call
+//  exit(): returns a reason if the binary is damaged.
+static const char *read_symbols(const uint8_t *base, const uint64_t size,
+                                symbol **_symbols, uint32_t *_count,
+                                uint8_t *_word_size)
+{
+    fatelf_elf_header hdr;
+    fatelf_elf_section *sections = NULL;
+    const fatelf_elf_section *table = NULL;
+    const fatelf_elf_section *strsec = NULL;
+    const uint8_t *versym = NULL;
+    version_names versions;
+    symbol *symbols = NULL;
+    uint32_t count = 0;
+    uint64_t total, symsize, j;
+    const char *err = NULL;
+    int i;
+
+    *_symbols = NULL;
+    *_count = 0;
+    memset(&versions, '\0', sizeof (versions));
+
+    if ((err = fatelf_elf_decode_header(base, (size_t) ((size < 64) ? size : 64), &hdr)) != NULL)
+        return err;
+
+    *_word_size = hdr.word_size;
+    if (hdr.shnum == 0)
+        return NULL;  // stripped to nothing; no symbols.
+    else if ( (hdr.shentsize < FATELF_ELF_SHDR_SIZE(hdr.word_size)) ||
+              (!in_bounds(hdr.shoff, ((uint64_t) hdr.shnum) * hdr.shentsize, size)) )
+        return "has bogus section headers";
+
+    sections = (fatelf_elf_section *) xmalloc(sizeof (fatelf_elf_section) * hdr.shnum);
+    for (i = 0; i < hdr.shnum; i++)
+        fatelf_elf_decode_section(&hdr, base + hdr.shoff + (((uint64_t) i) * hdr.shentsize), &sections[i]);
+
+    for (i = 0; i < hdr.shnum; i++)
+    {
+        if ((sections[i].type == FATELF_SHT_DYNSYM) && (!options.symtab))
+            table = &sections[i];
+        else if ((sections[i].type == FATELF_SHT_SYMTAB) && ((table == NULL) || (options.symtab)))
+            table = &sections[i];
+    } // for
+
+    if (table == NULL)
+    {
+        free(sections);
+        return NULL;  // no symbols.
+    } // if
+
+    symsize = FATELF_ELF_SYM_SIZE(hdr.word_size);
+    total = table->size / symsize;
+    if ( (table->link >= hdr.shnum) || (!in_bounds(table->offset, total * symsize, size)) ||
+         (!in_bounds(sections[table->link].offset, sections[table->link].size, size)) )
+    {
+        free(sections);
+        return "has a bogus symbol table";
+    } // if
+    strsec = &sections[table->link];
+
+    // Versions only apply to .dynsym.
+    for (i = 0; (i < hdr.shnum) && (err == NULL); i++)
+    {
+        const fatelf_elf_section *sec = &sections[i];
+        if (table->type != FATELF_SHT_DYNSYM)
+            break;
+        else if ((sec->type == FATELF_SHT_GNU_VERSYM) && (&sections[sec->link] == table))
+        {
+            if (in_bounds(sec->offset, total * 2, size))
+                versym = base + sec->offset;
+        } // else if
+        else if ((sec->type == FATELF_SHT_GNU_VERDEF) || (sec->type == FATELF_SHT_GNU_VERNEED))
+            err = read_versions(&hdr, base, size, sections, hdr.shnum, sec, &versions);
+    } // for
+
+    if (err != NULL)
+    {
+        free(versions.names);
+        free(sections);
+        return err;
+    } // if
+
+    symbols = (symbol *) xmalloc(sizeof (symbol) * (total + 1));
+    for (j = 1; j < total; j++)  // symbol 0 is always the null symbol.
+    {
+        symbol *sym = &symbols[count];
+        fatelf_elf_symbol elfsym;
+        int visibility;
+
+        fatelf_elf_decode_symbol(&hdr, base + table->offset + (j * symsize), &elfsym);
+        sym->bind = FATELF_ELF_ST_BIND(elfsym.info);
+        sym->type = FATELF_ELF_ST_TYPE(elfsym.info);
+        visibility = FATELF_ELF_ST_VISIBILITY(elfsym.other);
+        if (sym->bind == FATELF_STB_LOCAL)
+            continue;
+        else if ((sym->type == FATELF_STT_SECTION) || (sym->type == FATELF_STT_FILE))
+            continue;
+        else if ((visibility != FATELF_STV_DEFAULT) && (visibility != FATELF_STV_PROTECTED))
+            continue;  // hidden symbols aren't part of the ABI.
+        else if ((sym->name = get_string(base + strsec->offset, strsec->size, elfsym.name)) == NULL)
+            continue;
+        else if (*sym->name == '\0')
+            continue;
+
+        sym->value = elfsym.value;
+        sym->defined = (elfsym.shndx != FATELF_SHN_UNDEF);
+        sym->version = NULL;
+        sym->is_default = 1;
+        if (versym != NULL)
+        {
+            const uint16_t vs = fatelf_elf_get16(&hdr, versym + (j * 2));
+            const uint32_t idx = vs & 0x7FFF;
+            if ((idx >= 2) && (idx < versions.count))  // 0 and 1 are unversioned.
+                sym->version = versions.names[idx];
+            sym->is_default = ((!sym->defined) || (vs & FATELF_VERSYM_HIDDEN)) ? 0 : 1;
+        } // if
+        count++;
+    } // for
+
+    qsort(symbols, count, sizeof (symbol), compare_symbols);
+
+    free(versions.names);
+    free(sections);
+    *_symbols = symbols;
+    *_count = count;
+    return NULL;
+} // read_symbols
+
+
+static void parse_worker(void *data, const int idx)
+{
+    record_job *job = &((record_job *) data)[idx];
+    const symbol_file *file = job->file;
+    const uint64_t offset = job->rec ? job->rec->offset : 0;
+    const uint64_t size = job->rec ? job->rec->size : file->size;
+    job->err = read_symbols(file->map + offset, size, &job->symbols, &job->count, &job->word_size);
+} // parse_worker
+
+
+// Map a file and queue a job for each of its records. Files found by
+//  walking a directory that aren't FatELF are skipped; named ones that
+//  are plain ELF get one job.
+static int open_symbol_file(symbol_file *file, const char *fname,
+                            const int from_walk, record_job **jobs,
+                            int *numjobs, int *allocated)
+{
+    const int fd = open(fname, O_RDONLY | O_CLOEXEC);
+    const char *err = NULL;
+    struct stat statbuf;
+    int i;
+
+    memset(file, '\0', sizeof (*file));
+    file->fname = fname;
+
+    if ((fd == -1) || (fstat(fd, &statbuf) == -1))
+        xfail("Can't read '%s': %s", fname, strerror(errno));
+
+    file->size = (uint64_t) statbuf.st_size;
+    file->header = fatelf_pread_header(fd, 0, file->size, &err);
+    if ((file->header == NULL) && ((from_walk) || (strcmp(err, "is not a FatELF binary") != 0)))
+    {
+        close(fd);
+        if (from_walk)
+            return 0;  // just something else in the tree.
+        xfail("'%s' %s", fname, err);
+    } // if
+
+    if (file->size > 0)
+    {
+        file->map = (const uint8_t *) mmap(NULL, (size_t) file->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (file->map == MAP_FAILED)
+            xfail("Failed to map '%s': %s", fname, strerror(errno));
+    } // if
+    close(fd);  // the mapping stays.
+
+    file->firstjob = *numjobs;
+    file->numjobs = file->header ? (int) file->header->num_records : 1;
+    for (i = 0; i < file->numjobs; i++)
+    {
+        record_job *job;
+        if (*numjobs == *allocated)
+        {
+            *allocated = *allocated ? (*allocated * 2) : 256;
+            *jobs = (record_job *) realloc(*jobs, sizeof (record_job) * (*allocated));
+            if (*jobs == NULL)
+                xfail("Out of memory!");
+        } // if
+        job = &(*jobs)[(*numjobs)++];
+        memset(job, '\0', sizeof (*job));
+        job->rec = file->header ? &file->header->records[i] : NULL;
+    } // for
+
+    return 1;
+} // open_symbol_file
+
+
+static const char *record_name(const record_job *job)
+{
+    if (job->rec == NULL)
+        return "ELF";
+    return fatelf_get_target_name(job->rec, FATELF_WANT_EVERYTHING);
+} // record_name
+
+
+static const char *type_name(const uint8_t type)
+{
+    switch (type)
+    {
+        case 0: return "NOTYPE";
+        case 1: return "OBJECT";
+        case 2: return "FUNC";
+        case 5: return "COMMON";
+        case 6: return "TLS";
+        case 10: return "IFUNC";
+    } // switch
+    return "OTHER";
+} // type_name
+
+
+static const char *bind_name(const uint8_t bind)
+{
+    if (bind == FATELF_STB_GLOBAL)
+        return "GLOBAL";
+    else if (bind == FATELF_STB_WEAK)
+        return "WEAK";
+    else if (bind == FATELF_STB_GNU_UNIQUE)
+        return "UNIQUE";
+    return "OTHER";
+} // bind_name
+
+
+static void print_symbol_name(const symbol *sym)
+{
+    if (sym->version == NULL)
+        printf("%s\n", sym->name);
+    else
+        printf("%s%s%s\n", sym->name, sym->is_default ? "@@" : "@", sym->version);
+} // print_symbol_name
+
+
+static int list_file(const symbol_file *file, const record_job *jobs)
+{
+    int i;
+    uint32_t j;
+
+    for (i = 0; i < file->numjobs; i++)
+    {
+        const record_job *job = &jobs[file->firstjob + i];
+        const int width = (job->word_size == FATELF_32BITS) ? 8 : 16;
+        printf("%s: %s:\n", file->fname, record_name(job));
+        if (job->err != NULL)
+            xfail("'%s' %s in record #%d", file->fname, job->err, i);
+
+        for (j = 0; j < job->count; j++)
+        {
+            const symbol *sym = &job->symbols[j];
+            if (sym->defined)
+                printf("  %0*llx ", width, (unsigned long long) sym->value);
+            else
+                printf("  %*s ", width, "");
+            printf("%-6s %-6s %s ", type_name(sym->type), bind_name(sym->bind),
+                   sym->defined ? "DEF" : "UND");
+            print_symbol_name(sym);
+        } // for
+    } // for
+
+    return 0;
+} // list_file
+
+
+typedef struct exported
+{
+    const symbol *sym;
+    int record;
+} exported;
+
+
+static int compare_exported(const void *_a, const void *_b)
+{
+    const exported *a = (const exported *) _a;
+    const exported *b = (const exported *) _b;
+    const int rc = compare_symbols(a->sym, b->sym);
+    return (rc != 0) ? rc : (a->record - b->record);
+} // compare_exported
+
+
+// Report symbols that some records export and others don't, and symbols
+//  whose type differs between records. Returns non-zero if there were any.
+static int check_file(const symbol_file *file, const record_job *jobs)
+{
+    const record_job *first = &jobs[file->firstjob];
+    exported *all = NULL;
+    uint64_t total = 0;
+    int diffs = 0;
+    uint64_t i, j;
+    int r;
+
+    for (r = 0; r < file->numjobs; r++)
+    {
+        if (first[r].err != NULL)
+        {
+            printf("%s: %s: %s\n", file->fname, record_name(&first[r]), first[r].err);
+            return 1;
+        } // if
+        total += first[r].count;
+    } // for
+
+    if (file->numjobs < 2)
+        return 0;  // nothing to compare.
+
+    all = (exported *) xmalloc(sizeof (exported) * (total + 1));
+    total = 0;
+    for (r = 0; r < file->numjobs; r++)
+    {
+        for (j = 0; j < first[r].count; j++)
+        {
+            if (first[r].symbols[j].defined)
+            {
+                all[total].sym = &first[r].symbols[j];
+                all[total].record = r;
+                total++;
+            } // if
+        } // for
+    } // for
+
+    qsort(all, total, sizeof (exported), compare_exported);
+
+    // Each run of equal symbols should have one entry per record.
+    for (i = 0; i < total; i = j)
+    {
+        int type_differs = 0;
+        int seen = 0;
+        for (j = i; (j < total) && (compare_symbols(all[i].sym, all[j].sym) == 0); j++)
+        {
+            if ((j == i) || (all[j].record != all[j-1].record))
+                seen++;
+            if (all[j].sym->type != all[i].sym->type)
+                type_differs = 1;
+        } // for
+
+        if ((seen == file->numjobs) && (!type_differs))
+            continue;
+
+        diffs++;
+        printf("%s: ", file->fname);
+        if (seen < file->numjobs)
+        {
+            uint64_t k = i;
+            printf("missing from");
+            for (r = 0; r < file->numjobs; r++)
+            {
+                while ((k < j) && (all[k].record < r))
+                    k++;
+                if ((k == j) || (all[k].record != r))
+                    printf(" %s", record_name(&first[r]));
+            } // for
+            printf(": ");
+        } // if
+        else
+            printf("type differs: ");
+        print_symbol_name(all[i].sym);
+    } // for
+
+    free(all);
+    return diffs;
+} // check_file
+
+
+static const char **walk_files = NULL;  // nftw() doesn't pass a context pointer.
+static int walk_count = 0;
+static int walk_allocated = 0;
+
+
+static int walk_callback(const char *fname, const struct stat *statbuf,
+                         int typeflag, struct FTW *ftwbuf)
+{
+    (void) ftwbuf;
+    if ((typeflag == FTW_DNR) || (typeflag == FTW_NS))
+        xfail("Can't read '%s'", fname);
+    else if (!S_ISREG(statbuf->st_mode))
+        return 0;
+
+    if (walk_count == walk_allocated)
+    {
+        walk_allocated = walk_allocated ? (walk_allocated * 2) : 1024;
+        walk_files = (const char **) realloc(walk_files, sizeof (char *) * walk_allocated);
+        if (walk_files == NULL)
+            xfail("Out of memory!");
+    } // if
+    walk_files[walk_count++] = xstrdup(fname);
+    return 0;
+} // walk_callback
+
+
+static int compare_strings(const void *a, const void *b)
+{
+    return strcmp(*((const char **) a), *((const char **) b));
+} // compare_strings
+
+
+static int fatelf_symbols(const char **paths, const int numpaths,
+                          const int check)
+{
+    symbol_file *files = (symbol_file *) xmalloc(sizeof (symbol_file) * FILES_PER_BATCH);
+    int *from_walk = NULL;
+    int checked = 0, differing = 0;
+    int start, i, j;
+
+    // Directories are searched for FatELF files; plain files are used as-is.
+    for (i = 0; i < numpaths; i++)
+    {
+        struct stat statbuf;
+        const int before = walk_count;
+        if (stat(paths[i], &statbuf) == -1)
+            xfail("Can't read '%s': %s", paths[i], strerror(errno));
+        else if (!S_ISDIR(statbuf.st_mode))
+            walk_callback(paths[i], &statbuf, FTW_F, NULL);
+        else
+        {
+            if (nftw(paths[i], walk_callback, 64, FTW_PHYS) == -1)
+                xfail("Failed to scan '%s': %s", paths[i], strerror(errno));
+            qsort(walk_files + before, walk_count - before, sizeof (char *), compare_strings);
+        } // else
+
+        from_walk = (int *) realloc(from_walk, sizeof (int) * (walk_count + 1));
+        if (from_walk == NULL)
+            xfail("Out of memory!");
+        for (j = before; j < walk_count; j++)
+            from_walk[j] = S_ISDIR(statbuf.st_mode);
+    } // for
+
+    for (start = 0; start < walk_count; start += FILES_PER_BATCH)
+    {
+        const int end = ((walk_count - start) < FILES_PER_BATCH) ? walk_count : (start + FILES_PER_BATCH);
+        record_job *jobs = NULL;
+        int numjobs = 0, allocated = 0;
+        int numfiles = 0;
+
+        for (i = start; i < end; i++)
+        {
+            if (open_symbol_file(&files[numfiles], walk_files[i], from_walk[i], &jobs, &numjobs, &allocated))
+                numfiles++;
+        } // for
+
+        // jobs moved around while we were adding them, so point them at
+        //  their files now.
+        for (i = 0; i < numfiles; i++)
+        {
+            for (j = 0; j < files[i].numjobs; j++)
+                jobs[files[i].firstjob + j].file = &files[i];
+        } // for
+
+        fatelf_parallel_for(numjobs, options.threads, parse_worker, jobs);
+
+        for (i = 0; i < numfiles; i++)
+        {
+            symbol_file *file = &files[i];
+            if (!check)
+                list_file(file, jobs);
+            else
+            {
+                checked++;
+                if (check_file(file, jobs))
+                    differing++;
+            } // else
+
+            for (j = 0; j < file->numjobs; j++)
+                free(jobs[file->firstjob + j].symbols);
+            if (file->map != NULL)
+                munmap((void *) file->map, (size_t) file->size);
+            free(file->header);
+        } // for
+
+        free(jobs);
+    } // for
+
+    if (check)
+    {
+        printf("%d files checked, %d with differences between records.\n",
+               checked, differing);
+    } // if
+
+    for (i = 0; i < walk_count; i++)
+        free((void *) walk_files[i]);
+    free(walk_files);
+    free(from_walk);
+    free(files);
+
+    return differing ? SYMBOLS_EXIT_DIFFERENT : 0;
+} // fatelf_symbols
+
+
+int main(int argc, const char **argv)
+{
+    const char *usage = "USAGE: %s [--jobs=N] [--symtab] list <in> [... <in>]\n"
+                        "       %s [--jobs=N] [--symtab] check <in|dir> [... <in|dir>]";
+    int i = 1;
+
+    xfatelf_init(&argc, argv);
+
+    while ((i < argc) && (strncmp(argv[i], "--", 2) == 0))
+    {
+        if (strncmp(argv[i], "--jobs=", 7) == 0)
+            options.threads = atoi(argv[i] + 7);
+        else if (strcmp(argv[i], "--symtab") == 0)
+            options.symtab = 1;
+        else
+            xfail("Unknown option '%s'", argv[i]);
+        i++;
+    } // while
+
+    if ((i < argc) && (strcmp(argv[i], "list") == 0) && (argc > i + 1))
+        return fatelf_symbols(argv + i + 1, argc - (i + 1), 0);
+    else if ((i < argc) && (strcmp(argv[i], "check") == 0) && (argc > i + 1))
+        return fatelf_symbols(argv + i + 1, argc - (i + 1), 1);
+
+    // this could stand to use getopt(), later.
+    xfail(usage, argv[0], argv[0]);
+    return 1;
+} // main
+
+// end of fatelf-symbols.c ...
@@ -0,0 +1,1247 @@
+/**
+ * FatELF; support multiple ELF binaries in one file.
+ *
+ * Please see the file LICENSE.txt in the source's root directory.
+ *
+ *  This file written by Ryan C. Gordon.
+ */
+
+// This works on tar archives without unpacking them. "thin" and "remove"
+//  are filters: they read a tar stream on stdin and write one on stdout,
+//  and each FatELF member comes out like fatelf-extract or fatelf-remove
+//  would have written it, with its tar headers fixed to match. Everything
+//  else passes through untouched. Memory use doesn't depend on how big the
+//  members are, just on how big their headers are, and nothing goes to
+//  disk, except a FatELF member with junk on a stdin we can't seek: junk
+//  with a resource table needs padding we can only size from its trailer,
+//  so that member gets spooled to a temp file first. "merge" takes several tar files (say, a sysroot per CPU
+//  architecture) and writes one where each path that's an ELF binary in
+//  more than one of them is glued into a FatELF file, like fatelf-glue.
+
+#define FATELF_UTILS 1
+#include "fatelf-utils.h"
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define TAR_BLOCK 512
+#define TAR_RECORD (TAR_BLOCK * 20)  // tar pads whole archives to this.
+#define TAR_MAX_PREAMBLE (1024 * 1024)  // most extended header data we hold.
+#define TAR_MAX_FATELF_HEADER FATELF_DISK_FORMAT_SIZE_V2(65536)
+#define TAR_OCTAL_MAX 077777777777ULL  // biggest size an 11-digit field holds.
+
+typedef enum
+{
+    TAR_THIN,
+    TAR_REMOVE,
+    TAR_MERGE
+} tar_mode;
+
+// What to do with junk at the end of FatELF members, in merge mode.
+typedef enum junk_policy
+{
+    JUNK_KEEP,   // keep it, but fail if more than one input has some.
+    JUNK_FIRST,  // keep the first input's junk, drop the rest.
+    JUNK_DROP    // drop it all.
+} junk_policy;
+
+typedef enum
+{
+    MEMBER_OTHER,
+    MEMBER_ELF,
+    MEMBER_FATELF
+} member_kind;
+
+typedef struct tar_archive
+{
+    const char *name;
+    int fd;
+    uint64_t pos;   // bytes read so far.
+    int seekable;
+} tar_archive;
+
+// A growable buffer for the header blocks in front of a member.
+typedef struct tar_buffer
+{
+    uint8_t *data;
+    size_t len;
+    size_t allocated;
+} tar_buffer;
+
+typedef struct tar_member
+{
+    uint64_t start;       // where its first header block is in the archive.
+    uint64_t dataoffset;  // where its data starts.
+    uint64_t size;        // how much data it has.
+    int64_t pax;          // where its pax header block is, from start. -1 if none.
+    uint64_t paxlen;      // how much data that pax header has.
+    char typeflag;
+    char *path;           // without a leading "./" or trailing "/".
+} tar_member;
+
+// One piece of a member we're rewriting, in stream mode.
+typedef enum
+{
+    PIECE_MEMORY,
+    PIECE_ZEROS,
+    PIECE_INPUT
+} piece_type;
+
+typedef struct tar_piece
+{
+    piece_type type;
+    const uint8_t *mem;
+    uint64_t offset;  // from the start of the member's data, for PIECE_INPUT.
+    uint64_t len;
+} tar_piece;
+
+// A member of one of the archives we're merging.
+typedef struct merge_entry
+{
+    int archive;
+    int kind;
+    int done;
+    tar_member mem;
+} merge_entry;
+
+static const char *outname = "stdout";
+static const int outfd = 1;
+static uint64_t outpos = 0;
+static uint8_t copybuf[256 * 1024];
+static const uint8_t zeroblock[TAR_BLOCK];
+
+
+static uint64_t round_to_block(const uint64_t len)
+{
+    return (len + (TAR_BLOCK - 1)) & ~((uint64_t) (TAR_BLOCK - 1));
+} // round_to_block
+
+
+static void write_out(const void *_buf, size_t len)
+{
+    const uint8_t *buf = (const uint8_t *) _buf;
+    outpos += len;
+    while (len > 0)
+    {
+        const ssize_t rc = xwrite(outname, outfd, buf, len);
+        buf += rc;
+        len -= (size_t) rc;
+    } // while
+} // write_out
+
+
+static void write_zeros_out(const uint64_t len)
+{
+    xwrite_zeros(outname, outfd, (size_t) len);
+    outpos += len;
+} // write_zeros_out
+
+
+// pad the output to the end of the block, after (len) bytes of data.
+static void pad_out(const uint64_t len)
+{
+    write_zeros_out(round_to_block(len) - len);
+} // pad_out
+
+
+// Returns how many bytes we got; less than (len) only at the end of input.
+static size_t read_some(tar_archive *ar, void *_buf, size_t len)
+{
+    uint8_t *buf = (uint8_t *) _buf;
+    size_t total = 0;
+    while (total < len)
+    {
+        const ssize_t rc = xread(ar->name, ar->fd, buf + total, len - total, 0);
+        if (rc == 0)
+            break;
+        total += (size_t) rc;
+    } // while
+    ar->pos += total;
+    return total;
+} // read_some
+
+
+static void read_exact(tar_archive *ar, void *buf, const size_t len)
+{
+    if (read_some(ar, buf, len) != len)
+        xfail("'%s' is truncated", ar->name);
+} // read_exact
+
+
+static void skip_input(tar_archive *ar, uint64_t len)
+{
+    if (ar->seekable)
+    {
+        xlseek(ar->name, ar->fd, (off_t) len, SEEK_CUR);
+        ar->pos += len;
+        return;
+    } // if
+
+    while (len > 0)
+    {
+        const size_t count = (len < sizeof (copybuf)) ? (size_t) len : sizeof (copybuf);
+        read_exact(ar, copybuf, count);
+        len -= count;
+    } // while
+} // skip_input
+
+
+static void copy_input(tar_archive *ar, uint64_t len)
+{
+    const uint64_t start = fatelf_stats_begin();
+    const uint64_t total = len;
+    while (len > 0)
+    {
+        const size_t count = (len < sizeof (copybuf)) ? (size_t) len : sizeof (copybuf);
+        read_exact(ar, copybuf, count);
+        write_out(copybuf, count);
+        len -= count;
+    } // while
+    fatelf_stats_end(FATELF_STATS_PHASE_COPY, start, total);
+} // copy_input
+
+
+// copy from a tar file we can pread() from, which can take the fast paths.
+static void copy_archive_range(const tar_archive *ar, const uint64_t offset,
+                               const uint64_t len)
+{
+    xcopyfile_range(ar->name, ar->fd, outname, outfd, offset, len);
+    outpos += len;
+} // copy_archive_range
+
+
+static uint8_t *grow_buffer(tar_buffer *buf, const size_t len)
+{
+    if ((buf->len + len) > buf->allocated)
+    {
+        buf->allocated = (buf->len + len) * 2;
+        buf->data = (uint8_t *) realloc(buf->data, buf->allocated);
+        if (buf->data == NULL)
+            xfail("Out of memory!");
+    } // if
+    buf->len += len;
+    return buf->data + (buf->len - len);
+} // grow_buffer
+
+
+static int is_zero_block(const uint8_t *block)
+{
+    return (memcmp(block, zeroblock, TAR_BLOCK) == 0);
+} // is_zero_block
+
+
+static uint64_t parse_number(const tar_archive *ar, const uint8_t *field,
+                             const size_t len)
+{
+    uint64_t retval = 0;
+    size_t i = 0;
+
+    if (field[0] & 0x80)  // GNU base-256, for numbers too big for octal.
+    {
+        if ((field[0] != 0x80) || (len > 12))
+            xfail("'%s' has a tar header with a number we can't use", ar->name);
+        for (i = 1; i < len; i++)
+            retval = (retval << 8) | field[i];
+        return retval;
+    } // if
+
+    while ((i < len) && (field[i] == ' '))
+        i++;
+    for (; (i < len) && (field[i] >= '0') && (field[i] <= '7'); i++)
+        retval = (retval << 3) | (uint64_t) (field[i] - '0');
+    if ((i < len) && (field[i] != ' ') && (field[i] != '\0'))
+        xfail("'%s' has a tar header with a bad number in it", ar->name);
+    return retval;
+} // parse_number
+
+
+static void set_size_field(uint8_t *hdr, const uint64_t size)
+{
+    uint8_t *field = hdr + 124;
+    if (size <= TAR_OCTAL_MAX)
+        snprintf((char *) field, 12, "%011llo", (unsigned long long) size);
+    else
+    {
+        uint64_t val = size;
+        int i;
+        for (i = 11; i > 0; i--, val >>= 8)
+            field[i] = (uint8_t) (val & 0xFF);
+        field[0] = 0x80;
+    } // else
+} // set_size_field
+
+
+static unsigned int header_checksum(const uint8_t *hdr)
+{
+    unsigned int retval = 0;
+    int i;
+    for (i = 0; i < TAR_BLOCK; i++)
+        retval += ((i >= 148) && (i < 156)) ? ' ' : hdr[i];
+    return retval;
+} // header_checksum
+
+
+static void set_checksum(uint8_t *hdr)
+{
+    snprintf((char *) hdr + 148, 7, "%06o", header_checksum(hdr));
+    hdr[155] = ' ';
+} // set_checksum
+
+
+// Pull "path" and "size" out of pax extended header records.
+static void parse_pax(const tar_archive *ar, const uint8_t *data,
+                      const uint64_t len, char **path, int64_t *size)
+{
+    uint64_t pos = 0;
+    while (pos < len)
+    {
+        const char *rec = (const char *) data + pos;
+        const char *key;
+        const char *eq;
+        uint64_t reclen = 0;
+        uint64_t i;
+
+        for (i = 0; (pos + i < len) && (rec[i] >= '0') && (rec[i] <= '9'); i++)
+            reclen = (reclen * 10) + (uint64_t) (rec[i] - '0');
+        if ((pos + i >= len) || (reclen == 0) || (reclen > (len - pos)) ||
+            (i + 1 >= reclen) || (rec[i] != ' ') || (rec[reclen-1] != '\n'))
+            xfail("'%s' has a bad pax header", ar->name);
+
+        // (xfail() doesn't return, but the compiler doesn't know that.)
+        key = rec + i + 1;
+        eq = (i + 1 < reclen) ? memchr(key, '=', reclen - (i + 1)) : NULL;
+        if (eq != NULL)
+        {
+            const size_t keylen = (size_t) (eq - key);
+            const size_t vallen = (size_t) ((rec + reclen - 1) - (eq + 1));
+            if ((keylen == 4) && (memcmp(key, "path", 4) == 0))
+            {
+                free(*path);
+                *path = (char *) xmalloc(vallen + 1);
+                memcpy(*path, eq + 1, vallen);
+                (*path)[vallen] = '\0';
+            } // if
+            else if ((keylen == 4) && (memcmp(key, "size", 4) == 0))
+            {
+                char *endptr = NULL;
+                *size = (int64_t) strtoull(eq + 1, &endptr, 10);
+                if (endptr != (eq + 1 + vallen))
+                    xfail("'%s' has a bad pax header", ar->name);
+            } // else if
+        } // if
+
+        pos += reclen;
+    } // while
+} // parse_pax
+
+
+// Same pax records, with a new "size" (if there was one). free() the result.
+static uint8_t *rebuild_pax(const uint8_t *data, const uint64_t len,
+                            const uint64_t newsize, uint64_t *newlen)
+{
+    uint8_t *retval = (uint8_t *) xmalloc((size_t) len + 64);
+    uint64_t pos = 0;
+    uint64_t out = 0;
+
+    while (pos < len)
+    {
+        const char *rec = (const char *) data + pos;
+        const uint64_t reclen = strtoull(rec, NULL, 10);  // parse_pax checked these.
+        const char *key = strchr(rec, ' ') + 1;
+
+        if (strncmp(key, "size=", 5) == 0)
+        {
+            // the length counts its own digits, so it might need one more.
+            char body[64];
+            int bodylen = snprintf(body, sizeof (body), " size=%llu\n", (unsigned long long) newsize);
+            int total = bodylen + snprintf(NULL, 0, "%d", bodylen);
+            if (snprintf(NULL, 0, "%d", total) + bodylen != total)
+                total++;
+            out += (uint64_t) sprintf((char *) retval + out, "%d%s", total, body);
+        } // if
+        else
+        {
+            memcpy(retval + out, rec, (size_t) reclen);
+            out += reclen;
+        } // else
+
+        pos += reclen;
+    } // while
+
+    *newlen = out;
+    return retval;
+} // rebuild_pax
+
+
+static char *normalize_path(char *path)
+{
+    size_t len;
+    char *src = path;
+
+    while ((src[0] == '.') && (src[1] == '/'))
+    {
+        src += 2;
+        while (*src == '/')
+            src++;
+    } // while
+    while (*src == '/')
+        src++;
+
+    len = strlen(src);
+    memmove(path, src, len + 1);
+    while ((len > 0) && (path[len-1] == '/'))
+        path[--len] = '\0';
+    return path;
+} // normalize_path
+
+
+// Read all the header blocks for the next member into (pre). Returns zero
+//  at the end of the archive, with the end block in (pre).
+static int read_member(tar_archive *ar, tar_member *mem, tar_buffer *pre)
+{
+    char *paxpath = NULL;
+    char *longname = NULL;
+    int64_t paxsize = -1;
+
+    memset(mem, '\0', sizeof (*mem));
+    mem->start = ar->pos;
+    mem->pax = -1;
+    pre->len = 0;
+
+    while (1)
+    {
+        const size_t hdroffset = pre->len;
+        uint8_t *hdr = grow_buffer(pre, TAR_BLOCK);
+        unsigned int sum;
+        uint64_t size;
+        char type;
+
+        read_exact(ar, hdr, TAR_BLOCK);
+        if (is_zero_block(hdr))
+        {
+            if (hdroffset != 0)
+                xfail("'%s' ends in the middle of a member's headers", ar->name);
+            free(paxpath);
+            free(longname);
+            return 0;
+        } // if
+
+        sum = (unsigned int) parse_number(ar, hdr + 148, 8);
+        if (sum != header_checksum(hdr))
+            xfail("'%s' has a tar header with a bad checksum", ar->name);
+
+        size = parse_number(ar, hdr + 124, 12);
+        type = (char) hdr[156];
+
+        if ((type == 'x') || (type == 'L') || (type == 'K'))
+        {
+            const uint64_t padded = round_to_block(size);
+            uint8_t *data;
+
+            if ((pre->len + padded) > TAR_MAX_PREAMBLE)
+                xfail("'%s' has extended tar headers that are too big", ar->name);
+
+            data = grow_buffer(pre, (size_t) padded);
+            read_exact(ar, data, (size_t) padded);
+
+            if (type == 'x')
+            {
+                mem->pax = (int64_t) hdroffset;
+                mem->paxlen = size;
+                parse_pax(ar, data, size, &paxpath, &paxsize);
+            } // if
+            else if (type == 'L')
+            {
+                free(longname);
+                longname = (char *) xmalloc((size_t) size + 1);
+                memcpy(longname, data, (size_t) size);
+                longname[size] = '\0';
+            } // else if
+            continue;  // the member itself comes next.
+        } // if
+
+        mem->typeflag = type;
+        mem->size = (paxsize >= 0) ? (uint64_t) paxsize : size;
+        mem->dataoffset = ar->pos;
+
+        if (paxpath != NULL)
+            mem->path = paxpath;
+        else if (longname != NULL)
+            mem->path = longname;
+        else
+        {
+            const char *name = (const char *) hdr;
+            const char *prefix = (const char *) hdr + 345;
+            const size_t namelen = strnlen(name, 100);
+            const size_t prefixlen = (memcmp(hdr + 257, "ustar", 5) == 0) ? strnlen(prefix, 155) : 0;
+            mem->path = (char *) xmalloc(prefixlen + namelen + 2);
+            if (prefixlen > 0)
+            {
+                memcpy(mem->path, prefix, prefixlen);
+                mem->path[prefixlen] = '/';
+                memcpy(mem->path + prefixlen + 1, name, namelen);
+                mem->path[prefixlen + namelen + 1] = '\0';
+            } // if
+            else
+            {
+                memcpy(mem->path, name, namelen);
+                mem->path[namelen] = '\0';
+            } // else
+        } // else
+
+        if ((paxpath != NULL) && (longname != NULL))
+            free(longname);
+
+        normalize_path(mem->path);
+        return 1;
+    } // while
+} // read_member
+
+
+static int is_regular_file(const tar_member *mem)
+{
+    return ((mem->typeflag == '0') || (mem->typeflag == '\0') || (mem->typeflag == '7'));
+} // is_regular_file
+
+
+// Write a member's header blocks, changing its size to (newsize).
+static void write_member_headers(const tar_member *mem, const uint8_t *pre,
+                                 const size_t prelen, const uint64_t newsize)
+{
+    uint8_t hdr[TAR_BLOCK];
+    size_t pos = 0;
+
+    if (newsize == mem->size)
+    {
+        write_out(pre, prelen);
+        return;
+    } // if
+
+    if (mem->pax >= 0)
+    {
+        const size_t paxoffset = (size_t) mem->pax;
+        const uint8_t *paxdata = pre + paxoffset + TAR_BLOCK;
+        uint64_t paxlen = 0;
+        uint8_t *pax = rebuild_pax(paxdata, mem->paxlen, newsize, &paxlen);
+
+        write_out(pre, paxoffset);
+        memcpy(hdr, pre + paxoffset, TAR_BLOCK);
+        set_size_field(hdr, paxlen);
+        set_checksum(hdr);
+        write_out(hdr, TAR_BLOCK);
+        write_out(pax, (size_t) paxlen);
+        pad_out(paxlen);
+        free(pax);
+        pos = paxoffset + TAR_BLOCK + (size_t) round_to_block(mem->paxlen);
+    } // if
+
+    // everything between the pax header and the member's own header.
+    write_out(pre + pos, (prelen - TAR_BLOCK) - pos);
+
+    memcpy(hdr, pre + (prelen - TAR_BLOCK), TAR_BLOCK);
+    if ((newsize > TAR_OCTAL_MAX) && (mem->pax >= 0))
+        set_size_field(hdr, 0);  // the pax header has the real size.
+    else
+        set_size_field(hdr, newsize);
+    set_checksum(hdr);
+    write_out(hdr, TAR_BLOCK);
+} // write_member_headers
+
+
+static int compare_offsets(const void *_a, const void *_b)
+{
+    const FATELF_record *a = *((const FATELF_record **) _a);
+    const FATELF_record *b = *((const FATELF_record **) _b);
+    return (a->offset < b->offset) ? -1 : ((a->offset > b->offset) ? 1 : 0);
+} // compare_offsets
+
+
+// Write a member as (pieces), which only move forward through its data.
+//  (consumed) bytes of its data have been read already.
+static void write_pieces(tar_archive *ar, const tar_member *mem,
+                         const uint8_t *pre, const size_t prelen,
+                         const tar_piece *pieces, const int count,
+                         const uint64_t consumed)
+{
+    uint64_t newsize = 0;
+    uint64_t pos = consumed;
+    int i;
+
+    for (i = 0; i < count; i++)
+        newsize += pieces[i].len;
+
+    write_member_headers(mem, pre, prelen, newsize);
+
+    for (i = 0; i < count; i++)
+    {
+        const tar_piece *piece = &pieces[i];
+        if (piece->len == 0)
+            continue;
+        else if (piece->type == PIECE_MEMORY)
+            write_out(piece->mem, (size_t) piece->len);
+        else if (piece->type == PIECE_ZEROS)
+            write_zeros_out(piece->len);
+        else
+        {
+            if (piece->offset < pos)
+                xfail("'%s' in '%s' has records out of order; can't stream it", mem->path, ar->name);
+            skip_input(ar, piece->offset - pos);
+            copy_input(ar, piece->len);
+            pos = piece->offset + piece->len;
+        } // else
+    } // for
+
+    pad_out(newsize);
+    skip_input(ar, round_to_block(mem->size) - pos);
+} // write_pieces
+
+
+// Junk is whatever follows the last record, as fatelf-extract sees it.
+static void find_member_junk(const FATELF_header *header, const uint64_t size,
+                             uint64_t *junkoffset, uint64_t *junksize)
+{
+    *junkoffset = *junksize = 0;
+    if (header->num_records > 0)
+    {
+        const FATELF_record *rec = &header->records[find_furthest_record(header)];
+        const uint64_t edge = rec->offset + rec->size;
+        if (size > edge)
+        {
+            *junkoffset = edge;
+            *junksize = size - edge;
+        } // if
+    } // if
+} // find_member_junk
+
+
+// Copy the rest of a member, after the (consumed) bytes we already read,
+//  to a temp file, and set up (spool) to read it from there instead of
+//  (ar), so we can look ahead in it.
+static void spool_member(tar_archive *ar, const tar_member *mem,
+                         const uint64_t consumed, tar_archive *spool)
+{
+    const char *tmpdir = getenv("TMPDIR");
+    char *tmppath = NULL;
+    uint64_t len = round_to_block(mem->size) - consumed;
+    int fd;
+
+    if ((tmpdir == NULL) || (*tmpdir == '\0'))
+        tmpdir = "/tmp";
+    tmppath = (char *) xmalloc(strlen(tmpdir) + 32);
+    sprintf(tmppath, "%s/fatelf-tar-XXXXXX", tmpdir);
+    if ((fd = mkstemp(tmppath)) == -1)
+        xfail("Failed to create '%s': %s", tmppath, strerror(errno));
+    unlink(tmppath);  // it goes away when we close it.
+
+    while (len > 0)
+    {
+        const size_t count = (len < sizeof (copybuf)) ? (size_t) len : sizeof (copybuf);
+        size_t written = 0;
+        read_exact(ar, copybuf, count);
+        while (written < count)
+            written += (size_t) xwrite(tmppath, fd, copybuf + written, count - written);
+        len -= count;
+    } // while
+
+    xlseek(tmppath, fd, 0, SEEK_SET);
+    free(tmppath);
+    spool->name = ar->name;
+    spool->fd = fd;
+    spool->pos = consumed;
+    spool->seekable = 1;
+} // spool_member
+
+
+// Padding for a member's junk at (outpos), like xcopy_junk(). (ar) has to
+//  be seekable, and sit (consumed) bytes into the member's data.
+static uint64_t member_junk_padding(const tar_archive *ar,
+                                    const uint64_t consumed,
+                                    const uint64_t junkoffset,
+                                    const uint64_t junksize,
+                                    const uint64_t outpos)
+{
+    const off_t pos = lseek(ar->fd, 0, SEEK_CUR);
+    if ((pos == -1) || (junksize == 0))
+        return 0;
+    else if (!fatelf_junk_has_resources(ar->fd, ((uint64_t) pos) + (junkoffset - consumed), junksize))
+        return 0;
+    return fatelf_junk_padding(junkoffset, outpos);
+} // member_junk_padding
+
+
+// Thin or remove from a FatELF member. Returns zero if it doesn't have the
+//  target, so the caller passes it through.
+static int filter_fatelf_member(tar_archive *ar, const tar_member *mem,
+                                const uint8_t *pre, const size_t prelen,
+                                FATELF_header *header, const uint64_t consumed,
+                                const tar_mode mode, const char *target)
+{
+    uint64_t junkoffset, junksize;
+    tar_archive spool;
+    tar_archive *src = ar;
+    char err[256];
+    const int idx = fatelf_find_record(header, target, err, sizeof (err));
+
+    if (idx == -2)
+        xfail("%s", err);
+    else if (idx == -1)
+    {
+        fprintf(stderr, "No '%s' record in '%s'; passing it through.\n", target, mem->path);
+        return 0;
+    } // else if
+
+    find_member_junk(header, mem->size, &junkoffset, &junksize);
+    if ((junksize > 0) && (!ar->seekable))
+    {
+        spool_member(ar, mem, consumed, &spool);
+        src = &spool;
+    } // if
+
+    if (mode == TAR_THIN)  // the record and the junk, like fatelf-extract.
+    {
+        const FATELF_record *rec = &header->records[idx];
+        tar_piece pieces[3];
+        pieces[0].type = PIECE_INPUT;
+        pieces[0].offset = rec->offset;
+        pieces[0].len = rec->size;
+        pieces[1].type = PIECE_ZEROS;
+        pieces[1].len = member_junk_padding(src, consumed, junkoffset, junksize, rec->size);
+        pieces[2].type = PIECE_INPUT;
+        pieces[2].offset = junkoffset;
+        pieces[2].len = junksize;
+        write_pieces(src, mem, pre, prelen, pieces, 3, consumed);
+    } // if
+    else  // everything else, like fatelf-remove (but in file order).
+    {
+        const uint32_t total = header->num_records;
+        const uint64_t headerspace = fatelf_disk_header_size(header->version, total);
+        FATELF_record **sorted = (FATELF_record **) xmalloc(sizeof (FATELF_record *) * total);
+        tar_piece *pieces = (tar_piece *) xmalloc(sizeof (tar_piece) * ((total * 2) + 2));
+        uint64_t offset = headerspace;  // fatelf-remove leaves room for them all.
+        uint8_t *encoded = NULL;
+        size_t encodedlen = 0;
+        int count = 2;  // the header and its padding go first.
+        uint32_t i, j;
+
+        for (i = 0, j = 0; i < total; i++)
+        {
+            if (i != (uint32_t) idx)
+                sorted[j++] = &header->records[i];
+        } // for
+        qsort(sorted, j, sizeof (FATELF_record *), compare_offsets);
+
+        // lay out the new file, remembering where each record came from.
+        for (i = 0; i < j; i++)
+        {
+            FATELF_record *rec = sorted[i];
+            const uint64_t binary_offset = align_to_page(offset);
+            pieces[count].type = PIECE_ZEROS;
+            pieces[count++].len = binary_offset - offset;
+            pieces[count].type = PIECE_INPUT;
+            pieces[count].offset = rec->offset;
+            pieces[count++].len = rec->size;
+            rec->offset = binary_offset;
+            offset = binary_offset + rec->size;
+        } // for
+        pieces[count].type = PIECE_ZEROS;
+        pieces[count++].len = member_junk_padding(src, consumed, junkoffset, junksize, offset);
+        pieces[count].type = PIECE_INPUT;
+        pieces[count].offset = junkoffset;
+        pieces[count++].len = junksize;
+
+        // remove the record we chopped out.
+        header->num_records--;
+        memmove(&header->records[idx], &header->records[idx+1],
+                sizeof (FATELF_record) * (header->num_records - idx));
+
+        encoded = fatelf_encode_header(header, &encodedlen);
+        pieces[0].type = PIECE_MEMORY;
+        pieces[0].mem = encoded;
+        pieces[0].len = encodedlen;
+        pieces[1].type = PIECE_ZEROS;
+        pieces[1].len = headerspace - encodedlen;
+
+        write_pieces(src, mem, pre, prelen, pieces, count, consumed);
+
+        free(encoded);
+        free(pieces);
+        free(sorted);
+    } // else
+
+    if (src == &spool)
+        xclose("temp file", spool.fd);
+
+    return 1;
+} // filter_fatelf_member
+
+
+static void tar_filter(const tar_mode mode, const char *target)
+{
+    tar_archive ar;
+    tar_buffer pre;
+    tar_buffer fat;
+    tar_member mem;
+    struct stat statbuf;
+
+    memset(&ar, '\0', sizeof (ar));
+    memset(&pre, '\0', sizeof (pre));
+    memset(&fat, '\0', sizeof (fat));
+    ar.name = "stdin";
+    ar.fd = 0;
+    ar.seekable = ((fstat(ar.fd, &statbuf) == 0) && S_ISREG(statbuf.st_mode) &&
+                   (lseek(ar.fd, 0, SEEK_CUR) != -1));
+
+    while (read_member(&ar, &mem, &pre))
+    {
+        FATELF_header *header = NULL;
+        const char *err = NULL;
+        size_t needed = 0;
+
+        fat.len = 0;
+        if (is_regular_file(&mem) && (mem.size >= 8))
+        {
+            // Read just enough to see if it's FatELF, then the whole header.
+            const size_t first = (mem.size < FATELF_DISK_FORMAT_SIZE_V2(0)) ? (size_t) mem.size : FATELF_DISK_FORMAT_SIZE_V2(0);
+            read_exact(&ar, grow_buffer(&fat, first), first);
+            while ( ((needed = fatelf_decode_header_size(fat.data, fat.len, &err)) > fat.len) &&
+                    (needed <= mem.size) && (needed <= TAR_MAX_FATELF_HEADER) )
+            {
+                read_exact(&ar, grow_buffer(&fat, needed - fat.len), needed - fat.len);
+            } // while
+
+            if ((needed > TAR_MAX_FATELF_HEADER) && (needed <= mem.size))
+                xfail("'%s' in '%s' has a FatELF header that's too big to stream", mem.path, ar.name);
+            else if (needed > mem.size)
+                err = "has a truncated FatELF header";
+            else if (needed > 0)
+            {
+                header = fatelf_decode_header(fat.data, fat.len, &err);
+                if (header != NULL)
+                {
+                    uint32_t i;
+                    for (i = 0; i < header->num_records; i++)
+                    {
+                        const FATELF_record *rec = &header->records[i];
+                        if ((rec->offset > mem.size) || (rec->size > (mem.size - rec->offset)))
+                        {
+                            free(header);
+                            header = NULL;
+                            err = "is truncated";
+                            break;
+                        } // if
+                    } // for
+                } // if
+            } // else if
+
+            if ((needed > 0) && (header == NULL))
+                fprintf(stderr, "'%s' in '%s' %s; passing it through.\n", mem.path, ar.name, err);
+        } // if
+
+        if ((header == NULL) || (!filter_fatelf_member(&ar, &mem, pre.data, pre.len,
+                                                       header, fat.len, mode, target)))
+        {
+            write_out(pre.data, pre.len);
+            write_out(fat.data, fat.len);
+            copy_input(&ar, round_to_block(mem.size) - fat.len);
+        } // if
+
+        free(header);
+        free(mem.path);
+    } // while
+
+    // The end-of-archive blocks, and whatever padding follows them.
+    write_out(pre.data, pre.len);
+    while (1)
+    {
+        const size_t br = read_some(&ar, copybuf, sizeof (copybuf));
+        write_out(copybuf, br);
+        if (br < sizeof (copybuf))
+            break;
+    } // while
+
+    free(pre.data);
+    free(fat.data);
+} // tar_filter
+
+
+static int compare_entry_paths(const void *_a, const void *_b)
+{
+    const merge_entry *a = *((const merge_entry **) _a);
+    const merge_entry *b = *((const merge_entry **) _b);
+    const int rc = strcmp(a->mem.path, b->mem.path);
+    if (rc != 0)
+        return rc;
+    return (a < b) ? -1 : ((a > b) ? 1 : 0);  // keep archive order.
+} // compare_entry_paths
+
+
+static int member_kind_of(const tar_archive *ar, const tar_member *mem)
+{
+    uint8_t buf[5];
+    if ((!is_regular_file(mem)) || (mem->size < 64))
+        return MEMBER_OTHER;
+
+    xpread(ar->name, ar->fd, buf, sizeof (buf), mem->dataoffset);
+    if ( (buf[0] == (FATELF_MAGIC & 0xFF)) &&
+         (buf[1] == ((FATELF_MAGIC >> 8) & 0xFF)) &&
+         (buf[2] == ((FATELF_MAGIC >> 16) & 0xFF)) &&
+         (buf[3] == ((FATELF_MAGIC >> 24) & 0xFF)) )
+        return MEMBER_FATELF;
+    else if ((memcmp(buf, "\177ELF", 4) == 0) && ((buf[4] == 1) || (buf[4] == 2)))
+        return MEMBER_ELF;
+    return MEMBER_OTHER;
+} // member_kind_of
+
+
+static int same_contents(const tar_archive *ara, const tar_member *a,
+                         const tar_archive *arb, const tar_member *b)
+{
+    static uint8_t bufb[sizeof (copybuf)];
+    uint64_t pos = 0;
+
+    if (a->typeflag != b->typeflag)
+        return 0;
+    else if (!is_regular_file(a))
+        return 1;  // same kind of thing; not worth a fuss.
+    else if (a->size != b->size)
+        return 0;
+
+    while (pos < a->size)
+    {
+        const uint64_t left = a->size - pos;
+        const size_t count = (left < sizeof (copybuf)) ? (size_t) left : sizeof (copybuf);
+        xpread(ara->name, ara->fd, copybuf, count, a->dataoffset + pos);
+        xpread(arb->name, arb->fd, bufb, count, b->dataoffset + pos);
+        if (memcmp(copybuf, bufb, count) != 0)
+            return 0;
+        pos += count;
+    } // while
+
+    return 1;
+} // same_contents
+
+
+static void pass_through(const tar_archive *ar, const tar_member *mem)
+{
+    const uint64_t end = mem->dataoffset + round_to_block(mem->size);
+    copy_archive_range(ar, mem->start, end - mem->start);
+} // pass_through
+
+
+// Glue the ELF binaries at one path in several archives, like fatelf-glue.
+static void glue_entries(const tar_archive *archives, merge_entry **group,
+                         const int count, const junk_policy junk)
+{
+    const merge_entry *first = group[0];
+    const tar_archive *firstar = &archives[first->archive];
+    uint32_t allocated = (uint32_t) count;
+    uint32_t total = 0;
+    FATELF_header *header = (FATELF_header *) xmalloc(fatelf_header_size(allocated));
+    const merge_entry **sources = (const merge_entry **) xmalloc(sizeof (merge_entry *) * allocated);
+    uint64_t *srcoffsets = (uint64_t *) xmalloc(sizeof (uint64_t) * allocated);
+    const merge_entry *junkentry = NULL;
+    uint64_t junkoffset = 0;
+    uint64_t junksize = 0;
+    uint64_t junkpad = 0;
+    int junkresources = 0;
+    uint64_t offset = 0;
+    uint8_t *encoded = NULL;
+    size_t encodedlen = 0;
+    uint8_t *pre = NULL;
+    size_t prelen = 0;
+    uint32_t i, j;
+    int k;
+
+    for (k = 0; k < count; k++)
+    {
+        const merge_entry *entry = group[k];
+        const tar_archive *ar = &archives[entry->archive];
+
+        if (entry->kind == MEMBER_FATELF)
+        {
+            const char *err = NULL;
+            FATELF_header *fat = fatelf_pread_header(ar->fd, entry->mem.dataoffset, entry->mem.size, &err);
+            uint64_t thisjunkoffset, thisjunksize;
+
+            if (fat == NULL)
+                xfail("'%s' in '%s' %s", entry->mem.path, ar->name, err);
+
+            // keep room for one record per entry that's still to come.
+            if ((total + fat->num_records + (count - k - 1)) > allocated)
+            {
+                allocated = total + fat->num_records + (count - k - 1);
+                header = (FATELF_header *) realloc(header, fatelf_header_size(allocated));
+                sources = (const merge_entry **) realloc(sources, sizeof (merge_entry *) * allocated);
+                srcoffsets = (uint64_t *) realloc(srcoffsets, sizeof (uint64_t) * allocated);
+                if ((header == NULL) || (sources == NULL) || (srcoffsets == NULL))
+                    xfail("Out of memory!");
+            } // if
+
+            for (i = 0; i < fat->num_records; i++)
+            {
+                sources[total] = entry;
+                srcoffsets[total] = entry->mem.dataoffset + fat->records[i].offset;
+                header->records[total++] = fat->records[i];
+            } // for
+
+            find_member_junk(fat, entry->mem.size, &thisjunkoffset, &thisjunksize);
+            if ((thisjunksize > 0) && (junk != JUNK_DROP))
+            {
+                if (junkentry == NULL)
+                {
+                    junkentry = entry;
+                    junkoffset = entry->mem.dataoffset + thisjunkoffset;
+                    junksize = thisjunksize;
+                    junkresources = fatelf_junk_has_resources(ar->fd, junkoffset, junksize);
+                } // if
+                else if (junk == JUNK_KEEP)
+                {
+                    xfail("'%s' has junk at the end in both '%s' and '%s';"
+                          " use --junk=first or --junk=drop.", entry->mem.path,
+                          archives[junkentry->archive].name, ar->name);
+                } // else if
+            } // if
+
+            free(fat);
+        } // if
+        else
+        {
+            FATELF_record *record = &header->records[total];
+            xread_elf_header(ar->name, ar->fd, entry->mem.dataoffset, record);
+            record->isa_level = xread_elf_isa_level(ar->name, ar->fd, entry->mem.dataoffset);
+            record->offset = 0;
+            record->size = entry->mem.size;
+            sources[total] = entry;
+            srcoffsets[total++] = entry->mem.dataoffset;
+        } // else
+    } // for
+
+    // there are only a few records per path, so don't bother sorting.
+    for (i = 0; i < total; i++)
+    {
+        for (j = i + 1; j < total; j++)
+        {
+            if (fatelf_record_matches(&header->records[i], &header->records[j]))
+            {
+                xfail("'%s' is for the same target in '%s' and '%s'.", first->mem.path,
+                      archives[sources[i]->archive].name, archives[sources[j]->archive].name);
+            } // if
+        } // for
+    } // for
+
+    header->magic = FATELF_MAGIC;
+    header->num_records = total;
+    header->reserved0 = 0;
+    header->flags = 0;
+    header->version = fatelf_minimum_format_version(header);
+
+    offset = fatelf_disk_header_size(header->version, total);
+    for (i = 0; i < total; i++)
+    {
+        FATELF_record *rec = &header->records[i];
+        rec->offset = align_to_page(offset);
+        offset = rec->offset + rec->size;
+    } // for
+
+    // padded like xcopy_junk(), from where the junk was in its own member.
+    if (junkresources)
+        junkpad = fatelf_junk_padding(junkoffset - junkentry->mem.dataoffset, offset);
+
+    encoded = fatelf_encode_header(header, &encodedlen);
+
+    // the first archive's tar headers, with the new size.
+    prelen = (size_t) (first->mem.dataoffset - first->mem.start);
+    pre = (uint8_t *) xmalloc(prelen);
+    xpread(firstar->name, firstar->fd, pre, prelen, first->mem.start);
+    write_member_headers(&first->mem, pre, prelen, offset + junkpad + junksize);
+    free(pre);
+
+    write_out(encoded, encodedlen);
+    offset = encodedlen;
+    for (i = 0; i < total; i++)
+    {
+        const FATELF_record *rec = &header->records[i];
+        write_zeros_out(rec->offset - offset);
+        copy_archive_range(&archives[sources[i]->archive], srcoffsets[i], rec->size);
+        offset = rec->offset + rec->size;
+    } // for
+
+    if (junkentry != NULL)
+    {
+        write_zeros_out(junkpad);
+        copy_archive_range(&archives[junkentry->archive], junkoffset, junksize);
+    } // if
+
+    pad_out(offset + junkpad + junksize);
+
+    free(encoded);
+    free(srcoffsets);
+    free(sources);
+    free(header);
+} // glue_entries
+
+
+static void tar_merge(const char **fnames, const int count, const junk_policy junk)
+{
+    tar_archive *archives = (tar_archive *) xmalloc(sizeof (tar_archive) * count);
+    merge_entry *entries = NULL;
+    merge_entry **sorted = NULL;
+    merge_entry **group = (merge_entry **) xmalloc(sizeof (merge_entry *) * count);
+    size_t numentries = 0;
+    size_t allocated = 0;
+    tar_buffer pre;
+    size_t i;
+    int k;
+
+    memset(&pre, '\0', sizeof (pre));
+
+    // Index every archive: where each member is, and if it's ELF.
+    for (k = 0; k < count; k++)
+    {
+        tar_archive *ar = &archives[k];
+        tar_member mem;
+
+        ar->name = fnames[k];
+        ar->fd = xopen(ar->name, O_RDONLY, 0755);
+        ar->pos = 0;
+        ar->seekable = 1;
+
+        while (read_member(ar, &mem, &pre))
+        {
+            merge_entry *entry;
+            if (numentries == allocated)
+            {
+                allocated = allocated ? allocated * 2 : 1024;
+                entries = (merge_entry *) realloc(entries, sizeof (merge_entry) * allocated);
+                if (entries == NULL)
+                    xfail("Out of memory!");
+            } // if
+
+            entry = &entries[numentries++];
+            entry->archive = k;
+            entry->done = 0;
+            entry->mem = mem;
+            entry->kind = member_kind_of(ar, &mem);
+            skip_input(ar, round_to_block(mem.size));
+        } // while
+    } // for
+
+    free(pre.data);
+
+    sorted = (merge_entry **) xmalloc(sizeof (merge_entry *) * (numentries ? numentries : 1));
+    for (i = 0; i < numentries; i++)
+        sorted[i] = &entries[i];
+    qsort(sorted, numentries, sizeof (merge_entry *), compare_entry_paths);
+
+    // Now write each path once, in the order it first shows up.
+    for (i = 0; i < numentries; i++)
+    {
+        merge_entry *entry = &entries[i];
+        merge_entry **found;
+        size_t lo, hi;
+        int groupcount = 0;
+        int mergeable = 1;
+        int identical = 1;
+        int g;
+
+        if (entry->done)
+            continue;
+
+        found = (merge_entry **) bsearch(&entry, sorted, numentries, sizeof (merge_entry *), compare_entry_paths);
+        assert(found != NULL);
+        lo = hi = (size_t) (found - sorted);
+        while ((lo > 0) && (strcmp(sorted[lo-1]->mem.path, entry->mem.path) == 0))
+            lo--;
+        while ((hi < numentries) && (strcmp(sorted[hi]->mem.path, entry->mem.path) == 0))
+            hi++;
+
+        // one entry per archive; tar says a later copy in the same archive
+        //  wins, but we go with the first, like everywhere else here.
+        for (; lo < hi; lo++)
+        {
+            merge_entry *other = sorted[lo];
+            other->done = 1;
+            if ((groupcount == 0) || (group[groupcount-1]->archive != other->archive))
+                group[groupcount++] = other;
+        } // for
+
+        for (g = 0; g < groupcount; g++)
+        {
+            const merge_entry *other = group[g];
+            if (other->kind == MEMBER_OTHER)
+                mergeable = 0;
+            if ((g > 0) && (!same_contents(&archives[entry->archive], &entry->mem,
+                                           &archives[other->archive], &other->mem)))
+                identical = 0;
+        } // for
+
+        if ((groupcount > 1) && (mergeable) && (!identical))
+            glue_entries(archives, group, groupcount, junk);
+        else
+        {
+            if (!identical)
+            {
+                fprintf(stderr, "'%s' differs between archives; keeping the one from '%s'.\n",
+                        entry->mem.path, archives[entry->archive].name);
+            } // if
+            pass_through(&archives[entry->archive], &entry->mem);
+        } // else
+    } // for
+
+    // end-of-archive blocks, padded out like tar does.
+    write_zeros_out(TAR_BLOCK * 2);
+    if (outpos % TAR_RECORD)
+        write_zeros_out(TAR_RECORD - (outpos % TAR_RECORD));
+
+    for (i = 0; i < numentries; i++)
+        free(entries[i].mem.path);
+    free(entries);
+    free(sorted);
+    free(group);
+    for (k = 0; k < count; k++)
+        xclose(archives[k].name, archives[k].fd);
+    free(archives);
+} // tar_merge
+
+
+int main(int argc, const char **argv)
+{
+    const char *usage = "USAGE: %s [--junk=keep|first|drop] thin <target>\n"
+                        "       %s remove <target>\n"
+                        "       %s [--junk=keep|first|drop] merge <in1.tar> <in2.tar> [... <inN.tar>]\n"
+                        "  (thin and remove read stdin; all write to stdout)";
+    junk_policy junk = JUNK_KEEP;
+    int i = 1;
+
+    xfatelf_init(&argc, argv);
+
+    while ((i < argc) && (strncmp(argv[i], "--", 2) == 0))
+    {
+        if (strcmp(argv[i], "--junk=keep") == 0)
+            junk = JUNK_KEEP;
+        else if (strcmp(argv[i], "--junk=first") == 0)
+            junk = JUNK_FIRST;
+        else if (strcmp(argv[i], "--junk=drop") == 0)
+            junk = JUNK_DROP;
+        else
+            xfail("Unknown option '%s'", argv[i]);
+        i++;
+    } // while
+
+    if (isatty(outfd))
+        xfail("Not writing a tar archive to a terminal.");
+
+    if ((i < argc) && (strcmp(argv[i], "thin") == 0) && (argc == i + 2))
+        tar_filter(TAR_THIN, argv[i + 1]);
+    else if ((i < argc) && (strcmp(argv[i], "remove") == 0) && (argc == i + 2))
+        tar_filter(TAR_REMOVE, argv[i + 1]);
+    else if ((i < argc) && (strcmp(argv[i], "merge") == 0) && (argc >= i + 3))
+        tar_merge(argv + i + 1, argc - (i + 1), junk);
+    else  // this could stand to use getopt(), later.
+        xfail(usage, argv[0], argv[0], argv[0]);
+
+    return 0;  // success.
+} // main
+
+// end of fatelf-tar.c ...
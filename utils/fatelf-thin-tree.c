@@ -0,0 +1,371 @@
+/**
+ * FatELF; support multiple ELF binaries in one file.
+ *
+ * Please see the file LICENSE.txt in the source's root directory.
+ *
+ *  This file written by Ryan C. Gordon.
+ */
+
+// This mirrors a directory tree, but every FatELF file in it becomes just
+//  the record for one target (what fatelf-extract would give you), and
+//  everything else is copied as-is. Ownership, permissions, timestamps and
+//  hardlinks are kept. Where the filesystem can share extents (btrfs, XFS,
+//  etc), records are cloned from their page-aligned offsets instead of
+//  copied, so building the thin tree is mostly metadata work.
+
+#define _GNU_SOURCE 1  // for nftw().
+#define FATELF_UTILS 1
+#include "fatelf-utils.h"
+
+#include <ftw.h>
+#include <errno.h>
+#include <unistd.h>
+#include <limits.h>
+
+typedef struct tree_entry
+{
+    char *path;         // relative to the roots.
+    struct stat statbuf;
+    int linkto;         // index of the entry this is a hardlink of, or -1.
+} tree_entry;
+
+typedef struct thin_tree
+{
+    const char *srcroot;
+    const char *dstroot;
+    const char *target;
+    tree_entry *entries;
+    int count;
+    int *files;         // indices of regular files to write, for the workers.
+    int filecount;
+} thin_tree;
+
+static thin_tree walk;  // nftw() doesn't pass a context pointer.
+static int walk_allocated = 0;
+static int is_root = 0;
+
+
+static char *make_path(const char *root, const char *path)
+{
+    const size_t len = strlen(root) + strlen(path) + 2;
+    char *retval = (char *) xmalloc(len);
+    snprintf(retval, len, "%s%s%s", root, (*path) ? "/" : "", path);
+    return retval;
+} // make_path
+
+
+static int walk_callback(const char *fname, const struct stat *statbuf,
+                         int typeflag, struct FTW *ftwbuf)
+{
+    const char *rel = fname + strlen(walk.srcroot);
+    tree_entry *entry;
+
+    (void) ftwbuf;
+
+    if ((typeflag == FTW_DNR) || (typeflag == FTW_NS))
+        xfail("Can't read '%s'", fname);
+
+    if (walk.count == walk_allocated)
+    {
+        walk_allocated = walk_allocated ? (walk_allocated * 2) : 1024;
+        walk.entries = (tree_entry *) realloc(walk.entries, sizeof (tree_entry) * walk_allocated);
+        if (walk.entries == NULL)
+            xfail("Out of memory!");
+    } // if
+
+    while (*rel == '/')
+        rel++;
+
+    entry = &walk.entries[walk.count++];
+    entry->path = xstrdup(rel);
+    entry->statbuf = *statbuf;
+    entry->linkto = -1;
+    return 0;
+} // walk_callback
+
+
+static int compare_inodes(const void *_a, const void *_b)
+{
+    const tree_entry *a = &walk.entries[*((const int *) _a)];
+    const tree_entry *b = &walk.entries[*((const int *) _b)];
+    if (a->statbuf.st_dev != b->statbuf.st_dev)
+        return (a->statbuf.st_dev < b->statbuf.st_dev) ? -1 : 1;
+    else if (a->statbuf.st_ino != b->statbuf.st_ino)
+        return (a->statbuf.st_ino < b->statbuf.st_ino) ? -1 : 1;
+    return *((const int *) _a) - *((const int *) _b);  // walk order.
+} // compare_inodes
+
+
+// Files with more than one name are written once, and linked to the rest.
+static void find_hardlinks(void)
+{
+    int *sorted = (int *) xmalloc(sizeof (int) * (walk.count + 1));
+    int total = 0;
+    int i;
+
+    for (i = 0; i < walk.count; i++)
+    {
+        const struct stat *statbuf = &walk.entries[i].statbuf;
+        if ((S_ISREG(statbuf->st_mode)) && (statbuf->st_nlink > 1))
+            sorted[total++] = i;
+    } // for
+
+    qsort(sorted, total, sizeof (int), compare_inodes);
+
+    for (i = 1; i < total; i++)
+    {
+        tree_entry *prev = &walk.entries[sorted[i-1]];
+        tree_entry *entry = &walk.entries[sorted[i]];
+        if ( (prev->statbuf.st_dev == entry->statbuf.st_dev) &&
+             (prev->statbuf.st_ino == entry->statbuf.st_ino) )
+            entry->linkto = (prev->linkto >= 0) ? prev->linkto : sorted[i-1];
+    } // for
+
+    free(sorted);
+} // find_hardlinks
+
+
+// Ownership only sticks for root; for anyone else, keeping what we can is
+//  the best we can do, so that's not an error.
+static void set_owner(const char *fname, const int fd,
+                      const struct stat *statbuf)
+{
+    const int rc = (fd >= 0) ?
+        fchown(fd, statbuf->st_uid, statbuf->st_gid) :
+        lchown(fname, statbuf->st_uid, statbuf->st_gid);
+    if ((rc == -1) && (is_root))
+        xfail("Failed to chown '%s': %s", fname, strerror(errno));
+} // set_owner
+
+
+static void set_times(const char *fname, const int fd,
+                      const struct stat *statbuf)
+{
+    struct timespec times[2];
+    int rc;
+
+    times[0] = statbuf->st_atim;
+    times[1] = statbuf->st_mtim;
+    if (fd >= 0)
+        rc = futimens(fd, times);
+    else
+        rc = utimensat(AT_FDCWD, fname, times, AT_SYMLINK_NOFOLLOW);
+
+    if (rc == -1)
+        xfail("Failed to set times on '%s': %s", fname, strerror(errno));
+} // set_times
+
+
+static int is_fatelf_file(const char *fname, const int fd, const uint64_t size)
+{
+    uint8_t buf[4];
+    if (size < sizeof (buf))
+        return 0;
+    xpread(fname, fd, buf, sizeof (buf), 0);
+    return ( (buf[0] == (FATELF_MAGIC & 0xFF)) &&
+             (buf[1] == ((FATELF_MAGIC >> 8) & 0xFF)) &&
+             (buf[2] == ((FATELF_MAGIC >> 16) & 0xFF)) &&
+             (buf[3] == ((FATELF_MAGIC >> 24) & 0xFF)) );
+} // is_fatelf_file
+
+
+// Put (size) bytes from (offset) in (fd) at the current end of (outfd),
+//  sharing blocks where we can.
+static void clone_or_copy(const char *fname, const int fd,
+                          const char *out, const int outfd,
+                          const uint64_t outpos, const uint64_t offset,
+                          const uint64_t size)
+{
+    const uint64_t cloned = fatelf_clone_range(fd, offset, outfd, outpos, size);
+    if (cloned > 0)
+        xlseek(out, outfd, (off_t) (outpos + cloned), SEEK_SET);
+    xcopyfile_range(fname, fd, out, outfd, offset + cloned, size - cloned);
+} // clone_or_copy
+
+
+static void thin_file(void *data, const int idx)
+{
+    const thin_tree *tree = (const thin_tree *) data;
+    const tree_entry *entry = &tree->entries[tree->files[idx]];
+    const struct stat *statbuf = &entry->statbuf;
+    char *fname = make_path(tree->srcroot, entry->path);
+    char *out = make_path(tree->dstroot, entry->path);
+    const int fd = xopen(fname, O_RDONLY, 0);
+    const int outfd = xopen(out, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    const uint64_t size = xget_file_size(fname, fd);
+    FATELF_header *header = NULL;
+    int recidx = -1;
+
+    if (is_fatelf_file(fname, fd, size))
+    {
+        header = xread_fatelf_header(fname, fd);
+        if (strcmp(tree->target, "host") == 0)
+            recidx = fatelf_find_host_record(header);  // xfind_* would fail.
+        else
+            recidx = xfind_fatelf_record(header, tree->target);
+        if (recidx < 0)
+            fprintf(stderr, "No '%s' record in '%s'; copying it whole.\n", tree->target, fname);
+    } // if
+
+    if (recidx < 0)
+        clone_or_copy(fname, fd, out, outfd, 0, 0, size);
+    else
+    {
+        const FATELF_record *rec = &header->records[recidx];
+        uint64_t junkoffset, junksize;
+        if ((rec->offset > size) || (rec->size > (size - rec->offset)))
+            xfail("'%s' is truncated.", fname);
+        clone_or_copy(fname, fd, out, outfd, 0, rec->offset, rec->size);
+        if (xfind_junk(fname, fd, header, &junkoffset, &junksize))  // like fatelf-extract.
+        {
+            // padded like xcopy_junk(), but the junk can still be cloned.
+            uint64_t pad = 0;
+            if (fatelf_junk_has_resources(fd, junkoffset, junksize))
+                pad = fatelf_junk_padding(junkoffset, rec->size);
+            xwrite_zeros(out, outfd, (size_t) pad);
+            clone_or_copy(fname, fd, out, outfd, rec->size + pad, junkoffset, junksize);
+        } // if
+    } // else
+
+    // owner first, since chown() can clear setuid bits.
+    set_owner(out, outfd, statbuf);
+    if (fchmod(outfd, statbuf->st_mode & 07777) == -1)
+        xfail("Failed to chmod '%s': %s", out, strerror(errno));
+    set_times(out, outfd, statbuf);
+
+    xclose(out, outfd);
+    xclose(fname, fd);
+    free(header);
+    free(out);
+    free(fname);
+} // thin_file
+
+
+static void make_special(const thin_tree *tree, const tree_entry *entry)
+{
+    const struct stat *statbuf = &entry->statbuf;
+    char *fname = make_path(tree->srcroot, entry->path);
+    char *out = make_path(tree->dstroot, entry->path);
+
+    if (S_ISLNK(statbuf->st_mode))
+    {
+        char target[PATH_MAX];
+        const ssize_t len = readlink(fname, target, sizeof (target) - 1);
+        if (len == -1)
+            xfail("Failed to read symlink '%s': %s", fname, strerror(errno));
+        target[len] = '\0';
+        unlink(out);
+        if (symlink(target, out) == -1)
+            xfail("Failed to create symlink '%s': %s", out, strerror(errno));
+        set_owner(out, -1, statbuf);
+        set_times(out, -1, statbuf);
+    } // if
+    else  // fifos, sockets, device nodes: needs root for devices.
+    {
+        unlink(out);
+        if (mknod(out, statbuf->st_mode, statbuf->st_rdev) == -1)
+            fprintf(stderr, "Skipping '%s': %s\n", fname, strerror(errno));
+        else
+        {
+            set_owner(out, -1, statbuf);
+            set_times(out, -1, statbuf);
+        } // else
+    } // else
+
+    free(out);
+    free(fname);
+} // make_special
+
+
+static int fatelf_thin_tree(const char *src, const char *dst,
+                            const char *target)
+{
+    int i;
+
+    walk.srcroot = src;
+    walk.dstroot = dst;
+    walk.target = target;
+    is_root = (geteuid() == 0);
+
+    // FTW_PHYS: symlinks get copied as symlinks, not followed.
+    if (nftw(src, walk_callback, 64, FTW_PHYS) == -1)
+        xfail("Failed to scan '%s': %s", src, strerror(errno));
+    else if (!S_ISDIR(walk.entries[0].statbuf.st_mode))
+        xfail("'%s' isn't a directory", src);
+
+    find_hardlinks();
+
+    // Directories first (nftw() gives us parents before children), with
+    //  owner-only permissions until we're done filling them in.
+    walk.files = (int *) xmalloc(sizeof (int) * walk.count);
+    for (i = 0; i < walk.count; i++)
+    {
+        const tree_entry *entry = &walk.entries[i];
+        if (S_ISDIR(entry->statbuf.st_mode))
+        {
+            char *out = make_path(dst, entry->path);
+            if ((mkdir(out, 0700) == -1) && (errno != EEXIST))
+                xfail("Failed to create '%s': %s", out, strerror(errno));
+            free(out);
+        } // if
+        else if ((S_ISREG(entry->statbuf.st_mode)) && (entry->linkto < 0))
+            walk.files[walk.filecount++] = i;
+    } // for
+
+    fatelf_parallel_for(walk.filecount, 0, thin_file, &walk);
+
+    // Now the rest, which are cheap: hardlinks, symlinks, special files.
+    for (i = 0; i < walk.count; i++)
+    {
+        const tree_entry *entry = &walk.entries[i];
+        if (S_ISDIR(entry->statbuf.st_mode))
+            continue;
+        else if (entry->linkto >= 0)
+        {
+            char *from = make_path(dst, walk.entries[entry->linkto].path);
+            char *out = make_path(dst, entry->path);
+            unlink(out);
+            if (link(from, out) == -1)
+                xfail("Failed to link '%s' to '%s': %s", out, from, strerror(errno));
+            free(out);
+            free(from);
+        } // else if
+        else if (!S_ISREG(entry->statbuf.st_mode))
+            make_special(&walk, entry);
+    } // for
+
+    // Directories last, deepest first, since filling them in changed their
+    //  timestamps (and maybe they aren't writable for us once we're done).
+    for (i = walk.count - 1; i >= 0; i--)
+    {
+        const tree_entry *entry = &walk.entries[i];
+        if (S_ISDIR(entry->statbuf.st_mode))
+        {
+            char *out = make_path(dst, entry->path);
+            set_owner(out, -1, &entry->statbuf);
+            if (chmod(out, entry->statbuf.st_mode & 07777) == -1)
+                xfail("Failed to chmod '%s': %s", out, strerror(errno));
+            set_times(out, -1, &entry->statbuf);
+            free(out);
+        } // if
+    } // for
+
+    for (i = 0; i < walk.count; i++)
+        free(walk.entries[i].path);
+    free(walk.entries);
+    free(walk.files);
+
+    return 0;  // success.
+} // fatelf_thin_tree
+
+
+int main(int argc, const char **argv)
+{
+    xfatelf_init(&argc, argv);
+    if (argc != 4)  // this could stand to use getopt(), later.
+        xfail("USAGE: %s <src> <dst> <target>", argv[0]);
+    return fatelf_thin_tree(argv[1], argv[2], argv[3]);
+} // main
+
+// end of fatelf-thin-tree.c ...
+
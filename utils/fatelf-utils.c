@@ -8,12 +8,37 @@
 
 /* code shared between all FatELF utilities... */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE 1  // for O_DIRECT and sync_file_range().
+#endif
+
 #define FATELF_UTILS 1
 #include "fatelf-utils.h"
 
 #include <errno.h>
 #include <unistd.h>
 #include <stdarg.h>
+#include <pthread.h>
+#include <time.h>
+
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/fs.h>  // for FICLONERANGE.
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+#endif
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <immintrin.h>
+#elif defined(__aarch64__) && defined(__linux__)
+#include <sys/auxv.h>
+#endif
 
 const char *unlink_on_xfail = NULL;
 static uint8_t zerobuf[4096];
@@ -71,6 +96,169 @@ static uint8_t zerobuf[4096];
 const char *fatelf_build_version = MAKEBUILDVERSTRINGLITERAL(APPID, APPREV);
 
 
+// Instrumentation for --stats. Everything here is guarded by a single
+//  branch on fatelf_stats_mode, so it costs next to nothing when disabled.
+//  Counters are bumped atomically, since fatelf_parallel_for() workers
+//  do I/O too.
+
+int fatelf_stats_mode = FATELF_STATS_OFF;
+
+typedef enum stat_syscall
+{
+    STAT_SYSCALL_OPEN,
+    STAT_SYSCALL_CLOSE,
+    STAT_SYSCALL_READ,
+    STAT_SYSCALL_PREAD,
+    STAT_SYSCALL_WRITE,
+    STAT_SYSCALL_LSEEK,
+    STAT_SYSCALL_FSTAT,
+    STAT_SYSCALL_FSYNC,
+    STAT_SYSCALL_FADVISE,
+    STAT_SYSCALL_SYNC_FILE_RANGE,
+    STAT_SYSCALL_COPY_FILE_RANGE,
+    STAT_SYSCALL_FICLONERANGE,
+    STAT_SYSCALL_IO_URING_ENTER,
+    STAT_SYSCALL_TOTAL
+} stat_syscall;
+
+static const char *stat_syscall_names[STAT_SYSCALL_TOTAL] =
+{
+    "open", "close", "read", "pread", "write", "lseek", "fstat", "fsync",
+    "fadvise", "sync_file_range", "copy_file_range",
+    "ficlonerange", "io_uring_enter"
+};
+
+static const char *stat_phase_names[FATELF_STATS_PHASE_TOTAL] =
+{
+    "open", "header_parse", "copy", "pad", "header_write", "fsync"
+};
+
+typedef struct stat_counter
+{
+    uint64_t calls;
+    uint64_t bytes;
+    uint64_t nsecs;
+} stat_counter;
+
+static stat_counter syscall_stats[STAT_SYSCALL_TOTAL];
+static stat_counter phase_stats[FATELF_STATS_PHASE_TOTAL];
+static uint64_t stats_start_time = 0;
+static const char *stats_appname = NULL;
+
+#ifdef __GNUC__
+#define STATS_ENABLED() __builtin_expect(fatelf_stats_mode != FATELF_STATS_OFF, 0)
+#else
+#define STATS_ENABLED() (fatelf_stats_mode != FATELF_STATS_OFF)
+#endif
+
+static uint64_t stats_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (((uint64_t) ts.tv_sec) * 1000000000ull) + ((uint64_t) ts.tv_nsec);
+} // stats_now
+
+
+static inline void stats_syscall(const stat_syscall which, const ssize_t bytes)
+{
+    if (STATS_ENABLED())
+    {
+        __sync_fetch_and_add(&syscall_stats[which].calls, 1);
+        if (bytes > 0)
+            __sync_fetch_and_add(&syscall_stats[which].bytes, (uint64_t) bytes);
+    } // if
+} // stats_syscall
+
+
+uint64_t fatelf_stats_begin(void)
+{
+    return STATS_ENABLED() ? stats_now() : 0;
+} // fatelf_stats_begin
+
+
+void fatelf_stats_end(const fatelf_stats_phase phase, const uint64_t start,
+                      const uint64_t bytes)
+{
+    if (STATS_ENABLED())
+    {
+        stat_counter *counter = &phase_stats[phase];
+        __sync_fetch_and_add(&counter->calls, 1);
+        __sync_fetch_and_add(&counter->bytes, bytes);
+        __sync_fetch_and_add(&counter->nsecs, stats_now() - start);
+    } // if
+} // fatelf_stats_end
+
+
+static void dump_stats_text(FILE *io, const uint64_t wall)
+{
+    int i;
+
+    fprintf(io, "%s stats: %.3f ms wall clock\n", stats_appname,
+            ((double) wall) / 1000000.0);
+    fprintf(io, "  %-14s %12s %16s\n", "syscall", "calls", "bytes");
+    for (i = 0; i < STAT_SYSCALL_TOTAL; i++)
+    {
+        const stat_counter *counter = &syscall_stats[i];
+        fprintf(io, "  %-14s %12llu %16llu\n", stat_syscall_names[i],
+                (unsigned long long) counter->calls,
+                (unsigned long long) counter->bytes);
+    } // for
+
+    fprintf(io, "  %-14s %12s %16s %12s %10s\n",
+            "phase", "calls", "bytes", "ms", "MB/s");
+    for (i = 0; i < FATELF_STATS_PHASE_TOTAL; i++)
+    {
+        const stat_counter *counter = &phase_stats[i];
+        const double secs = ((double) counter->nsecs) / 1000000000.0;
+        const double mbps = (secs > 0.0) ? ((((double) counter->bytes) / (1024.0 * 1024.0)) / secs) : 0.0;
+        fprintf(io, "  %-14s %12llu %16llu %12.3f %10.1f\n",
+                stat_phase_names[i], (unsigned long long) counter->calls,
+                (unsigned long long) counter->bytes, secs * 1000.0, mbps);
+    } // for
+} // dump_stats_text
+
+
+static void dump_stats_json(FILE *io, const uint64_t wall)
+{
+    int i;
+
+    fprintf(io, "{\"tool\":\"%s\",\"wall_ns\":%llu,\"syscalls\":{",
+            stats_appname, (unsigned long long) wall);
+    for (i = 0; i < STAT_SYSCALL_TOTAL; i++)
+    {
+        const stat_counter *counter = &syscall_stats[i];
+        fprintf(io, "%s\"%s\":{\"calls\":%llu,\"bytes\":%llu}",
+                i ? "," : "", stat_syscall_names[i],
+                (unsigned long long) counter->calls,
+                (unsigned long long) counter->bytes);
+    } // for
+
+    fprintf(io, "},\"phases\":{");
+    for (i = 0; i < FATELF_STATS_PHASE_TOTAL; i++)
+    {
+        const stat_counter *counter = &phase_stats[i];
+        fprintf(io, "%s\"%s\":{\"calls\":%llu,\"bytes\":%llu,\"ns\":%llu}",
+                i ? "," : "", stat_phase_names[i],
+                (unsigned long long) counter->calls,
+                (unsigned long long) counter->bytes,
+                (unsigned long long) counter->nsecs);
+    } // for
+    fprintf(io, "}}\n");
+} // dump_stats_json
+
+
+// atexit() handler, so we report even if we xfail().
+static void dump_stats(void)
+{
+    const uint64_t wall = stats_now() - stats_start_time;
+    if (fatelf_stats_mode == FATELF_STATS_JSON)
+        dump_stats_json(stderr, wall);
+    else if (fatelf_stats_mode == FATELF_STATS_TEXT)
+        dump_stats_text(stderr, wall);
+    fflush(stderr);
+} // dump_stats
+
+
 
 // Report an error to stderr and terminate immediately with exit(1).
 void xfail(const char *fmt, ...)
@@ -113,9 +301,12 @@ char *xstrdup(const char *str)
 // xfail() on error.
 int xopen(const char *fname, const int flags, const int perms)
 {
+    const uint64_t start = fatelf_stats_begin();
     const int retval = open(fname, flags, perms);
+    stats_syscall(STAT_SYSCALL_OPEN, 0);
     if (retval == -1)
         xfail("Failed to open '%s': %s", fname, strerror(errno));
+    fatelf_stats_end(FATELF_STATS_PHASE_OPEN, start, 0);
     return retval;
 } // xopen
 
@@ -126,6 +317,7 @@ ssize_t xread(const char *fname, const int fd, void *buf,
 {
     ssize_t rc;
     while (((rc = read(fd,buf,len)) == -1) && (errno == EINTR)) { /* spin */ }
+    stats_syscall(STAT_SYSCALL_READ, rc);
     if ( (rc == -1) || ((must_read) && (rc != len)) )
         xfail("Failed to read '%s': %s", fname, strerror(errno));
     return rc;
@@ -138,6 +330,7 @@ ssize_t xwrite(const char *fname, const int fd,
 {
     ssize_t rc;
     while (((rc = write(fd,buf,len)) == -1) && (errno == EINTR)) { /* spin */ }
+    stats_syscall(STAT_SYSCALL_WRITE, rc);
     if (rc == -1)
         xfail("Failed to write '%s': %s", fname, strerror(errno));
     return rc;
@@ -146,12 +339,15 @@ ssize_t xwrite(const char *fname, const int fd,
 // xfail() on error, handle EINTR.
 void xwrite_zeros(const char *fname, const int fd, size_t len)
 {
+    const uint64_t start = fatelf_stats_begin();
+    const uint64_t total = (uint64_t) len;
     while (len > 0)
     {
         const size_t count = (len < sizeof (zerobuf)) ? len : sizeof (zerobuf);
         xwrite(fname, fd, zerobuf, count);
         len -= count;
     } // while
+    fatelf_stats_end(FATELF_STATS_PHASE_PAD, start, total);
 } // xwrite_zeros
 
 // xfail() on error, handle EINTR.
@@ -159,6 +355,7 @@ void xclose(const char *fname, const int fd)
 {
     int rc;
     while ( ((rc = close(fd)) == -1) && (errno == EINTR) ) { /* spin. */ }
+    stats_syscall(STAT_SYSCALL_CLOSE, 0);
     if (rc == -1)
         xfail("Failed to close '%s': %s", fname, strerror(errno));
 } // xopen
@@ -168,6 +365,7 @@ void xclose(const char *fname, const int fd)
 void xlseek(const char *fname, const int fd,
             const off_t offset, const int whence)
 {
+    stats_syscall(STAT_SYSCALL_LSEEK, 0);
     if (lseek(fd, offset, whence) == -1)
         xfail("Failed to seek in '%s': %s", fname, strerror(errno));
 } // xlseek
@@ -176,29 +374,24 @@ void xlseek(const char *fname, const int fd,
 uint64_t xget_file_size(const char *fname, const int fd)
 {
     struct stat statbuf;
+    stats_syscall(STAT_SYSCALL_FSTAT, 0);
     if (fstat(fd, &statbuf) == -1)
         xfail("Failed to fstat '%s': %s", fname, strerror(errno));
     return (uint64_t) statbuf.st_size;
 } // xget_file_size
 
 
-static uint8_t copybuf[256 * 1024];
-
-// xfail() on error.
-uint64_t xcopyfile(const char *in, const int infd,
-                   const char *out, const int outfd)
+// xfail() on error, handle EINTR.
+void xfsync(const char *fname, const int fd)
 {
-    uint64_t retval = 0;
-    ssize_t rc = 0;
-    xlseek(in, infd, 0, SEEK_SET);
-    while ( (rc = xread(in, infd, copybuf, sizeof (copybuf), 0)) > 0 )
-    {
-        xwrite(out, outfd, copybuf, rc);
-        retval += (uint64_t) rc;
-    } // while
-
-    return retval;
-} // xcopyfile
+    const uint64_t start = fatelf_stats_begin();
+    int rc;
+    while ( ((rc = fsync(fd)) == -1) && (errno == EINTR) ) { /* spin. */ }
+    stats_syscall(STAT_SYSCALL_FSYNC, 0);
+    if (rc == -1)
+        xfail("Failed to sync '%s': %s", fname, strerror(errno));
+    fatelf_stats_end(FATELF_STATS_PHASE_FSYNC, start, 0);
+} // xfsync
 
 
 static inline uint64_t minui64(const uint64_t a, const uint64_t b)
@@ -207,742 +400,4602 @@ static inline uint64_t minui64(const uint64_t a, const uint64_t b)
 } // minui64
 
 
-void xcopyfile_range(const char *in, const int infd,
-                     const char *out, const int outfd,
-                     const uint64_t offset, const uint64_t size)
-{
-    uint64_t remaining = size;
-    xlseek(in, infd, (off_t) offset, SEEK_SET);
-    while (remaining)
-    {
-        const size_t cpysize = minui64(remaining, sizeof (copybuf));
-        xread(in, infd, copybuf, cpysize, 1);
-        xwrite(out, outfd, copybuf, cpysize);
-        remaining -= (uint64_t) cpysize;
-    } // while
-} // xcopyfile_range
-
+#define COPYBUF_SIZE (256 * 1024)
+#define PIPE_CHUNK (1024 * 1024)
+#define PIPE_MAX_DEPTH 64
 
-void xread_elf_header(const char *fname, const int fd, const uint64_t offset,
-                      FATELF_record *record)
+// One buffer's worth of the pipelined copy engine, below.
+typedef struct pipe_slot
 {
-    const uint8_t magic[4] = { 0x7F, 0x45, 0x4C, 0x46 };
-    uint8_t buf[20];  // we only care about the first 20 bytes.
-    xlseek(fname, fd, offset, SEEK_SET);
-    xread(fname, fd, buf, sizeof (buf), 1);
-    if (memcmp(magic, buf, sizeof (magic)) != 0)
-        xfail("'%s' is not an ELF binary", fname);
+    uint8_t *buf;
+    uint64_t pos;  // where this chunk starts, relative to the copy.
+    size_t len;    // how big this chunk is.
+    size_t done;   // how much of the current read or write is finished.
+    int writing;
+} pipe_slot;
+
+struct uring;
+
+// Copy buffers (and the io_uring ring) belong to the thread doing the copy,
+//  so fatelf_parallel_for() workers can copy at the same time. They're
+//  allocated on first use and freed when the thread ends.
+typedef struct copy_thread_state
+{
+    uint8_t *copybuf;
+    uint8_t *streambuf;
+    pipe_slot slots[PIPE_MAX_DEPTH];
+    struct uring *ring;
+    int ring_state;  // 0: haven't tried, 1: working, -1: no good.
+} copy_thread_state;
 
-    record->osabi = buf[7];
-    record->osabi_version = buf[8];
-    record->word_size = buf[4];
-    record->byte_order = buf[5];
-    record->reserved0 = 0;
-    record->reserved1 = 0;
-    record->offset = 0;
-    record->size = 0;
+static pthread_key_t copy_state_key;
+static pthread_once_t copy_state_once = PTHREAD_ONCE_INIT;
 
-    if ((record->word_size != FATELF_32BITS) &&
-        (record->word_size != FATELF_64BITS))
-    {
-        xfail("Unexpected word size (%d) in '%s'", record->word_size, fname);
-    } // if
+static void uring_free(struct uring *ring);
 
-    if (record->byte_order == FATELF_BIGENDIAN)
-        record->machine = (((uint16_t)buf[18]) << 8) | (((uint16_t)buf[19]));
-    else if (record->byte_order == FATELF_LITTLEENDIAN)
-        record->machine = (((uint16_t)buf[19]) << 8) | (((uint16_t)buf[18]));
-    else
-    {
-        xfail("Unexpected byte order (%d) in '%s'",
-              (int) record->byte_order, fname);
-    } // else
-} // xread_elf_header
+static void free_copy_state(void *_state)
+{
+    copy_thread_state *state = (copy_thread_state *) _state;
+    int i;
+
+    for (i = 0; i < PIPE_MAX_DEPTH; i++)
+        free(state->slots[i].buf);
+    if (state->ring != NULL)
+        uring_free(state->ring);
+    free(state->streambuf);
+    free(state->copybuf);
+    free(state);
+} // free_copy_state
 
 
-size_t fatelf_header_size(const int bincount)
+static void create_copy_state_key(void)
 {
-    return (sizeof (FATELF_header) + (sizeof (FATELF_record) * bincount));
-} // fatelf_header_size
+    if (pthread_key_create(&copy_state_key, free_copy_state) != 0)
+        xfail("Failed to create thread-local storage");
+} // create_copy_state_key
 
 
-// Write a uint8_t to a buffer.
-static inline uint8_t *putui8(uint8_t *ptr, const uint8_t val)
+static copy_thread_state *get_copy_state(void)
 {
-    *(ptr++) = val;
-    return ptr;
-} // putui8
+    copy_thread_state *state;
 
+    pthread_once(&copy_state_once, create_copy_state_key);
+    if ((state = (copy_thread_state *) pthread_getspecific(copy_state_key)) == NULL)
+    {
+        state = (copy_thread_state *) xmalloc(sizeof (copy_thread_state));
+        state->copybuf = (uint8_t *) xmalloc(COPYBUF_SIZE);
+        pthread_setspecific(copy_state_key, state);
+    } // if
 
-// Write a native uint16_t to a buffer in littleendian format.
-static inline uint8_t *putui16(uint8_t *ptr, const uint16_t val)
-{
-    *(ptr++) = ((uint8_t) ((val >> 0) & 0xFF));
-    *(ptr++) = ((uint8_t) ((val >> 8) & 0xFF));
-    return ptr;
-} // putui16
+    return state;
+} // get_copy_state
 
 
-// Write a native uint32_t to a buffer in littleendian format.
-static inline uint8_t *putui32(uint8_t *ptr, const uint32_t val)
-{
-    *(ptr++) = ((uint8_t) ((val >> 0) & 0xFF));
-    *(ptr++) = ((uint8_t) ((val >> 8) & 0xFF));
-    *(ptr++) = ((uint8_t) ((val >> 16) & 0xFF));
-    *(ptr++) = ((uint8_t) ((val >> 24) & 0xFF));
-    return ptr;
-} // putui32
+// Large-file copy mode. These are set by xfatelf_init().
+int fatelf_copy_direct = 0;
+uint64_t fatelf_copy_rate_limit = 0;
+int fatelf_copy_progress = 0;
 
+#define STREAM_ALIGN 4096  // covers the O_DIRECT rules of any sane device.
+#define STREAM_BUFSIZE (1024 * 1024)
+#define STREAM_WINDOW (8 * 1024 * 1024)  // dirty bytes we allow in flight.
 
-// Write a native uint64_t to a buffer in littleendian format.
-static inline uint8_t *putui64(uint8_t *ptr, const uint64_t val)
+static uint64_t throttle_start = 0;
+static uint64_t throttle_bytes = 0;
+
+static inline int streaming_copy_wanted(void)
 {
-    *(ptr++) = ((uint8_t) ((val >> 0) & 0xFF));
-    *(ptr++) = ((uint8_t) ((val >> 8) & 0xFF));
-    *(ptr++) = ((uint8_t) ((val >> 16) & 0xFF));
-    *(ptr++) = ((uint8_t) ((val >> 24) & 0xFF));
-    *(ptr++) = ((uint8_t) ((val >> 32) & 0xFF));
-    *(ptr++) = ((uint8_t) ((val >> 40) & 0xFF));
-    *(ptr++) = ((uint8_t) ((val >> 48) & 0xFF));
-    *(ptr++) = ((uint8_t) ((val >> 56) & 0xFF));
-    return ptr;
-} // putui64
+    return (fatelf_copy_direct || fatelf_copy_rate_limit || fatelf_copy_progress);
+} // streaming_copy_wanted
 
 
-// Read a uint8_t from a buffer.
-static inline uint8_t *getui8(uint8_t *ptr, uint8_t *val)
+// Hold the total copy rate of this process to fatelf_copy_rate_limit.
+//  fatelf_parallel_for() workers all land here, so the shared budget is
+//  only touched atomically; whoever copies first starts the clock.
+static void throttle_copy(const uint64_t bytes)
 {
-    *val = *ptr;
-    return ptr + sizeof (*val);
-} // getui8
+    uint64_t now, start, total, expected;
 
+    if (!fatelf_copy_rate_limit)
+        return;
 
-// Read a littleendian uint16_t from a buffer in native format.
-static inline uint8_t *getui16(uint8_t *ptr, uint16_t *val)
-{
-    *val = ( (((uint16_t) ptr[0]) << 0) | (((uint16_t) ptr[1]) << 8) );
-    return ptr + sizeof (*val);
-} // getui16
+    now = stats_now();
+    __sync_bool_compare_and_swap(&throttle_start, 0, now);
+    start = __sync_fetch_and_add(&throttle_start, 0);
+    total = __sync_add_and_fetch(&throttle_bytes, bytes);
+
+    expected = (uint64_t) ((((double) total) * 1000000000.0) /
+                           ((double) fatelf_copy_rate_limit));
+    if ((now >= start) && ((now - start) < expected))
+    {
+        const uint64_t ns = expected - (now - start);
+        struct timespec ts;
+        ts.tv_sec = (time_t) (ns / 1000000000ull);
+        ts.tv_nsec = (long) (ns % 1000000000ull);
+        while ((nanosleep(&ts, &ts) == -1) && (errno == EINTR)) { /* spin */ }
+    } // if
+} // throttle_copy
 
 
-// Read a littleendian uint32_t from a buffer in native format.
-static inline uint8_t *getui32(uint8_t *ptr, uint32_t *val)
+static void report_progress(const char *in, const char *out,
+                            const uint64_t done, const uint64_t total,
+                            const uint64_t start)
 {
-    *val = ( (((uint32_t) ptr[0]) << 0)  |
-             (((uint32_t) ptr[1]) << 8)  |
-             (((uint32_t) ptr[2]) << 16) |
-             (((uint32_t) ptr[3]) << 24) );
-    return ptr + sizeof (*val);
-} // getui32
+    const double secs = ((double) (stats_now() - start)) / 1000000000.0;
+    const double mib = 1024.0 * 1024.0;
+    fprintf(stderr, "'%s' -> '%s': %.1f of %.1f MiB (%d%%), %.1f MiB/s\n",
+            in, out, ((double) done) / mib, ((double) total) / mib,
+            total ? ((int) ((done * 100) / total)) : 100,
+            (secs > 0.0) ? ((((double) done) / mib) / secs) : 0.0);
+} // report_progress
+
+
+// Start writeback of what we just wrote, and once there's more than a
+//  window's worth in flight, wait for the oldest window to hit the disk
+//  and drop it from the page cache. This keeps a huge copy from filling
+//  memory with dirty pages that push out everyone else's working set.
+static void stream_write_behind(const char *out, const int outfd,
+                                const uint64_t pos, const uint64_t len,
+                                uint64_t *dropped, const int finished)
+{
+#if defined(__linux__) && defined(SYNC_FILE_RANGE_WRITE)
+    const unsigned int waitflags = SYNC_FILE_RANGE_WAIT_BEFORE |
+                                   SYNC_FILE_RANGE_WRITE |
+                                   SYNC_FILE_RANGE_WAIT_AFTER;
+    const uint64_t end = pos + len;
 
+    if (len > 0)
+    {
+        sync_file_range(outfd, (off_t) pos, (off_t) len, SYNC_FILE_RANGE_WRITE);
+        stats_syscall(STAT_SYSCALL_SYNC_FILE_RANGE, 0);
+    } // if
 
-// Read a littleendian uint64_t from a buffer in native format.
-static inline uint8_t *getui64(uint8_t *ptr, uint64_t *val)
-{
-    *val = ( (((uint64_t) ptr[0]) << 0)  |
-             (((uint64_t) ptr[1]) << 8)  |
-             (((uint64_t) ptr[2]) << 16) |
-             (((uint64_t) ptr[3]) << 24) |
-             (((uint64_t) ptr[4]) << 32) |
-             (((uint64_t) ptr[5]) << 40) |
-             (((uint64_t) ptr[6]) << 48) |
-             (((uint64_t) ptr[7]) << 56) );
-    return ptr + sizeof (*val);
-} // getui64
+    while ( ((end - *dropped) >= (2 * STREAM_WINDOW)) ||
+            ((finished) && (end > *dropped)) )
+    {
+        const uint64_t count = minui64(end - *dropped, STREAM_WINDOW);
+        if (sync_file_range(outfd, (off_t) *dropped, (off_t) count, waitflags) == -1)
+            xfail("Failed to sync '%s': %s", out, strerror(errno));
+        posix_fadvise(outfd, (off_t) *dropped, (off_t) count, POSIX_FADV_DONTNEED);
+        stats_syscall(STAT_SYSCALL_SYNC_FILE_RANGE, 0);
+        stats_syscall(STAT_SYSCALL_FADVISE, 0);
+        *dropped += count;
+    } // while
+#endif
+} // stream_write_behind
 
 
-void xwrite_fatelf_header(const char *fname, const int fd,
-                          const FATELF_header *header)
+// The copy path for --direct-io, --io-rate and --progress. With
+//  --direct-io, the input is read with O_DIRECT into aligned buffers (or,
+//  if the filesystem won't allow that, read normally and dropped from the
+//  page cache right after), and the output is streamed to disk behind us.
+static uint64_t xcopyfile_streaming(const char *in, const int infd,
+                                    const char *out, const int outfd,
+                                    const uint64_t offset, const uint64_t size)
 {
-    const size_t buflen = FATELF_DISK_FORMAT_SIZE(header->num_records);
-    uint8_t *buf = (uint8_t *) xmalloc(buflen);
-    uint8_t *ptr = buf;
-    int i;
+    const uint64_t start = stats_now();
+    uint64_t lastreport = start;
+    uint64_t remaining = size;
+    uint64_t pos = offset;
+    uint64_t outpos = 0;
+    uint64_t dropped = 0;
+    int writebehind = 0;
+    int directfd = -1;
+    int reported = 0;
+    copy_thread_state *state = get_copy_state();
+    uint8_t *streambuf = state->streambuf;
+
+    if (streambuf == NULL)
+    {
+        void *ptr = NULL;
+        if (posix_memalign(&ptr, STREAM_ALIGN, STREAM_BUFSIZE) != 0)
+            xfail("Out of memory!");
+        streambuf = state->streambuf = (uint8_t *) ptr;
+    } // if
 
-    ptr = putui32(ptr, header->magic);
-    ptr = putui16(ptr, header->version);
-    ptr = putui8(ptr, header->num_records);
-    ptr = putui8(ptr, header->reserved0);
+    if (fatelf_copy_direct)
+    {
+        const off_t rc = lseek(outfd, 0, SEEK_CUR);
+        stats_syscall(STAT_SYSCALL_LSEEK, 0);
+        writebehind = (rc != -1);
+        dropped = outpos = writebehind ? (uint64_t) rc : 0;
 
-    for (i = 0; i < header->num_records; i++)
+        #ifdef O_DIRECT
+        {
+            // Get a second handle on the input with O_DIRECT, so the caller's
+            //  descriptor keeps working normally.
+            char path[64];
+            snprintf(path, sizeof (path), "/proc/self/fd/%d", infd);
+            directfd = open(path, O_RDONLY | O_DIRECT);
+            stats_syscall(STAT_SYSCALL_OPEN, 0);
+        }
+        #endif
+
+        #ifdef POSIX_FADV_SEQUENTIAL
+        posix_fadvise(infd, (off_t) offset, (off_t) size, POSIX_FADV_SEQUENTIAL);
+        stats_syscall(STAT_SYSCALL_FADVISE, 0);
+        #endif
+    } // if
+
+    while (remaining > 0)
     {
-        ptr = putui16(ptr, header->records[i].machine);
-        ptr = putui8(ptr, header->records[i].osabi);
-        ptr = putui8(ptr, header->records[i].osabi_version);
-        ptr = putui8(ptr, header->records[i].word_size);
-        ptr = putui8(ptr, header->records[i].byte_order);
-        ptr = putui8(ptr, header->records[i].reserved0);
-        ptr = putui8(ptr, header->records[i].reserved1);
-        ptr = putui64(ptr, header->records[i].offset);
-        ptr = putui64(ptr, header->records[i].size);
-    } // for
+        const uint8_t *data = streambuf;
+        uint64_t count = 0;
 
-    assert(ptr == (buf + buflen));
+        if (directfd != -1)
+        {
+            // O_DIRECT wants aligned offsets, lengths and buffers, so read
+            //  whole blocks that cover what we want, and skip the edges.
+            const uint64_t aligned = pos & ~((uint64_t) (STREAM_ALIGN - 1));
+            const uint64_t skip = pos - aligned;
+            const uint64_t want = minui64(STREAM_BUFSIZE, (skip + remaining + (STREAM_ALIGN - 1)) & ~((uint64_t) (STREAM_ALIGN - 1)));
+            ssize_t rc;
+            while (((rc = pread(directfd, streambuf, (size_t) want, (off_t) aligned)) == -1) && (errno == EINTR)) { /* spin */ }
+            stats_syscall(STAT_SYSCALL_PREAD, rc);
+            if ((rc == -1) && (errno == EINVAL))  // filesystem won't do it.
+            {
+                close(directfd);
+                directfd = -1;
+                continue;
+            } // if
+            else if (rc == -1)
+                xfail("Failed to read '%s': %s", in, strerror(errno));
+            else if (((uint64_t) rc) <= skip)
+                xfail("Failed to read '%s': Unexpected end of file", in);
+            data = streambuf + skip;
+            count = minui64(((uint64_t) rc) - skip, remaining);
+        } // if
+        else
+        {
+            count = minui64(STREAM_BUFSIZE, remaining);
+            xpread(in, infd, streambuf, (size_t) count, pos);
+            #ifdef POSIX_FADV_DONTNEED
+            if (fatelf_copy_direct)
+            {
+                posix_fadvise(infd, (off_t) pos, (off_t) count, POSIX_FADV_DONTNEED);
+                stats_syscall(STAT_SYSCALL_FADVISE, 0);
+            } // if
+            #endif
+        } // else
 
-    xlseek(fname, fd, 0, SEEK_SET);  // jump to start of file again.
-    xwrite(fname, fd, buf, buflen);
+        {
+            uint64_t written = 0;
+            while (written < count)
+                written += (uint64_t) xwrite(out, outfd, data + written, (size_t) (count - written));
+        }
 
-    free(buf);
-} // xwrite_fatelf_header
+        if (writebehind)
+            stream_write_behind(out, outfd, outpos, count, &dropped, 0);
 
-// don't forget to free() the returned pointer!
-FATELF_header *xread_fatelf_header(const char *fname, const int fd)
-{
-    FATELF_header *header = NULL;
-    uint8_t buf[8];
-    uint8_t *fullbuf = NULL;
-    uint8_t *ptr = buf;
-    uint32_t magic = 0;
-    uint16_t version = 0;
-    uint8_t bincount = 0;
-    uint8_t reserved0 = 0;
-    size_t buflen = 0;
-    int i = 0;
+        pos += count;
+        outpos += count;
+        remaining -= count;
 
-    xlseek(fname, fd, 0, SEEK_SET);  // just in case.
-    xread(fname, fd, buf, sizeof (buf), 1);
-    ptr = getui32(ptr, &magic);
-    ptr = getui16(ptr, &version);
-    ptr = getui8(ptr, &bincount);
-    ptr = getui8(ptr, &reserved0);
+        throttle_copy(count);
 
-    if (magic != FATELF_MAGIC)
-        xfail("'%s' is not a FatELF binary.", fname);
-    else if (version != 1)
-        xfail("'%s' uses an unknown FatELF version.", fname);
-    
-    buflen = FATELF_DISK_FORMAT_SIZE(bincount) - sizeof (buf);
-    ptr = fullbuf = (uint8_t *) xmalloc(buflen);
-    xread(fname, fd, fullbuf, buflen, 1);
-
-    header = (FATELF_header *) xmalloc(fatelf_header_size(bincount));
-    header->magic = magic;
-    header->version = version;
-    header->num_records = bincount;
-    header->reserved0 = reserved0;
+        if (fatelf_copy_progress)
+        {
+            const uint64_t now = stats_now();
+            if ((now - lastreport) >= 1000000000ull)
+            {
+                report_progress(in, out, size - remaining, size, start);
+                lastreport = now;
+                reported = (remaining > 0);
+            } // if
+        } // if
+    } // while
 
-    for (i = 0; i < bincount; i++)
+    if (writebehind)
+        stream_write_behind(out, outfd, outpos, 0, &dropped, 1);
+
+    if (directfd != -1)
     {
-        ptr = getui16(ptr, &header->records[i].machine);
-        ptr = getui8(ptr, &header->records[i].osabi);
-        ptr = getui8(ptr, &header->records[i].osabi_version);
-        ptr = getui8(ptr, &header->records[i].word_size);
-        ptr = getui8(ptr, &header->records[i].byte_order);
-        ptr = getui8(ptr, &header->records[i].reserved0);
-        ptr = getui8(ptr, &header->records[i].reserved1);
-        ptr = getui64(ptr, &header->records[i].offset);
-        ptr = getui64(ptr, &header->records[i].size);
-    } // for
+        close(directfd);
+        stats_syscall(STAT_SYSCALL_CLOSE, 0);
+    } // if
 
-    assert(ptr == (fullbuf + buflen));
-
-    free(fullbuf);
-    return header;
-} // xread_fatelf_header
+    if (reported)  // let them see it finish, if they saw it start.
+        report_progress(in, out, size, size, start);
 
+    return size;
+} // xcopyfile_streaming
 
-uint64_t align_to_page(const uint64_t offset)
-{
-    const size_t pagesize = 4096;  // !!! FIXME: hardcoded pagesize.
-    const size_t overflow = (offset % pagesize);
-    return overflow ? (offset + (pagesize - overflow)) : offset;
-} // align_to_page
 
+#if defined(__linux__) && defined(__GLIBC__) && \
+    ((__GLIBC__ > 2) || ((__GLIBC__ == 2) && (__GLIBC_MINOR__ >= 27)))
+#define FATELF_HAVE_COPY_FILE_RANGE 1
+#endif
 
-// !!! FIXME: these names/descs aren't set in stone.
-// List from: http://www.sco.com/developers/gabi/latest/ch4.eheader.html
-static const fatelf_machine_info machines[] =
+// Have the kernel copy (size) bytes at (offset) in (infd) to the current
+//  position of (outfd), so the data never comes up to userspace (and on
+//  filesystems that can share extents, isn't copied at all). Returns how
+//  much got copied; if that's short, the kernel can't do this for these
+//  files, and the caller should do the rest itself.
+static uint64_t copy_range_in_kernel(const int infd, const int outfd,
+                                     const uint64_t offset, const uint64_t size)
 {
-    // MUST BE SORTED BY ID!
-    { 0, "none", "No machine" },
-    { 1, "m32", "AT&T WE 32100" },
-    { 2, "sparc", "SPARC" },
-    { 3, "i386", "Intel 80386" },
-    { 4, "68k", "Motorola 68000" },
-    { 5, "88k", "Motorola 88000" },
-    { 7, "860", "Intel 80860" },
-    { 8, "mips", "MIPS I" },
-    { 9, "s370", "IBM System/370" },
-    { 10, "mips-rs3", "MIPS RS3000" },
-    { 15, "pa-risc", "Hewlett-Packard PA-RISC" },
-    { 17, "vpp500", "Fujitsu VPP500" },
-    { 18, "sparc32plus", "Enhanced instruction set SPARC" },
-    { 19, "960", "Intel 80960" },
-    { 20, "ppc", "PowerPC" },
-    { 21, "ppc64", "64-bit PowerPC" },
-    { 22, "s390", "IBM System/390" },
-    { 36, "v800", "NEC V800" },
-    { 37, "fr20", "Fujitsu FR20" },
-    { 38, "rh32", "TRW RH-32" },
-    { 39, "rce", "Motorola RCE" },
-    { 40, "arm", "Advanced RISC Machines ARM" },
-    { 41, "alpha", "Digital Alpha" },
-    { 42, "sh", "Hitachi SH" },
-    { 43, "sparcv9", "SPARC Version 9" },
-    { 44, "tricore", "Siemens Tricore embedded" },
-    { 45, "arc", "Argonaut RISC Core" },
-    { 46, "h8-300", "Hitachi H8/300" },
-    { 47, "h8-300h", "Hitachi H8/300H" },
-    { 48, "h8s", "Hitachi H8S" },
-    { 49, "h8-500", "Hitachi H8/500" },
-    { 50, "ia64", "Intel IA-64" },
-    { 51, "mipsx", "Stanford MIPS-X" },
-    { 52, "coldfire", "Motorola Coldfire" },
-    { 53, "m68hc12", "Motorola M68HC12" },
-    { 54, "mma", "Fujitsu MMA Multimedia Accelerator" },
-    { 55, "pcp", "Siemens PCP" },
-    { 56, "ncpu", "Sony nCPU embedded RISC" },
-    { 57, "ndr1", "Denso NDR1" },
-    { 58, "starcore", "Motorola Star*Core" },
-    { 59, "me16", "Toyota ME16" },
-    { 60, "st100", "STMicroelectronics ST100" },
-    { 61, "tinyj", "Advanced Logic Corp. TinyJ" },
-    { 62, "x86_64", "AMD x86-64" },
-    { 63, "pdsp", "Sony DSP" },
-    { 64, "pdp10", "Digital Equipment Corp. PDP-10" },
-    { 65, "pdp11", "Digital Equipment Corp. PDP-11" },
-    { 66, "fx66", "Siemens FX66" },
-    { 67, "st9plus", "STMicroelectronics ST9+" },
-    { 68, "st7", "STMicroelectronics ST7" },
-    { 69, "68hc16", "Motorola MC68HC16" },
-    { 70, "68hc11", "Motorola MC68HC11" },
-    { 70, "68hc11", "Motorola MC68HC11" },
-    { 71, "68hc08", "Motorola MC68HC08" },
-    { 72, "68hc05", "Motorola MC68HC05" },
-    { 73, "svx", "Silicon Graphics SVx" },
-    { 74, "st19", "STMicroelectronics ST19" },
-    { 75, "vax", "Digital VAX" },
-    { 76, "cris", "Axis Communications 32-bit embedded processor" },
-    { 77, "javelin", "Infineon Technologies 32-bit embedded processor" },
-    { 78, "firepath", "Element 14 64-bit DSP Processor" },
-    { 79, "zsp", "LSI Logic 16-bit DSP Processor" },
-    { 80, "mmix", "Donald Knuth's educational 64-bit processor" },
-    { 81, "huany", "Harvard University machine-independent object files" },
-    { 82, "prism", "SiTera Prism" },
-    { 83, "avr", "Atmel AVR" },
-    { 84, "fr30", "Fujitsu FR30" },
-    { 85, "d10v", "Mitsubishi D10V" },
-    { 86, "d30v", "Mitsubishi D30V" },
-    { 87, "v850", "NEC v850" },
-    { 88, "m32r", "Mitsubishi M32R" },
-    { 89, "mn10300", "Matsushita MN10300" },
-    { 90, "mn10200", "Matsushita MN10200" },
-    { 91, "pj", "picoJava" },
-    { 92, "openrisc", "OpenRISC" },
-    { 93, "arc_a5", "ARC Cores Tangent-A5" },
-    { 94, "xtensa", "Tensilica Xtensa" },
-    { 95, "videocore", "Alphamosaic VideoCore" },
-    { 96, "tmm_gpp", "Thompson Multimedia General Purpose Processor" },
-    { 97, "ns32k", "National Semiconductor 32000 series" },
-    { 98, "tpc", "Tenor Network TPC" },
-    { 99, "snp1k", "Trebia SNP 1000" },
-    { 100, "st200", "STMicroelectronics ST200" },
-    { 101, "ip2k", "Ubicom IP2xxx" },
-    { 102, "max", "MAX Processor" },
-    { 103, "cr", "National Semiconductor CompactRISC" },
-    { 104, "f2mc16", "Fujitsu F2MC16" },
-    { 105, "msp430", "Texas Instruments msp430" },
-    { 106, "blackfin", "Analog Devices Blackfin" },
-    { 107, "se_c33", "S1C33 Family of Seiko Epson processors" },
-    { 108, "sep", "Sharp embedded microprocessor" },
-    { 109, "arca", "Arca RISC Microprocessor" },
-    { 110, "unicore", "Microprocessor series from PKU-Unity Ltd. and MPRC of Peking University" },
-    { 0x9026, "alpha", "Digital Alpha" },  // linux headers use this.
-    { 0x9080, "v850", "NEC v850" },  // old tools use this, apparently.
-    { 0x9041, "m32r", "Mitsubishi M32R" },  // old tools use this, apparently.
-    { 0xA390, "s390", "IBM System/390" },  // legacy value.
-    { 0xBEEF, "mn10300", "Matsushita MN10300" },  // old tools.
-};
+    uint64_t copied = 0;
+#ifdef FATELF_HAVE_COPY_FILE_RANGE
+    while (copied < size)
+    {
+        loff_t inpos = (loff_t) (offset + copied);
+        const size_t len = (size_t) minui64(size - copied, 0x40000000);
+        const ssize_t rc = copy_file_range(infd, &inpos, outfd, NULL, len, 0);
+        stats_syscall(STAT_SYSCALL_COPY_FILE_RANGE, rc);
+        if ((rc == -1) && (errno == EINTR))
+            continue;
+        else if (rc <= 0)  // EXDEV, ENOSYS, EINVAL, etc: do it by hand.
+            break;
+        copied += (uint64_t) rc;
+    } // while
+#endif
+    return copied;
+} // copy_range_in_kernel
 
 
-// !!! FIXME: these names/descs aren't set in stone.
-// List from: http://www.sco.com/developers/gabi/latest/ch4.eheader.html
-static const fatelf_osabi_info osabis[] =
-{
-    // MUST BE SORTED BY ID!
-    { 0, "sysv", "UNIX System V" },
-    { 1, "hpux", "Hewlett-Packard HP-UX" },
-    { 2, "netbsd", "NetBSD" },
-    { 3, "linux", "Linux" },
-    { 4, "hurd", "Hurd" },
-    { 5, "86open", "86Open common IA32" },
-    { 6, "solaris", "Sun Solaris" },
-    { 7, "aix", "AIX" },
-    { 8, "irix", "IRIX" },
-    { 9, "freebsd", "FreeBSD" },
-    { 10, "tru64", "Compaq TRU64 UNIX" },
-    { 11, "modesto", "Novell Modesto" },
-    { 12, "openbsd", "OpenBSD" },
-    { 13, "openvms", "OpenVMS" },
-    { 14, "nsk", "Hewlett-Packard Non-Stop Kernel" },
-    { 15, "aros", "Amiga Research OS" },
-    { 97, "armabi", "ARM" },
-    { 255, "standalone", "Standalone application" },
-};
+// The pipelined copy engine. When the kernel can't copy for us, we keep
+//  fatelf_copy_depth buffers in flight, so the next reads are already
+//  underway while earlier buffers are being written, and the two devices
+//  work at the same time instead of taking turns. With io_uring, one
+//  thread keeps all the reads and writes queued in the kernel; otherwise a
+//  reader thread fills buffers while the calling thread writes them out.
 
+int fatelf_copy_engine = FATELF_COPY_ENGINE_AUTO;
+int fatelf_copy_depth = 4;
 
-const fatelf_machine_info *get_machine_by_id(const uint16_t id)
+static int pipe_depth(copy_thread_state *state)
 {
+    const int depth = fatelf_copy_depth;
     int i;
-    for (i = 0; i < (sizeof (machines) / sizeof (machines[0])); i++)
+
+    for (i = 0; i < depth; i++)
     {
-        if (machines[i].id == id)
-            return &machines[i];
-        else if (machines[i].id > id)
-            break;  // not found (sorted by id).
+        if (state->slots[i].buf == NULL)
+        {
+            void *ptr = NULL;
+            if (posix_memalign(&ptr, 4096, PIPE_CHUNK) != 0)
+                xfail("Out of memory!");
+            state->slots[i].buf = (uint8_t *) ptr;
+        } // if
     } // for
 
-    return NULL;
-} // get_machine_by_id
+    return depth;
+} // pipe_depth
 
 
-const fatelf_machine_info *get_machine_by_name(const char *name)
+// (IO_URING_OP_SUPPORTED came with IORING_REGISTER_PROBE, which is an enum.)
+#if defined(__linux__) && defined(__NR_io_uring_setup) && defined(IORING_OFF_SQES) && defined(IO_URING_OP_SUPPORTED)
+#define FATELF_HAVE_IO_URING 1
+
+// Just enough io_uring to queue reads and writes, without liburing.
+typedef struct uring
 {
-    int i;
-    for (i = 0; i < (sizeof (machines) / sizeof (machines[0])); i++)
+    int fd;
+    unsigned int *sq_head;
+    unsigned int *sq_tail;
+    unsigned int *sq_mask;
+    unsigned int *sq_array;
+    unsigned int *cq_head;
+    unsigned int *cq_tail;
+    unsigned int *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    unsigned int queued;  // sqes filled in, but not submitted yet.
+    void *sqptr;
+    size_t sqsize;
+    void *cqptr;
+    size_t cqsize;
+    size_t sqessize;
+} uring;
+
+static void uring_free(uring *ring)
+{
+    munmap(ring->sqes, ring->sqessize);
+    if (ring->cqptr != ring->sqptr)
+        munmap(ring->cqptr, ring->cqsize);
+    munmap(ring->sqptr, ring->sqsize);
+    close(ring->fd);
+    free(ring);
+} // uring_free
+
+
+// IORING_OP_READ and IORING_OP_WRITE showed up in Linux 5.6, after
+//  io_uring itself; older kernels fail every one with -EINVAL. Probing
+//  showed up at the same time, so if it fails, so would they.
+static int uring_can_read_write(const int fd)
+{
+    const unsigned int numops = 256;
+    struct io_uring_probe *probe;
+    int retval = 0;
+
+    probe = (struct io_uring_probe *) xmalloc(sizeof (*probe) + (numops * sizeof (struct io_uring_probe_op)));
+    if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, numops) == 0)
     {
-        if (strcmp(machines[i].name, name) == 0)
-            return &machines[i];
-    } // for
+        retval = (probe->last_op >= IORING_OP_READ) && (probe->last_op >= IORING_OP_WRITE) &&
+                 (probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED) &&
+                 (probe->ops[IORING_OP_WRITE].flags & IO_URING_OP_SUPPORTED);
+    } // if
 
-    return NULL;
-} // get_machine_by_name
+    free(probe);
+    return retval;
+} // uring_can_read_write
 
 
-const fatelf_osabi_info *get_osabi_by_id(const uint8_t id)
+static uring *uring_init(copy_thread_state *state)
 {
-    int i;
-    for (i = 0; i < (sizeof (osabis) / sizeof (osabis[0])); i++)
+    uring *ring;
+    struct io_uring_params params;
+    size_t sqsize, cqsize;
+    uint8_t *sqptr, *cqptr;
+    void *sqes;
+    int fd;
+
+    if (state->ring_state != 0)
+        return state->ring;
+
+    state->ring_state = -1;
+    memset(&params, '\0', sizeof (params));
+    if ((fd = (int) syscall(__NR_io_uring_setup, PIPE_MAX_DEPTH, &params)) == -1)
+        return NULL;  // old kernel, seccomp, io_uring_disabled, etc.
+    else if (!uring_can_read_write(fd))
     {
-        if (osabis[i].id == id)
-            return &osabis[i];
-        else if (osabis[i].id > id)
-            break;  // not found (sorted by id).
-    } // for
-
-    return NULL;
-} // get_osabi_by_id
+        close(fd);
+        return NULL;  // Linux 5.1 through 5.5; use threads instead.
+    } // else if
 
+    sqsize = params.sq_off.array + (params.sq_entries * sizeof (unsigned int));
+    cqsize = params.cq_off.cqes + (params.cq_entries * sizeof (struct io_uring_cqe));
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+        sqsize = cqsize = (sqsize > cqsize) ? sqsize : cqsize;
 
-const fatelf_osabi_info *get_osabi_by_name(const char *name)
-{
-    int i;
-    for (i = 0; i < (sizeof (osabis) / sizeof (osabis[0])); i++)
+    sqptr = (uint8_t *) mmap(NULL, sqsize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (sqptr == MAP_FAILED)
     {
-        if (strcmp(osabis[i].name, name) == 0)
-            return &osabis[i];
-    } // for
+        close(fd);
+        return NULL;
+    } // if
 
-    return NULL;
-} // get_osabi_by_name
+    cqptr = sqptr;
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP))
+    {
+        cqptr = (uint8_t *) mmap(NULL, cqsize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (cqptr == MAP_FAILED)
+        {
+            munmap(sqptr, sqsize);
+            close(fd);
+            return NULL;
+        } // if
+    } // if
 
+    sqes = mmap(NULL, params.sq_entries * sizeof (struct io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED)
+    {
+        if (cqptr != sqptr)
+            munmap(cqptr, cqsize);
+        munmap(sqptr, sqsize);
+        close(fd);
+        return NULL;
+    } // if
 
-static int parse_abi_version_string(const char *str)
+    // we keep the ring until the thread ends.
+    ring = (uring *) xmalloc(sizeof (uring));
+    ring->fd = fd;
+    ring->sq_head = (unsigned int *) (sqptr + params.sq_off.head);
+    ring->sq_tail = (unsigned int *) (sqptr + params.sq_off.tail);
+    ring->sq_mask = (unsigned int *) (sqptr + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned int *) (sqptr + params.sq_off.array);
+    ring->cq_head = (unsigned int *) (cqptr + params.cq_off.head);
+    ring->cq_tail = (unsigned int *) (cqptr + params.cq_off.tail);
+    ring->cq_mask = (unsigned int *) (cqptr + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *) (cqptr + params.cq_off.cqes);
+    ring->sqes = (struct io_uring_sqe *) sqes;
+    ring->queued = 0;
+    ring->sqptr = sqptr;
+    ring->sqsize = sqsize;
+    ring->cqptr = cqptr;
+    ring->cqsize = cqsize;
+    ring->sqessize = params.sq_entries * sizeof (struct io_uring_sqe);
+    state->ring = ring;
+    state->ring_state = 1;
+    return ring;
+} // uring_init
+
+
+// we never queue more than PIPE_MAX_DEPTH, so there's always room.
+static void uring_queue(uring *ring, const int op, const int fd, void *buf,
+                        const size_t len, const uint64_t offset,
+                        const int slot)
 {
-    long num = 0;
-    char *endptr = NULL;
-    const char *prefix = "osabiver";
-    const size_t prefix_len = 8;
-    assert(strlen(prefix) == prefix_len);
-    if (strncmp(str, prefix, prefix_len) != 0)
-        return -1;
-
-    str += prefix_len;
-    num = strtol(str, &endptr, 0);
-    return ( ((endptr == str) || (*endptr != '\0')) ? -1 : ((int) num) );
-} // parse_abi_version_string
+    const unsigned int tail = *ring->sq_tail;
+    const unsigned int idx = tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[idx];
+
+    memset(sqe, '\0', sizeof (*sqe));
+    sqe->opcode = (uint8_t) op;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t) (uintptr_t) buf;
+    sqe->len = (uint32_t) len;
+    sqe->off = offset;
+    sqe->user_data = (uint64_t) slot;
+    ring->sq_array[idx] = idx;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring->queued++;
+} // uring_queue
+
+
+static void uring_queue_slot(uring *ring, const pipe_slot *slot, const int idx,
+                             const int infd, const uint64_t inoffset,
+                             const int outfd, const uint64_t outoffset)
+{
+    if (slot->writing)
+    {
+        uring_queue(ring, IORING_OP_WRITE, outfd, slot->buf + slot->done,
+                    slot->len - slot->done,
+                    outoffset + slot->pos + slot->done, idx);
+    } // if
+    else
+    {
+        uring_queue(ring, IORING_OP_READ, infd, slot->buf + slot->done,
+                    slot->len - slot->done,
+                    inoffset + slot->pos + slot->done, idx);
+    } // else
+} // uring_queue_slot
 
 
-static int xfind_fatelf_record_by_fields(const FATELF_header *header,
-                                         const char *target)
+// Copy with io_uring. Both files need real offsets, so (outfd) must be
+//  seekable; its position ends up just past what we wrote, like write().
+static void copy_range_uring(copy_thread_state *state, uring *ring,
+                             const char *in, const int infd,
+                             const char *out, const int outfd,
+                             const uint64_t inoffset, const uint64_t outoffset,
+                             const uint64_t size)
 {
-    char *buf = xstrdup(target);
-    const fatelf_osabi_info *osabi = NULL;
-    const fatelf_machine_info *machine = NULL;
-    FATELF_record rec;
-    int wants = 0;
-    int abiver = 0;
-    char *str = buf;
-    char *ptr = buf;
-    int retval = -1;
-    int i = 0;
+    const int depth = pipe_depth(state);
+    uint64_t next = 0;
+    uint64_t written = 0;
+    int i;
 
-    memset(&rec, '\0', sizeof (rec));
+    for (i = 0; (i < depth) && (next < size); i++)
+    {
+        pipe_slot *slot = &state->slots[i];
+        slot->pos = next;
+        slot->len = (size_t) minui64(PIPE_CHUNK, size - next);
+        slot->done = 0;
+        slot->writing = 0;
+        next += slot->len;
+        uring_queue_slot(ring, slot, i, infd, inoffset, outfd, outoffset);
+    } // for
 
-    while (1)
+    while (written < size)
     {
-        const char ch = *ptr;
-        if ((ch == ':') || (ch == '\0'))
+        unsigned int head, tail;
+        const unsigned int submit = ring->queued;
+        const int rc = (int) syscall(__NR_io_uring_enter, ring->fd, submit, 1,
+                                     IORING_ENTER_GETEVENTS, NULL, 0);
+        stats_syscall(STAT_SYSCALL_IO_URING_ENTER, 0);
+        if ((rc == -1) && ((errno == EINTR) || (errno == EAGAIN) || (errno == EBUSY)))
+            continue;
+        else if (rc == -1)
+            xfail("io_uring failed copying '%s' to '%s': %s", in, out, strerror(errno));
+        ring->queued -= (unsigned int) rc;
+
+        head = *ring->cq_head;
+        tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+        while (head != tail)
         {
-            *ptr = '\0';
+            const struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+            const int idx = (int) cqe->user_data;
+            const int res = cqe->res;
+            pipe_slot *slot = &state->slots[idx];
 
-            if (ptr == str)
-            {
-                // no-op for empty string.
-            } // if
-            else if ((strcmp(str,"be")==0) || (strcmp(str,"bigendian")==0))
-            {
-                wants |= FATELF_WANT_BYTEORDER;
-                rec.byte_order = FATELF_BIGENDIAN;
-            } // if
-            else if ((strcmp(str,"le")==0) || (strcmp(str,"littleendian")==0))
-            {
-                wants |= FATELF_WANT_BYTEORDER;
-                rec.byte_order = FATELF_LITTLEENDIAN;
-            } // else if
-            else if (strcmp(str,"32bit") == 0)
+            head++;
+
+            if ((res == -EINTR) || (res == -EAGAIN))
+                ;  // just try it again.
+            else if (res < 0)
             {
-                wants |= FATELF_WANT_WORDSIZE;
-                rec.word_size = FATELF_32BITS;
+                xfail("Failed to %s '%s': %s", slot->writing ? "write" : "read",
+                      slot->writing ? out : in, strerror(-res));
             } // else if
-            else if (strcmp(str,"64bit") == 0)
+            else if (res == 0)
             {
-                wants |= FATELF_WANT_WORDSIZE;
-                rec.word_size = FATELF_64BITS;
+                xfail("Failed to %s '%s': %s", slot->writing ? "write" : "read",
+                      slot->writing ? out : in,
+                      slot->writing ? "No space left" : "Unexpected end of file");
             } // else if
-            else if ((machine = get_machine_by_name(str)) != NULL)
+            else
             {
-                wants |= FATELF_WANT_MACHINE;
-                rec.machine = machine->id;
-            } // else if
-            else if ((osabi = get_osabi_by_name(str)) != NULL)
+                stats_syscall(slot->writing ? STAT_SYSCALL_WRITE : STAT_SYSCALL_PREAD, res);
+                slot->done += (size_t) res;
+                if ((slot->done == slot->len) && (!slot->writing))
+                {
+                    slot->writing = 1;  // got it all, now send it out.
+                    slot->done = 0;
+                } // if
+                else if (slot->done == slot->len)  // write finished.
+                {
+                    written += slot->len;
+                    throttle_copy(slot->len);
+                    if (next >= size)
+                        continue;  // nothing left to read; slot goes idle.
+                    slot->pos = next;
+                    slot->len = (size_t) minui64(PIPE_CHUNK, size - next);
+                    slot->done = 0;
+                    slot->writing = 0;
+                    next += slot->len;
+                } // else if
+            } // else
+
+            // queue whatever's next for this slot (or the rest of a short op).
+            uring_queue_slot(ring, slot, idx, infd, inoffset, outfd, outoffset);
+        } // while
+
+        __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    } // while
+
+    xlseek(out, outfd, (off_t) (outoffset + size), SEEK_SET);
+} // copy_range_uring
+
+#else
+struct uring { int unused; };
+static void uring_free(struct uring *ring) { (void) ring; }
+#endif
+
+
+typedef struct pipe_reader
+{
+    pipe_slot *slots;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int depth;
+    int infd;
+    uint64_t offset;
+    uint64_t size;
+    int filled;   // slots read and waiting to be written.
+    int quit;     // writer wants the reader to stop.
+    int error;    // errno from the reader, or -1 for end of file.
+} pipe_reader;
+
+static void *pipe_reader_thread(void *_state)
+{
+    pipe_reader *state = (pipe_reader *) _state;
+    uint64_t pos = 0;
+    int i = 0;
+
+    while (pos < state->size)
+    {
+        pipe_slot *slot = &state->slots[i];
+
+        pthread_mutex_lock(&state->lock);
+        while ((state->filled == state->depth) && (!state->quit))
+            pthread_cond_wait(&state->cond, &state->lock);
+        pthread_mutex_unlock(&state->lock);
+
+        if (state->quit)
+            break;
+
+        slot->pos = pos;
+        slot->len = (size_t) minui64(PIPE_CHUNK, state->size - pos);
+        slot->done = 0;
+        while (slot->done < slot->len)
+        {
+            const ssize_t rc = pread(state->infd, slot->buf + slot->done,
+                                     slot->len - slot->done,
+                                     (off_t) (state->offset + pos + slot->done));
+            stats_syscall(STAT_SYSCALL_PREAD, rc);
+            if ((rc == -1) && (errno == EINTR))
+                continue;
+            else if (rc <= 0)
             {
-                wants |= FATELF_WANT_OSABI;
-                rec.osabi = osabi->id;
+                pthread_mutex_lock(&state->lock);
+                state->error = (rc == 0) ? -1 : errno;
+                pthread_cond_signal(&state->cond);
+                pthread_mutex_unlock(&state->lock);
+                return NULL;
             } // else if
-            else if ((abiver = parse_abi_version_string(str)) != -1)
+            slot->done += (size_t) rc;
+        } // while
+
+        pos += slot->len;
+        i = (i + 1) % state->depth;
+
+        pthread_mutex_lock(&state->lock);
+        state->filled++;
+        pthread_cond_signal(&state->cond);
+        pthread_mutex_unlock(&state->lock);
+    } // while
+
+    return NULL;
+} // pipe_reader_thread
+
+
+// Copy with a reader thread. This only needs pread() on the input, so the
+//  output can be a pipe.
+static int copy_range_threaded(copy_thread_state *copystate, const char *in, const int infd,
+                               const char *out, const int outfd,
+                               const uint64_t offset, const uint64_t size)
+{
+    pipe_reader state;
+    pthread_t thread;
+    uint64_t written = 0;
+    int error = 0;
+    int i = 0;
+
+    memset(&state, '\0', sizeof (state));
+    state.slots = copystate->slots;
+    state.depth = pipe_depth(copystate);
+    state.infd = infd;
+    state.offset = offset;
+    state.size = size;
+    pthread_mutex_init(&state.lock, NULL);
+    pthread_cond_init(&state.cond, NULL);
+
+    if (pthread_create(&thread, NULL, pipe_reader_thread, &state) != 0)
+    {
+        pthread_cond_destroy(&state.cond);
+        pthread_mutex_destroy(&state.lock);
+        return 0;  // do it the slow way, then.
+    } // if
+
+    while (written < size)
+    {
+        const pipe_slot *slot = &state.slots[i];
+
+        pthread_mutex_lock(&state.lock);
+        while ((state.filled == 0) && (state.error == 0))
+            pthread_cond_wait(&state.cond, &state.lock);
+        error = (state.filled == 0) ? state.error : 0;
+        pthread_mutex_unlock(&state.lock);
+
+        if (error)
+            break;
+
+        {
+            size_t done = 0;
+            while (done < slot->len)
+                done += (size_t) xwrite(out, outfd, slot->buf + done, slot->len - done);
+        }
+
+        written += slot->len;
+        throttle_copy(slot->len);
+        i = (i + 1) % state.depth;
+
+        pthread_mutex_lock(&state.lock);
+        state.filled--;
+        pthread_cond_signal(&state.cond);
+        pthread_mutex_unlock(&state.lock);
+    } // while
+
+    pthread_join(thread, NULL);
+    pthread_cond_destroy(&state.cond);
+    pthread_mutex_destroy(&state.lock);
+
+    if (error == -1)
+        xfail("Failed to read '%s': Unexpected end of file", in);
+    else if (error)
+        xfail("Failed to read '%s': %s", in, strerror(error));
+
+    return 1;
+} // copy_range_threaded
+
+
+// The old way: one buffer, read then write, repeat.
+static void copy_range_plain(copy_thread_state *state, const char *in, const int infd,
+                             const char *out, const int outfd,
+                             const uint64_t offset, const uint64_t size)
+{
+    uint64_t remaining = size;
+    xlseek(in, infd, (off_t) offset, SEEK_SET);
+    while (remaining)
+    {
+        const size_t cpysize = minui64(remaining, COPYBUF_SIZE);
+        xread(in, infd, state->copybuf, cpysize, 1);
+        xwrite(out, outfd, state->copybuf, cpysize);
+        remaining -= (uint64_t) cpysize;
+    } // while
+} // copy_range_plain
+
+
+// Copy (size) bytes at (offset) in (infd) to the current position in
+//  (outfd), whichever way works best here.
+static void copy_range(const char *in, const int infd,
+                       const char *out, const int outfd,
+                       uint64_t offset, uint64_t size)
+{
+    const int engine = fatelf_copy_engine;
+    copy_thread_state *state = get_copy_state();
+    struct uring *ring = NULL;
+    off_t outpos;
+
+    if ((engine == FATELF_COPY_ENGINE_AUTO) || (engine == FATELF_COPY_ENGINE_KERNEL))
+    {
+        const uint64_t copied = copy_range_in_kernel(infd, outfd, offset, size);
+        offset += copied;
+        size -= copied;
+    } // if
+
+    if (size == 0)
+        return;
+    else if ((size <= PIPE_CHUNK) || (engine == FATELF_COPY_ENGINE_PLAIN) ||
+             (engine == FATELF_COPY_ENGINE_KERNEL) || (fatelf_copy_depth < 2))
+    {
+        copy_range_plain(state, in, infd, out, outfd, offset, size);  // not worth it.
+        return;
+    } // else if
+
+    outpos = lseek(outfd, 0, SEEK_CUR);
+    stats_syscall(STAT_SYSCALL_LSEEK, 0);
+
+    #ifdef FATELF_HAVE_IO_URING
+    if ( (outpos != -1) && ((engine == FATELF_COPY_ENGINE_AUTO) || (engine == FATELF_COPY_ENGINE_URING)) && ((ring = uring_init(state)) != NULL) )
+    {
+        copy_range_uring(state, ring, in, infd, out, outfd, offset, (uint64_t) outpos, size);
+        return;
+    } // if
+    #else
+    (void) outpos;
+    (void) ring;
+    #endif
+
+    if (!copy_range_threaded(state, in, infd, out, outfd, offset, size))
+        copy_range_plain(state, in, infd, out, outfd, offset, size);
+} // copy_range
+
+
+// xfail() on error.
+uint64_t xcopyfile(const char *in, const int infd,
+                   const char *out, const int outfd)
+{
+    const uint64_t start = fatelf_stats_begin();
+    uint64_t retval = 0;
+    struct stat statbuf;
+    uint8_t *copybuf = NULL;
+    ssize_t rc = 0;
+
+    // We know how big a regular file is, so it can take the fast paths.
+    stats_syscall(STAT_SYSCALL_FSTAT, 0);
+    if ((fstat(infd, &statbuf) == 0) && (S_ISREG(statbuf.st_mode)))
+    {
+        retval = (uint64_t) statbuf.st_size;
+        if (streaming_copy_wanted())
+            xcopyfile_streaming(in, infd, out, outfd, 0, retval);
+        else
+            copy_range(in, infd, out, outfd, 0, retval);
+        fatelf_stats_end(FATELF_STATS_PHASE_COPY, start, retval);
+        return retval;
+    } // if
+
+    // Pipes and such: read until EOF. --io-rate still applies, but there's
+    //  no size to stream against or to report progress on. A pipe can't
+    //  rewind, so it's read from wherever it is.
+    copybuf = get_copy_state()->copybuf;
+    stats_syscall(STAT_SYSCALL_LSEEK, 0);
+    if ((lseek(infd, 0, SEEK_SET) == -1) && (errno != ESPIPE))
+        xfail("Failed to seek in '%s': %s", in, strerror(errno));
+    while ( (rc = xread(in, infd, copybuf, COPYBUF_SIZE, 0)) > 0 )
+    {
+        xwrite(out, outfd, copybuf, rc);
+        retval += (uint64_t) rc;
+        throttle_copy((uint64_t) rc);
+    } // while
+
+    fatelf_stats_end(FATELF_STATS_PHASE_COPY, start, retval);
+    return retval;
+} // xcopyfile
+
+
+void xcopyfile_range(const char *in, const int infd,
+                     const char *out, const int outfd,
+                     const uint64_t offset, const uint64_t size)
+{
+    const uint64_t start = fatelf_stats_begin();
+
+    if (streaming_copy_wanted())
+        xcopyfile_streaming(in, infd, out, outfd, offset, size);
+    else
+        copy_range(in, infd, out, outfd, offset, size);
+
+    fatelf_stats_end(FATELF_STATS_PHASE_COPY, start, size);
+} // xcopyfile_range
+
+
+uint64_t fatelf_clone_range(const int infd, const uint64_t inoffset,
+                            const int outfd, const uint64_t outoffset,
+                            const uint64_t size)
+{
+#ifdef FICLONERANGE
+    struct file_clone_range range;
+    struct stat instat, outstat;
+    uint64_t blocksize, len;
+    int rc;
+
+    rc = fstat(outfd, &outstat);
+    stats_syscall(STAT_SYSCALL_FSTAT, 0);
+    if ((rc == -1) || (fstat(infd, &instat) == -1))
+        return 0;
+    stats_syscall(STAT_SYSCALL_FSTAT, 0);
+
+    // the filesystem only shares whole blocks, at block-aligned offsets,
+    //  except that the last partial block of the input can go, too.
+    blocksize = (outstat.st_blksize > 0) ? (uint64_t) outstat.st_blksize : 4096;
+    len = size - (size % blocksize);
+    if ((inoffset + size) == ((uint64_t) instat.st_size))
+        len = size;
+    if ((len == 0) || (inoffset % blocksize) || (outoffset % blocksize))
+        return 0;
+
+    range.src_fd = (int64_t) infd;
+    range.src_offset = inoffset;
+    range.src_length = len;
+    range.dest_offset = outoffset;
+    while (((rc = ioctl(outfd, FICLONERANGE, &range)) == -1) && (errno == EINTR)) { /* spin */ }
+    stats_syscall(STAT_SYSCALL_FICLONERANGE, (rc == -1) ? 0 : (ssize_t) len);
+    return (rc == -1) ? 0 : len;  // EOPNOTSUPP, EXDEV, etc: caller copies.
+#else
+    (void) infd; (void) inoffset; (void) outfd; (void) outoffset; (void) size;
+    return 0;
+#endif
+} // fatelf_clone_range
+
+
+void xread_elf_header(const char *fname, const int fd, const uint64_t offset,
+                      FATELF_record *record)
+{
+    const uint8_t magic[4] = { 0x7F, 0x45, 0x4C, 0x46 };
+    const uint64_t start = fatelf_stats_begin();
+    uint8_t buf[20];  // we only care about the first 20 bytes.
+    xlseek(fname, fd, offset, SEEK_SET);
+    xread(fname, fd, buf, sizeof (buf), 1);
+    if (memcmp(magic, buf, sizeof (magic)) != 0)
+        xfail("'%s' is not an ELF binary", fname);
+
+    record->osabi = buf[7];
+    record->osabi_version = buf[8];
+    record->word_size = buf[4];
+    record->byte_order = buf[5];
+    record->isa_level = 0;
+    record->reserved1 = 0;
+    record->offset = 0;
+    record->size = 0;
+
+    if ((record->word_size != FATELF_32BITS) &&
+        (record->word_size != FATELF_64BITS))
+    {
+        xfail("Unexpected word size (%d) in '%s'", record->word_size, fname);
+    } // if
+
+    if (record->byte_order == FATELF_BIGENDIAN)
+        record->machine = (((uint16_t)buf[18]) << 8) | (((uint16_t)buf[19]));
+    else if (record->byte_order == FATELF_LITTLEENDIAN)
+        record->machine = (((uint16_t)buf[19]) << 8) | (((uint16_t)buf[18]));
+    else
+    {
+        xfail("Unexpected byte order (%d) in '%s'",
+              (int) record->byte_order, fname);
+    } // else
+
+    fatelf_stats_end(FATELF_STATS_PHASE_HEADER_PARSE, start, sizeof (buf));
+} // xread_elf_header
+
+
+// xfail() on error or short read, handle EINTR. Doesn't move the file
+//  position, so threads can share (fd).
+void xpread(const char *fname, const int fd, void *buf,
+            const size_t len, const uint64_t offset)
+{
+    uint8_t *ptr = (uint8_t *) buf;
+    size_t remaining = len;
+    uint64_t pos = offset;
+
+    while (remaining > 0)
+    {
+        const ssize_t rc = pread(fd, ptr, remaining, (off_t) pos);
+        stats_syscall(STAT_SYSCALL_PREAD, rc);
+        if ((rc == -1) && (errno == EINTR))
+            continue;
+        else if (rc == -1)
+            xfail("Failed to read '%s': %s", fname, strerror(errno));
+        else if (rc == 0)
+            xfail("Failed to read '%s': Unexpected end of file", fname);
+        ptr += rc;
+        pos += (uint64_t) rc;
+        remaining -= (size_t) rc;
+    } // while
+} // xpread
+
+
+// ELF fields are in the binary's own byte order, unlike FatELF's.
+static uint16_t elf16(const uint8_t byte_order, const uint8_t *ptr)
+{
+    if (byte_order == FATELF_BIGENDIAN)
+        return (((uint16_t) ptr[0]) << 8) | ((uint16_t) ptr[1]);
+    return (((uint16_t) ptr[1]) << 8) | ((uint16_t) ptr[0]);
+} // elf16
+
+
+static uint32_t elf32(const uint8_t byte_order, const uint8_t *ptr)
+{
+    if (byte_order == FATELF_BIGENDIAN)
+    {
+        return ( (((uint32_t) elf16(byte_order, ptr)) << 16) |
+                 ((uint32_t) elf16(byte_order, ptr + 2)) );
+    } // if
+    return ( (((uint32_t) elf16(byte_order, ptr + 2)) << 16) |
+             ((uint32_t) elf16(byte_order, ptr)) );
+} // elf32
+
+
+static uint64_t elf64(const uint8_t byte_order, const uint8_t *ptr)
+{
+    if (byte_order == FATELF_BIGENDIAN)
+    {
+        return ( (((uint64_t) elf32(byte_order, ptr)) << 32) |
+                 ((uint64_t) elf32(byte_order, ptr + 4)) );
+    } // if
+    return ( (((uint64_t) elf32(byte_order, ptr + 4)) << 32) |
+             ((uint64_t) elf32(byte_order, ptr)) );
+} // elf64
+
+
+// Elf32 and Elf64 "Addr"/"Off"/"Xword" fields differ in size.
+static uint64_t elfword(const fatelf_elf_header *hdr, const uint8_t *ptr)
+{
+    if (hdr->word_size == FATELF_32BITS)
+        return (uint64_t) elf32(hdr->byte_order, ptr);
+    return elf64(hdr->byte_order, ptr);
+} // elfword
+
+
+uint16_t fatelf_elf_get16(const fatelf_elf_header *hdr, const uint8_t *ptr)
+{
+    return elf16(hdr->byte_order, ptr);
+} // fatelf_elf_get16
+
+
+uint32_t fatelf_elf_get32(const fatelf_elf_header *hdr, const uint8_t *ptr)
+{
+    return elf32(hdr->byte_order, ptr);
+} // fatelf_elf_get32
+
+
+const char *fatelf_elf_decode_header(const uint8_t *buf, const size_t buflen,
+                                     fatelf_elf_header *hdr)
+{
+    const uint8_t magic[4] = { 0x7F, 0x45, 0x4C, 0x46 };
+    const uint8_t *ptr = NULL;
+
+    memset(hdr, '\0', sizeof (*hdr));
+    if ((buflen < 20) || (memcmp(magic, buf, sizeof (magic)) != 0))
+        return "is not an ELF binary";
+
+    hdr->word_size = buf[4];
+    hdr->byte_order = buf[5];
+    hdr->osabi = buf[7];
+    hdr->osabi_version = buf[8];
+
+    if ((hdr->word_size != FATELF_32BITS) && (hdr->word_size != FATELF_64BITS))
+        return "has an unexpected ELF word size";
+    else if ((hdr->byte_order != FATELF_BIGENDIAN) &&
+             (hdr->byte_order != FATELF_LITTLEENDIAN))
+        return "has an unexpected ELF byte order";
+    else if (buflen < FATELF_ELF_EHDR_SIZE(hdr->word_size))
+        return "has a truncated ELF header";
+
+    hdr->type = elf16(hdr->byte_order, buf + 16);
+    hdr->machine = elf16(hdr->byte_order, buf + 18);
+    ptr = buf + 24;
+    hdr->entry = elfword(hdr, ptr);
+    ptr += (hdr->word_size == FATELF_32BITS) ? 4 : 8;
+    hdr->phoff = elfword(hdr, ptr);
+    ptr += (hdr->word_size == FATELF_32BITS) ? 4 : 8;
+    hdr->shoff = elfword(hdr, ptr);
+    ptr += (hdr->word_size == FATELF_32BITS) ? 4 : 8;
+    ptr += 4;  // e_flags
+    ptr += 2;  // e_ehsize
+    hdr->phentsize = elf16(hdr->byte_order, ptr); ptr += 2;
+    hdr->phnum = elf16(hdr->byte_order, ptr); ptr += 2;
+    hdr->shentsize = elf16(hdr->byte_order, ptr); ptr += 2;
+    hdr->shnum = elf16(hdr->byte_order, ptr); ptr += 2;
+    hdr->shstrndx = elf16(hdr->byte_order, ptr); ptr += 2;
+    return NULL;
+} // fatelf_elf_decode_header
+
+
+void fatelf_elf_decode_section(const fatelf_elf_header *hdr,
+                               const uint8_t *ptr, fatelf_elf_section *sec)
+{
+    const uint8_t order = hdr->byte_order;
+    const int wordlen = (hdr->word_size == FATELF_32BITS) ? 4 : 8;
+    sec->name = elf32(order, ptr); ptr += 4;
+    sec->type = elf32(order, ptr); ptr += 4;
+    sec->flags = elfword(hdr, ptr); ptr += wordlen;
+    sec->addr = elfword(hdr, ptr); ptr += wordlen;
+    sec->offset = elfword(hdr, ptr); ptr += wordlen;
+    sec->size = elfword(hdr, ptr); ptr += wordlen;
+    sec->link = elf32(order, ptr); ptr += 4;
+    sec->info = elf32(order, ptr); ptr += 4;
+    sec->addralign = elfword(hdr, ptr); ptr += wordlen;
+    sec->entsize = elfword(hdr, ptr); ptr += wordlen;
+} // fatelf_elf_decode_section
+
+
+void fatelf_elf_decode_symbol(const fatelf_elf_header *hdr,
+                              const uint8_t *ptr, fatelf_elf_symbol *sym)
+{
+    const uint8_t order = hdr->byte_order;
+    sym->name = elf32(order, ptr);
+    if (hdr->word_size == FATELF_32BITS)
+    {
+        sym->value = elf32(order, ptr + 4);
+        sym->size = elf32(order, ptr + 8);
+        sym->info = ptr[12];
+        sym->other = ptr[13];
+        sym->shndx = elf16(order, ptr + 14);
+    } // if
+    else
+    {
+        sym->info = ptr[4];
+        sym->other = ptr[5];
+        sym->shndx = elf16(order, ptr + 6);
+        sym->value = elf64(order, ptr + 8);
+        sym->size = elf64(order, ptr + 16);
+    } // else
+} // fatelf_elf_decode_symbol
+
+
+void xread_elf_full_header(const char *fname, const int fd,
+                           const uint64_t offset, fatelf_elf_header *hdr)
+{
+    uint8_t buf[64];  // big enough for an Elf64_Ehdr.
+    const char *err = NULL;
+    const uint64_t fsize = xget_file_size(fname, fd);
+    const size_t avail = (fsize <= offset) ? 0 :
+                         (size_t) minui64(fsize - offset, sizeof (buf));
+    if (avail > 0)
+        xpread(fname, fd, buf, avail, offset);
+    if ((err = fatelf_elf_decode_header(buf, avail, hdr)) != NULL)
+        xfail("'%s' %s", fname, err);
+} // xread_elf_full_header
+
+
+fatelf_elf_section *xread_elf_sections(const char *fname, const int fd,
+                                       const uint64_t offset,
+                                       const fatelf_elf_header *hdr,
+                                       int *count)
+{
+    const size_t entsize = FATELF_ELF_SHDR_SIZE(hdr->word_size);
+    fatelf_elf_section *retval = NULL;
+    uint8_t *buf = NULL;
+    uint64_t total = hdr->shnum;
+    uint64_t i;
+
+    *count = 0;
+    if (hdr->shoff == 0)
+        return NULL;  // no section headers at all (stripped executable?).
+    else if (hdr->shentsize < entsize)
+        xfail("'%s' has a bogus ELF section header size", fname);
+
+    buf = (uint8_t *) xmalloc(hdr->shentsize);
+    if (total == 0)  // extended numbering: real count is in section 0.
+    {
+        fatelf_elf_section sec0;
+        xpread(fname, fd, buf, hdr->shentsize, offset + hdr->shoff);
+        fatelf_elf_decode_section(hdr, buf, &sec0);
+        total = sec0.size;
+    } // if
+
+    if (total > 0xFFFFFF)
+        xfail("'%s' has too many ELF sections", fname);
+
+    retval = (fatelf_elf_section *) xmalloc(sizeof (*retval) * (total + 1));
+    for (i = 0; i < total; i++)
+    {
+        const uint64_t pos = offset + hdr->shoff + (i * hdr->shentsize);
+        xpread(fname, fd, buf, hdr->shentsize, pos);
+        fatelf_elf_decode_section(hdr, buf, &retval[i]);
+    } // for
+
+    free(buf);
+    *count = (int) total;
+    return retval;
+} // xread_elf_sections
+
+
+void *xread_elf_section_data(const char *fname, const int fd,
+                             const uint64_t offset,
+                             const fatelf_elf_section *sec)
+{
+    uint8_t *retval = NULL;
+    if (sec->size > 0x7FFFFFFF)
+        xfail("'%s' has an unreasonably large ELF section", fname);
+    retval = (uint8_t *) xmalloc((size_t) sec->size + 1);  // +1 for a null.
+    if ((sec->type != FATELF_SHT_NOBITS) && (sec->size > 0))
+        xpread(fname, fd, retval, (size_t) sec->size, offset + sec->offset);
+    return retval;
+} // xread_elf_section_data
+
+
+#define FATELF_SHT_NOTE 7
+#define FATELF_NT_GNU_PROPERTY_TYPE_0 5
+#define FATELF_GNU_PROPERTY_X86_ISA_1_NEEDED 0xC0008002
+
+// Walk the GNU properties in one SHT_NOTE section's data.
+static uint8_t find_isa_level_note(const fatelf_elf_header *hdr,
+                                   const uint8_t *data, const uint64_t len,
+                                   const uint64_t align)
+{
+    const uint8_t bo = hdr->byte_order;
+    const uint64_t pralign = (hdr->word_size == FATELF_64BITS) ? 8 : 4;
+    uint64_t pos = 0;
+
+    #define ALIGN_UP(x, a) (((x) + ((a) - 1)) & ~((uint64_t) ((a) - 1)))
+
+    while ((pos + 12) <= len)
+    {
+        const uint32_t namesz = elf32(bo, data + pos);
+        const uint32_t descsz = elf32(bo, data + pos + 4);
+        const uint32_t type = elf32(bo, data + pos + 8);
+        const uint64_t descpos = ALIGN_UP(pos + 12 + namesz, align);
+        const uint64_t next = ALIGN_UP(descpos + descsz, align);
+
+        if ((descpos > len) || (next > len) || (next <= pos))
+            break;  // truncated or bogus; just stop looking.
+
+        if ( (type == FATELF_NT_GNU_PROPERTY_TYPE_0) && (namesz == 4) &&
+             (memcmp(data + pos + 12, "GNU", 4) == 0) )
+        {
+            const uint64_t end = descpos + descsz;
+            uint64_t prpos = descpos;
+            while ((prpos + 8) <= end)
+            {
+                const uint32_t prtype = elf32(bo, data + prpos);
+                const uint32_t prsize = elf32(bo, data + prpos + 4);
+                if ((prpos + 8 + prsize) > end)
+                    break;
+                else if ((prtype == FATELF_GNU_PROPERTY_X86_ISA_1_NEEDED) && (prsize >= 4))
+                {
+                    // bit 0 is baseline, bits 1 to 3 are x86-64-v2 to v4.
+                    const uint32_t bits = elf32(bo, data + prpos + 8);
+                    if (bits & (1 << 3))
+                        return 4;
+                    else if (bits & (1 << 2))
+                        return 3;
+                    else if (bits & (1 << 1))
+                        return 2;
+                    return FATELF_ISA_BASELINE;
+                } // else if
+                prpos = ALIGN_UP(prpos + 8 + prsize, pralign);
+            } // while
+        } // if
+
+        pos = next;
+    } // while
+
+    #undef ALIGN_UP
+
+    return FATELF_ISA_BASELINE;
+} // find_isa_level_note
+
+
+uint8_t xread_elf_isa_level(const char *fname, const int fd,
+                            const uint64_t offset)
+{
+    fatelf_elf_header hdr;
+    fatelf_elf_section *sections = NULL;
+    uint8_t retval = FATELF_ISA_BASELINE;
+    const uint64_t fsize = xget_file_size(fname, fd);
+    int count = 0;
+    int i;
+
+    // Not even a full ELF header? Then there aren't any notes, either.
+    if ((fsize <= offset) || ((fsize - offset) < FATELF_ELF_EHDR_SIZE(FATELF_64BITS)))
+        return FATELF_ISA_BASELINE;
+
+    xread_elf_full_header(fname, fd, offset, &hdr);
+    if ((hdr.machine != 3) && (hdr.machine != 62))
+        return FATELF_ISA_BASELINE;  // only x86 has an ISA-needed property.
+
+    sections = xread_elf_sections(fname, fd, offset, &hdr, &count);
+    for (i = 0; (i < count) && (retval == FATELF_ISA_BASELINE); i++)
+    {
+        const fatelf_elf_section *sec = &sections[i];
+        if ((sec->type == FATELF_SHT_NOTE) && (sec->size > 0))
+        {
+            uint8_t *data = (uint8_t *) xread_elf_section_data(fname, fd, offset, sec);
+            const uint64_t align = (sec->addralign == 8) ? 8 : 4;
+            retval = find_isa_level_note(&hdr, data, sec->size, align);
+            free(data);
+        } // if
+    } // for
+
+    free(sections);
+    return retval;
+} // xread_elf_isa_level
+
+
+size_t fatelf_header_size(const uint32_t bincount)
+{
+    return (sizeof (FATELF_header) + (sizeof (FATELF_record) * (size_t) bincount));
+} // fatelf_header_size
+
+
+// The fields of a record, in order of precedence for sorting. The
+//  FATELF_WANT_* bit for each one is there for binary searches.
+#define RECORD_KEY_FIELDS 6
+static const int record_key_wants[RECORD_KEY_FIELDS] = {
+    FATELF_WANT_MACHINE, FATELF_WANT_WORDSIZE, FATELF_WANT_BYTEORDER,
+    FATELF_WANT_OSABI, FATELF_WANT_OSABIVER, FATELF_WANT_ISALEVEL
+};
+
+// Compare the first (fields) sort keys of two records.
+static int compare_record_keys(const FATELF_record *a, const FATELF_record *b,
+                               const int fields)
+{
+    #define TEST_UNSORTED(idx, field) \
+        if (fields <= idx) \
+            return 0; \
+        else if (a->field > b->field) \
+            return 1; \
+        else if (a->field < b->field) \
+            return -1;
+
+    // This must be in the same order as record_key_wants.
+    TEST_UNSORTED(0, machine);
+    TEST_UNSORTED(1, word_size);
+    TEST_UNSORTED(2, byte_order);
+    TEST_UNSORTED(3, osabi);
+    TEST_UNSORTED(4, osabi_version);
+    TEST_UNSORTED(5, isa_level);
+
+    #undef TEST_UNSORTED
+
+    return 0;
+} // compare_record_keys
+
+
+int fatelf_record_compare(const FATELF_record *a, const FATELF_record *b)
+{
+    return compare_record_keys(a, b, RECORD_KEY_FIELDS);
+} // fatelf_record_compare
+
+
+static int qsort_records(const void *a, const void *b)
+{
+    return fatelf_record_compare((const FATELF_record *) a,
+                                 (const FATELF_record *) b);
+} // qsort_records
+
+
+void fatelf_sort_records(FATELF_record *records, const uint32_t count)
+{
+    qsort(records, count, sizeof (FATELF_record), qsort_records);
+} // fatelf_sort_records
+
+
+static int compare_record_data(const void *_a, const void *_b)
+{
+    const FATELF_record *a = *((const FATELF_record **) _a);
+    const FATELF_record *b = *((const FATELF_record **) _b);
+    if (a->offset != b->offset)
+        return (a->offset < b->offset) ? -1 : 1;
+    else if (a->size != b->size)
+        return (a->size < b->size) ? -1 : 1;
+    else if (a != b)  // keep aliases in record order.
+        return (a < b) ? -1 : 1;
+    return 0;
+} // compare_record_data
+
+
+uint32_t fatelf_find_aliases(const FATELF_header *header, const int skip,
+                             int *owners)
+{
+    const uint32_t total = header->num_records;
+    const FATELF_record **sorted = (const FATELF_record **) xmalloc(sizeof (FATELF_record *) * (total + 1));
+    uint32_t count = 0;
+    uint32_t aliases = 0;
+    uint32_t i;
+
+    for (i = 0; i < total; i++)
+    {
+        owners[i] = (int) i;
+        if (((int) i != skip) && (header->records[i].size > 0))
+            sorted[count++] = &header->records[i];
+    } // for
+
+    // Sorting by offset puts each set of aliases together, lowest index first.
+    qsort(sorted, count, sizeof (FATELF_record *), compare_record_data);
+
+    for (i = 1; i < count; i++)
+    {
+        const FATELF_record *prev = sorted[i-1];
+        const FATELF_record *rec = sorted[i];
+        if ((rec->offset == prev->offset) && (rec->size == prev->size))
+        {
+            owners[rec - header->records] = owners[prev - header->records];
+            aliases++;
+        } // if
+    } // for
+
+    free(sorted);
+    return aliases;
+} // fatelf_find_aliases
+
+
+int fatelf_record_fits_elf(const FATELF_header *header, const int idx,
+                           const FATELF_record *elfrec)
+{
+    const FATELF_record *rec = &header->records[idx];
+    uint32_t i;
+
+    if (fatelf_record_matches(rec, elfrec))
+        return 1;
+    else if ( (rec->machine != elfrec->machine) ||
+              (rec->word_size != elfrec->word_size) ||
+              (rec->byte_order != elfrec->byte_order) ||
+              (rec->isa_level != elfrec->isa_level) )
+        return 0;
+
+    // Only the OSABI differs, which is fine for an alias.
+    for (i = 0; i < header->num_records; i++)
+    {
+        const FATELF_record *other = &header->records[i];
+        if ( ((int) i != idx) && (rec->size > 0) &&
+             (other->offset == rec->offset) && (other->size == rec->size) )
+            return 1;
+    } // for
+
+    return 0;
+} // fatelf_record_fits_elf
+
+
+void xcheck_lone_aliases(const char *fname, const int fd,
+                         const FATELF_header *header, const int skip,
+                         const int *owners)
+{
+    const FATELF_record *skipped = &header->records[skip];
+    uint32_t i, j;
+
+    for (i = 0; i < header->num_records; i++)
+    {
+        const FATELF_record *rec = &header->records[i];
+        FATELF_record elfrec;
+
+        if ( ((int) i == skip) || (rec->size == 0) ||
+             (rec->offset != skipped->offset) || (rec->size != skipped->size) )
+            continue;  // didn't share with (skip).
+
+        for (j = 0; j < header->num_records; j++)
+        {
+            if ((j != i) && ((int) j != skip) && (owners[j] == owners[i]))
+                break;
+        } // for
+
+        if (j < header->num_records)
+            continue;  // still shares with someone else.
+
+        xread_elf_header(fname, fd, rec->offset, &elfrec);
+        elfrec.isa_level = rec->isa_level;
+        if (!fatelf_record_matches(rec, &elfrec))
+        {
+            // fatelf_get_target_name() has one buffer, so copy the first.
+            char *name = xstrdup(fatelf_get_target_name(rec, FATELF_WANT_EVERYTHING));
+            xfail("'%s' shares its data with '%s', and can't keep it alone;"
+                  " its ELF header has another OSABI.", name,
+                  fatelf_get_target_name(skipped, FATELF_WANT_EVERYTHING));
+        } // if
+    } // for
+} // xcheck_lone_aliases
+
+
+// Find the range of records whose first (fields) keys match (key), in a
+//  header that's sorted. (*hi) is one past the last match.
+static void find_record_range(const FATELF_header *header,
+                              const FATELF_record *key, const int fields,
+                              uint32_t *lo, uint32_t *hi)
+{
+    uint32_t low = 0;
+    uint32_t high = header->num_records;
+
+    while (low < high)  // lower bound.
+    {
+        const uint32_t mid = low + ((high - low) / 2);
+        if (compare_record_keys(&header->records[mid], key, fields) < 0)
+            low = mid + 1;
+        else
+            high = mid;
+    } // while
+    *lo = low;
+
+    high = header->num_records;
+    while (low < high)  // upper bound.
+    {
+        const uint32_t mid = low + ((high - low) / 2);
+        if (compare_record_keys(&header->records[mid], key, fields) <= 0)
+            low = mid + 1;
+        else
+            high = mid;
+    } // while
+    *hi = low;
+} // find_record_range
+
+
+int fatelf_find_matching_record(const FATELF_header *header,
+                                const FATELF_record *rec)
+{
+    uint32_t lo = 0;
+    uint32_t hi = header->num_records;
+    uint32_t i;
+
+    if (header->version >= FATELF_FORMAT_VERSION_2)
+        find_record_range(header, rec, RECORD_KEY_FIELDS, &lo, &hi);
+
+    for (i = lo; i < hi; i++)
+    {
+        if (fatelf_record_matches(&header->records[i], rec))
+            return (int) i;
+    } // for
+
+    return -1;
+} // fatelf_find_matching_record
+
+
+// Write a uint8_t to a buffer.
+static inline uint8_t *putui8(uint8_t *ptr, const uint8_t val)
+{
+    *(ptr++) = val;
+    return ptr;
+} // putui8
+
+
+// Write a native uint16_t to a buffer in littleendian format.
+static inline uint8_t *putui16(uint8_t *ptr, const uint16_t val)
+{
+    *(ptr++) = ((uint8_t) ((val >> 0) & 0xFF));
+    *(ptr++) = ((uint8_t) ((val >> 8) & 0xFF));
+    return ptr;
+} // putui16
+
+
+// Write a native uint32_t to a buffer in littleendian format.
+static inline uint8_t *putui32(uint8_t *ptr, const uint32_t val)
+{
+    *(ptr++) = ((uint8_t) ((val >> 0) & 0xFF));
+    *(ptr++) = ((uint8_t) ((val >> 8) & 0xFF));
+    *(ptr++) = ((uint8_t) ((val >> 16) & 0xFF));
+    *(ptr++) = ((uint8_t) ((val >> 24) & 0xFF));
+    return ptr;
+} // putui32
+
+
+// Write a native uint64_t to a buffer in littleendian format.
+static inline uint8_t *putui64(uint8_t *ptr, const uint64_t val)
+{
+    *(ptr++) = ((uint8_t) ((val >> 0) & 0xFF));
+    *(ptr++) = ((uint8_t) ((val >> 8) & 0xFF));
+    *(ptr++) = ((uint8_t) ((val >> 16) & 0xFF));
+    *(ptr++) = ((uint8_t) ((val >> 24) & 0xFF));
+    *(ptr++) = ((uint8_t) ((val >> 32) & 0xFF));
+    *(ptr++) = ((uint8_t) ((val >> 40) & 0xFF));
+    *(ptr++) = ((uint8_t) ((val >> 48) & 0xFF));
+    *(ptr++) = ((uint8_t) ((val >> 56) & 0xFF));
+    return ptr;
+} // putui64
+
+
+// Read a uint8_t from a buffer.
+static inline uint8_t *getui8(uint8_t *ptr, uint8_t *val)
+{
+    *val = *ptr;
+    return ptr + sizeof (*val);
+} // getui8
+
+
+// Read a littleendian uint16_t from a buffer in native format.
+static inline uint8_t *getui16(uint8_t *ptr, uint16_t *val)
+{
+    *val = ( (((uint16_t) ptr[0]) << 0) | (((uint16_t) ptr[1]) << 8) );
+    return ptr + sizeof (*val);
+} // getui16
+
+
+// Read a littleendian uint32_t from a buffer in native format.
+static inline uint8_t *getui32(uint8_t *ptr, uint32_t *val)
+{
+    *val = ( (((uint32_t) ptr[0]) << 0)  |
+             (((uint32_t) ptr[1]) << 8)  |
+             (((uint32_t) ptr[2]) << 16) |
+             (((uint32_t) ptr[3]) << 24) );
+    return ptr + sizeof (*val);
+} // getui32
+
+
+// Read a littleendian uint64_t from a buffer in native format.
+static inline uint8_t *getui64(uint8_t *ptr, uint64_t *val)
+{
+    *val = ( (((uint64_t) ptr[0]) << 0)  |
+             (((uint64_t) ptr[1]) << 8)  |
+             (((uint64_t) ptr[2]) << 16) |
+             (((uint64_t) ptr[3]) << 24) |
+             (((uint64_t) ptr[4]) << 32) |
+             (((uint64_t) ptr[5]) << 40) |
+             (((uint64_t) ptr[6]) << 48) |
+             (((uint64_t) ptr[7]) << 56) );
+    return ptr + sizeof (*val);
+} // getui64
+
+
+static uint8_t *encode_record(uint8_t *ptr, const FATELF_record *rec)
+{
+    ptr = putui16(ptr, rec->machine);
+    ptr = putui8(ptr, rec->osabi);
+    ptr = putui8(ptr, rec->osabi_version);
+    ptr = putui8(ptr, rec->word_size);
+    ptr = putui8(ptr, rec->byte_order);
+    ptr = putui8(ptr, rec->isa_level);
+    ptr = putui8(ptr, rec->reserved1);
+    ptr = putui64(ptr, rec->offset);
+    ptr = putui64(ptr, rec->size);
+    return ptr;
+} // encode_record
+
+
+static uint8_t *decode_record(uint8_t *ptr, FATELF_record *rec)
+{
+    ptr = getui16(ptr, &rec->machine);
+    ptr = getui8(ptr, &rec->osabi);
+    ptr = getui8(ptr, &rec->osabi_version);
+    ptr = getui8(ptr, &rec->word_size);
+    ptr = getui8(ptr, &rec->byte_order);
+    ptr = getui8(ptr, &rec->isa_level);
+    ptr = getui8(ptr, &rec->reserved1);
+    ptr = getui64(ptr, &rec->offset);
+    ptr = getui64(ptr, &rec->size);
+    return ptr;
+} // decode_record
+
+
+uint16_t fatelf_minimum_format_version(const FATELF_header *header)
+{
+    uint32_t i;
+
+    if (header->num_records > FATELF_MAX_RECORDS_V1)
+        return FATELF_FORMAT_VERSION_2;
+
+    // version 1 readers would think these are duplicates of the baseline.
+    for (i = 0; i < header->num_records; i++)
+    {
+        if (header->records[i].isa_level != FATELF_ISA_BASELINE)
+            return FATELF_FORMAT_VERSION_2;
+    } // for
+
+    return FATELF_FORMAT_VERSION_1;
+} // fatelf_minimum_format_version
+
+
+size_t fatelf_disk_header_size(const uint16_t version,
+                               const uint32_t bincount)
+{
+    if (version == FATELF_FORMAT_VERSION_1)
+        return FATELF_DISK_FORMAT_SIZE(bincount);
+    return (size_t) FATELF_DISK_FORMAT_SIZE_V2(bincount);
+} // fatelf_disk_header_size
+
+
+uint8_t *fatelf_encode_header(const FATELF_header *header, size_t *len)
+{
+    const uint32_t total = header->num_records;
+    const size_t buflen = fatelf_disk_header_size(header->version, total);
+    uint8_t *buf = (uint8_t *) xmalloc(buflen);
+    uint8_t *ptr = buf;
+    uint32_t i;
+
+    ptr = putui32(ptr, header->magic);
+    ptr = putui16(ptr, header->version);
+
+    if (header->version == FATELF_FORMAT_VERSION_1)
+    {
+        assert(total <= FATELF_MAX_RECORDS_V1);
+        ptr = putui8(ptr, (uint8_t) total);
+        ptr = putui8(ptr, (uint8_t) header->reserved0);
+        for (i = 0; i < total; i++)
+            ptr = encode_record(ptr, &header->records[i]);
+    } // if
+    else
+    {
+        // Version 2 records are always in canonical order on disk. Sort a
+        //  copy, so the caller's record indices don't change under them.
+        const size_t reclen = sizeof (FATELF_record) * total;
+        FATELF_record *sorted = (FATELF_record *) xmalloc(reclen ? reclen : 1);
+        int *owners = (int *) xmalloc(sizeof (int) * (total + 1));
+        uint32_t flags = header->flags & ~(FATELF_FLAG_MERKLE | FATELF_FLAG_ALIASES);
+
+        // The aliases flag follows the records, so it's always right.
+        if (fatelf_find_aliases(header, -1, owners) > 0)
+            flags |= FATELF_FLAG_ALIASES;
+        free(owners);
+
+        memcpy(sorted, header->records, reclen);
+        fatelf_sort_records(sorted, total);
+
+        ptr = putui16(ptr, header->reserved0);
+        ptr = putui32(ptr, total);
+        ptr = putui32(ptr, flags);
+        for (i = 0; i < total; i++)
+            ptr = encode_record(ptr, &sorted[i]);
+        free(sorted);
+    } // else
+
+    assert(ptr == (buf + buflen));
+
+    *len = buflen;
+    return buf;
+} // fatelf_encode_header
+
+
+size_t fatelf_decode_header_size(const uint8_t *buf, const size_t buflen,
+                                 const char **err)
+{
+    uint8_t *ptr = (uint8_t *) buf;
+    uint32_t magic = 0;
+    uint16_t version = 0;
+    uint8_t bincount = 0;
+    uint16_t reserved0 = 0;
+    uint32_t bincount32 = 0;
+
+    if (buflen < 8)
+    {
+        *err = "has a truncated FatELF header";
+        return 0;
+    } // if
+
+    ptr = getui32(ptr, &magic);
+    ptr = getui16(ptr, &version);
+
+    if (magic != FATELF_MAGIC)
+    {
+        *err = "is not a FatELF binary";
+        return 0;
+    } // if
+    else if (version == FATELF_FORMAT_VERSION_1)
+    {
+        ptr = getui8(ptr, &bincount);
+        return FATELF_DISK_FORMAT_SIZE(bincount);
+    } // else if
+    else if (version != FATELF_FORMAT_VERSION_2)
+    {
+        *err = "uses an unknown FatELF version";
+        return 0;
+    } // else if
+    else if (buflen < FATELF_DISK_FORMAT_SIZE_V2(0))
+        return FATELF_DISK_FORMAT_SIZE_V2(0);  // need more to tell.
+
+    ptr = getui16(ptr, &reserved0);
+    ptr = getui32(ptr, &bincount32);
+
+    // on 32-bit hosts, a bogus count could wrap either size around to
+    //  something small enough to look plausible.
+    if ((FATELF_DISK_FORMAT_SIZE_V2(bincount32) > (uint64_t) SIZE_MAX) ||
+        (bincount32 > ((SIZE_MAX - sizeof (FATELF_header)) / sizeof (FATELF_record))))
+    {
+        *err = "has too many records to read";
+        return 0;
+    } // if
+
+    return (size_t) FATELF_DISK_FORMAT_SIZE_V2(bincount32);
+} // fatelf_decode_header_size
+
+
+FATELF_header *fatelf_decode_header(const uint8_t *buf, const size_t buflen,
+                                    const char **err)
+{
+    const size_t needed = fatelf_decode_header_size(buf, buflen, err);
+    FATELF_header *header = NULL;
+    uint8_t *ptr = (uint8_t *) buf;
+    uint32_t bincount = 0;
+    size_t headerlen = 0;
+    uint32_t i = 0;
+
+    if (needed == 0)
+        return NULL;
+    else if (buflen < needed)
+    {
+        *err = "has a truncated FatELF header";
+        return NULL;
+    } // else if
+
+    if (buf[4] == FATELF_FORMAT_VERSION_1)
+    {
+        bincount = buf[6];
+        headerlen = FATELF_DISK_FORMAT_SIZE(0);
+    } // if
+    else
+    {
+        getui32((uint8_t *) buf + 8, &bincount);
+        headerlen = FATELF_DISK_FORMAT_SIZE_V2(0);
+    } // else
+
+    // don't trust the size math: every record has to be in the buffer.
+    if (bincount > ((buflen - headerlen) / 24))
+    {
+        *err = "has a truncated FatELF header";
+        return NULL;
+    } // if
+
+    // not xmalloc(): libfatelf-preload.so calls this, and must never exit().
+    header = (FATELF_header *) calloc(1, fatelf_header_size(bincount));
+    if (header == NULL)
+    {
+        *err = "has too many records to read";
+        return NULL;
+    } // if
+
+    if (buf[4] == FATELF_FORMAT_VERSION_1)
+    {
+        uint8_t bincount8 = 0;
+        uint8_t reserved0 = 0;
+        ptr = getui32(ptr, &header->magic);
+        ptr = getui16(ptr, &header->version);
+        ptr = getui8(ptr, &bincount8);
+        ptr = getui8(ptr, &reserved0);
+        header->reserved0 = reserved0;
+        header->flags = 0;  // version 1 has no flags.
+    } // if
+    else
+    {
+        ptr = getui32(ptr, &header->magic);
+        ptr = getui16(ptr, &header->version);
+        ptr = getui16(ptr, &header->reserved0);
+        ptr = getui32(ptr, &bincount);
+        ptr = getui32(ptr, &header->flags);
+
+        // a flag we don't know might change how the file has to be read.
+        if ((header->flags & ~FATELF_KNOWN_FLAGS) != 0)
+        {
+            free(header);
+            *err = "has unknown FatELF header flags";
+            return NULL;
+        } // if
+    } // else
+
+    header->num_records = bincount;
+    for (i = 0; i < bincount; i++)
+        ptr = decode_record(ptr, &header->records[i]);
+
+    assert(ptr == (buf + needed));
+
+    // binary searches depend on this, so don't trust the file.
+    if (header->version >= FATELF_FORMAT_VERSION_2)
+    {
+        for (i = 1; i < bincount; i++)
+        {
+            if (fatelf_record_compare(&header->records[i-1], &header->records[i]) >= 0)
+            {
+                free(header);
+                *err = "has unsorted or duplicate FatELF records";
+                return NULL;
+            } // if
+        } // for
+    } // if
+
+    return header;
+} // fatelf_decode_header
+
+
+void xwrite_fatelf_header(const char *fname, const int fd,
+                          const FATELF_header *header)
+{
+    const uint64_t start = fatelf_stats_begin();
+    size_t buflen = 0;
+    uint8_t *buf = fatelf_encode_header(header, &buflen);
+    xlseek(fname, fd, 0, SEEK_SET);  // jump to start of file again.
+    xwrite(fname, fd, buf, buflen);
+    free(buf);
+    fatelf_stats_end(FATELF_STATS_PHASE_HEADER_WRITE, start, buflen);
+} // xwrite_fatelf_header
+
+// don't forget to free() the returned pointer!
+FATELF_header *xread_fatelf_header(const char *fname, const int fd)
+{
+    const uint64_t start = fatelf_stats_begin();
+    FATELF_header *header = NULL;
+    const char *err = NULL;
+    uint8_t buf[8];
+    uint8_t *fullbuf = NULL;
+    size_t buflen = 0;
+
+    size_t have = sizeof (buf);
+
+    xlseek(fname, fd, 0, SEEK_SET);  // just in case.
+    xread(fname, fd, buf, sizeof (buf), 1);
+    fullbuf = (uint8_t *) xmalloc(have);
+    memcpy(fullbuf, buf, have);
+
+    // newer versions might need a few more bytes to know the full size.
+    while ((buflen = fatelf_decode_header_size(fullbuf, have, &err)) > have)
+    {
+        if (buflen > xget_file_size(fname, fd))
+            xfail("'%s' has a truncated FatELF header.", fname);
+        fullbuf = (uint8_t *) realloc(fullbuf, buflen);
+        if (fullbuf == NULL)
+            xfail("Out of memory!");
+        xread(fname, fd, fullbuf + have, buflen - have, 1);
+        have = buflen;
+    } // while
+
+    if (buflen == 0)
+        xfail("'%s' %s.", fname, err);
+
+    header = fatelf_decode_header(fullbuf, buflen, &err);
+    if (header == NULL)
+        xfail("'%s' %s.", fname, err);
+
+    free(fullbuf);
+    fatelf_stats_end(FATELF_STATS_PHASE_HEADER_PARSE, start, buflen);
+    return header;
+} // xread_fatelf_header
+
+
+static int pread_all(const int fd, void *_buf, size_t len, uint64_t offset)
+{
+    uint8_t *buf = (uint8_t *) _buf;
+    while (len > 0)
+    {
+        const ssize_t rc = pread(fd, buf, len, (off_t) offset);
+        stats_syscall(STAT_SYSCALL_PREAD, rc);
+        if ((rc == -1) && (errno == EINTR))
+            continue;
+        else if (rc <= 0)
+            return -1;
+        buf += rc;
+        len -= (size_t) rc;
+        offset += (uint64_t) rc;
+    } // while
+    return 0;
+} // pread_all
+
+
+FATELF_header *fatelf_pread_header(const int fd, const uint64_t offset,
+                                   const uint64_t size, const char **err)
+{
+    uint8_t first[FATELF_DISK_FORMAT_SIZE_V2(0)];
+    FATELF_header *header = NULL;
+    uint8_t *buf = NULL;
+    size_t len = sizeof (first);
+    uint32_t i;
+
+    if (size < 8)  // too small to even have the magic and version.
+    {
+        *err = "is not a FatELF binary";
+        return NULL;
+    } // if
+    else if (size < len)
+        len = (size_t) size;
+
+    if (pread_all(fd, first, len, offset) == -1)
+    {
+        *err = "couldn't be read";
+        return NULL;
+    } // if
+    else if ((len = fatelf_decode_header_size(first, len, err)) == 0)
+        return NULL;
+    else if (len > size)
+    {
+        *err = "has a truncated FatELF header";
+        return NULL;
+    } // else if
+
+    buf = (uint8_t *) xmalloc(len);
+    memcpy(buf, first, (len < sizeof (first)) ? len : sizeof (first));
+    if ((len > sizeof (first)) &&
+        (pread_all(fd, buf + sizeof (first), len - sizeof (first), offset + sizeof (first)) == -1))
+    {
+        free(buf);
+        *err = "couldn't be read";
+        return NULL;
+    } // if
+
+    header = fatelf_decode_header(buf, len, err);
+    free(buf);
+    if (header == NULL)
+        return NULL;
+
+    for (i = 0; i < header->num_records; i++)
+    {
+        const FATELF_record *rec = &header->records[i];
+        if ((rec->offset > size) || (rec->size > (size - rec->offset)))
+        {
+            free(header);
+            *err = "is truncated";
+            return NULL;
+        } // if
+    } // for
+
+    return header;
+} // fatelf_pread_header
+
+
+uint64_t align_to_page(const uint64_t offset)
+{
+    const size_t pagesize = 4096;  // !!! FIXME: hardcoded pagesize.
+    const size_t overflow = (offset % pagesize);
+    return overflow ? (offset + (pagesize - overflow)) : offset;
+} // align_to_page
+
+
+// !!! FIXME: these names/descs aren't set in stone.
+// List from: http://www.sco.com/developers/gabi/latest/ch4.eheader.html
+static const fatelf_machine_info machines[] =
+{
+    // MUST BE SORTED BY ID!
+    { 0, "none", "No machine" },
+    { 1, "m32", "AT&T WE 32100" },
+    { 2, "sparc", "SPARC" },
+    { 3, "i386", "Intel 80386" },
+    { 4, "68k", "Motorola 68000" },
+    { 5, "88k", "Motorola 88000" },
+    { 7, "860", "Intel 80860" },
+    { 8, "mips", "MIPS I" },
+    { 9, "s370", "IBM System/370" },
+    { 10, "mips-rs3", "MIPS RS3000" },
+    { 15, "pa-risc", "Hewlett-Packard PA-RISC" },
+    { 17, "vpp500", "Fujitsu VPP500" },
+    { 18, "sparc32plus", "Enhanced instruction set SPARC" },
+    { 19, "960", "Intel 80960" },
+    { 20, "ppc", "PowerPC" },
+    { 21, "ppc64", "64-bit PowerPC" },
+    { 22, "s390", "IBM System/390" },
+    { 36, "v800", "NEC V800" },
+    { 37, "fr20", "Fujitsu FR20" },
+    { 38, "rh32", "TRW RH-32" },
+    { 39, "rce", "Motorola RCE" },
+    { 40, "arm", "Advanced RISC Machines ARM" },
+    { 41, "alpha", "Digital Alpha" },
+    { 42, "sh", "Hitachi SH" },
+    { 43, "sparcv9", "SPARC Version 9" },
+    { 44, "tricore", "Siemens Tricore embedded" },
+    { 45, "arc", "Argonaut RISC Core" },
+    { 46, "h8-300", "Hitachi H8/300" },
+    { 47, "h8-300h", "Hitachi H8/300H" },
+    { 48, "h8s", "Hitachi H8S" },
+    { 49, "h8-500", "Hitachi H8/500" },
+    { 50, "ia64", "Intel IA-64" },
+    { 51, "mipsx", "Stanford MIPS-X" },
+    { 52, "coldfire", "Motorola Coldfire" },
+    { 53, "m68hc12", "Motorola M68HC12" },
+    { 54, "mma", "Fujitsu MMA Multimedia Accelerator" },
+    { 55, "pcp", "Siemens PCP" },
+    { 56, "ncpu", "Sony nCPU embedded RISC" },
+    { 57, "ndr1", "Denso NDR1" },
+    { 58, "starcore", "Motorola Star*Core" },
+    { 59, "me16", "Toyota ME16" },
+    { 60, "st100", "STMicroelectronics ST100" },
+    { 61, "tinyj", "Advanced Logic Corp. TinyJ" },
+    { 62, "x86_64", "AMD x86-64" },
+    { 63, "pdsp", "Sony DSP" },
+    { 64, "pdp10", "Digital Equipment Corp. PDP-10" },
+    { 65, "pdp11", "Digital Equipment Corp. PDP-11" },
+    { 66, "fx66", "Siemens FX66" },
+    { 67, "st9plus", "STMicroelectronics ST9+" },
+    { 68, "st7", "STMicroelectronics ST7" },
+    { 69, "68hc16", "Motorola MC68HC16" },
+    { 70, "68hc11", "Motorola MC68HC11" },
+    { 70, "68hc11", "Motorola MC68HC11" },
+    { 71, "68hc08", "Motorola MC68HC08" },
+    { 72, "68hc05", "Motorola MC68HC05" },
+    { 73, "svx", "Silicon Graphics SVx" },
+    { 74, "st19", "STMicroelectronics ST19" },
+    { 75, "vax", "Digital VAX" },
+    { 76, "cris", "Axis Communications 32-bit embedded processor" },
+    { 77, "javelin", "Infineon Technologies 32-bit embedded processor" },
+    { 78, "firepath", "Element 14 64-bit DSP Processor" },
+    { 79, "zsp", "LSI Logic 16-bit DSP Processor" },
+    { 80, "mmix", "Donald Knuth's educational 64-bit processor" },
+    { 81, "huany", "Harvard University machine-independent object files" },
+    { 82, "prism", "SiTera Prism" },
+    { 83, "avr", "Atmel AVR" },
+    { 84, "fr30", "Fujitsu FR30" },
+    { 85, "d10v", "Mitsubishi D10V" },
+    { 86, "d30v", "Mitsubishi D30V" },
+    { 87, "v850", "NEC v850" },
+    { 88, "m32r", "Mitsubishi M32R" },
+    { 89, "mn10300", "Matsushita MN10300" },
+    { 90, "mn10200", "Matsushita MN10200" },
+    { 91, "pj", "picoJava" },
+    { 92, "openrisc", "OpenRISC" },
+    { 93, "arc_a5", "ARC Cores Tangent-A5" },
+    { 94, "xtensa", "Tensilica Xtensa" },
+    { 95, "videocore", "Alphamosaic VideoCore" },
+    { 96, "tmm_gpp", "Thompson Multimedia General Purpose Processor" },
+    { 97, "ns32k", "National Semiconductor 32000 series" },
+    { 98, "tpc", "Tenor Network TPC" },
+    { 99, "snp1k", "Trebia SNP 1000" },
+    { 100, "st200", "STMicroelectronics ST200" },
+    { 101, "ip2k", "Ubicom IP2xxx" },
+    { 102, "max", "MAX Processor" },
+    { 103, "cr", "National Semiconductor CompactRISC" },
+    { 104, "f2mc16", "Fujitsu F2MC16" },
+    { 105, "msp430", "Texas Instruments msp430" },
+    { 106, "blackfin", "Analog Devices Blackfin" },
+    { 107, "se_c33", "S1C33 Family of Seiko Epson processors" },
+    { 108, "sep", "Sharp embedded microprocessor" },
+    { 109, "arca", "Arca RISC Microprocessor" },
+    { 110, "unicore", "Microprocessor series from PKU-Unity Ltd. and MPRC of Peking University" },
+    { 0x9026, "alpha", "Digital Alpha" },  // linux headers use this.
+    { 0x9080, "v850", "NEC v850" },  // old tools use this, apparently.
+    { 0x9041, "m32r", "Mitsubishi M32R" },  // old tools use this, apparently.
+    { 0xA390, "s390", "IBM System/390" },  // legacy value.
+    { 0xBEEF, "mn10300", "Matsushita MN10300" },  // old tools.
+};
+
+
+// !!! FIXME: these names/descs aren't set in stone.
+// List from: http://www.sco.com/developers/gabi/latest/ch4.eheader.html
+static const fatelf_osabi_info osabis[] =
+{
+    // MUST BE SORTED BY ID!
+    { 0, "sysv", "UNIX System V" },
+    { 1, "hpux", "Hewlett-Packard HP-UX" },
+    { 2, "netbsd", "NetBSD" },
+    { 3, "linux", "Linux" },
+    { 4, "hurd", "Hurd" },
+    { 5, "86open", "86Open common IA32" },
+    { 6, "solaris", "Sun Solaris" },
+    { 7, "aix", "AIX" },
+    { 8, "irix", "IRIX" },
+    { 9, "freebsd", "FreeBSD" },
+    { 10, "tru64", "Compaq TRU64 UNIX" },
+    { 11, "modesto", "Novell Modesto" },
+    { 12, "openbsd", "OpenBSD" },
+    { 13, "openvms", "OpenVMS" },
+    { 14, "nsk", "Hewlett-Packard Non-Stop Kernel" },
+    { 15, "aros", "Amiga Research OS" },
+    { 97, "armabi", "ARM" },
+    { 255, "standalone", "Standalone application" },
+};
+
+
+const fatelf_machine_info *get_machine_by_id(const uint16_t id)
+{
+    int i;
+    for (i = 0; i < (sizeof (machines) / sizeof (machines[0])); i++)
+    {
+        if (machines[i].id == id)
+            return &machines[i];
+        else if (machines[i].id > id)
+            break;  // not found (sorted by id).
+    } // for
+
+    return NULL;
+} // get_machine_by_id
+
+
+const fatelf_machine_info *get_machine_by_name(const char *name)
+{
+    int i;
+    for (i = 0; i < (sizeof (machines) / sizeof (machines[0])); i++)
+    {
+        if (strcmp(machines[i].name, name) == 0)
+            return &machines[i];
+    } // for
+
+    return NULL;
+} // get_machine_by_name
+
+
+const fatelf_osabi_info *get_osabi_by_id(const uint8_t id)
+{
+    int i;
+    for (i = 0; i < (sizeof (osabis) / sizeof (osabis[0])); i++)
+    {
+        if (osabis[i].id == id)
+            return &osabis[i];
+        else if (osabis[i].id > id)
+            break;  // not found (sorted by id).
+    } // for
+
+    return NULL;
+} // get_osabi_by_id
+
+
+const fatelf_osabi_info *get_osabi_by_name(const char *name)
+{
+    int i;
+    for (i = 0; i < (sizeof (osabis) / sizeof (osabis[0])); i++)
+    {
+        if (strcmp(osabis[i].name, name) == 0)
+            return &osabis[i];
+    } // for
+
+    return NULL;
+} // get_osabi_by_name
+
+
+static const fatelf_isa_info isas[] =
+{
+    { 62, 2, "x86-64-v2", "x86-64 with SSE4.2, SSSE3, POPCNT, CMPXCHG16B" },
+    { 62, 3, "x86-64-v3", "x86-64 with AVX2, BMI2, FMA, MOVBE" },
+    { 62, 4, "x86-64-v4", "x86-64 with AVX-512 F/BW/CD/DQ/VL" },
+    { 183, 1, "armv8.1-a", "ARMv8.1-A (LSE atomics, RDM)" },
+    { 183, 2, "armv8.2-a", "ARMv8.2-A (DC CVAP)" },
+    { 183, 3, "armv8.3-a", "ARMv8.3-A (LRCPC, JSCVT, FCMA)" },
+    { 183, 4, "armv8.4-a", "ARMv8.4-A (DIT, LSE2, LRCPC2, FlagM)" },
+    { 183, 5, "armv8.5-a", "ARMv8.5-A (SB, FlagM2, FRINT)" },
+};
+
+const fatelf_isa_info *get_isa_by_level(const uint16_t machine,
+                                        const uint8_t level)
+{
+    int i;
+    for (i = 0; i < (sizeof (isas) / sizeof (isas[0])); i++)
+    {
+        if ((isas[i].machine == machine) && (isas[i].level == level))
+            return &isas[i];
+    } // for
+
+    return NULL;
+} // get_isa_by_level
+
+
+const fatelf_isa_info *get_isa_by_name(const char *name)
+{
+    int i;
+    for (i = 0; i < (sizeof (isas) / sizeof (isas[0])); i++)
+    {
+        if (strcmp(isas[i].name, name) == 0)
+            return &isas[i];
+    } // for
+
+    return NULL;
+} // get_isa_by_name
+
+
+int fatelf_parse_isa_level(const char *str)
+{
+    const fatelf_isa_info *isa = get_isa_by_name(str);
+    char *endptr = NULL;
+    long num = 0;
+
+    if (isa != NULL)
+        return (int) isa->level;
+    else if (strcmp(str, "baseline") == 0)
+        return FATELF_ISA_BASELINE;
+    else if (strncmp(str, "isa", 3) != 0)
+        return -1;
+
+    str += 3;
+    num = strtol(str, &endptr, 0);
+    if ((endptr == str) || (*endptr != '\0') || (num < 0) || (num > 0xFF))
+        return -1;
+    return (int) num;
+} // fatelf_parse_isa_level
+
+
+static int parse_abi_version_string(const char *str)
+{
+    long num = 0;
+    char *endptr = NULL;
+    const char *prefix = "osabiver";
+    const size_t prefix_len = 8;
+    assert(strlen(prefix) == prefix_len);
+    if (strncmp(str, prefix, prefix_len) != 0)
+        return -1;
+
+    str += prefix_len;
+    num = strtol(str, &endptr, 0);
+    return ( ((endptr == str) || (*endptr != '\0')) ? -1 : ((int) num) );
+} // parse_abi_version_string
+
+
+static int find_fatelf_record_by_fields(const FATELF_header *header,
+                                        const char *target,
+                                        char *err, const size_t errlen)
+{
+    char *buf = xstrdup(target);
+    const fatelf_osabi_info *osabi = NULL;
+    const fatelf_machine_info *machine = NULL;
+    FATELF_record rec;
+    int wants = 0;
+    int abiver = 0;
+    int isalevel = 0;
+    int baseline = -1;
+    int ambiguous = 0;
+    int ambiguous_baseline = 0;
+    char *str = buf;
+    char *ptr = buf;
+    int retval = -1;
+    uint32_t lo = 0;
+    uint32_t hi = header->num_records;
+    int i = 0;
+
+    memset(&rec, '\0', sizeof (rec));
+
+    while (1)
+    {
+        const char ch = *ptr;
+        if ((ch == ':') || (ch == '\0'))
+        {
+            *ptr = '\0';
+
+            if (ptr == str)
+            {
+                // no-op for empty string.
+            } // if
+            else if ((strcmp(str,"be")==0) || (strcmp(str,"bigendian")==0))
+            {
+                wants |= FATELF_WANT_BYTEORDER;
+                rec.byte_order = FATELF_BIGENDIAN;
+            } // if
+            else if ((strcmp(str,"le")==0) || (strcmp(str,"littleendian")==0))
+            {
+                wants |= FATELF_WANT_BYTEORDER;
+                rec.byte_order = FATELF_LITTLEENDIAN;
+            } // else if
+            else if ((strcmp(str,"32bit")==0) || (strcmp(str,"32bits")==0))
+            {
+                wants |= FATELF_WANT_WORDSIZE;
+                rec.word_size = FATELF_32BITS;
+            } // else if
+            else if ((strcmp(str,"64bit")==0) || (strcmp(str,"64bits")==0))
+            {
+                wants |= FATELF_WANT_WORDSIZE;
+                rec.word_size = FATELF_64BITS;
+            } // else if
+            else if ((machine = get_machine_by_name(str)) != NULL)
+            {
+                wants |= FATELF_WANT_MACHINE;
+                rec.machine = machine->id;
+            } // else if
+            else if ((osabi = get_osabi_by_name(str)) != NULL)
+            {
+                wants |= FATELF_WANT_OSABI;
+                rec.osabi = osabi->id;
+            } // else if
+            else if ((abiver = parse_abi_version_string(str)) != -1)
+            {
+                wants |= FATELF_WANT_OSABIVER;
+                rec.osabi_version = (uint8_t) abiver;
+            } // else if
+            else if ((isalevel = fatelf_parse_isa_level(str)) != -1)
+            {
+                wants |= FATELF_WANT_ISALEVEL;
+                rec.isa_level = (uint8_t) isalevel;
+            } // else if
+            else
+            {
+                snprintf(err, errlen, "Unknown target '%s'", str);
+                free(buf);
+                return -2;
+            } // else
+
+            if (ch == '\0')
+                break;  // we're done.
+
+            str = ptr + 1;
+        } // if
+
+        ptr++;
+    } // while
+
+    free(buf);
+
+    // Sorted headers let us binary search on as many leading sort keys as
+    //  the target specifies, and only check the rest by hand.
+    if (header->version >= FATELF_FORMAT_VERSION_2)
+    {
+        int fields = 0;
+        while ((fields < RECORD_KEY_FIELDS) && (wants & record_key_wants[fields]))
+            fields++;
+        find_record_range(header, &rec, fields, &lo, &hi);
+    } // if
+
+    for (i = (int) lo; i < ((int) hi); i++)
+    {
+        const FATELF_record *prec = &header->records[i];
+        if ((wants & FATELF_WANT_MACHINE) && (rec.machine != prec->machine))
+            continue;
+        else if ((wants & FATELF_WANT_OSABI) && (rec.osabi != prec->osabi))
+            continue;
+        else if ((wants & FATELF_WANT_OSABIVER) && (rec.osabi_version != prec->osabi_version))
+            continue;
+        else if ((wants & FATELF_WANT_WORDSIZE) && (rec.word_size != prec->word_size))
+            continue;
+        else if ((wants & FATELF_WANT_BYTEORDER) && (rec.byte_order != prec->byte_order))
+            continue;
+        else if ((wants & FATELF_WANT_ISALEVEL) && (rec.isa_level != prec->isa_level))
+            continue;
+
+        if (prec->isa_level == FATELF_ISA_BASELINE)
+        {
+            if (baseline != -1)
+                ambiguous_baseline = 1;
+            baseline = i;
+        } // if
+
+        if (retval != -1)
+            ambiguous = 1;
+        retval = i;
+    } // for
+
+    // A target that doesn't name an ISA level means the baseline build, so
+    //  "x86_64" still works when there's an x86-64-v3 record, too.
+    if ((ambiguous) && (!(wants & FATELF_WANT_ISALEVEL)) && (baseline != -1))
+    {
+        ambiguous = ambiguous_baseline;
+        retval = baseline;
+    } // if
+
+    if (ambiguous)
+    {
+        snprintf(err, errlen, "Ambiguous target '%s'", target);
+        return -2;
+    } // if
+
+    return retval;
+} // find_fatelf_record_by_fields
+
+
+int fatelf_find_record(const FATELF_header *header, const char *target,
+                       char *err, const size_t errlen)
+{
+    if (strcmp(target, "host") == 0)
+        return fatelf_find_host_record(header);  // nothing here is just -1.
+
+    else if (strncmp(target, "record", 6) == 0)
+    {
+        char *endptr = NULL;
+        const long num = strtol(target+6, &endptr, 0);
+        if ((endptr != target+6) && (*endptr == '\0'))  // a numeric index?
+        {
+            const long recs = (long) header->num_records;
+            if ((num < 0) || (num >= recs))
+            {
+                snprintf(err, errlen, "No record #%ld in FatELF header (max %d)",
+                         num, (int) recs - 1);
+                return -2;
+            } // if
+            return (int) num;
+        } // if
+    } // if
+
+    return find_fatelf_record_by_fields(header, target, err, errlen);
+} // fatelf_find_record
+
+
+int xfind_fatelf_record(const FATELF_header *header, const char *target)
+{
+    char err[256];
+    const int retval = fatelf_find_record(header, target, err, sizeof (err));
+    if (retval == -2)
+        xfail("%s", err);
+    else if ((retval == -1) && (strcmp(target, "host") == 0))
+        xfail("No record in FatELF header can run on this machine");
+    return retval;
+} // xfind_fatelf_record
+
+
+int fatelf_get_host_record(FATELF_record *rec)
+{
+    memset(rec, '\0', sizeof (*rec));
+
+#if defined(__x86_64__) && !defined(__ILP32__)
+    rec->machine = 62;
+#elif defined(__i386__)
+    rec->machine = 3;
+#elif defined(__aarch64__)
+    rec->machine = 183;
+#elif defined(__arm__)
+    rec->machine = 40;
+#elif defined(__powerpc64__)
+    rec->machine = 21;
+#elif defined(__powerpc__)
+    rec->machine = 20;
+#elif defined(__s390x__)
+    rec->machine = 22;
+#elif defined(__riscv)
+    rec->machine = 243;
+#elif defined(__mips__)
+    rec->machine = 8;
+#else
+    return 0;
+#endif
+
+#if defined(__linux__)
+    rec->osabi = 3;
+#endif
+    rec->word_size = (sizeof (void *) == 8) ? FATELF_64BITS : FATELF_32BITS;
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+    rec->byte_order = FATELF_BIGENDIAN;
+#else
+    rec->byte_order = FATELF_LITTLEENDIAN;
+#endif
+    return 1;
+} // fatelf_get_host_record
+
+
+#if defined(__x86_64__) || defined(__i386__)
+static uint8_t get_x86_isa_level(void)
+{
+    unsigned int eax, ebx, ecx, edx;
+    unsigned int ecx1, ebx7 = 0, ecx81 = 0;
+    uint64_t xcr0 = 0;
+
+    if (!__get_cpuid(1, &eax, &ebx, &ecx1, &edx))
+        return FATELF_ISA_BASELINE;
+    if (__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+        ebx7 = ebx;
+    if (__get_cpuid(0x80000001, &eax, &ebx, &ecx, &edx))
+        ecx81 = ecx;
+
+    // The OS has to save the AVX registers, not just the CPU have them.
+    if (ecx1 & (1u << 27))  // OSXSAVE
+    {
+        unsigned int lo, hi;
+        __asm__ __volatile__ ("xgetbv" : "=a" (lo), "=d" (hi) : "c" (0));
+        xcr0 = (((uint64_t) hi) << 32) | lo;
+    } // if
+
+    #define HAS_BITS(reg, bits) (((reg) & (bits)) == (bits))
+
+    // SSE3, SSSE3, CMPXCHG16B, SSE4.1, SSE4.2, POPCNT; LAHF/SAHF.
+    if (!HAS_BITS(ecx1, (1u<<0) | (1u<<9) | (1u<<13) | (1u<<19) | (1u<<20) | (1u<<23)) ||
+        !HAS_BITS(ecx81, (1u<<0)))
+        return FATELF_ISA_BASELINE;
+
+    // FMA, MOVBE, AVX, F16C; BMI1, AVX2, BMI2; LZCNT; YMM state.
+    if (!HAS_BITS(ecx1, (1u<<12) | (1u<<22) | (1u<<28) | (1u<<29)) ||
+        !HAS_BITS(ebx7, (1u<<3) | (1u<<5) | (1u<<8)) ||
+        !HAS_BITS(ecx81, (1u<<5)) || !HAS_BITS(xcr0, 0x6))
+        return 2;
+
+    // AVX512F, DQ, CD, BW, VL; opmask and ZMM state.
+    if (!HAS_BITS(ebx7, (1u<<16) | (1u<<17) | (1u<<28) | (1u<<30) | (1u<<31)) ||
+        !HAS_BITS(xcr0, 0xE0))
+        return 3;
+
+    #undef HAS_BITS
+
+    return 4;
+} // get_x86_isa_level
+#endif
+
+
+#if defined(__aarch64__) && defined(__linux__)
+static uint8_t get_arm64_isa_level(void)
+{
+    const unsigned long hwcap = getauxval(AT_HWCAP);
+    const unsigned long hwcap2 = getauxval(AT_HWCAP2);
+
+    // These are the HWCAP_* and HWCAP2_* bits from asm/hwcap.h.
+    #define HAS_BITS(reg, bits) (((reg) & (bits)) == (bits))
+    if (!HAS_BITS(hwcap, (1ul<<8) | (1ul<<12)))  // ATOMICS, ASIMDRDM
+        return FATELF_ISA_BASELINE;
+    else if (!HAS_BITS(hwcap, (1ul<<16)))  // DCPOP
+        return 1;
+    else if (!HAS_BITS(hwcap, (1ul<<13) | (1ul<<14) | (1ul<<15)))  // JSCVT, FCMA, LRCPC
+        return 2;
+    else if (!HAS_BITS(hwcap, (1ul<<24) | (1ul<<25) | (1ul<<26) | (1ul<<27)))  // DIT, USCAT, ILRCPC, FLAGM
+        return 3;
+    else if (!HAS_BITS(hwcap, (1ul<<29)) || !HAS_BITS(hwcap2, (1ul<<7) | (1ul<<8)))  // SB; FLAGM2, FRINT
+        return 4;
+    #undef HAS_BITS
+    return 5;
+} // get_arm64_isa_level
+#endif
+
+
+uint8_t fatelf_get_host_isa_level(const uint16_t machine)
+{
+    const char *env = getenv("FATELF_HOST_ISA_LEVEL");
+    if ((env != NULL) && (*env != '\0'))
+    {
+        const int level = fatelf_parse_isa_level(env);
+        if (level != -1)
+            return (uint8_t) level;
+        return (uint8_t) strtol(env, NULL, 0);
+    } // if
+
+#if defined(__x86_64__) || defined(__i386__)
+    if (machine == 62)
+        return get_x86_isa_level();
+#elif defined(__aarch64__) && defined(__linux__)
+    if (machine == 183)
+        return get_arm64_isa_level();
+#endif
+
+    return FATELF_ISA_BASELINE;
+} // fatelf_get_host_isa_level
+
+
+int fatelf_find_host_record(const FATELF_header *header)
+{
+    FATELF_record host;
+    uint8_t hostlevel;
+    int retval = -1;
+    int bestscore = -1;
+    uint32_t i;
+
+    if (!fatelf_get_host_record(&host))
+        return -1;
+
+    hostlevel = fatelf_get_host_isa_level(host.machine);
+
+    for (i = 0; i < header->num_records; i++)
+    {
+        const FATELF_record *rec = &header->records[i];
+        int score;
+
+        if ((rec->machine != host.machine) || (rec->word_size != host.word_size))
+            continue;
+        else if (rec->byte_order != host.byte_order)
+            continue;
+        else if ((rec->osabi != host.osabi) && (rec->osabi != 0))
+            continue;
+        else if (rec->isa_level > hostlevel)
+            continue;  // this CPU can't run it.
+
+        score = (((int) rec->isa_level) << 1) | ((rec->osabi == host.osabi) ? 1 : 0);
+        if (score > bestscore)
+        {
+            bestscore = score;
+            retval = (int) i;
+        } // if
+    } // for
+
+    return retval;
+} // fatelf_find_host_record
+
+
+int fatelf_record_matches(const FATELF_record *a, const FATELF_record *b)
+{
+    return ( (a->machine == b->machine) &&
+             (a->osabi == b->osabi) &&
+             (a->osabi_version == b->osabi_version) &&
+             (a->word_size == b->word_size) &&
+             (a->byte_order == b->byte_order) &&
+             (a->isa_level == b->isa_level) );
+} // fatelf_record_matches
+
+
+int find_furthest_record(const FATELF_header *header)
+{
+    // there's nothing that says the records have to be in order, although
+    //  we probably _should_. Just in case, check them all.
+    const int total = (int) header->num_records;
+    uint64_t furthest = 0;
+    int retval = -1;
+    int i;
+
+    for (i = 0; i < total; i++)
+    {
+        const FATELF_record *rec = &header->records[i];
+        const uint64_t edge = rec->offset + rec->size;
+        if (edge > furthest)
+        {
+            retval = i;
+            furthest = edge;
+        } // if
+    } // for
+
+    return retval;
+} // find_furthest_record
+
+
+const char *fatelf_get_wordsize_string(const uint8_t wordsize)
+{
+    if (wordsize == FATELF_32BITS)
+        return "32";
+    else if (wordsize == FATELF_64BITS)
+        return "64";
+    return "???";
+} // fatelf_get_wordsize_string
+
+
+const char *fatelf_get_byteorder_name(const uint8_t byteorder)
+{
+    if (byteorder == FATELF_LITTLEENDIAN)
+        return "Littleendian";
+    else if (byteorder == FATELF_BIGENDIAN)
+        return "Bigendian";
+    return "???";
+} // get_byteorder_name
+
+
+const char *fatelf_get_byteorder_target_name(const uint8_t byteorder)
+{
+    if (byteorder == FATELF_LITTLEENDIAN)
+        return "le";
+    else if (byteorder == FATELF_BIGENDIAN)
+        return "be";
+    return NULL;
+} // fatelf_get_byteorder_target_name
+
+
+const char *fatelf_get_wordsize_target_name(const uint8_t wordsize)
+{
+    if (wordsize == FATELF_32BITS)
+        return "32bits";
+    else if (wordsize == FATELF_64BITS)
+        return "64bits";
+    return NULL;
+} // fatelf_get_wordsize_target_name
+
+
+
+const char *fatelf_get_target_name(const FATELF_record *rec, const int wants)
+{
+    // !!! FIXME: this code is sort of stinky.
+    static char buffer[128];
+    const fatelf_osabi_info *osabi = get_osabi_by_id(rec->osabi);
+    const fatelf_machine_info *machine = get_machine_by_id(rec->machine);
+    const char *order = fatelf_get_byteorder_target_name(rec->byte_order);
+    const char *wordsize = fatelf_get_wordsize_target_name(rec->word_size);
+
+    buffer[0] = '\0';
+
+    if ((wants & FATELF_WANT_MACHINE) && (machine))
+    {
+        if (buffer[0])
+            strcat(buffer, ":");
+        strcat(buffer, machine->name);
+    } // if
+
+    if ((wants & FATELF_WANT_WORDSIZE) && (wordsize))
+    {
+        if (buffer[0])
+            strcat(buffer, ":");
+        strcat(buffer, wordsize);
+    } // if
+
+    if ((wants & FATELF_WANT_BYTEORDER) && (order))
+    {
+        if (buffer[0])
+            strcat(buffer, ":");
+        strcat(buffer, order);
+    } // if
+
+    if ((wants & FATELF_WANT_OSABI) && (osabi))
+    {
+        if (buffer[0])
+            strcat(buffer, ":");
+        strcat(buffer, osabi->name);
+    } // if
+
+    if (wants & FATELF_WANT_OSABIVER)
+    {
+        char tmp[32];
+        if (buffer[0])
+            strcat(buffer, ":");
+        snprintf(tmp, sizeof (tmp), "osabiver%d", (int) rec->osabi_version);
+        strcat(buffer, tmp);
+    } // if
+
+    // Baseline records don't get this, so their names stay the same as ever.
+    if ((wants & FATELF_WANT_ISALEVEL) && (rec->isa_level != FATELF_ISA_BASELINE))
+    {
+        const fatelf_isa_info *isa = get_isa_by_level(rec->machine, rec->isa_level);
+        char tmp[32];
+        if (buffer[0])
+            strcat(buffer, ":");
+        if (isa)
+            strcat(buffer, isa->name);
+        else
+        {
+            snprintf(tmp, sizeof (tmp), "isa%d", (int) rec->isa_level);
+            strcat(buffer, tmp);
+        } // else
+    } // if
+
+    return buffer;
+} // fatelf_get_target_name
+
+
+int xfind_junk(const char *fname, const int fd, const FATELF_header *header,
+               uint64_t *offset, uint64_t *size)
+{
+    const int furthest = find_furthest_record(header);
+
+    if (furthest >= 0)  // presumably, we failed elsewhere, but oh well.
+    {
+        const uint64_t fsize = xget_file_size(fname, fd);
+        const FATELF_record *rec = &header->records[furthest];
+        const uint64_t edge = rec->offset + rec->size;
+        if (fsize > edge)
+        {
+            *offset = edge;
+            *size = fsize - edge;
+            return 1;
+        } // if
+    } // if
+
+    return 0;
+} // xfind_junk
+
+
+int fatelf_is_resource_trailer(const uint8_t *trailer)
+{
+    uint32_t magic = 0;
+    getui32((uint8_t *) trailer, &magic);
+    return (magic == FATELF_RESOURCE_MAGIC);
+} // fatelf_is_resource_trailer
+
+
+int fatelf_junk_has_resources(const int fd, const uint64_t offset,
+                              const uint64_t size)
+{
+    uint8_t buf[FATELF_RESOURCE_TRAILER_SIZE];
+    const uint64_t pos = offset + size - sizeof (buf);
+    ssize_t rc;
+
+    if (size < sizeof (buf))
+        return 0;
+
+    rc = pread(fd, buf, sizeof (buf), (off_t) pos);
+    stats_syscall(STAT_SYSCALL_PREAD, rc);
+    return ((rc == (ssize_t) sizeof (buf)) && fatelf_is_resource_trailer(buf));
+} // fatelf_junk_has_resources
+
+
+uint64_t fatelf_junk_padding(const uint64_t offset, const uint64_t outpos)
+{
+    // Resources are aligned within their page, so keep the whole junk
+    //  region at the same offset within a page as it was in the input.
+    const uint64_t align = FATELF_RESOURCE_MAX_ALIGN;
+    return ((offset % align) + align - (outpos % align)) % align;
+} // fatelf_junk_padding
+
+
+void xcopy_junk(const char *fname, const int fd,
+                const char *out, const int outfd,
+                const uint64_t offset, const uint64_t size)
+{
+    if (fatelf_junk_has_resources(fd, offset, size))
+    {
+        const off_t pos = lseek(outfd, 0, SEEK_CUR);
+        stats_syscall(STAT_SYSCALL_LSEEK, 0);
+        if (pos != -1)
+            xwrite_zeros(out, outfd, (size_t) fatelf_junk_padding(offset, (uint64_t) pos));
+    } // if
+
+    xcopyfile_range(fname, fd, out, outfd, offset, size);
+} // xcopy_junk
+
+
+void xappend_junk(const char *fname, const int fd,
+                  const char *out, const int outfd,
+                  const FATELF_header *header)
+{
+    uint64_t offset, size;
+    if (xfind_junk(fname, fd, header, &offset, &size))
+        xcopy_junk(fname, fd, out, outfd, offset, size);
+} // xappend_junk
+
+
+fatelf_writer *xfatelf_begin_writer(const char *fname, const int fd,
+                                    const uint32_t reserve)
+{
+    fatelf_writer *writer = (fatelf_writer *) xmalloc(sizeof (fatelf_writer));
+    const uint64_t first = align_to_page(FATELF_DISK_FORMAT_SIZE_V2(reserve));
+
+    // Reserve room for a version 2 header, which is the bigger one. The
+    //  first record's padding writes it.
+    writer->fname = fname;
+    writer->fd = fd;
+    writer->capacity = (uint32_t) ((first - FATELF_DISK_FORMAT_SIZE_V2(0)) / 24);
+    writer->offset = 0;
+    writer->junk = 0;
+    writer->names = NULL;
+    writer->header = (FATELF_header *) xmalloc(fatelf_header_size(1));
+    writer->header->magic = FATELF_MAGIC;
+    writer->header->version = FATELF_FORMAT_VERSION_1;  // unsorted for now.
+    writer->header->reserved0 = 0;
+    writer->header->num_records = 0;
+    writer->header->flags = 0;
+
+    xlseek(fname, fd, 0, SEEK_SET);
+    return writer;
+} // xfatelf_begin_writer
+
+
+// Make room for the next record, and pad to where it goes.
+static FATELF_record *begin_writer_record(fatelf_writer *writer,
+                                          const char *name)
+{
+    const uint32_t total = writer->header->num_records;
+    const uint64_t header_room = FATELF_DISK_FORMAT_SIZE_V2(writer->capacity);
+    const uint64_t binary_offset = align_to_page((total > 0) ? writer->offset : header_room);
+    FATELF_record *rec = NULL;
+
+    if (writer->junk)
+        xfail("'%s' can't come after the junk in '%s'.", name, writer->fname);
+    else if (total >= writer->capacity)
+        xfail("'%s' has room for %u records, so '%s' doesn't fit.", writer->fname, (unsigned int) writer->capacity, name);
+
+    writer->header = (FATELF_header *) realloc(writer->header, fatelf_header_size(total + 1));
+    writer->names = (char **) realloc(writer->names, sizeof (char *) * (total + 1));
+    if ((writer->header == NULL) || (writer->names == NULL))
+        xfail("Out of memory!");
+
+    // the first record's padding covers the room for the header.
+    xwrite_zeros(writer->fname, writer->fd, (size_t) (binary_offset - writer->offset));
+
+    writer->names[total] = xstrdup(name);
+    rec = &writer->header->records[total];
+    memset(rec, '\0', sizeof (FATELF_record));
+    rec->offset = binary_offset;
+    return rec;
+} // begin_writer_record
+
+
+// The record's data is in place; fill in the rest from its ELF header.
+static uint32_t end_writer_record(fatelf_writer *writer, const int isa)
+{
+    FATELF_header *header = writer->header;
+    const uint32_t idx = header->num_records;
+    FATELF_record *rec = &header->records[idx];
+    const uint64_t offset = rec->offset;
+    const uint64_t size = rec->size;
+    int other;
+
+    xread_elf_header(writer->fname, writer->fd, offset, rec);
+    if (isa >= 0)
+        rec->isa_level = (uint8_t) isa;
+    else
+        rec->isa_level = xread_elf_isa_level(writer->fname, writer->fd, offset);
+    rec->offset = offset;
+    rec->size = size;
+
+    if ((other = fatelf_find_matching_record(header, rec)) >= 0)
+        xfail("'%s' and '%s' are for the same target.", writer->names[other], writer->names[idx]);
+
+    header->num_records++;
+    writer->offset = offset + size;
+    xlseek(writer->fname, writer->fd, (off_t) writer->offset, SEEK_SET);
+    return idx;
+} // end_writer_record
+
+
+uint32_t xfatelf_write_record(fatelf_writer *writer, const char *name,
+                              const void *buf, const uint64_t size,
+                              const int isa)
+{
+    FATELF_record *rec = begin_writer_record(writer, name);
+    xwrite(writer->fname, writer->fd, buf, (size_t) size);
+    rec->size = size;
+    return end_writer_record(writer, isa);
+} // xfatelf_write_record
+
+
+uint32_t xfatelf_write_record_fd(fatelf_writer *writer, const char *name,
+                                 const int fd, const uint64_t offset,
+                                 const uint64_t size, const int isa)
+{
+    FATELF_record *rec = begin_writer_record(writer, name);
+
+    if (size != FATELF_WRITER_TO_EOF)
+    {
+        xcopyfile_range(name, fd, writer->fname, writer->fd, offset, size);
+        rec->size = size;
+    } // if
+    else
+    {
+        uint8_t *copybuf = get_copy_state()->copybuf;
+        ssize_t rc;
+        rec->size = 0;
+        while ( (rc = xread(name, fd, copybuf, COPYBUF_SIZE, 0)) > 0 )
+        {
+            xwrite(writer->fname, writer->fd, copybuf, (size_t) rc);
+            rec->size += (uint64_t) rc;
+        } // while
+    } // else
+
+    return end_writer_record(writer, isa);
+} // xfatelf_write_record_fd
+
+
+void xfatelf_write_junk(fatelf_writer *writer, const void *buf,
+                        const uint64_t size)
+{
+    const uint8_t *ptr = (const uint8_t *) buf;
+    uint64_t offset = writer->offset;
+    uint32_t magic = 0;
+
+    if (size >= FATELF_RESOURCE_TRAILER_SIZE)
+        getui32((uint8_t *) ptr + size - FATELF_RESOURCE_TRAILER_SIZE, &magic);
+    if (magic == FATELF_RESOURCE_MAGIC)
+        offset = align_to_page(offset);
+
+    xwrite_zeros(writer->fname, writer->fd, (size_t) (offset - writer->offset));
+    xwrite(writer->fname, writer->fd, buf, (size_t) size);
+    writer->offset = offset + size;
+    writer->junk = 1;
+} // xfatelf_write_junk
+
+
+void xfatelf_write_junk_fd(fatelf_writer *writer, const char *name,
+                           const int fd, const uint64_t offset,
+                           const uint64_t size)
+{
+    off_t pos;
+    xcopy_junk(name, fd, writer->fname, writer->fd, offset, size);
+    pos = lseek(writer->fd, 0, SEEK_CUR);
+    stats_syscall(STAT_SYSCALL_LSEEK, 0);
+    if (pos == -1)
+        xfail("Couldn't seek in '%s': %s", writer->fname, strerror(errno));
+    writer->offset = (uint64_t) pos;
+    writer->junk = 1;
+} // xfatelf_write_junk_fd
+
+
+void xfatelf_finish_writer(fatelf_writer *writer)
+{
+    FATELF_header *header = writer->header;
+    uint32_t i;
+
+    if (header->num_records == 0)
+        xfail("No records to write to '%s'.", writer->fname);
+
+    // The reserved room fits a version 2 header, and so a version 1 one.
+    header->version = fatelf_minimum_format_version(header);
+    assert(fatelf_disk_header_size(header->version, header->num_records) <= header->records[0].offset);
+    xwrite_fatelf_header(writer->fname, writer->fd, header);
+
+    for (i = 0; i < header->num_records; i++)
+        free(writer->names[i]);
+    free(writer->names);
+    free(header);
+    free(writer);
+} // xfatelf_finish_writer
+
+
+static int compare_resource_names(const void *a, const void *b)
+{
+    return strcmp(((const fatelf_resource *) a)->name,
+                  ((const fatelf_resource *) b)->name);
+} // compare_resource_names
+
+
+fatelf_resource_table *fatelf_read_resource_table(const int fd,
+                                                  const uint64_t filesize,
+                                                  const char **err)
+{
+    uint8_t trailer[FATELF_RESOURCE_TRAILER_SIZE];
+    fatelf_resource_table *table = NULL;
+    uint8_t *buf = NULL;
+    uint8_t *ptr = trailer;
+    uint32_t magic = 0;
+    uint16_t version = 0;
+    uint16_t reserved0 = 0;
+    uint32_t count = 0;
+    uint32_t reserved1 = 0;
+    uint64_t region_size = 0;
+    uint64_t table_offset = 0;
+    uint64_t entries_end = 0;
+    uint64_t names_len = 0;
+    char *names = NULL;
+    uint32_t i;
+
+    *err = NULL;
+    if (filesize < sizeof (trailer))
+        return NULL;  // no table; not an error.
+    else if (pread_all(fd, trailer, sizeof (trailer), filesize - sizeof (trailer)) == -1)
+    {
+        *err = "couldn't be read";
+        return NULL;
+    } // else if
+
+    ptr = getui32(ptr, &magic);
+    if (magic != FATELF_RESOURCE_MAGIC)
+        return NULL;  // no table; not an error.
+
+    ptr = getui16(ptr, &version);
+    ptr = getui16(ptr, &reserved0);
+    ptr = getui32(ptr, &count);
+    ptr = getui32(ptr, &reserved1);
+    ptr = getui64(ptr, &region_size);
+    ptr = getui64(ptr, &table_offset);
+
+    if (version != FATELF_RESOURCE_VERSION)
+    {
+        *err = "has an unknown resource table version";
+        return NULL;
+    } // if
+    else if ( (reserved0 != 0) || (reserved1 != 0) ||
+              (region_size > filesize) || (region_size < sizeof (trailer)) ||
+              (table_offset > region_size) ||
+              (count > ((region_size - table_offset) / FATELF_RESOURCE_ENTRY_SIZE)) )
+    {
+        *err = "has a corrupt resource table";
+        return NULL;
+    } // else if
+
+    entries_end = table_offset + (((uint64_t) count) * FATELF_RESOURCE_ENTRY_SIZE);
+    if ((entries_end + sizeof (trailer)) > region_size)
+    {
+        *err = "has a corrupt resource table";
+        return NULL;
+    } // if
+
+    names_len = region_size - sizeof (trailer) - entries_end;
+    table = (fatelf_resource_table *) xmalloc(sizeof (fatelf_resource_table) +
+                                              (sizeof (fatelf_resource) * count) +
+                                              (size_t) names_len + 1);
+    table->region_offset = filesize - region_size;
+    table->region_size = region_size;
+    table->table_offset = table_offset;
+    table->num_resources = count;
+    table->resources = (fatelf_resource *) (table + 1);
+    names = (char *) (table->resources + count);
+    names[names_len] = '\0';
+
+    buf = (uint8_t *) xmalloc((size_t) (entries_end - table_offset) + 1);
+    if ( (pread_all(fd, buf, (size_t) (entries_end - table_offset), table->region_offset + table_offset) == -1) ||
+         (pread_all(fd, names, (size_t) names_len, table->region_offset + entries_end) == -1) )
+    {
+        free(buf);
+        free(table);
+        *err = "couldn't be read";
+        return NULL;
+    } // if
+
+    ptr = buf;
+    for (i = 0; i < count; i++)
+    {
+        fatelf_resource *res = &table->resources[i];
+        uint32_t name_offset = 0;
+        uint16_t name_length = 0;
+        uint8_t align_log2 = 0;
+        uint64_t reserved = 0;
+
+        ptr = getui64(ptr, &res->offset);
+        ptr = getui64(ptr, &res->size);
+        ptr = getui32(ptr, &name_offset);
+        ptr = getui16(ptr, &name_length);
+        ptr = getui8(ptr, &align_log2);
+        ptr = getui8(ptr, &res->hash_type);
+        memcpy(res->hash, ptr, sizeof (res->hash));
+        ptr += sizeof (res->hash);
+        ptr = getui64(ptr, &reserved);
+
+        res->name = names + name_offset;
+        res->alignment = ((uint32_t) 1) << (align_log2 & 31);
+
+        if ( (((uint64_t) name_offset) + name_length >= names_len) ||
+             (strlen(res->name) != name_length) || (name_length == 0) ||
+             (res->alignment > FATELF_RESOURCE_MAX_ALIGN) ||
+             (res->hash_type > FATELF_RESOURCE_HASH_SHA256) || (reserved != 0) ||
+             (res->offset > table_offset) || (res->size > (table_offset - res->offset)) ||
+             ((i > 0) && (strcmp(res[-1].name, res->name) >= 0)) )
+        {
+            free(buf);
+            free(table);
+            *err = "has a corrupt resource table";
+            return NULL;
+        } // if
+    } // for
+
+    free(buf);
+    return table;
+} // fatelf_read_resource_table
+
+
+uint8_t *fatelf_encode_resource_table(const fatelf_resource_table *table,
+                                      size_t *len)
+{
+    const uint32_t count = table->num_resources;
+    fatelf_resource *sorted = (fatelf_resource *) xmalloc(sizeof (fatelf_resource) * (count ? count : 1));
+    size_t names_len = 0;
+    size_t buflen = 0;
+    uint32_t name_offset = 0;
+    uint8_t *buf = NULL;
+    uint8_t *ptr = NULL;
+    uint32_t i;
+
+    // Entries are sorted by name on disk, so readers can binary search.
+    memcpy(sorted, table->resources, sizeof (fatelf_resource) * count);
+    qsort(sorted, count, sizeof (fatelf_resource), compare_resource_names);
+
+    for (i = 0; i < count; i++)
+        names_len += strlen(sorted[i].name) + 1;
+
+    buflen = (FATELF_RESOURCE_ENTRY_SIZE * count) + names_len + FATELF_RESOURCE_TRAILER_SIZE;
+    buf = (uint8_t *) xmalloc(buflen);
+    ptr = buf;
+
+    for (i = 0; i < count; i++)
+    {
+        const fatelf_resource *res = &sorted[i];
+        uint8_t align_log2 = 0;
+        while ((((uint32_t) 1) << align_log2) < res->alignment)
+            align_log2++;
+
+        assert((i == 0) || (strcmp(sorted[i-1].name, res->name) != 0));
+        ptr = putui64(ptr, res->offset);
+        ptr = putui64(ptr, res->size);
+        ptr = putui32(ptr, name_offset);
+        ptr = putui16(ptr, (uint16_t) strlen(res->name));
+        ptr = putui8(ptr, align_log2);
+        ptr = putui8(ptr, res->hash_type);
+        memcpy(ptr, res->hash, sizeof (res->hash));
+        ptr += sizeof (res->hash);
+        ptr = putui64(ptr, 0);
+        name_offset += (uint32_t) strlen(res->name) + 1;
+    } // for
+
+    for (i = 0; i < count; i++)
+    {
+        const size_t namelen = strlen(sorted[i].name) + 1;
+        memcpy(ptr, sorted[i].name, namelen);
+        ptr += namelen;
+    } // for
+
+    ptr = putui32(ptr, FATELF_RESOURCE_MAGIC);
+    ptr = putui16(ptr, FATELF_RESOURCE_VERSION);
+    ptr = putui16(ptr, 0);
+    ptr = putui32(ptr, count);
+    ptr = putui32(ptr, 0);
+    ptr = putui64(ptr, table->table_offset + buflen);
+    ptr = putui64(ptr, table->table_offset);
+
+    assert(ptr == (buf + buflen));
+    free(sorted);
+
+    *len = buflen;
+    return buf;
+} // fatelf_encode_resource_table
+
+
+const fatelf_resource *fatelf_find_resource(const fatelf_resource_table *table,
+                                            const char *name)
+{
+    fatelf_resource key;
+    memset(&key, '\0', sizeof (key));
+    key.name = name;
+    return (const fatelf_resource *) bsearch(&key, table->resources,
+                        table->num_resources, sizeof (fatelf_resource),
+                        compare_resource_names);
+} // fatelf_find_resource
+
+
+const void *fatelf_map_resource(const int fd, const char *name,
+                                const int verify, uint64_t *size,
+                                const char **err)
+{
+    static const uint8_t empty = 0;
+    const uint64_t pagesize = (uint64_t) sysconf(_SC_PAGESIZE);
+    fatelf_resource_table *table = NULL;
+    const fatelf_resource *res = NULL;
+    struct stat statbuf;
+    uint64_t offset, delta;
+    uint8_t *base = NULL;
+    const uint8_t *retval = NULL;
+
+    if (fstat(fd, &statbuf) == -1)
+    {
+        *err = "couldn't be read";
+        return NULL;
+    } // if
+
+    table = fatelf_read_resource_table(fd, (uint64_t) statbuf.st_size, err);
+    if (table == NULL)
+    {
+        if (*err == NULL)
+            *err = "has no resources";
+        return NULL;
+    } // if
+    else if ((res = fatelf_find_resource(table, name)) == NULL)
+    {
+        free(table);
+        *err = "has no resource with that name";
+        return NULL;
+    } // else if
+
+    *size = res->size;
+    if (res->size == 0)
+    {
+        free(table);
+        return &empty;
+    } // if
+
+    // mmap() wants a page-aligned offset; map from the start of the page.
+    offset = table->region_offset + res->offset;
+    delta = offset % pagesize;
+    base = (uint8_t *) mmap(NULL, (size_t) (res->size + delta), PROT_READ,
+                            MAP_SHARED, fd, (off_t) (offset - delta));
+    if (base == MAP_FAILED)
+    {
+        free(table);
+        *err = "couldn't be mapped";
+        return NULL;
+    } // if
+
+    retval = base + delta;
+    if ((verify) && (res->hash_type == FATELF_RESOURCE_HASH_SHA256))
+    {
+        uint8_t digest[FATELF_SHA256_SIZE];
+        fatelf_sha256 ctx;
+        fatelf_sha256_init(&ctx);
+        fatelf_sha256_update(&ctx, retval, (size_t) res->size);
+        fatelf_sha256_final(&ctx, digest);
+        if (memcmp(digest, res->hash, sizeof (digest)) != 0)
+        {
+            munmap(base, (size_t) (res->size + delta));
+            free(table);
+            *err = "has a resource that failed its hash check";
+            return NULL;
+        } // if
+    } // if
+
+    free(table);
+    return retval;
+} // fatelf_map_resource
+
+
+void fatelf_unmap_resource(const void *ptr, const uint64_t size)
+{
+    const uintptr_t pagesize = (uintptr_t) sysconf(_SC_PAGESIZE);
+    const uintptr_t delta = ((uintptr_t) ptr) % pagesize;
+    if (size > 0)
+        munmap((void *) (((uintptr_t) ptr) - delta), (size_t) (size + delta));
+} // fatelf_unmap_resource
+
+
+#define FATELF_PT_NOTE 4
+#define FATELF_NT_GNU_BUILD_ID 3
+
+// Walk the notes in one PT_NOTE segment or SHT_NOTE section for a build-id.
+static int find_build_id_note(const fatelf_elf_header *hdr,
+                              const uint8_t *data, const uint64_t len,
+                              const uint64_t align, uint8_t *id,
+                              size_t *idlen)
+{
+    const uint8_t bo = hdr->byte_order;
+    uint64_t pos = 0;
+
+    #define ALIGN_UP(x, a) (((x) + ((a) - 1)) & ~((uint64_t) ((a) - 1)))
+
+    while ((pos + 12) <= len)
+    {
+        const uint32_t namesz = elf32(bo, data + pos);
+        const uint32_t descsz = elf32(bo, data + pos + 4);
+        const uint32_t type = elf32(bo, data + pos + 8);
+        const uint64_t descpos = ALIGN_UP(pos + 12 + namesz, align);
+        const uint64_t next = ALIGN_UP(descpos + descsz, align);
+
+        if ((descpos > len) || (next > len) || (next <= pos))
+            break;  // truncated or bogus; just stop looking.
+
+        if ( (type == FATELF_NT_GNU_BUILD_ID) && (namesz == 4) &&
+             (memcmp(data + pos + 12, "GNU", 4) == 0) &&
+             (descsz > 0) && (descsz <= FATELF_BUILD_ID_MAX) )
+        {
+            memcpy(id, data + descpos, descsz);
+            *idlen = descsz;
+            return 1;
+        } // if
+
+        pos = next;
+    } // while
+
+    #undef ALIGN_UP
+
+    return 0;
+} // find_build_id_note
+
+
+const char *fatelf_read_build_id(const int fd, const uint64_t offset,
+                                 const uint64_t size, uint8_t *id,
+                                 size_t *idlen)
+{
+    uint8_t buf[64];
+    fatelf_elf_header hdr;
+    const char *err = NULL;
+    uint8_t *table = NULL;
+    uint64_t tablelen = 0;
+    int found = 0;
+    int pass, i;
+
+    *idlen = 0;
+    if (size < FATELF_ELF_EHDR_SIZE(FATELF_32BITS))
+        return "is not an ELF binary";
+    else if (pread_all(fd, buf, (size_t) minui64(size, sizeof (buf)), offset) == -1)
+        return "couldn't be read";
+    else if ((err = fatelf_elf_decode_header(buf, (size_t) minui64(size, sizeof (buf)), &hdr)) != NULL)
+        return err;
+
+    // Program headers first: that's what's mapped, so it's what a core dump
+    //  has. Objects and some debug files only have sections.
+    for (pass = 0; (pass < 2) && (!found); pass++)
+    {
+        const uint64_t tableoff = pass ? hdr.shoff : hdr.phoff;
+        const uint16_t count = pass ? hdr.shnum : hdr.phnum;
+        const uint16_t entsize = pass ? hdr.shentsize : hdr.phentsize;
+        const uint16_t minsize = pass ? FATELF_ELF_SHDR_SIZE(hdr.word_size) : ((hdr.word_size == FATELF_32BITS) ? 32 : 56);
+
+        if ((count == 0) || (entsize < minsize))
+            continue;
+
+        tablelen = ((uint64_t) count) * entsize;
+        if ((tableoff > size) || (tablelen > (size - tableoff)))
+            return "has bogus ELF headers";
+        else if ((table = (uint8_t *) malloc((size_t) tablelen)) == NULL)
+            return "is too big to read";
+        else if (pread_all(fd, table, (size_t) tablelen, offset + tableoff) == -1)
+        {
+            free(table);
+            return "couldn't be read";
+        } // else if
+
+        for (i = 0; (i < count) && (!found); i++)
+        {
+            const uint8_t *ptr = table + (((uint64_t) i) * entsize);
+            uint64_t noteoff, notelen, align;
+            uint8_t *data = NULL;
+
+            if (pass == 0)
             {
-                wants |= FATELF_WANT_OSABIVER;
-                rec.osabi_version = (uint8_t) abiver;
-            } // else if
+                if (elf32(hdr.byte_order, ptr) != FATELF_PT_NOTE)
+                    continue;
+                else if (hdr.word_size == FATELF_32BITS)
+                {
+                    noteoff = elf32(hdr.byte_order, ptr + 4);
+                    notelen = elf32(hdr.byte_order, ptr + 16);
+                    align = elf32(hdr.byte_order, ptr + 28);
+                } // else if
+                else
+                {
+                    noteoff = elf64(hdr.byte_order, ptr + 8);
+                    notelen = elf64(hdr.byte_order, ptr + 32);
+                    align = elf64(hdr.byte_order, ptr + 48);
+                } // else
+            } // if
             else
             {
-                xfail("Unknown target '%s'", str);
+                fatelf_elf_section sec;
+                fatelf_elf_decode_section(&hdr, ptr, &sec);
+                if (sec.type != FATELF_SHT_NOTE)
+                    continue;
+                noteoff = sec.offset;
+                notelen = sec.size;
+                align = sec.addralign;
             } // else
 
-            if (ch == '\0')
-                break;  // we're done.
+            if ((notelen == 0) || (notelen > 0x100000) || (noteoff > size) || (notelen > (size - noteoff)))
+                continue;
+            else if ((data = (uint8_t *) malloc((size_t) notelen)) == NULL)
+                continue;
+            else if (pread_all(fd, data, (size_t) notelen, offset + noteoff) == 0)
+                found = find_build_id_note(&hdr, data, notelen, (align == 8) ? 8 : 4, id, idlen);
+            free(data);
+        } // for
+
+        free(table);
+    } // for
+
+    return NULL;
+} // fatelf_read_build_id
+
+
+// Encode an index entry: the build-id, zero padded, then the rest.
+void fatelf_encode_build_id_entry(const fatelf_build_id_entry *entry,
+                                  uint8_t *buf)
+{
+    uint8_t *ptr = buf;
+    memset(buf, '\0', FATELF_BUILD_ID_ENTRY_SIZE);
+    memcpy(ptr, entry->id, entry->id_len);
+    ptr += FATELF_BUILD_ID_MAX;
+    ptr = putui8(ptr, entry->id_len);
+    ptr = putui8(ptr, entry->rec.word_size);
+    ptr = putui8(ptr, entry->rec.byte_order);
+    ptr = putui8(ptr, entry->rec.osabi);
+    ptr = putui8(ptr, entry->rec.osabi_version);
+    ptr = putui8(ptr, entry->rec.isa_level);
+    ptr = putui16(ptr, entry->rec.machine);
+    ptr = putui32(ptr, entry->file);
+    ptr = putui32(ptr, entry->record);
+    ptr = putui64(ptr, entry->rec.offset);
+    ptr = putui64(ptr, entry->rec.size);
+    assert(ptr == buf + FATELF_BUILD_ID_ENTRY_SIZE);
+} // fatelf_encode_build_id_entry
+
+
+void fatelf_encode_build_id_file(const fatelf_build_id_file *file,
+                                 const uint64_t path_offset, uint8_t *buf)
+{
+    uint8_t *ptr = buf;
+    ptr = putui64(ptr, path_offset);
+    ptr = putui64(ptr, (uint64_t) file->mtime_sec);
+    ptr = putui32(ptr, file->mtime_nsec);
+    ptr = putui32(ptr, 0);  // reserved
+    ptr = putui64(ptr, file->size);
+    assert(ptr == buf + FATELF_BUILD_ID_FILE_SIZE);
+} // fatelf_encode_build_id_file
+
+
+uint8_t *fatelf_encode_build_id_index_header(const uint32_t num_entries,
+                                             const uint32_t num_files,
+                                             const uint64_t strings_size,
+                                             uint8_t *buf)
+{
+    const uint64_t entries_offset = FATELF_BUILD_ID_HEADER_SIZE;
+    const uint64_t files_offset = entries_offset + (((uint64_t) num_entries) * FATELF_BUILD_ID_ENTRY_SIZE);
+    const uint64_t strings_offset = files_offset + (((uint64_t) num_files) * FATELF_BUILD_ID_FILE_SIZE);
+    uint8_t *ptr = buf;
+
+    memset(buf, '\0', FATELF_BUILD_ID_HEADER_SIZE);
+    memcpy(ptr, FATELF_BUILD_ID_MAGIC, 8);
+    ptr += 8;
+    ptr = putui32(ptr, FATELF_BUILD_ID_VERSION);
+    ptr = putui32(ptr, num_entries);
+    ptr = putui32(ptr, num_files);
+    ptr = putui32(ptr, 0);  // reserved
+    ptr = putui64(ptr, entries_offset);
+    ptr = putui64(ptr, files_offset);
+    ptr = putui64(ptr, strings_offset);
+    ptr = putui64(ptr, strings_size);
+    return buf;
+} // fatelf_encode_build_id_index_header
+
+
+fatelf_build_id_index *fatelf_open_build_id_index(const char *fname,
+                                                  const char **err)
+{
+    const int fd = open(fname, O_RDONLY | O_CLOEXEC);
+    fatelf_build_id_index *index = NULL;
+    uint64_t entries_offset, files_offset, strings_offset;
+    uint32_t version = 0, reserved = 0;
+    struct stat statbuf;
+    uint8_t *ptr = NULL;
+    void *map = NULL;
+
+    *err = NULL;
+    if (fd == -1)
+    {
+        *err = strerror(errno);
+        return NULL;
+    } // if
+    else if (fstat(fd, &statbuf) == -1)
+    {
+        *err = strerror(errno);
+        close(fd);
+        return NULL;
+    } // else if
+    else if (statbuf.st_size < FATELF_BUILD_ID_HEADER_SIZE)
+    {
+        close(fd);
+        *err = "is not a build-id index";
+        return NULL;
+    } // else if
+
+    map = mmap(NULL, (size_t) statbuf.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);  // the mapping stays.
+    if (map == MAP_FAILED)
+    {
+        *err = strerror(errno);
+        return NULL;
+    } // if
+
+    index = (fatelf_build_id_index *) malloc(sizeof (fatelf_build_id_index));
+    if (index == NULL)
+    {
+        munmap(map, (size_t) statbuf.st_size);
+        *err = "Out of memory";
+        return NULL;
+    } // if
+
+    index->map = (const uint8_t *) map;
+    index->map_size = (uint64_t) statbuf.st_size;
+
+    ptr = (uint8_t *) index->map;
+    if (memcmp(ptr, FATELF_BUILD_ID_MAGIC, 8) != 0)
+        *err = "is not a build-id index";
+    else
+    {
+        ptr += 8;
+        ptr = getui32(ptr, &version);
+        ptr = getui32(ptr, &index->num_entries);
+        ptr = getui32(ptr, &index->num_files);
+        ptr = getui32(ptr, &reserved);
+        ptr = getui64(ptr, &entries_offset);
+        ptr = getui64(ptr, &files_offset);
+        ptr = getui64(ptr, &strings_offset);
+        ptr = getui64(ptr, &index->strings_size);
+
+        // Check the layout once, so lookups don't have to.
+        if (version != FATELF_BUILD_ID_VERSION)
+            *err = "is an unsupported build-id index version";
+        else if ( (entries_offset != FATELF_BUILD_ID_HEADER_SIZE) ||
+                  (files_offset != entries_offset + (((uint64_t) index->num_entries) * FATELF_BUILD_ID_ENTRY_SIZE)) ||
+                  (strings_offset != files_offset + (((uint64_t) index->num_files) * FATELF_BUILD_ID_FILE_SIZE)) ||
+                  (strings_offset > index->map_size) ||
+                  (index->strings_size != (index->map_size - strings_offset)) ||
+                  ((index->strings_size > 0) && (index->map[index->map_size - 1] != '\0')) )
+            *err = "is a corrupt build-id index";
+    } // else
+
+    if (*err != NULL)
+    {
+        munmap(map, (size_t) index->map_size);
+        free(index);
+        return NULL;
+    } // if
+
+    index->entries = index->map + entries_offset;
+    index->files = index->map + files_offset;
+    index->strings = (const char *) (index->map + strings_offset);
+    return index;
+} // fatelf_open_build_id_index
+
+
+void fatelf_close_build_id_index(fatelf_build_id_index *index)
+{
+    if (index != NULL)
+    {
+        munmap((void *) index->map, (size_t) index->map_size);
+        free(index);
+    } // if
+} // fatelf_close_build_id_index
+
+
+void fatelf_get_build_id_entry(const fatelf_build_id_index *index,
+                               const uint32_t idx,
+                               fatelf_build_id_entry *entry)
+{
+    uint8_t *ptr = (uint8_t *) (index->entries + (((uint64_t) idx) * FATELF_BUILD_ID_ENTRY_SIZE));
+    memset(entry, '\0', sizeof (*entry));
+    memcpy(entry->id, ptr, FATELF_BUILD_ID_MAX);
+    ptr += FATELF_BUILD_ID_MAX;
+    ptr = getui8(ptr, &entry->id_len);
+    ptr = getui8(ptr, &entry->rec.word_size);
+    ptr = getui8(ptr, &entry->rec.byte_order);
+    ptr = getui8(ptr, &entry->rec.osabi);
+    ptr = getui8(ptr, &entry->rec.osabi_version);
+    ptr = getui8(ptr, &entry->rec.isa_level);
+    ptr = getui16(ptr, &entry->rec.machine);
+    ptr = getui32(ptr, &entry->file);
+    ptr = getui32(ptr, &entry->record);
+    ptr = getui64(ptr, &entry->rec.offset);
+    ptr = getui64(ptr, &entry->rec.size);
+    if (entry->id_len > FATELF_BUILD_ID_MAX)
+        entry->id_len = FATELF_BUILD_ID_MAX;
+} // fatelf_get_build_id_entry
+
+
+int fatelf_get_build_id_file(const fatelf_build_id_index *index,
+                             const uint32_t idx, fatelf_build_id_file *file)
+{
+    uint8_t *ptr = (uint8_t *) (index->files + (((uint64_t) idx) * FATELF_BUILD_ID_FILE_SIZE));
+    uint64_t path_offset, mtime_sec;
+    uint32_t reserved;
+
+    if (idx >= index->num_files)
+        return 0;
+
+    ptr = getui64(ptr, &path_offset);
+    ptr = getui64(ptr, &mtime_sec);
+    ptr = getui32(ptr, &file->mtime_nsec);
+    ptr = getui32(ptr, &reserved);
+    ptr = getui64(ptr, &file->size);
+    file->mtime_sec = (int64_t) mtime_sec;
+
+    if (path_offset >= index->strings_size)
+        return 0;  // the last string is null-terminated, so this is enough.
+    file->path = index->strings + path_offset;
+    return 1;
+} // fatelf_get_build_id_file
+
+
+// Entries sort by their zero-padded build-id, then its length.
+static int compare_build_id_key(const uint8_t *entry, const uint8_t *key,
+                                const uint8_t keylen)
+{
+    const int rc = memcmp(entry, key, FATELF_BUILD_ID_MAX);
+    if (rc != 0)
+        return rc;
+    return ((int) entry[FATELF_BUILD_ID_MAX]) - ((int) keylen);
+} // compare_build_id_key
+
+
+int fatelf_compare_build_id_entries(const fatelf_build_id_entry *a,
+                                    const fatelf_build_id_entry *b)
+{
+    const int rc = memcmp(a->id, b->id, FATELF_BUILD_ID_MAX);
+    if (rc != 0)
+        return rc;
+    return ((int) a->id_len) - ((int) b->id_len);
+} // fatelf_compare_build_id_entries
+
+
+uint32_t fatelf_lookup_build_id(const fatelf_build_id_index *index,
+                                const uint8_t *id, const size_t idlen,
+                                uint32_t *first)
+{
+    uint8_t key[FATELF_BUILD_ID_MAX];
+    uint32_t lo = 0, hi = index->num_entries;
+    uint32_t end;
+
+    *first = 0;
+    if ((idlen == 0) || (idlen > FATELF_BUILD_ID_MAX))
+        return 0;
+
+    memset(key, '\0', sizeof (key));
+    memcpy(key, id, idlen);
+
+    // Find the first entry that isn't less than the key...
+    while (lo < hi)
+    {
+        const uint32_t mid = lo + ((hi - lo) / 2);
+        const uint8_t *entry = index->entries + (((uint64_t) mid) * FATELF_BUILD_ID_ENTRY_SIZE);
+        if (compare_build_id_key(entry, key, (uint8_t) idlen) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    } // while
+
+    // ...then count the ones that match; there's usually just one.
+    for (end = lo; end < index->num_entries; end++)
+    {
+        const uint8_t *entry = index->entries + (((uint64_t) end) * FATELF_BUILD_ID_ENTRY_SIZE);
+        if (compare_build_id_key(entry, key, (uint8_t) idlen) != 0)
+            break;
+    } // for
+
+    *first = lo;
+    return end - lo;
+} // fatelf_lookup_build_id
+
+
+int fatelf_cpu_count(void)
+{
+    const long rc = sysconf(_SC_NPROCESSORS_ONLN);
+    return (rc < 1) ? 1 : (int) rc;
+} // fatelf_cpu_count
+
+
+typedef struct parallel_for_state
+{
+    void (*fn)(void *data, const int idx);
+    void *data;
+    int count;
+    int next;  // atomically incremented by the workers.
+} parallel_for_state;
+
+
+static void *parallel_for_worker(void *_state)
+{
+    parallel_for_state *state = (parallel_for_state *) _state;
+    int idx;
+    while ((idx = __sync_fetch_and_add(&state->next, 1)) < state->count)
+        state->fn(state->data, idx);
+    return NULL;
+} // parallel_for_worker
+
+
+void fatelf_parallel_for(const int count, int threads,
+                         void (*fn)(void *data, const int idx), void *data)
+{
+    parallel_for_state state;
+    pthread_t *workers = NULL;
+    int i;
+
+    if (threads <= 0)
+        threads = fatelf_cpu_count();
+    if (threads > count)
+        threads = count;
+
+    state.fn = fn;
+    state.data = data;
+    state.count = count;
+    state.next = 0;
+
+    if (threads <= 1)  // don't bother spinning up threads.
+    {
+        parallel_for_worker(&state);
+        return;
+    } // if
+
+    // the calling thread is a worker too, so spin up one less.
+    workers = (pthread_t *) xmalloc(sizeof (pthread_t) * threads);
+    for (i = 1; i < threads; i++)
+    {
+        const int rc = pthread_create(&workers[i], NULL,
+                                      parallel_for_worker, &state);
+        if (rc != 0)
+            xfail("Failed to create thread: %s", strerror(rc));
+    } // for
+
+    parallel_for_worker(&state);
+
+    for (i = 1; i < threads; i++)
+        pthread_join(workers[i], NULL);
+    free(workers);
+} // fatelf_parallel_for
+
+
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+    0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+    0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+    0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+    0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static void sha256_block(fatelf_sha256 *ctx, const uint8_t *block)
+{
+    #define ROR32(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+    uint32_t w[64];
+    uint32_t a, b, c, d, e, f, g, h;
+    int i;
+
+    for (i = 0; i < 16; i++)
+    {
+        w[i] = (((uint32_t) block[i*4]) << 24) | (((uint32_t) block[i*4+1]) << 16) |
+               (((uint32_t) block[i*4+2]) << 8) | ((uint32_t) block[i*4+3]);
+    } // for
+
+    for (i = 16; i < 64; i++)
+    {
+        const uint32_t s0 = ROR32(w[i-15], 7) ^ ROR32(w[i-15], 18) ^ (w[i-15] >> 3);
+        const uint32_t s1 = ROR32(w[i-2], 17) ^ ROR32(w[i-2], 19) ^ (w[i-2] >> 10);
+        w[i] = w[i-16] + s0 + w[i-7] + s1;
+    } // for
+
+    a = ctx->state[0]; b = ctx->state[1]; c = ctx->state[2]; d = ctx->state[3];
+    e = ctx->state[4]; f = ctx->state[5]; g = ctx->state[6]; h = ctx->state[7];
 
-            str = ptr + 1;
-        } // if
+    for (i = 0; i < 64; i++)
+    {
+        const uint32_t s1 = ROR32(e, 6) ^ ROR32(e, 11) ^ ROR32(e, 25);
+        const uint32_t ch = (e & f) ^ ((~e) & g);
+        const uint32_t t1 = h + s1 + ch + sha256_k[i] + w[i];
+        const uint32_t s0 = ROR32(a, 2) ^ ROR32(a, 13) ^ ROR32(a, 22);
+        const uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+        const uint32_t t2 = s0 + maj;
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    } // for
 
-        ptr++;
-    } // while
+    ctx->state[0] += a; ctx->state[1] += b; ctx->state[2] += c; ctx->state[3] += d;
+    ctx->state[4] += e; ctx->state[5] += f; ctx->state[6] += g; ctx->state[7] += h;
+    #undef ROR32
+} // sha256_block
 
-    free(buf);
 
-    for (i = 0; i < ((int) header->num_records); i++)
+static void sha256_blocks_portable(fatelf_sha256 *ctx, const uint8_t *data,
+                                   size_t count)
+{
+    while (count--)
     {
-        const FATELF_record *prec = &header->records[i];
-        if ((wants & FATELF_WANT_MACHINE) && (rec.machine != prec->machine))
-            continue;
-        else if ((wants & FATELF_WANT_OSABI) && (rec.osabi != prec->osabi))
-            continue;
-        else if ((wants & FATELF_WANT_OSABIVER) && (rec.osabi_version != prec->osabi_version))
-            continue;
-        else if ((wants & FATELF_WANT_WORDSIZE) && (rec.word_size != prec->word_size))
-            continue;
-        else if ((wants & FATELF_WANT_BYTEORDER) && (rec.byte_order != prec->byte_order))
-            continue;
+        sha256_block(ctx, data);
+        data += 64;
+    } // while
+} // sha256_blocks_portable
 
-        if (retval != -1)
-            xfail("Ambiguous target '%s'", target);
-        retval = i;
-    } // for
 
-    return retval;
-} // xfind_fatelf_record_by_fields
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define FATELF_HAVE_SHA_NI 1
+// The SHA extensions (Goldmont, Ice Lake, Zen and later) do two rounds per
+//  instruction. The state has to be shuffled into ABEF/CDGH order first.
+__attribute__((target("sha,sse4.1")))
+static void sha256_blocks_shani(fatelf_sha256 *ctx, const uint8_t *data,
+                                size_t count)
+{
+    const __m128i bswap = _mm_set_epi8(12, 13, 14, 15, 8, 9, 10, 11,
+                                       4, 5, 6, 7, 0, 1, 2, 3);
+    __m128i tmp = _mm_loadu_si128((const __m128i *) &ctx->state[0]);
+    __m128i state1 = _mm_loadu_si128((const __m128i *) &ctx->state[4]);
+    __m128i state0;
+    int i;
 
+    tmp = _mm_shuffle_epi32(tmp, 0xB1);  // CDAB
+    state1 = _mm_shuffle_epi32(state1, 0x1B);  // EFGH
+    state0 = _mm_alignr_epi8(tmp, state1, 8);  // ABEF
+    state1 = _mm_blend_epi16(state1, tmp, 0xF0);  // CDGH
 
-int xfind_fatelf_record(const FATELF_header *header, const char *target)
-{
-    if (strncmp(target, "record", 6) == 0)
+    while (count--)
     {
-        char *endptr = NULL;
-        const long num = strtol(target+6, &endptr, 0);
-        if ((endptr != target+6) && (*endptr == '\0'))  // a numeric index?
+        const __m128i abef = state0;
+        const __m128i cdgh = state1;
+        __m128i w[4];
+
+        for (i = 0; i < 4; i++)
+            w[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (data + (i * 16))), bswap);
+
+        // Four rounds at a time; the schedule for four groups ahead is
+        //  built in the slot the current group just finished with.
+        for (i = 0; i < 16; i++)
         {
-            const long recs = (long) header->num_records;
-            if ((num < 0) || (num > recs))
+            __m128i msg = _mm_add_epi32(w[i & 3], _mm_loadu_si128((const __m128i *) &sha256_k[i * 4]));
+            state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+            msg = _mm_shuffle_epi32(msg, 0x0E);
+            state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+            if (i < 12)
             {
-                xfail("No record #%ld in FatELF header (max %d)",
-                      num, (int) recs);
+                __m128i next = _mm_sha256msg1_epu32(w[i & 3], w[(i + 1) & 3]);
+                next = _mm_add_epi32(next, _mm_alignr_epi8(w[(i + 3) & 3], w[(i + 2) & 3], 4));
+                w[i & 3] = _mm_sha256msg2_epu32(next, w[(i + 3) & 3]);
             } // if
-            return (int) num;
-        } // if
+        } // for
+
+        state0 = _mm_add_epi32(state0, abef);
+        state1 = _mm_add_epi32(state1, cdgh);
+        data += 64;
+    } // while
+
+    tmp = _mm_shuffle_epi32(state0, 0x1B);  // FEBA
+    state1 = _mm_shuffle_epi32(state1, 0xB1);  // DCHG
+    state0 = _mm_blend_epi16(tmp, state1, 0xF0);  // DCBA
+    state1 = _mm_alignr_epi8(state1, tmp, 8);  // HGFE
+    _mm_storeu_si128((__m128i *) &ctx->state[0], state0);
+    _mm_storeu_si128((__m128i *) &ctx->state[4], state1);
+} // sha256_blocks_shani
+
+
+static int have_sha_ni(void)
+{
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+        return 0;
+    else if ((ecx & ((1u << 9) | (1u << 19))) != ((1u << 9) | (1u << 19)))
+        return 0;  // needs SSSE3 and SSE4.1 too.
+    else if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+        return 0;
+    return (ebx & (1u << 29)) ? 1 : 0;
+} // have_sha_ni
+#endif
+
+typedef void (*sha256_blocks_fn)(fatelf_sha256 *ctx, const uint8_t *data,
+                                 size_t count);
+
+// Picked on first use. Threads may race to set it, but they all pick the
+//  same thing.
+static sha256_blocks_fn sha256_blocks = NULL;
+
+static sha256_blocks_fn get_sha256_blocks(void)
+{
+    if (sha256_blocks == NULL)
+    {
+        const char *env = getenv("FATELF_SHA256");
+        sha256_blocks_fn fn = sha256_blocks_portable;
+        #ifdef FATELF_HAVE_SHA_NI
+        if ( ((env == NULL) || (strcmp(env, "portable") != 0)) && (have_sha_ni()) )
+            fn = sha256_blocks_shani;
+        #else
+        (void) env;
+        #endif
+        sha256_blocks = fn;
     } // if
+    return sha256_blocks;
+} // get_sha256_blocks
 
-    return xfind_fatelf_record_by_fields(header, target);
-} // xfind_fatelf_record
+
+const char *fatelf_sha256_implementation(void)
+{
+    #ifdef FATELF_HAVE_SHA_NI
+    if (get_sha256_blocks() == sha256_blocks_shani)
+        return "sha-ni";
+    #endif
+    return "portable";
+} // fatelf_sha256_implementation
 
 
-int fatelf_record_matches(const FATELF_record *a, const FATELF_record *b)
+void fatelf_sha256_init(fatelf_sha256 *ctx)
 {
-    return ( (a->machine == b->machine) &&
-             (a->osabi == b->osabi) &&
-             (a->osabi_version == b->osabi_version) &&
-             (a->word_size == b->word_size) &&
-             (a->byte_order == b->byte_order) );
-} // fatelf_record_matches
+    static const uint32_t initial[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+    memcpy(ctx->state, initial, sizeof (initial));
+    ctx->total = 0;
+    ctx->buflen = 0;
+} // fatelf_sha256_init
 
 
-int find_furthest_record(const FATELF_header *header)
+void fatelf_sha256_update(fatelf_sha256 *ctx, const void *_data, size_t len)
 {
-    // there's nothing that says the records have to be in order, although
-    //  we probably _should_. Just in case, check them all.
-    const int total = (int) header->num_records;
-    uint64_t furthest = 0;
-    int retval = -1;
+    const uint8_t *data = (const uint8_t *) _data;
+
+    ctx->total += len;
+
+    if (ctx->buflen > 0)  // finish a partial block first.
+    {
+        const size_t cpy = minui64(len, sizeof (ctx->buf) - ctx->buflen);
+        memcpy(ctx->buf + ctx->buflen, data, cpy);
+        ctx->buflen += cpy;
+        data += cpy;
+        len -= cpy;
+        if (ctx->buflen < sizeof (ctx->buf))
+            return;
+        get_sha256_blocks()(ctx, ctx->buf, 1);
+        ctx->buflen = 0;
+    } // if
+
+    if (len >= sizeof (ctx->buf))
+    {
+        const size_t blocks = len / sizeof (ctx->buf);
+        get_sha256_blocks()(ctx, data, blocks);
+        data += blocks * sizeof (ctx->buf);
+        len -= blocks * sizeof (ctx->buf);
+    } // if
+
+    memcpy(ctx->buf, data, len);
+    ctx->buflen = len;
+} // fatelf_sha256_update
+
+
+void fatelf_sha256_final(fatelf_sha256 *ctx, uint8_t *digest)
+{
+    const uint64_t bits = ctx->total * 8;
+    uint8_t pad[72];
+    size_t padlen = ((ctx->buflen < 56) ? 56 : 120) - ctx->buflen;
     int i;
 
-    for (i = 0; i < total; i++)
+    memset(pad, '\0', sizeof (pad));
+    pad[0] = 0x80;
+    for (i = 0; i < 8; i++)
+        pad[padlen + i] = (uint8_t) (bits >> (56 - (i * 8)));
+    fatelf_sha256_update(ctx, pad, padlen + 8);
+    assert(ctx->buflen == 0);
+
+    for (i = 0; i < 8; i++)
     {
-        const FATELF_record *rec = &header->records[i];
-        const uint64_t edge = rec->offset + rec->size;
-        if (edge > furthest)
-        {
-            retval = i;
-            furthest = edge;
-        } // if
+        digest[i*4] = (uint8_t) (ctx->state[i] >> 24);
+        digest[i*4+1] = (uint8_t) (ctx->state[i] >> 16);
+        digest[i*4+2] = (uint8_t) (ctx->state[i] >> 8);
+        digest[i*4+3] = (uint8_t) (ctx->state[i]);
     } // for
-
-    return retval;
-} // find_furthest_record
+} // fatelf_sha256_final
 
 
-const char *fatelf_get_wordsize_string(const uint8_t wordsize)
+void xsha256_range(const char *fname, const int fd, const uint64_t offset,
+                   const uint64_t size, uint8_t *digest)
 {
-    if (wordsize == FATELF_32BITS)
-        return "32";
-    else if (wordsize == FATELF_64BITS)
-        return "64";
-    return "???";
-} // fatelf_get_wordsize_string
+    const size_t buflen = 256 * 1024;
+    uint8_t *buf = (uint8_t *) xmalloc(buflen);
+    uint64_t remaining = size;
+    uint64_t pos = offset;
+    fatelf_sha256 ctx;
+
+    fatelf_sha256_init(&ctx);
+    while (remaining > 0)
+    {
+        const size_t len = (size_t) minui64(remaining, buflen);
+        xpread(fname, fd, buf, len, pos);
+        fatelf_sha256_update(&ctx, buf, len);
+        remaining -= len;
+        pos += len;
+    } // while
 
+    fatelf_sha256_final(&ctx, digest);
+    free(buf);
+} // xsha256_range
 
-const char *fatelf_get_byteorder_name(const uint8_t byteorder)
+
+// Work out the stored levels of a record's tree: how many blocks each has,
+//  and where each starts in the tree. The top level comes first on disk,
+//  like fs-verity, so level (num_levels - 1) starts at block zero.
+static uint32_t merkle_levels(const uint64_t size, const uint8_t block_log2,
+                              uint64_t *level_blocks, uint64_t *level_start)
 {
-    if (byteorder == FATELF_LITTLEENDIAN)
-        return "Littleendian";
-    else if (byteorder == FATELF_BIGENDIAN)
-        return "Bigendian";
-    return "???";
-} // get_byteorder_name
+    const uint64_t hashes_per_block = (((uint64_t) 1) << block_log2) / FATELF_SHA256_SIZE;
+    uint64_t count = (size + ((((uint64_t) 1) << block_log2) - 1)) >> block_log2;
+    uint64_t total = 0;
+    uint32_t num_levels = 0;
+    int i;
 
+    while (count > 1)
+    {
+        assert(num_levels < FATELF_MERKLE_MAX_LEVELS);
+        count = (count + (hashes_per_block - 1)) / hashes_per_block;
+        level_blocks[num_levels++] = count;
+    } // while
 
-const char *fatelf_get_byteorder_target_name(const uint8_t byteorder)
+    for (i = ((int) num_levels) - 1; i >= 0; i--)
+    {
+        level_start[i] = total;
+        total += level_blocks[i];
+    } // for
+
+    return num_levels;
+} // merkle_levels
+
+
+uint64_t fatelf_merkle_tree_size(const uint64_t size, const uint8_t block_log2)
 {
-    if (byteorder == FATELF_LITTLEENDIAN)
-        return "le";
-    else if (byteorder == FATELF_BIGENDIAN)
-        return "be";
-    return NULL;
-} // fatelf_get_byteorder_target_name
+    uint64_t level_blocks[FATELF_MERKLE_MAX_LEVELS];
+    uint64_t level_start[FATELF_MERKLE_MAX_LEVELS];
+    const uint32_t num_levels = merkle_levels(size, block_log2, level_blocks, level_start);
+    if (num_levels == 0)
+        return 0;
+    return (level_start[0] + level_blocks[0]) << block_log2;
+} // fatelf_merkle_tree_size
+
+
+// Hash a block; a short last block hashes as if it were padded with zeros.
+static void merkle_hash_block(const uint8_t *data, const uint64_t len,
+                              const uint32_t block_size, uint8_t *hash)
+{
+    static const uint8_t zeros[256] = { 0 };
+    uint64_t pad = block_size - len;
+    fatelf_sha256 ctx;
+
+    fatelf_sha256_init(&ctx);
+    fatelf_sha256_update(&ctx, data, (size_t) len);
+    while (pad > 0)
+    {
+        const size_t count = (size_t) minui64(pad, sizeof (zeros));
+        fatelf_sha256_update(&ctx, zeros, count);
+        pad -= count;
+    } // while
+    fatelf_sha256_final(&ctx, hash);
+} // merkle_hash_block
 
 
-const char *fatelf_get_wordsize_target_name(const uint8_t wordsize)
+uint8_t *xbuild_merkle_tree(const char *fname, const int fd,
+                            const uint64_t offset, const uint64_t size,
+                            const uint8_t block_log2, uint8_t *root,
+                            uint64_t *treesize)
 {
-    if (wordsize == FATELF_32BITS)
-        return "32bits";
-    else if (wordsize == FATELF_64BITS)
-        return "64bits";
-    return NULL;
-} // fatelf_get_wordsize_target_name
+    const uint32_t block_size = ((uint32_t) 1) << block_log2;
+    const size_t buflen = 256 * 1024;
+    uint64_t level_blocks[FATELF_MERKLE_MAX_LEVELS];
+    uint64_t level_start[FATELF_MERKLE_MAX_LEVELS];
+    const uint32_t num_levels = merkle_levels(size, block_log2, level_blocks, level_start);
+    uint8_t *buf = NULL;
+    uint8_t *tree = NULL;
+    uint8_t *hashes = NULL;
+    uint64_t pos = 0;
+    uint64_t block = 0;
+    uint32_t level;
+
+    *treesize = (num_levels == 0) ? 0 : ((level_start[0] + level_blocks[0]) << block_log2);
+    tree = (uint8_t *) xmalloc((size_t) (*treesize ? *treesize : 1));
+    memset(tree, '\0', (size_t) *treesize);
+    memset(root, '\0', FATELF_SHA256_SIZE);
+
+    if (size == 0)
+        return tree;
+
+    // The leaves: one hash per block of the record.
+    buf = (uint8_t *) xmalloc(buflen);
+    hashes = tree + ((num_levels > 0) ? (level_start[0] << block_log2) : 0);
+    while (pos < size)
+    {
+        const size_t len = (size_t) minui64(size - pos, buflen);
+        size_t i;
+        xpread(fname, fd, buf, len, offset + pos);
+        for (i = 0; i < len; i += block_size, block++)
+        {
+            const uint64_t blocklen = minui64(len - i, block_size);
+            merkle_hash_block(buf + i, blocklen, block_size, (num_levels > 0) ? (hashes + (block * FATELF_SHA256_SIZE)) : root);
+        } // for
+        pos += len;
+    } // while
+    free(buf);
 
+    // Each level up hashes the blocks of the one below, until one is left.
+    for (level = 0; level < num_levels; level++)
+    {
+        const uint8_t *src = tree + (level_start[level] << block_log2);
+        uint8_t *dst = (level + 1 < num_levels) ? (tree + (level_start[level + 1] << block_log2)) : root;
+        uint64_t i;
+        for (i = 0; i < level_blocks[level]; i++)
+            merkle_hash_block(src + (i << block_log2), block_size, block_size, dst + (i * FATELF_SHA256_SIZE));
+    } // for
 
+    return tree;
+} // xbuild_merkle_tree
 
-const char *fatelf_get_target_name(const FATELF_record *rec, const int wants)
+
+fatelf_merkle_table *fatelf_read_merkle_table(const int fd,
+                                              const FATELF_header *header,
+                                              const uint64_t filesize,
+                                              const char **err)
 {
-    // !!! FIXME: this code is sort of stinky.
-    static char buffer[128];
-    const fatelf_osabi_info *osabi = get_osabi_by_id(rec->osabi);
-    const fatelf_machine_info *machine = get_machine_by_id(rec->machine);
-    const char *order = fatelf_get_byteorder_target_name(rec->byte_order);
-    const char *wordsize = fatelf_get_wordsize_target_name(rec->word_size);
+    const uint64_t start = fatelf_disk_header_size(header->version, header->num_records);
+    const uint64_t len = FATELF_MERKLE_TABLE_SIZE(header->num_records);
+    fatelf_merkle_table *table = NULL;
+    uint8_t *buf = NULL;
+    uint8_t *ptr = NULL;
+    uint32_t magic = 0, count = 0, reserved = 0;
+    uint16_t version = 0;
+    uint32_t i;
 
-    buffer[0] = '\0';
+    *err = NULL;
+    if ((header->version < FATELF_FORMAT_VERSION_2) || (!(header->flags & FATELF_FLAG_MERKLE)))
+        return NULL;
+    else if ((start > filesize) || (len > (filesize - start)) || (len > 0x7FFFFFFF))
+    {
+        *err = "has a truncated Merkle tree table";
+        return NULL;
+    } // else if
+    else if ((buf = (uint8_t *) malloc((size_t) len)) == NULL)
+    {
+        *err = "has too many records to read";
+        return NULL;
+    } // else if
+    else if (pread_all(fd, buf, (size_t) len, start) == -1)
+    {
+        free(buf);
+        *err = "couldn't be read";
+        return NULL;
+    } // else if
 
-    if ((wants & FATELF_WANT_MACHINE) && (machine))
+    table = (fatelf_merkle_table *) malloc(sizeof (fatelf_merkle_table) + (sizeof (fatelf_merkle_tree) * header->num_records));
+    if (table == NULL)
     {
-        if (buffer[0])
-            strcat(buffer, ":");
-        strcat(buffer, machine->name);
+        free(buf);
+        *err = "has too many records to read";
+        return NULL;
     } // if
 
-    if ((wants & FATELF_WANT_WORDSIZE) && (wordsize))
+    table->trees = (fatelf_merkle_tree *) (table + 1);
+    ptr = getui32(buf, &magic);
+    ptr = getui16(ptr, &version);
+    ptr = getui8(ptr, &table->hash_type);
+    ptr = getui8(ptr, &table->block_log2);
+    ptr = getui32(ptr, &count);
+    ptr = getui32(ptr, &reserved);
+    table->num_trees = count;
+
+    if (magic != FATELF_MERKLE_MAGIC)
+        *err = "has a corrupt Merkle tree table";
+    else if (version != FATELF_MERKLE_VERSION)
+        *err = "has an unsupported Merkle tree version";
+    else if (table->hash_type != FATELF_MERKLE_HASH_SHA256)
+        *err = "has an unsupported Merkle tree hash";
+    else if ( (table->block_log2 < FATELF_MERKLE_MIN_BLOCK_LOG2) ||
+              (table->block_log2 > FATELF_MERKLE_MAX_BLOCK_LOG2) ||
+              (count != header->num_records) || (reserved != 0) )
+        *err = "has a corrupt Merkle tree table";
+
+    // The trees go between the table and the records; they only have to be
+    //  the right size and in the file. fatelf-validate checks for overlap.
+    for (i = 0; (*err == NULL) && (i < count); i++)
     {
-        if (buffer[0])
-            strcat(buffer, ":");
-        strcat(buffer, wordsize);
-    } // if
+        fatelf_merkle_tree *tree = &table->trees[i];
+        uint64_t reserved64 = 0;
+        ptr = getui64(ptr, &tree->offset);
+        ptr = getui64(ptr, &tree->size);
+        memcpy(tree->root, ptr, FATELF_SHA256_SIZE);
+        ptr += FATELF_SHA256_SIZE;
+        ptr = getui64(ptr, &reserved64);
+
+        if ( (reserved64 != 0) ||
+             (tree->size != fatelf_merkle_tree_size(header->records[i].size, table->block_log2)) ||
+             ((tree->size > 0) && (tree->offset < (start + len))) ||
+             (tree->offset > filesize) || (tree->size > (filesize - tree->offset)) )
+            *err = "has a corrupt Merkle tree table";
+    } // for
 
-    if ((wants & FATELF_WANT_BYTEORDER) && (order))
+    free(buf);
+    if (*err != NULL)
     {
-        if (buffer[0])
-            strcat(buffer, ":");
-        strcat(buffer, order);
+        free(table);
+        return NULL;
     } // if
 
-    if ((wants & FATELF_WANT_OSABI) && (osabi))
+    return table;
+} // fatelf_read_merkle_table
+
+
+uint8_t *fatelf_encode_merkle_header(const FATELF_header *header,
+                                     const fatelf_merkle_table *table,
+                                     size_t *len)
+{
+    size_t hdrlen = 0;
+    uint8_t *buf = fatelf_encode_header(header, &hdrlen);
+    const size_t buflen = hdrlen + (size_t) FATELF_MERKLE_TABLE_SIZE(table->num_trees);
+    uint8_t *ptr = NULL;
+    uint32_t flags = 0;
+    uint32_t i;
+
+    assert(header->version >= FATELF_FORMAT_VERSION_2);
+    assert(table->num_trees == header->num_records);
+    for (i = 1; i < header->num_records; i++)
+        assert(fatelf_record_compare(&header->records[i-1], &header->records[i]) < 0);
+
+    buf = (uint8_t *) realloc(buf, buflen);
+    if (buf == NULL)
+        xfail("Out of memory!");
+
+    getui32(buf + 12, &flags);  // keep the aliases flag.
+    putui32(buf + 12, flags | FATELF_FLAG_MERKLE);
+
+    ptr = buf + hdrlen;
+    ptr = putui32(ptr, FATELF_MERKLE_MAGIC);
+    ptr = putui16(ptr, FATELF_MERKLE_VERSION);
+    ptr = putui8(ptr, table->hash_type);
+    ptr = putui8(ptr, table->block_log2);
+    ptr = putui32(ptr, table->num_trees);
+    ptr = putui32(ptr, 0);  // reserved
+    for (i = 0; i < table->num_trees; i++)
     {
-        if (buffer[0])
-            strcat(buffer, ":");
-        strcat(buffer, osabi->name);
+        const fatelf_merkle_tree *tree = &table->trees[i];
+        ptr = putui64(ptr, tree->offset);
+        ptr = putui64(ptr, tree->size);
+        memcpy(ptr, tree->root, FATELF_SHA256_SIZE);
+        ptr += FATELF_SHA256_SIZE;
+        ptr = putui64(ptr, 0);  // reserved
+    } // for
+
+    assert(ptr == (buf + buflen));
+    *len = buflen;
+    return buf;
+} // fatelf_encode_merkle_header
+
+
+fatelf_merkle_verifier *fatelf_open_merkle_verifier(const int fd,
+                                                    const FATELF_header *header,
+                                                    const uint64_t filesize,
+                                                    const int recidx,
+                                                    const char **err)
+{
+    fatelf_merkle_table *table = fatelf_read_merkle_table(fd, header, filesize, err);
+    uint64_t level_blocks[FATELF_MERKLE_MAX_LEVELS];
+    fatelf_merkle_verifier *verifier = NULL;
+    const fatelf_merkle_tree *tree = NULL;
+    uint32_t i;
+
+    if (table == NULL)
+        return NULL;
+
+    verifier = (fatelf_merkle_verifier *) calloc(1, sizeof (fatelf_merkle_verifier));
+    if (verifier == NULL)
+    {
+        free(table);
+        *err = "Out of memory";
+        return NULL;
     } // if
 
-    if (wants & FATELF_WANT_OSABIVER)
+    tree = &table->trees[recidx];
+    verifier->fd = fd;
+    verifier->rec_offset = header->records[recidx].offset;
+    verifier->rec_size = header->records[recidx].size;
+    verifier->tree_offset = tree->offset;
+    verifier->block_size = ((uint32_t) 1) << table->block_log2;
+    verifier->num_levels = merkle_levels(verifier->rec_size, table->block_log2,
+                                         level_blocks, verifier->level_start);
+    memcpy(verifier->root, tree->root, FATELF_SHA256_SIZE);
+    for (i = 0; i < FATELF_MERKLE_MAX_LEVELS; i++)
+        verifier->cached[i] = UINT64_MAX;
+    free(table);
+
+    verifier->cache = (uint8_t *) malloc(((size_t) verifier->block_size) * (verifier->num_levels + 1));
+    verifier->buf = (uint8_t *) malloc(((size_t) verifier->block_size) * 64);
+    if ((verifier->cache == NULL) || (verifier->buf == NULL))
     {
-        char tmp[32];
-        if (buffer[0])
-            strcat(buffer, ":");
-        snprintf(tmp, sizeof (tmp), "osabiver%d", (int) rec->osabi_version);
-        strcat(buffer, tmp);
+        fatelf_close_merkle_verifier(verifier);
+        *err = "Out of memory";
+        return NULL;
     } // if
 
-    return buffer;
-} // fatelf_get_target_name
+    return verifier;
+} // fatelf_open_merkle_verifier
 
 
-int xfind_junk(const char *fname, const int fd, const FATELF_header *header,
-               uint64_t *offset, uint64_t *size)
+void fatelf_close_merkle_verifier(fatelf_merkle_verifier *verifier)
 {
-    const int furthest = find_furthest_record(header);
+    if (verifier != NULL)
+    {
+        free(verifier->cache);
+        free(verifier->buf);
+        free(verifier);
+    } // if
+} // fatelf_close_merkle_verifier
 
-    if (furthest >= 0)  // presumably, we failed elsewhere, but oh well.
+
+// Check that (hash) is entry (idx) of tree level (level), verifying the
+//  tree block that holds it (and the ones above it) if it isn't cached.
+static const char *merkle_verify_hash(fatelf_merkle_verifier *verifier,
+                                      const uint32_t level, const uint64_t idx,
+                                      const uint8_t *hash)
+{
+    const uint64_t hashes_per_block = verifier->block_size / FATELF_SHA256_SIZE;
+    const uint64_t block = idx / hashes_per_block;
+    uint8_t *cached = verifier->cache + (((size_t) verifier->block_size) * level);
+
+    if (verifier->cached[level] != block)
     {
-        const uint64_t fsize = xget_file_size(fname, fd);
-        const FATELF_record *rec = &header->records[furthest];
-        const uint64_t edge = rec->offset + rec->size;
-        if (fsize > edge)
+        const uint64_t pos = verifier->tree_offset + ((verifier->level_start[level] + block) * verifier->block_size);
+        uint8_t blockhash[FATELF_SHA256_SIZE];
+        const char *err = NULL;
+
+        verifier->cached[level] = UINT64_MAX;  // until it checks out.
+        if (pread_all(verifier->fd, cached, verifier->block_size, pos) == -1)
+            return "couldn't read its Merkle tree";
+
+        merkle_hash_block(cached, verifier->block_size, verifier->block_size, blockhash);
+        if (level + 1 < verifier->num_levels)
         {
-            *offset = edge;
-            *size = fsize - edge;
-            return 1;
+            if ((err = merkle_verify_hash(verifier, level + 1, block, blockhash)) != NULL)
+                return err;
         } // if
+        else if ((block != 0) || (memcmp(blockhash, verifier->root, FATELF_SHA256_SIZE) != 0))
+            return "doesn't match its Merkle tree root";
+
+        verifier->cached[level] = block;
     } // if
 
-    return 0;
-} // xfind_junk
+    if (memcmp(cached + ((idx % hashes_per_block) * FATELF_SHA256_SIZE), hash, FATELF_SHA256_SIZE) != 0)
+        return "doesn't match its Merkle tree";
+    return NULL;
+} // merkle_verify_hash
 
 
-void xappend_junk(const char *fname, const int fd,
-                  const char *out, const int outfd,
-                  const FATELF_header *header)
+const char *fatelf_merkle_verify_data(fatelf_merkle_verifier *verifier,
+                                      const uint64_t offset,
+                                      const uint8_t *data, const uint64_t len)
 {
-    uint64_t offset, size;
-    if (xfind_junk(fname, fd, header, &offset, &size))
-        xcopyfile_range(fname, fd, out, outfd, offset, size);
-} // xappend_junk
+    const uint32_t block_size = verifier->block_size;
+    uint64_t pos = 0;
+
+    if ((offset % block_size) != 0)
+        return "was verified from the middle of a block";
+    else if ((offset > verifier->rec_size) || (len > (verifier->rec_size - offset)))
+        return "was verified past the end of the record";
+    else if (((len % block_size) != 0) && ((offset + len) != verifier->rec_size))
+        return "was verified up to the middle of a block";
+
+    while (pos < len)
+    {
+        const uint64_t blocklen = minui64(len - pos, block_size);
+        uint8_t hash[FATELF_SHA256_SIZE];
+        const char *err = NULL;
+
+        merkle_hash_block(data + pos, blocklen, block_size, hash);
+        if (verifier->num_levels == 0)
+        {
+            if (memcmp(hash, verifier->root, FATELF_SHA256_SIZE) != 0)
+                return "doesn't match its Merkle tree root";
+        } // if
+        else if ((err = merkle_verify_hash(verifier, 0, (offset + pos) / block_size, hash)) != NULL)
+            return err;
+        pos += blocklen;
+    } // while
+
+    return NULL;
+} // fatelf_merkle_verify_data
+
+
+const char *fatelf_merkle_verify_range(fatelf_merkle_verifier *verifier,
+                                       const uint64_t offset,
+                                       const uint64_t len)
+{
+    const uint64_t block_size = verifier->block_size;
+    const uint64_t buflen = block_size * 64;
+    uint64_t pos, end;
+
+    if ((offset > verifier->rec_size) || (len > (verifier->rec_size - offset)))
+        return "was verified past the end of the record";
+    else if (len == 0)
+        return NULL;
+
+    // Widen the range to whole blocks, then read and check them in chunks.
+    pos = offset - (offset % block_size);
+    end = minui64(((offset + len + (block_size - 1)) / block_size) * block_size, verifier->rec_size);
+    while (pos < end)
+    {
+        const uint64_t count = minui64(end - pos, buflen);
+        const char *err = NULL;
+        if (pread_all(verifier->fd, verifier->buf, (size_t) count, verifier->rec_offset + pos) == -1)
+            return "couldn't be read";
+        else if ((err = fatelf_merkle_verify_data(verifier, pos, verifier->buf, count)) != NULL)
+            return err;
+        pos += count;
+    } // while
+
+    return NULL;
+} // fatelf_merkle_verify_range
+
+
+void xcopyfile_verified(const char *in, const int infd, const char *out,
+                        const int outfd, fatelf_merkle_verifier *verifier)
+{
+    const uint64_t buflen = ((uint64_t) verifier->block_size) * 64;
+    uint64_t pos = 0;
+
+    while (pos < verifier->rec_size)
+    {
+        const uint64_t count = minui64(verifier->rec_size - pos, buflen);
+        const char *err = NULL;
+        xpread(in, infd, verifier->buf, (size_t) count, verifier->rec_offset + pos);
+        if ((err = fatelf_merkle_verify_data(verifier, pos, verifier->buf, count)) != NULL)
+            xfail("'%s' %s at offset %llu of its record", in, err, (unsigned long long) pos);
+        xwrite(out, outfd, verifier->buf, (size_t) count);
+        pos += count;
+    } // while
+} // xcopyfile_verified
 
 
-void xfatelf_init(int argc, const char **argv)
+// "512", "64K", "20M", "1G", etc. Returns zero on bad input.
+static uint64_t parse_byte_count(const char *str)
 {
+    char *endptr = NULL;
+    const unsigned long long num = strtoull(str, &endptr, 10);
+    if (endptr == str)
+        return 0;
+    else if ((*endptr == 'k') || (*endptr == 'K'))
+        return ((uint64_t) num) << 10;
+    else if ((*endptr == 'm') || (*endptr == 'M'))
+        return ((uint64_t) num) << 20;
+    else if ((*endptr == 'g') || (*endptr == 'G'))
+        return ((uint64_t) num) << 30;
+    else if (*endptr != '\0')
+        return 0;
+    return (uint64_t) num;
+} // parse_byte_count
+
+
+void xfatelf_init(int *argc, const char **argv)
+{
+    int i, j;
+
     memset(zerobuf, '\0', sizeof (zerobuf));  // just in case.
-    if ((argc >= 2) && (strcmp(argv[1], "--version") == 0))
+    if ((*argc >= 2) && (strcmp(argv[1], "--version") == 0))
     {
         printf("%s\n", fatelf_build_version);
         exit(0);
     } // if
+
+    // Pull out options every tool understands, so they can go anywhere.
+    for (i = j = 1; i < *argc; i++)
+    {
+        const char *arg = argv[i];
+        if (strcmp(arg, "--direct-io") == 0)
+            fatelf_copy_direct = 1;
+        else if (strcmp(arg, "--progress") == 0)
+            fatelf_copy_progress = 1;
+        else if (strncmp(arg, "--io-rate=", 10) == 0)
+        {
+            if ((fatelf_copy_rate_limit = parse_byte_count(arg + 10)) == 0)
+                xfail("Bad --io-rate value '%s'", arg + 10);
+        } // else if
+        else if (strcmp(arg, "--copy-engine=auto") == 0)
+            fatelf_copy_engine = FATELF_COPY_ENGINE_AUTO;
+        else if (strcmp(arg, "--copy-engine=kernel") == 0)
+            fatelf_copy_engine = FATELF_COPY_ENGINE_KERNEL;
+        else if (strcmp(arg, "--copy-engine=uring") == 0)
+            fatelf_copy_engine = FATELF_COPY_ENGINE_URING;
+        else if (strcmp(arg, "--copy-engine=threads") == 0)
+            fatelf_copy_engine = FATELF_COPY_ENGINE_THREADS;
+        else if (strcmp(arg, "--copy-engine=plain") == 0)
+            fatelf_copy_engine = FATELF_COPY_ENGINE_PLAIN;
+        else if (strncmp(arg, "--copy-engine=", 14) == 0)
+            xfail("Unknown --copy-engine '%s'", arg + 14);
+        else if (strncmp(arg, "--copy-depth=", 13) == 0)
+        {
+            char *endptr = NULL;
+            const long depth = strtol(arg + 13, &endptr, 10);
+            if ((endptr == arg + 13) || (*endptr != '\0') || (depth < 1) || (depth > PIPE_MAX_DEPTH))
+                xfail("Bad --copy-depth value '%s' (1 to %d)", arg + 13, PIPE_MAX_DEPTH);
+            fatelf_copy_depth = (int) depth;
+        } // else if
+        else if (strcmp(arg, "--stats") == 0)
+            fatelf_stats_mode = FATELF_STATS_TEXT;
+        else if (strcmp(arg, "--stats=json") == 0)
+            fatelf_stats_mode = FATELF_STATS_JSON;
+        else if (strncmp(arg, "--stats=", 8) == 0)
+            xfail("Unknown --stats format '%s'", arg + 8);
+        else
+            argv[j++] = arg;
+    } // for
+
+    argv[j] = NULL;
+    *argc = j;
+
+    if (fatelf_stats_mode != FATELF_STATS_OFF)
+    {
+        const char *ptr = strrchr(argv[0], '/');
+        stats_appname = ptr ? ptr + 1 : argv[0];
+        stats_start_time = stats_now();
+        atexit(dump_stats);
+    } // if
 } // xfatelf_init
 
 // end of fatelf-utils.c ...
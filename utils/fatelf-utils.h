@@ -31,11 +31,53 @@
 extern const char *unlink_on_xfail;
 extern const char *fatelf_build_version;
 
+// --stats instrumentation. This is set by xfatelf_init().
+#define FATELF_STATS_OFF 0
+#define FATELF_STATS_TEXT 1
+#define FATELF_STATS_JSON 2
+extern int fatelf_stats_mode;
+
+// Large-file copy mode, also set by xfatelf_init(). --direct-io reads with
+//  O_DIRECT (or drops what we read from the page cache, if the filesystem
+//  can't do that) and streams output to disk as we go, so huge copies don't
+//  flood the page cache. --io-rate=BYTES[K|M|G] caps the copy rate per
+//  second, and --progress reports on stderr about once a second.
+extern int fatelf_copy_direct;
+extern uint64_t fatelf_copy_rate_limit;
+extern int fatelf_copy_progress;
+
+// How copies are done, when --direct-io and friends aren't in play, set by
+//  --copy-engine=NAME in xfatelf_init(). "auto" lets the kernel copy if it
+//  can (copy_file_range()), and otherwise keeps --copy-depth=N buffers in
+//  flight, with io_uring if it works here, or a reader thread if not. The
+//  other names force one way, mostly for benchmarking: "kernel" is
+//  copy_file_range() or a plain loop, "uring" and "threads" skip the
+//  kernel copy, and "plain" is one buffer, read then write.
+#define FATELF_COPY_ENGINE_AUTO 0
+#define FATELF_COPY_ENGINE_KERNEL 1
+#define FATELF_COPY_ENGINE_URING 2
+#define FATELF_COPY_ENGINE_THREADS 3
+#define FATELF_COPY_ENGINE_PLAIN 4
+extern int fatelf_copy_engine;
+extern int fatelf_copy_depth;
+
+typedef enum fatelf_stats_phase
+{
+    FATELF_STATS_PHASE_OPEN,
+    FATELF_STATS_PHASE_HEADER_PARSE,
+    FATELF_STATS_PHASE_COPY,
+    FATELF_STATS_PHASE_PAD,
+    FATELF_STATS_PHASE_HEADER_WRITE,
+    FATELF_STATS_PHASE_FSYNC,
+    FATELF_STATS_PHASE_TOTAL
+} fatelf_stats_phase;
+
 #define FATELF_WANT_MACHINE   (1 << 0)
 #define FATELF_WANT_OSABI     (1 << 1)
 #define FATELF_WANT_OSABIVER  (1 << 2)
 #define FATELF_WANT_WORDSIZE  (1 << 3)
 #define FATELF_WANT_BYTEORDER (1 << 4)
+#define FATELF_WANT_ISALEVEL  (1 << 5)
 #define FATELF_WANT_EVERYTHING 0xFFFF
 
 typedef struct fatelf_machine_info
@@ -46,6 +88,15 @@ typedef struct fatelf_machine_info
 } fatelf_machine_info;
 
 
+typedef struct fatelf_isa_info
+{
+    uint16_t machine;
+    uint8_t level;
+    const char *name;
+    const char *desc;
+} fatelf_isa_info;
+
+
 typedef struct fatelf_osabi_info
 {
     uint8_t id;
@@ -54,6 +105,210 @@ typedef struct fatelf_osabi_info
 } fatelf_osabi_info;
 
 
+// The parts of an ELF header we care about, in native byte order.
+typedef struct fatelf_elf_header
+{
+    uint8_t word_size;  // FATELF_32BITS or FATELF_64BITS
+    uint8_t byte_order;  // FATELF_BIGENDIAN or FATELF_LITTLEENDIAN
+    uint8_t osabi;
+    uint8_t osabi_version;
+    uint16_t type;
+    uint16_t machine;
+    uint64_t entry;
+    uint64_t phoff;
+    uint64_t shoff;
+    uint16_t phentsize;
+    uint16_t phnum;
+    uint16_t shentsize;
+    uint16_t shnum;
+    uint16_t shstrndx;
+} fatelf_elf_header;
+
+// An Elf32_Shdr or Elf64_Shdr, in native byte order.
+typedef struct fatelf_elf_section
+{
+    uint32_t name;
+    uint32_t type;
+    uint64_t flags;
+    uint64_t addr;
+    uint64_t offset;
+    uint64_t size;
+    uint32_t link;
+    uint32_t info;
+    uint64_t addralign;
+    uint64_t entsize;
+} fatelf_elf_section;
+
+// An Elf32_Sym or Elf64_Sym, in native byte order.
+typedef struct fatelf_elf_symbol
+{
+    uint32_t name;
+    uint8_t info;
+    uint8_t other;
+    uint16_t shndx;
+    uint64_t value;
+    uint64_t size;
+} fatelf_elf_symbol;
+
+// SHA-256 state. Use fatelf_sha256_init/update/final.
+typedef struct fatelf_sha256
+{
+    uint32_t state[8];
+    uint64_t total;
+    uint8_t buf[64];
+    size_t buflen;
+} fatelf_sha256;
+
+#define FATELF_SHA256_SIZE 32
+
+// One entry in the resource table at the end of a FatELF file.
+typedef struct fatelf_resource
+{
+    const char *name;
+    uint64_t offset;     // from the start of the resource region.
+    uint64_t size;
+    uint32_t alignment;  // power of two, up to FATELF_RESOURCE_MAX_ALIGN.
+    uint8_t hash_type;   // FATELF_RESOURCE_HASH_*
+    uint8_t hash[FATELF_SHA256_SIZE];
+} fatelf_resource;
+
+// A resource table, in memory.
+typedef struct fatelf_resource_table
+{
+    uint64_t region_offset;  // where the resource region starts in the file.
+    uint64_t region_size;    // through the end of the trailer.
+    uint64_t table_offset;   // where the entries start, from region_offset.
+    uint32_t num_resources;
+    fatelf_resource *resources;  // sorted by name, when read from a file.
+} fatelf_resource_table;
+
+// A build-id index: NT_GNU_BUILD_ID -> file and record, sorted by build-id,
+//  written by fatelf-buildid. It's mmap()ed and binary searched, so lookups
+//  don't parse anything. Little endian: a header, the entries, the files,
+//  then the files' paths as null-terminated strings.
+#define FATELF_BUILD_ID_MAGIC "FATELFBI"
+#define FATELF_BUILD_ID_VERSION 1
+#define FATELF_BUILD_ID_MAX 32
+#define FATELF_BUILD_ID_HEADER_SIZE 64
+#define FATELF_BUILD_ID_ENTRY_SIZE 64
+#define FATELF_BUILD_ID_FILE_SIZE 32
+#define FATELF_BUILD_ID_NO_RECORD 0xFFFFFFFF  // a plain ELF file.
+
+typedef struct fatelf_build_id_entry
+{
+    uint8_t id[FATELF_BUILD_ID_MAX];  // zero padded.
+    uint8_t id_len;
+    uint32_t file;    // index into the files.
+    uint32_t record;  // or FATELF_BUILD_ID_NO_RECORD.
+    FATELF_record rec;  // target, offset and size; alignment is unused.
+} fatelf_build_id_entry;
+
+typedef struct fatelf_build_id_file
+{
+    const char *path;  // absolute.
+    int64_t mtime_sec;
+    uint32_t mtime_nsec;
+    uint64_t size;
+} fatelf_build_id_file;
+
+typedef struct fatelf_build_id_index
+{
+    const uint8_t *map;
+    uint64_t map_size;
+    uint32_t num_entries;
+    uint32_t num_files;
+    const uint8_t *entries;
+    const uint8_t *files;
+    const char *strings;
+    uint64_t strings_size;
+} fatelf_build_id_index;
+
+// One record's Merkle tree: fs-verity style, SHA-256 of each block of the
+//  record, then of each block of those hashes, up to a single root hash.
+typedef struct fatelf_merkle_tree
+{
+    uint64_t offset;  // from the start of the file.
+    uint64_t size;
+    uint8_t root[FATELF_SHA256_SIZE];
+} fatelf_merkle_tree;
+
+// The table of Merkle trees after a version 2 header with FATELF_FLAG_MERKLE.
+typedef struct fatelf_merkle_table
+{
+    uint8_t hash_type;   // FATELF_MERKLE_HASH_*
+    uint8_t block_log2;
+    uint32_t num_trees;  // one per record, in the header's order.
+    fatelf_merkle_tree *trees;
+} fatelf_merkle_table;
+
+#define FATELF_MERKLE_MAX_LEVELS 16  // enough for 2^64 bytes in 1K blocks.
+
+// Checks one record's data against its tree, a block at a time, reading
+//  tree blocks only as they're needed. The tree blocks it has verified
+//  stay cached (one per level), so walking a range in order reads each
+//  tree block once. Get one from fatelf_open_merkle_verifier().
+typedef struct fatelf_merkle_verifier
+{
+    int fd;
+    uint64_t rec_offset;
+    uint64_t rec_size;
+    uint64_t tree_offset;
+    uint32_t block_size;
+    uint32_t num_levels;  // zero if the record is one block or less.
+    uint64_t level_start[FATELF_MERKLE_MAX_LEVELS];  // in blocks, level 0 is the leaves.
+    uint64_t cached[FATELF_MERKLE_MAX_LEVELS];  // block in the cache, or UINT64_MAX.
+    uint8_t *cache;  // (num_levels) verified tree blocks.
+    uint8_t *buf;    // for data read by fatelf_merkle_verify_range().
+    uint8_t root[FATELF_SHA256_SIZE];
+} fatelf_merkle_verifier;
+
+// Writes a FatELF file a record at a time, each straight to its final place,
+//  for producers that already have their binaries in memory or in an fd.
+//  Room for the header is reserved at the start, and it's written into
+//  that room at the end, once every record's size is known. Get one from
+//  xfatelf_begin_writer().
+typedef struct fatelf_writer
+{
+    const char *fname;
+    int fd;
+    uint32_t capacity;  // records that fit in the room before the first.
+    uint64_t offset;    // end of what we've written so far.
+    int junk;           // nonzero once junk is written; nothing can follow.
+    char **names;       // for error messages.
+    FATELF_header *header;
+} fatelf_writer;
+
+// Pass this as a size to read an fd to its end, like a pipe.
+#define FATELF_WRITER_TO_EOF ((uint64_t) -1)
+
+#define FATELF_ELF_EHDR_SIZE(ws) (((ws) == FATELF_32BITS) ? 52 : 64)
+#define FATELF_ELF_SHDR_SIZE(ws) (((ws) == FATELF_32BITS) ? 40 : 64)
+#define FATELF_ELF_SYM_SIZE(ws) (((ws) == FATELF_32BITS) ? 16 : 24)
+
+// The few ELF constants we need, so we don't depend on the system's elf.h.
+#define FATELF_ET_REL 1
+#define FATELF_SHT_SYMTAB 2
+#define FATELF_SHT_NOBITS 8
+#define FATELF_SHT_DYNSYM 11
+#define FATELF_SHT_GNU_VERDEF 0x6FFFFFFD
+#define FATELF_SHT_GNU_VERNEED 0x6FFFFFFE
+#define FATELF_SHT_GNU_VERSYM 0x6FFFFFFF
+#define FATELF_SHN_UNDEF 0
+#define FATELF_SHN_COMMON 0xFFF2
+#define FATELF_STB_LOCAL 0
+#define FATELF_STB_GLOBAL 1
+#define FATELF_STB_WEAK 2
+#define FATELF_STB_GNU_UNIQUE 10
+#define FATELF_STT_SECTION 3
+#define FATELF_STT_FILE 4
+#define FATELF_ELF_ST_BIND(info) ((info) >> 4)
+#define FATELF_ELF_ST_TYPE(info) ((info) & 0xF)
+#define FATELF_ELF_ST_VISIBILITY(other) ((other) & 0x3)
+#define FATELF_STV_DEFAULT 0
+#define FATELF_STV_PROTECTED 3
+#define FATELF_VERSYM_HIDDEN 0x8000
+
+
 // all functions that start with 'x' may call exit() on error!
 
 // Report an error to stderr and terminate immediately with exit(1).
@@ -74,6 +329,7 @@ ssize_t xwrite(const char *fname, const int fd,
                const void *buf, const size_t len);
 void xclose(const char *fname, const int fd);
 void xlseek(const char *fname, const int fd, const off_t o, const int whence);
+void xfsync(const char *fname, const int fd);
 
 // This writes len null bytes to (fd).
 void xwrite_zeros(const char *fname, const int fd, size_t len);
@@ -87,6 +343,16 @@ void xcopyfile_range(const char *in, const int infd,
                      const char *out, const int outfd,
                      const uint64_t offset, const uint64_t size);
 
+// Share (size) bytes at (inoffset) in (infd) with (outfd) at (outoffset),
+//  without copying, on filesystems that can (btrfs, XFS, etc). Only whole,
+//  aligned blocks can be shared (plus the input's partial last block, if
+//  the range runs to its end), so this returns how many bytes it did,
+//  which may be zero, and the caller copies the rest. Neither file's
+//  position changes. Never fails.
+uint64_t fatelf_clone_range(const int infd, const uint64_t inoffset,
+                            const int outfd, const uint64_t outoffset,
+                            const uint64_t size);
+
 // get the length of an open file in bytes.
 uint64_t xget_file_size(const char *fname, const int fd);
 
@@ -94,8 +360,119 @@ uint64_t xget_file_size(const char *fname, const int fd);
 void xread_elf_header(const char *fname, const int fd, const uint64_t offset,
                       FATELF_record *rec);
 
+// Find the ISA level the ELF binary at (offset) says it needs, from its
+//  GNU property notes (GNU_PROPERTY_X86_ISA_1_NEEDED). Zero if it doesn't say.
+uint8_t xread_elf_isa_level(const char *fname, const int fd,
+                            const uint64_t offset);
+
+// read exactly len bytes at offset, without touching the file position.
+void xpread(const char *fname, const int fd, void *buf,
+            const size_t len, const uint64_t offset);
+
+// Parse a full ELF header from memory. Returns NULL on success, or a reason
+//  it failed ("is not an ELF binary", etc). This does not call exit().
+const char *fatelf_elf_decode_header(const uint8_t *buf, const size_t buflen,
+                                     fatelf_elf_header *hdr);
+
+// Parse one section header or symbol table entry from memory. (ptr) must
+//  have at least FATELF_ELF_SHDR_SIZE/FATELF_ELF_SYM_SIZE bytes.
+void fatelf_elf_decode_section(const fatelf_elf_header *hdr,
+                               const uint8_t *ptr, fatelf_elf_section *sec);
+void fatelf_elf_decode_symbol(const fatelf_elf_header *hdr,
+                              const uint8_t *ptr, fatelf_elf_symbol *sym);
+
+// Read a 16 or 32-bit value in an ELF binary's byte order.
+uint16_t fatelf_elf_get16(const fatelf_elf_header *hdr, const uint8_t *ptr);
+uint32_t fatelf_elf_get32(const fatelf_elf_header *hdr, const uint8_t *ptr);
+
+// read the full ELF header of the binary starting at (offset) in fd.
+void xread_elf_full_header(const char *fname, const int fd,
+                           const uint64_t offset, fatelf_elf_header *hdr);
+
+// read all the section headers of the ELF binary at (offset) in fd. Returns
+//  NULL if there aren't any. Don't forget to free() the returned pointer!
+fatelf_elf_section *xread_elf_sections(const char *fname, const int fd,
+                                       const uint64_t offset,
+                                       const fatelf_elf_header *hdr,
+                                       int *count);
+
+// read a section's contents into a new buffer, with an extra null byte on
+//  the end so string tables are safe. Don't forget to free() it!
+void *xread_elf_section_data(const char *fname, const int fd,
+                             const uint64_t offset,
+                             const fatelf_elf_section *sec);
+
 // How many bytes to allocate for a FATELF_header.
-size_t fatelf_header_size(const int bincount);
+size_t fatelf_header_size(const uint32_t bincount);
+
+// The oldest FatELF format version that can hold this header (more than 255
+//  records, or any ISA levels, need version 2). Tools write this unless told
+//  otherwise, since the system patches only know version 1.
+uint16_t fatelf_minimum_format_version(const FATELF_header *header);
+
+// How many bytes a FatELF header takes on disk, before padding.
+size_t fatelf_disk_header_size(const uint16_t version,
+                               const uint32_t bincount);
+
+// Compare two records by their target fields (machine, then word size, byte
+//  order, OSABI, OSABI version and ISA level), like strcmp(). This is the canonical
+//  order of version 2 records.
+int fatelf_record_compare(const FATELF_record *a, const FATELF_record *b);
+
+// Sort records in canonical order.
+void fatelf_sort_records(FATELF_record *records, const uint32_t count);
+
+// Records are aliases when they share the same data: the same offset and a
+//  nonzero size. This sets (owners[i]) to the lowest index of the records
+//  that share record i's data, which is (i) if it has it to itself, so
+//  copying records in order, each alias can reuse its owner's new offset.
+//  (skip) is a record to leave out, like one being removed or replaced, or
+//  -1; it owns itself. Returns how many records are aliases of another.
+uint32_t fatelf_find_aliases(const FATELF_header *header, const int skip,
+                             int *owners);
+
+// Does the ELF header (elfrec) belong in record (idx)? It has to match, but
+//  aliases can differ from their ELF header in OSABI and OSABI version.
+//  Callers set (elfrec)'s ISA level, which ELF headers don't have.
+int fatelf_record_fits_elf(const FATELF_header *header, const int idx,
+                           const FATELF_record *elfrec);
+
+// Call this with (owners) from fatelf_find_aliases(header, skip, ...) before
+//  record (skip) lets go of its data. Fails if that leaves another record
+//  alone with the data, but with an OSABI its ELF header doesn't have,
+//  since only aliases can differ from their ELF header like that.
+void xcheck_lone_aliases(const char *fname, const int fd,
+                         const FATELF_header *header, const int skip,
+                         const int *owners);
+
+// Find the record that fatelf_record_matches() (rec). -1 if there isn't one.
+//  This is a binary search for version 2 headers.
+int fatelf_find_matching_record(const FATELF_header *header,
+                                const FATELF_record *rec);
+
+// Serialize a FatELF header to its on-disk format. Returns a buffer that
+//  you must free(), and its size in (*len). This never sets
+//  FATELF_FLAG_MERKLE, since the trees it promises aren't in the buffer;
+//  tools that move records drop the trees this way, rather than leave
+//  stale ones. fatelf_encode_merkle_header() writes them. It sets
+//  FATELF_FLAG_ALIASES if, and only if, some records are aliases, which
+//  needs version 2 (fatelf_find_aliases()).
+uint8_t *fatelf_encode_header(const FATELF_header *header, size_t *len);
+
+// Look at the start of an on-disk FatELF header and report how many bytes
+//  the whole thing needs. Returns zero and sets (*err) on bad data. If
+//  (buflen) is too short to tell, this returns a larger size that will be
+//  enough to tell, so call it again once you have that much.
+size_t fatelf_decode_header_size(const uint8_t *buf, const size_t buflen,
+                                 const char **err);
+
+// Parse an on-disk FatELF header from memory. These don't call exit(), they
+//  return NULL and set (*err) to a reason ("is not a FatELF binary", etc).
+//  Headers in memory use the same in-memory layout for all versions. Version
+//  2 headers with unsorted records or unknown flags are refused, too.
+// don't forget to free() the returned pointer!
+FATELF_header *fatelf_decode_header(const uint8_t *buf, const size_t buflen,
+                                    const char **err);
 
 // Put FatELF header to disk. Will seek to 0 first.
 void xwrite_fatelf_header(const char *fname, const int fd,
@@ -105,18 +482,156 @@ void xwrite_fatelf_header(const char *fname, const int fd,
 // don't forget to free() the returned pointer!
 FATELF_header *xread_fatelf_header(const char *fname, const int fd);
 
+// Get the FatELF header of a file that sits (offset) bytes into fd and is
+//  (size) bytes long (a whole file, or a member of an archive), without
+//  calling exit() or moving the file position. Returns NULL and sets (*err)
+//  like fatelf_decode_header(), and also if a record doesn't fit in (size).
+// don't forget to free() the returned pointer!
+FATELF_header *fatelf_pread_header(const int fd, const uint64_t offset,
+                                   const uint64_t size, const char **err);
+
 // Locate non-FatELF data at the end of a FatELF file fd, based on
 //  header header. Returns non-zero if junk found, and fills in offset and
 //  size.
 int xfind_junk(const char *fname, const int fd, const FATELF_header *header,
                uint64_t *offset, uint64_t *size);
 
+// Nonzero if (trailer), the last FATELF_RESOURCE_TRAILER_SIZE bytes of
+//  some junk, says the junk ends in a resource table.
+int fatelf_is_resource_trailer(const uint8_t *trailer);
+
+// Nonzero if junk (as found by xfind_junk) in fd ends in a resource table.
+//  This doesn't call exit(); if the read fails, it returns zero.
+int fatelf_junk_has_resources(const int fd, const uint64_t offset,
+                              const uint64_t size);
+
+// How many zero bytes go in front of junk with a resource table that was
+//  at (offset) in its file, when it's written at (outpos), so it keeps the
+//  same offset within a page. Junk without one doesn't get any. Anything
+//  that lays out junk itself, rather than with xcopy_junk(), needs this.
+uint64_t fatelf_junk_padding(const uint64_t offset, const uint64_t outpos);
+
+// Copy junk (as found by xfind_junk) to the current position in outfd. If
+//  it has a resource table, this pads first, so it keeps the same offset
+//  within a page, and the resources stay aligned.
+void xcopy_junk(const char *fname, const int fd,
+                const char *out, const int outfd,
+                const uint64_t offset, const uint64_t size);
+
 // Write non-FatELF data at the end of FatELF file fd to current position in
-//  outfd, based on header header.
+//  outfd, based on header header, with xcopy_junk().
 void xappend_junk(const char *fname, const int fd,
                   const char *out, const int outfd,
                   const FATELF_header *header);
 
+// Start writing a FatELF file to fd, which must be open for reading and
+//  writing. This reserves room for a header of (reserve) records, but the
+//  header can hold as many records as fit before the first page boundary
+//  anyway, so (reserve) can be zero if you don't know how many there'll be.
+//  Fails if you write more records than that.
+fatelf_writer *xfatelf_begin_writer(const char *fname, const int fd,
+                                    const uint32_t reserve);
+
+// Write (size) bytes of (buf) as the next record, page-aligned. The record's
+//  target comes from its ELF header, and its ISA level from its notes,
+//  unless (isa) isn't -1. (name) is for error messages, like two records
+//  for the same target. Returns the record's index.
+uint32_t xfatelf_write_record(fatelf_writer *writer, const char *name,
+                              const void *buf, const uint64_t size,
+                              const int isa);
+
+// Like xfatelf_write_record(), but copies (size) bytes at (offset) in fd,
+//  without going through userspace where the filesystem allows it. With a
+//  (size) of FATELF_WRITER_TO_EOF, this reads fd from where it is to the
+//  end instead, so fd can be a pipe.
+uint32_t xfatelf_write_record_fd(fatelf_writer *writer, const char *name,
+                                 const int fd, const uint64_t offset,
+                                 const uint64_t size, const int isa);
+
+// Write junk after the last record. If it ends in a resource table, it
+//  starts on a page boundary, so the resources stay aligned. No records
+//  can follow.
+void xfatelf_write_junk(fatelf_writer *writer, const void *buf,
+                        const uint64_t size);
+
+// Like xfatelf_write_junk(), but copies junk from fd, with xcopy_junk().
+void xfatelf_write_junk_fd(fatelf_writer *writer, const char *name,
+                           const int fd, const uint64_t offset,
+                           const uint64_t size);
+
+// Write the header, with the lowest format version that holds the records,
+//  and free (writer). This doesn't close the fd.
+void xfatelf_finish_writer(fatelf_writer *writer);
+
+// Read the resource table at the end of fd, which is (filesize) bytes.
+//  Doesn't call exit(): returns NULL with (*err) set to NULL if there's no
+//  table, or to a reason if it's corrupt. The table and its names are one
+//  allocation, so free() the returned pointer when you're done.
+fatelf_resource_table *fatelf_read_resource_table(const int fd,
+                                                  const uint64_t filesize,
+                                                  const char **err);
+
+// Serialize the entries, names and trailer of a resource table, which go
+//  (table->table_offset) bytes into the resource region, after the data.
+//  The resources can be in any order. Returns a buffer that you must
+//  free(), and its size in (*len).
+uint8_t *fatelf_encode_resource_table(const fatelf_resource_table *table,
+                                      size_t *len);
+
+// Binary search a table for a resource. NULL if it's not there.
+const fatelf_resource *fatelf_find_resource(const fatelf_resource_table *table,
+                                            const char *name);
+
+// Map the resource called (name) in fd read-only, straight from the file,
+//  and put its size in (*size). If (verify) is non-zero and the resource
+//  has a hash, check it first. Doesn't call exit(): returns NULL and sets
+//  (*err) to a reason on failure. Unmap it with fatelf_unmap_resource().
+const void *fatelf_map_resource(const int fd, const char *name,
+                                const int verify, uint64_t *size,
+                                const char **err);
+void fatelf_unmap_resource(const void *ptr, const uint64_t size);
+
+// Find the NT_GNU_BUILD_ID note of the ELF object at (offset) in fd, which
+//  is (size) bytes, looking at PT_NOTE segments, then SHT_NOTE sections.
+//  (id) needs FATELF_BUILD_ID_MAX bytes. Doesn't call exit(): returns a
+//  reason if it's not a readable ELF object, else NULL with (*idlen) set
+//  to zero if there's no build-id.
+const char *fatelf_read_build_id(const int fd, const uint64_t offset,
+                                 const uint64_t size, uint8_t *id,
+                                 size_t *idlen);
+
+// Serialize the parts of a build-id index, into buffers of
+//  FATELF_BUILD_ID_HEADER_SIZE, _ENTRY_SIZE and _FILE_SIZE bytes. Entries
+//  must be written in fatelf_compare_build_id_entries() order.
+uint8_t *fatelf_encode_build_id_index_header(const uint32_t num_entries,
+                                             const uint32_t num_files,
+                                             const uint64_t strings_size,
+                                             uint8_t *buf);
+void fatelf_encode_build_id_entry(const fatelf_build_id_entry *entry,
+                                  uint8_t *buf);
+void fatelf_encode_build_id_file(const fatelf_build_id_file *file,
+                                 const uint64_t path_offset, uint8_t *buf);
+int fatelf_compare_build_id_entries(const fatelf_build_id_entry *a,
+                                    const fatelf_build_id_entry *b);
+
+// Map a build-id index. Doesn't call exit(): returns NULL and sets (*err)
+//  to a reason on failure.
+fatelf_build_id_index *fatelf_open_build_id_index(const char *fname,
+                                                  const char **err);
+void fatelf_close_build_id_index(fatelf_build_id_index *index);
+
+// Find the entries for a build-id: returns how many there are (the same
+//  build-id can be in more than one file), the first in (*first).
+uint32_t fatelf_lookup_build_id(const fatelf_build_id_index *index,
+                                const uint8_t *id, const size_t idlen,
+                                uint32_t *first);
+void fatelf_get_build_id_entry(const fatelf_build_id_index *index,
+                               const uint32_t idx,
+                               fatelf_build_id_entry *entry);
+// Zero if the file's path is corrupt.
+int fatelf_get_build_id_file(const fatelf_build_id_index *index,
+                             const uint32_t idx, fatelf_build_id_file *file);
+
 // Align a value to the page size.
 uint64_t align_to_page(const uint64_t offset);
 
@@ -127,6 +642,26 @@ const fatelf_machine_info *get_machine_by_id(const uint16_t id);
 const fatelf_machine_info *get_machine_by_name(const char *name);
 const fatelf_osabi_info *get_osabi_by_id(const uint8_t id);
 const fatelf_osabi_info *get_osabi_by_name(const char *name);
+const fatelf_isa_info *get_isa_by_level(const uint16_t machine,
+                                        const uint8_t level);
+const fatelf_isa_info *get_isa_by_name(const char *name);
+
+// Parse an ISA level name ("x86-64-v3", "armv8.2-a", "isa3", "baseline").
+//  Returns -1 if it's bogus.
+int fatelf_parse_isa_level(const char *str);
+
+// Fill in the machine, word size and byte order of the running system.
+//  Returns zero if this build doesn't know what machine it's on.
+int fatelf_get_host_record(FATELF_record *rec);
+
+// The highest ISA level the running CPU supports for (machine), from CPUID
+//  or AT_HWCAP. The FATELF_HOST_ISA_LEVEL environment variable overrides it.
+uint8_t fatelf_get_host_isa_level(const uint16_t machine);
+
+// Pick the record that runs best on this machine: among the records this
+//  CPU can run, the highest ISA level wins, then an exact OSABI over sysv.
+//  Returns -1 if nothing here can run. The target name "host" uses this.
+int fatelf_find_host_record(const FATELF_header *header);
 
 // Returns a string that can be used to target a specific record.
 const char *fatelf_get_target_name(const FATELF_record *rec, const int wants);
@@ -138,14 +673,117 @@ const char *fatelf_get_byteorder_target_name(const uint8_t byteorder);
 const char *fatelf_get_wordsize_target_name(const uint8_t wordsize);
 
 // Find the desired record in the FatELF header, based on a string in
-//  various formats.
+//  various formats. Returns -1 if no record matches the target, except
+//  that "host" with nothing that runs here fails.
 int xfind_fatelf_record(const FATELF_header *header, const char *target);
 
+// Same as xfind_fatelf_record(), but never fails: returns -2 and writes a
+//  message to (err) if the target can't be resolved at all (it's malformed,
+//  ambiguous, or "recordN" out of range), and -1 if no record matches,
+//  "host" included.
+int fatelf_find_record(const FATELF_header *header, const char *target,
+                       char *err, const size_t errlen);
+
 // non-zero if all pertinent fields in a match b.
 int fatelf_record_matches(const FATELF_record *a, const FATELF_record *b);
 
-// Call this at the start of main().
-void xfatelf_init(int argc, const char **argv);
+// Number of CPUs online, at least 1.
+int fatelf_cpu_count(void);
+
+// Call fn(data, i) for every i from 0 to count-1, spread across (threads)
+//  worker threads (zero or less means one per CPU). Returns when all are done.
+//  The x* functions are safe to use from (fn) as long as each thread uses its
+//  own file descriptors; xfail() from any thread still ends the process.
+void fatelf_parallel_for(const int count, int threads,
+                         void (*fn)(void *data, const int idx), void *data);
+
+// Plain SHA-256 (FIPS 180-4).
+void fatelf_sha256_init(fatelf_sha256 *ctx);
+void fatelf_sha256_update(fatelf_sha256 *ctx, const void *data, size_t len);
+void fatelf_sha256_final(fatelf_sha256 *ctx, uint8_t *digest);
+
+// Which SHA-256 code is in use: "sha-ni" where the CPU has the x86 SHA
+//  extensions, "portable" otherwise, or if FATELF_SHA256=portable is set.
+const char *fatelf_sha256_implementation(void);
+
+// SHA-256 of (size) bytes at (offset) in fd. Doesn't move the file position,
+//  so threads can share (fd). (digest) must hold FATELF_SHA256_SIZE bytes.
+void xsha256_range(const char *fname, const int fd, const uint64_t offset,
+                   const uint64_t size, uint8_t *digest);
+
+// Size of the Merkle tree for a record of (size) bytes, in blocks of
+//  (1 << block_log2) bytes. Zero if the record is a block or less: then the
+//  root is the hash of the one block, or all zeros for an empty record.
+uint64_t fatelf_merkle_tree_size(const uint64_t size, const uint8_t block_log2);
+
+// Build the Merkle tree for the (size) bytes at (offset) in fd, and put its
+//  root hash in (root). Doesn't move the file position, so threads can
+//  share (fd). Returns the tree, which you must free(), and its size in
+//  (*treesize); the tree is empty (but not NULL) for a single block.
+uint8_t *xbuild_merkle_tree(const char *fname, const int fd,
+                            const uint64_t offset, const uint64_t size,
+                            const uint8_t block_log2, uint8_t *root,
+                            uint64_t *treesize);
+
+// Read the Merkle tree table of a file of (filesize) bytes. Doesn't call
+//  exit(): returns NULL with (*err) set to NULL if the header doesn't have
+//  FATELF_FLAG_MERKLE, or to a reason if the table is corrupt. free() the
+//  returned pointer when you're done; the trees are in the same allocation.
+fatelf_merkle_table *fatelf_read_merkle_table(const int fd,
+                                              const FATELF_header *header,
+                                              const uint64_t filesize,
+                                              const char **err);
+
+// Serialize a version 2 header with FATELF_FLAG_MERKLE, followed by the
+//  tree table. The header's records must already be sorted, so the trees
+//  line up with them on disk. Returns a buffer that you must free(), and
+//  its size in (*len).
+uint8_t *fatelf_encode_merkle_header(const FATELF_header *header,
+                                     const fatelf_merkle_table *table,
+                                     size_t *len);
+
+// Set up to verify record (recidx) of fd against its Merkle tree. Doesn't
+//  call exit(): returns NULL with (*err) set to NULL if the file has no
+//  trees, or to a reason if they're corrupt. The fd must stay open while
+//  the verifier is in use.
+fatelf_merkle_verifier *fatelf_open_merkle_verifier(const int fd,
+                                                    const FATELF_header *header,
+                                                    const uint64_t filesize,
+                                                    const int recidx,
+                                                    const char **err);
+void fatelf_close_merkle_verifier(fatelf_merkle_verifier *verifier);
+
+// Verify (len) bytes at (offset) into the record, reading them and just
+//  enough of the tree from the file. Every block the range touches is
+//  checked. Returns NULL if it all matches, or a reason.
+const char *fatelf_merkle_verify_range(fatelf_merkle_verifier *verifier,
+                                       const uint64_t offset,
+                                       const uint64_t len);
+
+// Verify data you already read from the record, (len) bytes at (offset)
+//  into it. (offset) must be on a block boundary, and (len) a whole number
+//  of blocks unless it runs to the end of the record. Returns NULL if it
+//  all matches, or a reason.
+const char *fatelf_merkle_verify_data(fatelf_merkle_verifier *verifier,
+                                      const uint64_t offset,
+                                      const uint8_t *data, const uint64_t len);
+
+// Copy the verifier's whole record from infd to the current position of
+//  outfd, checking each block against the tree before it's written.
+void xcopyfile_verified(const char *in, const int infd, const char *out,
+                        const int outfd, fatelf_merkle_verifier *verifier);
+
+// Time a phase for --stats: pass fatelf_stats_begin()'s return value to
+//  fatelf_stats_end() when the phase is done. The x* I/O functions already
+//  do this for themselves. Both are nearly free when stats are disabled.
+uint64_t fatelf_stats_begin(void);
+void fatelf_stats_end(const fatelf_stats_phase phase, const uint64_t start,
+                      const uint64_t bytes);
+
+// Call this at the start of main(). This handles --version, and removes
+//  options that all tools share (like --stats[=json]) from argv, so check
+//  (*argc) after calling this.
+void xfatelf_init(int *argc, const char **argv);
 
 // end of fatelf-utils.h ...
 
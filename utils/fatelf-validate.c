@@ -9,6 +9,105 @@
 #define FATELF_UTILS 1
 #include "fatelf-utils.h"
 
+static int overlaps(const uint64_t a, const uint64_t alen,
+                    const uint64_t b, const uint64_t blen)
+{
+    return (alen > 0) && (blen > 0) && (a < (b + blen)) && (b < (a + alen));
+} // overlaps
+
+
+static int compare_record_data(const void *_a, const void *_b)
+{
+    const FATELF_record *a = *((const FATELF_record **) _a);
+    const FATELF_record *b = *((const FATELF_record **) _b);
+    if (a->offset != b->offset)
+        return (a->offset < b->offset) ? -1 : 1;
+    else if (a->size != b->size)
+        return (a->size < b->size) ? -1 : 1;
+    return 0;
+} // compare_record_data
+
+
+// Records can't overlap, unless they're aliases: exactly the same data,
+//  which needs FATELF_FLAG_ALIASES. Sorting by offset means we only have to
+//  check each record against the furthest-reaching one before it.
+static void validate_record_overlap(const FATELF_header *header)
+{
+    const uint32_t total = header->num_records;
+    const FATELF_record **sorted = (const FATELF_record **) xmalloc(sizeof (FATELF_record *) * (total + 1));
+    const FATELF_record *furthest = NULL;
+    uint32_t count = 0;
+    uint32_t aliases = 0;
+    uint32_t i;
+
+    // Records whose offset+size wraps get their own complaint below.
+    for (i = 0; i < total; i++)
+    {
+        const FATELF_record *rec = &header->records[i];
+        if ((rec->size > 0) && ((rec->offset + rec->size) > rec->offset))
+            sorted[count++] = rec;
+    } // for
+
+    qsort(sorted, count, sizeof (FATELF_record *), compare_record_data);
+
+    for (i = 0; i < count; i++)
+    {
+        const FATELF_record *rec = sorted[i];
+        if (furthest == NULL)
+            furthest = rec;
+        else if ((rec->offset == furthest->offset) && (rec->size == furthest->size))
+            aliases++;
+        else if (rec->offset < (furthest->offset + furthest->size))
+        {
+            xfail("Records #%d and #%d overlap",
+                  (int) (furthest - header->records), (int) (rec - header->records));
+        } // else if
+        else
+            furthest = rec;
+    } // for
+
+    free(sorted);
+
+    if ((aliases > 0) && (!(header->flags & FATELF_FLAG_ALIASES)))
+        xfail("Records share data, but the FatELF header doesn't allow aliases.");
+    else if ((aliases == 0) && (header->flags & FATELF_FLAG_ALIASES))
+        xfail("FatELF header allows aliases, but no records share data.");
+} // validate_record_overlap
+
+
+// The tree table has to be sane, and the trees can't overlap each other or
+//  any record. Checking the trees' contents means reading every record;
+//  that's what "fatelf-merkle verify" is for.
+static void validate_merkle_trees(const char *fname, const int fd,
+                                  const FATELF_header *header)
+{
+    const char *err = NULL;
+    fatelf_merkle_table *table = fatelf_read_merkle_table(fd, header, xget_file_size(fname, fd), &err);
+    uint32_t i, j;
+
+    if (table == NULL)
+        xfail("'%s' %s", fname, err);
+
+    for (i = 0; i < table->num_trees; i++)
+    {
+        const fatelf_merkle_tree *tree = &table->trees[i];
+        for (j = 0; j < header->num_records; j++)
+        {
+            const FATELF_record *rec = &header->records[j];
+            if (overlaps(tree->offset, tree->size, rec->offset, rec->size))
+                xfail("Merkle tree #%u overlaps record #%u", (unsigned int) i, (unsigned int) j);
+        } // for
+        for (j = 0; j < i; j++)
+        {
+            if (overlaps(tree->offset, tree->size, table->trees[j].offset, table->trees[j].size))
+                xfail("Merkle trees #%u and #%u overlap", (unsigned int) j, (unsigned int) i);
+        } // for
+    } // for
+
+    free(table);
+} // validate_merkle_trees
+
+
 static int fatelf_validate(const char *fname)
 {
     const int fd = xopen(fname, O_RDONLY, 0755);
@@ -18,13 +117,16 @@ static int fatelf_validate(const char *fname)
     if (header->reserved0 != 0)
         xfail("FatELF header reserved field isn't zero.");
 
+    // Whether records share data decides which ELF headers they can have.
+    validate_record_overlap(header);
+
     for (i = 0; i < ((int)header->num_records); i++)
     {
         const FATELF_record *rec = &header->records[i];
         FATELF_record elfrec;
 
-        if (rec->reserved0 != 0)
-            xfail("Reserved0 field is not zero in record #%d", i);
+        if ((header->version < FATELF_FORMAT_VERSION_2) && (rec->isa_level != 0))
+            xfail("ISA level needs FatELF version 2 in record #%d", i);
         else if (rec->reserved1 != 0)
             xfail("Reserved1 field is not zero in record #%d", i);
         else if (!get_machine_by_id(rec->machine))
@@ -49,13 +151,32 @@ static int fatelf_validate(const char *fname)
             xfail("32-bit binary past 4 gig limit in record #%d", i);
         } // else if
 
-        // !!! FIXME: check for overlap between records?
-
+        // The ISA level can be set by hand, but mustn't claim this binary
+        //  runs on less than its notes say it needs.
         xread_elf_header(fname, fd, rec->offset, &elfrec);
-        if (!fatelf_record_matches(rec, &elfrec))
+        elfrec.isa_level = rec->isa_level;
+        if (!fatelf_record_fits_elf(header, i, &elfrec))
             xfail("ELF header differs from FatELF data in record #%d", i);
+        else if (xread_elf_isa_level(fname, fd, rec->offset) > rec->isa_level)
+            xfail("ISA level is lower than the ELF notes need in record #%d", i);
     } // for
 
+    if (header->flags & FATELF_FLAG_MERKLE)
+        validate_merkle_trees(fname, fd, header);
+
+    if (header->num_records > 0)
+    {
+        const char *err = NULL;
+        const uint64_t size = xget_file_size(fname, fd);
+        const FATELF_record *rec = &header->records[find_furthest_record(header)];
+        fatelf_resource_table *table = fatelf_read_resource_table(fd, size, &err);
+        if (err != NULL)
+            xfail("'%s' %s", fname, err);
+        else if ((table != NULL) && (table->region_offset < (rec->offset + rec->size)))
+            xfail("Resource table overlaps record data");
+        free(table);
+    } // if
+
     xclose(fname, fd);
     free(header);
     return 0;  // success
@@ -64,7 +185,7 @@ static int fatelf_validate(const char *fname)
 
 int main(int argc, const char **argv)
 {
-    xfatelf_init(argc, argv);
+    xfatelf_init(&argc, argv);
     if (argc != 2)  // this could stand to use getopt(), later.
         xfail("USAGE: %s <in>", argv[0]);
     return fatelf_validate(argv[1]);
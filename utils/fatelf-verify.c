@@ -22,7 +22,7 @@ static int fatelf_verify(const char *fname, const char *target)
 
 int main(int argc, const char **argv)
 {
-    xfatelf_init(argc, argv);
+    xfatelf_init(&argc, argv);
     if (argc != 3)  // this could stand to use getopt(), later.
         xfail("USAGE: %s <in> <target>", argv[0]);
     return fatelf_verify(argv[1], argv[2]);
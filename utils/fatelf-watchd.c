@@ -0,0 +1,1188 @@
+/**
+ * FatELF; support multiple ELF binaries in one file.
+ *
+ * Please see the file LICENSE.txt in the source's root directory.
+ *
+ *  This file written by Ryan C. Gordon.
+ */
+
+// This keeps a thin tree (what fatelf-thin-tree makes) in sync with its
+//  source tree as the source changes. Every directory in the source is
+//  watched with inotify. A changed path waits until it has been quiet for a
+//  moment, so a burst of events (a build writing a file in pieces, a package
+//  manager unpacking) becomes one job. Then a worker thread re-derives just
+//  that path. The main thread only reads events and hands out jobs, so it
+//  never blocks on file data. Each new file is written under a temporary
+//  name and renamed into place, so readers of the thin tree never see half
+//  a file.
+//
+// Unlike the other tools, a daemon can't give up on the first bad file, so
+//  the workers report errors and carry on instead of calling xfail().
+
+#define _GNU_SOURCE 1  // for nftw().
+#define FATELF_UTILS 1
+#include "fatelf-utils.h"
+
+#include <ftw.h>
+#include <errno.h>
+#include <unistd.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define DEFAULT_DELAY_MS 200
+#define WATCH_MASK (IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | \
+                    IN_MOVED_TO | IN_ATTRIB | IN_ONLYDIR | IN_DONT_FOLLOW)
+
+typedef enum
+{
+    ENTRY_PENDING,  // waiting for events to stop.
+    ENTRY_QUEUED,   // waiting for a worker.
+    ENTRY_RUNNING   // a worker has it.
+} entry_state;
+
+// One path that needs syncing. It's in the hash table until it's done, and
+//  in the pending list or the work queue unless a worker has it.
+typedef struct sync_entry
+{
+    char *path;  // relative to the roots; "" is the roots themselves.
+    entry_state state;
+    int dirty;   // changed again while a worker had it.
+    uint64_t first_event;  // milliseconds, for lag.
+    uint64_t deadline;     // when a pending entry is quiet enough.
+    struct sync_entry *hash_next;
+    struct sync_entry *prev;
+    struct sync_entry *next;
+} sync_entry;
+
+typedef struct entry_list
+{
+    sync_entry *head;
+    sync_entry *tail;
+    int count;
+} entry_list;
+
+typedef enum
+{
+    SYNC_SKIPPED,  // already up to date.
+    SYNC_WRITTEN,
+    SYNC_REMOVED,
+    SYNC_FAILED
+} sync_result;
+
+typedef struct watchd
+{
+    const char *srcroot;
+    const char *dstroot;
+    const char *target;
+    const char *socketpath;
+    int delay_ms;
+    int verbose;
+    int is_root;
+    int inotifyfd;
+    char **wdpaths;  // relative directory for each watch descriptor.
+    int wdpaths_allocated;
+    int num_watches;
+    int num_workers;
+
+    // Everything below is shared with the workers; hold (lock) for it.
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    sync_entry **buckets;
+    uint32_t num_buckets;
+    uint32_t num_entries;
+    entry_list pending;  // sorted by deadline, since touching moves to the end.
+    entry_list queue;
+    int running;
+    int stopping;
+    uint64_t start_time;
+    uint64_t events;
+    uint64_t written;
+    uint64_t removed;
+    uint64_t skipped;
+    uint64_t errors;
+    uint64_t bytes;
+    uint64_t last_lag;
+    uint64_t max_lag;
+} watchd;
+
+static watchd w;  // nftw() doesn't pass a context pointer.
+
+
+static uint64_t now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (((uint64_t) ts.tv_sec) * 1000) + (((uint64_t) ts.tv_nsec) / 1000000);
+} // now_ms
+
+
+static char *make_path(const char *root, const char *path)
+{
+    const size_t len = strlen(root) + strlen(path) + 2;
+    char *retval = (char *) xmalloc(len);
+    snprintf(retval, len, "%s%s%s", root, (*path) ? "/" : "", path);
+    return retval;
+} // make_path
+
+
+static void report(const char *fmt, ...) FATELF_ISPRINTF(1,2);
+static void report(const char *fmt, ...)
+{
+    char buf[1024];
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(buf, sizeof (buf), fmt, ap);
+    va_end(ap);
+    fprintf(stderr, "fatelf-watchd: %s\n", buf);  // one write per line.
+} // report
+
+
+static void list_append(entry_list *list, sync_entry *entry)
+{
+    entry->prev = list->tail;
+    entry->next = NULL;
+    if (list->tail)
+        list->tail->next = entry;
+    else
+        list->head = entry;
+    list->tail = entry;
+    list->count++;
+} // list_append
+
+
+static void list_remove(entry_list *list, sync_entry *entry)
+{
+    if (entry->prev)
+        entry->prev->next = entry->next;
+    else
+        list->head = entry->next;
+    if (entry->next)
+        entry->next->prev = entry->prev;
+    else
+        list->tail = entry->prev;
+    entry->prev = entry->next = NULL;
+    list->count--;
+} // list_remove
+
+
+static uint32_t hash_path(const char *path)
+{
+    uint32_t hash = 2166136261u;  // FNV-1a
+    while (*path)
+        hash = (hash ^ (uint8_t) *(path++)) * 16777619u;
+    return hash;
+} // hash_path
+
+
+static void grow_buckets(void)
+{
+    const uint32_t count = w.num_buckets ? (w.num_buckets * 2) : 1024;
+    sync_entry **buckets = (sync_entry **) xmalloc(sizeof (sync_entry *) * count);
+    uint32_t i;
+
+    memset(buckets, '\0', sizeof (sync_entry *) * count);
+    for (i = 0; i < w.num_buckets; i++)
+    {
+        sync_entry *entry = w.buckets[i];
+        while (entry != NULL)
+        {
+            sync_entry *next = entry->hash_next;
+            const uint32_t idx = hash_path(entry->path) & (count - 1);
+            entry->hash_next = buckets[idx];
+            buckets[idx] = entry;
+            entry = next;
+        } // while
+    } // for
+
+    free(w.buckets);
+    w.buckets = buckets;
+    w.num_buckets = count;
+} // grow_buckets
+
+
+// Note a change to (path). Hold the lock for this.
+static void touch_locked(const char *path, const uint64_t now)
+{
+    sync_entry *entry = NULL;
+    uint32_t idx;
+
+    if (w.num_entries >= w.num_buckets)
+        grow_buckets();
+
+    idx = hash_path(path) & (w.num_buckets - 1);
+    for (entry = w.buckets[idx]; entry != NULL; entry = entry->hash_next)
+    {
+        if (strcmp(entry->path, path) == 0)
+            break;
+    } // for
+
+    if (entry == NULL)
+    {
+        entry = (sync_entry *) xmalloc(sizeof (sync_entry));
+        memset(entry, '\0', sizeof (*entry));
+        entry->path = xstrdup(path);
+        entry->state = ENTRY_PENDING;
+        entry->first_event = now;
+        entry->deadline = now + w.delay_ms;
+        entry->hash_next = w.buckets[idx];
+        w.buckets[idx] = entry;
+        w.num_entries++;
+        list_append(&w.pending, entry);
+    } // if
+    else if (entry->state == ENTRY_PENDING)  // still busy; wait longer.
+    {
+        entry->deadline = now + w.delay_ms;
+        list_remove(&w.pending, entry);
+        list_append(&w.pending, entry);
+    } // else if
+    else if (entry->state == ENTRY_RUNNING)
+        entry->dirty = 1;
+    // queued entries haven't been looked at yet, so they'll see this change.
+} // touch_locked
+
+
+static void touch(const char *path)
+{
+    pthread_mutex_lock(&w.lock);
+    touch_locked(path, now_ms());
+    pthread_mutex_unlock(&w.lock);
+} // touch
+
+
+static void forget_entry_locked(sync_entry *entry)
+{
+    const uint32_t idx = hash_path(entry->path) & (w.num_buckets - 1);
+    sync_entry **ptr = &w.buckets[idx];
+    while (*ptr != entry)
+        ptr = &(*ptr)->hash_next;
+    *ptr = entry->hash_next;
+    w.num_entries--;
+    free(entry->path);
+    free(entry);
+} // forget_entry_locked
+
+
+static void add_watch(const char *rel)
+{
+    char *fname = make_path(w.srcroot, rel);
+    const int wd = inotify_add_watch(w.inotifyfd, fname, WATCH_MASK);
+
+    if (wd == -1)
+    {
+        if (errno != ENOENT)  // gone already? Its parent will tell us.
+            report("Can't watch '%s': %s", fname, strerror(errno));
+        free(fname);
+        return;
+    } // if
+
+    if (wd >= w.wdpaths_allocated)
+    {
+        const int count = (wd + 1) * 2;
+        w.wdpaths = (char **) realloc(w.wdpaths, sizeof (char *) * count);
+        if (w.wdpaths == NULL)
+            xfail("Out of memory!");
+        memset(w.wdpaths + w.wdpaths_allocated, '\0', sizeof (char *) * (count - w.wdpaths_allocated));
+        w.wdpaths_allocated = count;
+    } // if
+
+    if (w.wdpaths[wd] == NULL)
+        w.num_watches++;
+    free(w.wdpaths[wd]);  // same directory under a new name, maybe.
+    w.wdpaths[wd] = xstrdup(rel);
+    free(fname);
+} // add_watch
+
+
+// A directory moved away: stop watching it and everything under it, since
+//  inotify follows the directory, not the name.
+static void remove_watches(const char *rel)
+{
+    const size_t len = strlen(rel);
+    int i;
+
+    for (i = 0; i < w.wdpaths_allocated; i++)
+    {
+        const char *path = w.wdpaths[i];
+        if ( (path != NULL) && (strncmp(path, rel, len) == 0) &&
+             ((path[len] == '\0') || (path[len] == '/')) )
+        {
+            inotify_rm_watch(w.inotifyfd, i);
+            free(w.wdpaths[i]);
+            w.wdpaths[i] = NULL;
+            w.num_watches--;
+        } // if
+    } // for
+} // remove_watches
+
+
+static const char *scan_root = NULL;  // for scan_callback().
+static int scan_watches = 0;
+
+
+static int scan_callback(const char *fname, const struct stat *statbuf,
+                         int typeflag, struct FTW *ftwbuf)
+{
+    const char *rel = fname + strlen(scan_root);
+
+    (void) ftwbuf;
+
+    while (*rel == '/')
+        rel++;
+
+    if ((typeflag == FTW_DNR) || (typeflag == FTW_NS))
+        return 0;  // vanished, probably; if not, its events will say so.
+    else if ((scan_watches) && (S_ISDIR(statbuf->st_mode)))
+        add_watch(rel);
+
+    touch(rel);
+    return 0;
+} // scan_callback
+
+
+// Watch (rel) in the source tree and everything under it, and look at all
+//  of it. Workers skip what's already up to date, so this is cheap.
+static void scan_source(const char *rel)
+{
+    char *fname = make_path(w.srcroot, rel);
+    scan_root = w.srcroot;
+    scan_watches = 1;
+    if ((nftw(fname, scan_callback, 32, FTW_PHYS) == -1) && (errno != ENOENT))
+        report("Failed to scan '%s': %s", fname, strerror(errno));
+    free(fname);
+} // scan_source
+
+
+// Everything in the thin tree gets looked at too, so things that are gone
+//  from the source go from the thin tree.
+static void scan_dest(void)
+{
+    scan_root = w.dstroot;
+    scan_watches = 0;
+    if ((nftw(w.dstroot, scan_callback, 32, FTW_PHYS) == -1) && (errno != ENOENT))
+        report("Failed to scan '%s': %s", w.dstroot, strerror(errno));
+} // scan_dest
+
+
+static int remove_callback(const char *fname, const struct stat *statbuf,
+                           int typeflag, struct FTW *ftwbuf)
+{
+    (void) statbuf;
+    (void) typeflag;
+    (void) ftwbuf;
+    if ((remove(fname) == -1) && (errno != ENOENT))
+        return -1;
+    return 0;
+} // remove_callback
+
+
+static int remove_tree(const char *fname)
+{
+    if ((nftw(fname, remove_callback, 16, FTW_DEPTH | FTW_PHYS) == -1) && (errno != ENOENT))
+        return -1;
+    return 0;
+} // remove_tree
+
+
+// Create the directories above (rel) in the thin tree, in case its
+//  directory's own job hasn't run yet. That job fixes up the permissions.
+static void make_parents(const char *rel)
+{
+    char *path = xstrdup(rel);
+    char *ptr;
+    for (ptr = strchr(path, '/'); ptr != NULL; ptr = strchr(ptr + 1, '/'))
+    {
+        char *fname;
+        *ptr = '\0';
+        fname = make_path(w.dstroot, path);
+        mkdir(fname, 0755);  // errors will show up when we write the file.
+        free(fname);
+        *ptr = '/';
+    } // for
+    free(path);
+} // make_parents
+
+
+static int put_range(const int fd, const uint64_t offset, const int outfd,
+                     const uint64_t outpos, const uint64_t size)
+{
+    uint8_t buf[128 * 1024];
+    uint64_t done = fatelf_clone_range(fd, offset, outfd, outpos, size);
+
+    while (done < size)
+    {
+        const size_t len = (size_t) (((size - done) < sizeof (buf)) ? (size - done) : sizeof (buf));
+        const ssize_t br = pread(fd, buf, len, (off_t) (offset + done));
+        ssize_t written = 0;
+        if ((br == -1) && (errno == EINTR))
+            continue;
+        else if (br <= 0)
+        {
+            if (br == 0)
+                errno = EIO;  // it shrank under us.
+            return -1;
+        } // else if
+
+        while (written < br)
+        {
+            const ssize_t bw = pwrite(outfd, buf + written, (size_t) (br - written),
+                                      (off_t) (outpos + done + written));
+            if ((bw == -1) && (errno == EINTR))
+                continue;
+            else if (bw == -1)
+                return -1;
+            written += bw;
+        } // while
+        done += (uint64_t) br;
+    } // while
+
+    return 0;
+} // put_range
+
+
+// Move a finished temp file (or symlink) over (out). If a directory is in
+//  the way, it's from an older version of the source tree, so it goes.
+static int replace_with(const char *tmp, const char *out)
+{
+    if (rename(tmp, out) == 0)
+        return 0;
+    else if ((errno == EISDIR) || (errno == ENOTEMPTY) || (errno == EEXIST))
+    {
+        if ((remove_tree(out) == 0) && (rename(tmp, out) == 0))
+            return 0;
+    } // else if
+    return -1;
+} // replace_with
+
+
+static int set_attributes(const char *fname, const int fd,
+                          const struct stat *statbuf)
+{
+    struct timespec times[2];
+
+    // owner first, since chown() can clear setuid bits. Ownership only
+    //  sticks for root, like fatelf-thin-tree.
+    if (w.is_root)
+    {
+        const int rc = (fd >= 0) ?
+            fchown(fd, statbuf->st_uid, statbuf->st_gid) :
+            lchown(fname, statbuf->st_uid, statbuf->st_gid);
+        if (rc == -1)
+            return -1;
+    } // if
+
+    if ((fd >= 0) && (fchmod(fd, statbuf->st_mode & 07777) == -1))
+        return -1;
+
+    times[0] = statbuf->st_atim;
+    times[1] = statbuf->st_mtim;
+    if (fd >= 0)
+        return futimens(fd, times);
+    return utimensat(AT_FDCWD, fname, times, AT_SYMLINK_NOFOLLOW);
+} // set_attributes
+
+
+static int up_to_date(const struct stat *src, const struct stat *dst)
+{
+    return ( ((src->st_mode & S_IFMT) == (dst->st_mode & S_IFMT)) &&
+             ((src->st_mode & 07777) == (dst->st_mode & 07777)) &&
+             (src->st_mtim.tv_sec == dst->st_mtim.tv_sec) &&
+             (src->st_mtim.tv_nsec == dst->st_mtim.tv_nsec) );
+} // up_to_date
+
+
+// Like fatelf-thin-tree: the record for our target and the junk, or the
+//  whole file if it isn't FatELF or has no such record.
+static sync_result sync_file(const char *fname, const char *out,
+                             uint64_t *bytes, char *err, const size_t errlen)
+{
+    const size_t tmplen = strlen(out) + 32;
+    char *tmp = (char *) xmalloc(tmplen);
+    FATELF_header *header = NULL;
+    const char *readerr = NULL;
+    struct stat statbuf;
+    struct stat outstat;
+    int fd = -1, outfd = -1;
+    int recidx = -1;
+    int rc = -1;
+
+    if ((fd = open(fname, O_RDONLY | O_NOFOLLOW)) == -1)
+    {
+        free(tmp);
+        if (errno == ENOENT)  // gone again; its own event will remove it.
+            return SYNC_SKIPPED;
+        snprintf(err, errlen, "%s", strerror(errno));
+        return SYNC_FAILED;
+    } // if
+    else if (fstat(fd, &statbuf) == -1)
+    {
+        snprintf(err, errlen, "%s", strerror(errno));
+        close(fd);
+        free(tmp);
+        return SYNC_FAILED;
+    } // else if
+    else if ((lstat(out, &outstat) == 0) && (up_to_date(&statbuf, &outstat)))
+    {
+        close(fd);
+        free(tmp);
+        return SYNC_SKIPPED;
+    } // else if
+
+    header = fatelf_pread_header(fd, 0, (uint64_t) statbuf.st_size, &readerr);
+    if ((header == NULL) && (strcmp(readerr, "is not a FatELF binary") != 0))
+    {
+        snprintf(err, errlen, "%s", readerr);
+        close(fd);
+        free(tmp);
+        return SYNC_FAILED;
+    } // if
+    else if ((header != NULL) && ((recidx = fatelf_find_record(header, w.target, err, errlen)) == -2))
+    {
+        free(header);
+        close(fd);
+        free(tmp);
+        return SYNC_FAILED;
+    } // else if
+
+    snprintf(tmp, tmplen, "%s.fatelf-watchd-XXXXXX", out);
+    if ((outfd = mkstemp(tmp)) == -1)
+    {
+        snprintf(err, errlen, "%s", strerror(errno));
+        free(header);
+        close(fd);
+        free(tmp);
+        return SYNC_FAILED;
+    } // if
+
+    if (recidx < 0)
+    {
+        if ((header != NULL) && (w.verbose))
+            report("No '%s' record in '%s'; copying it whole.", w.target, fname);
+        rc = put_range(fd, 0, outfd, 0, (uint64_t) statbuf.st_size);
+        *bytes = (uint64_t) statbuf.st_size;
+    } // if
+    else
+    {
+        const FATELF_record *rec = &header->records[recidx];
+        const FATELF_record *last = &header->records[find_furthest_record(header)];
+        const uint64_t edge = last->offset + last->size;
+        rc = put_range(fd, rec->offset, outfd, 0, rec->size);
+        *bytes = rec->size;
+        if ((rc == 0) && (((uint64_t) statbuf.st_size) > edge))  // junk.
+        {
+            rc = put_range(fd, edge, outfd, rec->size, statbuf.st_size - edge);
+            *bytes += statbuf.st_size - edge;
+        } // if
+    } // else
+
+    if ((rc == 0) && (set_attributes(tmp, outfd, &statbuf) == 0) &&
+        (close(outfd) == 0) && (replace_with(tmp, out) == 0))
+    {
+        free(header);
+        close(fd);
+        free(tmp);
+        return SYNC_WRITTEN;
+    } // if
+
+    snprintf(err, errlen, "%s", strerror(errno));
+    close(outfd);  // might already be closed; that's okay.
+    unlink(tmp);
+    free(header);
+    close(fd);
+    free(tmp);
+    return SYNC_FAILED;
+} // sync_file
+
+
+static sync_result sync_other(const char *fname, const char *out,
+                              const struct stat *statbuf, char *err,
+                              const size_t errlen)
+{
+    struct stat outstat;
+    const int exists = (lstat(out, &outstat) == 0);
+
+    if (S_ISDIR(statbuf->st_mode))
+    {
+        if ((exists) && (S_ISDIR(outstat.st_mode)) &&
+            ((outstat.st_mode & 07777) == (statbuf->st_mode & 07777)))
+            return SYNC_SKIPPED;
+        else if ((exists) && (!S_ISDIR(outstat.st_mode)))
+            unlink(out);
+        if ((mkdir(out, 0700) == -1) && (errno != EEXIST))
+        {
+            snprintf(err, errlen, "%s", strerror(errno));
+            return SYNC_FAILED;
+        } // if
+        // Directory timestamps change as they fill in, so don't bother.
+        if ( ((w.is_root) && (lchown(out, statbuf->st_uid, statbuf->st_gid) == -1)) ||
+             (chmod(out, statbuf->st_mode & 07777) == -1) )
+        {
+            snprintf(err, errlen, "%s", strerror(errno));
+            return SYNC_FAILED;
+        } // if
+        return SYNC_WRITTEN;
+    } // if
+
+    else if (S_ISLNK(statbuf->st_mode))
+    {
+        const size_t tmplen = strlen(out) + 32;
+        char *tmp = (char *) xmalloc(tmplen);
+        char target[PATH_MAX];
+        char existing[PATH_MAX];
+        const ssize_t len = readlink(fname, target, sizeof (target) - 1);
+        ssize_t outlen = -1;
+        int rc = -1;
+
+        if (len == -1)
+        {
+            free(tmp);
+            if (errno == ENOENT)
+                return SYNC_SKIPPED;
+            snprintf(err, errlen, "%s", strerror(errno));
+            return SYNC_FAILED;
+        } // if
+
+        target[len] = '\0';
+        if ((exists) && (S_ISLNK(outstat.st_mode)))
+            outlen = readlink(out, existing, sizeof (existing) - 1);
+        if ((outlen == len) && (memcmp(existing, target, (size_t) len) == 0))
+        {
+            free(tmp);
+            return SYNC_SKIPPED;
+        } // if
+
+        // symlink() won't replace anything, so make it aside and rename it.
+        snprintf(tmp, tmplen, "%s.fatelf-watchd-%d", out, (int) gettid());
+        unlink(tmp);
+        if (symlink(target, tmp) == 0)
+        {
+            rc = set_attributes(tmp, -1, statbuf);
+            if (rc == 0)
+                rc = replace_with(tmp, out);
+        } // if
+
+        if (rc == -1)
+        {
+            snprintf(err, errlen, "%s", strerror(errno));
+            unlink(tmp);
+        } // if
+
+        free(tmp);
+        return (rc == 0) ? SYNC_WRITTEN : SYNC_FAILED;
+    } // else if
+
+    // fifos, sockets, device nodes: like fatelf-thin-tree, needs root for
+    //  devices, and failing isn't an error.
+    if ((exists) && (up_to_date(statbuf, &outstat)))
+        return SYNC_SKIPPED;
+    remove_tree(out);
+    if (mknod(out, statbuf->st_mode, statbuf->st_rdev) == -1)
+    {
+        if (w.verbose)
+            report("Skipping '%s': %s", fname, strerror(errno));
+        return SYNC_SKIPPED;
+    } // if
+    set_attributes(out, -1, statbuf);
+    return SYNC_WRITTEN;
+} // sync_other
+
+
+static sync_result sync_path(const char *rel, uint64_t *bytes,
+                             char *err, const size_t errlen)
+{
+    char *fname = make_path(w.srcroot, rel);
+    char *out = make_path(w.dstroot, rel);
+    sync_result retval = SYNC_SKIPPED;
+    struct stat statbuf;
+    struct stat outstat;
+
+    *bytes = 0;
+
+    if (lstat(fname, &statbuf) == -1)
+    {
+        if (errno != ENOENT)
+        {
+            snprintf(err, errlen, "%s", strerror(errno));
+            retval = SYNC_FAILED;
+        } // if
+        else if (*rel == '\0')
+        {
+            snprintf(err, errlen, "source tree is gone; not removing the thin tree");
+            retval = SYNC_FAILED;
+        } // else if
+        else if (lstat(out, &outstat) == 0)
+        {
+            const int rc = S_ISDIR(outstat.st_mode) ? remove_tree(out) : unlink(out);
+            if ((rc == -1) && (errno != ENOENT))
+            {
+                snprintf(err, errlen, "%s", strerror(errno));
+                retval = SYNC_FAILED;
+            } // if
+            else
+                retval = SYNC_REMOVED;
+        } // else if
+    } // if
+
+    else
+    {
+        make_parents(rel);
+        if (S_ISREG(statbuf.st_mode))
+            retval = sync_file(fname, out, bytes, err, errlen);
+        else
+            retval = sync_other(fname, out, &statbuf, err, errlen);
+    } // else
+
+    free(out);
+    free(fname);
+    return retval;
+} // sync_path
+
+
+static void *worker_thread(void *unused)
+{
+    (void) unused;
+
+    pthread_mutex_lock(&w.lock);
+    while (1)
+    {
+        char err[256];
+        sync_entry *entry = NULL;
+        sync_result result;
+        uint64_t bytes = 0;
+
+        while ((!w.stopping) && (w.queue.head == NULL))
+            pthread_cond_wait(&w.cond, &w.lock);
+
+        if (w.stopping)
+            break;
+
+        entry = w.queue.head;
+        list_remove(&w.queue, entry);
+        entry->state = ENTRY_RUNNING;
+        w.running++;
+
+        // the path is ours while it's running; nothing else frees it.
+        pthread_mutex_unlock(&w.lock);
+        err[0] = '\0';
+        result = sync_path(entry->path, &bytes, err, sizeof (err));
+        if (result == SYNC_FAILED)
+            report("'%s': %s", entry->path, err);
+        else if ((w.verbose) && (result == SYNC_WRITTEN))
+            report("Synced '%s'", entry->path);
+        else if ((w.verbose) && (result == SYNC_REMOVED))
+            report("Removed '%s'", entry->path);
+        pthread_mutex_lock(&w.lock);
+
+        w.running--;
+        w.bytes += bytes;
+        if (result == SYNC_WRITTEN)
+            w.written++;
+        else if (result == SYNC_REMOVED)
+            w.removed++;
+        else if (result == SYNC_SKIPPED)
+            w.skipped++;
+        else
+            w.errors++;
+
+        if (result != SYNC_SKIPPED)
+        {
+            w.last_lag = now_ms() - entry->first_event;
+            if (w.last_lag > w.max_lag)
+                w.max_lag = w.last_lag;
+        } // if
+
+        if (entry->dirty)  // changed while we worked; go around again.
+        {
+            entry->dirty = 0;
+            entry->state = ENTRY_PENDING;
+            entry->deadline = now_ms() + w.delay_ms;
+            list_append(&w.pending, entry);
+        } // if
+        else
+            forget_entry_locked(entry);
+    } // while
+    pthread_mutex_unlock(&w.lock);
+
+    return NULL;
+} // worker_thread
+
+
+// Move pending paths that have been quiet long enough to the work queue,
+//  and return how many milliseconds until the next one will be (-1: none).
+static int dispatch(void)
+{
+    const uint64_t now = now_ms();
+    int retval = -1;
+    int woke = 0;
+
+    pthread_mutex_lock(&w.lock);
+    while ((w.pending.head != NULL) && (w.pending.head->deadline <= now))
+    {
+        sync_entry *entry = w.pending.head;
+        list_remove(&w.pending, entry);
+        entry->state = ENTRY_QUEUED;
+        list_append(&w.queue, entry);
+        woke = 1;
+    } // while
+
+    if (w.pending.head != NULL)
+        retval = (int) (w.pending.head->deadline - now);
+    if (woke)
+        pthread_cond_broadcast(&w.cond);
+    pthread_mutex_unlock(&w.lock);
+
+    return retval;
+} // dispatch
+
+
+static void handle_event(const struct inotify_event *ev)
+{
+    const char *dir = NULL;
+    char *rel = NULL;
+
+    if (ev->mask & IN_Q_OVERFLOW)
+    {
+        report("Missed some events; rescanning everything.");
+        scan_source("");
+        scan_dest();
+        return;
+    } // if
+    else if ((ev->wd < 0) || (ev->wd >= w.wdpaths_allocated))
+        return;
+    else if ((dir = w.wdpaths[ev->wd]) == NULL)
+        return;  // a watch we already dropped.
+    else if (ev->mask & IN_IGNORED)  // the directory is gone.
+    {
+        free(w.wdpaths[ev->wd]);
+        w.wdpaths[ev->wd] = NULL;
+        w.num_watches--;
+        return;
+    } // else if
+
+    pthread_mutex_lock(&w.lock);
+    w.events++;
+    pthread_mutex_unlock(&w.lock);
+
+    if (ev->len == 0)  // about the directory itself.
+    {
+        touch(dir);
+        return;
+    } // if
+
+    rel = (*dir) ? make_path(dir, ev->name) : xstrdup(ev->name);
+    if ((ev->mask & IN_ISDIR) && (ev->mask & IN_MOVED_FROM))
+        remove_watches(rel);
+
+    if ((ev->mask & IN_ISDIR) && (ev->mask & (IN_CREATE | IN_MOVED_TO)))
+        scan_source(rel);  // files may be in it before we watch it.
+    else
+        touch(rel);
+
+    free(rel);
+} // handle_event
+
+
+static void write_status(const int fd)
+{
+    const uint64_t now = now_ms();
+    uint64_t oldest = 0;
+    char buf[2048];
+    uint32_t i;
+    int len;
+
+    pthread_mutex_lock(&w.lock);
+    for (i = 0; i < w.num_buckets; i++)
+    {
+        const sync_entry *entry;
+        for (entry = w.buckets[i]; entry != NULL; entry = entry->hash_next)
+        {
+            if ((now - entry->first_event) > oldest)
+                oldest = now - entry->first_event;
+        } // for
+    } // for
+
+    len = snprintf(buf, sizeof (buf),
+        "source %s\n"
+        "destination %s\n"
+        "target %s\n"
+        "uptime_ms %llu\n"
+        "watches %d\n"
+        "workers %d\n"
+        "queue_depth %d\n"
+        "pending %d\n"
+        "queued %d\n"
+        "running %d\n"
+        "lag_ms %llu\n"
+        "last_lag_ms %llu\n"
+        "max_lag_ms %llu\n"
+        "events %llu\n"
+        "files_written %llu\n"
+        "files_removed %llu\n"
+        "files_skipped %llu\n"
+        "errors %llu\n"
+        "bytes_processed %llu\n",
+        w.srcroot, w.dstroot, w.target,
+        (unsigned long long) (now - w.start_time),
+        w.num_watches, w.num_workers,
+        w.pending.count + w.queue.count + w.running,
+        w.pending.count, w.queue.count, w.running,
+        (unsigned long long) oldest,
+        (unsigned long long) w.last_lag,
+        (unsigned long long) w.max_lag,
+        (unsigned long long) w.events,
+        (unsigned long long) w.written,
+        (unsigned long long) w.removed,
+        (unsigned long long) w.skipped,
+        (unsigned long long) w.errors,
+        (unsigned long long) w.bytes);
+    pthread_mutex_unlock(&w.lock);
+
+    if (len > (int) sizeof (buf))
+        len = (int) sizeof (buf);
+    send(fd, buf, (size_t) len, MSG_NOSIGNAL | MSG_DONTWAIT);  // best effort.
+} // write_status
+
+
+static int open_status_socket(const char *path)
+{
+    struct sockaddr_un addr;
+    const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+
+    if (fd == -1)
+        xfail("Failed to create socket: %s", strerror(errno));
+    else if (strlen(path) >= sizeof (addr.sun_path))
+        xfail("Socket path '%s' is too long", path);
+
+    memset(&addr, '\0', sizeof (addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    // A stale socket from a daemon that died can go; a live one can't.
+    if (connect(fd, (struct sockaddr *) &addr, sizeof (addr)) == 0)
+        xfail("Something is already listening on '%s'", path);
+    unlink(path);
+
+    if (bind(fd, (struct sockaddr *) &addr, sizeof (addr)) == -1)
+        xfail("Failed to bind '%s': %s", path, strerror(errno));
+    else if (listen(fd, 16) == -1)
+        xfail("Failed to listen on '%s': %s", path, strerror(errno));
+
+    return fd;
+} // open_status_socket
+
+
+static int fatelf_watchd_status(const char *path)
+{
+    struct sockaddr_un addr;
+    const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    char buf[4096];
+    ssize_t br;
+
+    if (fd == -1)
+        xfail("Failed to create socket: %s", strerror(errno));
+    else if (strlen(path) >= sizeof (addr.sun_path))
+        xfail("Socket path '%s' is too long", path);
+
+    memset(&addr, '\0', sizeof (addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    if (connect(fd, (struct sockaddr *) &addr, sizeof (addr)) == -1)
+        xfail("Failed to connect to '%s': %s", path, strerror(errno));
+
+    while ((br = xread(path, fd, buf, sizeof (buf), 0)) > 0)
+        fwrite(buf, (size_t) br, 1, stdout);
+
+    xclose(path, fd);
+    return 0;  // success.
+} // fatelf_watchd_status
+
+
+static int is_inside(const char *dir, const char *path)
+{
+    const size_t len = strlen(dir);
+    return ( (strncmp(dir, path, len) == 0) &&
+             ((path[len] == '/') || (path[len] == '\0')) );
+} // is_inside
+
+
+static int fatelf_watchd(const char *src, const char *dst)
+{
+    char realsrc[PATH_MAX];
+    char realdst[PATH_MAX];
+    struct epoll_event ev;
+    pthread_t *workers = NULL;
+    sigset_t sigs;
+    int epfd = -1, sigfd, listenfd = -1;
+    int i;
+
+    if (realpath(src, realsrc) == NULL)
+        xfail("Can't find '%s': %s", src, strerror(errno));
+    else if ((mkdir(dst, 0755) == -1) && (errno != EEXIST))
+        xfail("Failed to create '%s': %s", dst, strerror(errno));
+    else if (realpath(dst, realdst) == NULL)
+        xfail("Can't find '%s': %s", dst, strerror(errno));
+    else if ((is_inside(realsrc, realdst)) || (is_inside(realdst, realsrc)))
+        xfail("The source and thin trees can't be inside each other");
+
+    w.srcroot = src;
+    w.dstroot = dst;
+    w.is_root = (geteuid() == 0);
+    w.start_time = now_ms();
+    pthread_mutex_init(&w.lock, NULL);
+    pthread_cond_init(&w.cond, NULL);
+
+    // Block these everywhere, workers included, and take them from a
+    //  signalfd, so we can shut down cleanly.
+    sigemptyset(&sigs);
+    sigaddset(&sigs, SIGINT);
+    sigaddset(&sigs, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &sigs, NULL);
+    if ((sigfd = signalfd(-1, &sigs, SFD_CLOEXEC | SFD_NONBLOCK)) == -1)
+        xfail("Failed to create signalfd: %s", strerror(errno));
+
+    if ((w.inotifyfd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK)) == -1)
+        xfail("Failed to start inotify: %s", strerror(errno));
+    else if ((epfd = epoll_create1(EPOLL_CLOEXEC)) == -1)
+        xfail("Failed to create epoll: %s", strerror(errno));
+
+    if (w.socketpath != NULL)
+        listenfd = open_status_socket(w.socketpath);
+
+    memset(&ev, '\0', sizeof (ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = w.inotifyfd;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, w.inotifyfd, &ev);
+    ev.data.fd = sigfd;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, sigfd, &ev);
+    if (listenfd != -1)
+    {
+        ev.data.fd = listenfd;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, listenfd, &ev);
+    } // if
+
+    workers = (pthread_t *) xmalloc(sizeof (pthread_t) * w.num_workers);
+    for (i = 0; i < w.num_workers; i++)
+    {
+        const int rc = pthread_create(&workers[i], NULL, worker_thread, NULL);
+        if (rc != 0)
+            xfail("Failed to create thread: %s", strerror(rc));
+    } // for
+
+    // Watch before scanning, so nothing changes unseen in between.
+    scan_source("");
+    scan_dest();
+
+    report("Watching '%s' for '%s' into '%s'.", src, w.target, dst);
+
+    while (!w.stopping)
+    {
+        struct epoll_event events[8];
+        const int timeout = dispatch();
+        const int count = epoll_wait(epfd, events, 8, timeout);
+
+        if ((count == -1) && (errno != EINTR))
+            xfail("epoll_wait failed: %s", strerror(errno));
+
+        for (i = 0; i < count; i++)
+        {
+            const int fd = events[i].data.fd;
+            if (fd == w.inotifyfd)
+            {
+                uint8_t buf[64 * 1024] __attribute__((aligned(__alignof__(struct inotify_event))));
+                ssize_t br;
+                while ((br = read(w.inotifyfd, buf, sizeof (buf))) > 0)
+                {
+                    ssize_t pos = 0;
+                    while (pos < br)
+                    {
+                        const struct inotify_event *iev = (const struct inotify_event *) (buf + pos);
+                        handle_event(iev);
+                        pos += (ssize_t) (sizeof (struct inotify_event) + iev->len);
+                    } // while
+                } // while
+            } // if
+            else if (fd == listenfd)
+            {
+                int client;
+                while ((client = accept4(listenfd, NULL, NULL, SOCK_CLOEXEC)) != -1)
+                {
+                    write_status(client);
+                    close(client);
+                } // while
+            } // else if
+            else if (fd == sigfd)
+            {
+                pthread_mutex_lock(&w.lock);
+                w.stopping = 1;
+                pthread_cond_broadcast(&w.cond);
+                pthread_mutex_unlock(&w.lock);
+            } // else if
+        } // for
+    } // while
+
+    // Workers finish what they're doing; anything still waiting is left for
+    //  the scan when we start again.
+    for (i = 0; i < w.num_workers; i++)
+        pthread_join(workers[i], NULL);
+    free(workers);
+
+    if (listenfd != -1)
+    {
+        close(listenfd);
+        unlink(w.socketpath);
+    } // if
+
+    report("Stopped.");
+    return 0;  // success.
+} // fatelf_watchd
+
+
+int main(int argc, const char **argv)
+{
+    const char *usage = "USAGE: %s [--jobs=N] [--delay=MS] [--socket=PATH] [--verbose] <src> <dst> <target>\n"
+                        "       %s --status=PATH";
+    int i = 1;
+
+    xfatelf_init(&argc, argv);
+
+    w.delay_ms = DEFAULT_DELAY_MS;
+    w.num_workers = fatelf_cpu_count();
+
+    while ((i < argc) && (strncmp(argv[i], "--", 2) == 0))
+    {
+        if (strncmp(argv[i], "--jobs=", 7) == 0)
+            w.num_workers = atoi(argv[i] + 7);
+        else if (strncmp(argv[i], "--delay=", 8) == 0)
+            w.delay_ms = atoi(argv[i] + 8);
+        else if (strncmp(argv[i], "--socket=", 9) == 0)
+            w.socketpath = argv[i] + 9;
+        else if (strncmp(argv[i], "--status=", 9) == 0)
+        {
+            if (argc != 2)
+                xfail(usage, argv[0], argv[0]);
+            return fatelf_watchd_status(argv[i] + 9);
+        } // else if
+        else if (strcmp(argv[i], "--verbose") == 0)
+            w.verbose = 1;
+        else
+            xfail("Unknown option '%s'", argv[i]);
+        i++;
+    } // while
+
+    if (argc != i + 3)  // this could stand to use getopt(), later.
+        xfail(usage, argv[0], argv[0]);
+    else if ((w.num_workers < 1) || (w.delay_ms < 0))
+        xfail("--jobs must be at least 1, and --delay can't be negative");
+
+    w.target = argv[i + 2];
+    return fatelf_watchd(argv[i], argv[i + 1]);
+} // main
+
+// end of fatelf-watchd.c ...